@@ -0,0 +1,402 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "watomic.h"
+#include "req.h"
+#include "admctl.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#include <time.h>
+#endif
+
+/* token bucket of a source module, tokens are kept in millitokens so the
+   refill doesn't lose the fractions */
+typedef struct _admctl_bucket_t
+{
+	bool used;
+	char src[REQMODSIZE + 1];
+	uint64_t millitokens;
+	uint64_t last_ns;			/* last refill */
+	uint64_t seen_ns;			/* last request, the least recent is reclaimed */
+	int next;					/* next bucket of the hash chain, -1 if none */
+} admctl_bucket_t;
+
+/* this module variables */
+static bool loaded = false;
+static admctl_opt_t options;
+static wlock_t bucket_lock;
+static admctl_bucket_t buckets[ADMCTL_MAXSOURCES];
+static int bucket_heads[ADMCTL_MAXSOURCES];	/* hash chains, -1 if empty */
+static admctl_bucket_t newcomer_bucket;		/* tokens of the sources not in the table */
+static unsigned int bucket_count = 0;
+static bool shedding = false;
+static watomic_t pending = 0;
+static watomic_t admitted = 0;
+static watomic_t rejected_rate = 0;
+static watomic_t rejected_queue = 0;
+
+/*
+   _admctl_now_ns
+
+   Helper function that returns the monotonic clock in nanoseconds.
+*/
+static uint64_t
+_admctl_now_ns(void)
+{
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+	return (uint64_t)GetTickCount64() * 1000000ULL;
+#endif
+}
+
+/*
+   _admctl_bucket_refill
+
+   Helper function that adds the tokens earned since the last refill, rate
+   tokens per second up to burst.
+*/
+static void
+_admctl_bucket_refill(admctl_bucket_t *bucket,uint64_t now)
+{
+	uint64_t refill, burst = (uint64_t)options.burst * 1000;
+
+	/* rate tokens per second = rate millitokens per millisecond */
+	refill = (now - bucket->last_ns) / 1000000 * options.rate;
+	if( refill ) {
+		bucket->millitokens = bucket->millitokens + refill > burst ? burst : bucket->millitokens + refill;
+		bucket->last_ns += (refill / options.rate) * 1000000;
+	}
+}
+
+/*
+   _admctl_bucket_hash
+
+   Helper function that returns the hash chain of a source module name
+   (FNV-1a), up to REQMODSIZE chars.
+*/
+static unsigned int
+_admctl_bucket_hash(const char *src)
+{
+	uint32_t hash = 2166136261u;
+	unsigned int i;
+
+	for( i = 0 ; (i < REQMODSIZE) && src[i] ; i++ )
+		hash = (hash ^ (uint8_t)src[i]) * 16777619u;
+
+	return hash % ADMCTL_MAXSOURCES;
+}
+
+/*
+   _admctl_bucket_unlink
+
+   Helper function that takes a bucket out of its hash chain to reuse it.
+*/
+static void
+_admctl_bucket_unlink(int idx)
+{
+	int *link = &bucket_heads[_admctl_bucket_hash(buckets[idx].src)];
+
+	while( *link != idx )
+		link = &buckets[*link].next;
+	*link = buckets[idx].next;
+
+	buckets[idx].used = false;
+	bucket_count--;
+}
+
+/*
+   _admctl_bucket_find
+
+   Helper function that returns the bucket of a source module. A source not
+   in the table gets a bucket with up to burst / ADMCTL_NEWCOMER_SHARE tokens
+   taken from the newcomer bucket, shared by all of them: a new module starts
+   with a share of the burst and refills to the whole burst at its rate, but
+   changing the source name doesn't earn a fresh one, a module that floods
+   with new names is held to the rate of a single source. When the table is full the
+   bucket of the least recently seen source is reclaimed, each source keeps
+   its own bucket. Returns 0 when the newcomer bucket has no token left.
+   Must be called with bucket_lock acquired.
+*/
+static admctl_bucket_t *
+_admctl_bucket_find(const char *src,uint64_t now)
+{
+	unsigned int hash, i;
+	int idx, victim = -1;
+	uint64_t share;
+
+	hash = _admctl_bucket_hash(src);
+	for( idx = bucket_heads[hash] ; idx >= 0 ; idx = buckets[idx].next )
+	{
+		if( !strncmp(buckets[idx].src,src,REQMODSIZE) ) {
+			buckets[idx].seen_ns = now;
+			_admctl_bucket_refill(&buckets[idx],now);
+			return &buckets[idx];
+		}
+	}
+
+	_admctl_bucket_refill(&newcomer_bucket,now);
+	if( newcomer_bucket.millitokens < 1000 )
+		return 0;
+
+	for( i = 0 ; i < ADMCTL_MAXSOURCES ; i++ )
+	{
+		if( !buckets[i].used ) {
+			victim = (int)i;
+			break;
+		}
+		if( (victim < 0) || (buckets[i].seen_ns < buckets[victim].seen_ns) )
+			victim = (int)i;
+	}
+
+	if( buckets[victim].used ) {
+		dbgprint(MOD_ADMCTL,__func__,"reclaiming bucket of source module %s (idx=%d)",buckets[victim].src,victim);
+		_admctl_bucket_unlink(victim);
+	}
+
+	/* the tokens of the new bucket are taken from the newcomer bucket, at
+	   least one token so a burst below ADMCTL_NEWCOMER_SHARE still admits */
+	share = (uint64_t)options.burst * 1000 / ADMCTL_NEWCOMER_SHARE;
+	if( share < 1000 )
+		share = 1000;
+	if( share > newcomer_bucket.millitokens )
+		share = newcomer_bucket.millitokens;
+
+	memset(&buckets[victim],0,sizeof(admctl_bucket_t));
+	buckets[victim].used = true;
+	strncpy(buckets[victim].src,src,REQMODSIZE);
+	buckets[victim].src[REQMODSIZE] = '\0';
+	buckets[victim].millitokens = share;
+	newcomer_bucket.millitokens -= share;
+	buckets[victim].last_ns = now;
+	buckets[victim].seen_ns = now;
+	buckets[victim].next = bucket_heads[hash];
+	bucket_heads[hash] = victim;
+	bucket_count++;
+
+	dbgprint(MOD_ADMCTL,__func__,"new bucket for source module %s (idx=%d)",buckets[victim].src,victim);
+	return &buckets[victim];
+}
+
+/*
+   admctl_load
+
+   Initializes admission control with the given options (or the defaults if
+   opt is 0), called by modmgr_load.
+*/
+wstatus
+admctl_load(const admctl_opt_t *opt)
+{
+	wstatus ws;
+
+	dbgprint(MOD_ADMCTL,__func__,"called with opt=%p",opt);
+
+	if( loaded ) {
+		dbgprint(MOD_ADMCTL,__func__,"module was already loaded");
+		DBGRET_FAILURE(MOD_ADMCTL);
+	}
+
+	memset(&options,0,sizeof(options));
+	if( opt )
+		options = *opt;
+
+	if( !options.rate )
+		options.rate = ADMCTL_DEFAULT_RATE;
+	if( !options.burst )
+		options.burst = ADMCTL_DEFAULT_BURST;
+	if( !options.queue_high )
+		options.queue_high = ADMCTL_DEFAULT_QUEUE_HIGH;
+	if( !options.queue_low || (options.queue_low > options.queue_high) )
+		options.queue_low = options.queue_high / 2;
+
+	ws = wlock_create(&bucket_lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_ADMCTL,__func__,"failed to create lock (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_ADMCTL);
+	}
+
+	memset(buckets,0,sizeof(buckets));
+	memset(bucket_heads,0xFF,sizeof(bucket_heads));
+	memset(&newcomer_bucket,0,sizeof(newcomer_bucket));
+	newcomer_bucket.used = true;
+	newcomer_bucket.millitokens = (uint64_t)options.burst * 1000;
+	newcomer_bucket.last_ns = _admctl_now_ns();
+	bucket_count = 0;
+	shedding = false;
+	pending = admitted = rejected_rate = rejected_queue = 0;
+
+	dbgprint(MOD_ADMCTL,__func__,"admission control loaded (rate=%u, burst=%u, queue_high=%u, queue_low=%u)",
+			options.rate,options.burst,options.queue_high,options.queue_low);
+	loaded = true;
+	DBGRET_SUCCESS(MOD_ADMCTL);
+}
+
+/*
+   admctl_unload
+
+   Frees admission control resources, called by modmgr_unload.
+*/
+wstatus
+admctl_unload(void)
+{
+	dbgprint(MOD_ADMCTL,__func__,"called");
+
+	if( !loaded ) {
+		dbgprint(MOD_ADMCTL,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_ADMCTL);
+	}
+
+	dbgprint(MOD_ADMCTL,__func__,"admitted=%ld, rejected_rate=%ld, rejected_queue=%ld",
+			admitted,rejected_rate,rejected_queue);
+
+	wlock_free(&bucket_lock);
+	loaded = false;
+	DBGRET_SUCCESS(MOD_ADMCTL);
+}
+
+/*
+   admctl_admit
+
+   Decides if a request may enter modmgr, only the request header is needed.
+   When the request is admitted the queue depth is incremented and the caller
+   must call admctl_release once the request was processed. internal is set
+   by modmgr for the requests of its own fast channel, they're admitted
+   without limits, everything else (replies too) is charged to the bucket of
+   its source. This function is called for every request that arrives, it
+   doesn't log unless the request is rejected.
+*/
+wstatus
+admctl_admit(const req_header_t *header,bool internal,admctl_verdict_list *verdict)
+{
+	admctl_bucket_t *bucket;
+	uint64_t now, burst;
+	unsigned int depth;
+	admctl_verdict_list result = ADMCTL_ADMIT;
+
+	if( !header || !verdict )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	if( !loaded || internal )
+		goto admit;
+
+	burst = (uint64_t)options.burst * 1000;
+	now = _admctl_now_ns();
+	depth = (unsigned int)watomic_get(&pending);
+
+	wlock_acquire(&bucket_lock);
+
+	/* update the watermark state (hysteresis between queue_low and queue_high) */
+	if( !shedding && (depth >= options.queue_high) ) {
+		shedding = true;
+		dbgprint(MOD_ADMCTL,__func__,"queue depth reached %u, shedding load",depth);
+	} else if( shedding && (depth <= options.queue_low) ) {
+		shedding = false;
+		dbgprint(MOD_ADMCTL,__func__,"queue depth dropped to %u, stopped shedding",depth);
+	}
+
+	if( options.rate == ADMCTL_RATE_UNLIMITED ) {
+		if( shedding )
+			result = ADMCTL_REJECT_QUEUE;
+		wlock_release(&bucket_lock);
+		goto verdict;
+	}
+
+	bucket = _admctl_bucket_find(header->src,now);
+
+	if( !bucket || (bucket->millitokens < 1000) )
+		result = ADMCTL_REJECT_RATE;
+	else if( shedding && (bucket->millitokens < burst / 2) )
+		result = ADMCTL_REJECT_QUEUE;
+	else
+		bucket->millitokens -= 1000;
+
+	wlock_release(&bucket_lock);
+
+verdict:
+	if( result == ADMCTL_REJECT_RATE ) {
+		watomic_inc(&rejected_rate);
+		dbgprint(MOD_ADMCTL,__func__,"rejected request id %d from %s (%s)",header->id,header->src,admctl_verdict_str(result));
+		*verdict = result;
+		return WSTATUS_SUCCESS;
+	}
+
+	if( result == ADMCTL_REJECT_QUEUE ) {
+		watomic_inc(&rejected_queue);
+		dbgprint(MOD_ADMCTL,__func__,"rejected request id %d from %s (%s)",header->id,header->src,admctl_verdict_str(result));
+		*verdict = result;
+		return WSTATUS_SUCCESS;
+	}
+
+admit:
+	watomic_inc(&pending);
+	watomic_inc(&admitted);
+	*verdict = ADMCTL_ADMIT;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   admctl_release
+
+   Decrements the queue depth, called when an admitted request was processed.
+*/
+wstatus
+admctl_release(void)
+{
+	if( watomic_dec(&pending) < 0 ) {
+		watomic_inc(&pending);
+		dbgprint(MOD_ADMCTL,__func__,"release without admit, check the caller");
+		return WSTATUS_FAILURE;
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   admctl_status
+
+   Returns the admission counters, queue depth and shedding state.
+*/
+wstatus
+admctl_status(admctl_status_t *status)
+{
+	if( !status )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	status->admitted = (unsigned long)watomic_get(&admitted);
+	status->rejected_rate = (unsigned long)watomic_get(&rejected_rate);
+	status->rejected_queue = (unsigned long)watomic_get(&rejected_queue);
+	status->pending = (unsigned int)watomic_get(&pending);
+	status->sources = bucket_count;
+	status->shedding = shedding;
+	return WSTATUS_SUCCESS;
+}
+
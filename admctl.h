@@ -0,0 +1,110 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Admission control of the requests that enter modmgr. Without it every
+   request that arrives is buffered and queued, a misbehaving module flooding
+   modmgr makes the memory grow and the latency of every other module rise.
+
+   Requests are admitted or rejected from their header only (see
+   req_peek_header), before the rest of the request is parsed, so shedding a
+   flood is cheap. Rejected requests are answered by modmgr with a single
+   "busy" error reply.
+
+   Two limits are applied:
+
+   - Per source module token bucket: each source gets rate requests per
+     second with bursts up to burst requests. Sources above their rate are
+     rejected (ADMCTL_REJECT_RATE). The buckets of up to ADMCTL_MAXSOURCES
+     sources are kept, the least recently seen is reclaimed for a new one.
+     A new source takes its tokens from a newcomer bucket shared by all new
+     sources (rate and burst like the others), at most burst /
+     ADMCTL_NEWCOMER_SHARE of them, so a module that changes its source name
+     on every request doesn't earn a fresh burst each time and one unknown
+     source can't take the tokens of the next ones.
+
+   - Global queue watermark: requests admitted and not yet processed are
+     counted (admctl_admit / admctl_release). When the count reaches
+     queue_high modmgr starts shedding until it drops to queue_low, while
+     shedding only sources that still have at least half of their bucket
+     are admitted, so the modules that are bursting are shed first and the
+     well-behaved ones keep their latency (ADMCTL_REJECT_QUEUE).
+
+   Replies are charged to the bucket of their source like requests, the
+   source and type come from the sender and can't be trusted. Only the
+   requests that modmgr receives from inside the process (internal=true, its
+   fast channel) skip both limits.
+
+   Zero options select the defaults, rate ADMCTL_RATE_UNLIMITED disables the
+   token buckets.
+*/
+
+#ifndef _ADMCTL_H
+#define _ADMCTL_H
+
+#include <stdbool.h>
+#include "wstatus.h"
+#include "req.h"
+
+#define ADMCTL_MAXSOURCES 256
+#define ADMCTL_DEFAULT_RATE 1000
+#define ADMCTL_DEFAULT_BURST 200
+#define ADMCTL_DEFAULT_QUEUE_HIGH 1024
+#define ADMCTL_DEFAULT_QUEUE_LOW 512
+#define ADMCTL_RATE_UNLIMITED (~0u)
+#define ADMCTL_NEWCOMER_SHARE 8
+
+typedef struct _admctl_opt_t
+{
+	unsigned int rate;			/* requests per second per source */
+	unsigned int burst;			/* bucket depth */
+	unsigned int queue_high;	/* start shedding at this queue depth */
+	unsigned int queue_low;		/* stop shedding at this queue depth */
+} admctl_opt_t;
+
+typedef enum _admctl_verdict_list
+{
+	ADMCTL_ADMIT,
+	ADMCTL_REJECT_RATE,
+	ADMCTL_REJECT_QUEUE
+} admctl_verdict_list;
+
+#define admctl_verdict_str(x) ( x == ADMCTL_ADMIT ? "admitted" : \
+		x == ADMCTL_REJECT_RATE ? "source over rate" : "queue over watermark" )
+
+typedef struct _admctl_status_t
+{
+	unsigned long admitted;
+	unsigned long rejected_rate;
+	unsigned long rejected_queue;
+	unsigned int pending;
+	unsigned int sources;
+	bool shedding;
+} admctl_status_t;
+
+wstatus admctl_load(const admctl_opt_t *opt);
+wstatus admctl_unload(void);
+wstatus admctl_admit(const req_header_t *header,bool internal,admctl_verdict_list *verdict);
+wstatus admctl_release(void);
+wstatus admctl_status(admctl_status_t *status);
+
+#endif
+
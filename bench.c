@@ -0,0 +1,1165 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   wicombench - request stack microbenchmarks
+
+   Repeatable microbenchmarks of the functions in the request path (parsing,
+   conversion, nvpair lookup, encoding, reqbuf, wchannel and the modmgr peer
+   links). Each benchmark
+   is calibrated to run for at least the minimum time, then measured a few
+   times. Results are printed to stdout as JSON lines, one object per
+   benchmark, so builds can be compared with any script:
+
+   {"bench":"req_to_bin","iterations":65536,"runs":5,"ns_per_op":812.4,
+    "ns_per_op_min":790.1,"allocs_per_op":5.00,"bytes_per_op":1530.00}
+
+   ns_per_op is the median of the runs. Allocations are counted when the
+   binary is linked with -Wl,--wrap=malloc,... and built with BENCH_ALLOC_WRAP
+   (see Makefile, "make bench"), otherwise they're reported as null. Only
+   allocations made by wicom code are counted (not the ones made inside libc).
+
+   Debug messages are disabled while benchmarking (debug_set_mask).
+
+   Usage: wicombench [-t min_ms] [-r runs] [-l] [name_filter ...]
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wstatus.h"
+#include "debug.h"
+#include "jmlist.h"
+#include "nvpair.h"
+#include "req.h"
+#include "reqbuf.h"
+#include "wchannel.h"
+#include "wloop.h"
+#include "modpeer.h"
+#include "modcast.h"
+#include "shmring.h"
+
+#define BENCH_DEFAULT_MINTIME_MS 200
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_MAXRUNS 32
+#define BENCH_MAXITERATIONS (1UL << 30)
+
+#define BENCH_REQ_TEXT "123 modFrom modTo reqCode name1=value1 name2=\"value2 with spaces\" " \
+						"name3=#6566672A686970 sid=42"
+#define BENCH_UDP_PORT "48790"
+#define BENCH_BATCH_SIZE 32
+#define BENCH_RING_SIZE 4096
+#define BENCH_RELIABLE_LOSS 5		/* percent of the datagrams dropped */
+#define BENCH_BULK_DATA 700			/* bytes of the data of a bulk request, hex encoded */
+#define BENCH_PEER_PORT_A "48791"
+#define BENCH_PEER_PORT_B "48792"
+#define BENCH_REPLY_TEXT "123r modTo modFrom reqCode status=ok"
+#define BENCH_MCAST_GROUP "239.255.42.1"
+#define BENCH_MCAST_PORT "48793"		/* of the group */
+#define BENCH_MCAST_PORT_S "48794"		/* of the sender */
+#define BENCH_MCAST_MEMBERS 2
+
+typedef wstatus (*BENCHFUNC)(void);
+
+typedef struct _bench_t
+{
+	const char *name;
+	BENCHFUNC setup;		/* optional */
+	BENCHFUNC op;			/* one operation */
+	BENCHFUNC teardown;		/* optional */
+} bench_t;
+
+/* allocation counters */
+
+static unsigned long long bench_allocs = 0;
+static unsigned long long bench_alloc_bytes = 0;
+
+#ifdef BENCH_ALLOC_WRAP
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb,size_t size);
+void *__real_realloc(void *ptr,size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+	bench_allocs++;
+	bench_alloc_bytes += size;
+	return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb,size_t size)
+{
+	bench_allocs++;
+	bench_alloc_bytes += nmemb*size;
+	return __real_calloc(nmemb,size);
+}
+
+void *
+__wrap_realloc(void *ptr,size_t size)
+{
+	bench_allocs++;
+	bench_alloc_bytes += size;
+	return __real_realloc(ptr,size);
+}
+#endif
+
+/* benchmark state, created by the setup functions */
+
+static request_t bench_text = 0;
+static request_t bench_bin = 0;
+static char bench_value[64];
+static char *bench_encoded = 0;
+static unsigned int bench_decoded_size = 0;
+static reqbuf_t bench_rb = 0;
+static unsigned int bench_rb_offset = 0;
+static char bench_rb_stream[512];
+static unsigned int bench_rb_stream_size = 0;
+static wchannel_t bench_wch = 0;
+extern wstatus reqbuf_wchannel_read_cb(void *param,void *chunk_ptr,unsigned int chunk_size,unsigned int *chunk_used);
+extern wstatus reqbuf_wchannel_peek_cb(void *param,void **chunk_ptr,unsigned int *chunk_used,unsigned int *chunk_id);
+extern wstatus reqbuf_wchannel_done_cb(void *param,unsigned int chunk_id);
+static wchannel_msg_t bench_batch_list[BENCH_BATCH_SIZE];
+static char bench_bulk_text[64 + 2 * BENCH_BULK_DATA];
+static wloop_t bench_wloop = 0;
+static wchannel_t bench_pipe = 0;
+static unsigned int bench_wloop_received = 0;
+
+static modpeer_t bench_peer_a = 0;
+static modpeer_t bench_peer_b = 0;
+static wchannel_t bench_peer_wch_a = 0;
+static wchannel_t bench_peer_wch_b = 0;
+static reqbuf_t bench_peer_rb_a = 0;
+static reqbuf_t bench_peer_rb_b = 0;
+static wchannel_t bench_mcast_wch = 0;
+static wchannel_t bench_member_wch[BENCH_MCAST_MEMBERS];
+static modcast_t bench_cast = 0;
+static int bench_mcast_id = 0;
+static shmring_t bench_ring_mgr = 0;
+static shmring_t bench_ring_mod = 0;
+
+/*
+   request parsing and conversion
+*/
+
+static wstatus
+bench_req_validate(void)
+{
+	req_validation_t validation;
+	wstatus ws;
+
+	ws = req_validate(BENCH_REQ_TEXT,sizeof(BENCH_REQ_TEXT),&validation);
+	if( (ws != WSTATUS_SUCCESS) || (validation != REQUEST_IS_VALID) )
+		return WSTATUS_FAILURE;
+
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_req_from_string(void)
+{
+	request_t req;
+
+	if( req_from_string(BENCH_REQ_TEXT,&req) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return req_free(req);
+}
+
+static wstatus
+bench_reqs_setup(void)
+{
+	if( req_from_string(BENCH_REQ_TEXT,&bench_text) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	if( req_to_bin(bench_text,&bench_bin) != WSTATUS_SUCCESS ) {
+		req_free(bench_text);
+		bench_text = 0;
+		return WSTATUS_FAILURE;
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_reqs_teardown(void)
+{
+	req_free(bench_bin);
+	req_free(bench_text);
+	bench_bin = bench_text = 0;
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_req_to_bin(void)
+{
+	request_t req;
+
+	if( req_to_bin(bench_text,&req) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return req_free(req);
+}
+
+static wstatus
+bench_req_to_text(void)
+{
+	request_t req;
+
+	if( req_to_text(bench_bin,&req) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return req_free(req);
+}
+
+static wstatus
+bench_req_get_nv_text(void)
+{
+	nvpair_t nvp;
+
+	if( req_get_nv(bench_text,"name3",5,&nvp) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return _nvp_free(nvp);
+}
+
+static wstatus
+bench_req_get_nv_bin(void)
+{
+	nvpair_t nvp;
+
+	if( req_get_nv(bench_bin,"name3",5,&nvp) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return _nvp_free(nvp);
+}
+
+static wstatus
+bench_req_get_nv_id_bin(void)
+{
+	nvpair_t nvp;
+
+	if( req_get_nv_id(bench_bin,REQNAME_SID,&nvp) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return _nvp_free(nvp);
+}
+
+/*
+   nvpair value encoding
+*/
+
+static wstatus
+bench_nvp_setup(void)
+{
+	unsigned int i;
+
+	for( i = 0 ; i < sizeof(bench_value) ; i++ )
+		bench_value[i] = (char)(i*7);
+
+	if( _nvp_value_encode(bench_value,sizeof(bench_value),&bench_encoded) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	if( _nvp_value_decoded_size(bench_encoded,strlen(bench_encoded),&bench_decoded_size) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_nvp_teardown(void)
+{
+	free(bench_encoded);
+	bench_encoded = 0;
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_nvp_encode(void)
+{
+	char *encoded;
+
+	if( _nvp_value_encode(bench_value,sizeof(bench_value),&encoded) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	free(encoded);
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_nvp_decode(void)
+{
+	char decoded[sizeof(bench_value)];
+
+	return _nvp_value_decode(bench_encoded,strlen(bench_encoded),decoded,bench_decoded_size);
+}
+
+/*
+   reqbuf over fragmented input: the read callback returns the stream of text
+   requests in small fragments that never match the request boundaries and
+   starts over when it reaches the end.
+*/
+
+#define BENCH_RB_FRAGMENT 7
+
+static wstatus
+bench_rb_read(void *param,void *chunk_ptr,unsigned int chunk_size,unsigned int *chunk_used)
+{
+	unsigned int size = BENCH_RB_FRAGMENT;
+
+	if( size > chunk_size )
+		size = chunk_size;
+
+	if( size > bench_rb_stream_size - bench_rb_offset )
+		size = bench_rb_stream_size - bench_rb_offset;
+
+	memcpy(chunk_ptr,bench_rb_stream + bench_rb_offset,size);
+	bench_rb_offset += size;
+	if( bench_rb_offset == bench_rb_stream_size )
+		bench_rb_offset = 0;
+
+	*chunk_used = size;
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_reqbuf_setup(void)
+{
+	const char *reqs[] = { BENCH_REQ_TEXT, "124 modFrom modTo reqCode", "125r modTo modFrom reqCode a=1 b=2" };
+	unsigned int i,size;
+
+	bench_rb_stream_size = 0;
+	bench_rb_offset = 0;
+	for( i = 0 ; i < sizeof(reqs)/sizeof(reqs[0]) ; i++ ) {
+		size = strlen(reqs[i]) + 1;
+		memcpy(bench_rb_stream + bench_rb_stream_size,reqs[i],size);
+		bench_rb_stream_size += size;
+	}
+
+	return reqbuf_create(bench_rb_read,0,REQBUF_TYPE_TEXT,&bench_rb);
+}
+
+static wstatus
+bench_reqbuf_teardown(void)
+{
+	reqbuf_destroy(bench_rb);
+	bench_rb = 0;
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_reqbuf_read(void)
+{
+	request_t req;
+
+	if( reqbuf_read(bench_rb,&req) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return req_free(req);
+}
+
+/*
+   wchannel UDP loopback, the channel sends to itself
+*/
+
+static wstatus
+bench_udp_create(unsigned int ring_size,bool reliable,unsigned int loss)
+{
+	wchannel_load_t load;
+	wchannel_opt_t opt;
+
+	if( wchannel_load(load) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = "127.0.0.1";
+	opt.port_src = BENCH_UDP_PORT;
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.ring_size = ring_size;
+	opt.reliable = reliable;
+	opt.reliable_loss = loss;
+
+	if( wchannel_create(&opt,&bench_wch) != WSTATUS_SUCCESS ) {
+		wchannel_unload();
+		return WSTATUS_FAILURE;
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_udp_setup(void)
+{
+	return bench_udp_create(0,false,0);
+}
+
+/*
+   the same loopback with a capture ring of BENCH_RING_SIZE messages, each
+   send and receive is recorded (see wchannel_ring_dump)
+*/
+static wstatus
+bench_ring_setup(void)
+{
+	return bench_udp_create(BENCH_RING_SIZE,false,0);
+}
+
+/*
+   the same loopback with reliable datagrams (wrel.h), each message is
+   acknowledged by the service thread of the channel, and with
+   BENCH_RELIABLE_LOSS percent of the datagrams dropped, the messages lost
+   are sent again after their timeout or a selective ACK
+*/
+static wstatus
+bench_reliable_setup(void)
+{
+	return bench_udp_create(0,true,0);
+}
+
+static wstatus
+bench_reliable_loss_setup(void)
+{
+	return bench_udp_create(0,true,BENCH_RELIABLE_LOSS);
+}
+
+static wstatus
+bench_udp_teardown(void)
+{
+	wchannel_destroy(bench_wch);
+	wchannel_unload();
+	bench_wch = 0;
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_udp_loopback(void)
+{
+	char buffer[256];
+	unsigned int used;
+	unsigned long gen = 0;
+	wstatus ws;
+
+	/* a reliable channel returns WSTATUS_AGAIN while the window is full */
+	while( (ws = wchannel_send(bench_wch,"127.0.0.1 " BENCH_UDP_PORT,BENCH_REQ_TEXT,sizeof(BENCH_REQ_TEXT),&used)) == WSTATUS_AGAIN )
+		wchannel_reliable_wait(bench_wch,&gen,100000);
+	if( ws != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return wchannel_receive(bench_wch,buffer,sizeof(buffer),&used);
+}
+
+/*
+   wchannel engines on UDP loopback: one operation sends a batch of
+   BENCH_BATCH_SIZE requests to the channel itself (wchannel_send_batch) and
+   reads them with a zero copy reqbuf, with the classic engine (sendmmsg and
+   a recv per datagram) or the URING engine (one submission for the batch,
+   datagrams taken from the registered buffers). The gso cases send the
+   batch as one buffer the kernel segments (UDP_SEGMENT) and receive the
+   datagrams coalesced (UDP_GRO), with the small requests and with bulk
+   ones of BENCH_BULK_DATA bytes of data, like the chunks of a stream.
+*/
+
+static wstatus
+bench_batch_setup(wchannel_engine_list engine,bool offload,bool bulk)
+{
+	wchannel_load_t load;
+	wchannel_opt_t opt;
+	unsigned int i,size;
+	char *text;
+
+	if( wchannel_load(load) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = "127.0.0.1";
+	opt.port_src = BENCH_UDP_PORT;
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.engine = engine;
+	opt.uring_buffers = 2 * BENCH_BATCH_SIZE;
+	opt.uring_buffer_size = 2048;
+	opt.gso = offload;
+	opt.gro = offload;
+
+	if( wchannel_create(&opt,&bench_wch) != WSTATUS_SUCCESS ) {
+		wchannel_unload();
+		return WSTATUS_FAILURE;
+	}
+
+	if( wchannel_engine(bench_wch) != engine )
+		fprintf(stderr,"io_uring is not available, the URING case runs the classic engine\n");
+	if( offload && (wchannel_offload(bench_wch) != (WCHANNEL_OFFLOAD_GSO | WCHANNEL_OFFLOAD_GRO)) )
+		fprintf(stderr,"UDP_SEGMENT or UDP_GRO is not available, the gso case sends per datagram\n");
+
+	if( reqbuf_create_zc(reqbuf_wchannel_peek_cb,reqbuf_wchannel_done_cb,bench_wch,REQBUF_TYPE_TEXT,&bench_rb) != WSTATUS_SUCCESS ) {
+		bench_udp_teardown();
+		return WSTATUS_FAILURE;
+	}
+
+	text = BENCH_REQ_TEXT;
+	size = sizeof(BENCH_REQ_TEXT);
+	if( bulk ) {
+		size = (unsigned int)sprintf(bench_bulk_text,"124 modFrom modTo stream.chunk sid=42 seq=1 data=#");
+		for( i = 0 ; i < BENCH_BULK_DATA ; i++ )
+			size += (unsigned int)sprintf(bench_bulk_text + size,"%02X",i & 0xFF);
+		text = bench_bulk_text;
+		size++;
+	}
+
+	for( i = 0 ; i < BENCH_BATCH_SIZE ; i++ ) {
+		bench_batch_list[i].dest = "127.0.0.1 " BENCH_UDP_PORT;
+		bench_batch_list[i].ptr = text;
+		bench_batch_list[i].size = size;
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_batch_classic_setup(void)
+{
+	return bench_batch_setup(WCHANNEL_ENGINE_CLASSIC,false,false);
+}
+
+static wstatus
+bench_batch_uring_setup(void)
+{
+	return bench_batch_setup(WCHANNEL_ENGINE_URING,false,false);
+}
+
+static wstatus
+bench_batch_gso_setup(void)
+{
+	return bench_batch_setup(WCHANNEL_ENGINE_CLASSIC,true,false);
+}
+
+static wstatus
+bench_bulk_classic_setup(void)
+{
+	return bench_batch_setup(WCHANNEL_ENGINE_CLASSIC,false,true);
+}
+
+static wstatus
+bench_bulk_gso_setup(void)
+{
+	return bench_batch_setup(WCHANNEL_ENGINE_CLASSIC,true,true);
+}
+
+static wstatus
+bench_batch_teardown(void)
+{
+	reqbuf_destroy(bench_rb);
+	bench_rb = 0;
+	return bench_udp_teardown();
+}
+
+static wstatus
+bench_batch_loopback(void)
+{
+	request_t req;
+	unsigned int i,sent;
+
+	if( wchannel_send_batch(bench_wch,bench_batch_list,BENCH_BATCH_SIZE,&sent) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	for( i = 0 ; i < BENCH_BATCH_SIZE ; i++ ) {
+		if( reqbuf_read(bench_rb,&req) != WSTATUS_SUCCESS )
+			return WSTATUS_FAILURE;
+		req_free(req);
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wloop dispatch: the UDP loopback of wchannel_udp_loopback but the datagram
+   is received by the ready callback of an event loop that also waits for an
+   idle PIPE channel, one operation is a send and a wloop_run_once.
+*/
+
+static void
+bench_wloop_ready_cb(wloop_t loop,wchannel_t channel,void *param)
+{
+	char buffer[256];
+	unsigned int used;
+
+	if( wchannel_receive(channel,buffer,sizeof(buffer),&used) == WSTATUS_SUCCESS )
+		bench_wloop_received++;
+}
+
+static wstatus
+bench_wloop_setup(void)
+{
+	wchannel_opt_t opt;
+
+	if( bench_udp_setup() != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_PIPE;
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+
+	if( wchannel_create(&opt,&bench_pipe) != WSTATUS_SUCCESS )
+		goto return_fail;
+
+	if( wloop_create(0,0,&bench_wloop) != WSTATUS_SUCCESS )
+		goto return_fail;
+
+	if( (wloop_add(bench_wloop,bench_wch,bench_wloop_ready_cb,0) != WSTATUS_SUCCESS) ||
+			(wloop_add(bench_wloop,bench_pipe,bench_wloop_ready_cb,0) != WSTATUS_SUCCESS) )
+		goto return_fail;
+
+	return WSTATUS_SUCCESS;
+
+return_fail:
+	if( bench_wloop )
+		wloop_destroy(bench_wloop);
+	if( bench_pipe )
+		wchannel_destroy(bench_pipe);
+	bench_wloop = 0;
+	bench_pipe = 0;
+	bench_udp_teardown();
+	return WSTATUS_FAILURE;
+}
+
+static wstatus
+bench_wloop_teardown(void)
+{
+	wloop_destroy(bench_wloop);
+	wchannel_destroy(bench_pipe);
+	bench_wloop = 0;
+	bench_pipe = 0;
+	return bench_udp_teardown();
+}
+
+static wstatus
+bench_wloop_dispatch(void)
+{
+	unsigned int used,received = bench_wloop_received;
+
+	if( wchannel_send(bench_wch,"127.0.0.1 " BENCH_UDP_PORT,BENCH_REQ_TEXT,sizeof(BENCH_REQ_TEXT),&used) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	if( wloop_run_once(bench_wloop,-1) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return bench_wloop_received == received + 1 ? WSTATUS_SUCCESS : WSTATUS_FAILURE;
+}
+
+/*
+   modmgr peer hop on loopback: node A forwards a request to node B through its
+   peer link, B parses it (like its remote receivers) and forwards the reply
+   back, A parses the reply. One operation is the round trip of both hops.
+*/
+
+static unsigned int
+bench_peer_summary_a(void *param,char *buf,unsigned int buf_size)
+{
+	return snprintf(buf,buf_size,"modFrom");
+}
+
+static unsigned int
+bench_peer_summary_b(void *param,char *buf,unsigned int buf_size)
+{
+	return snprintf(buf,buf_size,"modTo");
+}
+
+static wstatus
+bench_peer_channel(const char *port,wchannel_t *wch,reqbuf_t *rb)
+{
+	wchannel_opt_t opt;
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = "127.0.0.1";
+	opt.port_src = (char*)port;
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+
+	if( wchannel_create(&opt,wch) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return reqbuf_create(reqbuf_wchannel_read_cb,*wch,REQBUF_TYPE_TEXT,rb);
+}
+
+static wstatus
+bench_peer_node(const char *node,const char *peer_node,const char *peer_port,
+		MODPEERSUMMARYCB summary_cb,modpeer_t *peers)
+{
+	modpeer_addr_t addr;
+	modpeer_opt_t peer_opt;
+
+	/* a single summary, sent when the peers are created */
+	addr.node = peer_node;
+	addr.host = "127.0.0.1";
+	addr.port = peer_port;
+	memset(&peer_opt,0,sizeof(peer_opt));
+	peer_opt.node = node;
+	peer_opt.host_src = "127.0.0.1";
+	peer_opt.summary_ms = 3600000;
+	peer_opt.peer_list = &addr;
+	peer_opt.peer_count = 1;
+
+	return modpeer_create(&peer_opt,summary_cb,0,peers);
+}
+
+static wstatus
+bench_peer_read(reqbuf_t rb)
+{
+	request_t req;
+
+	if( reqbuf_read(rb,&req) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return req_free(req);
+}
+
+static wstatus
+bench_peer_teardown(void)
+{
+	if( bench_peer_a )
+		modpeer_destroy(bench_peer_a);
+	if( bench_peer_b )
+		modpeer_destroy(bench_peer_b);
+	if( bench_peer_rb_a )
+		reqbuf_destroy(bench_peer_rb_a);
+	if( bench_peer_rb_b )
+		reqbuf_destroy(bench_peer_rb_b);
+	if( bench_peer_wch_a )
+		wchannel_destroy(bench_peer_wch_a);
+	if( bench_peer_wch_b )
+		wchannel_destroy(bench_peer_wch_b);
+	wchannel_unload();
+
+	bench_peer_a = bench_peer_b = 0;
+	bench_peer_rb_a = bench_peer_rb_b = 0;
+	bench_peer_wch_a = bench_peer_wch_b = 0;
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_peer_setup(void)
+{
+	wchannel_load_t load;
+
+	if( wchannel_load(load) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	/* both receivers are bound before the summaries are sent */
+	if( (bench_peer_channel(BENCH_PEER_PORT_A,&bench_peer_wch_a,&bench_peer_rb_a) != WSTATUS_SUCCESS) ||
+		(bench_peer_channel(BENCH_PEER_PORT_B,&bench_peer_wch_b,&bench_peer_rb_b) != WSTATUS_SUCCESS) ||
+		(bench_peer_node("nodeA","nodeB",BENCH_PEER_PORT_B,bench_peer_summary_a,&bench_peer_a) != WSTATUS_SUCCESS) ||
+		(bench_peer_node("nodeB","nodeA",BENCH_PEER_PORT_A,bench_peer_summary_b,&bench_peer_b) != WSTATUS_SUCCESS) )
+		goto return_fail;
+
+	/* consume the summaries of both nodes */
+	if( (bench_peer_read(bench_peer_rb_a) != WSTATUS_SUCCESS) ||
+		(bench_peer_read(bench_peer_rb_b) != WSTATUS_SUCCESS) )
+		goto return_fail;
+
+	return WSTATUS_SUCCESS;
+
+return_fail:
+	bench_peer_teardown();
+	return WSTATUS_FAILURE;
+}
+
+static wstatus
+bench_peer_hop(void)
+{
+	if( modpeer_send(bench_peer_a,0,BENCH_REQ_TEXT,sizeof(BENCH_REQ_TEXT)-1) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	if( bench_peer_read(bench_peer_rb_b) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	if( modpeer_send(bench_peer_b,0,BENCH_REPLY_TEXT,sizeof(BENCH_REPLY_TEXT)-1) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return bench_peer_read(bench_peer_rb_a);
+}
+
+/*
+   multicast group on loopback: a request goes out as one datagram to the
+   group (mcast_loop on lo), BENCH_MCAST_MEMBERS channels that joined it
+   on the same port (reuse_port) get a copy and reply to the sender with
+   their own name, the sender correlates the replies (see modcast.h). One
+   operation is a request and the replies of all the members, it fails
+   unless the collection is complete with both of them.
+*/
+
+static wstatus
+bench_mcast_teardown(void)
+{
+	unsigned int i;
+
+	for( i = 0 ; i < BENCH_MCAST_MEMBERS ; i++ ) {
+		if( bench_member_wch[i] )
+			wchannel_destroy(bench_member_wch[i]);
+		bench_member_wch[i] = 0;
+	}
+	if( bench_mcast_wch )
+		wchannel_destroy(bench_mcast_wch);
+	if( bench_cast )
+		modcast_destroy(bench_cast);
+	wchannel_unload();
+
+	bench_mcast_wch = 0;
+	bench_cast = 0;
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_mcast_setup(void)
+{
+	wchannel_load_t load;
+	wchannel_opt_t opt;
+	char member[16];
+	unsigned int i;
+
+	if( wchannel_load(load) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	if( modcast_create(0,&bench_cast) != WSTATUS_SUCCESS )
+		goto return_fail;
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = "127.0.0.1";
+	opt.port_src = BENCH_MCAST_PORT_S;
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.mcast = true;
+	opt.mcast_loop = true;
+	opt.mcast_if = "lo";
+	if( wchannel_create(&opt,&bench_mcast_wch) != WSTATUS_SUCCESS )
+		goto return_fail;
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = "0.0.0.0";
+	opt.port_src = BENCH_MCAST_PORT;
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.reuse_port = true;
+	for( i = 0 ; i < BENCH_MCAST_MEMBERS ; i++ )
+	{
+		if( wchannel_create(&opt,&bench_member_wch[i]) != WSTATUS_SUCCESS )
+			goto return_fail;
+		if( wchannel_mcast_join(bench_member_wch[i],BENCH_MCAST_GROUP,"lo") != WSTATUS_SUCCESS )
+			goto return_fail;
+
+		snprintf(member,sizeof(member),"ap%u",i + 1);
+		if( modcast_join(bench_cast,member) != WSTATUS_SUCCESS )
+			goto return_fail;
+	}
+
+	return WSTATUS_SUCCESS;
+
+return_fail:
+	bench_mcast_teardown();
+	return WSTATUS_FAILURE;
+}
+
+static wstatus
+bench_mcast_group(void)
+{
+	modcast_reply_t reply_list[BENCH_MCAST_MEMBERS];
+	req_header_t header;
+	char buffer[512];
+	unsigned int used, count, i;
+	bool complete;
+	int size;
+
+	bench_mcast_id = bench_mcast_id % MAXREQID + 1;
+	modcast_sent(bench_cast,bench_mcast_id,"modFrom");
+
+	size = snprintf(buffer,sizeof(buffer),"%d modFrom apGroup reqCode name1=value1",bench_mcast_id);
+	if( wchannel_send(bench_mcast_wch,BENCH_MCAST_GROUP " " BENCH_MCAST_PORT,buffer,size + 1,&used) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	/* each member answers with its name as source */
+	for( i = 0 ; i < BENCH_MCAST_MEMBERS ; i++ )
+	{
+		if( wchannel_receive(bench_member_wch[i],buffer,sizeof(buffer),&used) != WSTATUS_SUCCESS )
+			return WSTATUS_FAILURE;
+
+		size = snprintf(buffer,sizeof(buffer),"%dr ap%u modFrom reqCode status=ok",bench_mcast_id,i + 1);
+		if( wchannel_send(bench_member_wch[i],"127.0.0.1 " BENCH_MCAST_PORT_S,buffer,size + 1,&used) != WSTATUS_SUCCESS )
+			return WSTATUS_FAILURE;
+	}
+
+	for( i = 0 ; i < BENCH_MCAST_MEMBERS ; i++ )
+	{
+		if( wchannel_receive(bench_mcast_wch,buffer,sizeof(buffer),&used) != WSTATUS_SUCCESS )
+			return WSTATUS_FAILURE;
+		if( req_peek_header(buffer,used - 1,&header) != WSTATUS_SUCCESS )
+			return WSTATUS_FAILURE;
+		modcast_reply(bench_cast,header.id,"modFrom",header.src);
+	}
+
+	if( modcast_collect(bench_cast,bench_mcast_id,"modFrom",reply_list,BENCH_MCAST_MEMBERS,&count,&complete) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return (complete && (count == BENCH_MCAST_MEMBERS) && reply_list[0].replied && reply_list[1].replied) ?
+		WSTATUS_SUCCESS : WSTATUS_FAILURE;
+}
+
+/*
+   shared memory rings, a frame written by the modmgr side and read back by
+   the module side in the same thread (see shmring.h)
+*/
+
+static wstatus
+bench_shm_teardown(void)
+{
+	if( bench_ring_mod )
+		shmring_destroy(bench_ring_mod);
+	if( bench_ring_mgr )
+		shmring_destroy(bench_ring_mgr);
+	bench_ring_mgr = bench_ring_mod = 0;
+	return bench_reqs_teardown();
+}
+
+static wstatus
+bench_shm_setup(void)
+{
+	if( bench_reqs_setup() != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	if( (shmring_create(0,&bench_ring_mgr) != WSTATUS_SUCCESS) ||
+		(shmring_open(shmring_path(bench_ring_mgr),&bench_ring_mod) != WSTATUS_SUCCESS) ) {
+		bench_shm_teardown();
+		return WSTATUS_FAILURE;
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+static wstatus
+bench_shm_frame(void)
+{
+	unsigned int frame_size,frame_used;
+	const void *frame_ptr;
+	void *ptr;
+	request_t req;
+	wstatus ws;
+
+	if( (req_frame_size(bench_bin,&frame_size) != WSTATUS_SUCCESS) ||
+		(shmring_reserve(bench_ring_mgr,frame_size,false,&ptr) != WSTATUS_SUCCESS) )
+		return WSTATUS_FAILURE;
+
+	if( req_to_frame(bench_bin,ptr,frame_size,&frame_used) != WSTATUS_SUCCESS ) {
+		shmring_commit(bench_ring_mgr,0);
+		return WSTATUS_FAILURE;
+	}
+	shmring_commit(bench_ring_mgr,frame_used);
+
+	if( shmring_peek(bench_ring_mod,&frame_ptr,&frame_size) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	ws = req_from_frame(frame_ptr,frame_size,&req);
+	shmring_release(bench_ring_mod);
+	if( ws != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	return req_free(req);
+}
+
+static const bench_t bench_list[] = {
+	{ "req_validate", 0, bench_req_validate, 0 },
+	{ "req_from_string", 0, bench_req_from_string, 0 },
+	{ "req_to_bin", bench_reqs_setup, bench_req_to_bin, bench_reqs_teardown },
+	{ "req_to_text", bench_reqs_setup, bench_req_to_text, bench_reqs_teardown },
+	{ "req_get_nv_text", bench_reqs_setup, bench_req_get_nv_text, bench_reqs_teardown },
+	{ "req_get_nv_bin", bench_reqs_setup, bench_req_get_nv_bin, bench_reqs_teardown },
+	{ "req_get_nv_id_bin", bench_reqs_setup, bench_req_get_nv_id_bin, bench_reqs_teardown },
+	{ "nvp_value_encode", bench_nvp_setup, bench_nvp_encode, bench_nvp_teardown },
+	{ "nvp_value_decode", bench_nvp_setup, bench_nvp_decode, bench_nvp_teardown },
+	{ "reqbuf_read_fragmented", bench_reqbuf_setup, bench_reqbuf_read, bench_reqbuf_teardown },
+	{ "wchannel_udp_loopback", bench_udp_setup, bench_udp_loopback, bench_udp_teardown },
+	{ "wchannel_ring_loopback", bench_ring_setup, bench_udp_loopback, bench_udp_teardown },
+	{ "wchannel_reliable_loopback", bench_reliable_setup, bench_udp_loopback, bench_udp_teardown },
+	{ "wchannel_reliable_loss_loopback", bench_reliable_loss_setup, bench_udp_loopback, bench_udp_teardown },
+	{ "wchannel_batch_classic", bench_batch_classic_setup, bench_batch_loopback, bench_batch_teardown },
+	{ "wchannel_batch_uring", bench_batch_uring_setup, bench_batch_loopback, bench_batch_teardown },
+	{ "wchannel_batch_gso", bench_batch_gso_setup, bench_batch_loopback, bench_batch_teardown },
+	{ "wchannel_bulk_classic", bench_bulk_classic_setup, bench_batch_loopback, bench_batch_teardown },
+	{ "wchannel_bulk_gso", bench_bulk_gso_setup, bench_batch_loopback, bench_batch_teardown },
+	{ "wloop_udp_dispatch", bench_wloop_setup, bench_wloop_dispatch, bench_wloop_teardown },
+	{ "modpeer_hop_roundtrip", bench_peer_setup, bench_peer_hop, bench_peer_teardown },
+	{ "modcast_group_roundtrip", bench_mcast_setup, bench_mcast_group, bench_mcast_teardown },
+	{ "shmring_frame_roundtrip", bench_shm_setup, bench_shm_frame, bench_shm_teardown }
+};
+#define BENCH_COUNT (sizeof(bench_list)/sizeof(bench_t))
+
+/*
+   runner
+*/
+
+static double
+bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+}
+
+static wstatus
+bench_loop(const bench_t *bench,unsigned long iterations,double *elapsed_ns)
+{
+	unsigned long i;
+	double start;
+
+	start = bench_now_ns();
+	for( i = 0 ; i < iterations ; i++ ) {
+		if( bench->op() != WSTATUS_SUCCESS )
+			return WSTATUS_FAILURE;
+	}
+	*elapsed_ns = bench_now_ns() - start;
+
+	return WSTATUS_SUCCESS;
+}
+
+static int
+bench_cmp_double(const void *a,const void *b)
+{
+	double da = *(const double*)a, db = *(const double*)b;
+	return (da > db) - (da < db);
+}
+
+static void
+bench_run(const bench_t *bench,unsigned int min_time_ms,unsigned int runs)
+{
+	unsigned long iterations = 1;
+	unsigned long long allocs,alloc_bytes;
+	double elapsed,results[BENCH_MAXRUNS];
+	unsigned int i;
+
+	if( bench->setup && (bench->setup() != WSTATUS_SUCCESS) ) {
+		printf("{\"bench\":\"%s\",\"error\":\"setup failed\"}\n",bench->name);
+		return;
+	}
+
+	/* warm up and calibrate the iterations of each run */
+
+	for(;;)
+	{
+		if( bench_loop(bench,iterations,&elapsed) != WSTATUS_SUCCESS )
+			goto op_failed;
+
+		if( (elapsed >= (double)min_time_ms*1e6) || (iterations >= BENCH_MAXITERATIONS) )
+			break;
+
+		iterations *= 2;
+	}
+
+	allocs = bench_allocs;
+	alloc_bytes = bench_alloc_bytes;
+
+	for( i = 0 ; i < runs ; i++ ) {
+		if( bench_loop(bench,iterations,&elapsed) != WSTATUS_SUCCESS )
+			goto op_failed;
+		results[i] = elapsed/(double)iterations;
+	}
+
+	allocs = bench_allocs - allocs;
+	alloc_bytes = bench_alloc_bytes - alloc_bytes;
+
+	qsort(results,runs,sizeof(double),bench_cmp_double);
+
+	printf("{\"bench\":\"%s\",\"iterations\":%lu,\"runs\":%u,\"ns_per_op\":%.1f,\"ns_per_op_min\":%.1f,",
+			bench->name,iterations,runs,results[runs/2],results[0]);
+#ifdef BENCH_ALLOC_WRAP
+	printf("\"allocs_per_op\":%.2f,\"bytes_per_op\":%.2f}\n",
+			(double)allocs/((double)iterations*runs),(double)alloc_bytes/((double)iterations*runs));
+#else
+	printf("\"allocs_per_op\":null,\"bytes_per_op\":null}\n");
+#endif
+	fflush(stdout);
+
+	if( bench->teardown )
+		bench->teardown();
+	return;
+
+op_failed:
+	printf("{\"bench\":\"%s\",\"error\":\"operation failed\"}\n",bench->name);
+	if( bench->teardown )
+		bench->teardown();
+}
+
+static int
+bench_selected(const bench_t *bench,int argc,char *argv[],int first_filter)
+{
+	int i;
+
+	if( first_filter >= argc )
+		return 1;
+
+	for( i = first_filter ; i < argc ; i++ ) {
+		if( strstr(bench->name,argv[i]) )
+			return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc,char *argv[])
+{
+	struct _jmlist_init_params init = { .flags = 0, .fverbose = 0, .fdump = stdout, .fdebug = 0 };
+	unsigned int min_time_ms = BENCH_DEFAULT_MINTIME_MS;
+	unsigned int runs = BENCH_DEFAULT_RUNS;
+	unsigned int i;
+	int arg;
+
+	for( arg = 1 ; arg < argc ; arg++ )
+	{
+		if( !strcmp(argv[arg],"-t") && (arg+1 < argc) ) {
+			min_time_ms = (unsigned int)atoi(argv[++arg]);
+		} else if( !strcmp(argv[arg],"-r") && (arg+1 < argc) ) {
+			runs = (unsigned int)atoi(argv[++arg]);
+			if( !runs || (runs > BENCH_MAXRUNS) ) {
+				fprintf(stderr,"runs must be 1..%u\n",BENCH_MAXRUNS);
+				return EXIT_FAILURE;
+			}
+		} else if( !strcmp(argv[arg],"-l") ) {
+			for( i = 0 ; i < BENCH_COUNT ; i++ )
+				printf("%s\n",bench_list[i].name);
+			return EXIT_SUCCESS;
+		} else if( argv[arg][0] == '-' ) {
+			fprintf(stderr,"usage: %s [-t min_ms] [-r runs] [-l] [name_filter ...]\n",argv[0]);
+			return EXIT_FAILURE;
+		} else
+			break;
+	}
+
+	debug_set_mask(DEBUG_MASK_NONE);
+	jmlist_initialize(&init);
+
+	for( i = 0 ; i < BENCH_COUNT ; i++ ) {
+		if( bench_selected(&bench_list[i],argc,argv,arg) )
+			bench_run(&bench_list[i],min_time_ms,runs);
+	}
+
+	jmlist_uninitialize();
+	return EXIT_SUCCESS;
+}
+
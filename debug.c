@@ -40,10 +40,38 @@ modname modname_list[] = {
 	{MOD_WVIEW,"wview"},
 	{MOD_WVIEWCTL,"wviewctl"},
 	{MOD_SHAPEMGR,"shapemgr"},
-	{MOD_WCHANNEL,"wchannel"}
+	{MOD_WCHANNEL,"wchannel"},
+	{MOD_REQSTREAM,"reqstream"},
+	{MOD_REQSCHEMA,"reqschema"},
+	{MOD_WCAPTURE,"wcapture"},
+	{MOD_ADMCTL,"admctl"},
+	{MOD_MODSCHED,"modsched"},
+	{MOD_MODINBOX,"modinbox"},
+	{MOD_MODBUS,"modbus"},
+	{MOD_MODSTATS,"modstats"},
+	{MOD_MODGROUP,"modgroup"},
+	{MOD_MODPEER,"modpeer"},
+	{MOD_SHMRING,"shmring"},
+	{MOD_WURING,"wuring"},
+	{MOD_WLOOP,"wloop"},
+	{MOD_MODCAST,"modcast"},
+	{MOD_WREL,"wrel"}
 };
 #define MOD_COUNT (sizeof(modname_list)/sizeof(modname))
 
+unsigned int debug_mask = DEBUG_MASK_ALL;
+
+/*
+   debug_set_mask
+
+   Sets the modules (debug_mod_t bits) whose debug messages are printed.
+*/
+void
+debug_set_mask(unsigned int mask)
+{
+	debug_mask = mask;
+}
+
 wstatus
 modt2name(debug_mod_t module,const char **name)
 {
@@ -73,7 +101,7 @@ modt2name(debug_mod_t module,const char **name)
 }
 
 void
-dbgprint(debug_mod_t module,const char *func,char *fmt,...)
+_dbgprint(debug_mod_t module,const char *func,char *fmt,...)
 {
 	va_list vl;
 
@@ -115,14 +143,15 @@ const char *array2z(const char *buf_ptr,unsigned int buf_size)
 		l_buf_size = 256;
 	}
 
-	if( buf_size > l_buf_size ) {
+	/* one more byte for the null terminator */
+	if( buf_size >= l_buf_size ) {
 		assert(l_buf_ptr != 0);
 		free(l_buf_ptr);
 		l_buf_ptr = (char*)malloc(sizeof(char)*(buf_size+1));
 		l_buf_size = buf_size + 1;
 	}
 
-	memset(l_buf_ptr,l_buf_size,0);
+	memset(l_buf_ptr,0,l_buf_size);
 	assert(l_buf_size >= buf_size);
 	memcpy(l_buf_ptr,buf_ptr,buf_size);
 	
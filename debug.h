@@ -42,7 +42,22 @@ typedef enum _debug_mod_t {
 	MOD_WVIEW = 512,
 	MOD_WVIEWCTL = 1024,
 	MOD_SHAPEMGR = 2048,
-	MOD_WCHANNEL = 4096
+	MOD_WCHANNEL = 4096,
+	MOD_REQSTREAM = 8192,
+	MOD_REQSCHEMA = 16384,
+	MOD_WCAPTURE = 32768,
+	MOD_ADMCTL = 65536,
+	MOD_MODSCHED = 131072,
+	MOD_MODINBOX = 262144,
+	MOD_MODBUS = 524288,
+	MOD_MODSTATS = 1048576,
+	MOD_MODGROUP = 2097152,
+	MOD_MODPEER = 4194304,
+	MOD_SHMRING = 8388608,
+	MOD_WURING = 16777216,
+	MOD_WLOOP = 33554432,
+	MOD_MODCAST = 67108864,
+	MOD_WREL = 134217728
 } debug_mod_t;
 /* maximum modules for debug... 32 */
 
@@ -51,13 +66,24 @@ typedef struct _modname {
 	const char *name;
 } modname;
 
+/* debug messages are only printed for the modules set in the debug mask
+   (debug_set_mask), the arguments of filtered messages aren't evaluated so
+   a disabled module costs a single test per message */
+#define DEBUG_MASK_ALL 0xFFFFFFFF
+#define DEBUG_MASK_NONE 0
+
+extern unsigned int debug_mask;
+
+#define dbgprint(module,...) ((debug_mask & (module)) ? _dbgprint(module,__VA_ARGS__) : (void)0)
+
 #define DBGRET_SUCCESS(mod) dbgprint(mod,__func__,"Returning with success."); return WSTATUS_SUCCESS;
 #define DBGRET_FAILURE(mod) dbgprint(mod,__func__,"Returning with failure."); return WSTATUS_FAILURE;
 
 #define b2c(a) ( (isalnum(a) || (a == ' ')) ? a : '.')
 
 wstatus modt2name(debug_mod_t module,const char **name);
-void dbgprint(debug_mod_t module,const char *func,char *fmt,...);
+void _dbgprint(debug_mod_t module,const char *func,char *fmt,...);
+void debug_set_mask(unsigned int mask);
 const char *z_ptr(const char *ptr);
 const char *array2z(const char *buf_ptr,unsigned int buf_size);
 #endif
@@ -0,0 +1,722 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "wcond.h"
+#include "wthread.h"
+#include "req.h"
+#include "modbus.h"
+
+typedef struct _modbus_event_t
+{
+	char key[MODBUS_TOPICSIZE+MODBUS_KEYSIZE];	/* "topic key", empty = not conflated */
+	uint32_t hash;
+	request_t event;
+	struct _modbus_event_t *next;		/* queue order, or free list */
+	struct _modbus_event_t *hnext;		/* conflation bucket */
+} modbus_event_t;
+
+typedef struct _modbus_sub_t
+{
+	char name[REQMODSIZE];
+	char patterns[MODBUS_MAXPATTERNS][MODBUS_TOPICSIZE];
+	unsigned int pattern_count;
+	unsigned int size;
+	modbus_event_t *pool;
+	modbus_event_t *free_list;
+	modbus_event_t **buckets;			/* size buckets */
+	modbus_event_t *head;
+	modbus_event_t *tail;
+	unsigned int depth;
+	bool ready;							/* in the ready list of the bus */
+	struct _modbus_sub_t *next;
+	struct _modbus_sub_t *next_ready;
+	unsigned long queued;
+	unsigned long delivered;
+	unsigned long conflated;
+	unsigned long dropped;
+} modbus_sub_t;
+
+struct _modbus_t
+{
+	unsigned int queue_size;
+	MODBUSDELIVERCB deliver_cb;
+	void *param;
+	wlock_t lock;
+	wcond_t cond;
+	wthread_t thread;
+	bool stopping;
+	bool finished;
+	modbus_sub_t *subs;
+	modbus_sub_t *ready_head;			/* subscribers with events, round-robin */
+	modbus_sub_t *ready_tail;
+};
+
+/*
+   _modbus_hash
+
+   FNV-1a hash of the conflation key of an event.
+*/
+static uint32_t
+_modbus_hash(const char *key)
+{
+	uint32_t hash = 2166136261u;
+	const char *p;
+
+	for( p = key ; *p ; p++ )
+		hash = (hash ^ (uint8_t)*p) * 16777619u;
+
+	return hash;
+}
+
+/*
+   _modbus_sub_find
+
+   Helper function that returns the subscriber with the given name or 0.
+   Must be called with the lock acquired.
+*/
+static modbus_sub_t *
+_modbus_sub_find(modbus_t bus,const char *name)
+{
+	modbus_sub_t *sub;
+
+	for( sub = bus->subs ; sub ; sub = sub->next )
+		if( !strcmp(sub->name,name) )
+			return sub;
+
+	return 0;
+}
+
+/*
+   _modbus_sub_match
+
+   Helper function that checks if any subscription of a subscriber matches
+   the topic, patterns ending with '*' match by prefix.
+*/
+static bool
+_modbus_sub_match(const modbus_sub_t *sub,const char *topic)
+{
+	unsigned int i;
+	size_t len;
+
+	for( i = 0 ; i < sub->pattern_count ; i++ )
+	{
+		len = strlen(sub->patterns[i]);
+		if( len && (sub->patterns[i][len-1] == '*') ) {
+			if( !strncmp(topic,sub->patterns[i],len-1) )
+				return true;
+		} else if( !strcmp(topic,sub->patterns[i]) )
+			return true;
+	}
+
+	return false;
+}
+
+/*
+   _modbus_sub_unhash
+
+   Helper function that removes a queued event from its conflation bucket.
+*/
+static void
+_modbus_sub_unhash(modbus_sub_t *sub,modbus_event_t *ev)
+{
+	modbus_event_t **pp;
+
+	if( !ev->key[0] )
+		return;
+
+	for( pp = &sub->buckets[ev->hash % sub->size] ; *pp ; pp = &(*pp)->hnext )
+		if( *pp == ev ) {
+			*pp = ev->hnext;
+			break;
+		}
+}
+
+/*
+   _modbus_sub_pop
+
+   Helper function that takes the oldest event of a subscriber queue, the
+   event reference goes to the caller. Must be called with the lock acquired.
+*/
+static request_t
+_modbus_sub_pop(modbus_sub_t *sub)
+{
+	modbus_event_t *ev = sub->head;
+	request_t event;
+
+	if( !ev )
+		return 0;
+
+	sub->head = ev->next;
+	if( !sub->head )
+		sub->tail = 0;
+	sub->depth--;
+
+	_modbus_sub_unhash(sub,ev);
+	event = ev->event;
+
+	ev->event = 0;
+	ev->next = sub->free_list;
+	sub->free_list = ev;
+
+	return event;
+}
+
+/*
+   _modbus_sub_push
+
+   Helper function that queues an event for a subscriber, conflating it with
+   a queued event of the same key. The queue takes its own reference of the
+   event. Must be called with the lock acquired.
+*/
+static void
+_modbus_sub_push(modbus_t bus,modbus_sub_t *sub,const char *key,uint32_t hash,request_t event)
+{
+	modbus_event_t *ev;
+	request_t old;
+
+	if( key[0] )
+	{
+		for( ev = sub->buckets[hash % sub->size] ; ev ; ev = ev->hnext )
+		{
+			if( (ev->hash == hash) && !strcmp(ev->key,key) ) {
+				old = ev->event;
+				req_ref(event);
+				ev->event = event;
+				req_free(old);
+				sub->conflated++;
+				return;
+			}
+		}
+	}
+
+	if( !sub->free_list ) {
+		old = _modbus_sub_pop(sub);
+		req_free(old);
+		sub->dropped++;
+	}
+
+	ev = sub->free_list;
+	sub->free_list = ev->next;
+
+	strcpy(ev->key,key);
+	ev->hash = hash;
+	req_ref(event);
+	ev->event = event;
+	ev->next = 0;
+	ev->hnext = 0;
+
+	if( key[0] ) {
+		ev->hnext = sub->buckets[hash % sub->size];
+		sub->buckets[hash % sub->size] = ev;
+	}
+
+	if( sub->tail )
+		sub->tail->next = ev;
+	else
+		sub->head = ev;
+	sub->tail = ev;
+	sub->depth++;
+	sub->queued++;
+
+	if( !sub->ready ) {
+		sub->ready = true;
+		sub->next_ready = 0;
+		if( bus->ready_tail )
+			bus->ready_tail->next_ready = sub;
+		else
+			bus->ready_head = sub;
+		bus->ready_tail = sub;
+		wcond_signal(&bus->cond);
+	}
+}
+
+/*
+   _modbus_sub_free
+
+   Helper function that frees a subscriber and the events still queued, it
+   must have been removed from the subscribers and ready lists.
+*/
+static void
+_modbus_sub_free(modbus_sub_t *sub)
+{
+	request_t event;
+
+	while( (event = _modbus_sub_pop(sub)) )
+		req_free(event);
+
+	free(sub->pool);
+	free(sub->buckets);
+	free(sub);
+}
+
+/*
+   _modbus_thread
+
+   Thread routine of the bus, takes the subscribers with events in round-robin
+   and delivers up to MODBUS_BATCH events of each one per turn, a subscriber
+   with a long queue doesn't delay the others.
+*/
+void
+_modbus_thread(void *param)
+{
+	modbus_t bus = (modbus_t)param;
+	request_t batch[MODBUS_BATCH];
+	char name[REQMODSIZE];
+	modbus_sub_t *sub;
+	unsigned int count, i;
+
+	dbgprint(MOD_MODBUS,__func__,"bus thread started");
+
+	for(;;)
+	{
+		wlock_acquire(&bus->lock);
+
+		while( !bus->ready_head && !bus->stopping )
+			wcond_wait(&bus->cond,&bus->lock);
+
+		if( bus->stopping ) {
+			wlock_release(&bus->lock);
+			break;
+		}
+
+		sub = bus->ready_head;
+		bus->ready_head = sub->next_ready;
+		if( !bus->ready_head )
+			bus->ready_tail = 0;
+		sub->ready = false;
+
+		for( count = 0 ; (count < MODBUS_BATCH) && sub->head ; count++ )
+			batch[count] = _modbus_sub_pop(sub);
+		sub->delivered += count;
+		strcpy(name,sub->name);
+
+		/* still has events, back to the end of the round */
+		if( sub->head ) {
+			sub->ready = true;
+			sub->next_ready = 0;
+			if( bus->ready_tail )
+				bus->ready_tail->next_ready = sub;
+			else
+				bus->ready_head = sub;
+			bus->ready_tail = sub;
+		}
+
+		wlock_release(&bus->lock);
+
+		for( i = 0 ; i < count ; i++ ) {
+			bus->deliver_cb(bus->param,name,batch[i]);
+			req_free(batch[i]);
+		}
+	}
+
+	dbgprint(MOD_MODBUS,__func__,"bus thread finished");
+}
+
+/*
+   modbus_create
+
+   Creates an event bus and starts its thread.
+*/
+wstatus
+modbus_create(const modbus_opt_t *opt,MODBUSDELIVERCB deliver_cb,void *param,modbus_t *bus)
+{
+	modbus_t new_bus = 0;
+	bool lock_created = false, cond_created = false;
+	wstatus ws;
+
+	dbgprint(MOD_MODBUS,__func__,"called with opt=%p, deliver_cb=%p, param=%p, bus=%p",opt,deliver_cb,param,bus);
+
+	if( !deliver_cb || !bus ) {
+		dbgprint(MOD_MODBUS,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_bus = (modbus_t)malloc(sizeof(struct _modbus_t));
+	if( !new_bus ) {
+		dbgprint(MOD_MODBUS,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODBUS);
+	}
+	memset(new_bus,0,sizeof(struct _modbus_t));
+
+	new_bus->queue_size = (opt && opt->queue_size) ? opt->queue_size : MODBUS_DEFAULT_QUEUE;
+	new_bus->deliver_cb = deliver_cb;
+	new_bus->param = param;
+
+	ws = wlock_create(&new_bus->lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODBUS,__func__,"failed to create lock (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	lock_created = true;
+
+	ws = wcond_create(&new_bus->cond);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODBUS,__func__,"failed to create condition (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	cond_created = true;
+
+	ws = wthread_create(_modbus_thread,new_bus,&new_bus->thread);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODBUS,__func__,"failed to create bus thread (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	*bus = new_bus;
+	DBGRET_SUCCESS(MOD_MODBUS);
+
+return_fail:
+	if( cond_created )
+		wcond_free(&new_bus->cond);
+	if( lock_created )
+		wlock_free(&new_bus->lock);
+	free(new_bus);
+	DBGRET_FAILURE(MOD_MODBUS);
+}
+
+/*
+   modbus_stop
+
+   Stops the bus thread (after the delivery in progress) and waits for it,
+   the bus isn't freed and publish/subscribe calls keep working but nothing
+   is delivered anymore. Used to shut down when the deliver callback and
+   the publishers depend on each other (see modmgr_unload).
+*/
+wstatus
+modbus_stop(modbus_t bus)
+{
+	dbgprint(MOD_MODBUS,__func__,"called with bus=%p",bus);
+
+	if( !bus ) {
+		dbgprint(MOD_MODBUS,__func__,"invalid bus argument (bus=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( bus->finished ) {
+		DBGRET_SUCCESS(MOD_MODBUS);
+	}
+
+	wlock_acquire(&bus->lock);
+	bus->stopping = true;
+	wcond_broadcast(&bus->cond);
+	wlock_release(&bus->lock);
+
+	wthread_wait(bus->thread);
+	bus->finished = true;
+
+	DBGRET_SUCCESS(MOD_MODBUS);
+}
+
+/*
+   modbus_destroy
+
+   Stops the bus (if modbus_stop wasn't called yet) and frees it with all
+   the subscribers, events not delivered are dropped.
+*/
+wstatus
+modbus_destroy(modbus_t bus)
+{
+	modbus_sub_t *sub;
+
+	dbgprint(MOD_MODBUS,__func__,"called with bus=%p",bus);
+
+	if( !bus ) {
+		dbgprint(MOD_MODBUS,__func__,"invalid bus argument (bus=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	modbus_stop(bus);
+
+	while( (sub = bus->subs) ) {
+		bus->subs = sub->next;
+		_modbus_sub_free(sub);
+	}
+
+	wcond_free(&bus->cond);
+	wlock_free(&bus->lock);
+	free(bus);
+	DBGRET_SUCCESS(MOD_MODBUS);
+}
+
+/*
+   modbus_subscribe
+
+   Subscribes a module to a topic or topic prefix (pattern ending with '*').
+   The queue of the subscriber is created by its first subscription with
+   queue_size events (0 = default of the bus), later subscriptions share it.
+   Subscribing twice to the same pattern does nothing.
+*/
+wstatus
+modbus_subscribe(modbus_t bus,const char *subscriber,const char *pattern,unsigned int queue_size)
+{
+	modbus_sub_t *sub = 0;
+	bool created = false;
+	unsigned int i;
+
+	dbgprint(MOD_MODBUS,__func__,"called with bus=%p, subscriber=\"%s\", pattern=\"%s\", queue_size=%u",
+			bus,z_ptr(subscriber),z_ptr(pattern),queue_size);
+
+	if( !bus || !subscriber || !pattern || !strlen(subscriber) || !strlen(pattern) ) {
+		dbgprint(MOD_MODBUS,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( (strlen(subscriber) >= REQMODSIZE) || (strlen(pattern) >= MODBUS_TOPICSIZE) ) {
+		dbgprint(MOD_MODBUS,__func__,"subscriber or pattern too long");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&bus->lock);
+
+	sub = _modbus_sub_find(bus,subscriber);
+	if( !sub )
+	{
+		sub = (modbus_sub_t*)malloc(sizeof(modbus_sub_t));
+		if( !sub ) {
+			dbgprint(MOD_MODBUS,__func__,"malloc failed");
+			goto return_fail;
+		}
+		memset(sub,0,sizeof(modbus_sub_t));
+		created = true;
+
+		strcpy(sub->name,subscriber);
+		sub->size = queue_size ? queue_size : bus->queue_size;
+		sub->pool = (modbus_event_t*)malloc(sub->size * sizeof(modbus_event_t));
+		sub->buckets = (modbus_event_t**)malloc(sub->size * sizeof(modbus_event_t*));
+		if( !sub->pool || !sub->buckets ) {
+			dbgprint(MOD_MODBUS,__func__,"malloc failed");
+			goto return_fail;
+		}
+		memset(sub->buckets,0,sub->size * sizeof(modbus_event_t*));
+
+		for( i = 0 ; i < sub->size ; i++ ) {
+			sub->pool[i].event = 0;
+			sub->pool[i].next = (i + 1 < sub->size) ? &sub->pool[i+1] : 0;
+		}
+		sub->free_list = &sub->pool[0];
+	}
+
+	for( i = 0 ; i < sub->pattern_count ; i++ )
+	{
+		if( !strcmp(sub->patterns[i],pattern) ) {
+			wlock_release(&bus->lock);
+			dbgprint(MOD_MODBUS,__func__,"%s is already subscribed to %s",subscriber,pattern);
+			DBGRET_SUCCESS(MOD_MODBUS);
+		}
+	}
+
+	if( sub->pattern_count == MODBUS_MAXPATTERNS ) {
+		dbgprint(MOD_MODBUS,__func__,"%s has too many subscriptions (max is %u)",subscriber,MODBUS_MAXPATTERNS);
+		goto return_fail;
+	}
+
+	strcpy(sub->patterns[sub->pattern_count++],pattern);
+
+	if( created ) {
+		sub->next = bus->subs;
+		bus->subs = sub;
+	}
+
+	wlock_release(&bus->lock);
+	dbgprint(MOD_MODBUS,__func__,"subscribed %s to %s",subscriber,pattern);
+	DBGRET_SUCCESS(MOD_MODBUS);
+
+return_fail:
+	wlock_release(&bus->lock);
+	if( created ) {
+		free(sub->pool);
+		free(sub->buckets);
+		free(sub);
+	}
+	DBGRET_FAILURE(MOD_MODBUS);
+}
+
+/*
+   modbus_unsubscribe
+
+   Removes a subscription of a module, with pattern 0 all of them. When the
+   last subscription is removed the subscriber is freed and the events still
+   queued are dropped.
+*/
+wstatus
+modbus_unsubscribe(modbus_t bus,const char *subscriber,const char *pattern)
+{
+	modbus_sub_t *sub, **pp, **rp;
+	unsigned int i;
+
+	dbgprint(MOD_MODBUS,__func__,"called with bus=%p, subscriber=\"%s\", pattern=\"%s\"",
+			bus,z_ptr(subscriber),z_ptr(pattern));
+
+	if( !bus || !subscriber ) {
+		dbgprint(MOD_MODBUS,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&bus->lock);
+
+	sub = _modbus_sub_find(bus,subscriber);
+	if( !sub ) {
+		wlock_release(&bus->lock);
+		dbgprint(MOD_MODBUS,__func__,"%s has no subscriptions",subscriber);
+		DBGRET_FAILURE(MOD_MODBUS);
+	}
+
+	if( pattern )
+	{
+		for( i = 0 ; i < sub->pattern_count ; i++ )
+			if( !strcmp(sub->patterns[i],pattern) )
+				break;
+
+		if( i == sub->pattern_count ) {
+			wlock_release(&bus->lock);
+			dbgprint(MOD_MODBUS,__func__,"%s isn't subscribed to %s",subscriber,pattern);
+			DBGRET_FAILURE(MOD_MODBUS);
+		}
+
+		sub->pattern_count--;
+		if( i != sub->pattern_count )
+			strcpy(sub->patterns[i],sub->patterns[sub->pattern_count]);
+	} else
+		sub->pattern_count = 0;
+
+	if( sub->pattern_count ) {
+		wlock_release(&bus->lock);
+		DBGRET_SUCCESS(MOD_MODBUS);
+	}
+
+	/* no subscriptions left, remove the subscriber */
+
+	for( pp = &bus->subs ; *pp ; pp = &(*pp)->next )
+		if( *pp == sub ) {
+			*pp = sub->next;
+			break;
+		}
+
+	if( sub->ready )
+	{
+		for( rp = &bus->ready_head ; *rp ; rp = &(*rp)->next_ready )
+		{
+			if( *rp == sub ) {
+				*rp = sub->next_ready;
+				break;
+			}
+		}
+
+		bus->ready_tail = 0;
+		for( rp = &bus->ready_head ; *rp ; rp = &(*rp)->next_ready )
+			bus->ready_tail = *rp;
+	}
+
+	wlock_release(&bus->lock);
+
+	_modbus_sub_free(sub);
+	dbgprint(MOD_MODBUS,__func__,"removed subscriber %s",subscriber);
+	DBGRET_SUCCESS(MOD_MODBUS);
+}
+
+/*
+   modbus_publish
+
+   Publishes an event, it's queued for every subscriber with a matching
+   subscription and this returns without waiting for the deliveries. The
+   event is sealed if it wasn't already and shared by all the subscribers,
+   the caller keeps its reference. Events with the same topic and key are
+   conflated in the queues, key may be 0 for events that must not be.
+*/
+wstatus
+modbus_publish(modbus_t bus,const char *topic,const char *key,request_t event)
+{
+	char ckey[MODBUS_TOPICSIZE+MODBUS_KEYSIZE];
+	uint32_t hash = 0;
+	modbus_sub_t *sub;
+	wstatus ws;
+
+	if( !bus || !topic || !event ) {
+		dbgprint(MOD_MODBUS,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( (strlen(topic) >= MODBUS_TOPICSIZE) || (key && (strlen(key) >= MODBUS_KEYSIZE)) ) {
+		dbgprint(MOD_MODBUS,__func__,"topic or key too long");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( !req_is_sealed(event) )
+	{
+		ws = req_seal(event);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODBUS,__func__,"failed to seal event (ws=%s)",wstatus_str(ws));
+			DBGRET_FAILURE(MOD_MODBUS);
+		}
+	}
+
+	ckey[0] = '\0';
+	if( key ) {
+		snprintf(ckey,sizeof(ckey),"%s %s",topic,key);
+		hash = _modbus_hash(ckey);
+	}
+
+	wlock_acquire(&bus->lock);
+	for( sub = bus->subs ; sub ; sub = sub->next )
+		if( _modbus_sub_match(sub,topic) )
+			_modbus_sub_push(bus,sub,ckey,hash,event);
+	wlock_release(&bus->lock);
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   modbus_status
+
+   Returns the queue depth and counters of a subscriber.
+*/
+wstatus
+modbus_status(modbus_t bus,const char *subscriber,modbus_status_t *status)
+{
+	modbus_sub_t *sub;
+
+	if( !bus || !subscriber || !status )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	wlock_acquire(&bus->lock);
+
+	sub = _modbus_sub_find(bus,subscriber);
+	if( !sub ) {
+		wlock_release(&bus->lock);
+		return WSTATUS_FAILURE;
+	}
+
+	status->depth = sub->depth;
+	status->queued = sub->queued;
+	status->delivered = sub->delivered;
+	status->conflated = sub->conflated;
+	status->dropped = sub->dropped;
+
+	wlock_release(&bus->lock);
+	return WSTATUS_SUCCESS;
+}
+
@@ -0,0 +1,88 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Event bus of modmgr (publish/subscribe). State changes of ap, apl, apmgr,
+   map and mapmgr are notified by hook routines that run inline in the
+   thread doing the change, and SSR modules have no way to receive them.
+   The event bus lets any module, DCR or SSR, subscribe to topics and get
+   the events through modmgr like any other request.
+
+   Topics are dot separated names, by convention the module followed by the
+   object, "ap.<name>", "apmgr", "map.<name>"... A subscription is either a
+   topic or a prefix ending with '*': "ap.*" matches the events of every
+   AP, "*" matches all the events.
+
+   Publishing doesn't wait for the subscribers, the event is put in the
+   queue of each subscriber with a matching subscription and the bus thread
+   delivers the queues in round-robin (see modmgr_publish). The queues are
+   bounded and conflate the events by key: an event published with the
+   same topic and key of an event still queued replaces it in place, so a
+   slow subscriber receives the latest value of each key instead of every
+   change. When the queue is full of different keys the oldest event is
+   dropped. Events published without key are never conflated.
+
+   A subscriber watching thousands of APs costs the publishers one hash
+   lookup per event, whatever the speed it takes the events.
+*/
+
+#ifndef _MODBUS_H
+#define _MODBUS_H
+
+#include <stdbool.h>
+#include "wstatus.h"
+#include "req.h"
+
+#define MODBUS_TOPICSIZE 128
+#define MODBUS_KEYSIZE 128
+#define MODBUS_MAXPATTERNS 16			/* subscriptions of each subscriber */
+#define MODBUS_DEFAULT_QUEUE 1024
+#define MODBUS_BATCH 16					/* events delivered per turn of a subscriber */
+
+/* called by the bus thread, the event is borrowed for the call */
+typedef void (*MODBUSDELIVERCB)(void *param,const char *subscriber,request_t event);
+
+typedef struct _modbus_opt_t
+{
+	unsigned int queue_size;			/* default queue of the subscribers, 0 = MODBUS_DEFAULT_QUEUE */
+} modbus_opt_t;
+
+typedef struct _modbus_status_t
+{
+	unsigned int depth;					/* events queued now */
+	unsigned long queued;
+	unsigned long delivered;
+	unsigned long conflated;			/* events replaced by a newer one */
+	unsigned long dropped;				/* events dropped, queue full */
+} modbus_status_t;
+
+typedef struct _modbus_t *modbus_t;
+
+wstatus modbus_create(const modbus_opt_t *opt,MODBUSDELIVERCB deliver_cb,void *param,modbus_t *bus);
+wstatus modbus_stop(modbus_t bus);
+wstatus modbus_destroy(modbus_t bus);
+wstatus modbus_subscribe(modbus_t bus,const char *subscriber,const char *pattern,unsigned int queue_size);
+wstatus modbus_unsubscribe(modbus_t bus,const char *subscriber,const char *pattern);
+wstatus modbus_publish(modbus_t bus,const char *topic,const char *key,request_t event);
+wstatus modbus_status(modbus_t bus,const char *subscriber,modbus_status_t *status);
+
+#endif
+
@@ -0,0 +1,559 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "req.h"
+#include "modcast.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#include <time.h>
+#endif
+
+typedef struct _modcast_member_t
+{
+	bool used;
+	char name[REQMODSIZE+1];
+	unsigned long replies;
+	unsigned long missed;
+	uint64_t last_rtt_us;
+} modcast_member_t;
+
+/* request sent to the group, the bits of the masks are member slots */
+typedef struct _modcast_pending_t
+{
+	bool used;
+	bool open;							/* waiting for replies */
+	int id;
+	char requester[REQMODSIZE+1];
+	uint64_t sent_ns;
+	uint64_t deadline_ns;
+	uint64_t expect_mask;
+	uint64_t reply_mask;
+	uint32_t rtt_us[MODCAST_MAXMEMBERS];
+	struct _modcast_pending_t *next;	/* bucket chain */
+} modcast_pending_t;
+
+struct _modcast_t
+{
+	modcast_opt_t opt;
+	wlock_t lock;
+	modcast_member_t members[MODCAST_MAXMEMBERS];
+	unsigned int member_count;
+	modcast_pending_t pending[MODCAST_PENDING];
+	modcast_pending_t *buckets[MODCAST_PENDING];
+	uint64_t sent;						/* collections opened, the next one takes slot sent % MODCAST_PENDING */
+	uint64_t expired;					/* collections before this one aren't open */
+};
+
+/*
+   _modcast_now_ns
+
+   Helper function that returns the monotonic clock in nanoseconds.
+*/
+static uint64_t
+_modcast_now_ns(void)
+{
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+	return (uint64_t)GetTickCount64() * 1000000ULL;
+#endif
+}
+
+/*
+   _modcast_bucket
+
+   Helper function that returns the bucket of a request, FNV-1a of the
+   requester and the id.
+*/
+static unsigned int
+_modcast_bucket(int id,const char *requester)
+{
+	uint32_t hash = 2166136261u;
+	unsigned int i,num = (unsigned int)id;
+
+	for( ; *requester ; requester++ )
+		hash = (hash ^ (uint8_t)*requester) * 16777619u;
+	for( i = 0 ; i < sizeof(num) ; i++, num >>= 8 )
+		hash = (hash ^ (num & 0xFF)) * 16777619u;
+
+	return hash % MODCAST_PENDING;
+}
+
+/*
+   _modcast_find
+
+   Helper function that returns the slot of a member, or -1.
+*/
+static int
+_modcast_find(modcast_t cast,const char *member)
+{
+	unsigned int i;
+
+	for( i = 0 ; i < MODCAST_MAXMEMBERS ; i++ )
+		if( cast->members[i].used && !strcmp(cast->members[i].name,member) )
+			return (int)i;
+
+	return -1;
+}
+
+/*
+   _modcast_lookup
+
+   Helper function that returns the collection of a request, or 0.
+*/
+static modcast_pending_t *
+_modcast_lookup(modcast_t cast,int id,const char *requester)
+{
+	modcast_pending_t *entry;
+
+	for( entry = cast->buckets[_modcast_bucket(id,requester)] ; entry ; entry = entry->next )
+		if( (entry->id == id) && !strcmp(entry->requester,requester) )
+			return entry;
+
+	return 0;
+}
+
+/*
+   _modcast_close
+
+   Helper function that closes a collection, the members that didn't reply
+   yet missed the request.
+*/
+static void
+_modcast_close(modcast_t cast,modcast_pending_t *entry)
+{
+	uint64_t missing;
+	unsigned int i;
+
+	if( !entry->open )
+		return;
+
+	missing = entry->expect_mask & ~entry->reply_mask;
+	for( i = 0 ; missing ; i++, missing >>= 1 )
+		if( missing & 1 )
+			cast->members[i].missed++;
+
+	entry->open = false;
+}
+
+/*
+   _modcast_expire
+
+   Helper function that closes the collections past their deadline. They
+   are opened in order with the same timeout, so the check stops at the
+   first one still in time.
+*/
+static void
+_modcast_expire(modcast_t cast,uint64_t now_ns)
+{
+	modcast_pending_t *entry;
+
+	while( cast->expired < cast->sent )
+	{
+		entry = &cast->pending[cast->expired % MODCAST_PENDING];
+		if( entry->open && (entry->deadline_ns > now_ns) )
+			break;
+
+		_modcast_close(cast,entry);
+		cast->expired++;
+	}
+}
+
+/*
+   _modcast_unlink
+
+   Helper function that removes a collection from its bucket.
+*/
+static void
+_modcast_unlink(modcast_t cast,modcast_pending_t *entry)
+{
+	modcast_pending_t **link;
+
+	link = &cast->buckets[_modcast_bucket(entry->id,entry->requester)];
+	while( *link && (*link != entry) )
+		link = &(*link)->next;
+	if( *link )
+		*link = entry->next;
+
+	entry->used = false;
+	entry->next = 0;
+}
+
+/*
+   modcast_create
+
+   Creates a multicast group without members, zero options select the
+   defaults.
+*/
+wstatus
+modcast_create(const modcast_opt_t *opt,modcast_t *cast)
+{
+	modcast_t new_cast;
+
+	dbgprint(MOD_MODCAST,__func__,"called with opt=%p, cast=%p",opt,cast);
+
+	if( !cast ) {
+		dbgprint(MOD_MODCAST,__func__,"invalid cast argument (cast=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_cast = (modcast_t)malloc(sizeof(struct _modcast_t));
+	if( !new_cast ) {
+		dbgprint(MOD_MODCAST,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODCAST);
+	}
+	memset(new_cast,0,sizeof(struct _modcast_t));
+
+	if( opt )
+		new_cast->opt = *opt;
+	if( !new_cast->opt.reply_timeout_ms )
+		new_cast->opt.reply_timeout_ms = MODCAST_DEFAULT_TIMEOUT_MS;
+
+	if( wlock_create(&new_cast->lock) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODCAST,__func__,"failed to create lock");
+		free(new_cast);
+		DBGRET_FAILURE(MOD_MODCAST);
+	}
+
+	*cast = new_cast;
+	DBGRET_SUCCESS(MOD_MODCAST);
+}
+
+/*
+   modcast_destroy
+
+   Destroys the group, the open collections are dropped.
+*/
+wstatus
+modcast_destroy(modcast_t cast)
+{
+	dbgprint(MOD_MODCAST,__func__,"called with cast=%p",cast);
+
+	if( !cast ) {
+		dbgprint(MOD_MODCAST,__func__,"invalid cast argument (cast=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_free(&cast->lock);
+	free(cast);
+	DBGRET_SUCCESS(MOD_MODCAST);
+}
+
+/*
+   modcast_join
+
+   Adds a member, the replies of the requests sent from now on are expected
+   from it too. Joining twice does nothing.
+*/
+wstatus
+modcast_join(modcast_t cast,const char *member)
+{
+	int slot;
+
+	dbgprint(MOD_MODCAST,__func__,"called with cast=%p, member=%s",cast,z_ptr(member));
+
+	if( !cast || !member || !member[0] || (strlen(member) > REQMODSIZE) ) {
+		dbgprint(MOD_MODCAST,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&cast->lock);
+
+	if( _modcast_find(cast,member) >= 0 ) {
+		wlock_release(&cast->lock);
+		DBGRET_SUCCESS(MOD_MODCAST);
+	}
+
+	for( slot = 0 ; (slot < MODCAST_MAXMEMBERS) && cast->members[slot].used ; slot++ );
+	if( slot == MODCAST_MAXMEMBERS ) {
+		wlock_release(&cast->lock);
+		dbgprint(MOD_MODCAST,__func__,"group is full (%u members)",MODCAST_MAXMEMBERS);
+		DBGRET_FAILURE(MOD_MODCAST);
+	}
+
+	memset(&cast->members[slot],0,sizeof(modcast_member_t));
+	cast->members[slot].used = true;
+	strcpy(cast->members[slot].name,member);
+	cast->member_count++;
+
+	wlock_release(&cast->lock);
+	DBGRET_SUCCESS(MOD_MODCAST);
+}
+
+/*
+   modcast_leave
+
+   Removes a member, the open collections don't wait for it anymore.
+*/
+wstatus
+modcast_leave(modcast_t cast,const char *member)
+{
+	uint64_t bit;
+	unsigned int i;
+	int slot;
+
+	dbgprint(MOD_MODCAST,__func__,"called with cast=%p, member=%s",cast,z_ptr(member));
+
+	if( !cast || !member ) {
+		dbgprint(MOD_MODCAST,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&cast->lock);
+
+	slot = _modcast_find(cast,member);
+	if( slot < 0 ) {
+		wlock_release(&cast->lock);
+		dbgprint(MOD_MODCAST,__func__,"member (%s) isn't in the group",member);
+		DBGRET_FAILURE(MOD_MODCAST);
+	}
+
+	/* the slot may be reused, the collections forget it */
+	bit = 1ULL << slot;
+	for( i = 0 ; i < MODCAST_PENDING ; i++ ) {
+		cast->pending[i].expect_mask &= ~bit;
+		cast->pending[i].reply_mask &= ~bit;
+		if( cast->pending[i].open && (cast->pending[i].reply_mask == cast->pending[i].expect_mask) )
+			cast->pending[i].open = false;
+	}
+
+	cast->members[slot].used = false;
+	cast->member_count--;
+
+	wlock_release(&cast->lock);
+	DBGRET_SUCCESS(MOD_MODCAST);
+}
+
+/*
+   modcast_sent
+
+   A request id of requester was sent to the group, a collection expecting
+   a reply of each member is opened. A group without members opens none.
+*/
+void
+modcast_sent(modcast_t cast,int id,const char *requester)
+{
+	modcast_pending_t *entry;
+	uint64_t now_ns;
+	unsigned int i,bucket;
+
+	if( !cast || !requester || (strlen(requester) > REQMODSIZE) )
+		return;
+
+	now_ns = _modcast_now_ns();
+
+	wlock_acquire(&cast->lock);
+
+	_modcast_expire(cast,now_ns);
+
+	if( !cast->member_count ) {
+		wlock_release(&cast->lock);
+		return;
+	}
+
+	/* the slot of the oldest collection, closed first if it's still open */
+	entry = &cast->pending[cast->sent % MODCAST_PENDING];
+	if( cast->sent - cast->expired == MODCAST_PENDING ) {
+		_modcast_close(cast,entry);
+		cast->expired++;
+	}
+	if( entry->used )
+		_modcast_unlink(cast,entry);
+
+	/* a request id reused by the requester replaces the old collection */
+	if( _modcast_lookup(cast,id,requester) )
+		_modcast_unlink(cast,_modcast_lookup(cast,id,requester));
+
+	memset(entry,0,sizeof(modcast_pending_t));
+	entry->used = true;
+	entry->open = true;
+	entry->id = id;
+	strcpy(entry->requester,requester);
+	entry->sent_ns = now_ns;
+	entry->deadline_ns = now_ns + (uint64_t)cast->opt.reply_timeout_ms * 1000000ULL;
+	for( i = 0 ; i < MODCAST_MAXMEMBERS ; i++ )
+		if( cast->members[i].used )
+			entry->expect_mask |= 1ULL << i;
+
+	bucket = _modcast_bucket(id,requester);
+	entry->next = cast->buckets[bucket];
+	cast->buckets[bucket] = entry;
+	cast->sent++;
+
+	wlock_release(&cast->lock);
+}
+
+/*
+   modcast_reply
+
+   A reply of member to the request id of requester was received, returns
+   true if the request was sent to the group. Replies of members that
+   weren't expected, late or duplicated don't change the collection.
+*/
+bool
+modcast_reply(modcast_t cast,int id,const char *requester,const char *member)
+{
+	modcast_pending_t *entry;
+	uint64_t now_ns,rtt_us,bit;
+	int slot;
+
+	if( !cast || !requester || !member )
+		return false;
+
+	now_ns = _modcast_now_ns();
+
+	wlock_acquire(&cast->lock);
+
+	_modcast_expire(cast,now_ns);
+
+	entry = _modcast_lookup(cast,id,requester);
+	if( !entry ) {
+		wlock_release(&cast->lock);
+		return false;
+	}
+
+	slot = _modcast_find(cast,member);
+	if( (slot < 0) || !entry->open ) {
+		wlock_release(&cast->lock);
+		return true;
+	}
+
+	bit = 1ULL << slot;
+	if( (entry->expect_mask & bit) && !(entry->reply_mask & bit) )
+	{
+		rtt_us = (now_ns - entry->sent_ns) / 1000;
+		entry->reply_mask |= bit;
+		entry->rtt_us[slot] = rtt_us > UINT32_MAX ? UINT32_MAX : (uint32_t)rtt_us;
+		cast->members[slot].replies++;
+		cast->members[slot].last_rtt_us = rtt_us;
+
+		if( entry->reply_mask == entry->expect_mask )
+			entry->open = false;
+	}
+
+	wlock_release(&cast->lock);
+	return true;
+}
+
+/*
+   modcast_collect
+
+   Returns the members expected to reply to the request id of requester, up
+   to list_size, and whether they replied. complete is set when all of them
+   replied. Fails if the collection of the request isn't kept (the request
+   wasn't sent to the group or it's too old).
+*/
+wstatus
+modcast_collect(modcast_t cast,int id,const char *requester,modcast_reply_t *list,unsigned int list_size,
+		unsigned int *count,bool *complete)
+{
+	modcast_pending_t *entry;
+	unsigned int i,n = 0;
+
+	dbgprint(MOD_MODCAST,__func__,"called with cast=%p, id=%d, requester=%s, list=%p, list_size=%u",
+			cast,id,z_ptr(requester),list,list_size);
+
+	if( !cast || !requester || !list || !count || !complete ) {
+		dbgprint(MOD_MODCAST,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&cast->lock);
+
+	_modcast_expire(cast,_modcast_now_ns());
+
+	entry = _modcast_lookup(cast,id,requester);
+	if( !entry ) {
+		wlock_release(&cast->lock);
+		dbgprint(MOD_MODCAST,__func__,"no collection for request %d of %s",id,requester);
+		DBGRET_FAILURE(MOD_MODCAST);
+	}
+
+	for( i = 0 ; (i < MODCAST_MAXMEMBERS) && (n < list_size) ; i++ )
+	{
+		if( !(entry->expect_mask & (1ULL << i)) )
+			continue;
+
+		memcpy(list[n].member,cast->members[i].name,sizeof(list[n].member));
+		list[n].replied = (entry->reply_mask & (1ULL << i)) != 0;
+		list[n].rtt_us = list[n].replied ? entry->rtt_us[i] : 0;
+		n++;
+	}
+	*count = n;
+	*complete = entry->reply_mask == entry->expect_mask;
+
+	wlock_release(&cast->lock);
+	DBGRET_SUCCESS(MOD_MODCAST);
+}
+
+/*
+   modcast_status
+
+   Returns the counters of up to list_size members of the group, count is
+   set to the number of members returned. The expired collections are
+   closed first.
+*/
+wstatus
+modcast_status(modcast_t cast,modcast_status_t *list,unsigned int list_size,unsigned int *count)
+{
+	modcast_member_t *member;
+	unsigned int i,n = 0;
+
+	dbgprint(MOD_MODCAST,__func__,"called with cast=%p, list=%p, list_size=%u, count=%p",
+			cast,list,list_size,count);
+
+	if( !cast || !list || !count ) {
+		dbgprint(MOD_MODCAST,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&cast->lock);
+
+	_modcast_expire(cast,_modcast_now_ns());
+
+	for( i = 0 ; (i < MODCAST_MAXMEMBERS) && (n < list_size) ; i++ )
+	{
+		member = &cast->members[i];
+		if( !member->used )
+			continue;
+
+		memcpy(list[n].member,member->name,sizeof(list[n].member));
+		list[n].replies = member->replies;
+		list[n].missed = member->missed;
+		list[n].last_rtt_us = member->last_rtt_us;
+		n++;
+	}
+	*count = n;
+
+	wlock_release(&cast->lock);
+	DBGRET_SUCCESS(MOD_MODCAST);
+}
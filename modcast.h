@@ -0,0 +1,89 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Multicast groups of modmgr. Sending a request to every AP of a list took
+   a unicast send (and an address resolution) per AP. A multicast group is
+   registered in modmgr like a module (MODREG_COMM_MCAST) with the address
+   and port of the group, a request sent to its name leaves modmgr as a
+   single datagram and every member that joined the group (see
+   wchannel_mcast_join) gets it. Each member replies with its own name as
+   source, the replies are routed to the requester like any other.
+
+   This module correlates the replies: the members expected to answer are
+   added with modcast_join, each request sent to the group (modcast_sent)
+   opens a collection with the members at that moment, modcast_reply marks
+   the member that replied. A collection is complete when all of them
+   replied, after reply_timeout the members that didn't reply are counted
+   as missed. modcast_collect returns which members replied to a request
+   while its collection is kept, the last MODCAST_PENDING requests of the
+   group (a collection still open when its slot is reused is expired
+   first). modcast_status returns the counters of each member.
+*/
+
+#ifndef _MODCAST_H
+#define _MODCAST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wstatus.h"
+#include "req.h"
+
+#define MODCAST_MAXMEMBERS 64
+#define MODCAST_PENDING 256				/* collections kept, per group */
+#define MODCAST_DEFAULT_TIMEOUT_MS 2000
+
+typedef struct _modcast_opt_t
+{
+	unsigned int reply_timeout_ms;		/* 0 = MODCAST_DEFAULT_TIMEOUT_MS */
+} modcast_opt_t;
+
+/* member of the group, see modcast_status */
+typedef struct _modcast_status_t
+{
+	char member[REQMODSIZE+1];
+	unsigned long replies;
+	unsigned long missed;				/* requests it didn't reply before the timeout */
+	uint64_t last_rtt_us;				/* time to its last reply */
+} modcast_status_t;
+
+/* reply of a member to a request, see modcast_collect */
+typedef struct _modcast_reply_t
+{
+	char member[REQMODSIZE+1];
+	bool replied;
+	uint64_t rtt_us;					/* 0 if it didn't reply */
+} modcast_reply_t;
+
+typedef struct _modcast_t *modcast_t;
+
+wstatus modcast_create(const modcast_opt_t *opt,modcast_t *cast);
+wstatus modcast_destroy(modcast_t cast);
+wstatus modcast_join(modcast_t cast,const char *member);
+wstatus modcast_leave(modcast_t cast,const char *member);
+void modcast_sent(modcast_t cast,int id,const char *requester);
+bool modcast_reply(modcast_t cast,int id,const char *requester,const char *member);
+wstatus modcast_collect(modcast_t cast,int id,const char *requester,modcast_reply_t *list,unsigned int list_size,
+		unsigned int *count,bool *complete);
+wstatus modcast_status(modcast_t cast,modcast_status_t *list,unsigned int list_size,unsigned int *count);
+
+#endif
+
@@ -0,0 +1,791 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "req.h"
+#include "modgroup.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#include <time.h>
+#endif
+
+#define MODGROUP_SWEEP 16				/* pending entries checked per pick */
+
+typedef struct _modgroup_replica_t
+{
+	void *member;
+	char id[MODGROUP_IDSIZE];
+	unsigned int outstanding;
+	unsigned int failures;				/* consecutive */
+	uint64_t down_until_ns;
+	unsigned long sent;
+	unsigned long failed;
+	unsigned long timeouts;
+} modgroup_replica_t;
+
+/* point of the consistent hashing ring */
+typedef struct _modgroup_point_t
+{
+	uint32_t hash;
+	unsigned int replica;
+} modgroup_point_t;
+
+/* request forwarded to a replica and waiting for its reply */
+typedef struct _modgroup_pending_t
+{
+	bool used;
+	int id;
+	char requester[REQMODSIZE];
+	void *member;
+	uint64_t deadline_ns;
+	struct _modgroup_pending_t *next;	/* bucket chain, or free list */
+} modgroup_pending_t;
+
+struct _modgroup_t
+{
+	modgroup_opt_t opt;
+	wlock_t lock;
+	modgroup_replica_t replicas[MODGROUP_MAXREPLICAS];
+	unsigned int count;
+	unsigned int next;					/* rotates the ties of least outstanding */
+	uint32_t rand_state;
+	modgroup_point_t ring[MODGROUP_MAXREPLICAS*MODGROUP_VNODES];
+	unsigned int ring_size;
+	modgroup_pending_t pending[MODGROUP_PENDING];
+	modgroup_pending_t *buckets[MODGROUP_PENDING];
+	modgroup_pending_t *free_list;
+	unsigned int sweep;
+};
+
+/*
+   _modgroup_now_ns
+
+   Helper function that returns the monotonic clock in nanoseconds.
+*/
+static uint64_t
+_modgroup_now_ns(void)
+{
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+	return (uint64_t)GetTickCount64() * 1000000ULL;
+#endif
+}
+
+/*
+   _modgroup_hash
+
+   Helper function that returns the FNV-1a hash of a string followed by a
+   number, mixed so all the bits are usable (the ring and the buckets).
+*/
+static uint32_t
+_modgroup_hash(const char *str,unsigned int num)
+{
+	uint32_t hash = 2166136261u;
+	unsigned int i;
+
+	for( ; *str ; str++ )
+		hash = (hash ^ (uint8_t)*str) * 16777619u;
+	for( i = 0 ; i < sizeof(num) ; i++, num >>= 8 )
+		hash = (hash ^ (num & 0xFF)) * 16777619u;
+
+	/* FNV alone clusters similar ids (the ring points), mix it (murmur3 finalizer) */
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+/*
+   _modgroup_random
+
+   Helper function that returns a pseudo random number (xorshift), called
+   with the group lock acquired.
+*/
+static uint32_t
+_modgroup_random(modgroup_t group)
+{
+	uint32_t x = group->rand_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	group->rand_state = x;
+	return x;
+}
+
+/*
+   _modgroup_find
+
+   Helper function that returns the index of a member in the group, or -1.
+*/
+static int
+_modgroup_find(modgroup_t group,void *member)
+{
+	unsigned int i;
+
+	for( i = 0 ; i < group->count ; i++ )
+		if( group->replicas[i].member == member )
+			return (int)i;
+
+	return -1;
+}
+
+/*
+   _modgroup_up
+
+   Helper function that tells if a replica may get requests: it didn't reach
+   fail_max consecutive failures or its retry period is over.
+*/
+static bool
+_modgroup_up(modgroup_t group,const modgroup_replica_t *replica,uint64_t now_ns)
+{
+	return (replica->failures < group->opt.fail_max) || (now_ns >= replica->down_until_ns);
+}
+
+/*
+   _modgroup_failure
+
+   Helper function that counts a failure of a replica, at fail_max it's down
+   for a retry period.
+*/
+static void
+_modgroup_failure(modgroup_t group,modgroup_replica_t *replica,uint64_t now_ns)
+{
+	replica->failures++;
+	replica->failed++;
+
+	if( replica->failures >= group->opt.fail_max ) {
+		replica->down_until_ns = now_ns + (uint64_t)group->opt.retry_ms * 1000000ULL;
+		dbgprint(MOD_MODGROUP,__func__,"replica %s is down (%u consecutive failures)",
+				replica->id,replica->failures);
+	}
+}
+
+/*
+   _modgroup_point_cmp
+
+   qsort callback that orders the points of the ring.
+*/
+static int
+_modgroup_point_cmp(const void *a,const void *b)
+{
+	const modgroup_point_t *pa = (const modgroup_point_t *)a;
+	const modgroup_point_t *pb = (const modgroup_point_t *)b;
+
+	if( pa->hash != pb->hash )
+		return pa->hash < pb->hash ? -1 : 1;
+	return (int)pa->replica - (int)pb->replica;
+}
+
+/*
+   _modgroup_ring_build
+
+   Helper function that rebuilds the consistent hashing ring, each replica
+   has MODGROUP_VNODES points hashed from its id so the points of a replica
+   don't change when others are added or removed.
+*/
+static void
+_modgroup_ring_build(modgroup_t group)
+{
+	unsigned int i, v;
+
+	group->ring_size = 0;
+	for( i = 0 ; i < group->count ; i++ )
+		for( v = 0 ; v < MODGROUP_VNODES ; v++ ) {
+			group->ring[group->ring_size].hash = _modgroup_hash(group->replicas[i].id,v);
+			group->ring[group->ring_size].replica = i;
+			group->ring_size++;
+		}
+
+	qsort(group->ring,group->ring_size,sizeof(modgroup_point_t),_modgroup_point_cmp);
+}
+
+/*
+   _modgroup_pending_bucket
+
+   Helper function that returns the bucket of a pending request.
+*/
+static unsigned int
+_modgroup_pending_bucket(int id,const char *requester)
+{
+	return _modgroup_hash(requester,(unsigned int)id) % MODGROUP_PENDING;
+}
+
+/*
+   _modgroup_pending_remove
+
+   Helper function that unlinks a pending request from its bucket and puts it
+   in the free list.
+*/
+static void
+_modgroup_pending_remove(modgroup_t group,modgroup_pending_t *entry)
+{
+	modgroup_pending_t **link;
+
+	link = &group->buckets[_modgroup_pending_bucket(entry->id,entry->requester)];
+	while( *link && (*link != entry) )
+		link = &(*link)->next;
+	if( *link )
+		*link = entry->next;
+
+	entry->used = false;
+	entry->member = 0;
+	entry->next = group->free_list;
+	group->free_list = entry;
+}
+
+/*
+   _modgroup_pending_expire
+
+   Helper function that checks the next MODGROUP_SWEEP pending requests (or
+   all of them), the ones past their deadline count as a failure of their
+   replica.
+*/
+static void
+_modgroup_pending_expire(modgroup_t group,uint64_t now_ns,unsigned int max)
+{
+	modgroup_pending_t *entry;
+	int idx;
+
+	while( max-- )
+	{
+		entry = &group->pending[group->sweep];
+		group->sweep = (group->sweep + 1) % MODGROUP_PENDING;
+
+		if( !entry->used || (entry->deadline_ns > now_ns) )
+			continue;
+
+		idx = _modgroup_find(group,entry->member);
+		if( idx >= 0 ) {
+			if( group->replicas[idx].outstanding )
+				group->replicas[idx].outstanding--;
+			group->replicas[idx].timeouts++;
+			_modgroup_failure(group,&group->replicas[idx],now_ns);
+		}
+		_modgroup_pending_remove(group,entry);
+	}
+}
+
+/*
+   modgroup_create
+
+   Creates an empty replica group, zero options select the defaults.
+*/
+wstatus
+modgroup_create(const modgroup_opt_t *opt,modgroup_t *group)
+{
+	modgroup_t new_group;
+	unsigned int i;
+
+	dbgprint(MOD_MODGROUP,__func__,"called with opt=%p, group=%p",opt,group);
+
+	if( !group ) {
+		dbgprint(MOD_MODGROUP,__func__,"invalid group argument (group=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( opt && (opt->policy == MODGROUP_HASH) && !strlen(opt->hash_name) ) {
+		dbgprint(MOD_MODGROUP,__func__,"hash policy requires the name of the nvpair to hash");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_group = (modgroup_t)malloc(sizeof(struct _modgroup_t));
+	if( !new_group ) {
+		dbgprint(MOD_MODGROUP,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODGROUP);
+	}
+	memset(new_group,0,sizeof(struct _modgroup_t));
+
+	if( opt )
+		new_group->opt = *opt;
+	new_group->opt.hash_name[sizeof(new_group->opt.hash_name)-1] = '\0';
+	if( !new_group->opt.fail_max )
+		new_group->opt.fail_max = MODGROUP_DEFAULT_FAIL_MAX;
+	if( !new_group->opt.retry_ms )
+		new_group->opt.retry_ms = MODGROUP_DEFAULT_RETRY_MS;
+	if( !new_group->opt.pending_timeout_ms )
+		new_group->opt.pending_timeout_ms = MODGROUP_DEFAULT_PENDING_TIMEOUT_MS;
+
+	if( wlock_create(&new_group->lock) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODGROUP,__func__,"failed to create lock");
+		free(new_group);
+		DBGRET_FAILURE(MOD_MODGROUP);
+	}
+
+	for( i = MODGROUP_PENDING ; i-- ; ) {
+		new_group->pending[i].next = new_group->free_list;
+		new_group->free_list = &new_group->pending[i];
+	}
+
+	new_group->rand_state = (uint32_t)_modgroup_now_ns() | 1;
+
+	*group = new_group;
+	dbgprint(MOD_MODGROUP,__func__,"created replica group %p (policy=%d)",new_group,new_group->opt.policy);
+	DBGRET_SUCCESS(MOD_MODGROUP);
+}
+
+/*
+   modgroup_destroy
+
+   Frees a replica group, the members are not touched.
+*/
+wstatus
+modgroup_destroy(modgroup_t group)
+{
+	dbgprint(MOD_MODGROUP,__func__,"called with group=%p",group);
+
+	if( !group ) {
+		dbgprint(MOD_MODGROUP,__func__,"invalid group argument (group=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_free(&group->lock);
+	free(group);
+	DBGRET_SUCCESS(MOD_MODGROUP);
+}
+
+/*
+   modgroup_add
+
+   Adds a replica to the group, id identifies it in the hash ring (keep it
+   stable across restarts of the replica, e.g. "host port") and in the status.
+*/
+wstatus
+modgroup_add(modgroup_t group,void *member,const char *id)
+{
+	modgroup_replica_t *replica;
+
+	dbgprint(MOD_MODGROUP,__func__,"called with group=%p, member=%p, id=\"%s\"",group,member,z_ptr(id));
+
+	if( !group || !member || !id ) {
+		dbgprint(MOD_MODGROUP,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&group->lock);
+
+	if( _modgroup_find(group,member) >= 0 ) {
+		wlock_release(&group->lock);
+		dbgprint(MOD_MODGROUP,__func__,"member is already in the group");
+		DBGRET_FAILURE(MOD_MODGROUP);
+	}
+
+	if( group->count == MODGROUP_MAXREPLICAS ) {
+		wlock_release(&group->lock);
+		dbgprint(MOD_MODGROUP,__func__,"group is full (%u replicas)",MODGROUP_MAXREPLICAS);
+		DBGRET_FAILURE(MOD_MODGROUP);
+	}
+
+	replica = &group->replicas[group->count++];
+	memset(replica,0,sizeof(modgroup_replica_t));
+	replica->member = member;
+	strncpy(replica->id,id,sizeof(replica->id)-1);
+
+	_modgroup_ring_build(group);
+	wlock_release(&group->lock);
+
+	dbgprint(MOD_MODGROUP,__func__,"added replica %s, the group has %u replicas",id,group->count);
+	DBGRET_SUCCESS(MOD_MODGROUP);
+}
+
+/*
+   modgroup_remove
+
+   Removes a replica from the group, its pending requests are forgotten.
+*/
+wstatus
+modgroup_remove(modgroup_t group,void *member)
+{
+	unsigned int i;
+	int idx;
+
+	dbgprint(MOD_MODGROUP,__func__,"called with group=%p, member=%p",group,member);
+
+	if( !group || !member ) {
+		dbgprint(MOD_MODGROUP,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&group->lock);
+
+	idx = _modgroup_find(group,member);
+	if( idx < 0 ) {
+		wlock_release(&group->lock);
+		dbgprint(MOD_MODGROUP,__func__,"member is not in the group");
+		DBGRET_FAILURE(MOD_MODGROUP);
+	}
+
+	for( i = 0 ; i < MODGROUP_PENDING ; i++ )
+		if( group->pending[i].used && (group->pending[i].member == member) )
+			_modgroup_pending_remove(group,&group->pending[i]);
+
+	memmove(&group->replicas[idx],&group->replicas[idx+1],
+			(group->count - idx - 1) * sizeof(modgroup_replica_t));
+	group->count--;
+
+	_modgroup_ring_build(group);
+	wlock_release(&group->lock);
+
+	DBGRET_SUCCESS(MOD_MODGROUP);
+}
+
+/*
+   modgroup_count
+
+   Returns the number of replicas of the group.
+*/
+unsigned int
+modgroup_count(modgroup_t group)
+{
+	unsigned int count;
+
+	if( !group )
+		return 0;
+
+	wlock_acquire(&group->lock);
+	count = group->count;
+	wlock_release(&group->lock);
+	return count;
+}
+
+/*
+   modgroup_hash_name
+
+   Returns the name of the nvpair hashed by the group, or 0 when its policy
+   isn't MODGROUP_HASH.
+*/
+const char *
+modgroup_hash_name(modgroup_t group)
+{
+	if( !group || (group->opt.policy != MODGROUP_HASH) )
+		return 0;
+	return group->opt.hash_name;
+}
+
+/*
+   modgroup_pick
+
+   Chooses the replica of the next request with the policy of the group, key
+   is the value of the hashed nvpair (0 when the request doesn't have it).
+   Replicas that are down are skipped, fails only when all of them are down.
+*/
+wstatus
+modgroup_pick(modgroup_t group,const char *key,void **member)
+{
+	modgroup_replica_t *best = 0, *a, *b;
+	unsigned int i, lo, hi, mid, ia, ib;
+	uint64_t now_ns;
+	uint32_t hash;
+
+	if( !group || !member ) {
+		dbgprint(MOD_MODGROUP,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	now_ns = _modgroup_now_ns();
+
+	wlock_acquire(&group->lock);
+
+	_modgroup_pending_expire(group,now_ns,MODGROUP_SWEEP);
+
+	if( (group->opt.policy == MODGROUP_HASH) && key && group->ring_size )
+	{
+		/* first point clockwise of the key, then the next replicas that are up */
+		hash = _modgroup_hash(key,0);
+		lo = 0;
+		hi = group->ring_size;
+		while( lo < hi ) {
+			mid = (lo + hi) / 2;
+			if( group->ring[mid].hash < hash )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for( i = 0 ; i < group->ring_size ; i++ ) {
+			a = &group->replicas[group->ring[(lo + i) % group->ring_size].replica];
+			if( _modgroup_up(group,a,now_ns) ) {
+				best = a;
+				break;
+			}
+		}
+		goto picked;
+	}
+
+	if( (group->opt.policy == MODGROUP_TWO_CHOICES) && (group->count > 2) )
+	{
+		ia = _modgroup_random(group) % group->count;
+		ib = _modgroup_random(group) % (group->count - 1);
+		if( ib >= ia )
+			ib++;
+		a = &group->replicas[ia];
+		b = &group->replicas[ib];
+
+		if( !_modgroup_up(group,a,now_ns) )
+			a = 0;
+		if( !_modgroup_up(group,b,now_ns) )
+			b = 0;
+		if( a && b )
+			best = (b->outstanding < a->outstanding) ? b : a;
+		else
+			best = a ? a : b;
+
+		/* both were down, look at all of them */
+		if( best )
+			goto picked;
+	}
+
+	/* least outstanding, the ties are rotated */
+	for( i = 0 ; i < group->count ; i++ ) {
+		a = &group->replicas[(group->next + i) % group->count];
+		if( !_modgroup_up(group,a,now_ns) )
+			continue;
+		if( !best || (a->outstanding < best->outstanding) )
+			best = a;
+	}
+	if( group->count )
+		group->next = (group->next + 1) % group->count;
+
+picked:
+	if( !best ) {
+		wlock_release(&group->lock);
+		dbgprint(MOD_MODGROUP,__func__,"all the %u replicas are down",group->count);
+		DBGRET_FAILURE(MOD_MODGROUP);
+	}
+
+	*member = best->member;
+	wlock_release(&group->lock);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   modgroup_sent
+
+   Counts a request forwarded to a replica, called before it's sent (the
+   replica may finish it before the send returns), modgroup_failed cancels it
+   when the send fails. With wait_reply the request is pending until its reply
+   (modgroup_reply, matched by the request id and requester) or until
+   pending_timeout, otherwise modgroup_done must be called when the replica
+   finished it.
+*/
+void
+modgroup_sent(modgroup_t group,void *member,int id,const char *requester,bool wait_reply)
+{
+	modgroup_pending_t *entry;
+	unsigned int bucket;
+	int idx;
+
+	if( !group || !member )
+		return;
+
+	wlock_acquire(&group->lock);
+
+	idx = _modgroup_find(group,member);
+	if( idx < 0 ) {
+		wlock_release(&group->lock);
+		return;
+	}
+
+	group->replicas[idx].sent++;
+
+	if( wait_reply )
+	{
+		entry = group->free_list;
+		if( !entry ) {
+			/* not tracked, it wouldn't leave the outstanding count */
+			wlock_release(&group->lock);
+			return;
+		}
+		group->free_list = entry->next;
+
+		entry->used = true;
+		entry->id = id;
+		memset(entry->requester,0,sizeof(entry->requester));
+		strncpy(entry->requester,requester ? requester : "",sizeof(entry->requester)-1);
+		entry->member = member;
+		entry->deadline_ns = _modgroup_now_ns() + (uint64_t)group->opt.pending_timeout_ms * 1000000ULL;
+
+		bucket = _modgroup_pending_bucket(id,entry->requester);
+		entry->next = group->buckets[bucket];
+		group->buckets[bucket] = entry;
+	}
+
+	group->replicas[idx].outstanding++;
+	wlock_release(&group->lock);
+}
+
+/*
+   modgroup_done
+
+   A request sent without wait_reply was finished by the replica.
+*/
+void
+modgroup_done(modgroup_t group,void *member)
+{
+	int idx;
+
+	if( !group || !member )
+		return;
+
+	wlock_acquire(&group->lock);
+	idx = _modgroup_find(group,member);
+	if( idx >= 0 ) {
+		if( group->replicas[idx].outstanding )
+			group->replicas[idx].outstanding--;
+		group->replicas[idx].failures = 0;
+	}
+	wlock_release(&group->lock);
+}
+
+/*
+   modgroup_reply
+
+   A reply was received from the group for the request id of requester, the
+   replica that had it pending is healthy. Replies that don't match a pending
+   request (late or duplicated) are ignored.
+*/
+void
+modgroup_reply(modgroup_t group,int id,const char *requester)
+{
+	modgroup_pending_t *entry;
+	char name[REQMODSIZE];
+	int idx;
+
+	if( !group || !requester )
+		return;
+
+	memset(name,0,sizeof(name));
+	strncpy(name,requester,sizeof(name)-1);
+
+	wlock_acquire(&group->lock);
+
+	for( entry = group->buckets[_modgroup_pending_bucket(id,name)] ; entry ; entry = entry->next )
+		if( (entry->id == id) && !strcmp(entry->requester,name) )
+			break;
+
+	if( entry )
+	{
+		idx = _modgroup_find(group,entry->member);
+		if( idx >= 0 ) {
+			if( group->replicas[idx].outstanding )
+				group->replicas[idx].outstanding--;
+			group->replicas[idx].failures = 0;
+		}
+		_modgroup_pending_remove(group,entry);
+	}
+
+	wlock_release(&group->lock);
+}
+
+/*
+   modgroup_failed
+
+   A request counted with modgroup_sent couldn't be sent to the replica, it's
+   not outstanding anymore and counts as a failure of the replica.
+*/
+void
+modgroup_failed(modgroup_t group,void *member,int id,const char *requester)
+{
+	modgroup_pending_t *entry;
+	char name[REQMODSIZE];
+	int idx;
+
+	if( !group || !member )
+		return;
+
+	memset(name,0,sizeof(name));
+	strncpy(name,requester ? requester : "",sizeof(name)-1);
+
+	wlock_acquire(&group->lock);
+
+	for( entry = group->buckets[_modgroup_pending_bucket(id,name)] ; entry ; entry = entry->next )
+		if( (entry->member == member) && (entry->id == id) && !strcmp(entry->requester,name) ) {
+			_modgroup_pending_remove(group,entry);
+			break;
+		}
+
+	idx = _modgroup_find(group,member);
+	if( idx >= 0 ) {
+		if( group->replicas[idx].outstanding )
+			group->replicas[idx].outstanding--;
+		_modgroup_failure(group,&group->replicas[idx],_modgroup_now_ns());
+	}
+
+	wlock_release(&group->lock);
+}
+
+/*
+   modgroup_status
+
+   Returns the state of up to list_size replicas of the group, count is set
+   to the number of replicas returned. The expired requests are checked first.
+*/
+wstatus
+modgroup_status(modgroup_t group,modgroup_status_t *list,unsigned int list_size,unsigned int *count)
+{
+	modgroup_replica_t *replica;
+	uint64_t now_ns;
+	unsigned int i;
+
+	dbgprint(MOD_MODGROUP,__func__,"called with group=%p, list=%p, list_size=%u, count=%p",
+			group,list,list_size,count);
+
+	if( !group || !list || !count ) {
+		dbgprint(MOD_MODGROUP,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	now_ns = _modgroup_now_ns();
+
+	wlock_acquire(&group->lock);
+
+	_modgroup_pending_expire(group,now_ns,MODGROUP_PENDING);
+
+	for( i = 0 ; (i < group->count) && (i < list_size) ; i++ )
+	{
+		replica = &group->replicas[i];
+		memcpy(list[i].id,replica->id,sizeof(list[i].id));
+		list[i].outstanding = replica->outstanding;
+		list[i].healthy = _modgroup_up(group,replica,now_ns);
+		list[i].failures = replica->failures;
+		list[i].sent = replica->sent;
+		list[i].failed = replica->failed;
+		list[i].timeouts = replica->timeouts;
+	}
+	*count = i;
+
+	wlock_release(&group->lock);
+	DBGRET_SUCCESS(MOD_MODGROUP);
+}
+
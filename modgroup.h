@@ -0,0 +1,118 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Replica groups of modmgr. Module names used to be unique, a slow SSR
+   module was a hard ceiling for every request sent to it. Several modules
+   may now register with the same name, they form a replica group and each
+   request sent to the name is forwarded to one of them. The routing policy
+   is chosen by the first registration of the group:
+
+   MODGROUP_LEAST_OUTSTANDING	the replica with less requests waiting for
+								a reply (default).
+   MODGROUP_TWO_CHOICES			two replicas are chosen at random and the
+								one with less outstanding requests is used,
+								almost as good and doesn't herd all the
+								sources on the same replica.
+   MODGROUP_HASH				consistent hashing of the value of an nvpair
+								(the AP id for example), all the requests of
+								the same value go to the same replica while
+								it's healthy. Adding or removing a replica only
+								moves the values of that replica. Requests
+								without the nvpair use least outstanding.
+
+   The outstanding requests of a replica are counted from the forward until
+   its reply (SSR) or until the callback returns (DCR, requests dropped by a
+   drop oldest inbox stop being outstanding when dropped). Requests still
+   without reply after pending_timeout are counted as failures, like the
+   send failures. After fail_max consecutive failures the replica is down
+   and skipped, once retry passed it gets requests again and the first
+   success brings it back (a new failure keeps it down for another retry
+   period). No request waits on a dead replica, requests only fail when all
+   the replicas are down.
+
+   Members are opaque pointers to modmgr (the module registrations), the
+   group doesn't own them. Replies are matched by request id and requester
+   only, replicas are meant to be servers: replies sent to the name of a
+   group go to one of its replicas, not necessarily to the one that sent the
+   request.
+*/
+
+#ifndef _MODGROUP_H
+#define _MODGROUP_H
+
+#include <stdbool.h>
+#include "wstatus.h"
+#include "req.h"
+
+#define MODGROUP_MAXREPLICAS 32
+#define MODGROUP_IDSIZE 192
+#define MODGROUP_KEYSIZE 64
+#define MODGROUP_VNODES 160				/* points of each replica in the hash ring */
+#define MODGROUP_PENDING 1024			/* requests waiting for a reply, per group */
+#define MODGROUP_DEFAULT_FAIL_MAX 3
+#define MODGROUP_DEFAULT_RETRY_MS 5000
+#define MODGROUP_DEFAULT_PENDING_TIMEOUT_MS 10000
+
+typedef enum _modgroup_policy_list
+{
+	MODGROUP_LEAST_OUTSTANDING,
+	MODGROUP_TWO_CHOICES,
+	MODGROUP_HASH
+} modgroup_policy_list;
+
+typedef struct _modgroup_opt_t
+{
+	modgroup_policy_list policy;
+	char hash_name[MODGROUP_KEYSIZE];	/* nvpair hashed by MODGROUP_HASH */
+	unsigned int fail_max;				/* 0 = MODGROUP_DEFAULT_FAIL_MAX */
+	unsigned int retry_ms;				/* 0 = MODGROUP_DEFAULT_RETRY_MS */
+	unsigned int pending_timeout_ms;	/* 0 = MODGROUP_DEFAULT_PENDING_TIMEOUT_MS */
+} modgroup_opt_t;
+
+typedef struct _modgroup_status_t
+{
+	char id[MODGROUP_IDSIZE];
+	unsigned int outstanding;
+	bool healthy;
+	unsigned int failures;				/* consecutive */
+	unsigned long sent;
+	unsigned long failed;
+	unsigned long timeouts;
+} modgroup_status_t;
+
+typedef struct _modgroup_t *modgroup_t;
+
+wstatus modgroup_create(const modgroup_opt_t *opt,modgroup_t *group);
+wstatus modgroup_destroy(modgroup_t group);
+wstatus modgroup_add(modgroup_t group,void *member,const char *id);
+wstatus modgroup_remove(modgroup_t group,void *member);
+unsigned int modgroup_count(modgroup_t group);
+const char *modgroup_hash_name(modgroup_t group);
+wstatus modgroup_pick(modgroup_t group,const char *key,void **member);
+void modgroup_sent(modgroup_t group,void *member,int id,const char *requester,bool wait_reply);
+void modgroup_done(modgroup_t group,void *member);
+void modgroup_reply(modgroup_t group,int id,const char *requester);
+void modgroup_failed(modgroup_t group,void *member,int id,const char *requester);
+wstatus modgroup_status(modgroup_t group,modgroup_status_t *list,unsigned int list_size,unsigned int *count);
+
+#endif
+
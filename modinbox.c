@@ -0,0 +1,426 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "wcond.h"
+#include "wthread.h"
+#include "req.h"
+#include "modinbox.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#include <time.h>
+#endif
+
+struct _modinbox_t
+{
+	char name[REQMODSIZE];
+	unsigned int size;
+	unsigned int batch_max;
+	modinbox_overflow_list overflow;
+	unsigned int block_ms;
+	MODINBOXDELIVERCB deliver_cb;
+	MODINBOXDROPCB drop_cb;
+	void *param;
+	wlock_t lock;
+	wcond_t not_empty;
+	wcond_t not_full;
+	wthread_t thread;
+	bool stopping;
+	bool finished;				/* thread was waited by modinbox_wait */
+	request_t *ring;
+	unsigned int head;			/* next to deliver */
+	unsigned int count;
+	unsigned int depth_max;
+	unsigned long delivered;
+	unsigned long dropped;
+	unsigned long rejected;
+	request_t *batch;			/* used by the inbox thread */
+};
+
+/*
+   _modinbox_now_ns
+
+   Helper function that returns the monotonic clock in nanoseconds.
+*/
+static uint64_t
+_modinbox_now_ns(void)
+{
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+	return (uint64_t)GetTickCount64() * 1000000ULL;
+#endif
+}
+
+/*
+   _modinbox_thread
+
+   Thread routine of the inbox, waits for requests and delivers them to the
+   module in batches of up to batch_max. Finishes when the inbox is being
+   destroyed, the requests still queued are freed by modinbox_destroy.
+*/
+void
+_modinbox_thread(void *param)
+{
+	modinbox_t inbox = (modinbox_t)param;
+	unsigned int count, i;
+
+	dbgprint(MOD_MODINBOX,__func__,"inbox thread of %s started",inbox->name);
+
+	for(;;)
+	{
+		wlock_acquire(&inbox->lock);
+
+		while( !inbox->count && !inbox->stopping )
+			wcond_wait(&inbox->not_empty,&inbox->lock);
+
+		if( inbox->stopping ) {
+			wlock_release(&inbox->lock);
+			break;
+		}
+
+		for( count = 0 ; inbox->count && (count < inbox->batch_max) ; count++ ) {
+			inbox->batch[count] = inbox->ring[inbox->head];
+			inbox->head = (inbox->head + 1) % inbox->size;
+			inbox->count--;
+		}
+
+		wcond_broadcast(&inbox->not_full);
+		wlock_release(&inbox->lock);
+
+		inbox->deliver_cb(inbox->param,inbox->batch,count);
+
+		for( i = 0 ; i < count ; i++ )
+			req_free(inbox->batch[i]);
+
+		wlock_acquire(&inbox->lock);
+		inbox->delivered += count;
+		wlock_release(&inbox->lock);
+	}
+
+	dbgprint(MOD_MODINBOX,__func__,"inbox thread of %s finished",inbox->name);
+}
+
+/*
+   modinbox_create
+
+   Creates the inbox of a module and starts its thread.
+*/
+wstatus
+modinbox_create(const modinbox_opt_t *opt,MODINBOXDELIVERCB deliver_cb,void *param,modinbox_t *inbox)
+{
+	modinbox_t new_inbox = 0;
+	bool lock_created = false, empty_created = false, full_created = false;
+	wstatus ws;
+
+	dbgprint(MOD_MODINBOX,__func__,"called with opt=%p, deliver_cb=%p, param=%p, inbox=%p",opt,deliver_cb,param,inbox);
+
+	if( !opt || !deliver_cb || !inbox ) {
+		dbgprint(MOD_MODINBOX,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_inbox = (modinbox_t)malloc(sizeof(struct _modinbox_t));
+	if( !new_inbox ) {
+		dbgprint(MOD_MODINBOX,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODINBOX);
+	}
+	memset(new_inbox,0,sizeof(struct _modinbox_t));
+
+	if( opt->name )
+		strncpy(new_inbox->name,opt->name,sizeof(new_inbox->name)-1);
+	new_inbox->size = opt->size ? opt->size : MODINBOX_DEFAULT_SIZE;
+	new_inbox->batch_max = opt->batch_max ? opt->batch_max : MODINBOX_DEFAULT_BATCH;
+	if( new_inbox->batch_max > new_inbox->size )
+		new_inbox->batch_max = new_inbox->size;
+	new_inbox->overflow = opt->overflow;
+	new_inbox->block_ms = opt->block_ms ? opt->block_ms : MODINBOX_DEFAULT_BLOCK_MS;
+	new_inbox->deliver_cb = deliver_cb;
+	new_inbox->drop_cb = opt->drop_cb;
+	new_inbox->param = param;
+
+	new_inbox->ring = (request_t*)malloc(new_inbox->size * sizeof(request_t));
+	new_inbox->batch = (request_t*)malloc(new_inbox->batch_max * sizeof(request_t));
+	if( !new_inbox->ring || !new_inbox->batch ) {
+		dbgprint(MOD_MODINBOX,__func__,"malloc failed");
+		goto return_fail;
+	}
+
+	ws = wlock_create(&new_inbox->lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODINBOX,__func__,"failed to create lock (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	lock_created = true;
+
+	ws = wcond_create(&new_inbox->not_empty);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODINBOX,__func__,"failed to create condition (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	empty_created = true;
+
+	ws = wcond_create(&new_inbox->not_full);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODINBOX,__func__,"failed to create condition (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	full_created = true;
+
+	ws = wthread_create(_modinbox_thread,new_inbox,&new_inbox->thread);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODINBOX,__func__,"failed to create inbox thread (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	dbgprint(MOD_MODINBOX,__func__,"created inbox of %s (size=%u, batch_max=%u, overflow=%d, block_ms=%u)",
+			new_inbox->name,new_inbox->size,new_inbox->batch_max,new_inbox->overflow,new_inbox->block_ms);
+	*inbox = new_inbox;
+	DBGRET_SUCCESS(MOD_MODINBOX);
+
+return_fail:
+	if( full_created )
+		wcond_free(&new_inbox->not_full);
+	if( empty_created )
+		wcond_free(&new_inbox->not_empty);
+	if( lock_created )
+		wlock_free(&new_inbox->lock);
+	free(new_inbox->ring);
+	free(new_inbox->batch);
+	free(new_inbox);
+	DBGRET_FAILURE(MOD_MODINBOX);
+}
+
+/*
+   modinbox_stop
+
+   Tells the inbox thread to finish after the delivery in progress (if any),
+   puts fail from now on and the routers blocked in a full inbox are woken up.
+   Doesn't wait for the thread, see modinbox_destroy.
+*/
+wstatus
+modinbox_stop(modinbox_t inbox)
+{
+	dbgprint(MOD_MODINBOX,__func__,"called with inbox=%p",inbox);
+
+	if( !inbox ) {
+		dbgprint(MOD_MODINBOX,__func__,"invalid inbox argument (inbox=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&inbox->lock);
+	inbox->stopping = true;
+	wcond_broadcast(&inbox->not_empty);
+	wcond_broadcast(&inbox->not_full);
+	wlock_release(&inbox->lock);
+
+	DBGRET_SUCCESS(MOD_MODINBOX);
+}
+
+/*
+   modinbox_wait
+
+   Stops the inbox (if modinbox_stop wasn't called yet) and waits for its
+   thread to finish, the inbox isn't freed.
+*/
+wstatus
+modinbox_wait(modinbox_t inbox)
+{
+	dbgprint(MOD_MODINBOX,__func__,"called with inbox=%p",inbox);
+
+	if( !inbox ) {
+		dbgprint(MOD_MODINBOX,__func__,"invalid inbox argument (inbox=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( inbox->finished ) {
+		DBGRET_SUCCESS(MOD_MODINBOX);
+	}
+
+	modinbox_stop(inbox);
+	wthread_wait(inbox->thread);
+	inbox->finished = true;
+
+	DBGRET_SUCCESS(MOD_MODINBOX);
+}
+
+/*
+   modinbox_destroy
+
+   Stops the inbox and waits for its thread (if modinbox_wait wasn't called
+   yet) and frees the inbox, requests that weren't delivered are freed.
+*/
+wstatus
+modinbox_destroy(modinbox_t inbox)
+{
+	unsigned int dropped = 0;
+
+	dbgprint(MOD_MODINBOX,__func__,"called with inbox=%p",inbox);
+
+	if( !inbox ) {
+		dbgprint(MOD_MODINBOX,__func__,"invalid inbox argument (inbox=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	modinbox_wait(inbox);
+
+	while( inbox->count ) {
+		req_free(inbox->ring[inbox->head]);
+		inbox->head = (inbox->head + 1) % inbox->size;
+		inbox->count--;
+		dropped++;
+	}
+
+	if( dropped )
+		dbgprint(MOD_MODINBOX,__func__,"freed %u requests that weren't delivered to %s",dropped,inbox->name);
+
+	wcond_free(&inbox->not_full);
+	wcond_free(&inbox->not_empty);
+	wlock_free(&inbox->lock);
+	free(inbox->ring);
+	free(inbox->batch);
+	free(inbox);
+	DBGRET_SUCCESS(MOD_MODINBOX);
+}
+
+/*
+   modinbox_put
+
+   Puts a request in the inbox. The inbox takes the caller reference of the
+   request when it's queued (result MODINBOX_QUEUED or MODINBOX_DROPPED_OLDEST),
+   with MODINBOX_FULL the request wasn't queued and the caller still owns it.
+   With MODINBOX_OVERFLOW_BLOCK the caller waits up to block_ms for space,
+   except the inbox thread itself (a module replying to itself), which gets
+   MODINBOX_FULL at once.
+*/
+wstatus
+modinbox_put(modinbox_t inbox,request_t req,modinbox_result_list *result)
+{
+	request_t oldest = 0;
+	modinbox_result_list res = MODINBOX_QUEUED;
+	uint64_t now_ns, deadline_ns;
+
+	if( !inbox || !req || !result ) {
+		dbgprint(MOD_MODINBOX,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&inbox->lock);
+
+	if( !inbox->stopping && (inbox->count == inbox->size) )
+	{
+		switch(inbox->overflow)
+		{
+			case MODINBOX_OVERFLOW_BLOCK:
+				/* only the inbox thread makes room, it would wait for itself */
+				deadline_ns = _modinbox_now_ns();
+				if( !wthread_is_self(inbox->thread) )
+					deadline_ns += (uint64_t)inbox->block_ms * 1000000;
+				while( (inbox->count == inbox->size) && !inbox->stopping ) {
+					now_ns = _modinbox_now_ns();
+					if( now_ns >= deadline_ns )
+						break;
+					wcond_timedwait(&inbox->not_full,&inbox->lock,(unsigned int)((deadline_ns - now_ns) / 1000));
+				}
+				if( inbox->stopping || (inbox->count < inbox->size) )
+					break;
+
+				inbox->rejected++;
+				wlock_release(&inbox->lock);
+				dbgprint(MOD_MODINBOX,__func__,"inbox of %s is still full after %u ms, request rejected",inbox->name,inbox->block_ms);
+				*result = MODINBOX_FULL;
+				return WSTATUS_SUCCESS;
+
+			case MODINBOX_OVERFLOW_DROP_OLDEST:
+				oldest = inbox->ring[inbox->head];
+				inbox->head = (inbox->head + 1) % inbox->size;
+				inbox->count--;
+				inbox->dropped++;
+				res = MODINBOX_DROPPED_OLDEST;
+				break;
+
+			default:
+				inbox->rejected++;
+				wlock_release(&inbox->lock);
+				dbgprint(MOD_MODINBOX,__func__,"inbox of %s is full, request rejected",inbox->name);
+				*result = MODINBOX_FULL;
+				return WSTATUS_SUCCESS;
+		}
+	}
+
+	if( inbox->stopping ) {
+		wlock_release(&inbox->lock);
+		dbgprint(MOD_MODINBOX,__func__,"inbox of %s is being destroyed",inbox->name);
+		DBGRET_FAILURE(MOD_MODINBOX);
+	}
+
+	inbox->ring[(inbox->head + inbox->count) % inbox->size] = req;
+	inbox->count++;
+	if( inbox->count > inbox->depth_max )
+		inbox->depth_max = inbox->count;
+
+	wcond_signal(&inbox->not_empty);
+	wlock_release(&inbox->lock);
+
+	if( oldest ) {
+		dbgprint(MOD_MODINBOX,__func__,"inbox of %s is full, dropped oldest request",inbox->name);
+		if( inbox->drop_cb )
+			inbox->drop_cb(inbox->param,oldest);
+		req_free(oldest);
+	}
+
+	*result = res;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   modinbox_status
+
+   Returns the depth and counters of the inbox.
+*/
+wstatus
+modinbox_status(modinbox_t inbox,modinbox_status_t *status)
+{
+	if( !inbox || !status )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	wlock_acquire(&inbox->lock);
+	status->depth = inbox->count;
+	status->depth_max = inbox->depth_max;
+	status->delivered = inbox->delivered;
+	status->dropped = inbox->dropped;
+	status->rejected = inbox->rejected;
+	wlock_release(&inbox->lock);
+
+	return WSTATUS_SUCCESS;
+}
+
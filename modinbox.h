@@ -0,0 +1,116 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Inbox of a module. modmgr used to call the DCR module callbacks from its
+   own thread, a callback blocking on I/O froze the routing of every other
+   module. Following the actor model, each DCR module gets a bounded inbox
+   and a thread of its own: the router only puts the requests in the inbox
+   and the inbox thread delivers them to the module, in order.
+
+   Inbox threads put requests in other inboxes (replies of the modules), to
+   shut them down modinbox_stop is called on every inbox first (puts fail
+   from then on), then modinbox_wait on every inbox and only then they can
+   be destroyed.
+
+   The inbox thread takes all the requests queued (up to batch_max) at once
+   and hands them to the deliver callback, modules with a batch callback
+   receive them in a single call.
+
+   When the inbox is full the overflow policy chosen at registration is
+   applied:
+
+   MODINBOX_OVERFLOW_BUSY			the request isn't queued, modmgr answers
+									the source with a busy error (default).
+   MODINBOX_OVERFLOW_BLOCK			the router waits for space up to
+									block_ms, then the request is rejected like
+									with MODINBOX_OVERFLOW_BUSY. The wait is
+									bounded because the routers are the dispatch
+									and inbox threads: two modules may reply to
+									each other, and a slow module must not stall
+									the routing of the others for long. An inbox
+									thread putting in its own inbox doesn't wait,
+									only it could make room.
+   MODINBOX_OVERFLOW_DROP_OLDEST	the oldest queued request is dropped to
+									make room (state updates where only the
+									last one matters), drop_cb is called with
+									it before it's freed.
+*/
+
+#ifndef _MODINBOX_H
+#define _MODINBOX_H
+
+#include "wstatus.h"
+#include "req.h"
+
+#define MODINBOX_DEFAULT_SIZE 256
+#define MODINBOX_DEFAULT_BATCH 16
+#define MODINBOX_DEFAULT_BLOCK_MS 20
+
+typedef enum _modinbox_overflow_list
+{
+	MODINBOX_OVERFLOW_BUSY,
+	MODINBOX_OVERFLOW_BLOCK,
+	MODINBOX_OVERFLOW_DROP_OLDEST
+} modinbox_overflow_list;
+
+typedef enum _modinbox_result_list
+{
+	MODINBOX_QUEUED,
+	MODINBOX_DROPPED_OLDEST,
+	MODINBOX_FULL
+} modinbox_result_list;
+
+/* called by the inbox thread, the requests are freed by the inbox after the call */
+typedef void (*MODINBOXDELIVERCB)(void *param,const request_t *req_list,unsigned int req_count);
+/* called by modinbox_put for a request dropped by MODINBOX_OVERFLOW_DROP_OLDEST */
+typedef void (*MODINBOXDROPCB)(void *param,const request_t req);
+
+typedef struct _modinbox_opt_t
+{
+	const char *name;					/* for debug messages */
+	unsigned int size;					/* 0 = MODINBOX_DEFAULT_SIZE */
+	unsigned int batch_max;				/* 0 = MODINBOX_DEFAULT_BATCH */
+	modinbox_overflow_list overflow;
+	unsigned int block_ms;				/* 0 = MODINBOX_DEFAULT_BLOCK_MS */
+	MODINBOXDROPCB drop_cb;				/* 0 if not needed */
+} modinbox_opt_t;
+
+typedef struct _modinbox_status_t
+{
+	unsigned int depth;
+	unsigned int depth_max;				/* high water mark */
+	unsigned long delivered;
+	unsigned long dropped;				/* MODINBOX_OVERFLOW_DROP_OLDEST */
+	unsigned long rejected;				/* MODINBOX_OVERFLOW_BUSY and BLOCK timeouts */
+} modinbox_status_t;
+
+typedef struct _modinbox_t *modinbox_t;
+
+wstatus modinbox_create(const modinbox_opt_t *opt,MODINBOXDELIVERCB deliver_cb,void *param,modinbox_t *inbox);
+wstatus modinbox_stop(modinbox_t inbox);
+wstatus modinbox_wait(modinbox_t inbox);
+wstatus modinbox_destroy(modinbox_t inbox);
+wstatus modinbox_put(modinbox_t inbox,request_t req,modinbox_result_list *result);
+wstatus modinbox_status(modinbox_t inbox,modinbox_status_t *status);
+
+#endif
+
@@ -29,17 +29,38 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 #include "wstatus.h"
 #include "debug.h"
 #include "modmgr.h"
 #include "jmlist.h"
 #include "wchannel.h"
+#include "wloop.h"
 #include "wthread.h"
+#include "wcond.h"
 #include "nvpair.h"
+#include "reqschema.h"
+#include "admctl.h"
+#include "modsched.h"
+#include "modinbox.h"
+#include "modbus.h"
+#include "modstats.h"
+#include "modpeer.h"
+#include "shmring.h"
 #include "req.h"
 #include "reqbuf.h"
 
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#include <unistd.h>
+#endif
+
+#if (defined POSH_OS_WIN32 || defined POSH_OS_WIN64)
+#define MODMGR_TLS __declspec(thread)
+#else
+#define MODMGR_TLS __thread
+#endif
+
 /*
    This structure contains interface objects used between the
    request processor thread and the modmgr module.
@@ -51,20 +72,90 @@ typedef struct _request_proc_data_t
 	bool finished_flag;
 	wstatus ret_status;
 	wchannel_t recv_wch;
+	wloop_t loop;					/* event loop of the thread, stopped by modmgr_unload */
+	reqbuf_t rb;
 	wthread_t wthread;
+	wthread_t dispatch_wthread;
 } request_proc_data_t;
 
+/*
+   Requests to an SSR module whose reliable window is full, kept in the
+   order they were sent until the window opens (see _request_send_wch).
+*/
+typedef struct _deferred_req_t
+{
+	request_t req;
+	struct _deferred_req_t *next;
+} deferred_req_t;
+
+typedef struct _deferred_dest_t
+{
+	char dest[MODHOSTSIZE+MODPORTSIZE+1];
+	deferred_req_t *head;
+	deferred_req_t *tail;
+	unsigned int count;
+	struct _deferred_dest_t *next;
+} deferred_dest_t;
+
+/*
+   Remote request receiver, one per SO_REUSEPORT socket bound to the modmgr
+   port (see _remote_request_receiver_thread).
+*/
+typedef struct _remote_receiver_t
+{
+	unsigned int index;
+	wchannel_t wch;
+	wthread_t wthread;
+	bool started;
+} remote_receiver_t;
+
 extern wstatus reqbuf_wchannel_read_cb(void *param,void *chunk_ptr,unsigned int chunk_size, unsigned int *chunk_used);
+extern wstatus reqbuf_wchannel_peek_cb(void *param,void **chunk_ptr,unsigned int *chunk_used,unsigned int *chunk_id);
+extern wstatus reqbuf_wchannel_done_cb(void *param,unsigned int chunk_id);
 
 void _modmgr_reqproc_cb(const request_t req);
+void _modmgr_stats(const request_t req);
 wstatus _modreg_alloc(modreg_t *new_mod);
 wstatus _modreg_free(const struct _modreg_t *mod);
+wstatus _modreg_inbox_start(modreg_t mod);
+void _request_inbox_deliver_cb(void *param,const request_t *req_list,unsigned int req_count);
+void _request_inbox_drop_cb(void *param,const request_t req);
+wstatus _request_send_inbox(const request_t req,const struct _modreg_t *mod);
+void _modmgr_event_deliver_cb(void *param,const char *subscriber,request_t event);
+void _request_stats(const request_t req,const char *dst,uint64_t start_ns,uint64_t end_ns,unsigned int bytes_out,bool error);
+bool _request_expire(const request_t req,const struct _modreg_t *mod,uint64_t now_ms);
+wstatus _modmgr_lookup(const char *mod_name,const struct _modreg_t **modp);
+wstatus _request_send_group(const request_t req,const struct _modreg_t *mod);
+wstatus _request_send_peer(const request_t req,const char *dst);
+wstatus _request_send_shm(const request_t req,const struct _modreg_t *mod);
+void _modreg_shm_stop(modreg_t mod);
+void _modmgr_mcast_reply(int id,const char *requester,const char *member);
+wstatus _request_send_wch(const request_t req,char *dest,const char *text_ptr,unsigned int text_size);
+wstatus _request_deferred_start(void);
+void _request_deferred_stop(void);
 
 /* this module variables */
 static jmlist mod_list = 0; /* modreg_t */
+static wlock_t mod_lock; /* mod_list is used by the reader and dispatch threads */
+static modsched_t dispatch_sched = 0;
+static modbus_t event_bus = 0;
 static request_proc_data_t thread_reqproc_data;
 static bool unloading = false;
 static bool loaded = false;
+static wchannel_t send_wch = 0; /* modmgr request sender channel (SSR) */
+static remote_receiver_t *receiver_list = 0;
+static unsigned int receiver_count = 0;
+static modpeer_t peers = 0; /* other modmgr nodes (see modpeer.h) */
+static bool admit_internal = true; /* admission param of the fast channel */
+static deferred_dest_t *deferred_list = 0; /* SSR destinations with a full window */
+static wlock_t deferred_lock;
+static wcond_t deferred_cond;
+static wthread_t deferred_wthread;
+static bool deferred_started = false;
+static bool deferred_stopping = false;
+/* deadline of the requests a module callback is handling in this thread,
+   the requests it forwards inherit it (see _request_process) */
+static MODMGR_TLS uint64_t deliver_deadline_ms = 0;
 
 /*
    _request_build_error_reply
@@ -81,7 +172,7 @@ static bool loaded = false;
 wstatus
 _request_build_error_reply(const char *error_code,const char *error_description,request_t *req)
 {
-	request_t aux_req;
+	request_t aux_req = 0;
 	wstatus ws;
 
 	dbgprint(MOD_MODMGR,__func__,"called with error_code=\"%s\", error_description=\"%s\", req=%p",
@@ -95,6 +186,11 @@ _request_build_error_reply(const char *error_code,const char *error_description,
 	/* allocate new request data structure */
 
 	aux_req = (request_t)malloc(sizeof(struct _request_t));
+	if( !aux_req ) {
+		dbgprint(MOD_MODMGR,__func__,"malloc failed");
+		goto return_fail;
+	}
+	memset(aux_req,0,sizeof(struct _request_t));
 	aux_req->stype = REQUEST_STYPE_BIN;
 	aux_req->data.bin.type = REQUEST_TYPE_REPLY;
 	aux_req->data.bin.id = 0;
@@ -106,6 +202,7 @@ _request_build_error_reply(const char *error_code,const char *error_description,
 		goto return_fail;
 	}
 	memcpy(aux_req->data.bin.code,error_code,strlen(error_code));
+	aux_req->data.bin.code_id = reqid_code_lookup(error_code,strlen(error_code));
 	aux_req->data.bin.nvl = 0;
 
 	/* error description is not mandatory when the error code is self-describing...
@@ -136,829 +233,3891 @@ return_fail:
 }
 
 /*
-   _request_process
-
-   When a request is received by the modmgr module, it should:
-   1) lookup destination module in loaded module list
-   2.1) if module is not found send error reply to the source of the request.
-   2.2) if module is found, forward request to it.
+   _request_reply_code
 
-   When the module is registered it also indicates how the modmgr should
-   communicate with it: by a callback or using a wchannel.
+   Helper function to send an error reply with the given code to the source of a
+   request, used when the request can't be delivered to its destination. The reply
+   has the same request ID and swapped source and destination. Only the header of
+   the request is needed so this works for requests that weren't parsed.
 */
 wstatus
-_request_process(request_t req)
+_request_reply_code(const req_header_t *header,const char *error_code,const char *error_description)
 {
 	const struct _modreg_t *mod_src = 0;
-	const struct _modreg_t *mod_dst = 0;
 	request_t reply = 0;
 	wstatus ws;
 
-	dbgprint(MOD_MODMGR,__func__,"called with req=%p",req);
+	dbgprint(MOD_MODMGR,__func__,"called with header=%p, error_code=\"%s\", error_description=\"%s\"",
+			header,z_ptr(error_code),z_ptr(error_description));
 
-	ws = modmgr_lookup(array2z(req->data.bin.src,sizeof(req->data.bin.src)),&mod_src);
+	ws = modmgr_lookup(header->src,&mod_src);
 	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to lookup module (ws=%s)",wstatus_str(ws));
+		dbgprint(MOD_MODMGR,__func__,"failed to lookup source module, can't reply (ws=%s)",wstatus_str(ws));
 		goto return_fail;
 	}
 	dbgprint(MOD_MODMGR,__func__,"found source module in registered modules list");
-
-	ws = modmgr_lookup(req->data.bin.dst,&mod_dst);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to lookup module (ws=%s)",wstatus_str(ws));
-		goto dest_not_found;
-	}
-	dbgprint(MOD_MODMGR,__func__,"found destination module in registered modules list");
-
-dest_not_found:
 	
-	/* reply with error message */
-	ws = _request_build_error_reply(REQERROR_DESCNAME,REQERROR_MODUNFOUND,&reply);
+	ws = _request_build_error_reply(error_code,error_description,&reply);
 	if( ws != WSTATUS_SUCCESS ) {
 		dbgprint(MOD_MODMGR,__func__,"failed to create error reply (ws=%s)",wstatus_str(ws));
 		goto return_fail;
 	}
 	dbgprint(MOD_MODMGR,__func__,"created error reply successfully");
 
-	ws = _request_send(reply,mod_dst);
+	reply->data.bin.id = header->id;
+	strncpy(reply->data.bin.src,header->dst,sizeof(reply->data.bin.src));
+	strncpy(reply->data.bin.dst,header->src,sizeof(reply->data.bin.dst));
+
+	ws = _request_send(reply,mod_src);
 	if( ws != WSTATUS_SUCCESS ) {
 		dbgprint(MOD_MODMGR,__func__,"failed to send reply (ws=%s)",wstatus_str(ws));
 		goto return_fail;
 	}
 	dbgprint(MOD_MODMGR,__func__,"sent error reply successfully");
 
-	/* free reply */
+	/* free reply (drops our reference, the destination might still hold it) */
 	req_free(reply);
 
-	if( mod_src )
-		_modreg_free(mod_src);
-
-	if( mod_dst )
-		_modreg_free(mod_dst);
-
 	DBGRET_SUCCESS(MOD_MODMGR);
 
 return_fail:
 	if( reply )
 		req_free(reply);
 
-	if( mod_src )
-		_modreg_free(mod_src);
+	DBGRET_FAILURE(MOD_MODMGR);
+}
 
-	if( mod_dst )
-		_modreg_free(mod_dst);
+/*
+   _request_header
 
-	DBGRET_FAILURE(MOD_MODMGR);
+   Helper function that fills a request header (see req_peek_header) from a
+   binary request.
+*/
+void
+_request_header(const request_t req,req_header_t *header)
+{
+	header->type = req->data.bin.type;
+	header->id = req->data.bin.id;
+	memcpy(header->src,req->data.bin.src,sizeof(header->src));
+	memcpy(header->dst,req->data.bin.dst,sizeof(header->dst));
+	header->src[sizeof(header->src)-1] = '\0';
+	header->dst[sizeof(header->dst)-1] = '\0';
 }
 
 /*
-   _request_processor_thread
+   _request_reply_error
 
-   Thread callback which will receive both SSR and DCR and process them.
-   This thread has three parts, initialization, processing and cleanup.
-   
-   During initialization the function allocates required data structure
-   for futher processing. This includes the request buffer used for reading
-   requests that come from SSR and DCR. This function receives a init
-   data structure which contains some variables that enable the interface
-   between this thread function and the rest of the modmgr module.
-   There must be a way of stoping the thread, to do this a variable is
-   passed inside this init data structure (unloading bool) which should
-   be tested whenever possible in the processing loop.
-   
-   The processing part includes a loop which reads from the fast wchannel
-   (for instance, a PIPE) the requests are expected to be in binary form.
-   To read from this wchannel it uses the reqbuf_t created during the
-   initialization. The processing loop breaks when unloading flag is set.
+   Helper function to send an error reply to the source of a binary request, see
+   _request_reply_code.
+*/
+wstatus
+_request_reply_error(const request_t req,const char *error_description)
+{
+	req_header_t header;
 
-   The function reaches the cleanup part when the processing loop breaks,
-   this part is responsible for freeing the allocated data structures
-   used by the function, this includes the reqbuf_t.
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p, error_description=\"%s\"",req,z_ptr(error_description));
+
+	_request_header(req,&header);
+	return _request_reply_code(&header,REQERROR_DESCNAME,error_description);
+}
 
-   Since the wchannel object doesn't support timeouts whenever the client
-   code wants to unload the modmgr module it should: i) set unloading flag,
-   ii) send a dummy request code. Whenever a request arrives this function
-   first checks if the module is unloading before processing the request.
+/*
+   _request_admit_cb
+
+   Admission callback of the ingress reqbufs (see admctl.h), called with the
+   header of every request before it's parsed. param is 0 for the ingresses
+   fed by other processes (remote receivers, SHM rings) and points to
+   admit_internal for the fast channel, whose requests come from inside the
+   process. Rejected requests are answered with a busy error reply and
+   dropped.
 */
-void _request_processor_thread(void *param)
+bool
+_request_admit_cb(void *param,const req_header_t *header)
 {
-	reqbuf_t rb = 0;
-	request_t req;
+	admctl_verdict_list verdict;
+	char error_desc[128];
 	wstatus ws;
-	request_proc_data_t *proc_data = (request_proc_data_t*)param;
 
-	dbgprint(MOD_MODMGR,__func__,"called with param=%p");
+	ws = admctl_admit(header,param == &admit_internal,&verdict);
+	if( (ws != WSTATUS_SUCCESS) || (verdict == ADMCTL_ADMIT) )
+		return true;
 
-	if( !param ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid param argument (param=0)");
-		goto return_fail;
-	}
+	snprintf(error_desc,sizeof(error_desc),REQERROR_BUSY,admctl_verdict_str(verdict));
+	_request_reply_code(header,reqid_code_str(REQCODE_BUSY),error_desc);
+	return false;
+}
 
-	/* create request buffer */
+/*
+   _request_route
+
+   When a request is received by the modmgr module, it should:
+   1) lookup destination module in loaded module list
+   2.1) if module is not found send error reply to the source of the request.
+   2.2) if module is found, validate the request against the schema of its
+        code (if any, see reqschema.h). Invalid requests are answered with an
+        error reply, valid ones are forwarded with the typed record attached.
+   2.3) if module is not found but a peer node announced it, forward the
+        request to the peer (see _request_send_peer). The schema is validated
+        by the node of the module.
+
+   When the module is registered it also indicates how the modmgr should
+   communicate with it: by a callback or using a wchannel.
 
-	ws = reqbuf_create(reqbuf_wchannel_read_cb,proc_data->recv_wch,REQBUF_TYPE_BINARY,&rb);
+   Replies which can't be forwarded are dropped, no error is sent back.
+   This function does steps 1 and 2, mod_dst is set to the destination when
+   the request must be forwarded or to 0 when it was already answered with an
+   error (or dropped).
+*/
+wstatus
+_request_route(request_t req,const struct _modreg_t **mod_dst)
+{
+	const struct _modreg_t *mod_src = 0;
+	char error_desc[REQSCHEMA_ERRORSIZE];
+	char dst[REQMODSIZE+1];
+	char src[REQMODSIZE+1];
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p, mod_dst=%p",req,mod_dst);
+
+	*mod_dst = 0;
+
+	/* array2z isn't reentrant, requests are routed by the dispatch and inbox threads */
+	memcpy(dst,req->data.bin.dst,REQMODSIZE);
+	dst[REQMODSIZE] = '\0';
+
+	/* a reply of a replica completes its pending request (see modgroup.h), one
+	   of an unregistered source may be of a multicast group member */
+	if( req->data.bin.type == REQUEST_TYPE_REPLY )
+	{
+		memcpy(src,req->data.bin.src,REQMODSIZE);
+		src[REQMODSIZE] = '\0';
+		if( modmgr_lookup(src,&mod_src) != WSTATUS_SUCCESS )
+			_modmgr_mcast_reply(req->data.bin.id,dst,src);
+		else if( mod_src->replica.group )
+			modgroup_reply(mod_src->replica.group,req->data.bin.id,dst);
+	}
+
+	ws = modmgr_lookup(dst,mod_dst);
 	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to create new reqbuf (ws=%s)",wstatus_str(ws));
-		goto return_fail;
+		dbgprint(MOD_MODMGR,__func__,"failed to lookup module (ws=%s)",wstatus_str(ws));
+		*mod_dst = 0;
+		goto dest_not_found;
 	}
-	dbgprint(MOD_MODMGR,__func__,"created request buffer successfully (rb=%p)",rb);
+	dbgprint(MOD_MODMGR,__func__,"found destination module in registered modules list");
 
-	/* initialization part is finished, toggle flag */
-	proc_data->initialized_flag = true;
+	/* validate once here, the destination reads the typed record */
 
-	/* start processing part */
-	for(;;)
+	if( req->data.bin.type == REQUEST_TYPE_REQUEST )
 	{
-		ws = reqbuf_read(rb,&req);
-		if( ws != WSTATUS_SUCCESS ) {
-			dbgprint(MOD_MODMGR,__func__,"failed to read from request buffer (rb=%p, ws=%s)",
-					rb,wstatus_str(ws));
-			goto return_fail;
+		ws = reqschema_attach(req,error_desc,sizeof(error_desc));
+		if( ws == WSTATUS_INVALID_ARGUMENT ) {
+			dbgprint(MOD_MODMGR,__func__,"request rejected by schema: %s",error_desc);
+			_request_stats(req,dst,modstats_now_ns(),modstats_now_ns(),0,true);
+			*mod_dst = 0;
+			goto send_error;
 		}
-		dbgprint(MOD_MODMGR,__func__,"received request id %u",req->data.bin.id);
-
-		if( proc_data->unload_flag ) {
-			/* dont process request if we're unloading... */
-			dbgprint(MOD_MODMGR,__func__,"unload flag is set, finishing thread");
-			goto finish_thread;
-		}
-
-		/* call helper function to process request */
-		dbgprint(MOD_MODMGR,__func__,"calling helper function _request_process");
-		ws = _request_process(req);
-		dbgprint(MOD_MODMGR,__func__,"helper function _request_process returned ws=%s",wstatus_str(ws));
 		if( ws != WSTATUS_SUCCESS ) {
-			dbgprint(MOD_MODMGR,__func__,"unable to process request (ws=%s)",wstatus_str(ws));
-			goto return_fail;
+			dbgprint(MOD_MODMGR,__func__,"failed to validate request (ws=%s)",wstatus_str(ws));
+			*mod_dst = 0;
+			DBGRET_FAILURE(MOD_MODMGR);
 		}
-		dbgprint(MOD_MODMGR,__func__,"request processed successfully");
 	}
 
-return_success:
+	DBGRET_SUCCESS(MOD_MODMGR);
 
-	dbgprint(MOD_MODMGR,__func__,"returning with success.");
-	proc_data->ret_status = WSTATUS_SUCCESS;
-	proc_data->finished_flag = true;
-	return;
+dest_not_found:
 
-finish_thread:
-	/* destroy request buffer */
-	ws = reqbuf_destroy(rb);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to destroy request buffer (reqbuf=%p, ws=%s)",
-				rb,wstatus_str(ws));
-		goto return_fail;
+	if( peers && (_request_send_peer(req,dst) == WSTATUS_SUCCESS) ) {
+		DBGRET_SUCCESS(MOD_MODMGR);
 	}
 
-	/* done cleanup, leave thread. */
-	goto return_success;
+	_request_stats(req,dst,modstats_now_ns(),modstats_now_ns(),0,true);
 
-return_fail:
-	dbgprint(MOD_MODMGR,__func__,"returning with failure.");
-	proc_data->ret_status = WSTATUS_FAILURE;
-	proc_data->finished_flag = true;
-	return;
+	if( req->data.bin.type == REQUEST_TYPE_REPLY ) {
+		dbgprint(MOD_MODMGR,__func__,"destination of reply was not found, dropping it");
+		DBGRET_SUCCESS(MOD_MODMGR);
+	}
+
+	snprintf(error_desc,sizeof(error_desc),REQERROR_MODUNFOUND,dst);
+
+send_error:
+
+	return _request_reply_error(req,error_desc);
 }
 
 /*
-   modreg_create_from_request
+   _request_process
 
-   Helper function that converts a request with destination 'modmgr' and
-   code 'registryModule' into a module registration data structure.
+   Routes a request (see _request_route) and forwards it to its destination.
+   The request is sealed before being forwarded (see _request_send), the
+   caller still owns its reference and frees it with req_free. A request past
+   its deadline is dropped (see _request_expire). A request made by a module
+   callback gets the deadline of the requests it's handling if it's earlier,
+   the sub-requests never outlive the caller that's waiting for them.
 */
 wstatus
-modreg_create_from_request(request_t req,modreg_t *modreg)
-{
-	return WSTATUS_UNIMPLEMENTED;
-}
-
-wstatus
-_modreg_validate_name(const char *name_ptr,unsigned int name_size,modreg_validation_result *result)
+_request_process(request_t req)
 {
-	unsigned int i;
+	const struct _modreg_t *mod_dst = 0;
+	wstatus ws;
 
-	dbgprint(MOD_MODMGR,__func__,"called with name_ptr=%p, name_size=%u, result=%p",
-			name_ptr,name_size,result);
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p",req);
 
-	if( !name_ptr ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid name_ptr argument (name_ptr=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
+	if( deliver_deadline_ms && (req->data.bin.type == REQUEST_TYPE_REQUEST) ) {
+		req_deadline_parse(req);
+		if( !req_is_sealed(req) )
+			req_deadline_set(req,deliver_deadline_ms);
+		else if( !req->deadline_ms || (req->deadline_ms > deliver_deadline_ms) )
+			dbgprint(MOD_MODMGR,__func__,"request is sealed, it keeps its own deadline");
 	}
 
-	if( !name_size ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid name_size argument (name_size=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
+	if( _request_expire(req,0,req_deadline_now_ms()) ) {
+		DBGRET_SUCCESS(MOD_MODMGR);
 	}
 
-	if( !result ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid result argument (result=0)");
+	ws = _request_route(req,&mod_dst);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to route request (ws=%s)",wstatus_str(ws));
 		DBGRET_FAILURE(MOD_MODMGR);
 	}
 
-	for( i = 0 ; i < name_size ; i++ )
-   	{
-		if( MRV_NAMECHAR(name_ptr[i]) )
-			continue;
-
-		dbgprint(MOD_MODMGR,__func__,"invalid/unsupported character found in module name (name[%u]=%02X)",i,name_ptr[i]);
-		*result = MODREG_PARAM_INVALID_CHARACTER_FOUND;
-		dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
+	if( !mod_dst ) {
+		dbgprint(MOD_MODMGR,__func__,"request was answered by modmgr, not forwarding it");
 		DBGRET_SUCCESS(MOD_MODMGR);
 	}
 
-	dbgprint(MOD_MODMGR,__func__,"finished parsing all name characters");
+	ws = _request_send_group(req,mod_dst);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to forward request (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+	dbgprint(MOD_MODMGR,__func__,"forwarded request successfully");
 
-	/* all characters are valid */
-	
-	*result = MODREG_PARAM_CHARACTERS_ARE_VALID;
-	dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
 	DBGRET_SUCCESS(MOD_MODMGR);
 }
 
+/*
+   _request_enqueue
+
+   Helper function that queues a request in the dispatch scheduler. The class
+   of the request is the class its source module declared at registration,
+   the control plane codes of modmgr are always in the control class. The
+   cost used by the round-robin grows with the nvpairs of the request.
+*/
 wstatus
-_modreg_validate_description(const char *description_ptr,unsigned int description_size,modreg_validation_result *result)
+_request_enqueue(request_t req)
 {
-	unsigned int i;
-
-	dbgprint(MOD_MODMGR,__func__,"called with description_ptr=%p, description_size=%u, result=%p",
-			description_ptr,description_size,result);
-
-	if( !description_ptr ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid description_ptr argument (description_ptr=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
-
-	if( !description_size ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid description_size argument (description_size=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
+	const struct _modreg_t *mod_src = 0;
+	modsched_class_list sched_class = MODSCHED_CLASS_NORMAL;
+	unsigned int nv_count = 0;
+	char src[REQMODSIZE+1];
 
-	if( !result ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid result argument (result=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p",req);
 
-	for( i = 0 ; i < description_size ; i++ )
-   	{
-		if( MRV_DESCCHAR(description_ptr[i]) )
-			continue;
+	/* array2z isn't reentrant and the dispatch thread uses it */
+	memcpy(src,req->data.bin.src,REQMODSIZE);
+	src[REQMODSIZE] = '\0';
 
-		dbgprint(MOD_MODMGR,__func__,"invalid/unsupported character found in module description (name[%u]=%02X)",i,description_ptr[i]);
-		*result = MODREG_PARAM_INVALID_CHARACTER_FOUND;
-		dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
-		DBGRET_SUCCESS(MOD_MODMGR);
+	switch(req->data.bin.code_id)
+	{
+		case REQCODE_MODULE_REGISTER:
+		case REQCODE_REGISTRY_MODULE:
+		case REQCODE_MODULE_UNREGISTER:
+		case REQCODE_MODULE_LOOKUP:
+		case REQCODE_EVENT_SUBSCRIBE:
+		case REQCODE_EVENT_UNSUBSCRIBE:
+		case REQCODE_STATS:
+		case REQCODE_PEER_SUMMARY:
+			sched_class = MODSCHED_CLASS_CONTROL;
+			break;
+		default:
+			if( modmgr_lookup(src,&mod_src) == WSTATUS_SUCCESS )
+				sched_class = mod_src->dispatch.sched_class;
+			break;
 	}
 
-	dbgprint(MOD_MODMGR,__func__,"finished parsing all description characters");
+	req_get_nv_count(req,&nv_count);
 
-	/* all characters are valid */
-	
-	*result = MODREG_PARAM_CHARACTERS_ARE_VALID;
-	dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
-	DBGRET_SUCCESS(MOD_MODMGR);
+	return modsched_enqueue(dispatch_sched,req,src,sched_class,1 + nv_count);
 }
 
-wstatus
-_modreg_validate_author_name(const char *author_name_ptr,unsigned int author_name_size,modreg_validation_result *result)
+/*
+   _request_dispatch_thread
+
+   Thread callback that takes the requests from the dispatch scheduler (by class
+   and source, see modsched.h) and processes them. Requests for DCR modules are
+   only put in the inbox of the module (see modinbox.h), a slow module doesn't
+   stall the routing of the others. Requests past their deadline are dropped
+   without being routed (see _request_expire). The thread finishes when the
+   scheduler is stopped by modmgr_unload.
+*/
+void _request_dispatch_thread(void *param)
 {
-	unsigned int i;
+	const struct _modreg_t *mod_dst;
+	request_t req;
+	wstatus ws;
 
-	dbgprint(MOD_MODMGR,__func__,"called with author_name_ptr=%p, author_name_size=%u, result=%p",
-			author_name_ptr,author_name_size,result);
+	dbgprint(MOD_MODMGR,__func__,"called with param=%p",param);
 
-	if( !author_name_ptr ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid author_name_ptr argument (author_name_ptr=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
+	for(;;)
+	{
+		ws = modsched_dequeue(dispatch_sched,&req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"scheduler stopped, finishing thread");
+			break;
+		}
 
-	if( !author_name_size ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid author_name_size argument (author_name_size=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
+		if( _request_expire(req,0,req_deadline_now_ms()) ) {
+			admctl_release();
+			req_free(req);
+			continue;
+		}
 
-	if( !result ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid result argument (result=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
+		ws = _request_route(req,&mod_dst);
+		if( ws != WSTATUS_SUCCESS )
+			dbgprint(MOD_MODMGR,__func__,"unable to route request (ws=%s)",wstatus_str(ws));
 
-	for( i = 0 ; i < author_name_size ; i++ )
-   	{
-		if( MRV_AUTHORNCHAR(author_name_ptr[i]) )
-			continue;
+		if( mod_dst ) {
+			ws = _request_send_group(req,mod_dst);
+			if( ws != WSTATUS_SUCCESS )
+				dbgprint(MOD_MODMGR,__func__,"unable to forward request (ws=%s)",wstatus_str(ws));
+		}
 
-		dbgprint(MOD_MODMGR,__func__,"invalid/unsupported character found in module author name (author_name[%u]=%02X)",i,author_name_ptr[i]);
-		*result = MODREG_PARAM_INVALID_CHARACTER_FOUND;
-		dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
-		DBGRET_SUCCESS(MOD_MODMGR);
+		admctl_release();
+		req_free(req);
 	}
 
-	dbgprint(MOD_MODMGR,__func__,"finished parsing all author name characters");
-
-	/* all characters are valid */
-	
-	*result = MODREG_PARAM_CHARACTERS_ARE_VALID;
-	dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
-	DBGRET_SUCCESS(MOD_MODMGR);
+	dbgprint(MOD_MODMGR,__func__,"returning.");
 }
 
+/*
+   _request_processor_ready_cb
+
+   Ready callback of the fast wchannel in the loop of the request processor
+   thread, reads every request the channel has without waiting for more
+   (reqbuf_read_ready) and queues them in the dispatch scheduler. A failure
+   stops the loop, the thread finishes with failure.
+*/
+static void
+_request_processor_ready_cb(wloop_t loop,wchannel_t channel,void *param)
+{
+	request_proc_data_t *proc_data = (request_proc_data_t*)param;
+	request_t req;
+	wstatus ws;
+
+	for(;;)
+	{
+		ws = reqbuf_read_ready(proc_data->rb,&req);
+		if( ws == WSTATUS_AGAIN )
+			return;
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to read from request buffer (rb=%p, ws=%s)",
+					proc_data->rb,wstatus_str(ws));
+			goto return_fail;
+		}
+		dbgprint(MOD_MODMGR,__func__,"received request id %u",req->data.bin.id);
+
+		/* the queue wait of the statistics starts here (see modstats.h) */
+		req->ingress_ns = modstats_now_ns();
+		req_deadline_parse(req);
+
+		/* queue the request in the dispatch scheduler, see _request_dispatch_thread */
+		ws = _request_enqueue(req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"unable to queue request (ws=%s)",wstatus_str(ws));
+			admctl_release();
+			req_free(req);
+			goto return_fail;
+		}
+		dbgprint(MOD_MODMGR,__func__,"request queued successfully");
+	}
+
+return_fail:
+	proc_data->ret_status = WSTATUS_FAILURE;
+	wloop_stop(loop);
+}
+
+/*
+   _request_processor_thread
+
+   Thread callback which will receive both SSR and DCR and process them.
+   This thread has three parts, initialization, processing and cleanup.
+   
+   During initialization the function allocates required data structure
+   for futher processing. This includes the request buffer used for reading
+   requests that come from SSR and DCR. This function receives a init
+   data structure which contains some variables that enable the interface
+   between this thread function and the rest of the modmgr module.
+   
+   The processing part runs the event loop created by modmgr_load (wloop)
+   with the fast wchannel (for instance, a PIPE) in it, the requests are
+   expected to be in binary form. Whenever the wchannel is ready the
+   requests are read with the reqbuf_t created during the initialization
+   (_request_processor_ready_cb). Admitted requests are queued in the
+   dispatch scheduler and processed by _request_dispatch_thread.
+
+   The function reaches the cleanup part when the loop is stopped, by
+   modmgr_unload (wloop_stop wakes the loop right away, no message has to
+   be sent to the wchannel) or by a failure of the ready callback. This
+   part is responsible for freeing the allocated data structures used by
+   the function, this includes the reqbuf_t.
+*/
+void _request_processor_thread(void *param)
+{
+	wstatus ws;
+	request_proc_data_t *proc_data = (request_proc_data_t*)param;
+
+	dbgprint(MOD_MODMGR,__func__,"called with param=%p");
+
+	if( !param ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid param argument (param=0)");
+		return;
+	}
+
+	proc_data->ret_status = WSTATUS_SUCCESS;
+
+	/* create request buffer */
+
+	ws = reqbuf_create(reqbuf_wchannel_read_cb,proc_data->recv_wch,REQBUF_TYPE_BINARY,&proc_data->rb);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create new reqbuf (ws=%s)",wstatus_str(ws));
+		proc_data->rb = 0;
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"created request buffer successfully (rb=%p)",proc_data->rb);
+
+	ws = reqbuf_admission(proc_data->rb,_request_admit_cb,&admit_internal);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to set admission callback (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	ws = wloop_add(proc_data->loop,proc_data->recv_wch,_request_processor_ready_cb,proc_data);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to add the wchannel to the loop (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	/* initialization part is finished, toggle flag */
+	proc_data->initialized_flag = true;
+
+	/* start processing part, until wloop_stop */
+	ws = wloop_run(proc_data->loop);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"event loop failed (ws=%s)",wstatus_str(ws));
+		proc_data->ret_status = ws;
+	}
+	dbgprint(MOD_MODMGR,__func__,"event loop was stopped, finishing thread");
+
+	wloop_remove(proc_data->loop,proc_data->recv_wch);
+
+	/* destroy request buffer */
+	ws = reqbuf_destroy(proc_data->rb);
+	proc_data->rb = 0;
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to destroy request buffer (ws=%s)",wstatus_str(ws));
+		proc_data->ret_status = ws;
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"returning (ws=%s).",wstatus_str(proc_data->ret_status));
+	proc_data->finished_flag = true;
+	return;
+
+return_fail:
+	if( proc_data->rb ) {
+		reqbuf_destroy(proc_data->rb);
+		proc_data->rb = 0;
+	}
+	dbgprint(MOD_MODMGR,__func__,"returning with failure.");
+	proc_data->ret_status = WSTATUS_FAILURE;
+	proc_data->finished_flag = true;
+	proc_data->initialized_flag = true;
+	return;
+}
+
+/*
+   _remote_request_receiver_thread
+
+   Thread callback of a remote request receiver. Each receiver has its own
+   socket bound to the modmgr port with SO_REUSEPORT, the kernel spreads the
+   senders between the sockets, and its own text reqbuf so the parsing of the
+   requests runs in parallel on every core. Admitted requests are queued in the
+   dispatch scheduler directly, like the ones of the request processor. The
+   thread finishes when its socket is shut down by _remote_receivers_stop.
+
+   Each datagram must carry whole requests, a sender that splits a request
+   between datagrams would mix with the other senders of the same socket.
+   The reqbuf is zero copy, the requests are parsed in the buffer of the
+   wchannel (a registered buffer with the URING engine).
+*/
+void _remote_request_receiver_thread(void *param)
+{
+	remote_receiver_t *receiver = (remote_receiver_t*)param;
+	reqbuf_t rb = 0;
+	request_t req,bin_req;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with param=%p",param);
+
+	ws = reqbuf_create_zc(reqbuf_wchannel_peek_cb,reqbuf_wchannel_done_cb,receiver->wch,REQBUF_TYPE_TEXT,&rb);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"receiver %u failed to create reqbuf (ws=%s)",receiver->index,wstatus_str(ws));
+		return;
+	}
+
+	ws = reqbuf_admission(rb,_request_admit_cb,0);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"receiver %u failed to set admission callback (ws=%s)",
+				receiver->index,wstatus_str(ws));
+		goto finish_thread;
+	}
+
+	for(;;)
+	{
+		ws = reqbuf_read(rb,&req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"receiver %u stopped reading (ws=%s)",receiver->index,wstatus_str(ws));
+			break;
+		}
+
+		/* modmgr routes binary requests, the header is read from data.bin */
+		ws = req_to_bin(req,&bin_req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"receiver %u unable to convert request (ws=%s)",receiver->index,wstatus_str(ws));
+			admctl_release();
+			req_free(req);
+			continue;
+		}
+		bin_req->wire_size = req->wire_size;
+		req_free(req);
+		req = bin_req;
+
+		/* the queue wait of the statistics starts here (see modstats.h) */
+		req->ingress_ns = modstats_now_ns();
+		req_deadline_parse(req);
+
+		ws = _request_enqueue(req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"receiver %u unable to queue request (ws=%s)",receiver->index,wstatus_str(ws));
+			admctl_release();
+			req_free(req);
+		}
+	}
+
+finish_thread:
+	reqbuf_destroy(rb);
+	dbgprint(MOD_MODMGR,__func__,"receiver %u returning.",receiver->index);
+}
+
+/*
+   _remote_receivers_cpu_count
+
+   Helper function that returns the number of online processors, the default
+   number of remote receivers.
+*/
+unsigned int _remote_receivers_cpu_count(void)
+{
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (unsigned int)count : 1;
+#else
+	return 1;
+#endif
+}
+
+/*
+   _remote_receivers_start
+
+   Helper function that creates count remote receivers bound to host and port
+   with the wchannel engine and capture rings of ring_size messages, reliable
+   datagrams if asked (see _remote_request_receiver_thread).
+*/
+wstatus _remote_receivers_start(const char *host,const char *port,unsigned int count,wchannel_engine_list engine,
+		unsigned int ring_size,bool reliable,unsigned int reliable_loss)
+{
+	wchannel_opt_t wch_opt;
+	remote_receiver_t *receiver;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with host=%s, port=%s, count=%u",z_ptr(host),z_ptr(port),count);
+
+	receiver_list = (remote_receiver_t*)malloc(count * sizeof(remote_receiver_t));
+	if( !receiver_list ) {
+		dbgprint(MOD_MODMGR,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+	memset(receiver_list,0,count * sizeof(remote_receiver_t));
+
+	memset(&wch_opt,0,sizeof(wch_opt));
+	wch_opt.type = WCHANNEL_TYPE_SOCKUDP;
+	wch_opt.host_src = (char*)host;
+	wch_opt.port_src = (char*)port;
+	wch_opt.debug_opts = WCHANNEL_NO_DEBUG;
+	wch_opt.reuse_port = true;
+	wch_opt.engine = engine;
+	wch_opt.ring_size = ring_size;
+	wch_opt.reliable = reliable;
+	wch_opt.reliable_loss = reliable_loss;
+
+	for( receiver_count = 0 ; receiver_count < count ; receiver_count++ )
+	{
+		receiver = &receiver_list[receiver_count];
+		receiver->index = receiver_count;
+
+		ws = wchannel_create(&wch_opt,&receiver->wch);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to create socket of receiver %u (ws=%s)",receiver_count,wstatus_str(ws));
+			receiver->wch = 0;
+			DBGRET_FAILURE(MOD_MODMGR);
+		}
+
+		ws = wthread_create(_remote_request_receiver_thread,receiver,&receiver->wthread);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to create thread of receiver %u (ws=%s)",receiver_count,wstatus_str(ws));
+			wchannel_destroy(receiver->wch);
+			receiver->wch = 0;
+			DBGRET_FAILURE(MOD_MODMGR);
+		}
+		receiver->started = true;
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"started %u remote receivers on port %s (%s engine)",receiver_count,port,
+			wchannel_engine(receiver_list[0].wch) == WCHANNEL_ENGINE_URING ? "io_uring" : "classic");
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _remote_receivers_stop
+
+   Helper function that shuts down the sockets of the remote receivers, waits
+   for their threads and frees them.
+*/
+void _remote_receivers_stop(void)
+{
+	unsigned int i;
+
+	dbgprint(MOD_MODMGR,__func__,"called");
+
+	if( !receiver_list )
+		return;
+
+	for( i = 0 ; i < receiver_count ; i++ )
+		if( receiver_list[i].started )
+			wchannel_shutdown(receiver_list[i].wch);
+
+	for( i = 0 ; i < receiver_count ; i++ )
+	{
+		if( receiver_list[i].started )
+			wthread_wait(receiver_list[i].wthread);
+		if( receiver_list[i].wch )
+			wchannel_destroy(receiver_list[i].wch);
+	}
+
+	free(receiver_list);
+	receiver_list = 0;
+	receiver_count = 0;
+}
+
+/*
+   _shm_request_receiver_thread
+
+   Thread callback of the receiver of a SHM module, param is its registry.
+   The frames of the module ring are converted to binary requests and queued
+   in the dispatch scheduler after the admission control, like the ones of the
+   remote receivers. The thread finishes when the rings are shut down (see
+   _modreg_shm_stop) and the frames left were read.
+*/
+void _shm_request_receiver_thread(void *param)
+{
+	modreg_t mod = (modreg_t)param;
+	shmring_t ring = mod->communication.data.shm.ring;
+	req_header_t header;
+	const void *frame_ptr;
+	unsigned int frame_size;
+	request_t req;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with param=%p",param);
+
+	for(;;)
+	{
+		ws = shmring_peek(ring,&frame_ptr,&frame_size);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"receiver of module (%s) stopped reading (ws=%s)",
+					mod->basic.name,wstatus_str(ws));
+			break;
+		}
+
+		/* the request is a copy, the frame is released at once */
+		ws = req_from_frame(frame_ptr,frame_size,&req);
+		shmring_release(ring);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"dropping invalid frame of module (%s)",mod->basic.name);
+			continue;
+		}
+
+		_request_header(req,&header);
+		if( !_request_admit_cb(0,&header) ) {
+			req_free(req);
+			continue;
+		}
+
+		/* the queue wait of the statistics starts here (see modstats.h) */
+		req->ingress_ns = modstats_now_ns();
+		req_deadline_parse(req);
+
+		ws = _request_enqueue(req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"receiver of module (%s) unable to queue request (ws=%s)",
+					mod->basic.name,wstatus_str(ws));
+			admctl_release();
+			req_free(req);
+		}
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"receiver of module (%s) returning.",mod->basic.name);
+}
+
+/*
+   _modreg_shm_start
+
+   Helper function that creates the shared memory rings of a SHM module (see
+   shmring.h) and starts its receiver thread, must be called before the module
+   is inserted in the registered modules list.
+*/
+wstatus _modreg_shm_start(modreg_t mod)
+{
+	struct _shm *shm = &mod->communication.data.shm;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with mod=%p",mod);
+
+	if( mod->communication.type != MODREG_COMM_SHM ) {
+		dbgprint(MOD_MODMGR,__func__,"module (%s) isn't SHM, no rings needed",mod->basic.name);
+		DBGRET_SUCCESS(MOD_MODMGR);
+	}
+
+	ws = shmring_create(shm->ring_size,&shm->ring);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create rings of module (%s) (ws=%s)",mod->basic.name,wstatus_str(ws));
+		shm->ring = 0;
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	ws = wlock_create(&shm->send_lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create send lock of module (%s) (ws=%s)",mod->basic.name,wstatus_str(ws));
+		goto return_fail;
+	}
+
+	ws = wthread_create(_shm_request_receiver_thread,mod,&shm->wthread);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create receiver thread of module (%s) (ws=%s)",
+				mod->basic.name,wstatus_str(ws));
+		wlock_free(&shm->send_lock);
+		goto return_fail;
+	}
+	shm->started = true;
+
+	dbgprint(MOD_MODMGR,__func__,"module (%s) rings are at %s",mod->basic.name,shmring_path(shm->ring));
+	DBGRET_SUCCESS(MOD_MODMGR);
+
+return_fail:
+	shmring_destroy(shm->ring);
+	shm->ring = 0;
+	DBGRET_FAILURE(MOD_MODMGR);
+}
+
+/*
+   _modreg_shm_stop
+
+   Helper function that shuts down the rings of a SHM module and waits for its
+   receiver thread, the rings are freed by _modreg_free.
+*/
+void _modreg_shm_stop(modreg_t mod)
+{
+	struct _shm *shm = &mod->communication.data.shm;
+
+	if( (mod->communication.type != MODREG_COMM_SHM) || !shm->started )
+		return;
+
+	shmring_shutdown(shm->ring);
+	wthread_wait(shm->wthread);
+	shm->started = false;
+}
+
+/*
+   _modreg_shm_stop_jlcb
+
+   jmlist parse callback that stops the receivers of the SHM modules, the
+   first step of modmgr_unload with _remote_receivers_stop.
+*/
+void _modreg_shm_stop_jlcb(void *ptr,void *param)
+{
+	_modreg_shm_stop((modreg_t)ptr);
+}
+
+/*
+   modreg_create_from_request
+
+   Helper function that converts a request with destination 'modmgr' and
+   code 'registryModule' into a module registration data structure.
+*/
 wstatus
-_modreg_validate_author_email(const char *author_email_ptr,unsigned int author_email_size,modreg_validation_result *result)
+modreg_create_from_request(request_t req,modreg_t *modreg)
+{
+	return WSTATUS_UNIMPLEMENTED;
+}
+
+wstatus
+_modreg_validate_name(const char *name_ptr,unsigned int name_size,modreg_validation_result *result)
 {
 	unsigned int i;
 
-	dbgprint(MOD_MODMGR,__func__,"called with author_email_ptr=%p, author_email_size=%u, result=%p",
-			author_email_ptr,author_email_size,result);
+	dbgprint(MOD_MODMGR,__func__,"called with name_ptr=%p, name_size=%u, result=%p",
+			name_ptr,name_size,result);
+
+	if( !name_ptr ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid name_ptr argument (name_ptr=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !name_size ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid name_size argument (name_size=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !result ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid result argument (result=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	for( i = 0 ; i < name_size ; i++ )
+   	{
+		if( MRV_NAMECHAR(name_ptr[i]) )
+			continue;
+
+		dbgprint(MOD_MODMGR,__func__,"invalid/unsupported character found in module name (name[%u]=%02X)",i,name_ptr[i]);
+		*result = MODREG_PARAM_INVALID_CHARACTER_FOUND;
+		dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
+		DBGRET_SUCCESS(MOD_MODMGR);
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"finished parsing all name characters");
+
+	/* all characters are valid */
+	
+	*result = MODREG_PARAM_CHARACTERS_ARE_VALID;
+	dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+wstatus
+_modreg_validate_description(const char *description_ptr,unsigned int description_size,modreg_validation_result *result)
+{
+	unsigned int i;
+
+	dbgprint(MOD_MODMGR,__func__,"called with description_ptr=%p, description_size=%u, result=%p",
+			description_ptr,description_size,result);
+
+	if( !description_ptr ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid description_ptr argument (description_ptr=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !description_size ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid description_size argument (description_size=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !result ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid result argument (result=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	for( i = 0 ; i < description_size ; i++ )
+   	{
+		if( MRV_DESCCHAR(description_ptr[i]) )
+			continue;
+
+		dbgprint(MOD_MODMGR,__func__,"invalid/unsupported character found in module description (name[%u]=%02X)",i,description_ptr[i]);
+		*result = MODREG_PARAM_INVALID_CHARACTER_FOUND;
+		dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
+		DBGRET_SUCCESS(MOD_MODMGR);
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"finished parsing all description characters");
+
+	/* all characters are valid */
+	
+	*result = MODREG_PARAM_CHARACTERS_ARE_VALID;
+	dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+wstatus
+_modreg_validate_author_name(const char *author_name_ptr,unsigned int author_name_size,modreg_validation_result *result)
+{
+	unsigned int i;
+
+	dbgprint(MOD_MODMGR,__func__,"called with author_name_ptr=%p, author_name_size=%u, result=%p",
+			author_name_ptr,author_name_size,result);
+
+	if( !author_name_ptr ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid author_name_ptr argument (author_name_ptr=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !author_name_size ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid author_name_size argument (author_name_size=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !result ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid result argument (result=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	for( i = 0 ; i < author_name_size ; i++ )
+   	{
+		if( MRV_AUTHORNCHAR(author_name_ptr[i]) )
+			continue;
+
+		dbgprint(MOD_MODMGR,__func__,"invalid/unsupported character found in module author name (author_name[%u]=%02X)",i,author_name_ptr[i]);
+		*result = MODREG_PARAM_INVALID_CHARACTER_FOUND;
+		dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
+		DBGRET_SUCCESS(MOD_MODMGR);
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"finished parsing all author name characters");
+
+	/* all characters are valid */
+	
+	*result = MODREG_PARAM_CHARACTERS_ARE_VALID;
+	dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+wstatus
+_modreg_validate_author_email(const char *author_email_ptr,unsigned int author_email_size,modreg_validation_result *result)
+{
+	unsigned int i;
+
+	dbgprint(MOD_MODMGR,__func__,"called with author_email_ptr=%p, author_email_size=%u, result=%p",
+			author_email_ptr,author_email_size,result);
+
+	if( !author_email_ptr ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid author_email_ptr argument (author_email_ptr=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !author_email_size ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid author_email_size argument (author_email_size=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !result ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid result argument (result=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	for( i = 0 ; i < author_email_size ; i++ )
+   	{
+		if( MRV_AUTHORECHAR(author_email_ptr[i]) )
+			continue;
+
+		dbgprint(MOD_MODMGR,__func__,"invalid/unsupported character found in module author email (author_email[%u]=%02X)",i,author_email_ptr[i]);
+		*result = MODREG_PARAM_INVALID_CHARACTER_FOUND;
+		dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
+		DBGRET_SUCCESS(MOD_MODMGR);
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"finished parsing all author email characters");
+
+	/* all characters are valid */
+	
+	*result = MODREG_PARAM_CHARACTERS_ARE_VALID;
+	dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _modreg_alloc
+
+   Helper function to allocate a new module registry data structure.
+*/
+wstatus _modreg_alloc(modreg_t *mod)
+{
+	modreg_t new_mod;
+	dbgprint(MOD_MODMGR,__func__,"called with mod=%p",mod);
+
+	if(!mod) {
+		dbgprint(MOD_MODMGR,__func__,"invalid mod argument (mod=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	new_mod = (modreg_t)malloc(sizeof(struct _modreg_t));
+	if( !new_mod ) {
+		dbgprint(MOD_MODMGR,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"allocated memory for modreg_t data structure successfully (ptr=%p)",new_mod);
+
+	dbgprint(MOD_MODMGR,__func__,"filling modreg_t data structure");
+	memset(new_mod->basic.name,'\0',sizeof(new_mod->basic.name));
+	memset(new_mod->basic.description,'\0',sizeof(new_mod->basic.description));
+	memset(new_mod->basic.version,'\0',sizeof(new_mod->basic.version));
+	memset(new_mod->basic.author_name,'\0',sizeof(new_mod->basic.author_name));
+	memset(new_mod->basic.author_email,'\0',sizeof(new_mod->basic.author_email));
+
+	new_mod->communication.type = MODREG_COMM_UNDEF;
+	new_mod->communication.data.dcr.reqproc_cb = 0;
+	new_mod->communication.data.dcr.reqbatch_cb = 0;
+	new_mod->communication.data.dcr.batch_max = 0;
+	memset(new_mod->communication.data.ssr.host,'\0',sizeof(new_mod->communication.data.ssr.host));
+	memset(new_mod->communication.data.ssr.port,'\0',sizeof(new_mod->communication.data.ssr.port));
+	new_mod->communication.data.shm.ring_size = 0;
+	new_mod->communication.data.shm.ring = 0;
+	new_mod->communication.data.shm.started = false;
+	new_mod->dispatch.sched_class = MODSCHED_CLASS_NORMAL;
+	new_mod->inbox.size = 0;
+	new_mod->inbox.overflow = MODINBOX_OVERFLOW_BUSY;
+	new_mod->inbox.block_ms = 0;
+	new_mod->inbox.queue = 0;
+	new_mod->replica.policy = MODGROUP_LEAST_OUTSTANDING;
+	memset(new_mod->replica.hash_name,'\0',sizeof(new_mod->replica.hash_name));
+	new_mod->replica.group = 0;
+	dbgprint(MOD_MODMGR,__func__,"finished filling of new modreg_t data structure");
+
+	*mod = new_mod;
+	dbgprint(MOD_MODMGR,__func__,"updated mod value to %p",*mod);
+
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _modreg_free
+
+   Helper function to free a single module registry data structure from memory.
+   The data structure must have been allocated using _modreg_alloc function.
+   The inbox of the module is destroyed, waiting for its thread, and so are
+   the rings of SHM modules and the member list of multicast groups. The
+   module leaves its replica group, the last one frees the group.
+*/
+wstatus _modreg_free(const struct _modreg_t *mod)
+{
+	dbgprint(MOD_MODMGR,__func__,"called with mod=%p");
+
+	if(!mod) {
+		dbgprint(MOD_MODMGR,__func__,"invalid mod argument (mod=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( mod->inbox.queue )
+		modinbox_destroy(mod->inbox.queue);
+
+	if( (mod->communication.type == MODREG_COMM_SHM) && mod->communication.data.shm.ring ) {
+		_modreg_shm_stop((modreg_t)mod);
+		shmring_destroy(mod->communication.data.shm.ring);
+		wlock_free((wlock_t*)&mod->communication.data.shm.send_lock);
+	}
+
+	if( (mod->communication.type == MODREG_COMM_MCAST) && mod->communication.data.mcast.cast )
+		modcast_destroy(mod->communication.data.mcast.cast);
+
+	if( mod->replica.group ) {
+		modgroup_remove(mod->replica.group,(void*)mod);
+		if( !modgroup_count(mod->replica.group) )
+			modgroup_destroy(mod->replica.group);
+	}
+
+	free((void*)mod);
+
+	dbgprint(MOD_MODMGR,__func__,"freed module registry data structure successfully (ptr=%p)",mod);
+
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _modreg_inbox_start
+
+   Helper function that creates the inbox of a DCR module (see modinbox.h)
+   with the size and overflow policy of its registration, must be called
+   before the module is inserted in the registered modules list. Modules
+   with a batch callback get batches of up to their batch_max.
+*/
+wstatus _modreg_inbox_start(modreg_t mod)
+{
+	modinbox_opt_t opt;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with mod=%p",mod);
+
+	if( mod->communication.type != MODREG_COMM_DCR ) {
+		dbgprint(MOD_MODMGR,__func__,"module (%s) isn't DCR, no inbox needed",mod->basic.name);
+		DBGRET_SUCCESS(MOD_MODMGR);
+	}
+
+	opt.name = mod->basic.name;
+	opt.size = mod->inbox.size;
+	opt.overflow = mod->inbox.overflow;
+	opt.block_ms = mod->inbox.block_ms;
+	opt.drop_cb = _request_inbox_drop_cb;
+	opt.batch_max = MODINBOX_DEFAULT_BATCH;
+	if( mod->communication.data.dcr.reqbatch_cb )
+	{
+		opt.batch_max = mod->communication.data.dcr.batch_max;
+		if( !opt.batch_max || (opt.batch_max > MODREG_BATCH_MAX) )
+			opt.batch_max = MODREG_BATCH_MAX;
+	}
+
+	ws = modinbox_create(&opt,_request_inbox_deliver_cb,mod,&mod->inbox.queue);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create inbox of module (%s) (ws=%s)",mod->basic.name,wstatus_str(ws));
+		mod->inbox.queue = 0;
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _modreg_inbox_stop_jlcb
+
+   jmlist parse callback that stops the inbox of every registered module, the
+   first step of modmgr_unload before the registries (and inboxes) are freed.
+*/
+void _modreg_inbox_stop_jlcb(void *ptr,void *param)
+{
+	modreg_t mod = (modreg_t)ptr;
+
+	if( mod->inbox.queue )
+		modinbox_stop(mod->inbox.queue);
+}
+
+/*
+   _modreg_inbox_wait_jlcb
+
+   jmlist parse callback that waits for the inbox thread of every registered
+   module, called after all of them were stopped (see modinbox.h).
+*/
+void _modreg_inbox_wait_jlcb(void *ptr,void *param)
+{
+	modreg_t mod = (modreg_t)ptr;
+
+	if( mod->inbox.queue )
+		modinbox_wait(mod->inbox.queue);
+}
+
+/*
+   _modmgr_event_nv
+
+   Helper function that copies the value of an event nvpair into a null
+   terminated buffer, returns false when the nvpair isn't in the request
+   or doesn't fit.
+*/
+bool
+_modmgr_event_nv(const request_t req,reqname_id name_id,char *buf,unsigned int buf_size)
+{
+	nvpair_t nvp = 0;
+
+	if( req_get_nv_id(req,name_id,&nvp) != WSTATUS_SUCCESS )
+		return false;
+
+	if( nvp->value_size >= buf_size ) {
+		dbgprint(MOD_MODMGR,__func__,"value of nvpair \"%s\" is too long (%u)",reqid_name_str(name_id),nvp->value_size);
+		_nvp_free(nvp);
+		return false;
+	}
+
+	memcpy(buf,nvp->value_ptr,nvp->value_size);
+	buf[nvp->value_size] = '\0';
+	_nvp_free(nvp);
+	return true;
+}
+
+/*
+   _modmgr_event_subscription
+
+   Handles the event.subscribe and event.unsubscribe requests sent to modmgr,
+   the subscriber is the source of the request (see _modmgr_reqproc_cb).
+*/
+void
+_modmgr_event_subscription(const request_t req)
+{
+	char topic[MODBUS_TOPICSIZE];
+	char queue_buf[16];
+	char src[REQMODSIZE+1];
+	char error_desc[MODBUS_TOPICSIZE + 64];	/* topic and the rest of the message */
+	unsigned int queue_size = 0;
+	req_header_t header;
+	bool has_topic;
+	wstatus ws;
+
+	memcpy(src,req->data.bin.src,REQMODSIZE);
+	src[REQMODSIZE] = '\0';
+
+	has_topic = _modmgr_event_nv(req,REQNAME_TOPIC,topic,sizeof(topic));
+
+	if( req->data.bin.code_id == REQCODE_EVENT_SUBSCRIBE )
+	{
+		if( !has_topic ) {
+			_request_reply_error(req,"Missing topic nvpair.");
+			return;
+		}
+		if( _modmgr_event_nv(req,REQNAME_QUEUE_SIZE,queue_buf,sizeof(queue_buf)) )
+			queue_size = (unsigned int)strtoul(queue_buf,0,10);
+
+		ws = modmgr_subscribe(src,topic,queue_size);
+	} else
+		ws = modmgr_unsubscribe(src,has_topic ? topic : 0);
+
+	if( ws != WSTATUS_SUCCESS ) {
+		snprintf(error_desc,sizeof(error_desc),"Unable to %s %s (%s).",
+				req->data.bin.code_id == REQCODE_EVENT_SUBSCRIBE ? "subscribe" : "unsubscribe",
+				has_topic ? topic : "all topics",wstatus_str(ws));
+		_request_reply_error(req,error_desc);
+		return;
+	}
+
+	_request_header(req,&header);
+	_request_reply_code(&header,reqid_code_str(req->data.bin.code_id),0);
+}
+
+/*
+   _modmgr_stats_hist
+
+   Helper function that formats the percentiles of a histogram as
+   "p50-p90-p99-p999-max" (microseconds).
+*/
+void
+_modmgr_stats_hist(const modstats_hist_status_t *hist,char *buf,unsigned int size)
+{
+	snprintf(buf,size,"%llu-%llu-%llu-%llu-%llu",
+			(unsigned long long)hist->p50_us,(unsigned long long)hist->p90_us,
+			(unsigned long long)hist->p99_us,(unsigned long long)hist->p999_us,
+			(unsigned long long)hist->max_us);
+}
+
+/*
+   _modmgr_stats
+
+   Handles the stats requests sent to modmgr. The reply has the stats code and
+   the nvpair count with the number of entries, then for each entry N:
+      eN = "module:code", eNn = requests, eNe = errors, eNx = expired
+      (dropped past their deadline), eNi = bytes received,
+      eNo = bytes sent, eNq/eNh/eNt = queue wait, handler and total time
+      percentiles (see _modmgr_stats_hist).
+   When the request has the reset nvpair the statistics are reset after the
+   snapshot is taken.
+*/
+void
+_modmgr_stats(const request_t req)
+{
+	const struct _modreg_t *mod_src = 0;
+	modstats_status_t *list = 0;
+	unsigned int count = 0, i;
+	request_t reply = 0;
+	char name[16];
+	char value[REQMODSIZE+REQCODESIZE+2];
+	char src[REQMODSIZE+1];
+	char reset_buf[32];
+	wstatus ws;
+
+	list = (modstats_status_t*)malloc((MODSTATS_MAXPAIRS+1) * sizeof(modstats_status_t));
+	if( !list ) {
+		dbgprint(MOD_MODMGR,__func__,"malloc failed");
+		_request_reply_error(req,"Unable to take statistics snapshot.");
+		return;
+	}
+
+	ws = modstats_snapshot(list,MODSTATS_MAXPAIRS+1,&count);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to take statistics snapshot (ws=%s)",wstatus_str(ws));
+		_request_reply_error(req,"Unable to take statistics snapshot.");
+		goto return_free;
+	}
+
+	if( _modmgr_event_nv(req,REQNAME_RESET,reset_buf,sizeof(reset_buf)) )
+		modstats_reset();
+
+	ws = _request_build_error_reply(reqid_code_str(REQCODE_STATS),0,&reply);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create stats reply (ws=%s)",wstatus_str(ws));
+		goto return_free;
+	}
+
+	snprintf(value,sizeof(value),"%u",count);
+	req_add_nvp_z("count",value,reply);
+
+	for( i = 0 ; i < count ; i++ )
+	{
+		snprintf(name,sizeof(name),"e%u",i);
+		snprintf(value,sizeof(value),"%s:%s",list[i].dst,list[i].code);
+		req_add_nvp_z(name,value,reply);
+
+		snprintf(name,sizeof(name),"e%un",i);
+		snprintf(value,sizeof(value),"%llu",(unsigned long long)list[i].count);
+		req_add_nvp_z(name,value,reply);
+
+		snprintf(name,sizeof(name),"e%ue",i);
+		snprintf(value,sizeof(value),"%llu",(unsigned long long)list[i].errors);
+		req_add_nvp_z(name,value,reply);
+
+		snprintf(name,sizeof(name),"e%ux",i);
+		snprintf(value,sizeof(value),"%llu",(unsigned long long)list[i].expired);
+		req_add_nvp_z(name,value,reply);
+
+		snprintf(name,sizeof(name),"e%ui",i);
+		snprintf(value,sizeof(value),"%llu",(unsigned long long)list[i].bytes_in);
+		req_add_nvp_z(name,value,reply);
+
+		snprintf(name,sizeof(name),"e%uo",i);
+		snprintf(value,sizeof(value),"%llu",(unsigned long long)list[i].bytes_out);
+		req_add_nvp_z(name,value,reply);
+
+		snprintf(name,sizeof(name),"e%uq",i);
+		_modmgr_stats_hist(&list[i].queue,value,sizeof(value));
+		req_add_nvp_z(name,value,reply);
+
+		snprintf(name,sizeof(name),"e%uh",i);
+		_modmgr_stats_hist(&list[i].handler,value,sizeof(value));
+		req_add_nvp_z(name,value,reply);
+
+		snprintf(name,sizeof(name),"e%ut",i);
+		_modmgr_stats_hist(&list[i].total,value,sizeof(value));
+		req_add_nvp_z(name,value,reply);
+	}
+
+	memcpy(src,req->data.bin.src,REQMODSIZE);
+	src[REQMODSIZE] = '\0';
+
+	ws = modmgr_lookup(src,&mod_src);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to lookup source module, can't reply (ws=%s)",wstatus_str(ws));
+		goto return_free;
+	}
+
+	reply->data.bin.id = req->data.bin.id;
+	memcpy(reply->data.bin.src,req->data.bin.dst,sizeof(reply->data.bin.src));
+	memcpy(reply->data.bin.dst,req->data.bin.src,sizeof(reply->data.bin.dst));
+
+	ws = _request_send(reply,mod_src);
+	if( ws != WSTATUS_SUCCESS )
+		dbgprint(MOD_MODMGR,__func__,"failed to send stats reply (ws=%s)",wstatus_str(ws));
+
+return_free:
+	if( reply )
+		req_free(reply);
+	free(list);
+}
+
+/*
+   _modmgr_peer_summary_jlcb
+
+   Callback of jmlist_parse used by _modmgr_peer_summary_cb, appends the name of
+   a module to the summary.
+*/
+typedef struct _peer_summary_t
+{
+	char *buf;
+	unsigned int size;
+	unsigned int used;
+} peer_summary_t;
+
+void _modmgr_peer_summary_jlcb(void *ptr,void *param)
+{
+	const struct _modreg_t *mod = (const struct _modreg_t*)ptr;
+	peer_summary_t *summary = (peer_summary_t*)param;
+	unsigned int name_size = strlen(mod->basic.name);
+
+	/* modmgr is local in every node */
+	if( !strcmp(mod->basic.name,"modmgr") )
+		return;
+
+	if( summary->used + name_size + 2 > summary->size )
+		return;
+
+	if( summary->used )
+		summary->buf[summary->used++] = ':';
+	memcpy(summary->buf + summary->used,mod->basic.name,name_size);
+	summary->used += name_size;
+}
+
+/*
+   _modmgr_peer_summary_cb
+
+   Summary callback of the peers (see MODPEERSUMMARYCB), writes the names of
+   the registered modules.
+*/
+unsigned int _modmgr_peer_summary_cb(void *param,char *buf,unsigned int buf_size)
+{
+	peer_summary_t summary;
+
+	summary.buf = buf;
+	summary.size = buf_size;
+	summary.used = 0;
+
+	wlock_acquire(&mod_lock);
+	if( mod_list )
+		jmlist_parse(mod_list,_modmgr_peer_summary_jlcb,&summary);
+	wlock_release(&mod_lock);
+
+	return summary.used;
+}
+
+/*
+   _modmgr_peer_summary
+
+   Handles the peer.summary code, the routes of the peer are replaced by the
+   modules of the summary (see modpeer_learn).
+*/
+void _modmgr_peer_summary(const request_t req)
+{
+	char node[MODPEER_NODESIZE];
+	char *modules = 0;
+	nvpair_t nvp = 0;
+	wstatus ws;
+
+	if( !peers ) {
+		dbgprint(MOD_MODMGR,__func__,"peering is disabled, ignoring summary");
+		return;
+	}
+
+	if( !_modmgr_event_nv(req,REQNAME_NODE,node,sizeof(node)) ) {
+		dbgprint(MOD_MODMGR,__func__,"summary without valid node nvpair, ignoring it");
+		return;
+	}
+
+	if( req_get_nv_id(req,REQNAME_MODULES,&nvp) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"summary of %s without modules nvpair, ignoring it",node);
+		return;
+	}
+
+	modules = (char*)malloc(nvp->value_size + 1);
+	if( !modules ) {
+		dbgprint(MOD_MODMGR,__func__,"malloc failed");
+		_nvp_free(nvp);
+		return;
+	}
+	memcpy(modules,nvp->value_ptr,nvp->value_size);
+	modules[nvp->value_size] = '\0';
+	_nvp_free(nvp);
+
+	ws = modpeer_learn(peers,node,modules);
+	if( ws != WSTATUS_SUCCESS )
+		dbgprint(MOD_MODMGR,__func__,"failed to learn the modules of %s (ws=%s)",node,wstatus_str(ws));
+
+	free(modules);
+}
+
+/*
+   _modmgr_reqproc_cb
+
+   This is the callback that receives the requests which have as destiny module the 'modmgr'.
+   Its one of the rare functions where modmgr doesn't give a damn if goes wrong so it doesn't
+   provide any means for passing an error status code.
+   
+   The module manager accepts several request codes:
+
+   moduleRegister	registers a new module into modmgr, this will make it possible to receive
+					and send requests to the new module. This should be the first message to be sent from
+					any module that wants to be part of running wicom. There are some nvpairs required
+					for this request code:
+						name = module name
+						description = module description
+						version = module version
+						authorName = author name
+						authorEmail = author email
+						dependencies = other module list ex: "cfgmgr,datastor"
+					The handler isn't implemented yet, the dispatch class and the inbox
+					of a module are set in modreg_t with modmgr_register.
+   
+   moduleUnregister unregisters the previously registered calling module (the module to unregister
+					is identified by the source of the message.
+
+   moduleLookup		Checks if a module exists in the list of registered modules. Reply is error
+					or success depending on the lookup result.
+
+   event.subscribe	subscribes the source module to the events of a topic (see modbus.h), nvpairs:
+						topic = topic or prefix ending with '*', "ap.*"
+						queueSize = events kept for the module (optional, first subscription)
+					The reply has the same code, or is an error.
+
+   event.unsubscribe removes a subscription of the source module, without topic all of them.
+
+   event			publishes the event to the subscribers of its topic nvpair, the key
+					nvpair (optional) is used for conflation. No reply is sent.
+
+   stats			replies with the request statistics per destination module and code
+					(see _modmgr_stats), with the reset nvpair they're cleared afterwards.
+
+   peer.summary		modules of a peer node (see modpeer.h), nvpairs:
+						node = name of the peer node
+						modules = its module names separated by colons
+					No reply is sent.
+*/
+void _modmgr_reqproc_cb(const request_t req)
+{
+	if( req->stype == REQUEST_STYPE_BIN )
+	{
+		switch(req->data.bin.code_id)
+		{
+			case REQCODE_MODULE_REGISTER:
+			case REQCODE_REGISTRY_MODULE:
+				dbgprint(MOD_MODMGR,__func__,"received module register request (not implemented yet)");
+				break;
+			case REQCODE_MODULE_UNREGISTER:
+				dbgprint(MOD_MODMGR,__func__,"received module unregister request (not implemented yet)");
+				break;
+			case REQCODE_MODULE_LOOKUP:
+				dbgprint(MOD_MODMGR,__func__,"received module lookup request (not implemented yet)");
+				break;
+			case REQCODE_EVENT_SUBSCRIBE:
+			case REQCODE_EVENT_UNSUBSCRIBE:
+				_modmgr_event_subscription(req);
+				return;
+			case REQCODE_EVENT:
+				if( modmgr_publish(req) != WSTATUS_SUCCESS )
+					dbgprint(MOD_MODMGR,__func__,"failed to publish event");
+				return;
+			case REQCODE_STATS:
+				_modmgr_stats(req);
+				return;
+			case REQCODE_PEER_SUMMARY:
+				_modmgr_peer_summary(req);
+				return;
+			default:
+				dbgprint(MOD_MODMGR,__func__,"received request with unknown code %s",
+						array2z(req->data.bin.code,sizeof(req->data.bin.code)));
+				break;
+		}
+	}
+
+	/* for now it will just dump the request.. */
+	req_dump(req);
+}
+
+/*
+   modmgr_load
+
+   Initializes modmgr module. This function must be called before the client
+   code can use the modmgr. It should do the following things:
+   - create jmlist for registered modules
+   - insert the 'modmgr' module into the registered modules
+   - create the bind wchannel and the pipe wchannel used in modmgr threads.
+   - create the required threads for modmgr, this includes _request_processor and
+     _remote_request_receiver threads.
+   - wait for threads initialization.
+*/
+wstatus
+modmgr_load(modmgr_load_t load)
+{
+	struct _jmlist_params params = { .flags = JMLIST_LINKED };
+	jmlist_status jmls;
+	wstatus ws;
+	wchannel_opt_t fast_wch_opt; 
+	wchannel_opt_t send_wch_opt;
+	wchannel_t fast_wch = 0;
+	modreg_t modmgr_reg = 0;
+	bool schema_loaded = false;
+	bool admctl_loaded = false;
+	bool stats_loaded = false;
+	bool lock_created = false;
+	bool dispatch_started = false;
+	unsigned int receivers;
+	
+	dbgprint(MOD_MODMGR,__func__,"called with load.bind_hostname=\"%s\", load.bind_port=%s",
+			z_ptr(load.bind_hostname),z_ptr(load.bind_port));
+
+	/* create jmlist for registered modules */
+
+	jmls = jmlist_create(&mod_list,&params);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create jmlist (jmls=%d)",jmls);
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"created new jmlist for registered modules successfully (jml=%p)",mod_list);
+
+	ws = wlock_create(&mod_lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create registered modules lock (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	lock_created = true;
+
+	/* initialize the request schema registry */
+
+	ws = reqschema_load();
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to load reqschema (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	schema_loaded = true;
+
+	/* initialize admission control of the incoming requests */
+
+	ws = admctl_load(&load.admission);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to load admctl (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	admctl_loaded = true;
+
+	/* initialize the request statistics */
+
+	ws = modstats_load();
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to load modstats (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	stats_loaded = true;
+
+	/* create the dispatch scheduler and its thread */
+
+	ws = modsched_create(&load.dispatch,&dispatch_sched);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create dispatch scheduler (ws=%s)",wstatus_str(ws));
+		dispatch_sched = 0;
+		goto return_fail;
+	}
+
+	ws = wthread_create(_request_dispatch_thread,0,&thread_reqproc_data.dispatch_wthread);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create dispatch wthread (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	dispatch_started = true;
+
+	/* create the event bus */
+
+	ws = modbus_create(&load.events,_modmgr_event_deliver_cb,0,&event_bus);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create event bus (ws=%s)",wstatus_str(ws));
+		event_bus = 0;
+		goto return_fail;
+	}
+
+	/* allocate new modmgr_reg */
+
+	ws = _modreg_alloc(&modmgr_reg);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to allocate new module registry data structure (ws=%s)",wstatus_str(ws));
+		modmgr_reg = 0; /* _modreg_alloc shouldn't have touched it, anyways.. */
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"allocated new module registry data structure successfully (ptr=%p)",modmgr_reg);
+
+	/* fill the data structure information */
+	
+	strcpy(modmgr_reg->basic.name,"modmgr");
+	strcpy(modmgr_reg->basic.description,"The module manager from wicom itself.");
+	strcpy(modmgr_reg->basic.version,"0.1");
+	strcpy(modmgr_reg->basic.author_name,"Jean-François Mousinho");
+	strcpy(modmgr_reg->basic.author_email,"jean.mousinho@ist.utl.pt");
+	
+	modmgr_reg->communication.type = MODREG_COMM_DCR;
+	modmgr_reg->communication.data.dcr.reqproc_cb = _modmgr_reqproc_cb;
+	modmgr_reg->dispatch.sched_class = MODSCHED_CLASS_CONTROL;
+
+	dbgprint(MOD_MODMGR,__func__,"all new module registry data structure was filled OK (ptr=%p)",modmgr_reg);
+
+	/* modmgr requests are delivered by its own inbox thread too */
+
+	ws = _modreg_inbox_start(modmgr_reg);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to start inbox of modmgr (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	/* insert this module data structure into the jmlist */
+	
+	jmls = jmlist_insert(mod_list,modmgr_reg);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to insert new module into module registry list (jmls=%d)",jmls);
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"new module was inserted into module registry list successfully (ptr=%p)",modmgr_reg);
+
+	/* create new wchannel for communication with request_processor thread */
+
+	memset(&fast_wch_opt,0,sizeof(fast_wch_opt));
+	fast_wch_opt.type = WCHANNEL_TYPE_PIPE;
+	fast_wch_opt.host_src = NULL;
+	fast_wch_opt.port_src = NULL;
+	fast_wch_opt.host_dst = NULL;
+	fast_wch_opt.port_dst = NULL;
+	fast_wch_opt.debug_opts = WCHANNEL_NO_DEBUG;
+	fast_wch_opt.dump_cb = 0;
+	fast_wch_opt.buffer_size = 0;
+	dbgprint(MOD_MODMGR,__func__,"filled fast wchannel data structure, creating wchannel");
+
+	ws = wchannel_create(&fast_wch_opt,&fast_wch);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create wchannel (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"created new wchannel successfully (wch=%p)",fast_wch);
+
+	/* the request_processor thread waits for the fast wchannel in this loop */
+
+	ws = wloop_create(0,0,&thread_reqproc_data.loop);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create the event loop (ws=%s)",wstatus_str(ws));
+		thread_reqproc_data.loop = 0;
+		goto return_fail;
+	}
+
+	/* create the sender wchannel, used for requests to SSR modules and multicast groups */
+
+	memset(&send_wch_opt,0,sizeof(send_wch_opt));
+	send_wch_opt.type = WCHANNEL_TYPE_SOCKUDP;
+	send_wch_opt.host_src = load.bind_hostname ? load.bind_hostname : "0.0.0.0";
+	send_wch_opt.port_src = "0";
+	send_wch_opt.host_dst = NULL;
+	send_wch_opt.port_dst = NULL;
+	send_wch_opt.debug_opts = WCHANNEL_NO_DEBUG;
+	send_wch_opt.dump_cb = 0;
+	send_wch_opt.buffer_size = 0;
+	send_wch_opt.ring_size = load.ring_size ? load.ring_size : MODMGR_RING_SIZE;
+	send_wch_opt.mcast = true;
+	send_wch_opt.mcast_ttl = load.mcast_ttl;
+	send_wch_opt.mcast_loop = load.mcast_loop;
+	send_wch_opt.mcast_if = load.mcast_if;
+	send_wch_opt.reliable = load.reliable;
+	send_wch_opt.reliable_loss = load.reliable_loss;
+
+	ws = wchannel_create(&send_wch_opt,&send_wch);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create sender wchannel (ws=%s)",wstatus_str(ws));
+		send_wch = 0;
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"created sender wchannel successfully (wch=%p)",send_wch);
+
+	/* a reliable sender defers the requests of the modules with a full window */
+	if( load.reliable ) {
+		ws = _request_deferred_start();
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to start the deferred thread (ws=%s)",wstatus_str(ws));
+			goto return_fail;
+		}
+	}
+
+	/* create the remote request receivers, one socket per core by default */
+
+	if( load.bind_port )
+	{
+		receivers = load.receivers ? load.receivers : _remote_receivers_cpu_count();
+		if( receivers > MODMGR_MAXRECEIVERS )
+			receivers = MODMGR_MAXRECEIVERS;
+
+		ws = _remote_receivers_start(load.bind_hostname ? load.bind_hostname : "0.0.0.0",load.bind_port,receivers,
+				load.engine,load.ring_size ? load.ring_size : MODMGR_RING_SIZE,load.reliable,load.reliable_loss);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to start remote request receivers (ws=%s)",wstatus_str(ws));
+			goto return_fail;
+		}
+	}
+
+	/* peering with other nodes, their requests and summaries come to the receivers */
+
+	if( load.peering.node )
+	{
+		if( !load.bind_port ) {
+			dbgprint(MOD_MODMGR,__func__,"peering requires the remote receivers (bind_port)");
+			goto return_fail;
+		}
+
+		if( !load.peering.host_src )
+			load.peering.host_src = load.bind_hostname;
+
+		ws = modpeer_create(&load.peering,_modmgr_peer_summary_cb,0,&peers);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to create peers (ws=%s)",wstatus_str(ws));
+			peers = 0;
+			goto return_fail;
+		}
+	}
+
+	/* initialize thread_reqproc_data which is the _request_processor thread interface data */
+
+	thread_reqproc_data.unload_flag = false;
+	thread_reqproc_data.initialized_flag = false;
+	thread_reqproc_data.finished_flag = false;
+	thread_reqproc_data.recv_wch = fast_wch;
+	dbgprint(MOD_MODMGR,__func__,"initialized thread_reqproc_data for _request_processor thread");
+
+	/* create _request_processor therad */
+
+	ws = wthread_create(_request_processor_thread,&thread_reqproc_data,&thread_reqproc_data.wthread);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create wthread (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"created wthread for request processor successfully (wth=%p)",
+			thread_reqproc_data.wthread);
+
+	dbgprint(MOD_MODMGR,__func__,"going to wait for request processor thread initialization");
+
+	while(!thread_reqproc_data.initialized_flag);
+
+	if( thread_reqproc_data.finished_flag ) {
+		dbgprint(MOD_MODMGR,__func__,"request processor thread failed to initialize (ws=%s)",
+				wstatus_str(thread_reqproc_data.ret_status));
+
+		/* wait for thread to RETN */
+		dbgprint(MOD_MODMGR,__func__,"waiting for request processor thread to finish");
+		wthread_wait(thread_reqproc_data.wthread);
+		dbgprint(MOD_MODMGR,__func__,"request processor thread has finished");
+
+		/* clear wthread */
+		thread_reqproc_data.wthread = 0;
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"request processor thread initialized successfully");
+
+	dbgprint(MOD_MODMGR,__func__,"updating loaded flag to TRUE");
+	loaded = true;
+
+	DBGRET_SUCCESS(MOD_MODMGR);
+return_fail:
+
+	/* stop the remote receivers first, they queue requests */
+	_remote_receivers_stop();
+
+	if( peers )
+		modpeer_stop(peers);
+
+	/* stop the event bus, it's freed after the inboxes */
+	if( event_bus )
+		modbus_stop(event_bus);
+
+	/* free registered modules jmlist object */
+	if( mod_list )
+   	{
+		jmls = jmlist_free(mod_list);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to free mod_list jmlist (jmls=%d)",jmls);
+		} else {
+			dbgprint(MOD_MODMGR,__func__,"registered modules list was freed successfully (jml=%p)",mod_list);
+			mod_list = 0;
+		}
+	}
+
+	/* free the modmgr registry data structure (and its inbox) */
+	if( modmgr_reg ) {
+		_modreg_free(modmgr_reg);
+		modmgr_reg = 0;
+	}
+
+	/* free the sender wchannel and the requests waiting for its windows */
+	_request_deferred_stop();
+	if( send_wch ) {
+		wchannel_destroy(send_wch);
+		send_wch = 0;
+	}
+
+	if( event_bus ) {
+		modbus_destroy(event_bus);
+		event_bus = 0;
+	}
+
+	/* stop the dispatch thread and free the scheduler */
+	if( dispatch_sched ) {
+		modsched_stop(dispatch_sched);
+		if( dispatch_started )
+			wthread_wait(thread_reqproc_data.dispatch_wthread);
+		modsched_destroy(dispatch_sched);
+		dispatch_sched = 0;
+	}
+
+	/* free the peers (the dispatch thread forwards requests to them) */
+	if( peers ) {
+		modpeer_destroy(peers);
+		peers = 0;
+	}
+
+	/* free the request schema registry */
+	if( schema_loaded )
+		reqschema_unload();
+
+	/* free admission control */
+	if( admctl_loaded )
+		admctl_unload();
+
+	/* free the request statistics (all the threads finished) */
+	if( stats_loaded )
+		modstats_unload();
+
+	if( lock_created )
+		wlock_free(&mod_lock);
+
+	if( thread_reqproc_data.loop ) {
+		wloop_destroy(thread_reqproc_data.loop);
+		thread_reqproc_data.loop = 0;
+	}
+
+	/* free the fast wchannel */
+	if( fast_wch ) 
+	{
+		ws = wchannel_destroy(fast_wch);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to free fast wchannel (ws=%s)",wstatus_str(ws));
+		} else {
+			fast_wch = 0;
+		}
+	}
+
+	DBGRET_FAILURE(MOD_MODMGR);
+}
+
+/*
+   modmgr_unload
+
+   Uninitializes the modmgr module, this includes:
+    - signal all theads to finish, using the unload_flag and wloop_stop.
+	- wait for all threads to finish using wthread_wait
+	- free any data structure used by modmgr and clear the pointers to
+	  these data structures (mod_list).
+*/
+wstatus
+modmgr_unload(void)
+{
+	wstatus ws;
+	unsigned int mod_count;
+	jmlist_status jmls;
+	modreg_t mod_ptr;
+
+	dbgprint(MOD_MODMGR,__func__,"called");
+
+	if( !loaded ) {
+		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
+		goto return_fail;
+	}
+
+	unloading = true;
+
+	/* stop the remote receivers, no more requests come from the network or
+	   from the rings of the SHM modules */
+	_remote_receivers_stop();
+	jmlist_parse(mod_list,_modreg_shm_stop_jlcb,0);
+
+	/* no more summaries are sent, the peers still forward the last requests */
+	if( peers )
+		modpeer_stop(peers);
+
+	/* flag the thread to unload and stop its loop, it returns right away */
+
+	thread_reqproc_data.unload_flag = true;
+
+	ws = wloop_stop(thread_reqproc_data.loop);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to stop the loop of request processor thread (ws=%s)",
+				wstatus_str(ws));
+		goto return_fail;
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"waiting on request processor thread to finish");
+	wthread_wait(thread_reqproc_data.wthread);
+	dbgprint(MOD_MODMGR,__func__,"request processor thread finished (ws=%s)",wstatus_str(thread_reqproc_data.ret_status));
+	thread_reqproc_data.wthread = 0;
+
+	wloop_destroy(thread_reqproc_data.loop);
+	thread_reqproc_data.loop = 0;
+
+	/* stop the dispatch thread, requests still queued are dropped */
+	modsched_stop(dispatch_sched);
+	dbgprint(MOD_MODMGR,__func__,"waiting on dispatch thread to finish");
+	wthread_wait(thread_reqproc_data.dispatch_wthread);
+	modsched_destroy(dispatch_sched);
+	dispatch_sched = 0;
+
+	/* destroy the communications channel to this thread */
+	ws = wchannel_destroy(thread_reqproc_data.recv_wch);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to destroy reception wchannel of request processor thread");
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"request processor wchannel destroyed successfully");
+	thread_reqproc_data.recv_wch = 0;
+
+	/* stop the event bus thread, the bus is freed after the inbox threads (they
+	   publish and subscribe) */
+	modbus_stop(event_bus);
+
+	/* stop the inboxes of all modules, they put replies in each other inboxes so
+	   none can be freed before all of their threads finished */
+
+	jmlist_parse(mod_list,_modreg_inbox_stop_jlcb,0);
+	dbgprint(MOD_MODMGR,__func__,"waiting on module inbox threads to finish");
+	jmlist_parse(mod_list,_modreg_inbox_wait_jlcb,0);
+
+	modbus_destroy(event_bus);
+	event_bus = 0;
+
+	/* destroy the sender wchannel (only now, the inbox threads use it) and
+	   the requests still waiting for its windows */
+	_request_deferred_stop();
+	if( send_wch )
+	{
+		ws = wchannel_destroy(send_wch);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to destroy sender wchannel");
+			goto return_fail;
+		}
+		dbgprint(MOD_MODMGR,__func__,"sender wchannel destroyed successfully");
+		send_wch = 0;
+	}
+
+	/* destroy the peers, the inbox threads forward requests to them too */
+	if( peers ) {
+		modpeer_destroy(peers);
+		peers = 0;
+	}
+
+	/* free all modules inside the registered modules list */
+	
+	jmls = jmlist_entry_count(mod_list,&mod_count);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to get number of registered modules (jmls=%d)",jmls);
+		goto return_fail;
+	}
+	dbgprint(MOD_MODMGR,__func__,"freeing %u modules from the registered modules list",mod_count);
+
+	while(mod_count--)
+	{
+		jmls = jmlist_pop(mod_list,(void*)&mod_ptr);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to pop an entry from registered modules list (jmls=%d)",jmls);
+			goto return_fail;
+		}
+
+		dbgprint(MOD_MODMGR,__func__,"freeing module (%s) from the registered modules list",
+				array2z(mod_ptr->basic.name,sizeof(mod_ptr->basic.name)));
+
+		_modreg_free(mod_ptr);
+	}
+	dbgprint(MOD_MODMGR,__func__,"freeing registered modules list object");
+	jmls = jmlist_free(mod_list);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to free jmlist (jmls=%d)",jmls);
+		goto return_fail;
+	}
+	/* clear pointer */
+	mod_list = 0;
+	wlock_free(&mod_lock);
+
+	/* free the request schema registry */
+	ws = reqschema_unload();
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to unload reqschema (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	/* free admission control */
+	ws = admctl_unload();
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to unload admctl (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	/* free the request statistics */
+	ws = modstats_unload();
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to unload modstats (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	/* everything went OK .. */
+
+	DBGRET_SUCCESS(MOD_MODMGR);
+
+return_fail:
+	DBGRET_FAILURE(MOD_MODMGR);
+}
+
+/*
+   modmgr_lookup
+
+   This functions lookups for a specific module that was registered before in modmgr. The
+   module search is done using the module name and a modreg_t data structure pointer is returned.
+   Modules registered with the same name are replicas of a group (see modmgr_register), the
+   first of them is returned, requests are spread by _request_send_group.
+   The registered modules list is used by several threads, the lookup is done with mod_lock
+   acquired (see _modmgr_lookup).
+*/
+wstatus modmgr_lookup(const char *mod_name,const struct _modreg_t **modp)
+{
+	wstatus ws;
+
+	if( !mod_list ) {
+		dbgprint(MOD_MODMGR,__func__,"registered module list was not initialized yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	wlock_acquire(&mod_lock);
+	ws = _modmgr_lookup(mod_name,modp);
+	wlock_release(&mod_lock);
+	return ws;
+}
+
+/*
+   modmgr_register
+
+   Registers a module in modmgr, reg is copied (the inbox of DCR modules is
+   created by modmgr). A module registered with the name of another one joins
+   its replica group (see modgroup.h), the requests sent to the name are
+   spread between them with the policy of the first registration. SSR
+   replicas are identified by "host port" in the hash ring.
+
+   SHM modules get their rings from modmgr (see modmgr_shm_path), they're
+   created and the receiver thread started before the module is visible.
+   Multicast groups are identified by "host port" like SSR replicas, they
+   start without members (see modmgr_mcast_join).
+*/
+wstatus modmgr_register(const struct _modreg_t *reg)
+{
+	const struct _modreg_t *first = 0;
+	modgroup_opt_t group_opt;
+	modcast_opt_t cast_opt;
+	modgroup_t new_group = 0;
+	modreg_t mod = 0;
+	char id[MODGROUP_IDSIZE];
+	jmlist_status jmls;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with reg=%p",reg);
+
+	if( !reg ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid reg argument (reg=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !loaded ) {
+		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !reg->basic.name[0] || ((reg->communication.type != MODREG_COMM_DCR) &&
+				(reg->communication.type != MODREG_COMM_SSR) && (reg->communication.type != MODREG_COMM_SHM) &&
+				(reg->communication.type != MODREG_COMM_MCAST)) ) {
+		dbgprint(MOD_MODMGR,__func__,"registration without name or communication type");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	ws = _modreg_alloc(&mod);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to allocate module registry data structure (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	*mod = *reg;
+	mod->basic.name[sizeof(mod->basic.name)-1] = '\0';
+	mod->inbox.queue = 0;
+	mod->replica.group = 0;
+	if( mod->communication.type == MODREG_COMM_SHM ) {
+		mod->communication.data.shm.ring = 0;
+		mod->communication.data.shm.started = false;
+	}
+	if( mod->communication.type == MODREG_COMM_MCAST )
+		mod->communication.data.mcast.cast = 0;
+
+	if( mod->communication.type == MODREG_COMM_SSR )
+		snprintf(id,sizeof(id),"%s %s",mod->communication.data.ssr.host,mod->communication.data.ssr.port);
+	else if( mod->communication.type == MODREG_COMM_MCAST )
+		snprintf(id,sizeof(id),"%s %s",mod->communication.data.mcast.host,mod->communication.data.mcast.port);
+	else
+		snprintf(id,sizeof(id),"%s %p",mod->basic.name,(void*)mod);
+
+	ws = _modreg_inbox_start(mod);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to start inbox of module (%s) (ws=%s)",mod->basic.name,wstatus_str(ws));
+		goto return_fail;
+	}
+
+	ws = _modreg_shm_start(mod);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to start rings of module (%s) (ws=%s)",mod->basic.name,wstatus_str(ws));
+		goto return_fail;
+	}
+
+	if( mod->communication.type == MODREG_COMM_MCAST )
+	{
+		memset(&cast_opt,0,sizeof(cast_opt));
+		cast_opt.reply_timeout_ms = mod->communication.data.mcast.reply_timeout_ms;
+		ws = modcast_create(&cast_opt,&mod->communication.data.mcast.cast);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to create multicast group of module (%s) (ws=%s)",
+					mod->basic.name,wstatus_str(ws));
+			mod->communication.data.mcast.cast = 0;
+			goto return_fail;
+		}
+	}
+
+	/* the group is created out of the lock, it's freed if the name already has one */
+
+	memset(&group_opt,0,sizeof(group_opt));
+	group_opt.policy = reg->replica.policy;
+	memcpy(group_opt.hash_name,reg->replica.hash_name,sizeof(group_opt.hash_name));
+
+	ws = modgroup_create(&group_opt,&new_group);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create replica group (ws=%s)",wstatus_str(ws));
+		new_group = 0;
+		goto return_fail;
+	}
+
+	wlock_acquire(&mod_lock);
+
+	if( _modmgr_lookup(mod->basic.name,&first) == WSTATUS_SUCCESS )
+	{
+		if( !first->replica.group ) {
+			wlock_release(&mod_lock);
+			dbgprint(MOD_MODMGR,__func__,"module name (%s) is reserved",mod->basic.name);
+			goto return_fail;
+		}
+		mod->replica.group = first->replica.group;
+	} else {
+		mod->replica.group = new_group;
+		new_group = 0;
+	}
+
+	ws = modgroup_add(mod->replica.group,mod,id);
+	if( ws != WSTATUS_SUCCESS ) {
+		wlock_release(&mod_lock);
+		dbgprint(MOD_MODMGR,__func__,"failed to add module (%s) to its replica group (ws=%s)",
+				mod->basic.name,wstatus_str(ws));
+		if( !first )
+			new_group = mod->replica.group;
+		mod->replica.group = 0;
+		goto return_fail;
+	}
+
+	jmls = jmlist_insert(mod_list,mod);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		modgroup_remove(mod->replica.group,mod);
+		wlock_release(&mod_lock);
+		dbgprint(MOD_MODMGR,__func__,"failed to insert module into registered modules list (jmls=%d)",jmls);
+		if( !first )
+			new_group = mod->replica.group;
+		mod->replica.group = 0;
+		goto return_fail;
+	}
+
+	wlock_release(&mod_lock);
+
+	if( new_group )
+		modgroup_destroy(new_group);
+
+	dbgprint(MOD_MODMGR,__func__,"registered module (%s) as replica \"%s\"",mod->basic.name,id);
+	DBGRET_SUCCESS(MOD_MODMGR);
+
+return_fail:
+	if( new_group )
+		modgroup_destroy(new_group);
+	if( mod )
+		_modreg_free(mod);
+	DBGRET_FAILURE(MOD_MODMGR);
+}
+
+/*
+   modmgr_group_status
+
+   Returns the state of the replicas of a module (see modgroup_status).
+*/
+wstatus modmgr_group_status(const char *mod_name,modgroup_status_t *list,unsigned int list_size,unsigned int *count)
+{
+	const struct _modreg_t *mod = 0;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with mod_name=%s, list=%p, list_size=%u, count=%p",
+			z_ptr(mod_name),list,list_size,count);
+
+	ws = modmgr_lookup(mod_name,&mod);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"module (%s) is not registered",z_ptr(mod_name));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !mod->replica.group ) {
+		dbgprint(MOD_MODMGR,__func__,"module (%s) has no replica group",mod->basic.name);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	return modgroup_status(mod->replica.group,list,list_size,count);
+}
+
+/*
+   _modmgr_lookup
+
+   Helper function of modmgr_lookup that seeks the module in the registered modules list.
+*/
+wstatus _modmgr_lookup(const char *mod_name,const struct _modreg_t **modp)
+{
+	jmlist_status jmls;
+	unsigned int mod_idx;
+	void *aux_ptr;
+	const struct _modreg_t *aux_mod;
+	jmlist_seek_handle shandle;
+	jmlist_index entry_count;
+
+	dbgprint(MOD_MODMGR,__func__,"called with mod_name=%s, modp=%p",z_ptr(mod_name),modp);
+
+	if( !mod_name || !strlen(mod_name) ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid mod_name argument (mod_name=0 or strlen(mod_name)=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !modp ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid modp argument (modp=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !mod_list ) {
+		/* TODO: use better way of testing for jmlist initialization...
+		   this is code related to jmlist actually.. */
+		dbgprint(MOD_MODMGR,__func__,"registered module list was not initialized yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	jmls = jmlist_entry_count(mod_list,&entry_count);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to get registered modules list count "
+				"(jmlist function failed with jmls=%d)",jmls);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	jmls = jmlist_seek_start(mod_list,&shandle);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to start seeking in registered modules list "
+				"(jmlist function failed with jmls=%d)",jmls);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	mod_idx = 0;
+	while( entry_count-- )
+	{
+		jmls = jmlist_seek_next(mod_list,&shandle,&aux_ptr);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to seek in registered modules list "
+					"(jmlist function failed with jmls=%d)",jmls);
+			goto return_fail_end_seek;
+		}
+
+		aux_mod = (const modreg_t)aux_ptr;
+		
+		/* compare module's names */
+
+		if( strcmp(aux_mod->basic.name,mod_name) ) {
+			dbgprint(MOD_MODMGR,__func__,"module (idx=%u) name is different, "
+					"seeking for next module in list",mod_idx);
+			goto seek_mod;
+		}
+
+		dbgprint(MOD_MODMGR,__func__,"found requested module in index %u",mod_idx);
+
+		/* finish seeking */
+
+		jmls = jmlist_seek_end(mod_list,&shandle);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to finish seeking in registered modules list "
+					"(jmlist function failed with jmls=%d)",jmls);
+			DBGRET_FAILURE(MOD_MODMGR);
+		}
+
+		*modp = aux_mod;
+		dbgprint(MOD_MODMGR,__func__,"updated modp value to %p",*modp);
+
+		DBGRET_SUCCESS(MOD_MODMGR);
+
+seek_mod:
+		mod_idx++;
+	}
+
+return_fail_end_seek:
+	jmls = jmlist_seek_end(mod_list,&shandle);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to finish seeking in registered modules list "
+				"(jmlist function failed with jmls=%d)",jmls);
+	}
+	DBGRET_FAILURE(MOD_MODMGR);
+}
+
+/*
+   _request_deliver_batch
+
+   Delivers several requests to a DCR module with a batch callback in a single
+   call. The requests are sealed and borrowed for the duration of the call like
+   in _request_send. The module may return replies (at most one per request,
+   reply_max), they're forwarded to their destinations and freed, the excess
+   ones are only freed.
+*/
+wstatus _request_deliver_batch(const request_t *req_list,unsigned int req_count,const struct _modreg_t *mod)
+{
+	request_t reply_list[MODREG_BATCH_MAX];
+	unsigned int reply_count = 0, i;
+	uint64_t deadline_ms = 0, parent_ms = deliver_deadline_ms;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with req_list=%p, req_count=%u, mod=%p",req_list,req_count,mod);
+
+	if( !req_list || !req_count || (req_count > MODREG_BATCH_MAX) || !mod ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid arguments");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( (mod->communication.type != MODREG_COMM_DCR) || !mod->communication.data.dcr.reqbatch_cb ) {
+		dbgprint(MOD_MODMGR,__func__,"module (%s) has no batch callback",mod->basic.name);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	for( i = 0 ; i < req_count ; i++ )
+	{
+		if( req_is_sealed(req_list[i]) )
+			continue;
+
+		ws = req_seal(req_list[i]);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to seal request (ws=%s)",wstatus_str(ws));
+			DBGRET_FAILURE(MOD_MODMGR);
+		}
+	}
+
+	/* the sub-requests get the earliest deadline of the batch, the remaining
+	   budget of the requests that made them */
+	for( i = 0 ; i < req_count ; i++ )
+		if( req_list[i]->deadline_ms && (!deadline_ms || (req_list[i]->deadline_ms < deadline_ms)) )
+			deadline_ms = req_list[i]->deadline_ms;
+	deliver_deadline_ms = deadline_ms;
+
+	dbgprint(MOD_MODMGR,__func__,"calling module (%s) batch callback=%p with %u requests",
+			mod->basic.name,mod->communication.data.dcr.reqbatch_cb,req_count);
+	mod->communication.data.dcr.reqbatch_cb(req_list,req_count,reply_list,req_count,&reply_count);
+
+	if( reply_count > req_count ) {
+		dbgprint(MOD_MODMGR,__func__,"module (%s) returned too many replies (%u), check the module code",
+				mod->basic.name,reply_count);
+		if( reply_count > MODREG_BATCH_MAX )
+			reply_count = MODREG_BATCH_MAX;
+		/* the excess replies aren't forwarded but they're still owned by modmgr */
+		for( i = req_count ; i < reply_count ; i++ )
+			req_free(reply_list[i]);
+		reply_count = req_count;
+	}
+
+	/* forward the replies returned by the module */
+	for( i = 0 ; i < reply_count ; i++ )
+	{
+		ws = _request_process(reply_list[i]);
+		if( ws != WSTATUS_SUCCESS )
+			dbgprint(MOD_MODMGR,__func__,"failed to forward reply idx=%u (ws=%s)",i,wstatus_str(ws));
+		req_free(reply_list[i]);
+	}
+
+	deliver_deadline_ms = parent_ms;
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _request_deliver
+
+   Calls the callback of a DCR module with the requests, they must be sealed.
+   Modules with a batch callback receive all of them in one call (see
+   _request_deliver_batch), otherwise reqproc_cb is called once per request.
+   Used by the inbox threads, and by _request_send for modules without inbox.
+   The requests of a replica stop being outstanding when the call returns.
+*/
+wstatus _request_deliver(const request_t *req_list,unsigned int req_count,const struct _modreg_t *mod)
+{
+	uint64_t start_ns, end_ns;
+	unsigned int i;
+	uint64_t parent_ms = deliver_deadline_ms;
+	wstatus ws;
+
+	if( mod->communication.data.dcr.reqbatch_cb )
+	{
+		/* the handler time of a batch is split evenly between its requests */
+		start_ns = modstats_now_ns();
+		ws = _request_deliver_batch(req_list,req_count,mod);
+		end_ns = modstats_now_ns();
+
+		for( i = 0 ; i < req_count ; i++ ) {
+			_request_stats(req_list[i],mod->basic.name,start_ns + (end_ns - start_ns) * i / req_count,
+					start_ns + (end_ns - start_ns) * (i + 1) / req_count,0,ws != WSTATUS_SUCCESS);
+			if( mod->replica.group && (req_list[i]->data.bin.type == REQUEST_TYPE_REQUEST) )
+				modgroup_done(mod->replica.group,(void*)mod);
+		}
+		return ws;
+	}
+
+	if( !mod->communication.data.dcr.reqproc_cb ) {
+		dbgprint(MOD_MODMGR,__func__,"module (%s) has no request callback",mod->basic.name);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	for( i = 0 ; i < req_count ; i++ ) {
+		dbgprint(MOD_MODMGR,__func__,"calling module (%s) callback=%p",
+				mod->basic.name,mod->communication.data.dcr.reqproc_cb);
+		start_ns = modstats_now_ns();
+		deliver_deadline_ms = req_list[i]->deadline_ms;
+		mod->communication.data.dcr.reqproc_cb(req_list[i]);
+		deliver_deadline_ms = parent_ms;
+		_request_stats(req_list[i],mod->basic.name,start_ns,modstats_now_ns(),0,false);
+		if( mod->replica.group && (req_list[i]->data.bin.type == REQUEST_TYPE_REQUEST) )
+			modgroup_done(mod->replica.group,(void*)mod);
+	}
+
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _request_inbox_deliver_cb
+
+   Deliver callback of the module inboxes (see modinbox.h), param is the
+   registry of the module. Runs in the inbox thread of the module, the
+   requests past their deadline are dropped before the module is called.
+*/
+void
+_request_inbox_deliver_cb(void *param,const request_t *req_list,unsigned int req_count)
+{
+	const struct _modreg_t *mod = (const struct _modreg_t *)param;
+	request_t live_list[MODREG_BATCH_MAX];
+	unsigned int live_count = 0, i;
+	uint64_t now_ms;
+	wstatus ws;
+
+	/* the requests that expired while queued in the inbox aren't delivered */
+	now_ms = req_deadline_now_ms();
+	for( i = 0 ; (i < req_count) && (live_count < MODREG_BATCH_MAX) ; i++ )
+		if( !_request_expire(req_list[i],mod,now_ms) )
+			live_list[live_count++] = req_list[i];
+
+	if( !live_count )
+		return;
+
+	ws = _request_deliver(live_list,live_count,mod);
+	if( ws != WSTATUS_SUCCESS )
+		dbgprint(MOD_MODMGR,__func__,"unable to deliver %u requests to module (%s) (ws=%s)",
+				live_count,mod->basic.name,wstatus_str(ws));
+}
+
+/*
+   _request_inbox_drop_cb
+
+   Drop callback of the module inboxes (see modinbox.h), param is the
+   registry of the module. The request dropped by a drop oldest inbox won't
+   be delivered, it's counted as failed and, for a replica, it isn't
+   outstanding anymore.
+*/
+void
+_request_inbox_drop_cb(void *param,const request_t req)
+{
+	const struct _modreg_t *mod = (const struct _modreg_t *)param;
+
+	_request_stats(req,mod->basic.name,modstats_now_ns(),modstats_now_ns(),0,true);
+	if( mod->replica.group && (req->data.bin.type == REQUEST_TYPE_REQUEST) )
+		modgroup_done(mod->replica.group,(void*)mod);
+}
+
+/*
+   _request_stats
+
+   Helper function that records the statistics of a request delivered (or
+   failed to be delivered) to the module dst, see modstats.h. The handler time
+   goes from start_ns to end_ns, the queue wait from the ingress of the request.
+*/
+void
+_request_stats(const request_t req,const char *dst,uint64_t start_ns,uint64_t end_ns,unsigned int bytes_out,bool error)
+{
+	modstats_sample_t sample;
+	char code[REQCODESIZE+1];
+
+	/* array2z isn't reentrant, requests are delivered by several threads */
+	memcpy(code,req->data.bin.code,REQCODESIZE);
+	code[REQCODESIZE] = '\0';
+
+	sample.ingress_ns = req->ingress_ns;
+	sample.start_ns = start_ns;
+	sample.end_ns = end_ns;
+	sample.bytes_in = req->wire_size;
+	sample.bytes_out = bytes_out;
+	sample.error = error;
+	sample.expired = false;
+
+	modstats_record(dst,code,&sample);
+}
+
+/*
+   _request_expire
+
+   Drops a request past its deadline (see req_deadline_parse), the caller
+   already gave up so it isn't answered. Returns true when the request
+   expired, it's counted in the statistics of its destination (see
+   modstats.h) and the caller must not process it. mod is the replica that
+   got the request, 0 when it wasn't routed yet. Replies never expire.
+*/
+bool
+_request_expire(const request_t req,const struct _modreg_t *mod,uint64_t now_ms)
+{
+	modstats_sample_t sample;
+	char dst[REQMODSIZE+1];
+	char code[REQCODESIZE+1];
+
+	if( (req->data.bin.type != REQUEST_TYPE_REQUEST) || !req_expired(req,now_ms) )
+		return false;
+
+	/* array2z isn't reentrant, requests are delivered by several threads */
+	memcpy(dst,req->data.bin.dst,REQMODSIZE);
+	dst[REQMODSIZE] = '\0';
+	memcpy(code,req->data.bin.code,REQCODESIZE);
+	code[REQCODESIZE] = '\0';
+
+	dbgprint(MOD_MODMGR,__func__,"request %d to module (%s) expired %llu ms ago, dropping it",
+			req->data.bin.id,dst,(unsigned long long)(now_ms - req->deadline_ms));
+
+	memset(&sample,0,sizeof(sample));
+	sample.ingress_ns = req->ingress_ns;
+	sample.start_ns = modstats_now_ns();
+	sample.end_ns = sample.start_ns;
+	sample.bytes_in = req->wire_size;
+	sample.expired = true;
+	modstats_record(dst,code,&sample);
+
+	/* the replica won't answer it, it isn't outstanding anymore */
+	if( mod && mod->replica.group )
+		modgroup_done(mod->replica.group,(void*)mod);
+
+	return true;
+}
+
+/*
+   _request_send_inbox
+
+   Puts a sealed request in the inbox of a DCR module, the inbox keeps its own
+   reference. When the inbox is full and its overflow policy is busy (or block
+   and it stayed full for block_ms), requests are answered with a busy error
+   reply (replies are just dropped).
+*/
+wstatus
+_request_send_inbox(const request_t req,const struct _modreg_t *mod)
+{
+	modinbox_result_list result;
+	req_header_t header;
+	char error_desc[128];
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p, mod=%p",req,mod);
+
+	ws = req_ref(req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to reference request (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	ws = modinbox_put(mod->inbox.queue,req,&result);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to put request in inbox of module (%s) (ws=%s)",
+				mod->basic.name,wstatus_str(ws));
+		req_free(req);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( result != MODINBOX_FULL ) {
+		dbgprint(MOD_MODMGR,__func__,"request put in inbox of module (%s)",mod->basic.name);
+		DBGRET_SUCCESS(MOD_MODMGR);
+	}
+
+	/* the request wasn't queued, drop the reference taken for the inbox */
+	_request_stats(req,mod->basic.name,modstats_now_ns(),modstats_now_ns(),0,true);
+	_request_header(req,&header);
+	req_free(req);
+
+	/* a replica with a full inbox is shed like a failed one (see modgroup.h) */
+	if( mod->replica.group && (header.type == REQUEST_TYPE_REQUEST) )
+		modgroup_failed(mod->replica.group,(void*)mod,header.id,header.src);
+
+	if( header.type != REQUEST_TYPE_REQUEST ) {
+		dbgprint(MOD_MODMGR,__func__,"inbox of module (%s) is full, dropping reply",mod->basic.name);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	snprintf(error_desc,sizeof(error_desc),REQERROR_INBOXFULL,mod->basic.name);
+	ws = _request_reply_code(&header,reqid_code_str(REQCODE_BUSY),error_desc);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to send busy reply (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	/* the request was answered, for the caller it was handled */
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _request_send
+
+   Delivers a request to a module. The request is sealed if it wasn't already,
+   so the destination gets a read-only request that can be shared without locks
+   or copies:
+    - DCR modules receive it in the callback, called by the inbox thread of the
+      module (see _request_send_inbox). The request is only borrowed for the
+      duration of the call. A module that wants to keep it must call req_ref and
+      later req_unref.
+    - SSR modules receive the text serialization through the modmgr sender channel,
+      the text is built once and cached in the sealed request so sending the same
+      request to several SSR modules doesn't convert it again.
+    - SHM modules receive a binary frame in their ring (see _request_send_shm).
+    - Multicast groups receive the text like SSR modules, in one datagram to
+      the group address. The collection of the replies of the members is
+      opened before the send (see modcast_sent), they may answer before
+      wchannel_send returns.
+   The caller keeps its reference, freeing it with req_free as usual.
+*/
+wstatus _request_send(const request_t req,const struct _modreg_t *mod)
+{
+	const char *text_ptr;
+	unsigned int text_size;
+	char dest[MODHOSTSIZE+MODPORTSIZE+1];
+	char src[REQMODSIZE+1];
+	uint64_t start_ns;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p, mod=%p",req,mod);
+
+	if( !req ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid req argument (req=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !mod ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid mod argument (mod=0)");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !req_is_sealed(req) )
+	{
+		ws = req_seal(req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to seal request (ws=%s)",wstatus_str(ws));
+			DBGRET_FAILURE(MOD_MODMGR);
+		}
+		dbgprint(MOD_MODMGR,__func__,"sealed request (req=%p) successfully",req);
+	}
+
+	switch(mod->communication.type)
+	{
+		case MODREG_COMM_DCR:
+			if( mod->inbox.queue ) {
+				ws = _request_send_inbox(req,mod);
+				if( ws != WSTATUS_SUCCESS ) {
+					DBGRET_FAILURE(MOD_MODMGR);
+				}
+				break;
+			}
+			ws = _request_deliver(&req,1,mod);
+			if( ws != WSTATUS_SUCCESS ) {
+				DBGRET_FAILURE(MOD_MODMGR);
+			}
+			break;
+
+		case MODREG_COMM_SSR:
+		case MODREG_COMM_MCAST:
+			if( !send_wch ) {
+				dbgprint(MOD_MODMGR,__func__,"sender wchannel is not available");
+				DBGRET_FAILURE(MOD_MODMGR);
+			}
+
+			ws = req_sealed_text(req,&text_ptr,&text_size);
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_MODMGR,__func__,"failed to get text of sealed request (ws=%s)",wstatus_str(ws));
+				DBGRET_FAILURE(MOD_MODMGR);
+			}
+
+			if( mod->communication.type == MODREG_COMM_MCAST ) {
+				snprintf(dest,sizeof(dest),"%s %s",mod->communication.data.mcast.host,mod->communication.data.mcast.port);
+				if( req->data.bin.type == REQUEST_TYPE_REQUEST ) {
+					memcpy(src,req->data.bin.src,REQMODSIZE);
+					src[REQMODSIZE] = '\0';
+					modcast_sent(mod->communication.data.mcast.cast,req->data.bin.id,src);
+				}
+			} else
+				snprintf(dest,sizeof(dest),"%s %s",mod->communication.data.ssr.host,mod->communication.data.ssr.port);
+
+			/* include the null char, it delimits the text request in the receiver reqbuf */
+			start_ns = modstats_now_ns();
+			ws = _request_send_wch(req,dest,text_ptr,text_size+1);
+			_request_stats(req,mod->basic.name,start_ns,modstats_now_ns(),text_size+1,ws != WSTATUS_SUCCESS);
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_MODMGR,__func__,"failed to send request to module (%s) at \"%s\" (ws=%s)",
+						mod->basic.name,dest,wstatus_str(ws));
+				DBGRET_FAILURE(MOD_MODMGR);
+			}
+			dbgprint(MOD_MODMGR,__func__,"sent %u bytes to module (%s) at \"%s\"",text_size+1,mod->basic.name,dest);
+			break;
+
+		case MODREG_COMM_SHM:
+			ws = _request_send_shm(req,mod);
+			if( ws != WSTATUS_SUCCESS ) {
+				DBGRET_FAILURE(MOD_MODMGR);
+			}
+			break;
+
+		default:
+			dbgprint(MOD_MODMGR,__func__,"module (%s) has invalid communication type (%d)",
+					mod->basic.name,mod->communication.type);
+			DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _request_send_wch
+
+   Sends the text of a sealed request through the sender wchannel. A
+   reliable channel returns WSTATUS_AGAIN when the window of the module is
+   full, the request is then kept in the deferred queue of its destination
+   (up to MODMGR_DEFERRED_MAX) and sent by the deferred thread when the
+   window opens. The requests that follow to the same destination are
+   queued behind it so they keep their order, the other destinations are
+   sent right away: a slow or dead module doesn't hold the others. The
+   deferred lock is only held to look at the queues, never while sending.
+*/
+wstatus
+_request_send_wch(const request_t req,char *dest,const char *text_ptr,unsigned int text_size)
+{
+	deferred_dest_t *dd, **link;
+	deferred_req_t *entry;
+	unsigned int used;
+	wstatus ws;
+
+	if( !deferred_started )
+		return wchannel_send(send_wch,dest,(void*)text_ptr,text_size,&used);
+
+	wlock_acquire(&deferred_lock);
+	for( dd = deferred_list ; dd ; dd = dd->next )
+		if( !strcmp(dd->dest,dest) )
+			break;
+	wlock_release(&deferred_lock);
+
+	/* the queue of the destination may be gone once the lock is released,
+	   only whether it existed is used */
+	if( !dd ) {
+		ws = wchannel_send(send_wch,dest,(void*)text_ptr,text_size,&used);
+		if( ws != WSTATUS_AGAIN )
+			return ws;
+	}
+
+	/* allocated before, malloc isn't called with the lock */
+	entry = (deferred_req_t*)malloc(sizeof(deferred_req_t));
+	dd = (deferred_dest_t*)malloc(sizeof(deferred_dest_t));
+	if( !entry || !dd || (req_ref(req) != WSTATUS_SUCCESS) ) {
+		free(entry);
+		free(dd);
+		dbgprint(MOD_MODMGR,__func__,"unable to defer request to \"%s\"",dest);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+	entry->req = req;
+	entry->next = 0;
+	memset(dd,0,sizeof(deferred_dest_t));
+	strncpy(dd->dest,dest,sizeof(dd->dest)-1);
+
+	wlock_acquire(&deferred_lock);
+
+	/* new destinations go at the end, the deferred thread keeps its place */
+	for( link = &deferred_list ; *link ; link = &(*link)->next )
+		if( !strcmp((*link)->dest,dest) )
+			break;
+
+	if( *link ) {
+		free(dd);
+		dd = *link;
+	} else
+		*link = dd;
+
+	if( dd->count >= MODMGR_DEFERRED_MAX ) {
+		wlock_release(&deferred_lock);
+		dbgprint(MOD_MODMGR,__func__,"%u requests to \"%s\" already wait for its window, dropping request",
+				MODMGR_DEFERRED_MAX,dest);
+		req_free(req);
+		free(entry);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( dd->tail )
+		dd->tail->next = entry;
+	else
+		dd->head = entry;
+	dd->tail = entry;
+	dd->count++;
+
+	dbgprint(MOD_MODMGR,__func__,"window of \"%s\" is full, request deferred (%u waiting)",dest,dd->count);
+	wcond_signal(&deferred_cond);
+	wlock_release(&deferred_lock);
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   _request_deferred_thread
+
+   Thread callback that sends the deferred requests (see _request_send_wch).
+   Each destination is sent in order until its window is full again, then
+   the thread waits for a window of the sender wchannel to open (or
+   MODMGR_DEFERRED_WAIT_US, a window may open while it's sending). A request
+   that fails for another reason is dropped, a destination is removed when
+   its queue is empty. Finishes when _request_deferred_stop is called.
+
+   The lock is released while each request is sent. Only this thread takes
+   requests out of the queues and removes destinations, the senders only
+   append, so the head of a queue and the destination stay valid meanwhile
+   and the requests sent after it to the same destination wait behind it.
+*/
+void _request_deferred_thread(void *param)
+{
+	deferred_dest_t *dd, **link;
+	deferred_req_t *entry;
+	const char *text_ptr;
+	unsigned int text_size, used;
+	unsigned long gen = 0;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with param=%p",param);
+
+	wlock_acquire(&deferred_lock);
+
+	while( !deferred_stopping )
+	{
+		if( !deferred_list ) {
+			wcond_wait(&deferred_cond,&deferred_lock);
+			continue;
+		}
+
+		/* windows opened from now on are seen by the wait below */
+		wchannel_reliable_wait(send_wch,&gen,0);
+
+		for( link = &deferred_list ; (dd = *link) ; )
+		{
+			while( (entry = dd->head) )
+			{
+				wlock_release(&deferred_lock);
+				req_sealed_text(entry->req,&text_ptr,&text_size);
+				ws = wchannel_send(send_wch,dd->dest,(void*)text_ptr,text_size+1,&used);
+				wlock_acquire(&deferred_lock);
+
+				if( ws == WSTATUS_AGAIN )
+					break;
+				if( ws != WSTATUS_SUCCESS )
+					dbgprint(MOD_MODMGR,__func__,"failed to send deferred request to \"%s\" (ws=%s)",dd->dest,wstatus_str(ws));
+
+				dd->head = entry->next;
+				if( !dd->head )
+					dd->tail = 0;
+				dd->count--;
+				req_free(entry->req);
+				free(entry);
+			}
+
+			if( !dd->head ) {
+				*link = dd->next;
+				free(dd);
+			} else
+				link = &dd->next;
+		}
+
+		if( deferred_list ) {
+			wlock_release(&deferred_lock);
+			wchannel_reliable_wait(send_wch,&gen,MODMGR_DEFERRED_WAIT_US);
+			wlock_acquire(&deferred_lock);
+		}
+	}
+
+	wlock_release(&deferred_lock);
+	dbgprint(MOD_MODMGR,__func__,"returning.");
+}
+
+/*
+   _request_deferred_start
+
+   Starts the deferred thread of a reliable sender wchannel.
+*/
+wstatus
+_request_deferred_start(void)
+{
+	wstatus ws;
+
+	ws = wlock_create(&deferred_lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create deferred lock (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	ws = wcond_create(&deferred_cond);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create deferred condition (ws=%s)",wstatus_str(ws));
+		wlock_free(&deferred_lock);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	deferred_stopping = false;
+	ws = wthread_create(_request_deferred_thread,0,&deferred_wthread);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to create deferred wthread (ws=%s)",wstatus_str(ws));
+		wcond_free(&deferred_cond);
+		wlock_free(&deferred_lock);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	deferred_started = true;
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _request_deferred_stop
+
+   Stops the deferred thread, the requests still waiting for a window are
+   dropped. Called when no other thread sends anymore, before the sender
+   wchannel is destroyed.
+*/
+void
+_request_deferred_stop(void)
+{
+	deferred_dest_t *dd;
+	deferred_req_t *entry;
+	unsigned int dropped = 0;
+
+	if( !deferred_started )
+		return;
+
+	wlock_acquire(&deferred_lock);
+	deferred_stopping = true;
+	wcond_signal(&deferred_cond);
+	wlock_release(&deferred_lock);
+
+	wthread_wait(deferred_wthread);
+	deferred_started = false;
+
+	while( (dd = deferred_list) ) {
+		deferred_list = dd->next;
+		while( (entry = dd->head) ) {
+			dd->head = entry->next;
+			req_free(entry->req);
+			free(entry);
+			dropped++;
+		}
+		free(dd);
+	}
+
+	if( dropped )
+		dbgprint(MOD_MODMGR,__func__,"dropped %u deferred requests",dropped);
+
+	wcond_free(&deferred_cond);
+	wlock_free(&deferred_lock);
+}
+
+/*
+   _request_send_shm
+
+   Writes a request as a binary frame (see req_to_frame) in the ring of a SHM
+   module, the frame is built in place. The rings have a single producer and
+   requests are sent by the dispatch and the inbox threads, so the send is
+   serialized by the lock of the module. modmgr never waits for space: when
+   the ring is full requests are answered with a busy error reply, like the
+   ones of a full inbox (replies are just dropped).
+*/
+wstatus
+_request_send_shm(const request_t req,const struct _modreg_t *mod)
+{
+	shmring_t ring = mod->communication.data.shm.ring;
+	req_header_t header;
+	char error_desc[128];
+	unsigned int frame_size,frame_used;
+	void *frame_ptr;
+	uint64_t start_ns;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p, mod=%p",req,mod);
+
+	ws = req_frame_size(req,&frame_size);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to get frame size of request (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	start_ns = modstats_now_ns();
+	wlock_acquire((wlock_t*)&mod->communication.data.shm.send_lock);
+
+	ws = shmring_reserve(ring,frame_size,false,&frame_ptr);
+	if( ws == WSTATUS_SUCCESS ) {
+		ws = req_to_frame(req,frame_ptr,frame_size,&frame_used);
+		shmring_commit(ring,ws == WSTATUS_SUCCESS ? frame_used : 0);
+	}
+
+	wlock_release((wlock_t*)&mod->communication.data.shm.send_lock);
+	_request_stats(req,mod->basic.name,start_ns,modstats_now_ns(),frame_size,ws != WSTATUS_SUCCESS);
+
+	if( ws == WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"sent frame of %u bytes to module (%s)",frame_size,mod->basic.name);
+		DBGRET_SUCCESS(MOD_MODMGR);
+	}
+
+	_request_header(req,&header);
+
+	/* a replica with a full ring is shed like a failed one (see modgroup.h) */
+	if( mod->replica.group && (header.type == REQUEST_TYPE_REQUEST) )
+		modgroup_failed(mod->replica.group,(void*)mod,header.id,header.src);
+
+	if( header.type != REQUEST_TYPE_REQUEST ) {
+		dbgprint(MOD_MODMGR,__func__,"ring of module (%s) is full, dropping reply",mod->basic.name);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	snprintf(error_desc,sizeof(error_desc),REQERROR_RINGFULL,mod->basic.name);
+	ws = _request_reply_code(&header,reqid_code_str(REQCODE_BUSY),error_desc);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to send busy reply (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	/* the request was answered, for the caller it was handled */
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _request_send_group
+
+   Forwards a request to a module. When the module is a replica group (see
+   modgroup.h) the request goes to the replica chosen by the policy of the
+   group, when the send fails the replica is counted as failed and the next
+   one is tried. When no replica is available the source gets an error reply.
+   Replies and modules without group are sent by _request_send.
+*/
+wstatus _request_send_group(const request_t req,const struct _modreg_t *mod)
+{
+	const struct _modreg_t *replica;
+	const char *hash_name;
+	char key[MODGROUP_KEYSIZE];
+	char src[REQMODSIZE+1];
+	char error_desc[128];
+	unsigned int attempts;
+	nvpair_t nvp = 0;
+	void *member;
+	wstatus ws;
+
+	if( !mod->replica.group || (req->data.bin.type != REQUEST_TYPE_REQUEST) )
+		return _request_send(req,mod);
+
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p, mod=%p",req,mod);
+
+	memcpy(src,req->data.bin.src,REQMODSIZE);
+	src[REQMODSIZE] = '\0';
+
+	/* value of the hashed nvpair, requests without it use least outstanding */
+	key[0] = '\0';
+	hash_name = modgroup_hash_name(mod->replica.group);
+	if( hash_name && (req_get_nv(req,hash_name,strlen(hash_name),&nvp) == WSTATUS_SUCCESS) )
+	{
+		if( nvp->value_size < sizeof(key) ) {
+			memcpy(key,nvp->value_ptr,nvp->value_size);
+			key[nvp->value_size] = '\0';
+		}
+		_nvp_free(nvp);
+	}
+
+	for( attempts = modgroup_count(mod->replica.group) ; attempts ; attempts-- )
+	{
+		ws = modgroup_pick(mod->replica.group,strlen(key) ? key : 0,&member);
+		if( ws != WSTATUS_SUCCESS )
+			break;
+		replica = (const struct _modreg_t *)member;
+
+		/* the members of a multicast group reply with their own names, modcast waits for them */
+		modgroup_sent(mod->replica.group,member,req->data.bin.id,src,
+				(replica->communication.type != MODREG_COMM_DCR) && (replica->communication.type != MODREG_COMM_MCAST));
+
+		ws = _request_send(req,replica);
+		if( ws == WSTATUS_SUCCESS ) {
+			if( replica->communication.type == MODREG_COMM_MCAST )
+				modgroup_done(mod->replica.group,member);
+			dbgprint(MOD_MODMGR,__func__,"request sent to replica %p of module (%s)",replica,mod->basic.name);
+			DBGRET_SUCCESS(MOD_MODMGR);
+		}
+
+		dbgprint(MOD_MODMGR,__func__,"failed to send request to replica %p of module (%s), trying another",
+				replica,mod->basic.name);
+		modgroup_failed(mod->replica.group,member,req->data.bin.id,src);
+	}
+
+	dbgprint(MOD_MODMGR,__func__,"no replica of module (%s) is available",mod->basic.name);
+	snprintf(error_desc,sizeof(error_desc),REQERROR_NOREPLICA,mod->basic.name);
+	ws = _request_reply_error(req,error_desc);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to send error reply (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	/* the request was answered, for the caller it was handled */
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _request_send_peer
+
+   Forwards a request to the peer node that announced its destination (see
+   modpeer.h). Only the requests of local modules are forwarded, a request
+   that came from a peer is never sent to another one, so a stale route
+   can't make it loop between nodes. Fails when the request can't be
+   forwarded, _request_route answers it like a missing module.
+*/
+wstatus _request_send_peer(const request_t req,const char *dst)
+{
+	const struct _modreg_t *mod_src = 0;
+	const char *text_ptr;
+	unsigned int text_size;
+	unsigned int peer;
+	char src[REQMODSIZE+1];
+	uint64_t start_ns;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p, dst=%s",req,z_ptr(dst));
+
+	memcpy(src,req->data.bin.src,REQMODSIZE);
+	src[REQMODSIZE] = '\0';
+
+	if( modmgr_lookup(src,&mod_src) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"source (%s) isn't a local module, not forwarding to peers",src);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( modpeer_route(peers,dst,&peer) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"no peer announced module (%s)",dst);
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( !req_is_sealed(req) )
+	{
+		ws = req_seal(req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to seal request (ws=%s)",wstatus_str(ws));
+			DBGRET_FAILURE(MOD_MODMGR);
+		}
+	}
+
+	ws = req_sealed_text(req,&text_ptr,&text_size);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to get text of sealed request (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
 
-	if( !author_email_ptr ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid author_email_ptr argument (author_email_ptr=0)");
+	start_ns = modstats_now_ns();
+	ws = modpeer_send(peers,peer,text_ptr,text_size);
+	_request_stats(req,dst,start_ns,modstats_now_ns(),text_size+1,ws != WSTATUS_SUCCESS);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to forward request to peer %u (ws=%s)",peer,wstatus_str(ws));
 		DBGRET_FAILURE(MOD_MODMGR);
 	}
 
-	if( !author_email_size ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid author_email_size argument (author_email_size=0)");
+	dbgprint(MOD_MODMGR,__func__,"forwarded request to peer %u",peer);
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
+
+/*
+   _request_send_multi
+
+   Delivers the same request to several modules (notifications, error replies to
+   several waiters...). The request is sealed once and shared by all destinations,
+   nothing is duplicated. Returns WSTATUS_SEMIFAIL if some of the destinations
+   failed and WSTATUS_FAILURE if all of them failed.
+*/
+wstatus _request_send_multi(const request_t req,const struct _modreg_t **mod_list_ptr,unsigned int mod_count)
+{
+	unsigned int i,fail_count = 0;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with req=%p, mod_list_ptr=%p, mod_count=%u",req,mod_list_ptr,mod_count);
+
+	if( !req ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid req argument (req=0)");
 		DBGRET_FAILURE(MOD_MODMGR);
 	}
 
-	if( !result ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid result argument (result=0)");
+	if( !mod_list_ptr || !mod_count ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid mod_list_ptr argument (mod_list_ptr=0 or mod_count=0)");
 		DBGRET_FAILURE(MOD_MODMGR);
 	}
 
-	for( i = 0 ; i < author_email_size ; i++ )
-   	{
-		if( MRV_AUTHORECHAR(author_email_ptr[i]) )
-			continue;
+	if( !req_is_sealed(req) )
+	{
+		ws = req_seal(req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to seal request (ws=%s)",wstatus_str(ws));
+			DBGRET_FAILURE(MOD_MODMGR);
+		}
+	}
 
-		dbgprint(MOD_MODMGR,__func__,"invalid/unsupported character found in module author email (author_email[%u]=%02X)",i,author_email_ptr[i]);
-		*result = MODREG_PARAM_INVALID_CHARACTER_FOUND;
-		dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
-		DBGRET_SUCCESS(MOD_MODMGR);
+	for( i = 0 ; i < mod_count ; i++ )
+	{
+		ws = _request_send(req,mod_list_ptr[i]);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to send request to destination idx=%u (ws=%s)",i,wstatus_str(ws));
+			fail_count++;
+		}
 	}
 
-	dbgprint(MOD_MODMGR,__func__,"finished parsing all author email characters");
+	if( fail_count == mod_count ) {
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	if( fail_count ) {
+		dbgprint(MOD_MODMGR,__func__,"%u of %u destinations failed",fail_count,mod_count);
+		dbgprint(MOD_MODMGR,__func__,"Returning with semi-failure.");
+		return WSTATUS_SEMIFAIL;
+	}
 
-	/* all characters are valid */
-	
-	*result = MODREG_PARAM_CHARACTERS_ARE_VALID;
-	dbgprint(MOD_MODMGR,__func__,"updated result value to %s",modreg_val_str(*result));
 	DBGRET_SUCCESS(MOD_MODMGR);
 }
 
 /*
-   _modreg_alloc
+   modmgr_dispatch_status
 
-   Helper function to allocate a new module registry data structure.
+   Returns the queue depth, counters and wait times of a dispatch class.
 */
-wstatus _modreg_alloc(modreg_t *mod)
+wstatus modmgr_dispatch_status(modsched_class_list sched_class,modsched_status_t *status)
 {
-	modreg_t new_mod;
-	dbgprint(MOD_MODMGR,__func__,"called with mod=%p",mod);
+	if( !dispatch_sched ) {
+		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
 
-	if(!mod) {
-		dbgprint(MOD_MODMGR,__func__,"invalid mod argument (mod=0)");
+	return modsched_status(dispatch_sched,sched_class,status);
+}
+
+/*
+   _modmgr_event_deliver_cb
+
+   Deliver callback of the event bus, runs in the bus thread. The event goes to
+   the subscriber like any other request (_request_send), DCR subscribers get it
+   in their inbox and SSR ones through the sender wchannel, so the bus thread
+   doesn't wait for the subscribers either.
+*/
+void
+_modmgr_event_deliver_cb(void *param,const char *subscriber,request_t event)
+{
+	const struct _modreg_t *mod = 0;
+	wstatus ws;
+
+	ws = modmgr_lookup(subscriber,&mod);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"subscriber (%s) isn't registered, dropping event",subscriber);
+		return;
+	}
+
+	ws = _request_send(event,mod);
+	if( ws != WSTATUS_SUCCESS )
+		dbgprint(MOD_MODMGR,__func__,"failed to deliver event to subscriber (%s) (ws=%s)",subscriber,wstatus_str(ws));
+}
+
+/*
+   modmgr_event_alloc
+
+   Allocates a new event request (binary, code event) from src with the topic
+   and key nvpairs, key may be 0. The caller adds the payload nvpairs (the new
+   values, req_add_nvp_z), publishes it with modmgr_publish and frees it.
+*/
+wstatus modmgr_event_alloc(const char *src,const char *topic,const char *key,request_t *event)
+{
+	request_t new_event = 0;
+	wstatus ws;
+
+	dbgprint(MOD_MODMGR,__func__,"called with src=\"%s\", topic=\"%s\", key=\"%s\", event=%p",
+			z_ptr(src),z_ptr(topic),z_ptr(key),event);
+
+	if( !src || !topic || !event ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid arguments");
 		DBGRET_FAILURE(MOD_MODMGR);
 	}
 
-	new_mod = (modreg_t)malloc(sizeof(struct _modreg_t));
-	if( !new_mod ) {
+	new_event = (request_t)malloc(sizeof(struct _request_t));
+	if( !new_event ) {
 		dbgprint(MOD_MODMGR,__func__,"malloc failed");
 		DBGRET_FAILURE(MOD_MODMGR);
 	}
+	memset(new_event,0,sizeof(struct _request_t));
 
-	dbgprint(MOD_MODMGR,__func__,"allocated memory for modreg_t data structure successfully (ptr=%p)",new_mod);
-
-	dbgprint(MOD_MODMGR,__func__,"filling modreg_t data structure");
-	memset(new_mod->basic.name,'\0',sizeof(new_mod->basic.name));
-	memset(new_mod->basic.description,'\0',sizeof(new_mod->basic.description));
-	memset(new_mod->basic.version,'\0',sizeof(new_mod->basic.version));
-	memset(new_mod->basic.author_name,'\0',sizeof(new_mod->basic.author_name));
-	memset(new_mod->basic.author_email,'\0',sizeof(new_mod->basic.author_email));
+	new_event->stype = REQUEST_STYPE_BIN;
+	new_event->data.bin.type = REQUEST_TYPE_REQUEST;
+	new_event->data.bin.id = 0;
+	strncpy(new_event->data.bin.src,src,sizeof(new_event->data.bin.src)-1);
+	strcpy(new_event->data.bin.dst,"modmgr");
+	strcpy(new_event->data.bin.code,reqid_code_str(REQCODE_EVENT));
+	new_event->data.bin.code_id = REQCODE_EVENT;
 
-	new_mod->communication.type = MODREG_COMM_UNDEF;
-	new_mod->communication.data.dcr.reqproc_cb = 0;
-	memset(new_mod->communication.data.ssr.host,'\0',sizeof(new_mod->communication.data.ssr.host));
-	memset(new_mod->communication.data.ssr.port,'\0',sizeof(new_mod->communication.data.ssr.port));
-	dbgprint(MOD_MODMGR,__func__,"finished filling of new modreg_t data structure");
+	ws = req_add_nvp_z(reqid_name_str(REQNAME_TOPIC),topic,new_event);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODMGR,__func__,"failed to add topic nvpair (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
 
-	*mod = new_mod;
-	dbgprint(MOD_MODMGR,__func__,"updated mod value to %p",*mod);
+	if( key )
+	{
+		ws = req_add_nvp_z(reqid_name_str(REQNAME_KEY),key,new_event);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODMGR,__func__,"failed to add key nvpair (ws=%s)",wstatus_str(ws));
+			goto return_fail;
+		}
+	}
 
+	*event = new_event;
 	DBGRET_SUCCESS(MOD_MODMGR);
+
+return_fail:
+	req_free(new_event);
+	DBGRET_FAILURE(MOD_MODMGR);
 }
 
 /*
-   _modreg_free
+   modmgr_publish
 
-   Helper function to free a single module registry data structure from memory.
-   The data structure must have been allocated using _modreg_alloc function.
+   Publishes an event request (see modmgr_event_alloc) to the subscribers of
+   its topic, returns as soon as it's queued for them (see modbus.h). The
+   event is sealed and shared by the subscribers, it keeps the header of the
+   publisher. The caller keeps its reference.
 */
-wstatus _modreg_free(const struct _modreg_t *mod)
+wstatus modmgr_publish(const request_t event)
 {
-	dbgprint(MOD_MODMGR,__func__,"called with mod=%p");
+	char topic[MODBUS_TOPICSIZE];
+	char key[MODBUS_KEYSIZE];
+	bool has_key;
 
-	if(!mod) {
-		dbgprint(MOD_MODMGR,__func__,"invalid mod argument (mod=0)");
+	if( !event_bus ) {
+		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
 		DBGRET_FAILURE(MOD_MODMGR);
 	}
 
-	free((void*)mod);
+	if( !event || (event->stype != REQUEST_STYPE_BIN) ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid event argument");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
 
-	dbgprint(MOD_MODMGR,__func__,"freed module registry data structure successfully (ptr=%p)",mod);
+	if( !_modmgr_event_nv(event,REQNAME_TOPIC,topic,sizeof(topic)) ) {
+		dbgprint(MOD_MODMGR,__func__,"event without topic nvpair");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+	has_key = _modmgr_event_nv(event,REQNAME_KEY,key,sizeof(key));
 
-	DBGRET_SUCCESS(MOD_MODMGR);
+	return modbus_publish(event_bus,topic,has_key ? key : 0,event);
 }
 
 /*
-   _modmgr_reqproc_cb
+   modmgr_subscribe
 
-   This is the callback that receives the requests which have as destiny module the 'modmgr'.
-   Its one of the rare functions where modmgr doesn't give a damn if goes wrong so it doesn't
-   provide any means for passing an error status code.
-   
-   The module manager accepts several request codes:
+   Subscribes a registered module to a topic or topic prefix (see modbus.h).
+*/
+wstatus modmgr_subscribe(const char *mod_name,const char *pattern,unsigned int queue_size)
+{
+	const struct _modreg_t *mod = 0;
 
-   moduleRegister	registers a new module into modmgr, this will make it possible to receive
-					and send requests to the new module. This should be the first message to be sent from
-					any module that wants to be part of running wicom. There are some nvpairs required
-					for this request code:
-						name = module name
-						description = module description
-						version = module version
-						authorName = author name
-						authorEmail = author email
-						dependencies = other module list ex: "cfgmgr,datastor"
-   
-   moduleUnregister unregisters the previously registered calling module (the module to unregister
-					is identified by the source of the message.
+	if( !event_bus ) {
+		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
 
-   moduleLookup		Checks if a module exists in the list of registered modules. Reply is error
-					or success depending on the lookup result.
+	if( !mod_name || (modmgr_lookup(mod_name,&mod) != WSTATUS_SUCCESS) ) {
+		dbgprint(MOD_MODMGR,__func__,"module (%s) isn't registered",z_ptr(mod_name));
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	return modbus_subscribe(event_bus,mod_name,pattern,queue_size);
+}
+
+/*
+   modmgr_unsubscribe
+
+   Removes a subscription of a module, with pattern 0 all of them.
 */
-void _modmgr_reqproc_cb(const request_t req)
+wstatus modmgr_unsubscribe(const char *mod_name,const char *pattern)
 {
-	/* for now it will just dump the request.. */
-	req_dump(req);
+	if( !event_bus ) {
+		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
+
+	return modbus_unsubscribe(event_bus,mod_name,pattern);
 }
 
 /*
-   modmgr_load
-
-   Initializes modmgr module. This function must be called before the client
-   code can use the modmgr. It should do the following things:
-   - create jmlist for registered modules
-   - insert the 'modmgr' module into the registered modules
-   - create the bind wchannel and the pipe wchannel used in modmgr threads.
-   - create the required threads for modmgr, this includes _request_processor and
-     _remote_request_receiver threads.
-   - wait for threads initialization.
+   modmgr_event_status
 
-TODO: code related to _remote_request_receiver thread.
+   Returns the event queue counters of a subscriber.
 */
-wstatus
-modmgr_load(modmgr_load_t load)
+wstatus modmgr_event_status(const char *mod_name,modbus_status_t *status)
 {
-	struct _jmlist_params params = { .flags = JMLIST_LINKED };
-	jmlist_status jmls;
-	wstatus ws;
-	wchannel_opt_t fast_wch_opt; 
-	wchannel_t fast_wch = 0;
-	modreg_t modmgr_reg = 0;
-	
-	dbgprint(MOD_MODMGR,__func__,"called with load.bind_hostname=\"%s\", load.bind_port=%s",
-			z_ptr(load.bind_hostname),z_ptr(load.bind_port));
+	if( !event_bus ) {
+		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
 
-	/* create jmlist for registered modules */
+	return modbus_status(event_bus,mod_name,status);
+}
 
-	jmls = jmlist_create(&mod_list,&params);
-	if( jmls != JMLIST_ERROR_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to create jmlist (jmls=%d)",jmls);
-		goto return_fail;
-	}
-	dbgprint(MOD_MODMGR,__func__,"created new jmlist for registered modules successfully (jml=%p)",mod_list);
+/*
+   modmgr_stats
 
-	/* allocate new modmgr_reg */
+   Returns the request statistics per destination module and code, the same
+   as the stats request (see _modmgr_stats and modstats.h).
+*/
+wstatus modmgr_stats(modstats_status_t *list,unsigned int list_size,unsigned int *count)
+{
+	dbgprint(MOD_MODMGR,__func__,"called with list=%p, list_size=%u, count=%p",list,list_size,count);
 
-	ws = _modreg_alloc(&modmgr_reg);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to allocate new module registry data structure (ws=%s)",wstatus_str(ws));
-		modmgr_reg = 0; /* _modreg_alloc shouldn't have touched it, anyways.. */
-		goto return_fail;
+	if( !loaded ) {
+		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
 	}
-	dbgprint(MOD_MODMGR,__func__,"allocated new module registry data structure successfully (ptr=%p)",modmgr_reg);
 
-	/* fill the data structure information */
-	
-	strcpy(modmgr_reg->basic.name,"modmgr");
-	strcpy(modmgr_reg->basic.description,"The module manager from wicom itself.");
-	strcpy(modmgr_reg->basic.version,"0.1");
-	strcpy(modmgr_reg->basic.author_name,"Jean-François Mousinho");
-	strcpy(modmgr_reg->basic.author_email,"jean.mousinho@ist.utl.pt");
-	
-	modmgr_reg->communication.type = MODREG_COMM_DCR;
-	modmgr_reg->communication.data.dcr.reqproc_cb = _modmgr_reqproc_cb;
+	return modstats_snapshot(list,list_size,count);
+}
 
-	dbgprint(MOD_MODMGR,__func__,"all new module registry data structure was filled OK (ptr=%p)",modmgr_reg);
+/*
+   modmgr_peer_add
 
-	/* insert this module data structure into the jmlist */
-	
-	jmls = jmlist_insert(mod_list,modmgr_reg);
-	if( jmls != JMLIST_ERROR_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to insert new module into module registry list (jmls=%d)",jmls);
-		goto return_fail;
+   Adds a peer node (see modpeer.h), host and port are the address of its
+   remote receivers. Peering must be enabled by load.peering.node.
+*/
+wstatus modmgr_peer_add(const char *node,const char *host,const char *port)
+{
+	if( !peers ) {
+		dbgprint(MOD_MODMGR,__func__,"peering is disabled");
+		DBGRET_FAILURE(MOD_MODMGR);
 	}
-	dbgprint(MOD_MODMGR,__func__,"new module was inserted into module registry list successfully (ptr=%p)",modmgr_reg);
 
-	/* create new wchannel for communication with request_processor thread */
+	return modpeer_add(peers,node,host,port);
+}
 
-	fast_wch_opt.type = WCHANNEL_TYPE_PIPE;
-	fast_wch_opt.host_src = NULL;
-	fast_wch_opt.port_src = NULL;
-	fast_wch_opt.host_dst = NULL;
-	fast_wch_opt.port_dst = NULL;
-	fast_wch_opt.debug_opts = WCHANNEL_NO_DEBUG;
-	fast_wch_opt.dump_cb = 0;
-	fast_wch_opt.buffer_size = 0;
-	dbgprint(MOD_MODMGR,__func__,"filled fast wchannel data structure, creating wchannel");
+/*
+   modmgr_peer_status
 
-	ws = wchannel_create(&fast_wch_opt,&fast_wch);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to create wchannel (ws=%s)",wstatus_str(ws));
-		goto return_fail;
+   Fills list with the state of up to list_size peer nodes, see modpeer_status.
+*/
+wstatus modmgr_peer_status(modpeer_status_t *list,unsigned int list_size,unsigned int *count)
+{
+	if( !peers ) {
+		dbgprint(MOD_MODMGR,__func__,"peering is disabled");
+		DBGRET_FAILURE(MOD_MODMGR);
 	}
-	dbgprint(MOD_MODMGR,__func__,"created new wchannel successfully (wch=%p)",fast_wch);
-
-	/* initialize thread_reqproc_data which is the _request_processor thread interface data */
 
-	thread_reqproc_data.unload_flag = false;
-	thread_reqproc_data.initialized_flag = false;
-	thread_reqproc_data.finished_flag = false;
-	thread_reqproc_data.recv_wch = fast_wch;
-	dbgprint(MOD_MODMGR,__func__,"initialized thread_reqproc_data for _request_processor thread");
+	return modpeer_status(peers,list,list_size,count);
+}
 
-	/* create _request_processor therad */
+/* parameter of _modmgr_shm_lookup_jlcb and _modmgr_mcast_lookup_jlcb */
+typedef struct _modmgr_shm_lookup_t
+{
+	const char *name;
+	const struct _modreg_t *mod;
+} modmgr_shm_lookup_t;
 
-	ws = wthread_create(_request_processor_thread,&thread_reqproc_data,&thread_reqproc_data.wthread);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to create wthread (ws=%s)",wstatus_str(ws));
-		goto return_fail;
-	}
-	dbgprint(MOD_MODMGR,__func__,"created wthread for request processor successfully (wth=%p)",
-			thread_reqproc_data.wthread);
+/*
+   _modmgr_shm_lookup_jlcb
 
-	dbgprint(MOD_MODMGR,__func__,"going to wait for request processor thread initialization");
+   jmlist parse callback that keeps the last SHM module registered with the
+   name in param (see modmgr_shm_path).
+*/
+void _modmgr_shm_lookup_jlcb(void *ptr,void *param)
+{
+	const struct _modreg_t *mod = (const struct _modreg_t *)ptr;
+	modmgr_shm_lookup_t *lookup = (modmgr_shm_lookup_t*)param;
 
-	while(!thread_reqproc_data.initialized_flag);
+	if( (mod->communication.type == MODREG_COMM_SHM) && mod->communication.data.shm.ring &&
+			!strncmp(mod->basic.name,lookup->name,sizeof(mod->basic.name)) )
+		lookup->mod = mod;
+}
 
-	if( thread_reqproc_data.finished_flag ) {
-		dbgprint(MOD_MODMGR,__func__,"request processor thread failed to initialize (ws=%s)",
-				wstatus_str(thread_reqproc_data.ret_status));
+/*
+   modmgr_shm_path
 
-		/* wait for thread to RETN */
-		dbgprint(MOD_MODMGR,__func__,"waiting for request processor thread to finish");
-		wthread_wait(thread_reqproc_data.wthread);
-		dbgprint(MOD_MODMGR,__func__,"request processor thread has finished");
+   Copies the path of the rings of a SHM module to path (see shmring_open),
+   the module maps them after its registration. With replicas the path is of
+   the last one registered, each replica must get its path right after its
+   modmgr_register.
+*/
+wstatus modmgr_shm_path(const char *mod_name,char *path,unsigned int path_size)
+{
+	modmgr_shm_lookup_t lookup;
 
-		/* clear wthread */
-		thread_reqproc_data.wthread = 0;
-		goto return_fail;
+	dbgprint(MOD_MODMGR,__func__,"called with mod_name=%s, path=%p, path_size=%u",z_ptr(mod_name),path,path_size);
+
+	if( !mod_name || !path || !path_size ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid arguments");
+		DBGRET_FAILURE(MOD_MODMGR);
 	}
-	dbgprint(MOD_MODMGR,__func__,"request processor thread initialized successfully");
 
-	dbgprint(MOD_MODMGR,__func__,"updating loaded flag to TRUE");
-	loaded = true;
+	if( !loaded ) {
+		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
 
-	DBGRET_SUCCESS(MOD_MODMGR);
-return_fail:
+	lookup.name = mod_name;
+	lookup.mod = 0;
 
-	/* free registered modules jmlist object */
-	if( mod_list )
-   	{
-		jmls = jmlist_free(mod_list);
-		if( jmls != JMLIST_ERROR_SUCCESS ) {
-			dbgprint(MOD_MODMGR,__func__,"failed to free mod_list jmlist (jmls=%d)",jmls);
-		} else {
-			dbgprint(MOD_MODMGR,__func__,"registered modules list was freed successfully (jml=%p)",mod_list);
-			mod_list = 0;
-		}
+	wlock_acquire(&mod_lock);
+	jmlist_parse(mod_list,_modmgr_shm_lookup_jlcb,&lookup);
+	if( !lookup.mod || (strlen(shmring_path(lookup.mod->communication.data.shm.ring)) >= path_size) ) {
+		wlock_release(&mod_lock);
+		dbgprint(MOD_MODMGR,__func__,"module (%s) isn't a SHM module or path doesn't fit",mod_name);
+		DBGRET_FAILURE(MOD_MODMGR);
 	}
+	strcpy(path,shmring_path(lookup.mod->communication.data.shm.ring));
+	wlock_release(&mod_lock);
 
-	/* free the modmgr registry data structure */
-	if( modmgr_reg ) {
-		free(modmgr_reg);
-		modmgr_reg = 0;
-	}
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
 
-	/* free the fast wchannel */
-	if( fast_wch ) 
-	{
-		ws = wchannel_destroy(fast_wch);
-		if( ws != WSTATUS_SUCCESS ) {
-			dbgprint(MOD_MODMGR,__func__,"failed to free fast wchannel (ws=%s)",wstatus_str(ws));
-		} else {
-			fast_wch = 0;
-		}
+/*
+   modmgr_shm_status
+
+   Fills status with the state of the modmgr side of the rings of a SHM module
+   (the last replica registered, see modmgr_shm_path).
+*/
+wstatus modmgr_shm_status(const char *mod_name,shmring_status_t *status)
+{
+	modmgr_shm_lookup_t lookup;
+	wstatus ws = WSTATUS_FAILURE;
+
+	if( !mod_name || !status || !loaded ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid arguments or module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
 	}
 
-	DBGRET_FAILURE(MOD_MODMGR);
+	lookup.name = mod_name;
+	lookup.mod = 0;
+
+	wlock_acquire(&mod_lock);
+	jmlist_parse(mod_list,_modmgr_shm_lookup_jlcb,&lookup);
+	if( lookup.mod )
+		ws = shmring_status(lookup.mod->communication.data.shm.ring,status);
+	wlock_release(&mod_lock);
+
+	return ws;
 }
 
 /*
-   modmgr_unload
+   modmgr_ring_dump
 
-   Uninitializes the modmgr module, this includes:
-    - signal all theads to finish, using the unload_flag.
-	- wait for all threads to finish using wthread_wait
-	- free any data structure used by modmgr and clear the pointers to
-	  these data structures (mod_list).
+   Calls ring_cb for each message in the capture rings of the modmgr
+   wchannels (see wchannel_ring_dump): the sender first (requests and
+   replies sent to SSR modules and peers) and then each remote receiver.
+   The messages of each ring are in order, the rings aren't merged.
 */
-wstatus
-modmgr_unload(void)
+wstatus modmgr_ring_dump(WCHANNELRINGCB ring_cb,void *param)
 {
-	char *game_over_z = "game over code";
+	unsigned int i;
 	wstatus ws;
-	unsigned int used,mod_count;
-	jmlist_status jmls;
-	modreg_t mod_ptr;
 
-	dbgprint(MOD_MODMGR,__func__,"called");
+	dbgprint(MOD_MODMGR,__func__,"called with ring_cb=%p, param=%p",ring_cb,param);
 
-	if( !loaded ) {
-		dbgprint(MOD_MODMGR,__func__,"module was not loaded yet");
-		goto return_fail;
+	if( !loaded || unloading ) {
+		dbgprint(MOD_MODMGR,__func__,"module is not loaded or is unloading");
+		DBGRET_FAILURE(MOD_MODMGR);
 	}
 
-	unloading = true;
+	ws = wchannel_ring_dump(send_wch,ring_cb,param);
+	if( ws != WSTATUS_SUCCESS )
+		return ws;
 
-	/* flag the thread to unload */
+	for( i = 0 ; i < receiver_count ; i++ ) {
+		ws = wchannel_ring_dump(receiver_list[i].wch,ring_cb,param);
+		if( ws != WSTATUS_SUCCESS )
+			return ws;
+	}
 
-	thread_reqproc_data.unload_flag = true;
+	DBGRET_SUCCESS(MOD_MODMGR);
+}
 
-	/* send the dummy data to the thread */
+/* parameter of _modmgr_mcast_reply_jlcb */
+typedef struct _modmgr_mcast_reply_t
+{
+	int id;
+	const char *requester;
+	const char *member;
+	bool found;
+} modmgr_mcast_reply_t;
 
-	ws = wchannel_send(thread_reqproc_data.recv_wch,NULL,game_over_z,sizeof(game_over_z),&used);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to send game over message to request processor thread (ws=%s)",
-				wstatus_str(ws));
-		/* this is dirty nasty fail... */
-		goto return_fail;
-	}
-	dbgprint(MOD_MODMGR,__func__,"sent game over message to request processor thread successfully");
+/*
+   _modmgr_mcast_reply_jlcb
 
-	/* wait for the thread to receive the message and finish */
+   jmlist parse callback that passes the reply in param to the multicast
+   groups until one of them sent the request.
+*/
+void _modmgr_mcast_reply_jlcb(void *ptr,void *param)
+{
+	const struct _modreg_t *mod = (const struct _modreg_t *)ptr;
+	modmgr_mcast_reply_t *reply = (modmgr_mcast_reply_t*)param;
 
-	dbgprint(MOD_MODMGR,__func__,"waiting on request processor thread to finish");
-	wthread_wait(thread_reqproc_data.wthread);
-	dbgprint(MOD_MODMGR,__func__,"request processor thread finished (ws=%s)",wstatus_str(thread_reqproc_data.ret_status));
-	thread_reqproc_data.wthread = 0;
+	if( !reply->found && (mod->communication.type == MODREG_COMM_MCAST) && mod->communication.data.mcast.cast )
+		reply->found = modcast_reply(mod->communication.data.mcast.cast,reply->id,reply->requester,reply->member);
+}
 
-	/* destroy the communications channel to this thread */
-	ws = wchannel_destroy(thread_reqproc_data.recv_wch);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to destroy reception wchannel of request processor thread");
-		goto return_fail;
-	}
-	dbgprint(MOD_MODMGR,__func__,"request processor wchannel destroyed successfully");
-	thread_reqproc_data.recv_wch = 0;
+/*
+   _modmgr_mcast_reply
 
-	/* free all modules inside the registered modules list */
-	
-	jmls = jmlist_entry_count(mod_list,&mod_count);
-	if( jmls != JMLIST_ERROR_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to get number of registered modules (jmls=%d)",jmls);
-		goto return_fail;
-	}
-	dbgprint(MOD_MODMGR,__func__,"freeing %u modules from the registered modules list",mod_count);
+   Helper function called by _request_route for the replies of unregistered
+   modules, a member of a multicast group answering request id of requester.
+*/
+void _modmgr_mcast_reply(int id,const char *requester,const char *member)
+{
+	modmgr_mcast_reply_t reply;
 
-	while(mod_count--)
-	{
-		jmls = jmlist_pop(mod_list,(void*)&mod_ptr);
-		if( jmls != JMLIST_ERROR_SUCCESS ) {
-			dbgprint(MOD_MODMGR,__func__,"failed to pop an entry from registered modules list (jmls=%d)",jmls);
-			goto return_fail;
-		}
+	reply.id = id;
+	reply.requester = requester;
+	reply.member = member;
+	reply.found = false;
 
-		dbgprint(MOD_MODMGR,__func__,"freeing module (%s) from the registered modules list",
-				array2z(mod_ptr->basic.name,sizeof(mod_ptr->basic.name)));
+	wlock_acquire(&mod_lock);
+	jmlist_parse(mod_list,_modmgr_mcast_reply_jlcb,&reply);
+	wlock_release(&mod_lock);
 
-		free(mod_ptr);
-	}
-	dbgprint(MOD_MODMGR,__func__,"freeing registered modules list object");
-	jmls = jmlist_free(mod_list);
-	if( jmls != JMLIST_ERROR_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to free jmlist (jmls=%d)",jmls);
-		goto return_fail;
-	}
-	/* clear pointer */
-	mod_list = 0;
+	if( reply.found )
+		dbgprint(MOD_MODMGR,__func__,"reply of member (%s) to request %d of %s collected",member,id,requester);
+}
 
-	/* everything went OK .. */
+/*
+   _modmgr_mcast_lookup_jlcb
 
-	DBGRET_SUCCESS(MOD_MODMGR);
+   jmlist parse callback that keeps the last multicast group registered with
+   the name in param (a modmgr_shm_lookup_t).
+*/
+void _modmgr_mcast_lookup_jlcb(void *ptr,void *param)
+{
+	const struct _modreg_t *mod = (const struct _modreg_t *)ptr;
+	modmgr_shm_lookup_t *lookup = (modmgr_shm_lookup_t*)param;
 
-return_fail:
-	DBGRET_FAILURE(MOD_MODMGR);
+	if( (mod->communication.type == MODREG_COMM_MCAST) && mod->communication.data.mcast.cast &&
+			!strncmp(mod->basic.name,lookup->name,sizeof(mod->basic.name)) )
+		lookup->mod = mod;
 }
 
 /*
-   modmgr_lookup
+   _modmgr_mcast_cast
 
-   This functions lookups for a specific module that was registered before in modmgr. The
-   module search is done using the module name (meaning that there shouldn't exist two
-   loaded modules with the same name in wicom) and a modreg_t data structure pointer is returned.
+   Helper function that returns the member list of the multicast group
+   mod_name, must be called with mod_lock acquired. With replicas it's the
+   one of the last registered, like modmgr_shm_path.
 */
-wstatus modmgr_lookup(const char *mod_name,const struct _modreg_t **modp)
+modcast_t _modmgr_mcast_cast(const char *mod_name)
 {
-	jmlist_status jmls;
-	unsigned int mod_idx;
-	void *aux_ptr;
-	const struct _modreg_t *aux_mod;
-	jmlist_seek_handle shandle;
-	jmlist_index entry_count;
+	modmgr_shm_lookup_t lookup;
 
-	dbgprint(MOD_MODMGR,__func__,"called with mod_name=%s, modp=%p",z_ptr(mod_name),modp);
+	lookup.name = mod_name;
+	lookup.mod = 0;
+	jmlist_parse(mod_list,_modmgr_mcast_lookup_jlcb,&lookup);
 
-	if( !mod_name || !strlen(mod_name) ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid mod_name argument (mod_name=0 or strlen(mod_name)=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
+	return lookup.mod ? lookup.mod->communication.data.mcast.cast : 0;
+}
 
-	if( !modp ) {
-		dbgprint(MOD_MODMGR,__func__,"invalid modp argument (modp=0)");
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
+/*
+   modmgr_mcast_join
 
-	if( !mod_list ) {
-		/* TODO: use better way of testing for jmlist initialization...
-		   this is code related to jmlist actually.. */
-		dbgprint(MOD_MODMGR,__func__,"registered module list was not initialized yet");
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
+   Adds member to the multicast group mod_name (see modcast_join), its reply
+   is expected to the requests sent to the group from now on. The member
+   process joins the group address itself (see wchannel_mcast_join) and
+   replies with member as source.
+*/
+wstatus modmgr_mcast_join(const char *mod_name,const char *member)
+{
+	modcast_t cast;
+	wstatus ws;
 
-	jmls = jmlist_entry_count(mod_list,&entry_count);
-	if( jmls != JMLIST_ERROR_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to get registered modules list count "
-				"(jmlist function failed with jmls=%d)",jmls);
-		DBGRET_FAILURE(MOD_MODMGR);
-	}
+	dbgprint(MOD_MODMGR,__func__,"called with mod_name=%s, member=%s",z_ptr(mod_name),z_ptr(member));
 
-	jmls = jmlist_seek_start(mod_list,&shandle);
-	if( jmls != JMLIST_ERROR_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to start seeking in registered modules list "
-				"(jmlist function failed with jmls=%d)",jmls);
+	if( !mod_name || !member || !loaded ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid arguments or module was not loaded yet");
 		DBGRET_FAILURE(MOD_MODMGR);
 	}
 
-	mod_idx = 0;
-	while( entry_count-- )
-	{
-		jmls = jmlist_seek_next(mod_list,&shandle,&aux_ptr);
-		if( jmls != JMLIST_ERROR_SUCCESS ) {
-			dbgprint(MOD_MODMGR,__func__,"failed to seek in registered modules list "
-					"(jmlist function failed with jmls=%d)",jmls);
-			goto return_fail_end_seek;
-		}
+	wlock_acquire(&mod_lock);
+	cast = _modmgr_mcast_cast(mod_name);
+	ws = cast ? modcast_join(cast,member) : WSTATUS_FAILURE;
+	wlock_release(&mod_lock);
 
-		aux_mod = (const modreg_t)aux_ptr;
-		
-		/* compare module's names */
+	if( !cast )
+		dbgprint(MOD_MODMGR,__func__,"module (%s) isn't a multicast group",mod_name);
+	return ws;
+}
 
-		if( strcmp(aux_mod->basic.name,mod_name) ) {
-			dbgprint(MOD_MODMGR,__func__,"module (idx=%u) name is different, "
-					"seeking for next module in list",mod_idx);
-			goto seek_mod;
-		}
+/*
+   modmgr_mcast_leave
 
-		dbgprint(MOD_MODMGR,__func__,"found requested module in index %u",mod_idx);
+   Removes member from the multicast group mod_name (see modcast_leave).
+*/
+wstatus modmgr_mcast_leave(const char *mod_name,const char *member)
+{
+	modcast_t cast;
+	wstatus ws;
 
-		/* finish seeking */
+	dbgprint(MOD_MODMGR,__func__,"called with mod_name=%s, member=%s",z_ptr(mod_name),z_ptr(member));
 
-		jmls = jmlist_seek_end(mod_list,&shandle);
-		if( jmls != JMLIST_ERROR_SUCCESS ) {
-			dbgprint(MOD_MODMGR,__func__,"failed to finish seeking in registered modules list "
-					"(jmlist function failed with jmls=%d)",jmls);
-			DBGRET_FAILURE(MOD_MODMGR);
-		}
+	if( !mod_name || !member || !loaded ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid arguments or module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
 
-		*modp = aux_mod;
-		dbgprint(MOD_MODMGR,__func__,"updated modp value to %p",*modp);
+	wlock_acquire(&mod_lock);
+	cast = _modmgr_mcast_cast(mod_name);
+	ws = cast ? modcast_leave(cast,member) : WSTATUS_FAILURE;
+	wlock_release(&mod_lock);
 
-		DBGRET_SUCCESS(MOD_MODMGR);
+	if( !cast )
+		dbgprint(MOD_MODMGR,__func__,"module (%s) isn't a multicast group",mod_name);
+	return ws;
+}
 
-seek_mod:
-		mod_idx++;
-	}
+/*
+   modmgr_mcast_collect
 
-return_fail_end_seek:
-	jmls = jmlist_seek_end(mod_list,&shandle);
-	if( jmls != JMLIST_ERROR_SUCCESS ) {
-		dbgprint(MOD_MODMGR,__func__,"failed to finish seeking in registered modules list "
-				"(jmlist function failed with jmls=%d)",jmls);
+   Returns which members of the multicast group mod_name replied to request
+   id of requester (see modcast_collect), complete is set when all of them
+   did.
+*/
+wstatus modmgr_mcast_collect(const char *mod_name,int id,const char *requester,modcast_reply_t *list,
+		unsigned int list_size,unsigned int *count,bool *complete)
+{
+	modcast_t cast;
+	wstatus ws;
+
+	if( !mod_name || !loaded ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid arguments or module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
 	}
-	DBGRET_FAILURE(MOD_MODMGR);
+
+	wlock_acquire(&mod_lock);
+	cast = _modmgr_mcast_cast(mod_name);
+	ws = cast ? modcast_collect(cast,id,requester,list,list_size,count,complete) : WSTATUS_FAILURE;
+	wlock_release(&mod_lock);
+
+	return ws;
 }
 
-wstatus _request_send(const request_t req,const struct _modreg_t *mod)
+/*
+   modmgr_mcast_status
+
+   Fills list with the reply counters of up to list_size members of the
+   multicast group mod_name (see modcast_status).
+*/
+wstatus modmgr_mcast_status(const char *mod_name,modcast_status_t *list,unsigned int list_size,unsigned int *count)
 {
-	DBGRET_FAILURE(MOD_MODMGR);
-}
+	modcast_t cast;
+	wstatus ws;
+
+	if( !mod_name || !loaded ) {
+		dbgprint(MOD_MODMGR,__func__,"invalid arguments or module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODMGR);
+	}
 
+	wlock_acquire(&mod_lock);
+	cast = _modmgr_mcast_cast(mod_name);
+	ws = cast ? modcast_status(cast,list,list_size,count) : WSTATUS_FAILURE;
+	wlock_release(&mod_lock);
+
+	return ws;
+}
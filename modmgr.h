@@ -116,25 +116,100 @@
 		and waiting for the answer. If some error occurs before the request
 		is forward, it should build a reply with error information and send
 		the reply to the pipe.
+		The thread waits for the pipe in an event loop (wloop.h),
+		modmgr_unload stops the loop and the thread finishes at once.
 		1) pipe returns data
 		x) insert data into pipe req_buffer
 		x) got any request (req-start to req-end)? get it from req_buffer
 		2) lookup destiny module data structure
-		3.1) if mod_dst.DCR, convert req to req_bin, send request dst.callback
+		3.1) if mod_dst.DCR, convert req to req_bin, put request in the
+		     inbox of mod_dst, the inbox thread calls dst.callback
 		3.2) if mod_dst.SSR, convert req to req_text, send request to
 		     mod_dst.host, mod_dst.port
 		4) goto 1)
 
 	iv) _remote_request_receiver()
-		This thread receives data from the modmgr socket (UDP channel listening)
-		and sends the request to request processor pipe.
+		These threads receive data from the modmgr sockets, bound to bind_port
+		with SO_REUSEPORT (one per core by default, see load.receivers). The
+		kernel spreads the senders between the sockets so the parsing scales
+		with the cores.
 		1) read from wchannel
 		2) got data, insert into socket req_buffer
 		3) got any request (req-start to req-end)? get it from req_buffer
-		4) convert request to req_pipe
-		5) insert request into request processor pipe
-		6) goto 1)
-
+		4) queue the request in the dispatch scheduler
+		5) goto 1)
+		The receivers parse the requests straight from the buffer the
+		datagram was received in (see reqbuf_create_zc). With load.engine
+		set to WCHANNEL_ENGINE_URING the sockets use io_uring, the datagrams
+		are received in registered buffers without a syscall each (see
+		wchannel.h), kernels without it use the classic engine.
+
+	v) _shm_request_receiver()
+		SSR modules of the same host can register with the SHM communication
+		type, modmgr creates a pair of shared memory rings for them (see
+		shmring.h) and the module maps them with the path returned by
+		modmgr_shm_path. Requests travel in both directions as binary frames
+		(see req_to_frame), without syscalls while both sides are busy. Each
+		module has a receiver thread:
+		1) wait for a frame from the module ring
+		2) convert it into a binary request, run the admission control
+		3) queue the request in the dispatch scheduler
+		4) goto 1)
+		A full ring makes the module busy like a full inbox, modmgr never
+		waits for it.
+
+	vi) peering (see modpeer.h)
+		Other modmgr nodes send their summaries and forward requests to the
+		remote receivers. A request to a module that isn't registered but was
+		announced by a peer is forwarded to it, its reply comes back the same
+		way (routed by the name of the source module).
+
+	vii) deadlines
+		A request may carry a deadline nvpair, the absolute time (wall clock
+		milliseconds) after which its caller no longer waits for the reply
+		(see req_deadline_set). modmgr reads it when the request arrives and
+		drops the request, without answering it, when the deadline passed
+		before the dispatch thread routes it or before the inbox of the
+		module delivers it. The dropped requests are counted as expired in
+		the statistics of the module (see modstats.h). The requests a module
+		callback forwards (like the ones returned by a batch callback) get
+		the deadline of the requests it's handling if it's earlier, the
+		earliest one of a batch, and the nvpair travels with the requests forwarded to SSR modules and
+		peers, so the remaining budget follows the request.
+
+	viii) capture rings
+		The sender wchannel and the remote receivers always keep their last
+		load.ring_size messages in a capture ring (see wchannel.h), the
+		first WCHANNEL_RING_SNAPLEN bytes of each. modmgr_ring_dump copies
+		them out while modmgr runs, to see what was exchanged before an
+		incident.
+
+	ix) multicast groups
+		A module registered with MODREG_COMM_MCAST is a multicast group: the
+		requests sent to its name go in a single datagram to the group
+		address, every member process listening on it (see
+		wchannel_mcast_join) gets them and replies with its own name as
+		source. The members expected to answer are added with
+		modmgr_mcast_join, the replies are correlated per member by modcast
+		(see modcast.h) and still routed to the requester like any other.
+		modmgr_mcast_collect tells which members answered a request and
+		modmgr_mcast_status how many each one answered or missed. The sender
+		wchannel is created with load.mcast_ttl, load.mcast_loop and
+		load.mcast_if, a group on loopback needs mcast_loop.
+
+	x) reliable datagrams
+		With load.reliable the sender wchannel and the remote receivers
+		acknowledge every datagram and send again the lost ones (see
+		wrel.h), the requests and replies of each SSR module arrive once and
+		in order while a loss delays only that module. When the window of a
+		module is full its requests wait in a queue of their own (up to
+		MODMGR_DEFERRED_MAX) and are sent by the deferred thread when the
+		module acknowledges, the other modules are still sent right away.
+		The SSR modules must use reliable wchannels too, the datagrams of a
+		plain one aren't acknowledged. Requests to multicast groups are
+		still sent plain, modcast accounts for the members that miss them.
+		load.reliable_loss drops a percent of the datagrams, to test the
+		recovery on loopback.
 
 	Difference between requests and replies: each request has a type associated,
 	it can be request type and reply type (future might bring other types also).
@@ -183,12 +258,40 @@
 #include "wlock.h"
 #include "nvpair.h"
 #include "req.h"
+#include "admctl.h"
+#include "modsched.h"
+#include "modinbox.h"
+#include "modbus.h"
+#include "modstats.h"
+#include "modgroup.h"
+#include "modpeer.h"
+#include "modcast.h"
+#include "shmring.h"
+#include "wthread.h"
+#include "wchannel.h"
 
 typedef struct _modmgr_load_t {
 	char *bind_hostname;
 	char *bind_port;
+	admctl_opt_t admission;		/* zeros select the defaults */
+	modsched_opt_t dispatch;
+	modbus_opt_t events;
+	unsigned int receivers;		/* remote receiver sockets, 0 = one per core */
+	wchannel_engine_list engine;	/* wchannel engine of the remote receivers */
+	modpeer_opt_t peering;		/* peering.node = 0 disables it, requires bind_port */
+	unsigned int ring_size;		/* capture ring of each wchannel, 0 = MODMGR_RING_SIZE */
+	unsigned int mcast_ttl;		/* of the requests sent to multicast groups, 0 = 1 */
+	bool mcast_loop;			/* deliver them to the members on this host too */
+	char *mcast_if;				/* interface they're sent from, 0 = default route */
+	bool reliable;				/* reliable datagrams on the UDP wchannels (see wchannel.h) */
+	unsigned int reliable_loss;	/* percent of datagrams dropped on purpose, to test */
 } modmgr_load_t;
 
+#define MODMGR_MAXRECEIVERS 64
+#define MODMGR_RING_SIZE 4096
+#define MODMGR_DEFERRED_MAX 1024	/* requests kept per SSR module while its window is full */
+#define MODMGR_DEFERRED_WAIT_US 100000
+
 /*
  * MODULE REGISTRATION DECLARATIONS
  */
@@ -204,11 +307,25 @@ typedef struct _modmgr_load_t {
 typedef enum _modreg_comm_type_list {
 	MODREG_COMM_UNDEF,
 	MODREG_COMM_DCR,
-	MODREG_COMM_SSR
+	MODREG_COMM_SSR,
+	MODREG_COMM_SHM,
+	MODREG_COMM_MCAST
 } modreg_comm_type_list;
 
+/* the request is sealed and only borrowed during the call, use req_ref to keep it.
+   DCR callbacks are called from the inbox thread of the module (see modinbox.h),
+   never from the modmgr threads, a callback that blocks only delays its module. */
 typedef void (*REQPROCESSORCALLBACK)(const request_t req);
 
+/* batch delivery: up to batch_max requests queued for the module are passed
+   in one call, they're sealed and borrowed like in REQPROCESSORCALLBACK. The
+   module may return replies in reply_list (at most reply_max, one per request)
+   setting reply_count, modmgr forwards and frees them. */
+typedef void (*REQBATCHCALLBACK)(const request_t *req_list,unsigned int req_count,
+		request_t *reply_list,unsigned int reply_max,unsigned int *reply_count);
+
+#define MODREG_BATCH_MAX 64
+
 typedef struct _modreg_t {
 	struct _basic {
 		char name[MODNAMESIZE];
@@ -222,13 +339,42 @@ typedef struct _modreg_t {
 		union _xpto {
 			struct _dcr {
 				REQPROCESSORCALLBACK reqproc_cb;
+				REQBATCHCALLBACK reqbatch_cb;	/* optional, used instead of reqproc_cb */
+				unsigned int batch_max;			/* 0 = MODREG_BATCH_MAX */
 			} dcr;
 			struct _ssr {
 				char host[MODHOSTSIZE];
 				char port[MODPORTSIZE];
 			} ssr;
+			struct _shm {
+				unsigned int ring_size;		/* 0 = SHMRING_DEFAULT_SIZE */
+				shmring_t ring;				/* created by modmgr, see modmgr_shm_path */
+				wlock_t send_lock;			/* the ring has a single producer */
+				wthread_t wthread;			/* receiver of the requests of the module */
+				bool started;
+			} shm;
+			struct _mcast {
+				char host[MODHOSTSIZE];		/* group address */
+				char port[MODPORTSIZE];
+				unsigned int reply_timeout_ms;	/* 0 = MODCAST_DEFAULT_TIMEOUT_MS */
+				modcast_t cast;				/* created by modmgr, members added with modmgr_mcast_join */
+			} mcast;
 		} data;
 	} communication;
+	struct _dispatch {
+		modsched_class_list sched_class;	/* class of the requests sent by the module */
+	} dispatch;
+	struct _inbox {
+		unsigned int size;					/* 0 = MODINBOX_DEFAULT_SIZE */
+		modinbox_overflow_list overflow;	/* policy when the inbox is full */
+		unsigned int block_ms;				/* MODINBOX_OVERFLOW_BLOCK bounded wait, 0 = MODINBOX_DEFAULT_BLOCK_MS */
+		modinbox_t queue;					/* created by modmgr for DCR modules */
+	} inbox;
+	struct _replica {
+		modgroup_policy_list policy;		/* routing of the group, the first registration sets it */
+		char hash_name[MODGROUP_KEYSIZE];	/* nvpair hashed by MODGROUP_HASH */
+		modgroup_t group;					/* shared by the modules with the same name */
+	} replica;
 } *modreg_t;
 
 typedef enum _modreg_validation_result {
@@ -250,9 +396,32 @@ typedef enum _modreg_validation_result {
 
 wstatus modmgr_lookup(const char *mod_name,const struct _modreg_t **modp);
 wstatus modmgr_load(modmgr_load_t load);
+wstatus modmgr_register(const struct _modreg_t *reg);
+wstatus modmgr_group_status(const char *mod_name,modgroup_status_t *list,unsigned int list_size,unsigned int *count);
 wstatus modmgr_unload(void);
-
+wstatus modmgr_dispatch_status(modsched_class_list sched_class,modsched_status_t *status);
+wstatus modmgr_event_alloc(const char *src,const char *topic,const char *key,request_t *event);
+wstatus modmgr_publish(const request_t event);
+wstatus modmgr_subscribe(const char *mod_name,const char *pattern,unsigned int queue_size);
+wstatus modmgr_unsubscribe(const char *mod_name,const char *pattern);
+wstatus modmgr_event_status(const char *mod_name,modbus_status_t *status);
+wstatus modmgr_stats(modstats_status_t *list,unsigned int list_size,unsigned int *count);
+wstatus modmgr_peer_add(const char *node,const char *host,const char *port);
+wstatus modmgr_peer_status(modpeer_status_t *list,unsigned int list_size,unsigned int *count);
+wstatus modmgr_shm_path(const char *mod_name,char *path,unsigned int path_size);
+wstatus modmgr_shm_status(const char *mod_name,shmring_status_t *status);
+wstatus modmgr_ring_dump(WCHANNELRINGCB ring_cb,void *param);
+wstatus modmgr_mcast_join(const char *mod_name,const char *member);
+wstatus modmgr_mcast_leave(const char *mod_name,const char *member);
+wstatus modmgr_mcast_collect(const char *mod_name,int id,const char *requester,modcast_reply_t *list,
+		unsigned int list_size,unsigned int *count,bool *complete);
+wstatus modmgr_mcast_status(const char *mod_name,modcast_status_t *list,unsigned int list_size,unsigned int *count);
+
+wstatus _request_process(request_t req);
 wstatus _request_send(const request_t req,const struct _modreg_t *mod);
+wstatus _request_deliver(const request_t *req_list,unsigned int req_count,const struct _modreg_t *mod);
+wstatus _request_deliver_batch(const request_t *req_list,unsigned int req_count,const struct _modreg_t *mod);
+wstatus _request_send_multi(const request_t req,const struct _modreg_t **mod_list_ptr,unsigned int mod_count);
 
 #endif
 
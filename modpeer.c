@@ -0,0 +1,860 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "wcond.h"
+#include "wthread.h"
+#include "wchannel.h"
+#include "req.h"
+#include "reqids.h"
+#include "modpeer.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#include <time.h>
+#endif
+
+#define MODPEER_SLOTS 512				/* open addressing slots of a routing table */
+#define MODPEER_SUMMARYSIZE (MODPEER_MAXMODULES * (REQMODSIZE + 1))
+
+/*
+   Modules announced by a peer, replaced by each summary. The slots keep the
+   index + 1 of the names (0 is a free slot).
+*/
+typedef struct _modpeer_routes_t
+{
+	unsigned int count;
+	char name_list[MODPEER_MAXMODULES][REQMODSIZE+1];
+	uint16_t slot_list[MODPEER_SLOTS];
+} modpeer_routes_t;
+
+typedef struct _modpeer_link_t
+{
+	char node[MODPEER_NODESIZE];
+	char host[MODPEER_HOSTSIZE];
+	char port[MODPEER_PORTSIZE];
+	char dest[MODPEER_HOSTSIZE+MODPEER_PORTSIZE+1];
+	modpeer_routes_t *routes;
+	uint64_t summary_ns;		/* last summary received, 0 = never */
+	char *buf_list[2];			/* one is filled while the other is sent */
+	unsigned int fill;
+	unsigned int used;
+	unsigned int count;			/* requests in the buffer being filled */
+	uint64_t first_ns;			/* first request of the batch was added */
+	bool sending;
+	bool summary_due;			/* added after the last summary */
+	unsigned long summaries;
+	unsigned long requests;
+	unsigned long datagrams;
+	unsigned long errors;
+} modpeer_link_t;
+
+struct _modpeer_t
+{
+	char node[MODPEER_NODESIZE];
+	unsigned int summary_ms;
+	unsigned int linger_us;
+	unsigned int batch_size;
+	MODPEERSUMMARYCB summary_cb;
+	void *param;
+	wchannel_t wch;
+	wlock_t lock;
+	wcond_t wakeup;				/* a batch waits for the peer thread */
+	wcond_t sent;				/* a link finished sending */
+	modpeer_link_t link_list[MODPEER_MAXPEERS];
+	unsigned int link_count;
+	bool summary_due;			/* a link waits for its first summary */
+	bool stopping;
+	bool started;
+	bool finished;				/* thread was waited by modpeer_stop */
+	wthread_t thread;
+	char *summary_buf;			/* used by the peer thread */
+};
+
+/*
+   _modpeer_now_ns
+
+   Helper function that returns the monotonic clock in nanoseconds.
+*/
+static uint64_t
+_modpeer_now_ns(void)
+{
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+	return (uint64_t)GetTickCount64() * 1000000ULL;
+#endif
+}
+
+/*
+   _modpeer_hash
+
+   Helper function that returns the FNV-1a hash of a module name.
+*/
+static uint32_t
+_modpeer_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while( *name ) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+   _modpeer_routes_find
+
+   Helper function that tests if a routing table has a module name.
+*/
+static bool
+_modpeer_routes_find(const modpeer_routes_t *routes,const char *name,uint32_t hash)
+{
+	unsigned int slot = hash % MODPEER_SLOTS;
+	unsigned int i;
+
+	for( i = 0 ; i < MODPEER_SLOTS ; i++ )
+	{
+		if( !routes->slot_list[slot] )
+			return false;
+		if( !strcmp(routes->name_list[routes->slot_list[slot]-1],name) )
+			return true;
+		slot = (slot + 1) % MODPEER_SLOTS;
+	}
+	return false;
+}
+
+/*
+   _modpeer_link_up
+
+   Helper function that tests if a summary of the peer arrived in the last
+   three summary intervals, lock must be acquired.
+*/
+static bool
+_modpeer_link_up(modpeer_t peers,const modpeer_link_t *link,uint64_t now_ns)
+{
+	return link->routes && link->summary_ns &&
+		(now_ns - link->summary_ns < 3ULL * peers->summary_ms * 1000000ULL);
+}
+
+/*
+   _modpeer_drain
+
+   Helper function that sends the batch of a link until it's empty. Called
+   with the lock acquired and the link not sending, the lock is released
+   while each datagram is sent and the requests forwarded meanwhile are
+   added to the other buffer, they're sent by the next datagram.
+*/
+static void
+_modpeer_drain(modpeer_t peers,modpeer_link_t *link)
+{
+	unsigned int size,count,used;
+	char *buf;
+	wstatus ws;
+
+	link->sending = true;
+
+	while( link->used )
+	{
+		buf = link->buf_list[link->fill];
+		size = link->used;
+		count = link->count;
+		link->fill ^= 1;
+		link->used = 0;
+		link->count = 0;
+
+		wlock_release(&peers->lock);
+		ws = wchannel_send(peers->wch,link->dest,buf,size,&used);
+		wlock_acquire(&peers->lock);
+
+		link->datagrams++;
+		link->requests += count;
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODPEER,__func__,"failed to send %u requests to peer %s (ws=%s)",
+					count,link->node,wstatus_str(ws));
+			link->errors++;
+		}
+	}
+
+	link->sending = false;
+	wcond_broadcast(&peers->sent);
+}
+
+/*
+   _modpeer_summary
+
+   Helper function that sends a summary of the local modules (request
+   peer.summary to modmgr with the node and modules nvpairs) to every peer,
+   or with all false only to the peers added since the last summary.
+*/
+static void
+_modpeer_summary(modpeer_t peers,bool all)
+{
+	request_t req = 0;
+	const char *text_ptr;
+	unsigned int text_size;
+	unsigned int size;
+	unsigned int i,count;
+	bool send_list[MODPEER_MAXPEERS];
+	wstatus ws;
+
+	size = peers->summary_cb(peers->param,peers->summary_buf,MODPEER_SUMMARYSIZE);
+	peers->summary_buf[size < MODPEER_SUMMARYSIZE ? size : MODPEER_SUMMARYSIZE - 1] = '\0';
+
+	req = (request_t)malloc(sizeof(struct _request_t));
+	if( !req ) {
+		dbgprint(MOD_MODPEER,__func__,"malloc failed");
+		return;
+	}
+	memset(req,0,sizeof(struct _request_t));
+
+	req->stype = REQUEST_STYPE_BIN;
+	req->data.bin.type = REQUEST_TYPE_REQUEST;
+	strcpy(req->data.bin.src,"modmgr");
+	strcpy(req->data.bin.dst,"modmgr");
+	strcpy(req->data.bin.code,reqid_code_str(REQCODE_PEER_SUMMARY));
+	req->data.bin.code_id = REQCODE_PEER_SUMMARY;
+
+	ws = req_add_nvp_z(reqid_name_str(REQNAME_NODE),peers->node,req);
+	if( ws == WSTATUS_SUCCESS )
+		ws = req_add_nvp_z(reqid_name_str(REQNAME_MODULES),peers->summary_buf,req);
+	if( ws == WSTATUS_SUCCESS )
+		ws = req_seal(req);
+	if( ws == WSTATUS_SUCCESS )
+		ws = req_sealed_text(req,&text_ptr,&text_size);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODPEER,__func__,"failed to build summary request (ws=%s)",wstatus_str(ws));
+		req_free(req);
+		return;
+	}
+
+	wlock_acquire(&peers->lock);
+	count = peers->link_count;
+	for( i = 0 ; i < count ; i++ ) {
+		send_list[i] = all || peers->link_list[i].summary_due;
+		peers->link_list[i].summary_due = false;
+	}
+	peers->summary_due = false;
+	wlock_release(&peers->lock);
+
+	for( i = 0 ; i < count ; i++ )
+		if( send_list[i] )
+			modpeer_send(peers,i,text_ptr,text_size);
+
+	req_free(req);
+}
+
+/*
+   _modpeer_thread
+
+   Thread routine of the peers, sends the summaries and the batches that
+   lingered for linger_us. Peers added meanwhile get a summary at once, they
+   don't wait summary_ms for their first one.
+*/
+static void
+_modpeer_thread(void *param)
+{
+	modpeer_t peers = (modpeer_t)param;
+	modpeer_link_t *link;
+	uint64_t now_ns,next_summary_ns,wake_ns,due_ns;
+	unsigned int i;
+
+	dbgprint(MOD_MODPEER,__func__,"called with param=%p",param);
+
+	next_summary_ns = 0;
+
+	wlock_acquire(&peers->lock);
+	while( !peers->stopping )
+	{
+		now_ns = _modpeer_now_ns();
+
+		if( now_ns >= next_summary_ns )
+		{
+			wlock_release(&peers->lock);
+			_modpeer_summary(peers,true);
+			wlock_acquire(&peers->lock);
+			now_ns = _modpeer_now_ns();
+			next_summary_ns = now_ns + peers->summary_ms * 1000000ULL;
+			continue;
+		}
+
+		if( peers->summary_due )
+		{
+			wlock_release(&peers->lock);
+			_modpeer_summary(peers,false);
+			wlock_acquire(&peers->lock);
+			continue;
+		}
+
+		/* flush the batches that lingered enough, find the next deadline */
+		wake_ns = next_summary_ns;
+		for( i = 0 ; i < peers->link_count ; i++ )
+		{
+			link = &peers->link_list[i];
+			if( !link->used || link->sending )
+				continue;
+			due_ns = link->first_ns + peers->linger_us * 1000ULL;
+			if( due_ns <= now_ns ) {
+				_modpeer_drain(peers,link);
+				now_ns = _modpeer_now_ns();
+			} else if( due_ns < wake_ns )
+				wake_ns = due_ns;
+		}
+
+		if( wake_ns > now_ns )
+			wcond_timedwait(&peers->wakeup,&peers->lock,(unsigned int)((wake_ns - now_ns + 999) / 1000));
+	}
+	wlock_release(&peers->lock);
+
+	dbgprint(MOD_MODPEER,__func__,"returning.");
+}
+
+/*
+   modpeer_create
+
+   Creates the peers of a node, the links of opt.peer_list and the thread
+   that sends the summaries. summary_cb writes the module names of each
+   summary (see MODPEERSUMMARYCB).
+*/
+wstatus
+modpeer_create(const modpeer_opt_t *opt,MODPEERSUMMARYCB summary_cb,void *param,modpeer_t *peers)
+{
+	modpeer_t new_peers = 0;
+	wchannel_opt_t wch_opt;
+	bool lock_created = false;
+	bool wakeup_created = false;
+	bool sent_created = false;
+	unsigned int i;
+	wstatus ws;
+
+	dbgprint(MOD_MODPEER,__func__,"called with opt=%p, summary_cb=%p, param=%p, peers=%p",
+			opt,summary_cb,param,peers);
+
+	if( !opt || !opt->node || !strlen(opt->node) || !summary_cb || !peers ) {
+		dbgprint(MOD_MODPEER,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( strlen(opt->node) >= MODPEER_NODESIZE ) {
+		dbgprint(MOD_MODPEER,__func__,"node name is too long (%s)",opt->node);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( opt->batch_size > MODPEER_MAXBATCH_SIZE ) {
+		dbgprint(MOD_MODPEER,__func__,"batch size is too large (%u)",opt->batch_size);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_peers = (modpeer_t)malloc(sizeof(struct _modpeer_t));
+	if( !new_peers ) {
+		dbgprint(MOD_MODPEER,__func__,"malloc failed");
+		goto return_fail;
+	}
+	memset(new_peers,0,sizeof(struct _modpeer_t));
+
+	strcpy(new_peers->node,opt->node);
+	new_peers->summary_ms = opt->summary_ms ? opt->summary_ms : MODPEER_DEFAULT_SUMMARY_MS;
+	new_peers->linger_us = opt->linger_us;
+	new_peers->batch_size = opt->batch_size ? opt->batch_size : MODPEER_DEFAULT_BATCH_SIZE;
+	new_peers->summary_cb = summary_cb;
+	new_peers->param = param;
+
+	new_peers->summary_buf = (char*)malloc(MODPEER_SUMMARYSIZE);
+	if( !new_peers->summary_buf ) {
+		dbgprint(MOD_MODPEER,__func__,"malloc failed");
+		goto return_fail;
+	}
+
+	ws = wlock_create(&new_peers->lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODPEER,__func__,"failed to create lock (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	lock_created = true;
+
+	ws = wcond_create(&new_peers->wakeup);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODPEER,__func__,"failed to create condition (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	wakeup_created = true;
+
+	ws = wcond_create(&new_peers->sent);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODPEER,__func__,"failed to create condition (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	sent_created = true;
+
+	/* the links share a sender socket, the peers answer to their own receivers */
+
+	memset(&wch_opt,0,sizeof(wch_opt));
+	wch_opt.type = WCHANNEL_TYPE_SOCKUDP;
+	wch_opt.host_src = (char*)(opt->host_src ? opt->host_src : "0.0.0.0");
+	wch_opt.port_src = "0";
+	wch_opt.debug_opts = WCHANNEL_NO_DEBUG;
+
+	ws = wchannel_create(&wch_opt,&new_peers->wch);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODPEER,__func__,"failed to create sender wchannel (ws=%s)",wstatus_str(ws));
+		new_peers->wch = 0;
+		goto return_fail;
+	}
+
+	for( i = 0 ; i < opt->peer_count ; i++ )
+	{
+		ws = modpeer_add(new_peers,opt->peer_list[i].node,opt->peer_list[i].host,opt->peer_list[i].port);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_MODPEER,__func__,"failed to add peer %u (ws=%s)",i,wstatus_str(ws));
+			goto return_fail;
+		}
+	}
+
+	ws = wthread_create(_modpeer_thread,new_peers,&new_peers->thread);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODPEER,__func__,"failed to create thread (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	new_peers->started = true;
+
+	*peers = new_peers;
+	DBGRET_SUCCESS(MOD_MODPEER);
+
+return_fail:
+	if( new_peers )
+	{
+		for( i = 0 ; i < new_peers->link_count ; i++ ) {
+			free(new_peers->link_list[i].buf_list[0]);
+			free(new_peers->link_list[i].buf_list[1]);
+		}
+		if( new_peers->wch )
+			wchannel_destroy(new_peers->wch);
+		if( sent_created )
+			wcond_free(&new_peers->sent);
+		if( wakeup_created )
+			wcond_free(&new_peers->wakeup);
+		if( lock_created )
+			wlock_free(&new_peers->lock);
+		free(new_peers->summary_buf);
+		free(new_peers);
+	}
+	DBGRET_FAILURE(MOD_MODPEER);
+}
+
+/*
+   modpeer_stop
+
+   Stops the peer thread and sends the batches still waiting, the requests
+   forwarded afterwards are sent at once.
+*/
+wstatus
+modpeer_stop(modpeer_t peers)
+{
+	unsigned int i;
+
+	dbgprint(MOD_MODPEER,__func__,"called with peers=%p",peers);
+
+	if( !peers ) {
+		dbgprint(MOD_MODPEER,__func__,"invalid peers argument (peers=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( peers->finished ) {
+		DBGRET_SUCCESS(MOD_MODPEER);
+	}
+
+	wlock_acquire(&peers->lock);
+	peers->stopping = true;
+	wcond_broadcast(&peers->wakeup);
+	wlock_release(&peers->lock);
+
+	if( peers->started )
+		wthread_wait(peers->thread);
+	peers->finished = true;
+
+	wlock_acquire(&peers->lock);
+	for( i = 0 ; i < peers->link_count ; i++ )
+		if( peers->link_list[i].used && !peers->link_list[i].sending )
+			_modpeer_drain(peers,&peers->link_list[i]);
+	wlock_release(&peers->lock);
+
+	DBGRET_SUCCESS(MOD_MODPEER);
+}
+
+/*
+   modpeer_destroy
+
+   Stops the peers (see modpeer_stop) and frees them, no thread may be
+   forwarding requests to them.
+*/
+wstatus
+modpeer_destroy(modpeer_t peers)
+{
+	unsigned int i;
+
+	dbgprint(MOD_MODPEER,__func__,"called with peers=%p",peers);
+
+	if( !peers ) {
+		dbgprint(MOD_MODPEER,__func__,"invalid peers argument (peers=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	modpeer_stop(peers);
+
+	for( i = 0 ; i < peers->link_count ; i++ ) {
+		free(peers->link_list[i].routes);
+		free(peers->link_list[i].buf_list[0]);
+		free(peers->link_list[i].buf_list[1]);
+	}
+
+	wchannel_destroy(peers->wch);
+	wcond_free(&peers->sent);
+	wcond_free(&peers->wakeup);
+	wlock_free(&peers->lock);
+	free(peers->summary_buf);
+	free(peers);
+	DBGRET_SUCCESS(MOD_MODPEER);
+}
+
+/*
+   modpeer_add
+
+   Adds a peer, host and port are the address of its modmgr receivers. The
+   peer has no routes until its first summary arrives, the peer thread sends
+   ours to it right away.
+*/
+wstatus
+modpeer_add(modpeer_t peers,const char *node,const char *host,const char *port)
+{
+	modpeer_link_t *link;
+	char *buf0,*buf1;
+	unsigned int i;
+
+	dbgprint(MOD_MODPEER,__func__,"called with peers=%p, node=%s, host=%s, port=%s",
+			peers,z_ptr(node),z_ptr(host),z_ptr(port));
+
+	if( !peers || !node || !host || !port ) {
+		dbgprint(MOD_MODPEER,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( !strlen(node) || (strlen(node) >= MODPEER_NODESIZE) ||
+		(strlen(host) >= MODPEER_HOSTSIZE) || (strlen(port) >= MODPEER_PORTSIZE) ) {
+		dbgprint(MOD_MODPEER,__func__,"node, host or port has invalid size");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	/* the buffers are allocated before, malloc isn't called with the lock */
+	buf0 = (char*)malloc(peers->batch_size);
+	buf1 = (char*)malloc(peers->batch_size);
+	if( !buf0 || !buf1 ) {
+		dbgprint(MOD_MODPEER,__func__,"malloc failed");
+		free(buf0);
+		free(buf1);
+		DBGRET_FAILURE(MOD_MODPEER);
+	}
+
+	wlock_acquire(&peers->lock);
+
+	for( i = 0 ; i < peers->link_count ; i++ )
+	{
+		if( !strcmp(peers->link_list[i].node,node) ) {
+			wlock_release(&peers->lock);
+			dbgprint(MOD_MODPEER,__func__,"peer %s was already added",node);
+			free(buf0);
+			free(buf1);
+			DBGRET_FAILURE(MOD_MODPEER);
+		}
+	}
+
+	if( (peers->link_count == MODPEER_MAXPEERS) || !strcmp(peers->node,node) ) {
+		wlock_release(&peers->lock);
+		dbgprint(MOD_MODPEER,__func__,"too many peers or peer is this node (%s)",node);
+		free(buf0);
+		free(buf1);
+		DBGRET_FAILURE(MOD_MODPEER);
+	}
+
+	link = &peers->link_list[peers->link_count];
+	memset(link,0,sizeof(modpeer_link_t));
+	strcpy(link->node,node);
+	strcpy(link->host,host);
+	strcpy(link->port,port);
+	snprintf(link->dest,sizeof(link->dest),"%s %s",host,port);
+	link->buf_list[0] = buf0;
+	link->buf_list[1] = buf1;
+	link->summary_due = true;
+	peers->link_count++;
+	peers->summary_due = true;
+	wcond_broadcast(&peers->wakeup);
+
+	wlock_release(&peers->lock);
+
+	DBGRET_SUCCESS(MOD_MODPEER);
+}
+
+/*
+   modpeer_learn
+
+   Replaces the routes of a peer with the module names of its summary
+   (separated by colons). Summaries of unknown nodes are ignored.
+*/
+wstatus
+modpeer_learn(modpeer_t peers,const char *node,const char *modules)
+{
+	modpeer_routes_t *routes,*old_routes;
+	modpeer_link_t *link = 0;
+	const char *name_ptr,*name_end;
+	unsigned int name_size,slot,i;
+	uint32_t hash;
+
+	dbgprint(MOD_MODPEER,__func__,"called with peers=%p, node=%s, modules=%s",peers,z_ptr(node),z_ptr(modules));
+
+	if( !peers || !node || !modules ) {
+		dbgprint(MOD_MODPEER,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	routes = (modpeer_routes_t*)malloc(sizeof(modpeer_routes_t));
+	if( !routes ) {
+		dbgprint(MOD_MODPEER,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODPEER);
+	}
+	memset(routes,0,sizeof(modpeer_routes_t));
+
+	for( name_ptr = modules ; *name_ptr ; name_ptr = *name_end ? name_end + 1 : name_end )
+	{
+		name_end = strchr(name_ptr,':');
+		if( !name_end )
+			name_end = name_ptr + strlen(name_ptr);
+		name_size = (unsigned int)(name_end - name_ptr);
+
+		if( !name_size || (name_size > REQMODSIZE) )
+			continue;
+
+		if( routes->count == MODPEER_MAXMODULES ) {
+			dbgprint(MOD_MODPEER,__func__,"peer %s announced more than %u modules, ignoring the others",
+					node,MODPEER_MAXMODULES);
+			break;
+		}
+
+		memcpy(routes->name_list[routes->count],name_ptr,name_size);
+		routes->name_list[routes->count][name_size] = '\0';
+
+		/* replicas are announced once per registration */
+		hash = _modpeer_hash(routes->name_list[routes->count]);
+		if( _modpeer_routes_find(routes,routes->name_list[routes->count],hash) )
+			continue;
+
+		slot = hash % MODPEER_SLOTS;
+		while( routes->slot_list[slot] )
+			slot = (slot + 1) % MODPEER_SLOTS;
+		routes->slot_list[slot] = (uint16_t)(routes->count + 1);
+		routes->count++;
+	}
+
+	wlock_acquire(&peers->lock);
+
+	for( i = 0 ; i < peers->link_count ; i++ )
+		if( !strcmp(peers->link_list[i].node,node) )
+			link = &peers->link_list[i];
+
+	if( !link ) {
+		wlock_release(&peers->lock);
+		dbgprint(MOD_MODPEER,__func__,"summary of unknown node %s, ignoring it",node);
+		free(routes);
+		DBGRET_FAILURE(MOD_MODPEER);
+	}
+
+	old_routes = link->routes;
+	link->routes = routes;
+	link->summary_ns = _modpeer_now_ns();
+	link->summaries++;
+
+	wlock_release(&peers->lock);
+
+	free(old_routes);
+	dbgprint(MOD_MODPEER,__func__,"peer %s announced %u modules",node,routes->count);
+	DBGRET_SUCCESS(MOD_MODPEER);
+}
+
+/*
+   modpeer_route
+
+   Finds the peer that announced a module, peer is set to its index (used by
+   modpeer_send). Fails when no peer that is up announced it.
+*/
+wstatus
+modpeer_route(modpeer_t peers,const char *mod_name,unsigned int *peer)
+{
+	uint64_t now_ns;
+	uint32_t hash;
+	unsigned int i;
+
+	if( !peers || !mod_name || !peer ) {
+		dbgprint(MOD_MODPEER,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	hash = _modpeer_hash(mod_name);
+	now_ns = _modpeer_now_ns();
+
+	wlock_acquire(&peers->lock);
+	for( i = 0 ; i < peers->link_count ; i++ )
+	{
+		if( _modpeer_link_up(peers,&peers->link_list[i],now_ns) &&
+			_modpeer_routes_find(peers->link_list[i].routes,mod_name,hash) ) {
+			wlock_release(&peers->lock);
+			*peer = i;
+			return WSTATUS_SUCCESS;
+		}
+	}
+	wlock_release(&peers->lock);
+
+	return WSTATUS_FAILURE;
+}
+
+/*
+   modpeer_send
+
+   Forwards a text request (text_size doesn't include the null char) to a
+   peer. It's added to the batch of the link, when the link isn't sending
+   (and linger_us is 0) the batch is sent at once by the caller. Returns
+   when the request was copied, the datagram errors are only counted (see
+   modpeer_status), like the lost datagrams.
+*/
+wstatus
+modpeer_send(modpeer_t peers,unsigned int peer,const char *text_ptr,unsigned int text_size)
+{
+	modpeer_link_t *link;
+	unsigned int size = text_size + 1;
+	unsigned int used;
+	wstatus ws;
+
+	if( !peers || !text_ptr ) {
+		dbgprint(MOD_MODPEER,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&peers->lock);
+
+	if( peer >= peers->link_count ) {
+		wlock_release(&peers->lock);
+		dbgprint(MOD_MODPEER,__func__,"invalid peer argument (%u)",peer);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+	link = &peers->link_list[peer];
+
+	/* requests larger than a batch get their own datagram */
+	if( size > peers->batch_size )
+	{
+		wlock_release(&peers->lock);
+		ws = wchannel_send(peers->wch,link->dest,(void*)text_ptr,size,&used);
+		wlock_acquire(&peers->lock);
+		link->datagrams++;
+		link->requests++;
+		if( ws != WSTATUS_SUCCESS )
+			link->errors++;
+		wlock_release(&peers->lock);
+		return ws;
+	}
+
+	/* the batch is full, wait for the datagram being sent or send it */
+	while( link->used + size > peers->batch_size )
+	{
+		if( !link->sending )
+			_modpeer_drain(peers,link);
+		else
+			wcond_wait(&peers->sent,&peers->lock);
+	}
+
+	memcpy(link->buf_list[link->fill] + link->used,text_ptr,text_size);
+	link->buf_list[link->fill][link->used + text_size] = '\0';
+	link->used += size;
+	link->count++;
+
+	if( !link->sending )
+	{
+		if( !peers->linger_us || peers->stopping )
+			_modpeer_drain(peers,link);
+		else if( link->count == 1 ) {
+			link->first_ns = _modpeer_now_ns();
+			wcond_signal(&peers->wakeup);
+		}
+	}
+
+	wlock_release(&peers->lock);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   modpeer_status
+
+   Fills list with the state and counters of up to list_size peers, count is
+   set to the number of peers.
+*/
+wstatus
+modpeer_status(modpeer_t peers,modpeer_status_t *list,unsigned int list_size,unsigned int *count)
+{
+	modpeer_link_t *link;
+	uint64_t now_ns;
+	unsigned int i;
+
+	dbgprint(MOD_MODPEER,__func__,"called with peers=%p, list=%p, list_size=%u, count=%p",
+			peers,list,list_size,count);
+
+	if( !peers || (!list && list_size) || !count ) {
+		dbgprint(MOD_MODPEER,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	now_ns = _modpeer_now_ns();
+
+	wlock_acquire(&peers->lock);
+	for( i = 0 ; (i < peers->link_count) && (i < list_size) ; i++ )
+	{
+		link = &peers->link_list[i];
+		memset(&list[i],0,sizeof(modpeer_status_t));
+		strcpy(list[i].node,link->node);
+		strcpy(list[i].host,link->host);
+		strcpy(list[i].port,link->port);
+		list[i].up = _modpeer_link_up(peers,link,now_ns);
+		list[i].modules = link->routes ? link->routes->count : 0;
+		list[i].summaries = link->summaries;
+		list[i].requests = link->requests;
+		list[i].datagrams = link->datagrams;
+		list[i].errors = link->errors;
+	}
+	*count = peers->link_count;
+	wlock_release(&peers->lock);
+
+	DBGRET_SUCCESS(MOD_MODPEER);
+}
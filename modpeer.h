@@ -0,0 +1,115 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Peering of modmgr instances (nodes). Each node only knows its own
+   registered modules, peering lets a request reach a module registered in
+   another node without relays: every node sends a summary of its modules to
+   its peers (request peer.summary to modmgr, with the node name and the
+   module names) every summary_ms, and right away to a peer just added, and
+   keeps a routing table with the modules of each peer. A request whose destination isn't registered locally is
+   forwarded to the peer that announced it.
+
+   Links are UDP, a peer is the address of the remote receivers of its
+   modmgr (see modmgr_load_t.bind_port). Requests are sent in text form, the
+   requests forwarded to the same peer while a datagram is being sent are
+   batched in the next one ('\0' delimited, up to batch_size bytes), so the
+   batching doesn't delay a lone request. With linger_us the first request
+   of a batch waits that long for others before the datagram is sent.
+
+   Summaries only announce the local modules, a route has a single hop and
+   a forwarded request is never forwarded again (modmgr only forwards the
+   requests of local modules, see _request_route). The id, source and
+   destination of a request cross the link unchanged, the reply is routed
+   back to the source node by the name of the source module, like any other
+   request. The names of the modules must be unique in the federation, the
+   first peer (in the order they were added) announcing a name gets its
+   requests.
+
+   A peer without summaries for three summary intervals is down and its
+   routes are ignored until the next one arrives.
+*/
+
+#ifndef _MODPEER_H
+#define _MODPEER_H
+
+#include <stdbool.h>
+#include "wstatus.h"
+#include "req.h"
+
+#define MODPEER_MAXPEERS 16
+#define MODPEER_MAXMODULES 256			/* names announced by each peer */
+#define MODPEER_NODESIZE 32
+#define MODPEER_HOSTSIZE 128
+#define MODPEER_PORTSIZE 32
+#define MODPEER_DEFAULT_SUMMARY_MS 1000
+#define MODPEER_DEFAULT_BATCH_SIZE 8192
+#define MODPEER_MAXBATCH_SIZE 65000
+
+typedef struct _modpeer_addr_t
+{
+	const char *node;
+	const char *host;
+	const char *port;
+} modpeer_addr_t;
+
+typedef struct _modpeer_opt_t
+{
+	const char *node;					/* name of this node, 0 disables peering */
+	const char *host_src;				/* source address of the links, 0 = any */
+	unsigned int summary_ms;			/* 0 = MODPEER_DEFAULT_SUMMARY_MS */
+	unsigned int linger_us;				/* 0 = batch only while sending */
+	unsigned int batch_size;			/* 0 = MODPEER_DEFAULT_BATCH_SIZE */
+	const modpeer_addr_t *peer_list;
+	unsigned int peer_count;
+} modpeer_opt_t;
+
+typedef struct _modpeer_status_t
+{
+	char node[MODPEER_NODESIZE];
+	char host[MODPEER_HOSTSIZE];
+	char port[MODPEER_PORTSIZE];
+	bool up;
+	unsigned int modules;				/* announced in the last summary */
+	unsigned long summaries;			/* received */
+	unsigned long requests;				/* forwarded */
+	unsigned long datagrams;
+	unsigned long errors;				/* failed datagrams */
+} modpeer_status_t;
+
+/*
+   Called by the peer thread before each summary, it writes the names of the
+   local modules in buf separated by colons and returns the size used.
+*/
+typedef unsigned int (*MODPEERSUMMARYCB)(void *param,char *buf,unsigned int buf_size);
+
+typedef struct _modpeer_t *modpeer_t;
+
+wstatus modpeer_create(const modpeer_opt_t *opt,MODPEERSUMMARYCB summary_cb,void *param,modpeer_t *peers);
+wstatus modpeer_stop(modpeer_t peers);
+wstatus modpeer_destroy(modpeer_t peers);
+wstatus modpeer_add(modpeer_t peers,const char *node,const char *host,const char *port);
+wstatus modpeer_learn(modpeer_t peers,const char *node,const char *modules);
+wstatus modpeer_route(modpeer_t peers,const char *mod_name,unsigned int *peer);
+wstatus modpeer_send(modpeer_t peers,unsigned int peer,const char *text_ptr,unsigned int text_size);
+wstatus modpeer_status(modpeer_t peers,modpeer_status_t *list,unsigned int list_size,unsigned int *count);
+
+#endif
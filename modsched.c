@@ -0,0 +1,505 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "wcond.h"
+#include "req.h"
+#include "modsched.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#include <time.h>
+#endif
+
+typedef struct _modsched_entry_t
+{
+	request_t req;
+	unsigned int cost;
+	uint64_t enqueue_ns;
+	struct _modsched_entry_t *next;
+} modsched_entry_t;
+
+/* queue of a source module inside a class, exists while it has requests */
+typedef struct _modsched_flow_t
+{
+	char src[REQMODSIZE + 1];
+	unsigned int hash;
+	modsched_entry_t *head;
+	modsched_entry_t *tail;
+	unsigned int deficit;
+	bool in_turn;				/* quantum was given for the current turn */
+	bool active;				/* flow is in the active list */
+	struct _modsched_flow_t *next_active;
+	struct _modsched_flow_t *next_hash;
+} modsched_flow_t;
+
+typedef struct _modsched_class_t
+{
+	modsched_flow_t *flows[MODSCHED_FLOWHASH];	/* hash chains of the flows */
+	modsched_flow_t *active_head;	/* round-robin order */
+	modsched_flow_t *active_tail;
+	unsigned int depth;
+	unsigned long enqueued;
+	unsigned long dispatched;
+	uint64_t wait_total_ns;
+	uint64_t wait_max_ns;
+} modsched_class_t;
+
+struct _modsched_t
+{
+	unsigned int quantum;
+	wlock_t lock;
+	wcond_t cond;
+	bool stopped;
+	unsigned int depth;
+	modsched_class_t classes[MODSCHED_CLASS_COUNT];
+};
+
+/*
+   _modsched_now_ns
+
+   Helper function that returns the monotonic clock in nanoseconds.
+*/
+static uint64_t
+_modsched_now_ns(void)
+{
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+	return (uint64_t)GetTickCount64() * 1000000ULL;
+#endif
+}
+
+/*
+   _modsched_flow_find
+
+   Helper function that returns the flow of a source module in a class, the
+   flow is created the first time. Flows are kept in hash chains (FNV-1a
+   hash of the name, up to REQMODSIZE chars) and freed when they become
+   empty, each source with queued requests has its own flow. Returns 0 if
+   malloc fails.
+*/
+static modsched_flow_t *
+_modsched_flow_find(modsched_class_t *cls,const char *src)
+{
+	uint32_t hash = 2166136261u;
+	modsched_flow_t *flow;
+	unsigned int i;
+
+	for( i = 0 ; (i < REQMODSIZE) && src[i] ; i++ )
+		hash = (hash ^ (uint8_t)src[i]) * 16777619u;
+	hash %= MODSCHED_FLOWHASH;
+
+	for( flow = cls->flows[hash] ; flow ; flow = flow->next_hash )
+	{
+		if( !strncmp(flow->src,src,REQMODSIZE) )
+			return flow;
+	}
+
+	flow = (modsched_flow_t*)malloc(sizeof(modsched_flow_t));
+	if( !flow ) {
+		dbgprint(MOD_MODSCHED,__func__,"malloc failed");
+		return 0;
+	}
+	memset(flow,0,sizeof(modsched_flow_t));
+
+	strncpy(flow->src,src,REQMODSIZE);
+	flow->src[REQMODSIZE] = '\0';
+	flow->hash = hash;
+	flow->next_hash = cls->flows[hash];
+	cls->flows[hash] = flow;
+
+	return flow;
+}
+
+/*
+   _modsched_flow_free
+
+   Helper function that takes an empty flow out of its hash chain and frees
+   it.
+*/
+static void
+_modsched_flow_free(modsched_class_t *cls,modsched_flow_t *flow)
+{
+	modsched_flow_t **link = &cls->flows[flow->hash];
+
+	while( *link != flow )
+		link = &(*link)->next_hash;
+	*link = flow->next_hash;
+
+	free(flow);
+}
+
+/*
+   _modsched_class_pop
+
+   Helper function that takes the next request of a class by deficit round
+   robin. The flow at the head of the active list receives the quantum when
+   its turn starts and keeps the turn while the cost of its next request
+   fits in the deficit, then it goes to the tail. Flows leave the active list
+   and are freed (losing their deficit) when they become empty.
+*/
+static modsched_entry_t *
+_modsched_class_pop(modsched_t sched,modsched_class_t *cls)
+{
+	modsched_flow_t *flow;
+	modsched_entry_t *entry;
+
+	while( (flow = cls->active_head) )
+	{
+		if( !flow->in_turn ) {
+			flow->deficit += sched->quantum;
+			flow->in_turn = true;
+		}
+
+		entry = flow->head;
+		if( entry->cost <= flow->deficit )
+		{
+			flow->deficit -= entry->cost;
+			flow->head = entry->next;
+			if( !flow->head )
+			{
+				/* empty flow leaves the active list */
+				cls->active_head = flow->next_active;
+				if( !cls->active_head )
+					cls->active_tail = 0;
+				_modsched_flow_free(cls,flow);
+			}
+			return entry;
+		}
+
+		/* turn is over, move the flow to the tail */
+		flow->in_turn = false;
+		if( flow->next_active ) {
+			cls->active_head = flow->next_active;
+			flow->next_active = 0;
+			cls->active_tail->next_active = flow;
+			cls->active_tail = flow;
+		}
+	}
+
+	return 0;
+}
+
+/*
+   _modsched_take
+
+   Helper function that takes the next entry of the highest class with
+   requests and updates the class statistics. Must be called with the lock
+   acquired.
+*/
+static modsched_entry_t *
+_modsched_take(modsched_t sched)
+{
+	modsched_entry_t *entry = 0;
+	modsched_class_t *cls = 0;
+	uint64_t wait_ns;
+	unsigned int i;
+
+	for( i = 0 ; i < MODSCHED_CLASS_COUNT ; i++ ) {
+		cls = &sched->classes[i];
+		entry = _modsched_class_pop(sched,cls);
+		if( entry )
+			break;
+	}
+
+	if( !entry )
+		return 0;
+
+	wait_ns = _modsched_now_ns() - entry->enqueue_ns;
+	cls->depth--;
+	cls->dispatched++;
+	cls->wait_total_ns += wait_ns;
+	if( wait_ns > cls->wait_max_ns )
+		cls->wait_max_ns = wait_ns;
+	sched->depth--;
+
+	return entry;
+}
+
+/*
+   modsched_create
+
+   Creates a new scheduler with the given options (0 for the defaults).
+*/
+wstatus
+modsched_create(const modsched_opt_t *opt,modsched_t *sched)
+{
+	modsched_t new_sched;
+	wstatus ws;
+
+	dbgprint(MOD_MODSCHED,__func__,"called with opt=%p, sched=%p",opt,sched);
+
+	if( !sched ) {
+		dbgprint(MOD_MODSCHED,__func__,"invalid sched argument (sched=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_sched = (modsched_t)malloc(sizeof(struct _modsched_t));
+	if( !new_sched ) {
+		dbgprint(MOD_MODSCHED,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODSCHED);
+	}
+	memset(new_sched,0,sizeof(struct _modsched_t));
+
+	new_sched->quantum = (opt && opt->quantum) ? opt->quantum : MODSCHED_DEFAULT_QUANTUM;
+
+	ws = wlock_create(&new_sched->lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODSCHED,__func__,"failed to create lock (ws=%s)",wstatus_str(ws));
+		free(new_sched);
+		DBGRET_FAILURE(MOD_MODSCHED);
+	}
+
+	ws = wcond_create(&new_sched->cond);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_MODSCHED,__func__,"failed to create condition (ws=%s)",wstatus_str(ws));
+		wlock_free(&new_sched->lock);
+		free(new_sched);
+		DBGRET_FAILURE(MOD_MODSCHED);
+	}
+
+	dbgprint(MOD_MODSCHED,__func__,"created scheduler (sched=%p, quantum=%u)",new_sched,new_sched->quantum);
+	*sched = new_sched;
+	DBGRET_SUCCESS(MOD_MODSCHED);
+}
+
+/*
+   modsched_destroy
+
+   Frees the scheduler, requests still queued are freed. No thread may be
+   using the scheduler (stop it and wait for the dispatch thread first).
+*/
+wstatus
+modsched_destroy(modsched_t sched)
+{
+	modsched_entry_t *entry;
+	modsched_flow_t *flow;
+	unsigned int i, j, dropped = 0;
+
+	dbgprint(MOD_MODSCHED,__func__,"called with sched=%p",sched);
+
+	if( !sched ) {
+		dbgprint(MOD_MODSCHED,__func__,"invalid sched argument (sched=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	for( i = 0 ; i < MODSCHED_CLASS_COUNT ; i++ )
+	{
+		for( j = 0 ; j < MODSCHED_FLOWHASH ; j++ )
+		{
+			while( (flow = sched->classes[i].flows[j]) ) {
+				sched->classes[i].flows[j] = flow->next_hash;
+				while( (entry = flow->head) ) {
+					flow->head = entry->next;
+					req_free(entry->req);
+					free(entry);
+					dropped++;
+				}
+				free(flow);
+			}
+		}
+	}
+
+	if( dropped )
+		dbgprint(MOD_MODSCHED,__func__,"freed %u requests that were still queued",dropped);
+
+	wcond_free(&sched->cond);
+	wlock_free(&sched->lock);
+	free(sched);
+	DBGRET_SUCCESS(MOD_MODSCHED);
+}
+
+/*
+   modsched_enqueue
+
+   Queues a request of src in a class, cost is the weight of the request in
+   the round-robin (at least 1). The scheduler owns the request until it's
+   dequeued.
+*/
+wstatus
+modsched_enqueue(modsched_t sched,request_t req,const char *src,modsched_class_list sched_class,unsigned int cost)
+{
+	modsched_entry_t *entry;
+	modsched_class_t *cls;
+	modsched_flow_t *flow;
+
+	if( !sched || !req || !src || (sched_class >= MODSCHED_CLASS_COUNT) ) {
+		dbgprint(MOD_MODSCHED,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	entry = (modsched_entry_t*)malloc(sizeof(modsched_entry_t));
+	if( !entry ) {
+		dbgprint(MOD_MODSCHED,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODSCHED);
+	}
+
+	entry->req = req;
+	entry->cost = cost ? cost : 1;
+	entry->enqueue_ns = _modsched_now_ns();
+	entry->next = 0;
+
+	wlock_acquire(&sched->lock);
+
+	if( sched->stopped ) {
+		wlock_release(&sched->lock);
+		free(entry);
+		dbgprint(MOD_MODSCHED,__func__,"scheduler was stopped");
+		DBGRET_FAILURE(MOD_MODSCHED);
+	}
+
+	cls = &sched->classes[sched_class];
+	flow = _modsched_flow_find(cls,src);
+	if( !flow ) {
+		wlock_release(&sched->lock);
+		free(entry);
+		DBGRET_FAILURE(MOD_MODSCHED);
+	}
+
+	if( flow->tail )
+		flow->tail->next = entry;
+	else
+		flow->head = entry;
+	flow->tail = entry;
+
+	if( !flow->active ) {
+		flow->active = true;
+		flow->next_active = 0;
+		if( cls->active_tail )
+			cls->active_tail->next_active = flow;
+		else
+			cls->active_head = flow;
+		cls->active_tail = flow;
+	}
+
+	cls->depth++;
+	cls->enqueued++;
+	sched->depth++;
+
+	wcond_signal(&sched->cond);
+	wlock_release(&sched->lock);
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   modsched_dequeue
+
+   Takes the next request to dispatch, waits if the scheduler is empty. The
+   highest class with requests is served first. Returns failure when the
+   scheduler was stopped.
+*/
+wstatus
+modsched_dequeue(modsched_t sched,request_t *req)
+{
+	modsched_entry_t *entry = 0;
+
+	if( !sched || !req ) {
+		dbgprint(MOD_MODSCHED,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&sched->lock);
+
+	while( !sched->depth && !sched->stopped )
+		wcond_wait(&sched->cond,&sched->lock);
+
+	if( sched->stopped ) {
+		wlock_release(&sched->lock);
+		dbgprint(MOD_MODSCHED,__func__,"scheduler was stopped");
+		DBGRET_FAILURE(MOD_MODSCHED);
+	}
+
+	entry = _modsched_take(sched);
+
+	/* depth > 0 so some class must have an entry */
+	if( !entry ) {
+		wlock_release(&sched->lock);
+		dbgprint(MOD_MODSCHED,__func__,"queue depth is %u but no request was found",sched->depth);
+		DBGRET_FAILURE(MOD_MODSCHED);
+	}
+
+	wlock_release(&sched->lock);
+
+	*req = entry->req;
+	free(entry);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   modsched_stop
+
+   Stops the scheduler, the threads waiting in modsched_dequeue return with
+   failure and new requests are refused.
+*/
+wstatus
+modsched_stop(modsched_t sched)
+{
+	dbgprint(MOD_MODSCHED,__func__,"called with sched=%p",sched);
+
+	if( !sched ) {
+		dbgprint(MOD_MODSCHED,__func__,"invalid sched argument (sched=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&sched->lock);
+	sched->stopped = true;
+	wcond_broadcast(&sched->cond);
+	wlock_release(&sched->lock);
+
+	DBGRET_SUCCESS(MOD_MODSCHED);
+}
+
+/*
+   modsched_status
+
+   Returns the queue depth, counters and wait times of a class.
+*/
+wstatus
+modsched_status(modsched_t sched,modsched_class_list sched_class,modsched_status_t *status)
+{
+	modsched_class_t *cls;
+
+	if( !sched || !status || (sched_class >= MODSCHED_CLASS_COUNT) )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	wlock_acquire(&sched->lock);
+	cls = &sched->classes[sched_class];
+	status->depth = cls->depth;
+	status->enqueued = cls->enqueued;
+	status->dispatched = cls->dispatched;
+	status->wait_avg_us = cls->dispatched ? cls->wait_total_ns / cls->dispatched / 1000 : 0;
+	status->wait_max_us = cls->wait_max_ns / 1000;
+	wlock_release(&sched->lock);
+
+	return WSTATUS_SUCCESS;
+}
+
@@ -0,0 +1,93 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Dispatch scheduler of modmgr. The request processor used to handle the
+   requests in strict FIFO order, so bulk work (an inventory dump, a big
+   stream) delayed the control traffic (registryModule, UI queries) queued
+   behind it.
+
+   Requests are queued by the modmgr reader thread and taken by the dispatch
+   thread. Each request is queued in a priority class:
+
+   MODSCHED_CLASS_CONTROL	control plane codes (module registration and
+							lookup) and modules registered as control.
+   MODSCHED_CLASS_NORMAL	default class of the modules.
+   MODSCHED_CLASS_BULK		modules registered as bulk.
+
+   Classes are strict priorities, a request of a lower class is only
+   dispatched when the higher classes are empty. Inside a class the source
+   modules are served by deficit round-robin: each source has its own queue
+   and receives quantum cost units per round, a request is dispatched when
+   its cost fits in the deficit of its source. A source sending many (or big)
+   requests can't starve the other sources of its class.
+
+   The scheduler keeps per class statistics: queue depth, requests queued
+   and dispatched and the time requests waited in the queue.
+*/
+
+#ifndef _MODSCHED_H
+#define _MODSCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wstatus.h"
+#include "req.h"
+
+#define MODSCHED_FLOWHASH 64		/* hash chains of the source flows per class */
+#define MODSCHED_DEFAULT_QUANTUM 4
+
+typedef enum _modsched_class_list
+{
+	MODSCHED_CLASS_CONTROL,
+	MODSCHED_CLASS_NORMAL,
+	MODSCHED_CLASS_BULK,
+	MODSCHED_CLASS_COUNT
+} modsched_class_list;
+
+#define modsched_class_str(x) ( x == MODSCHED_CLASS_CONTROL ? "control" : \
+		x == MODSCHED_CLASS_NORMAL ? "normal" : "bulk" )
+
+typedef struct _modsched_opt_t
+{
+	unsigned int quantum;		/* cost units per source per round, 0 = default */
+} modsched_opt_t;
+
+typedef struct _modsched_status_t
+{
+	unsigned int depth;			/* requests queued now */
+	unsigned long enqueued;
+	unsigned long dispatched;
+	uint64_t wait_avg_us;		/* average wait in the queue */
+	uint64_t wait_max_us;
+} modsched_status_t;
+
+typedef struct _modsched_t *modsched_t;
+
+wstatus modsched_create(const modsched_opt_t *opt,modsched_t *sched);
+wstatus modsched_destroy(modsched_t sched);
+wstatus modsched_enqueue(modsched_t sched,request_t req,const char *src,modsched_class_list sched_class,unsigned int cost);
+wstatus modsched_dequeue(modsched_t sched,request_t *req);
+wstatus modsched_stop(modsched_t sched);
+wstatus modsched_status(modsched_t sched,modsched_class_list sched_class,modsched_status_t *status);
+
+#endif
+
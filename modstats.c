@@ -0,0 +1,546 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "watomic.h"
+#include "req.h"
+#include "modstats.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#include <time.h>
+#endif
+
+#if (defined POSH_OS_WIN32 || defined POSH_OS_WIN64)
+#define MODSTATS_TLS __declspec(thread)
+#else
+#define MODSTATS_TLS __thread
+#endif
+
+typedef struct _modstats_hist_t
+{
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint32_t buckets[MODSTATS_BUCKETS];
+} modstats_hist_t;
+
+typedef struct _modstats_pair_t
+{
+	char dst[REQMODSIZE];
+	char code[REQCODESIZE];
+	uint64_t count;
+	uint64_t errors;
+	uint64_t expired;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	modstats_hist_t queue;
+	modstats_hist_t handler;
+	modstats_hist_t total;
+} modstats_pair_t;
+
+typedef struct _modstats_shard_t
+{
+	long epoch;
+	modstats_pair_t *pairs[MODSTATS_MAXPAIRS];	/* open addressed, written by the owner only */
+	modstats_pair_t overflow;
+	struct _modstats_shard_t *next;
+} modstats_shard_t;
+
+/* shards are only added (lock-free push) and freed by modstats_unload */
+static modstats_shard_t *shard_list = 0;
+static watomic_t stats_epoch = 0;
+static watomic_t stats_gen = 0;			/* changes on every load, invalidates the tls shards */
+static bool loaded = false;
+
+static MODSTATS_TLS modstats_shard_t *tls_shard = 0;
+static MODSTATS_TLS long tls_gen = 0;
+
+/*
+   modstats_now_ns
+
+   Returns the monotonic clock in nanoseconds, the clock of the samples.
+*/
+uint64_t
+modstats_now_ns(void)
+{
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+	return (uint64_t)GetTickCount64() * 1000000ULL;
+#endif
+}
+
+/*
+   _modstats_bucket
+
+   Helper function that returns the histogram bucket of a value (us). Values
+   under MODSTATS_SUBBUCKETS have a bucket each, above that each power of two
+   has MODSTATS_SUBBUCKETS buckets.
+*/
+static unsigned int
+_modstats_bucket(uint64_t value)
+{
+	unsigned int msb;
+
+	if( value > 0xFFFFFFFFULL )
+		value = 0xFFFFFFFFULL;
+
+	if( value < MODSTATS_SUBBUCKETS )
+		return (unsigned int)value;
+
+	for( msb = MODSTATS_SUBBITS ; (value >> (msb + 1)) ; msb++ );
+
+	return (msb - MODSTATS_SUBBITS + 1) * MODSTATS_SUBBUCKETS +
+		(unsigned int)((value >> (msb - MODSTATS_SUBBITS)) & (MODSTATS_SUBBUCKETS - 1));
+}
+
+/*
+   _modstats_bucket_high
+
+   Helper function that returns the highest value (us) kept in a bucket.
+*/
+static uint64_t
+_modstats_bucket_high(unsigned int idx)
+{
+	unsigned int msb, sub;
+
+	if( idx < MODSTATS_SUBBUCKETS )
+		return idx;
+
+	msb = idx / MODSTATS_SUBBUCKETS + MODSTATS_SUBBITS - 1;
+	sub = idx % MODSTATS_SUBBUCKETS;
+
+	return (((uint64_t)(MODSTATS_SUBBUCKETS + sub + 1)) << (msb - MODSTATS_SUBBITS)) - 1;
+}
+
+/*
+   _modstats_hist_add
+
+   Helper function that records a value (ns) in a histogram.
+*/
+static void
+_modstats_hist_add(modstats_hist_t *hist,uint64_t value_ns)
+{
+	uint64_t value = value_ns / 1000;
+
+	hist->buckets[_modstats_bucket(value)]++;
+	hist->count++;
+	hist->sum_us += value;
+	if( value > hist->max_us )
+		hist->max_us = value;
+}
+
+/*
+   _modstats_hist_merge
+
+   Helper function that adds the histogram src to dst.
+*/
+static void
+_modstats_hist_merge(modstats_hist_t *dst,const modstats_hist_t *src)
+{
+	unsigned int i;
+
+	for( i = 0 ; i < MODSTATS_BUCKETS ; i++ )
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->sum_us += src->sum_us;
+	if( src->max_us > dst->max_us )
+		dst->max_us = src->max_us;
+}
+
+/*
+   _modstats_hist_percentile
+
+   Helper function that returns the value (us) under which are the given
+   per mille of the samples of a histogram.
+*/
+static uint64_t
+_modstats_hist_percentile(const modstats_hist_t *hist,unsigned int per_mille)
+{
+	uint64_t target, seen = 0, high;
+	unsigned int i;
+
+	if( !hist->count )
+		return 0;
+
+	target = (hist->count * per_mille + 999) / 1000;
+	if( !target )
+		target = 1;
+
+	for( i = 0 ; i < MODSTATS_BUCKETS ; i++ )
+	{
+		seen += hist->buckets[i];
+		if( seen >= target ) {
+			high = _modstats_bucket_high(i);
+			return high < hist->max_us ? high : hist->max_us;
+		}
+	}
+
+	return hist->max_us;
+}
+
+/*
+   _modstats_hist_status
+
+   Helper function that fills the status of a histogram.
+*/
+static void
+_modstats_hist_status(const modstats_hist_t *hist,modstats_hist_status_t *status)
+{
+	status->count = hist->count;
+	status->avg_us = hist->count ? hist->sum_us / hist->count : 0;
+	status->p50_us = _modstats_hist_percentile(hist,500);
+	status->p90_us = _modstats_hist_percentile(hist,900);
+	status->p99_us = _modstats_hist_percentile(hist,990);
+	status->p999_us = _modstats_hist_percentile(hist,999);
+	status->max_us = hist->max_us;
+}
+
+/*
+   _modstats_pair_clear
+
+   Helper function that clears the counters and histograms of a pair, the
+   names are kept.
+*/
+static void
+_modstats_pair_clear(modstats_pair_t *pair)
+{
+	pair->count = 0;
+	pair->errors = 0;
+	pair->expired = 0;
+	pair->bytes_in = 0;
+	pair->bytes_out = 0;
+	memset(&pair->queue,0,sizeof(pair->queue));
+	memset(&pair->handler,0,sizeof(pair->handler));
+	memset(&pair->total,0,sizeof(pair->total));
+}
+
+/*
+   _modstats_shard
+
+   Helper function that returns the shard of the calling thread, creating
+   it the first time (or after a reload). A new epoch clears the shard.
+*/
+static modstats_shard_t *
+_modstats_shard(void)
+{
+	modstats_shard_t *shard = tls_shard;
+	long gen = watomic_get(&stats_gen);
+	long epoch;
+	unsigned int i;
+
+	if( !shard || (tls_gen != gen) )
+	{
+		shard = (modstats_shard_t*)malloc(sizeof(modstats_shard_t));
+		if( !shard ) {
+			dbgprint(MOD_MODSTATS,__func__,"malloc failed");
+			return 0;
+		}
+		memset(shard,0,sizeof(modstats_shard_t));
+		strcpy(shard->overflow.dst,"*");
+		strcpy(shard->overflow.code,"*");
+		shard->epoch = watomic_get(&stats_epoch);
+
+		do {
+			shard->next = shard_list;
+		} while( !watomic_casptr(&shard_list,shard->next,shard) );
+
+		tls_shard = shard;
+		tls_gen = gen;
+		dbgprint(MOD_MODSTATS,__func__,"created statistics shard %p for this thread",shard);
+	}
+
+	epoch = watomic_get(&stats_epoch);
+	if( shard->epoch != epoch )
+	{
+		for( i = 0 ; i < MODSTATS_MAXPAIRS ; i++ )
+			if( shard->pairs[i] )
+				_modstats_pair_clear(shard->pairs[i]);
+		_modstats_pair_clear(&shard->overflow);
+		shard->epoch = epoch;
+	}
+
+	return shard;
+}
+
+/*
+   _modstats_pair_find
+
+   Helper function that returns the pair of a shard, created the first time.
+   Pairs are kept in an open addressed table (FNV-1a hash of the names), the
+   pairs that don't fit share the overflow pair. The new pair is completely
+   written before it's published in the table (snapshots read it).
+*/
+static modstats_pair_t *
+_modstats_pair_find(modstats_shard_t *shard,const char *dst,const char *code)
+{
+	uint32_t hash = 2166136261u;
+	modstats_pair_t *pair;
+	unsigned int i, idx;
+	const char *p;
+
+	for( p = dst ; *p ; p++ )
+		hash = (hash ^ (uint8_t)*p) * 16777619u;
+	hash = (hash ^ ' ') * 16777619u;
+	for( p = code ; *p ; p++ )
+		hash = (hash ^ (uint8_t)*p) * 16777619u;
+
+	for( i = 0 ; i < MODSTATS_MAXPAIRS ; i++ )
+	{
+		idx = (hash + i) % MODSTATS_MAXPAIRS;
+		pair = shard->pairs[idx];
+
+		if( !pair )
+		{
+			pair = (modstats_pair_t*)malloc(sizeof(modstats_pair_t));
+			if( !pair )
+				return &shard->overflow;
+			memset(pair,0,sizeof(modstats_pair_t));
+			strncpy(pair->dst,dst,sizeof(pair->dst)-1);
+			strncpy(pair->code,code,sizeof(pair->code)-1);
+
+			watomic_barrier();
+			shard->pairs[idx] = pair;
+			return pair;
+		}
+
+		if( !strncmp(pair->dst,dst,sizeof(pair->dst)-1) && !strncmp(pair->code,code,sizeof(pair->code)-1) )
+			return pair;
+	}
+
+	return &shard->overflow;
+}
+
+/*
+   modstats_load
+
+   Initializes the statistics, called by modmgr_load.
+*/
+wstatus
+modstats_load(void)
+{
+	dbgprint(MOD_MODSTATS,__func__,"called");
+
+	if( loaded ) {
+		dbgprint(MOD_MODSTATS,__func__,"module is already loaded");
+		DBGRET_FAILURE(MOD_MODSTATS);
+	}
+
+	watomic_inc(&stats_gen);
+	loaded = true;
+	DBGRET_SUCCESS(MOD_MODSTATS);
+}
+
+/*
+   modstats_unload
+
+   Frees the shards, none of the threads may be recording anymore.
+*/
+wstatus
+modstats_unload(void)
+{
+	modstats_shard_t *shard;
+	unsigned int i;
+
+	dbgprint(MOD_MODSTATS,__func__,"called");
+
+	if( !loaded ) {
+		dbgprint(MOD_MODSTATS,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODSTATS);
+	}
+
+	loaded = false;
+
+	while( (shard = shard_list) )
+	{
+		shard_list = shard->next;
+		for( i = 0 ; i < MODSTATS_MAXPAIRS ; i++ )
+			free(shard->pairs[i]);
+		free(shard);
+	}
+
+	DBGRET_SUCCESS(MOD_MODSTATS);
+}
+
+/*
+   modstats_record
+
+   Records a sample of a (destination, code) pair in the shard of the calling
+   thread. Never fails, samples that can't be recorded are ignored.
+*/
+void
+modstats_record(const char *dst,const char *code,const modstats_sample_t *sample)
+{
+	modstats_shard_t *shard;
+	modstats_pair_t *pair;
+
+	if( !loaded || !dst || !code || !sample )
+		return;
+
+	shard = _modstats_shard();
+	if( !shard )
+		return;
+
+	pair = _modstats_pair_find(shard,dst,code);
+
+	pair->count++;
+	if( sample->error )
+		pair->errors++;
+	pair->bytes_in += sample->bytes_in;
+	pair->bytes_out += sample->bytes_out;
+
+	/* expired requests never reached the handler, only the wait is kept */
+	if( sample->expired ) {
+		pair->expired++;
+		if( sample->ingress_ns && (sample->start_ns >= sample->ingress_ns) )
+			_modstats_hist_add(&pair->queue,sample->start_ns - sample->ingress_ns);
+		return;
+	}
+
+	if( sample->end_ns >= sample->start_ns )
+		_modstats_hist_add(&pair->handler,sample->end_ns - sample->start_ns);
+
+	if( sample->ingress_ns && (sample->start_ns >= sample->ingress_ns) )
+		_modstats_hist_add(&pair->queue,sample->start_ns - sample->ingress_ns);
+
+	if( sample->ingress_ns && (sample->end_ns >= sample->ingress_ns) )
+		_modstats_hist_add(&pair->total,sample->end_ns - sample->ingress_ns);
+}
+
+/*
+   modstats_snapshot
+
+   Sums the shards of all the threads and returns the statistics of up to
+   list_size pairs, count is set to the number of pairs returned.
+*/
+wstatus
+modstats_snapshot(modstats_status_t *list,unsigned int list_size,unsigned int *count)
+{
+	modstats_pair_t *sum = 0, *pair;
+	modstats_shard_t *shard;
+	unsigned int sum_count = 0, i, j;
+	long epoch;
+
+	dbgprint(MOD_MODSTATS,__func__,"called with list=%p, list_size=%u, count=%p",list,list_size,count);
+
+	if( !list || !list_size || !count ) {
+		dbgprint(MOD_MODSTATS,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( !loaded ) {
+		dbgprint(MOD_MODSTATS,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODSTATS);
+	}
+
+	sum = (modstats_pair_t*)malloc(list_size * sizeof(modstats_pair_t));
+	if( !sum ) {
+		dbgprint(MOD_MODSTATS,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_MODSTATS);
+	}
+
+	epoch = watomic_get(&stats_epoch);
+
+	for( shard = (modstats_shard_t*)shard_list ; shard ; shard = shard->next )
+	{
+		/* a shard of an older epoch wasn't cleared yet, it counts as empty */
+		if( shard->epoch != epoch )
+			continue;
+
+		for( i = 0 ; i <= MODSTATS_MAXPAIRS ; i++ )
+		{
+			pair = (i < MODSTATS_MAXPAIRS) ? shard->pairs[i] : &shard->overflow;
+			if( !pair || !pair->count )
+				continue;
+			watomic_barrier();
+
+			for( j = 0 ; j < sum_count ; j++ )
+				if( !strcmp(sum[j].dst,pair->dst) && !strcmp(sum[j].code,pair->code) )
+					break;
+
+			if( j == sum_count ) {
+				if( sum_count == list_size )
+					continue;
+				memset(&sum[j],0,sizeof(modstats_pair_t));
+				strcpy(sum[j].dst,pair->dst);
+				strcpy(sum[j].code,pair->code);
+				sum_count++;
+			}
+
+			sum[j].count += pair->count;
+			sum[j].errors += pair->errors;
+			sum[j].expired += pair->expired;
+			sum[j].bytes_in += pair->bytes_in;
+			sum[j].bytes_out += pair->bytes_out;
+			_modstats_hist_merge(&sum[j].queue,&pair->queue);
+			_modstats_hist_merge(&sum[j].handler,&pair->handler);
+			_modstats_hist_merge(&sum[j].total,&pair->total);
+		}
+	}
+
+	for( j = 0 ; j < sum_count ; j++ )
+	{
+		memcpy(list[j].dst,sum[j].dst,sizeof(list[j].dst));
+		memcpy(list[j].code,sum[j].code,sizeof(list[j].code));
+		list[j].count = sum[j].count;
+		list[j].errors = sum[j].errors;
+		list[j].expired = sum[j].expired;
+		list[j].bytes_in = sum[j].bytes_in;
+		list[j].bytes_out = sum[j].bytes_out;
+		_modstats_hist_status(&sum[j].queue,&list[j].queue);
+		_modstats_hist_status(&sum[j].handler,&list[j].handler);
+		_modstats_hist_status(&sum[j].total,&list[j].total);
+	}
+
+	free(sum);
+	*count = sum_count;
+	DBGRET_SUCCESS(MOD_MODSTATS);
+}
+
+/*
+   modstats_reset
+
+   Starts a new epoch, the statistics recorded so far are discarded. Each
+   shard is cleared by its own thread (see _modstats_shard).
+*/
+wstatus
+modstats_reset(void)
+{
+	dbgprint(MOD_MODSTATS,__func__,"called");
+
+	if( !loaded ) {
+		dbgprint(MOD_MODSTATS,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_MODSTATS);
+	}
+
+	watomic_inc(&stats_epoch);
+	DBGRET_SUCCESS(MOD_MODSTATS);
+}
+
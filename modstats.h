@@ -0,0 +1,106 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Request statistics of modmgr. For each (destination module, request code)
+   pair modmgr counts the requests, the errors (not delivered, rejected,
+   busy), the requests dropped past their deadline (see req_deadline_parse)
+   and the bytes received and sent, and keeps three latency histograms:
+
+   queue		from the arrival at modmgr until the handler starts (dispatch
+				scheduler plus inbox of the module).
+   handler		DCR callback time, or send time for SSR modules.
+   total		from the arrival until the handler finished.
+
+   Requests built inside wicom (error replies, events) have no arrival time
+   and only count in the handler histogram.
+
+   The histograms are HDR style (log-linear): values in microseconds, each
+   power of two is split in MODSTATS_SUBBUCKETS linear buckets, so every
+   value is kept with a relative error under 1/MODSTATS_SUBBUCKETS from 1us
+   up to ~70 minutes in a fixed 960 bytes per histogram.
+
+   Recording is lock-free: each thread records into a shard of its own
+   (created the first time it records) and nothing is shared between the
+   recording threads. modstats_snapshot sums the shards, it may see a
+   sample half recorded, which is fine for statistics. modstats_reset
+   doesn't touch the shards, it starts a new epoch and each shard clears
+   itself the next time its thread records.
+*/
+
+#ifndef _MODSTATS_H
+#define _MODSTATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "wstatus.h"
+#include "req.h"
+
+#define MODSTATS_SUBBITS 3
+#define MODSTATS_SUBBUCKETS (1 << MODSTATS_SUBBITS)
+#define MODSTATS_BUCKETS ((32 - MODSTATS_SUBBITS + 1) * MODSTATS_SUBBUCKETS)
+#define MODSTATS_MAXPAIRS 256			/* per shard, the rest share one entry */
+
+typedef struct _modstats_sample_t
+{
+	uint64_t ingress_ns;				/* 0 = unknown, only handler is recorded */
+	uint64_t start_ns;					/* handler start */
+	uint64_t end_ns;					/* handler end */
+	unsigned int bytes_in;
+	unsigned int bytes_out;
+	bool error;
+	bool expired;						/* dropped at start_ns, the handler didn't run */
+} modstats_sample_t;
+
+typedef struct _modstats_hist_status_t
+{
+	uint64_t count;
+	uint64_t avg_us;
+	uint64_t p50_us;
+	uint64_t p90_us;
+	uint64_t p99_us;
+	uint64_t p999_us;
+	uint64_t max_us;
+} modstats_hist_status_t;
+
+typedef struct _modstats_status_t
+{
+	char dst[REQMODSIZE];
+	char code[REQCODESIZE];
+	uint64_t count;
+	uint64_t errors;
+	uint64_t expired;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	modstats_hist_status_t queue;
+	modstats_hist_status_t handler;
+	modstats_hist_status_t total;
+} modstats_status_t;
+
+wstatus modstats_load(void);
+wstatus modstats_unload(void);
+uint64_t modstats_now_ns(void);
+void modstats_record(const char *dst,const char *code,const modstats_sample_t *sample);
+wstatus modstats_snapshot(modstats_status_t *list,unsigned int list_size,unsigned int *count);
+wstatus modstats_reset(void);
+
+#endif
+
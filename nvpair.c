@@ -26,6 +26,15 @@
 #include "debug.h"
 #include "nvpair.h"
 
+/*
+   _nvp_alloc
+
+   Helper function to allocate a new nvpair data structure with room for a
+   name of name_size bytes and a value of value_size bytes. Short names and
+   values are stored inline in the nvpair (see NVPAIR_INLINE_*), so the common
+   case is a single allocation. Larger names go to the heap and larger values
+   to a private value blob. Use _nvp_fill to copy the name and value.
+*/
 wstatus
 _nvp_alloc(uint16_t name_size,uint16_t value_size,nvpair_t *nvp)
 {
@@ -56,16 +65,23 @@ _nvp_alloc(uint16_t name_size,uint16_t value_size,nvpair_t *nvp)
 
 	new_nvp->name_ptr = 0;
 	new_nvp->name_size = 0;
+	new_nvp->name_id = REQNAME_UNKNOWN;
 	new_nvp->value_ptr = 0;
 	new_nvp->value_size = 0;
-
-	new_nvp->name_ptr = (char*)malloc(name_size);
-	if( !new_nvp->name_ptr ) {
-		dbgprint(MOD_NVPAIR,__func__,"malloc failed");
-		goto return_fail_malloc;
+	new_nvp->value_blob = 0;
+
+	if( name_size <= sizeof(new_nvp->name_inline) ) {
+		new_nvp->name_ptr = new_nvp->name_inline;
+		dbgprint(MOD_NVPAIR,__func__,"name of nvpair=%p stored inline (%u bytes)",new_nvp,name_size);
+	} else {
+		new_nvp->name_ptr = (char*)malloc(name_size);
+		if( !new_nvp->name_ptr ) {
+			dbgprint(MOD_NVPAIR,__func__,"malloc failed");
+			goto return_fail_malloc;
+		}
+		dbgprint(MOD_NVPAIR,__func__,"allocated %u bytes for name of nvpair=%p",
+				name_size,new_nvp);
 	}
-	dbgprint(MOD_NVPAIR,__func__,"allocated %u bytes for name of nvpair=%p",
-			name_size,new_nvp);
 
 	new_nvp->name_size = name_size;
 	dbgprint(MOD_NVPAIR,__func__,"changed nvpair (%p) name size to %u",
@@ -73,13 +89,18 @@ _nvp_alloc(uint16_t name_size,uint16_t value_size,nvpair_t *nvp)
 
 	if( value_size )
 	{
-		new_nvp->value_ptr = malloc(value_size);
-		if( !new_nvp->value_ptr ) {
-			dbgprint(MOD_NVPAIR,__func__,"malloc failed");
-			goto return_fail_malloc;
+		if( value_size <= sizeof(new_nvp->value_inline) ) {
+			new_nvp->value_ptr = new_nvp->value_inline;
+			dbgprint(MOD_NVPAIR,__func__,"value of nvpair=%p stored inline (%u bytes)",new_nvp,value_size);
+		} else {
+			if( _nvp_blob_alloc(value_size,&new_nvp->value_blob) != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_NVPAIR,__func__,"failed to allocate value blob");
+				goto return_fail_malloc;
+			}
+			new_nvp->value_ptr = new_nvp->value_blob->data;
+			dbgprint(MOD_NVPAIR,__func__,"allocated %d bytes for value of nvpair=%p",
+					value_size,new_nvp);
 		}
-		dbgprint(MOD_NVPAIR,__func__,"allocated %d bytes for value of nvpair=%p",
-				value_size,new_nvp);
 
 		new_nvp->value_size = value_size;
 		dbgprint(MOD_NVPAIR,__func__,"changed nvpair (%p) value size to %u",
@@ -93,12 +114,12 @@ _nvp_alloc(uint16_t name_size,uint16_t value_size,nvpair_t *nvp)
 	DBGRET_SUCCESS(MOD_NVPAIR);
 
 return_fail_malloc:
-	if( new_nvp->name_ptr ) {
+	if( new_nvp->name_ptr && !nvp_name_is_inline(new_nvp) ) {
 		free(new_nvp->name_ptr);
 	}
 
-	if( new_nvp->value_ptr ) {
-		free(new_nvp->value_ptr);
+	if( new_nvp->value_blob ) {
+		_nvp_blob_unref(new_nvp->value_blob);
 	}
 
 	free(new_nvp);
@@ -107,6 +128,223 @@ return_fail:
 	DBGRET_FAILURE(MOD_NVPAIR);
 }
 
+/*
+   _nvp_alloc_decoded
+
+   Helper function to allocate a new nvpair from the name and the encoded value
+   (#HEX) found in a text request. The value is decoded straight into the nvpair
+   storage, without any temporary buffer.
+*/
+wstatus
+_nvp_alloc_decoded(const char *name_ptr,uint16_t name_size,const char *encoded_ptr,uint16_t encoded_size,nvpair_t *nvp)
+{
+	nvpair_t new_nvp = 0;
+	unsigned int decoded_size;
+	wstatus ws;
+
+	dbgprint(MOD_NVPAIR,__func__,"called with name_ptr=%p, name_size=%u, encoded_ptr=%p, encoded_size=%u, nvp=%p",
+			name_ptr,name_size,encoded_ptr,encoded_size,nvp);
+
+	if( !name_ptr || !name_size ) {
+		dbgprint(MOD_NVPAIR,__func__,"invalid argument name_ptr or name_size=0");
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	if( !encoded_ptr ) {
+		dbgprint(MOD_NVPAIR,__func__,"invalid argument encoded_ptr (encoded_ptr=0)");
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	if( !nvp ) {
+		dbgprint(MOD_NVPAIR,__func__,"invalid argument nvp (nvp=0)");
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	ws = _nvp_value_decoded_size(encoded_ptr,encoded_size,&decoded_size);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_NVPAIR,__func__,"failed to get decoded size (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	ws = _nvp_alloc(name_size,decoded_size,&new_nvp);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_NVPAIR,__func__,"failed to allocate new nvpair (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	memcpy(new_nvp->name_ptr,name_ptr,name_size);
+	new_nvp->name_id = reqid_name_lookup(name_ptr,name_size);
+
+	if( decoded_size )
+	{
+		ws = _nvp_value_decode(encoded_ptr,encoded_size,new_nvp->value_ptr,decoded_size);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_NVPAIR,__func__,"unable to decode value (ws=%s)",wstatus_str(ws));
+			_nvp_free(new_nvp);
+			DBGRET_FAILURE(MOD_NVPAIR);
+		}
+	}
+	dbgprint(MOD_NVPAIR,__func__,"decoded %u bytes of value into nvpair=%p",decoded_size,new_nvp);
+
+	*nvp = new_nvp;
+	dbgprint(MOD_NVPAIR,__func__,"updated nvp value to %p",*nvp);
+
+	DBGRET_SUCCESS(MOD_NVPAIR);
+}
+
+/*
+   _nvp_blob_alloc
+
+   Helper function to allocate a new value blob with a single reference. The
+   blob data isn't initialized, the owner is expected to write it before
+   sharing the blob with other nvpairs.
+*/
+wstatus
+_nvp_blob_alloc(uint16_t size,nvblob_t *blob)
+{
+	nvblob_t new_blob;
+
+	dbgprint(MOD_NVPAIR,__func__,"called with size=%u, blob=%p",size,blob);
+
+	if( !size ) {
+		dbgprint(MOD_NVPAIR,__func__,"invalid argument size, size > 0 is required");
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	if( !blob ) {
+		dbgprint(MOD_NVPAIR,__func__,"invalid argument blob (blob=0)");
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	new_blob = (nvblob_t)malloc(sizeof(struct _nvblob_t) + size);
+	if( !new_blob ) {
+		dbgprint(MOD_NVPAIR,__func__,"malloc failed (size=%u)",sizeof(struct _nvblob_t) + size);
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	new_blob->refcount = 1;
+	new_blob->size = size;
+
+	*blob = new_blob;
+	dbgprint(MOD_NVPAIR,__func__,"updated blob value to %p",*blob);
+
+	DBGRET_SUCCESS(MOD_NVPAIR);
+}
+
+/*
+   _nvp_blob_ref
+
+   Helper function to take one more reference of a value blob. Safe to call
+   from any thread as long as the caller already holds a reference.
+*/
+wstatus
+_nvp_blob_ref(nvblob_t blob)
+{
+	long refcount;
+
+	if( !blob ) {
+		dbgprint(MOD_NVPAIR,__func__,"invalid argument blob (blob=0)");
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	refcount = watomic_inc(&blob->refcount);
+	dbgprint(MOD_NVPAIR,__func__,"(blob=%p) refcount is now %ld",blob,refcount);
+
+	DBGRET_SUCCESS(MOD_NVPAIR);
+}
+
+/*
+   _nvp_blob_unref
+
+   Helper function to drop a reference of a value blob, the last reference
+   frees the blob from memory.
+*/
+wstatus
+_nvp_blob_unref(nvblob_t blob)
+{
+	long refcount;
+
+	if( !blob ) {
+		dbgprint(MOD_NVPAIR,__func__,"invalid argument blob (blob=0)");
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	refcount = watomic_dec(&blob->refcount);
+	dbgprint(MOD_NVPAIR,__func__,"(blob=%p) refcount is now %ld",blob,refcount);
+
+	if( refcount < 0 ) {
+		dbgprint(MOD_NVPAIR,__func__,"(blob=%p) refcount underflow, check the nvpair owners",blob);
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	if( !refcount ) {
+		dbgprint(MOD_NVPAIR,__func__,"(blob=%p) no more references, freeing blob",blob);
+		free(blob);
+	}
+
+	DBGRET_SUCCESS(MOD_NVPAIR);
+}
+
+/*
+   _nvp_alloc_shared
+
+   Helper function to allocate a new nvpair which references the value of an
+   existing blob instead of copying it. The name is copied. The blob gets one
+   more reference which is dropped when the nvpair is freed with _nvp_free.
+   A null blob creates a nvpair without value.
+*/
+wstatus
+_nvp_alloc_shared(const char *name_ptr,uint16_t name_size,nvblob_t blob,nvpair_t *nvp)
+{
+	nvpair_t new_nvp;
+	wstatus ws;
+
+	dbgprint(MOD_NVPAIR,__func__,"called with name_ptr=%p, name_size=%u, blob=%p, nvp=%p",
+			name_ptr,name_size,blob,nvp);
+
+	if( !name_ptr || !name_size ) {
+		dbgprint(MOD_NVPAIR,__func__,"invalid argument name_ptr or name_size=0");
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	if( !nvp ) {
+		dbgprint(MOD_NVPAIR,__func__,"invalid argument nvp (nvp=0)");
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	/* allocate the nvpair without value, the value comes from the blob */
+
+	ws = _nvp_alloc(name_size,0,&new_nvp);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_NVPAIR,__func__,"failed to allocate new nvpair (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_NVPAIR);
+	}
+
+	memcpy(new_nvp->name_ptr,name_ptr,name_size);
+	new_nvp->name_id = reqid_name_lookup(name_ptr,name_size);
+
+	if( blob )
+	{
+		ws = _nvp_blob_ref(blob);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_NVPAIR,__func__,"failed to reference blob=%p",blob);
+			_nvp_free(new_nvp);
+			DBGRET_FAILURE(MOD_NVPAIR);
+		}
+
+		new_nvp->value_blob = blob;
+		new_nvp->value_ptr = blob->data;
+		new_nvp->value_size = blob->size;
+		dbgprint(MOD_NVPAIR,__func__,"nvpair=%p shares %u bytes of value with blob=%p",
+				new_nvp,new_nvp->value_size,blob);
+	}
+
+	*nvp = new_nvp;
+	dbgprint(MOD_NVPAIR,__func__,"updated nvp value to %p",*nvp);
+
+	DBGRET_SUCCESS(MOD_NVPAIR);
+}
+
 /*
    _nvp_fill
 
@@ -146,12 +384,19 @@ _nvp_fill(const char *name_ptr,const uint16_t name_size,const void *value_ptr,co
 
 	dbgprint(MOD_NVPAIR,__func__,"copying %u bytes of the name to nvp structure (%p)",name_size,nvp);
 	memcpy(nvp->name_ptr,name_ptr,name_size);
-	dbgprint(MOD_NVPAIR,__func__,"copied %d bytes successfully of the name to the nvp structure (%p)",name_size,nvp);
+	nvp->name_id = reqid_name_lookup(name_ptr,name_size);
+	dbgprint(MOD_NVPAIR,__func__,"copied %d bytes successfully of the name to the nvp structure (%p, name_id=%u)",
+			name_size,nvp,nvp->name_id);
 
 	if( !nvp->value_size ) {
 		DBGRET_SUCCESS(MOD_NVPAIR);
 	}
 
+	if( nvp->value_blob && (watomic_get(&nvp->value_blob->refcount) > 1) ) {
+		dbgprint(MOD_NVPAIR,__func__,"value of nvp (%p) is shared, it can't be modified",nvp);
+		goto return_fail;
+	}
+
 	dbgprint(MOD_NVPAIR,__func__,"copying %u bytes of the value to nvp structure (%p)",value_size,nvp);
 	memcpy(nvp->value_ptr,value_ptr,value_size);
 	dbgprint(MOD_NVPAIR,__func__,"copied %d bytes successfully of the value to the nvp structure (%p)",value_size,nvp);
@@ -169,27 +414,30 @@ return_fail:
    _nvp_free
 
    Helper function to free the name-value pair data structure from memory.
+   The value is only freed if this nvpair held the last reference to it.
 */
 wstatus
 _nvp_free(nvpair_t nvp)
 {
-	dbgprint(MOD_NVPAIR,__func__,"called with nvp=%p");
+	dbgprint(MOD_NVPAIR,__func__,"called with nvp=%p",nvp);
 
 	if( !nvp ) {
 		dbgprint(MOD_NVPAIR,__func__,"invalid argument nvp (nvp=0)");
 		goto return_fail;
 	}
 
-	if( nvp->name_ptr ) {
+	if( nvp->name_ptr && !nvp_name_is_inline(nvp) ) {
 		dbgprint(MOD_NVPAIR,__func__,"(nvp=%p) freeing name_ptr=%p",nvp,nvp->name_ptr);
 		free(nvp->name_ptr);
 	}
 
-	if( nvp->value_ptr ) {
-		dbgprint(MOD_NVPAIR,__func__,"(nvp=%p) freeing value_ptr=%p",nvp,nvp->value_ptr);
-		free(nvp->value_ptr);
+	if( nvp->value_blob ) {
+		dbgprint(MOD_NVPAIR,__func__,"(nvp=%p) releasing value_blob=%p",nvp,nvp->value_blob);
+		_nvp_blob_unref(nvp->value_blob);
 	}
 
+	free(nvp);
+
 	DBGRET_SUCCESS(MOD_NVPAIR);
 
 return_fail:
@@ -457,7 +705,9 @@ return_fail:
    _nvp_dup
 
    Helper function to duplicate a nvpair data structure. To free the allocated
-   nvpair data structure use the _nvp_free helper function.
+   nvpair data structure use the _nvp_free helper function. Large values aren't
+   copied, the new nvpair takes a reference of the same value blob. Inline
+   values are copied with the nvpair.
 */
 wstatus _nvp_dup(const nvpair_t nvp,nvpair_t *new_nvp)
 {
@@ -478,40 +728,27 @@ wstatus _nvp_dup(const nvpair_t nvp,nvpair_t *new_nvp)
 		DBGRET_FAILURE(MOD_NVPAIR);
 	}
 
-	ws = _nvp_alloc(nvp->name_size,nvp->value_size,&aux_nvp);
+	ws = _nvp_alloc_shared(nvp->name_ptr,nvp->name_size,nvp->value_blob,&aux_nvp);
 	if( ws != WSTATUS_SUCCESS ) {
 		dbgprint(MOD_NVPAIR,__func__,"failed to allocate new nvpair data structure "
 				"(helper function failed with ws=%s)",wstatus_str(ws));
 		DBGRET_FAILURE(MOD_NVPAIR);
 	}
-	dbgprint(MOD_NVPAIR,__func__,"allocated new nvpair data structure (ptr=%p)",aux_nvp);
+	dbgprint(MOD_NVPAIR,__func__,"allocated new nvpair data structure (ptr=%p) sharing blob=%p",
+			aux_nvp,nvp->value_blob);
 
-	ws = _nvp_fill(nvp->name_ptr,nvp->name_size,nvp->value_ptr,nvp->value_size,aux_nvp);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_NVPAIR,__func__,"failed to fill the new nvpair data structure "
-				"(helper function failed with ws=%s)",wstatus_str(ws));
+	/* inline values are just copied, there's no blob to share */
 
-		goto return_fail;
+	if( nvp->value_size && !nvp->value_blob ) {
+		memcpy(aux_nvp->value_inline,nvp->value_ptr,nvp->value_size);
+		aux_nvp->value_ptr = aux_nvp->value_inline;
+		aux_nvp->value_size = nvp->value_size;
 	}
-	dbgprint(MOD_NVPAIR,__func__,"new nvpair data structure was filled successfully");
 
 	*new_nvp = aux_nvp;
 	dbgprint(MOD_NVPAIR,__func__,"updated new_nvp value to %p",*new_nvp);
 
 	DBGRET_SUCCESS(MOD_NVPAIR);
-
-return_fail:
-
-	if( aux_nvp )
-   	{
-		_nvp_free(aux_nvp);
-		if( ws != WSTATUS_SUCCESS ) {
-			dbgprint(MOD_NVPAIR,__func__,"failed to free the allocated nvpair data structure (ptr=%p)",aux_nvp);
-		}
-		aux_nvp = 0;
-	}
-
-	DBGRET_FAILURE(MOD_NVPAIR);
 }
 
 /*
@@ -32,6 +32,8 @@
 #include "debug.h"
 #include "jmlist.h"
 #include "wlock.h"
+#include "watomic.h"
+#include "reqids.h"
 
 #define NVP_ENCODED_PREFIX '#'
 #define V_NAMECHAR(x) isalnum(x)
@@ -43,15 +45,42 @@
 #define V_QUOTECHAR(x) (x == '"')
 #define nvp_flag_test(x,f) ((x & f) == f) 
 
-/* nvpair_t: this data structure must have well defined sizes */
+/* nvblob_t: immutable value buffer shared between nvpairs. The buffer is
+   writable only while the refcount is 1 (the nvpair that allocated it),
+   after it is shared (dup, forward) it must be treated as read-only. */
+typedef struct _nvblob_t
+{
+	watomic_t refcount;
+	uint16_t size;
+	char data[1];
+} *nvblob_t;
+
+/* inline storage sizes of nvpair_t, names and values that fit here don't
+   need any extra allocation (most of them: ch=11, pwr=17.5, id=ap042) */
+#define NVPAIR_INLINE_NAMESIZE 16
+#define NVPAIR_INLINE_VALUESIZE 24
+
+/* nvpair_t: this data structure must have well defined sizes.
+   name_ptr and value_ptr always point to the bytes, either to the inline
+   buffers or to the heap (name) / value_blob->data (value) when they don't
+   fit. Keep the pointers and sizes first, iterating and comparing nvpairs
+   should only touch the first cache line. name_id tags the well-known names
+   (reqids.list) when the name is written, REQNAME_UNKNOWN for the others. */
 typedef struct _nvpair_t
 {
 	char *name_ptr;
-	uint16_t name_size;
 	void *value_ptr;
+	uint16_t name_size;
 	uint16_t value_size;
+	uint16_t name_id;
+	nvblob_t value_blob;
+	char name_inline[NVPAIR_INLINE_NAMESIZE];
+	char value_inline[NVPAIR_INLINE_VALUESIZE];
 } *nvpair_t;
 
+#define nvp_name_is_inline(x) ((x)->name_ptr == (x)->name_inline)
+#define nvp_value_is_inline(x) ((x)->value_ptr == (void*)(x)->value_inline)
+
 #define NVPAIR_FLAG_UNINITIALIZED 0x80000000
 
 /* NAME FLAGS */
@@ -109,6 +138,11 @@ wstatus _nvp_value_encoded_size(const char *value_ptr,const unsigned int value_s
 wstatus _nvp_value_decode(const char *value_ptr,const uint16_t value_size,char *decoded_ptr,unsigned int decoded_size);
 wstatus _nvp_value_decoded_size(const char *value_ptr,const uint16_t value_size,unsigned int *decoded_size);
 wstatus _nvp_dup(const nvpair_t nvp,nvpair_t *new_nvp);
+wstatus _nvp_alloc_shared(const char *name_ptr,uint16_t name_size,nvblob_t blob,nvpair_t *nvp);
+wstatus _nvp_alloc_decoded(const char *name_ptr,uint16_t name_size,const char *encoded_ptr,uint16_t encoded_size,nvpair_t *nvp);
+wstatus _nvp_blob_alloc(uint16_t size,nvblob_t *blob);
+wstatus _nvp_blob_ref(nvblob_t blob);
+wstatus _nvp_blob_unref(nvblob_t blob);
 
 /* debugging functions */
 void _nvp_print_value(const char *value_ptr, unsigned int value_size);
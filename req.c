@@ -18,11 +18,16 @@
 	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
 */
 
+#define _POSIX_C_SOURCE 199309L
+
 #include <ctype.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
 
+#include "posh.h"
 #include "wstatus.h"
 #include "debug.h"
 #include "nvpair.h"
@@ -844,14 +849,13 @@ _req_text_token_seek(const char *req_text,text_token_t token,char **token_ptr)
 			
 			case TEXT_TOKEN_TYPE:
 
-				if( V_REPLYCHAR(req_text[i]) ) {
-					/* TYPE=REPLY finished TYPE token */
-					cur_token = TEXT_TOKEN_MODSRC;
+				if( V_REPLYCHAR(req_text[i]) && (i > 0) && !V_REPLYCHAR(req_text[i-1]) ) {
+					/* TYPE=REPLY, the separator after it finishes TYPE token */
 					continue;
 				}
 
 				if( V_TOKSEPCHAR(req_text[i]) ) {
-					/* TYPE=REQUEST finished TYPE token */
+					/* TYPE finished, REQUEST has no char */
 					cur_token = TEXT_TOKEN_MODSRC;
 					continue;
 				}
@@ -973,8 +977,6 @@ _req_from_text_to_bin(request_t req,request_t *req_bin)
 	char *name_start,*value_start;
 	unsigned int name_size,value_size;
 	nvpair_fflag_list fflags;
-	char *decoded_ptr = 0;
-	unsigned int decoded_size = 0;
 
 	dbgprint(MOD_REQ,__func__,"called with req=%p, req_bin=%p",req,req_bin);
 
@@ -1051,7 +1053,9 @@ _req_from_text_to_bin(request_t req,request_t *req_bin)
 		dbgprint(MOD_REQ,__func__,"(req=%p) unable to get request code",req);
 		goto return_fail;
 	}
-	dbgprint(MOD_REQ,__func__,"(req=%p) got request code (%s)",req,new_req->data.bin.code);
+	new_req->data.bin.code_id = reqid_code_lookup(new_req->data.bin.code,strlen(new_req->data.bin.code));
+	dbgprint(MOD_REQ,__func__,"(req=%p) got request code (%s, code_id=%u)",req,new_req->data.bin.code,
+			new_req->data.bin.code_id);
 
 	/* start processing the aditional nvpairs */
 
@@ -1082,36 +1086,10 @@ _req_from_text_to_bin(request_t req,request_t *req_bin)
 			goto return_fail;
 		}
 
-		if( nvp_flag_test(fflags,NVPAIR_FFLAG_ENCODED) )
-	   	{
-			ws = _nvp_value_decoded_size(value_start,value_size,&decoded_size);
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_REQ,__func__,"(req=%p) failed to get decoded size for nv_idx=%u",req,nv_idx);
-				goto return_fail;
-			}
-
-			/* allocate buffer that will store the decoded value */
-
-			decoded_ptr = (char*)malloc(decoded_size);
-			if( !decoded_ptr ) {
-				dbgprint(MOD_REQ,__func__,"(req=%p) malloc failed on decoded_size=%u",req,decoded_size);
-				goto return_fail;
-			}
-			dbgprint(MOD_REQ,__func__,"(req=%p) allocated buffer for decoded value successful (ptr=%p)",
-					req,decoded_ptr);
-
-			ws = _nvp_value_decode(value_start,value_size,decoded_ptr,decoded_size);
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_REQ,__func__,"(req=%p) unable to decode value (ws=%s)",req,wstatus_str(ws));
-				goto return_fail;
-			}
-			dbgprint(MOD_REQ,__func__,"(req=%p) decoded successfully the value",req);
-		}
-
 		/* allocate new nvpair data structure for this nvpair */
 
 		if( nvp_flag_test(fflags,NVPAIR_FFLAG_ENCODED) )
-			ws = _nvp_alloc(name_size,decoded_size,&nvp);
+			ws = _nvp_alloc_decoded(name_start,name_size,value_start,value_size,&nvp);
 		else
 			ws = _nvp_alloc(name_size,value_size,&nvp);
 
@@ -1122,27 +1100,18 @@ _req_from_text_to_bin(request_t req,request_t *req_bin)
 		}
 		dbgprint(MOD_REQ,__func__,"(req=%p) allocated new nvpair data structure successfully (p=%p)",req,nvp);
 
-		/* fill the new data structure with the tokens */
+		/* fill the new data structure with the tokens, encoded values were
+		   already decoded into the nvpair */
 		
-		if( nvp_flag_test(fflags,NVPAIR_FFLAG_ENCODED) )
-			ws = _nvp_fill(name_start,name_size,decoded_ptr,decoded_size,nvp);
-		else
+		if( !nvp_flag_test(fflags,NVPAIR_FFLAG_ENCODED) ) {
 			ws = _nvp_fill(name_start,name_size,value_start,value_size,nvp);
-
-		if( ws != WSTATUS_SUCCESS ) {
-			dbgprint(MOD_REQ,__func__,"(req=%p) failed to fill the new nvpair (p=%p)",req,nvp);
-			goto return_fail;
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_REQ,__func__,"(req=%p) failed to fill the new nvpair (p=%p)",req,nvp);
+				goto return_fail;
+			}
 		}
 		dbgprint(MOD_REQ,__func__,"(req=%p) new nvpair ready for insertion in nvpair list",req);
 
-		/* we can now free the decoded buffer if it was used */
-		
-		if( decoded_ptr ) {
-			free(decoded_ptr);
-			decoded_ptr = 0;
-			decoded_size = 0;
-		}
-
 		jmls = jmlist_insert(new_req->data.bin.nvl,nvp);
 		if( jmls != JMLIST_ERROR_SUCCESS ) {
 			dbgprint(MOD_REQ,__func__,"(req=%p) jmlist failed to insert new nvpair data strucutre (jmls=%d)",req,jmls);
@@ -1187,9 +1156,6 @@ return_fail:
 		free(new_req);
 	}
 
-	if( decoded_ptr )
-		free(decoded_ptr);
-
 	DBGRET_FAILURE(MOD_REQ);
 }
 
@@ -1504,7 +1470,9 @@ void _req_bin_nvl_insert_jlcb(void *ptr,void *param)
 				dbgprint(MOD_REQ,__func__,"unable to convert value to encoded format");
 				return;
 			}
-			req_text = stpcpy(req_text,value_encoded);
+			/* stpcpy isn't C99 */
+			strcpy(req_text,value_encoded);
+			req_text += strlen(value_encoded);
 			*req_text = ' ';
 			*(req_text+1) = '\0';
 			free(value_encoded);
@@ -1906,6 +1874,69 @@ return_fail:
 	DBGRET_FAILURE(MOD_REQ); */
 }
 
+/*
+   req_peek_header
+
+   Reads the id, type, source and destination modules of a text request
+   without validating or parsing the rest of it. This is used at ingress to
+   take decisions (admission control) before paying for the full parse, the
+   request still has to go through req_validate later.
+
+   Returns failure if the header is malformed or doesn't fit in req_size.
+*/
+wstatus
+req_peek_header(const char *req_text,unsigned int req_size,req_header_t *header)
+{
+	unsigned int i = 0, j;
+	int id = 0;
+
+	if( !req_text || !header )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	/* <req-id> */
+	for( ; (i < req_size) && V_RIDCHAR(req_text[i]) ; i++ ) {
+		id = id * 10 + (req_text[i] - '0');
+		if( (i >= REQIDSIZE) || (id > MAXREQID) )
+			return WSTATUS_FAILURE;
+	}
+	if( !i || (i >= req_size) )
+		return WSTATUS_FAILURE;
+	header->id = id;
+
+	/* <type> */
+	if( V_REPLYCHAR(req_text[i]) ) {
+		header->type = REQUEST_TYPE_REPLY;
+		i++;
+	} else
+		header->type = REQUEST_TYPE_REQUEST;
+
+	/* <mod_source> */
+	if( (i >= req_size) || !V_TOKSEPCHAR(req_text[i]) )
+		return WSTATUS_FAILURE;
+	for( i++, j = 0 ; (i < req_size) && V_MODCHAR(req_text[i]) ; i++, j++ ) {
+		if( j >= REQMODSIZE - 1 )
+			return WSTATUS_FAILURE;
+		header->src[j] = req_text[i];
+	}
+	if( !j )
+		return WSTATUS_FAILURE;
+	header->src[j] = '\0';
+
+	/* <mod_dest> */
+	if( (i >= req_size) || !V_TOKSEPCHAR(req_text[i]) )
+		return WSTATUS_FAILURE;
+	for( i++, j = 0 ; (i < req_size) && V_MODCHAR(req_text[i]) ; i++, j++ ) {
+		if( j >= REQMODSIZE - 1 )
+			return WSTATUS_FAILURE;
+		header->dst[j] = req_text[i];
+	}
+	if( !j )
+		return WSTATUS_FAILURE;
+	header->dst[j] = '\0';
+
+	return WSTATUS_SUCCESS;
+}
+
 /*
    req_add_nvp_z
 
@@ -1939,6 +1970,11 @@ req_add_nvp_z(const char *name_ptr,const char *value_ptr,request_t req)
 		goto return_fail;
 	}
 
+	if( req_is_sealed(req) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) request is sealed, it can't be modified",req);
+		goto return_fail;
+	}
+
 	if( req->stype == REQUEST_STYPE_BIN )
 	{
 		value_size = value_ptr ? strlen(value_ptr) : 0;
@@ -1970,14 +2006,14 @@ req_add_nvp_z(const char *name_ptr,const char *value_ptr,request_t req)
 			dbgprint(MOD_REQ,__func__,"updated request nvl to %p",req->data.bin.nvl);
 		}
 
-		jmls = jmlist_insert(jml,nvp);
+		jmls = jmlist_insert(req->data.bin.nvl,nvp);
 		if( jmls != JMLIST_ERROR_SUCCESS ) {
 			dbgprint(MOD_REQ,__func__,"failed to insert nvpair into nvl (jmls=%d)",jmls);
 			goto return_fail;
 		}
 
 		entry_count = 0;
-		jmls = jmlist_entry_count(jml,&entry_count);
+		jmls = jmlist_entry_count(req->data.bin.nvl,&entry_count);
 		dbgprint(MOD_REQ,__func__,"inserted nvpair into nvl successfully (nvl has now %u entries)",entry_count);
 
 	} else if( req->stype == REQUEST_STYPE_TEXT ) {
@@ -1998,16 +2034,91 @@ return_fail:
 }
 
 /*
-   req_free
+   req_add_nvp_blob
 
-   As the name says, this function frees any data structure associated to the request.
+   Helper function of the req family for adding a nv-pair to a binary request
+   where the value is an existing nvpair blob. The value isn't copied, the
+   request keeps a reference of the blob until it's freed. This allows the same
+   large value to be attached to several requests (fan-out) at the cost of a
+   reference count. The name doesn't need to be null terminated.
 */
 wstatus
-req_free(request_t req)
+req_add_nvp_blob(const char *name_ptr,uint16_t name_size,nvblob_t blob,request_t req)
+{
+	nvpair_t nvp = 0;
+	jmlist_status jmls;
+	wstatus ws;
+	struct _jmlist_params params = {.flags = JMLIST_LINKED};
+
+	dbgprint(MOD_REQ,__func__,"called with name_ptr=%p, name_size=%u, blob=%p, req=%p",
+			name_ptr,name_size,blob,req);
+
+	if( !name_ptr || !name_size ) {
+		dbgprint(MOD_REQ,__func__,"invalid name_ptr argument (name_ptr=0 or name_size=0)");
+		goto return_fail;
+	}
+
+	if( !req ) {
+		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
+		goto return_fail;
+	}
+
+	if( req_is_sealed(req) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) request is sealed, it can't be modified",req);
+		goto return_fail;
+	}
+
+	if( req->stype != REQUEST_STYPE_BIN ) {
+		dbgprint(MOD_REQ,__func__,"invalid or unsupported request stype (%d)",req->stype);
+		goto return_fail;
+	}
+
+	ws = _nvp_alloc_shared(name_ptr,name_size,blob,&nvp);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"failed to allocate shared nvpair (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+	dbgprint(MOD_REQ,__func__,"allocated new shared nvpair (nvp=%p) successfully",nvp);
+
+	if( !req->data.bin.nvl )
+	{
+		jmls = jmlist_create(&req->data.bin.nvl,&params);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"failed to create jmlist (jmls=%d)",jmls);
+			req->data.bin.nvl = 0;
+			goto return_fail;
+		}
+		dbgprint(MOD_REQ,__func__,"created jmlist for the nvl successfully (jml=%p)",req->data.bin.nvl);
+	}
+
+	jmls = jmlist_insert(req->data.bin.nvl,nvp);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"failed to insert nvpair into nvl (jmls=%d)",jmls);
+		goto return_fail;
+	}
+
+	DBGRET_SUCCESS(MOD_REQ);
+
+return_fail:
+	if( nvp )
+		_nvp_free(nvp);
+
+	DBGRET_FAILURE(MOD_REQ);
+}
+
+/*
+   _req_destroy
+
+   Helper function that frees any data structure associated to the request,
+   including the cached text serialization of sealed requests. Doesn't look
+   at the reference count, use req_free instead.
+*/
+wstatus
+_req_destroy(request_t req)
 {
 	jmlist_status jmls;
 
-	dbgprint(MOD_REQ,__func__,"called with req=%p");
+	dbgprint(MOD_REQ,__func__,"called with req=%p",req);
 	if( !req ) {
 		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
 		goto return_fail;
@@ -2018,8 +2129,10 @@ req_free(request_t req)
 		case REQUEST_STYPE_BIN:
 			/* binary requests have an aditional data structure allocated which is the
 			   jmlist that contains the list of nv-pairs. This must be freed using the
-			   own jmlist APIs. */
+			   own jmlist APIs. Each nvpair is released first, the values are only
+			   freed when no other request shares them. */
 			if( req->data.bin.nvl ) {
+				jmlist_parse(req->data.bin.nvl,_req_nvl_jml_free,0);
 				jmls = jmlist_free(req->data.bin.nvl);
 				if( jmls != JMLIST_ERROR_SUCCESS ) {
 					dbgprint(MOD_REQ,__func__,"failed to free request nv-pair list (jmls=%d",jmls);
@@ -2040,6 +2153,18 @@ req_free(request_t req)
 			goto return_fail;
 	}
 
+	/* free the cached text serialization */
+	if( req->text_cache ) {
+		dbgprint(MOD_REQ,__func__,"freeing cached text request (ptr=%p)",req->text_cache);
+		free(req->text_cache);
+	}
+
+	/* free the schema record, it's a single allocation */
+	if( req->record ) {
+		dbgprint(MOD_REQ,__func__,"freeing schema record (ptr=%p)",req->record);
+		free(req->record);
+	}
+
 	/* free the request data structure */
 	dbgprint(MOD_REQ,__func__,"freeing request data structure");
 	free(req);
@@ -2051,177 +2176,996 @@ return_fail:
 }
 
 /*
-   req_get_nv
+   req_free
 
-   Helper function that searches a name-value pair in a request, it uses the name as the needle.
-   The name-value pair is returned in a nvpair_t structure, the client passes the address of
-   a variable that receives a nvpair_t pointer. The client is responsible for freeing the nvp
-   data structure returned using _nvp_free.
+   As the name says, this function frees any data structure associated to the request.
+   Sealed requests are shared so this only drops the caller reference, the request
+   is freed when the last reference is dropped (see req_unref).
 */
 wstatus
-req_get_nv(const request_t req,const char *name_ptr,unsigned int name_size,nvpair_t *nvpp)
+req_free(request_t req)
 {
-	wstatus ws;
+	dbgprint(MOD_REQ,__func__,"called with req=%p",req);
 
-	dbgprint(MOD_REQ,__func__,"called with req=%p, name_ptr=%p (%s), name_size=%u, nvpp=%p",
-			req,name_ptr,array2z(name_ptr,name_size),name_size,nvpp);
+	if( !req ) {
+		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
 
-	/* start by validating the arguments */
+	if( req_is_sealed(req) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) request is sealed, dropping one reference",req);
+		return req_unref(req);
+	}
+
+	return _req_destroy(req);
+}
+
+/*
+   _req_seal_clear
+
+   Helper function to reset the seal state (and the schema record, which points
+   into the nvpairs of the original, the ingress statistics and the parsed
+   deadline) of a request data structure. Must be
+   used on every request allocated without memset and on raw copies of a request
+   (reqbuf binary type), the copy is a new request owned by whoever made it.
+*/
+void
+_req_seal_clear(request_t req)
+{
+	req->flags = 0;
+	req->refcount = 0;
+	req->text_cache = 0;
+	req->record = 0;
+	req->ingress_ns = 0;
+	req->wire_size = 0;
+	req->deadline_ms = 0;
+}
+
+/*
+   req_seal
+
+   Turns the request into a sealed request. A sealed request is read-only, the
+   functions that modify requests (req_add_nvp_z, req_add_nvp_blob, ...) refuse
+   to work with it. The caller keeps one reference, other consumers (threads,
+   fan-out destinations) take their own with req_ref and drop it with req_unref
+   or req_free. Since nobody can modify it no locking is needed to read it.
+
+   Sealing an already sealed request is an error, the caller doesn't know who
+   else holds it.
+*/
+wstatus
+req_seal(request_t req)
+{
+	dbgprint(MOD_REQ,__func__,"called with req=%p",req);
 
 	if( !req ) {
 		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
 		DBGRET_FAILURE(MOD_REQ);
 	}
 
-	if( !name_ptr ) {
-		dbgprint(MOD_REQ,__func__,"invalid name_ptr argument (name_ptr=0)");
+	if( req_is_sealed(req) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) request is already sealed",req);
 		DBGRET_FAILURE(MOD_REQ);
 	}
 
-	if( !name_size ) {
-		dbgprint(MOD_REQ,__func__,"invalid name_size (name_size=0)");
+	if( (req->stype != REQUEST_STYPE_BIN) && (req->stype != REQUEST_STYPE_TEXT) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) invalid or unsupported request type (%d)",req,req->stype);
 		DBGRET_FAILURE(MOD_REQ);
 	}
 
-	switch(req->stype)
-	{
-		case REQUEST_STYPE_TEXT:
-			dbgprint(MOD_REQ,__func__,"request in req=%p is of TEXT stype, calling helper function _req_text_get_nv");
-			ws = _req_text_get_nv(req,name_ptr,name_size,nvpp);
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_REQ,__func__,"helper function _req_text_get_nv failed (ws=%d)",ws);
-				goto return_fail;
-			}
-			dbgprint(MOD_REQ,__func__,"helper function _req_text_get_nv was successful");
-			break;
-		case REQUEST_STYPE_BIN:
-			dbgprint(MOD_REQ,__func__,"request in req=%p is of BIN stype, calling helper function _req_bin_get_nv");
-			ws = _req_bin_get_nv(req,name_ptr,name_size,nvpp);
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_REQ,__func__,"helper function _req_bin_get_nv failed (ws=%d)");
-				goto return_fail;
-			}
-			dbgprint(MOD_REQ,__func__,"helper function _req_bin_get_nv was successful");
-			break;
-		case REQUEST_STYPE_PIPE:
-		default:
-			dbgprint(MOD_REQ,__func__,"invalid or unsupported request stype (%d)",req->stype);
-			DBGRET_FAILURE(MOD_REQ);
-	}
+	req->refcount = 1;
+	req->text_cache = 0;
+	req->flags |= REQUEST_FLAG_SEALED;
 
+	/* make sure all the writes to the request are visible before it's shared */
+	watomic_barrier();
+
+	dbgprint(MOD_REQ,__func__,"(req=%p) request sealed successfully",req);
 	DBGRET_SUCCESS(MOD_REQ);
-return_fail:
-	DBGRET_FAILURE(MOD_REQ);
 }
 
 /*
-   _req_text_get_nv
+   req_ref
 
-   Helper function to get a specific name-value pair value data. This function will return the original
-   decoded data. If the name-value pair isn't found or the request doesn't have any name-value pair
-   this function returns error. Since this function is processing a request in text form, it starts
-   by calling the text token seeker function to seek to the name-value list. After that it parses each
-   name-value pair using _req_text_nv_parse which returns name/value pointers, using that information
-   it compares the name with look_name, if its equal the name-value pair was found and the value
-   is processed.
+   Takes one more reference of a sealed request. The caller must already hold
+   a reference (the request can't be freed while this function runs).
 */
 wstatus
-_req_text_get_nv(const request_t req,const char *look_name_ptr,unsigned int look_name_size,nvpair_t *nvpp)
+req_ref(request_t req)
 {
-	unsigned int nv_idx;
-	char *aux;
-	char *value_start,*decoded_ptr,*name_start;
-	unsigned int name_size, value_size, decoded_size;
-	wstatus ws;
-	nvpair_fflag_list fflags;
-	nvpair_t aux_nvp = 0;
-
-	dbgprint(MOD_REQ,__func__,"called with req=%p, name_ptr=%p (%s), name_size=%u, nvpp=%p",
-			req,look_name_ptr,array2z(look_name_ptr,look_name_size),look_name_size,nvpp);
-
-	/* start by validating the arguments */
+	long refcount;
 
 	if( !req ) {
 		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
 		DBGRET_FAILURE(MOD_REQ);
 	}
 
-	if( !look_name_ptr ) {
-		dbgprint(MOD_REQ,__func__,"invalid look_name_ptr argument (look_name_ptr=0)");
+	if( !req_is_sealed(req) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) request is not sealed, can't reference it",req);
 		DBGRET_FAILURE(MOD_REQ);
 	}
 
-	if( !look_name_size ) {
-		dbgprint(MOD_REQ,__func__,"invalid look_name_size (look_name_size=0)");
+	refcount = watomic_inc(&req->refcount);
+	dbgprint(MOD_REQ,__func__,"(req=%p) refcount is now %ld",req,refcount);
+
+	DBGRET_SUCCESS(MOD_REQ);
+}
+
+/*
+   req_unref
+
+   Drops one reference of a sealed request, the last reference frees it.
+*/
+wstatus
+req_unref(request_t req)
+{
+	long refcount;
+
+	if( !req ) {
+		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
 		DBGRET_FAILURE(MOD_REQ);
 	}
 
-	if( req->stype != REQUEST_STYPE_TEXT ) {
-		dbgprint(MOD_REQ,__func__,"invalid request to be used with this function");
+	if( !req_is_sealed(req) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) request is not sealed, use req_free",req);
 		DBGRET_FAILURE(MOD_REQ);
 	}
 
-	/* seek to name-value pair list in the request */
+	refcount = watomic_dec(&req->refcount);
+	dbgprint(MOD_REQ,__func__,"(req=%p) refcount is now %ld",req,refcount);
 
-	ws = _req_text_token_seek(req->data.text.raw,TEXT_TOKEN_NVL,&aux);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_REQ,__func__,"(req=%p) unable to find nvl begin",req);
-		goto return_fail;
+	if( refcount < 0 ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) refcount underflow, check the request owners",req);
+		DBGRET_FAILURE(MOD_REQ);
 	}
 
-	for( nv_idx = 1 ; ; nv_idx++ )
-   	{
-		/* try to parse nvpair text tokens */
-		ws = _req_text_nv_parse(aux,&name_start,&name_size,&value_start,&value_size,&fflags);
-		if( ws != WSTATUS_SUCCESS ) {
-			dbgprint(MOD_REQ,__func__,"(req=%p) failed to process text request",req);
-			goto return_fail;
-		}
+	if( refcount ) {
+		DBGRET_SUCCESS(MOD_REQ);
+	}
 
+	dbgprint(MOD_REQ,__func__,"(req=%p) no more references, destroying request",req);
+	return _req_destroy(req);
+}
 
-		if( name_size != look_name_size ) {
-			dbgprint(MOD_REQ,__func__,"(req=%p) this nvpair has different name size, seeking",req);
-			goto seek_nvp;
-		}
+/*
+   req_sealed_text
 
-		/* compare name with the lookup name */
+   Returns the text serialization of a sealed request. For binary requests the
+   text is built on the first call and cached in the request, every other call
+   (from any thread) reuses it. The text belongs to the request, it's valid
+   while the caller holds a reference. text_size doesn't include the null char.
+*/
+wstatus
+req_sealed_text(request_t req,const char **text_ptr,unsigned int *text_size)
+{
+	request_t text_req = 0;
+	const char *aux_text;
+	wstatus ws;
 
-		if( memcmp(name_start,look_name_ptr,name_size) ) {
-			dbgprint(MOD_REQ,__func__,"(req=%p) this nvpair has different name, seeking",req);
-			goto seek_nvp;
-		}
-		dbgprint(MOD_REQ,__func__,"(req=%p) nvpair was found successfully",req);
+	dbgprint(MOD_REQ,__func__,"called with req=%p, text_ptr=%p, text_size=%p",req,text_ptr,text_size);
 
-		if( nvp_flag_test(fflags,NVPAIR_FFLAG_ENCODED) )
-	   	{
-			ws = _nvp_value_decoded_size(value_start,value_size,&decoded_size);
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_REQ,__func__,"(req=%p) failed to get decoded size for nv_idx=%u",req,nv_idx);
-				goto return_fail;
-			}
+	if( !req ) {
+		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
 
-			/* allocate buffer that will store the decoded value */
+	if( !text_ptr ) {
+		dbgprint(MOD_REQ,__func__,"invalid text_ptr argument (text_ptr=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
 
-			decoded_ptr = (char*)malloc(decoded_size);
-			if( !decoded_ptr ) {
-				dbgprint(MOD_REQ,__func__,"(req=%p) malloc failed on decoded_size=%u",req,decoded_size);
-				goto return_fail;
-			}
-			dbgprint(MOD_REQ,__func__,"(req=%p) allocated buffer for decoded value successful (ptr=%p)",
-					req,decoded_ptr);
+	if( !req_is_sealed(req) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) request is not sealed",req);
+		DBGRET_FAILURE(MOD_REQ);
+	}
 
-			ws = _nvp_value_decode(value_start,value_size,decoded_ptr,decoded_size);
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_REQ,__func__,"(req=%p) unable to decode value (ws=%s)",req,wstatus_str(ws));
-				goto return_fail;
+	switch(req->stype)
+	{
+		case REQUEST_STYPE_TEXT:
+			aux_text = req->data.text.raw;
+			break;
+		case REQUEST_STYPE_BIN:
+			if( !req->text_cache )
+			{
+				ws = req_to_text(req,&text_req);
+				if( ws != WSTATUS_SUCCESS ) {
+					dbgprint(MOD_REQ,__func__,"(req=%p) failed to convert request to text (ws=%s)",
+							req,wstatus_str(ws));
+					DBGRET_FAILURE(MOD_REQ);
+				}
+
+				/* other thread might have built it meanwhile, keep the first one */
+				if( !watomic_casptr(&req->text_cache,0,(void*)text_req) ) {
+					dbgprint(MOD_REQ,__func__,"(req=%p) text was cached by other thread, freeing ours",req);
+					_req_destroy(text_req);
+				} else
+					dbgprint(MOD_REQ,__func__,"(req=%p) cached text request (ptr=%p)",req,text_req);
+			}
+			aux_text = ((request_t)req->text_cache)->data.text.raw;
+			break;
+		default:
+			dbgprint(MOD_REQ,__func__,"(req=%p) invalid or unsupported request type (%d)",req,req->stype);
+			DBGRET_FAILURE(MOD_REQ);
+	}
+
+	*text_ptr = aux_text;
+	if( text_size )
+		*text_size = strlen(aux_text);
+
+	DBGRET_SUCCESS(MOD_REQ);
+}
+
+/*
+   _req_frame_field_size
+
+   Helper function that returns the size of a header field of a binary
+   request, the fields might fill the array without null char.
+*/
+unsigned int _req_frame_field_size(const char *field,unsigned int max)
+{
+	unsigned int size = 0;
+
+	while( (size < max) && field[size] )
+		size++;
+	return size;
+}
+
+/*
+   _req_frame_nv_size_jlcb
+
+   Helper callback of jmlist_parse that adds the frame size of a nvpair.
+*/
+void _req_frame_nv_size_jlcb(void *ptr,void *param)
+{
+	nvpair_t nvp = (nvpair_t)ptr;
+	unsigned int *size = (unsigned int*)param;
+
+	*size += sizeof(req_frame_nv_t) + nvp->name_size + nvp->value_size;
+}
+
+/*
+   _req_frame_nv_write_jlcb
+
+   Helper callback of jmlist_parse that writes a nvpair in a frame, param
+   points to the write position.
+*/
+void _req_frame_nv_write_jlcb(void *ptr,void *param)
+{
+	nvpair_t nvp = (nvpair_t)ptr;
+	char **pos = (char**)param;
+	req_frame_nv_t nv;
+
+	nv.name_size = nvp->name_size;
+	nv.value_size = nvp->value_size;
+	memcpy(*pos,&nv,sizeof(nv));
+	*pos += sizeof(nv);
+	memcpy(*pos,nvp->name_ptr,nvp->name_size);
+	*pos += nvp->name_size;
+	memcpy(*pos,nvp->value_ptr,nvp->value_size);
+	*pos += nvp->value_size;
+}
+
+/*
+   req_frame_size
+
+   Returns the size of the binary frame of a request (see req_to_frame), only
+   binary requests have frames.
+*/
+wstatus
+req_frame_size(const request_t req,unsigned int *frame_size)
+{
+	unsigned int size;
+	unsigned int nv_count = 0;
+
+	if( !req || !frame_size || (req->stype != REQUEST_STYPE_BIN) ) {
+		dbgprint(MOD_REQ,__func__,"invalid arguments (req=%p, frame_size=%p)",req,frame_size);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	size = sizeof(req_frame_t) + _req_frame_field_size(req->data.bin.src,REQMODSIZE-1) +
+		_req_frame_field_size(req->data.bin.dst,REQMODSIZE-1) + _req_frame_field_size(req->data.bin.code,REQCODESIZE-1);
+
+	if( req->data.bin.nvl ) {
+		jmlist_entry_count(req->data.bin.nvl,&nv_count);
+		if( nv_count > 0xFFFF ) {
+			dbgprint(MOD_REQ,__func__,"(req=%p) too many nvpairs for a frame (%u)",req,nv_count);
+			DBGRET_FAILURE(MOD_REQ);
+		}
+		jmlist_parse(req->data.bin.nvl,_req_frame_nv_size_jlcb,&size);
+	}
+
+	*frame_size = size;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   req_to_frame
+
+   Writes the binary frame of a request (see req_frame_t), frame_size must
+   be at least the size returned by req_frame_size. Unlike the text form no
+   value is encoded or quoted, the bytes are copied as they are.
+*/
+wstatus
+req_to_frame(const request_t req,void *frame_ptr,unsigned int frame_size,unsigned int *frame_used)
+{
+	req_frame_t header;
+	unsigned int size;
+	unsigned int nv_count = 0;
+	char *pos;
+
+	if( !frame_ptr || !frame_used ) {
+		dbgprint(MOD_REQ,__func__,"invalid arguments (frame_ptr=%p, frame_used=%p)",frame_ptr,frame_used);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( req_frame_size(req,&size) != WSTATUS_SUCCESS ) {
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( size > frame_size ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) frame doesn't fit (%u > %u)",req,size,frame_size);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( req->data.bin.nvl )
+		jmlist_entry_count(req->data.bin.nvl,&nv_count);
+
+	header.size = size;
+	header.id = req->data.bin.id;
+	header.nv_count = (uint16_t)nv_count;
+	header.type = (uint8_t)req->data.bin.type;
+	header.src_size = (uint8_t)_req_frame_field_size(req->data.bin.src,REQMODSIZE-1);
+	header.dst_size = (uint8_t)_req_frame_field_size(req->data.bin.dst,REQMODSIZE-1);
+	header.code_size = (uint8_t)_req_frame_field_size(req->data.bin.code,REQCODESIZE-1);
+	header.reserved = 0;
+
+	pos = (char*)frame_ptr;
+	memcpy(pos,&header,sizeof(header));
+	pos += sizeof(header);
+	memcpy(pos,req->data.bin.src,header.src_size);
+	pos += header.src_size;
+	memcpy(pos,req->data.bin.dst,header.dst_size);
+	pos += header.dst_size;
+	memcpy(pos,req->data.bin.code,header.code_size);
+	pos += header.code_size;
+
+	if( nv_count )
+		jmlist_parse(req->data.bin.nvl,_req_frame_nv_write_jlcb,&pos);
+
+	*frame_used = size;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   req_from_frame
+
+   Allocates a binary request from a binary frame (see req_to_frame), the
+   frame comes from another process so every size is checked against the
+   frame. The request must be freed with req_free.
+*/
+wstatus
+req_from_frame(const void *frame_ptr,unsigned int frame_size,request_t *req)
+{
+	struct _jmlist_params jmlp = { .flags = JMLIST_LINKED };
+	request_t new_req = 0;
+	req_frame_t header;
+	req_frame_nv_t nv;
+	const char *pos,*end;
+	nvpair_t nvp = 0;
+	unsigned int i;
+	jmlist_status jmls;
+	wstatus ws;
+
+	if( !frame_ptr || !req || (frame_size < sizeof(header)) ) {
+		dbgprint(MOD_REQ,__func__,"invalid arguments (frame_ptr=%p, frame_size=%u, req=%p)",frame_ptr,frame_size,req);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	memcpy(&header,frame_ptr,sizeof(header));
+	pos = (const char*)frame_ptr + sizeof(header);
+	end = (const char*)frame_ptr + frame_size;
+
+	if( (header.size > frame_size) || (header.type > REQUEST_TYPE_REPLY) ||
+		!header.src_size || (header.src_size >= REQMODSIZE) ||
+		!header.dst_size || (header.dst_size >= REQMODSIZE) ||
+		!header.code_size || (header.code_size >= REQCODESIZE) ||
+		(header.src_size + header.dst_size + header.code_size > end - pos) ) {
+		dbgprint(MOD_REQ,__func__,"invalid frame header (size=%u, frame_size=%u)",header.size,frame_size);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+	end = (const char*)frame_ptr + header.size;
+
+	new_req = (request_t)malloc(sizeof(struct _request_t));
+	if( !new_req ) {
+		dbgprint(MOD_REQ,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+	memset(new_req,0,sizeof(struct _request_t));
+
+	new_req->stype = REQUEST_STYPE_BIN;
+	new_req->data.bin.type = (request_type_list)header.type;
+	new_req->data.bin.id = header.id;
+	memcpy(new_req->data.bin.src,pos,header.src_size);
+	pos += header.src_size;
+	memcpy(new_req->data.bin.dst,pos,header.dst_size);
+	pos += header.dst_size;
+	memcpy(new_req->data.bin.code,pos,header.code_size);
+	pos += header.code_size;
+	new_req->data.bin.code_id = reqid_code_lookup(new_req->data.bin.code,header.code_size);
+
+	if( header.nv_count )
+	{
+		jmls = jmlist_create(&new_req->data.bin.nvl,&jmlp);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"failed to create jmlist (jmls=%d)",jmls);
+			new_req->data.bin.nvl = 0;
+			goto return_fail;
+		}
+	}
+
+	for( i = 0 ; i < header.nv_count ; i++ )
+	{
+		if( end - pos < (long)sizeof(nv) )
+			goto invalid_nv;
+		memcpy(&nv,pos,sizeof(nv));
+		pos += sizeof(nv);
+		if( !nv.name_size || (nv.name_size + nv.value_size > end - pos) )
+			goto invalid_nv;
+
+		ws = _nvp_alloc(nv.name_size,nv.value_size,&nvp);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"failed to allocate nvpair (ws=%s)",wstatus_str(ws));
+			goto return_fail;
+		}
+
+		ws = _nvp_fill(pos,nv.name_size,pos + nv.name_size,nv.value_size,nvp);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"failed to fill nvpair (ws=%s)",wstatus_str(ws));
+			_nvp_free(nvp);
+			goto return_fail;
+		}
+		pos += nv.name_size + nv.value_size;
+
+		jmls = jmlist_insert(new_req->data.bin.nvl,nvp);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"failed to insert nvpair (jmls=%d)",jmls);
+			_nvp_free(nvp);
+			goto return_fail;
+		}
+	}
+
+	new_req->wire_size = header.size;
+	*req = new_req;
+	return WSTATUS_SUCCESS;
+
+invalid_nv:
+	dbgprint(MOD_REQ,__func__,"nvpair %u exceeds the frame",i);
+return_fail:
+	req_free(new_req);
+	DBGRET_FAILURE(MOD_REQ);
+}
+
+/*
+   req_deadline_now_ms
+
+   Returns the wall clock in milliseconds since the epoch, the clock of the
+   deadlines. Deadlines cross processes and hosts, so unlike the statistics
+   they can't use the monotonic clock (the hosts must keep their clocks
+   synchronized).
+*/
+uint64_t
+req_deadline_now_ms(void)
+{
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME,&ts);
+	return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+#else
+	return (uint64_t)time(0) * 1000ULL;
+#endif
+}
+
+/*
+   req_deadline_parse
+
+   Sets the deadline of a request from its deadline nvpair, called by modmgr
+   when the request is received. A request without the nvpair (or with an
+   invalid one) has no deadline.
+*/
+wstatus
+req_deadline_parse(request_t req)
+{
+	nvpair_t nvp = 0;
+	char buf[24];
+	char *end_ptr;
+	unsigned long long aux;
+
+	if( !req ) {
+		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	req->deadline_ms = 0;
+
+	if( req_get_nv_id(req,REQNAME_DEADLINE,&nvp) != WSTATUS_SUCCESS )
+		return WSTATUS_SUCCESS;
+
+	if( !nvp->value_size || (nvp->value_size >= sizeof(buf)) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) invalid size of deadline value (%u)",req,nvp->value_size);
+		_nvp_free(nvp);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	memcpy(buf,nvp->value_ptr,nvp->value_size);
+	buf[nvp->value_size] = '\0';
+	_nvp_free(nvp);
+
+	aux = strtoull(buf,&end_ptr,10);
+	if( *end_ptr != '\0' ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) deadline is not a number (%s)",req,buf);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	req->deadline_ms = (uint64_t)aux;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   _req_deadline_remove
+
+   Helper function that removes the deadline nvpair of a binary request.
+*/
+wstatus
+_req_deadline_remove(request_t req)
+{
+	jmlist_seek_handle shandle;
+	jmlist_index nv_count;
+	void *aux_ptr;
+	nvpair_t nvp_seek = 0;
+
+	if( (req->stype != REQUEST_STYPE_BIN) || !req->data.bin.nvl ||
+		(jmlist_entry_count(req->data.bin.nvl,&nv_count) != JMLIST_ERROR_SUCCESS) ||
+		(jmlist_seek_start(req->data.bin.nvl,&shandle) != JMLIST_ERROR_SUCCESS) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) not a binary request with nvpairs",req);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	while( nv_count-- ) {
+		if( jmlist_seek_next(req->data.bin.nvl,&shandle,&aux_ptr) != JMLIST_ERROR_SUCCESS )
+			break;
+		if( ((nvpair_t)aux_ptr)->name_id == REQNAME_DEADLINE ) {
+			nvp_seek = (nvpair_t)aux_ptr;
+			break;
+		}
+	}
+	jmlist_seek_end(req->data.bin.nvl,&shandle);
+
+	if( !nvp_seek || (jmlist_remove_by_ptr(req->data.bin.nvl,nvp_seek) != JMLIST_ERROR_SUCCESS) ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) failed to remove the deadline nvpair",req);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	_nvp_free(nvp_seek);
+	DBGRET_SUCCESS(MOD_REQ);
+}
+
+/*
+   req_deadline_set
+
+   Sets the deadline of a request (milliseconds since the epoch, see
+   req_deadline_now_ms) in the deadline nvpair. A request that already has
+   an earlier deadline keeps it, so a request never gets more time than its
+   caller gave it. Sealed requests can't be changed.
+*/
+wstatus
+req_deadline_set(request_t req,uint64_t deadline_ms)
+{
+	char value[24];
+	char *name = (char*)reqid_name_str(REQNAME_DEADLINE);
+	nvpair_t nvp = 0;
+
+	dbgprint(MOD_REQ,__func__,"called with req=%p, deadline_ms=%llu",req,(unsigned long long)deadline_ms);
+
+	if( !req || !deadline_ms || req_is_sealed(req) ) {
+		dbgprint(MOD_REQ,__func__,"invalid arguments or sealed request (req=%p)",req);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( req_get_nv_id(req,REQNAME_DEADLINE,&nvp) == WSTATUS_SUCCESS ) {
+		_nvp_free(nvp);
+		if( (req_deadline_parse(req) == WSTATUS_SUCCESS) && (req->deadline_ms <= deadline_ms) ) {
+			dbgprint(MOD_REQ,__func__,"(req=%p) request keeps its earlier deadline",req);
+			DBGRET_SUCCESS(MOD_REQ);
+		}
+		if( _req_deadline_remove(req) != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"(req=%p) failed to replace the deadline",req);
+			DBGRET_FAILURE(MOD_REQ);
+		}
+	}
+
+	snprintf(value,sizeof(value),"%llu",(unsigned long long)deadline_ms);
+	if( req_add_nvp_z(name,value,req) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) failed to add deadline nvpair",req);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	req->deadline_ms = deadline_ms;
+	DBGRET_SUCCESS(MOD_REQ);
+}
+
+/*
+   req_expired
+
+   Returns true when the request has a deadline and now_ms is past it.
+*/
+bool
+req_expired(const request_t req,uint64_t now_ms)
+{
+	return req->deadline_ms && (now_ms >= req->deadline_ms);
+}
+
+/*
+   req_dup
+
+   Duplicates a request. For binary requests the header is copied and a new
+   nv-pair list is created where each nvpair references the value blob of the
+   original one, so no value bytes are copied. Text requests are copied as a
+   whole since the raw text lives in the request data structure. The returned
+   request must be freed with req_free.
+*/
+wstatus
+req_dup(const request_t req,request_t *new_req)
+{
+	request_t aux_req = 0;
+	struct _jmlist_params jmlp = { .flags = JMLIST_LINKED };
+	jmlist_seek_handle shandle;
+	jmlist_status jmls;
+	nvpair_t nvp;
+	nvpair_t aux_nvp;
+	void *aux_ptr;
+	unsigned int nv_count;
+	size_t req_size;
+	wstatus ws;
+
+	dbgprint(MOD_REQ,__func__,"called with req=%p, new_req=%p",req,new_req);
+
+	if( !req ) {
+		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( !new_req ) {
+		dbgprint(MOD_REQ,__func__,"invalid new_req argument (new_req=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	switch(req->stype)
+	{
+		case REQUEST_STYPE_BIN:
+			req_size = sizeof(struct _request_t);
+			break;
+		case REQUEST_STYPE_TEXT:
+			req_size = sizeof(struct _request_t) + strlen(req->data.text.raw);
+			break;
+		case REQUEST_STYPE_PIPE:
+			/* unsupported for now */
+		default:
+			dbgprint(MOD_REQ,__func__,"invalid or unsupported request type (%d)",req->stype);
+			DBGRET_FAILURE(MOD_REQ);
+	}
+
+	aux_req = (request_t)malloc(req_size);
+	if( !aux_req ) {
+		dbgprint(MOD_REQ,__func__,"malloc failed for size %u",req_size);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+	memcpy(aux_req,req,req_size);
+
+	/* the reply data, seal state and record belong to the original request only */
+
+	memset(&aux_req->reply_lock,0,sizeof(aux_req->reply_lock));
+	aux_req->reply_nvl = 0;
+	_req_seal_clear(aux_req);
+	aux_req->deadline_ms = req->deadline_ms;
+
+	if( (req->stype != REQUEST_STYPE_BIN) || !req->data.bin.nvl )
+		goto skip_nvl_dup;
+
+	aux_req->data.bin.nvl = 0;
+	jmls = jmlist_create(&aux_req->data.bin.nvl,&jmlp);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"failed to create jmlist (jmls=%d)",jmls);
+		aux_req->data.bin.nvl = 0;
+		goto return_fail;
+	}
+
+	jmls = jmlist_entry_count(req->data.bin.nvl,&nv_count);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"failed to get nvl entry count (jmls=%d)",jmls);
+		goto return_fail;
+	}
+
+	jmls = jmlist_seek_start(req->data.bin.nvl,&shandle);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"failed to start seeking nvl (jmls=%d)",jmls);
+		goto return_fail;
+	}
+
+	while( nv_count-- )
+	{
+		jmls = jmlist_seek_next(req->data.bin.nvl,&shandle,&aux_ptr);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"failed to seek next nvpair (jmls=%d)",jmls);
+			jmlist_seek_end(req->data.bin.nvl,&shandle);
+			goto return_fail;
+		}
+		nvp = (nvpair_t)aux_ptr;
+
+		ws = _nvp_dup(nvp,&aux_nvp);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"failed to duplicate nvpair (nvp=%p)",nvp);
+			jmlist_seek_end(req->data.bin.nvl,&shandle);
+			goto return_fail;
+		}
+
+		jmls = jmlist_insert(aux_req->data.bin.nvl,aux_nvp);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"failed to insert nvpair into nvl (jmls=%d)",jmls);
+			_nvp_free(aux_nvp);
+			jmlist_seek_end(req->data.bin.nvl,&shandle);
+			goto return_fail;
+		}
+	}
+
+	jmls = jmlist_seek_end(req->data.bin.nvl,&shandle);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"failed to end seeking nvl (jmls=%d)",jmls);
+		goto return_fail;
+	}
+
+skip_nvl_dup:
+	*new_req = aux_req;
+	dbgprint(MOD_REQ,__func__,"updated new_req value to %p",*new_req);
+
+	DBGRET_SUCCESS(MOD_REQ);
+
+return_fail:
+	if( aux_req->data.bin.nvl ) {
+		jmlist_parse(aux_req->data.bin.nvl,_req_nvl_jml_free,0);
+		jmlist_free(aux_req->data.bin.nvl);
+	}
+	free(aux_req);
+
+	DBGRET_FAILURE(MOD_REQ);
+}
+
+/*
+   req_get_nv
+
+   Helper function that searches a name-value pair in a request, it uses the name as the needle.
+   The name-value pair is returned in a nvpair_t structure, the client passes the address of
+   a variable that receives a nvpair_t pointer. The client is responsible for freeing the nvp
+   data structure returned using _nvp_free.
+*/
+wstatus
+req_get_nv(const request_t req,const char *name_ptr,unsigned int name_size,nvpair_t *nvpp)
+{
+	wstatus ws;
+
+	dbgprint(MOD_REQ,__func__,"called with req=%p, name_ptr=%p (%s), name_size=%u, nvpp=%p",
+			req,name_ptr,array2z(name_ptr,name_size),name_size,nvpp);
+
+	/* start by validating the arguments */
+
+	if( !req ) {
+		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( !name_ptr ) {
+		dbgprint(MOD_REQ,__func__,"invalid name_ptr argument (name_ptr=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( !name_size ) {
+		dbgprint(MOD_REQ,__func__,"invalid name_size (name_size=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	switch(req->stype)
+	{
+		case REQUEST_STYPE_TEXT:
+			dbgprint(MOD_REQ,__func__,"request in req=%p is of TEXT stype, calling helper function _req_text_get_nv");
+			ws = _req_text_get_nv(req,name_ptr,name_size,nvpp);
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_REQ,__func__,"helper function _req_text_get_nv failed (ws=%d)",ws);
+				goto return_fail;
+			}
+			dbgprint(MOD_REQ,__func__,"helper function _req_text_get_nv was successful");
+			break;
+		case REQUEST_STYPE_BIN:
+			dbgprint(MOD_REQ,__func__,"request in req=%p is of BIN stype, calling helper function _req_bin_get_nv");
+			ws = _req_bin_get_nv(req,name_ptr,name_size,nvpp);
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_REQ,__func__,"helper function _req_bin_get_nv failed (ws=%d)");
+				goto return_fail;
 			}
-			dbgprint(MOD_REQ,__func__,"(req=%p) decoded successfully the value",req);
+			dbgprint(MOD_REQ,__func__,"helper function _req_bin_get_nv was successful");
+			break;
+		case REQUEST_STYPE_PIPE:
+		default:
+			dbgprint(MOD_REQ,__func__,"invalid or unsupported request stype (%d)",req->stype);
+			DBGRET_FAILURE(MOD_REQ);
+	}
+
+	DBGRET_SUCCESS(MOD_REQ);
+return_fail:
+	DBGRET_FAILURE(MOD_REQ);
+}
+
+/*
+   req_get_nv_id
+
+   Same as req_get_nv but the needle is the id of a well-known name (see
+   reqids.list). The nvpairs of binary requests were tagged when they were
+   parsed, so the lookup compares integers instead of names. Text requests
+   are searched by the name of the id.
+*/
+wstatus
+req_get_nv_id(const request_t req,reqname_id name_id,nvpair_t *nvpp)
+{
+	const char *name_ptr;
+	jmlist_seek_handle shandle;
+	jmlist_status jmls;
+	jmlist_index nv_count;
+	void *aux_ptr;
+	nvpair_t nvp_seek;
+	wstatus ws;
+
+	dbgprint(MOD_REQ,__func__,"called with req=%p, name_id=%u, nvpp=%p",req,name_id,nvpp);
+
+	if( !req || !nvpp ) {
+		dbgprint(MOD_REQ,__func__,"invalid arguments (req=0 or nvpp=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	name_ptr = reqid_name_str(name_id);
+	if( !name_ptr ) {
+		dbgprint(MOD_REQ,__func__,"invalid name_id argument (%u)",name_id);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( req->stype != REQUEST_STYPE_BIN )
+		return req_get_nv(req,name_ptr,strlen(name_ptr),nvpp);
+
+	if( !req->data.bin.nvl ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) this request doesn't have any name-value pair",req);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	jmls = jmlist_entry_count(req->data.bin.nvl,&nv_count);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) failed to get nvl count (jmls=%d)",req,jmls);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	jmls = jmlist_seek_start(req->data.bin.nvl,&shandle);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) failed to start seeking nvl (jmls=%d)",req,jmls);
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	while( nv_count-- )
+	{
+		jmls = jmlist_seek_next(req->data.bin.nvl,&shandle,&aux_ptr);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"(req=%p) failed to seek nvl (jmls=%d)",req,jmls);
+			break;
+		}
+
+		nvp_seek = (nvpair_t)aux_ptr;
+		if( nvp_seek->name_id != name_id )
+			continue;
+
+		jmlist_seek_end(req->data.bin.nvl,&shandle);
+
+		ws = _nvp_dup(nvp_seek,nvpp);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"(req=%p) unable to duplicate request nvpair",req);
+			DBGRET_FAILURE(MOD_REQ);
+		}
+
+		dbgprint(MOD_REQ,__func__,"(req=%p) nvpp value updated to %p",req,*nvpp);
+		DBGRET_SUCCESS(MOD_REQ);
+	}
+
+	jmlist_seek_end(req->data.bin.nvl,&shandle);
+	dbgprint(MOD_REQ,__func__,"(req=%p) unable to find the wanted nvpair (%s)",req,name_ptr);
+	DBGRET_FAILURE(MOD_REQ);
+}
+
+/*
+   _req_text_get_nv
+
+   Helper function to get a specific name-value pair value data. This function will return the original
+   decoded data. If the name-value pair isn't found or the request doesn't have any name-value pair
+   this function returns error. Since this function is processing a request in text form, it starts
+   by calling the text token seeker function to seek to the name-value list. After that it parses each
+   name-value pair using _req_text_nv_parse which returns name/value pointers, using that information
+   it compares the name with look_name, if its equal the name-value pair was found and the value
+   is processed.
+*/
+wstatus
+_req_text_get_nv(const request_t req,const char *look_name_ptr,unsigned int look_name_size,nvpair_t *nvpp)
+{
+	unsigned int nv_idx;
+	char *aux;
+	char *value_start,*name_start;
+	unsigned int name_size, value_size;
+	wstatus ws;
+	nvpair_fflag_list fflags;
+	nvpair_t aux_nvp = 0;
+
+	dbgprint(MOD_REQ,__func__,"called with req=%p, name_ptr=%p (%s), name_size=%u, nvpp=%p",
+			req,look_name_ptr,array2z(look_name_ptr,look_name_size),look_name_size,nvpp);
+
+	/* start by validating the arguments */
+
+	if( !req ) {
+		dbgprint(MOD_REQ,__func__,"invalid req argument (req=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( !look_name_ptr ) {
+		dbgprint(MOD_REQ,__func__,"invalid look_name_ptr argument (look_name_ptr=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( !look_name_size ) {
+		dbgprint(MOD_REQ,__func__,"invalid look_name_size (look_name_size=0)");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	if( req->stype != REQUEST_STYPE_TEXT ) {
+		dbgprint(MOD_REQ,__func__,"invalid request to be used with this function");
+		DBGRET_FAILURE(MOD_REQ);
+	}
+
+	/* seek to name-value pair list in the request */
+
+	ws = _req_text_token_seek(req->data.text.raw,TEXT_TOKEN_NVL,&aux);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQ,__func__,"(req=%p) unable to find nvl begin",req);
+		goto return_fail;
+	}
+
+	for( nv_idx = 1 ; ; nv_idx++ )
+   	{
+		/* try to parse nvpair text tokens */
+		ws = _req_text_nv_parse(aux,&name_start,&name_size,&value_start,&value_size,&fflags);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQ,__func__,"(req=%p) failed to process text request",req);
+			goto return_fail;
+		}
+
+
+		if( name_size != look_name_size ) {
+			dbgprint(MOD_REQ,__func__,"(req=%p) this nvpair has different name size, seeking",req);
+			goto seek_nvp;
+		}
+
+		/* compare name with the lookup name */
+
+		if( memcmp(name_start,look_name_ptr,name_size) ) {
+			dbgprint(MOD_REQ,__func__,"(req=%p) this nvpair has different name, seeking",req);
+			goto seek_nvp;
 		}
+		dbgprint(MOD_REQ,__func__,"(req=%p) nvpair was found successfully",req);
 
 		/* allocate new nvpair data structure for this nvpair */
 
 		if( nvp_flag_test(fflags,NVPAIR_FFLAG_ENCODED) )
-			ws = _nvp_alloc(name_size,decoded_size,&aux_nvp);
+			ws = _nvp_alloc_decoded(name_start,name_size,value_start,value_size,&aux_nvp);
 		else
 			ws = _nvp_alloc(name_size,value_size,&aux_nvp);
 
@@ -2232,26 +3176,18 @@ _req_text_get_nv(const request_t req,const char *look_name_ptr,unsigned int look
 		}
 		dbgprint(MOD_REQ,__func__,"(req=%p) allocated new nvpair data structure successfully (p=%p)",req,aux_nvp);
 
-		/* fill the new data structure with the tokens */
+		/* fill the new data structure with the tokens, encoded values were
+		   already decoded into the nvpair */
 		
-		if( nvp_flag_test(fflags,NVPAIR_FFLAG_ENCODED) )
-			ws = _nvp_fill(name_start,name_size,decoded_ptr,decoded_size,aux_nvp);
-		else
+		if( !nvp_flag_test(fflags,NVPAIR_FFLAG_ENCODED) ) {
 			ws = _nvp_fill(name_start,name_size,value_start,value_size,aux_nvp);
-
-		if( ws != WSTATUS_SUCCESS ) {
-			dbgprint(MOD_REQ,__func__,"(req=%p) failed to fill the new nvpair (p=%p)",req,aux_nvp);
-			goto return_fail;
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_REQ,__func__,"(req=%p) failed to fill the new nvpair (p=%p)",req,aux_nvp);
+				goto return_fail;
+			}
 		}
 		dbgprint(MOD_REQ,__func__,"(req=%p) new nvpair was filled successfully",req);
 
-		/* we can now free the decoded buffer if it was used */
-		if( decoded_ptr ) {
-			free(decoded_ptr);
-			decoded_ptr = 0;
-			decoded_size = 0;
-		}
-
 		/* return this nvpair to the calling function */
 
 		*nvpp = aux_nvp;
@@ -2287,9 +3223,6 @@ seek_nvp:
 	goto return_fail;
 
 return_fail:
-	if( decoded_ptr )
-		free(decoded_ptr);
-
 	if( aux_nvp ) {
 		_nvp_free(aux_nvp);
 	}
@@ -3560,6 +4493,12 @@ end_of_name:
 			goto value_end;
 		}
 
+		if( !quoted && V_TOKSEPCHAR(*aux) )
+		{
+			dbgprint(MOD_REQ,__func__,"(nv_ptr=%p) found name-value pair sep character",*nv_ptr);
+			goto value_end;
+		}
+
 		if( encoded && !V_EVALUECHAR(*aux) ) {
 			dbgprint(MOD_REQ,__func__,"(nv_ptr=%p) invalid character found in encoded value (0x%02X '%c' at index %u)",
 					*nv_ptr,*aux,b2c(*aux),aux - aux_ref);
@@ -3572,12 +4511,6 @@ end_of_name:
 			goto return_invalid;
 		}
 
-		if( !quoted && V_TOKSEPCHAR(*aux) )
-		{
-			dbgprint(MOD_REQ,__func__,"(nv_ptr=%p) found name-value pair sep character");
-			goto value_end;
-		}
-
 		if( !quoted && !encoded && !V_VALUECHAR(*aux) )
 		{
 			dbgprint(MOD_REQ,__func__,"(nv_ptr=%p) invalid character found in value (0x%02X '%c' at index %u)",
@@ -32,6 +32,8 @@
 #include "jmlist.h"
 #include "wlock.h"
 #include "nvpair.h"
+#include "watomic.h"
+#include "reqids.h"
 
 #ifndef MAX
 #define MAX(a,b) (a > b ? a : b)
@@ -68,12 +70,15 @@ typedef enum _text_token_t {
 	TEXT_TOKEN_NVL
 } text_token_t;
 
+/* code_id tags the well-known codes (reqids.list), it's set by the parser
+   and by whoever builds a binary request by hand, REQCODE_UNKNOWN otherwise */
 typedef struct _req_data_bin {
 	request_type_list type;
 	int id;
 	char src[REQMODSIZE];
 	char dst[REQMODSIZE];
 	char code[REQCODESIZE];
+	reqcode_id code_id;
 	jmlist nvl;
 } req_data_bin;
 
@@ -87,11 +92,29 @@ typedef struct _req_data_text {
 	char raw[1];
 } req_data_text;
 
+/* request_t flags */
+#define REQUEST_FLAG_SEALED 0x01
+
 typedef struct _request_t {
 	request_stype_list stype;
 	unsigned int data_size;
 	wlock_t reply_lock;
 	jmlist reply_nvl;
+	/* seal state: once sealed the request is read-only and refcounted,
+	   text_cache holds the text serialization (built once on demand) */
+	unsigned int flags;
+	watomic_t refcount;
+	void *text_cache;
+	/* typed values pre-decoded at ingress when the request code has a
+	   schema (see reqschema.h), owned by the request */
+	void *record;
+	/* ingress timestamp (modstats_now_ns) and size on the wire of received
+	   requests, 0 for requests created locally (see modstats.h) */
+	uint64_t ingress_ns;
+	unsigned int wire_size;
+	/* absolute deadline of the request in wall clock milliseconds (see
+	   req_deadline_parse), 0 = no deadline */
+	uint64_t deadline_ms;
 	union _data {
 		req_data_bin bin;
 		req_data_pipe pipe;
@@ -102,6 +125,7 @@ typedef struct _request_t {
 
 
 #define rtype_str(x) (x == REQUEST_TYPE_REQUEST ? "REQUEST" : "REPLY")
+#define req_is_sealed(x) ((x)->flags & REQUEST_FLAG_SEALED)
 #define V_RIDCHAR(x) isdigit(x)
 #define V_MODCHAR(x) isalnum(x)
 #define V_CODECHAR(x) (isalnum(x) || (x == '.') || (x == '_') || (x == '-'))
@@ -112,6 +136,41 @@ typedef struct _request_t {
 #define REQERROR_DESCNAME "errorMsg"
 #define REQERROR_MODUNFOUND "Destination module %s was not found in modmgr module list."
 
+#define REQERROR_BUSY "Request rejected by modmgr admission control (%s), try again later."
+#define REQERROR_INBOXFULL "Module %s is busy (inbox is full), try again later."
+#define REQERROR_RINGFULL "Module %s is busy (shared memory ring is full), try again later."
+#define REQERROR_NOREPLICA "No replica of module %s is available, try again later."
+
+/* request header, the fields read by req_peek_header without parsing the
+   rest of the request (admission control, routing decisions) */
+typedef struct _req_header_t {
+	request_type_list type;
+	int id;
+	char src[REQMODSIZE];
+	char dst[REQMODSIZE];
+} req_header_t;
+
+/* binary frame of a request (see req_to_frame), used by the transports
+   between processes of the same host (see shmring.h). The fields are in
+   host byte order, the header is followed by src, dst and code (without
+   null chars), then by a req_frame_nv_t, the name and the value of each
+   nvpair. */
+typedef struct _req_frame_t {
+	uint32_t size;				/* of the whole frame */
+	int32_t id;
+	uint16_t nv_count;
+	uint8_t type;
+	uint8_t src_size;
+	uint8_t dst_size;
+	uint8_t code_size;
+	uint16_t reserved;
+} req_frame_t;
+
+typedef struct _req_frame_nv_t {
+	uint16_t name_size;
+	uint16_t value_size;
+} req_frame_nv_t;
+
 typedef enum _request_lookup_result {
 	REQUEST_NV_FOUND,
 	REQUEST_NV_NOT_FOUND
@@ -145,6 +204,9 @@ typedef enum _token_status_t {
 } token_status_t;
 
 /* internal functions */
+void _req_seal_clear(request_t req);
+wstatus _req_destroy(request_t req);
+wstatus _req_deadline_remove(request_t req);
 wstatus _req_from_text_to_bin(request_t req,request_t *req_bin);
 wstatus _req_from_pipe_to_bin(request_t req,request_t *req_bin);
 wstatus _req_nv_value_info(char *value_ptr,char **value_start,char **value_end,uint16_t *value_size);
@@ -167,13 +229,16 @@ wstatus _req_validate_nv(char **nv_ptr,const unsigned int nv_max_size,nv_status_
 /* functions that modify existing request */
 wstatus req_insert_nv(request_t req,char *name,char *value);
 wstatus req_add_nvp_z(const char *name_ptr,const char *value_ptr,request_t req);
+wstatus req_add_nvp_blob(const char *name_ptr,uint16_t name_size,nvblob_t blob,request_t req);
 wstatus req_remove_nv(request_t req,char *name);
 
 /* functions to get informations/data from the request */
 wstatus req_get_nv(const request_t req,const char *name_ptr,unsigned int name_size,nvpair_t *nvpp);
+wstatus req_get_nv_id(const request_t req,reqname_id name_id,nvpair_t *nvpp);
 wstatus req_get_nv_count(const struct _request_t *req,unsigned int *nv_count);
 wstatus req_get_nv_info(const struct _request_t *req,const char *look_name_ptr,unsigned int look_name_size,nvpair_info_t nvpi);
 wstatus req_validate(const char *req_text,const unsigned int req_size,req_validation_t *req_validation);
+wstatus req_peek_header(const char *req_text,unsigned int req_size,req_header_t *header);
 
 /* functions that output new request data structure */
 wstatus req_from_string(const char *raw_text,request_t *req_text);
@@ -182,6 +247,24 @@ wstatus req_to_bin(request_t req,request_t *req_bin);
 
 /* clean up functions */
 wstatus req_free(request_t req);
+wstatus req_dup(const request_t req,request_t *new_req);
+
+/* sealed requests */
+wstatus req_seal(request_t req);
+wstatus req_ref(request_t req);
+wstatus req_unref(request_t req);
+wstatus req_sealed_text(request_t req,const char **text_ptr,unsigned int *text_size);
+
+/* binary frames */
+wstatus req_frame_size(const request_t req,unsigned int *frame_size);
+wstatus req_to_frame(const request_t req,void *frame_ptr,unsigned int frame_size,unsigned int *frame_used);
+wstatus req_from_frame(const void *frame_ptr,unsigned int frame_size,request_t *req);
+
+/* deadlines, carried by the deadline nvpair (milliseconds since the epoch) */
+uint64_t req_deadline_now_ms(void);
+wstatus req_deadline_parse(request_t req);
+wstatus req_deadline_set(request_t req,uint64_t deadline_ms);
+bool req_expired(const request_t req,uint64_t now_ms);
 
 /* debugging functions */
 wstatus req_dump(request_t req);
@@ -33,8 +33,23 @@ struct _reqbuf_t {
 	void *buffer_ptr;
 	size_t buffer_size;
 	size_t buffer_used;
+	wcapture_t capture;
+	uint16_t capture_id;
+	REQBUFADMITCB admit_cb;
+	void *admit_param;
+	/* zero copy source (reqbuf_create_zc) */
+	REQBUFPEEKCB peek_cb;
+	REQBUFDONECB done_cb;
+	void *chunk_ptr;
+	unsigned int chunk_used;
+	unsigned int chunk_pos;				/* bytes of the chunk already parsed */
+	unsigned int chunk_id;
+	bool chunk_lent;
+	bool ready_read;					/* reqbuf_read_ready read since its last WSTATUS_AGAIN */
 };
 
+static wstatus _reqbuf_read(reqbuf_t rb,request_t *req,bool once);
+
 wstatus
 reqbuf_load(reqbuf_load_t *load)
 {
@@ -74,6 +89,39 @@ reqbuf_wchannel_read_cb(void *param,void *chunk_ptr,unsigned int chunk_size, uns
 	DBGRET_SUCCESS(MOD_REQBUF);
 }
 
+/*
+   reqbuf_wchannel_peek_cb
+
+   Callback function for the zero copy reading from a wchannel, the message
+   is lent by wchannel_receive_zc and given back by reqbuf_wchannel_done_cb.
+*/
+wstatus
+reqbuf_wchannel_peek_cb(void *param,void **chunk_ptr,unsigned int *chunk_used,unsigned int *chunk_id)
+{
+	wchannel_t wch = (wchannel_t)param;
+	wstatus ws;
+
+	ws = wchannel_receive_zc(wch,chunk_ptr,chunk_used,chunk_id);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQBUF,__func__,"wchannel receive failed (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_REQBUF);
+	}
+
+	dbgprint(MOD_REQBUF,__func__,"received %u bytes in buffer %u from wch=%p",*chunk_used,*chunk_id,wch);
+	DBGRET_SUCCESS(MOD_REQBUF);
+}
+
+/*
+   reqbuf_wchannel_done_cb
+
+   Callback function that gives back a message lent by reqbuf_wchannel_peek_cb.
+*/
+wstatus
+reqbuf_wchannel_done_cb(void *param,unsigned int chunk_id)
+{
+	return wchannel_receive_done((wchannel_t)param,chunk_id);
+}
+
 /*
    reqbuf_create
 
@@ -109,6 +157,18 @@ reqbuf_create(REQBUFREADCB read_cb,void *param,reqbuf_type_list type,reqbuf_t *r
 	new_rb->buffer_ptr = malloc(REQBUF_INIT_SIZE);
 	new_rb->buffer_size = REQBUF_INIT_SIZE;
 	new_rb->buffer_used = 0;
+	new_rb->capture = 0;
+	new_rb->capture_id = 0;
+	new_rb->admit_cb = 0;
+	new_rb->admit_param = 0;
+	new_rb->peek_cb = 0;
+	new_rb->done_cb = 0;
+	new_rb->chunk_ptr = 0;
+	new_rb->chunk_used = 0;
+	new_rb->chunk_pos = 0;
+	new_rb->chunk_id = 0;
+	new_rb->chunk_lent = false;
+	new_rb->ready_read = false;
 
 	dbgprint(MOD_REQBUF,__func__,"request buffer data structure was initialized (ptr=%p)",new_rb);
 
@@ -129,6 +189,37 @@ return_fail:
 	DBGRET_FAILURE(MOD_REQBUF);
 }
 
+/*
+   reqbuf_create_zc
+
+   Creates a request buffer that reads chunks lent by peek_cb instead of
+   copying them with a read callback. The requests are parsed straight from
+   the chunk, which is given back with done_cb once every request in it was
+   read. Only a request split between chunks is copied to the buffer.
+*/
+wstatus
+reqbuf_create_zc(REQBUFPEEKCB peek_cb,REQBUFDONECB done_cb,void *param,reqbuf_type_list type,reqbuf_t *rb)
+{
+	wstatus ws;
+
+	dbgprint(MOD_REQBUF,__func__,"called with peek_cb=%p, done_cb=%p, param=%p, type=%d, rb=%p",
+			peek_cb,done_cb,param,type,rb);
+
+	if( !peek_cb || !done_cb ) {
+		dbgprint(MOD_REQBUF,__func__,"invalid arguments (peek_cb=%p, done_cb=%p)",peek_cb,done_cb);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	ws = reqbuf_create(0,param,type,rb);
+	if( ws != WSTATUS_SUCCESS ) {
+		DBGRET_FAILURE(MOD_REQBUF);
+	}
+
+	(*rb)->peek_cb = peek_cb;
+	(*rb)->done_cb = done_cb;
+	DBGRET_SUCCESS(MOD_REQBUF);
+}
+
 /*
    _reqbuf_req_is_complete
 
@@ -303,6 +394,202 @@ end_of_request:
 	DBGRET_SUCCESS(MOD_REQBUF);
 }
 
+/*
+   _reqbuf_shift
+
+   Helper function that removes the first size bytes of the buffer (a request
+   that was read or dropped) shifting the remaining data to the beginning.
+*/
+void
+_reqbuf_shift(reqbuf_t rb,unsigned int size)
+{
+	/* if the size == buffer_used means the buffer contained only one request and
+	   nothing more, we can skip the shifting in that case. */
+	if( size < rb->buffer_used )
+		memmove(rb->buffer_ptr,(char*)rb->buffer_ptr + size,rb->buffer_used - size);
+
+	rb->buffer_used -= size;
+}
+
+/*
+   _reqbuf_admit
+
+   Helper function that reads the header of the request at the beginning of
+   the buffer and asks the admission callback if it may be read. Requests with
+   a header that can't be read are admitted, they'll fail later in the parser
+   with a proper error.
+*/
+bool
+_reqbuf_admit(reqbuf_t rb,void *req_ptr,unsigned int req_size)
+{
+	req_header_t header;
+	request_t bin_req;
+
+	if( rb->type == REQBUF_TYPE_TEXT ) {
+		if( req_peek_header(req_ptr,req_size,&header) != WSTATUS_SUCCESS )
+			return true;
+	} else {
+		if( req_size < sizeof(struct _request_t) )
+			return true;
+		bin_req = (request_t)req_ptr;
+		header.type = bin_req->data.bin.type;
+		header.id = bin_req->data.bin.id;
+		memcpy(header.src,bin_req->data.bin.src,sizeof(header.src));
+		memcpy(header.dst,bin_req->data.bin.dst,sizeof(header.dst));
+		header.src[sizeof(header.src)-1] = '\0';
+		header.dst[sizeof(header.dst)-1] = '\0';
+	}
+
+	if( rb->admit_cb(rb->admit_param,&header) )
+		return true;
+
+	dbgprint(MOD_REQBUF,__func__,"request id %d from %s was not admitted, dropping it (%u bytes)",
+			header.id,header.src,req_size);
+	return false;
+}
+
+/*
+   _reqbuf_take
+
+   Helper function that takes the request at the beginning of req_ptr, with
+   avail bytes of data. req_size is updated with the size of the request, 0
+   if it's incomplete, and req with the new request, 0 if it was dropped
+   (not admitted or malformed).
+
+   The reqbuf type here is important because the type of reqbuf determines the way
+   this function detects the requests in the buffer.
+*/
+static wstatus
+_reqbuf_take(reqbuf_t rb,void *req_ptr,unsigned int avail,request_t *req,unsigned int *req_size)
+{
+	wstatus ws;
+	request_t new_req;
+	bool complete_flag;
+
+	*req = 0;
+	*req_size = 0;
+
+	ws = _reqbuf_req_is_complete(req_ptr,avail,rb->type,&complete_flag);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQBUF,__func__,"unable to use _reqbuf_req_is_complete on rb=%p",rb);
+		DBGRET_FAILURE(MOD_REQBUF);
+	}
+	dbgprint(MOD_REQBUF,__func__,"request complete flag is %d",complete_flag);
+
+	if( complete_flag != true )
+		return WSTATUS_SUCCESS;
+
+	ws = _reqbuf_find_req_size(req_ptr,avail,rb->type,req_size);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQBUF,__func__,"unable to find request size on rb=%p",rb);
+		DBGRET_FAILURE(MOD_REQBUF);
+	}
+	dbgprint(MOD_REQBUF,__func__,"detected request size as %u bytes long",*req_size);
+
+	/* admission control looks only at the header, a request that isn't
+	   admitted is dropped before being parsed or copied */
+	if( rb->admit_cb && !_reqbuf_admit(rb,req_ptr,*req_size) )
+		return WSTATUS_SUCCESS;
+
+	if( rb->type == REQBUF_TYPE_TEXT )
+		goto req_type_text;
+	else if( rb->type == REQBUF_TYPE_BINARY )
+		goto req_type_bin;
+
+	dbgprint(MOD_REQBUF,__func__,"invalid or unsupported request buffer type (%d)",rb->type);
+	DBGRET_FAILURE(MOD_REQBUF);
+
+req_type_text:
+	ws = req_from_string(req_ptr,&new_req);
+	if( ws != WSTATUS_SUCCESS ) {
+		/* a malformed request is dropped, otherwise it would block the ones behind it */
+		dbgprint(MOD_REQBUF,__func__,"unable to create text request, dropping it "
+				"(_req_from_string failed, ws=%s)",wstatus_str(ws));
+		return WSTATUS_SUCCESS;
+	}
+	dbgprint(MOD_REQBUF,__func__,"created text request successfully (ptr=%p)",new_req);
+	new_req->wire_size = *req_size;
+
+	/* record the request text in the capture log */
+	if( rb->capture )
+		wcapture_write(rb->capture,WCAPTURE_DIR_IN,rb->capture_id,req_ptr,*req_size);
+
+	*req = new_req;
+	dbgprint(MOD_REQBUF,__func__,"updated req argument value to %p",*req);
+	return WSTATUS_SUCCESS;
+
+req_type_bin:
+
+	/* if the request is in binary form, it means it is actually the data structure,
+	   simply allocate and copy the memory. */
+	new_req = (request_t)malloc(*req_size);
+	if( !new_req ) {
+		dbgprint(MOD_REQBUF,__func__,"malloc failed (size=%u)",*req_size);
+		DBGRET_FAILURE(MOD_REQBUF);
+	}
+	dbgprint(MOD_REQBUF,__func__,"allocated request data structure successfully (ptr=%p)",new_req);
+	memcpy(new_req,req_ptr,*req_size);
+	dbgprint(MOD_REQBUF,__func__,"copied request data into new request data structure OK");
+
+	/* the copy is a new request, it doesn't share the seal state of the original */
+	_req_seal_clear(new_req);
+	new_req->wire_size = *req_size;
+
+	*req = new_req;
+	dbgprint(MOD_REQBUF,__func__,"updated req argument value to %p",*req);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   _reqbuf_append
+
+   Helper function that copies data to the end of the buffer, growing it if
+   needed. Used by zero copy buffers for a request split between chunks.
+*/
+static wstatus
+_reqbuf_append(reqbuf_t rb,void *data_ptr,unsigned int data_size)
+{
+	size_t new_size;
+	void *new_ptr;
+
+	if( rb->buffer_used + data_size > rb->buffer_size )
+	{
+		new_size = rb->buffer_used + data_size + REQBUF_INC_SIZE;
+		new_ptr = realloc(rb->buffer_ptr,new_size);
+		if( !new_ptr ) {
+			dbgprint(MOD_REQBUF,__func__,"realloc failed (size=%u)",(unsigned int)new_size);
+			DBGRET_FAILURE(MOD_REQBUF);
+		}
+		rb->buffer_ptr = new_ptr;
+		rb->buffer_size = new_size;
+	}
+
+	memcpy((char*)rb->buffer_ptr + rb->buffer_used,data_ptr,data_size);
+	rb->buffer_used += data_size;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   _reqbuf_chunk_done
+
+   Helper function that gives back the chunk lent by the peek callback.
+*/
+static void
+_reqbuf_chunk_done(reqbuf_t rb)
+{
+	wstatus ws;
+
+	ws = rb->done_cb(rb->param,rb->chunk_id);
+	if( ws != WSTATUS_SUCCESS )
+		dbgprint(MOD_REQBUF,__func__,"done_cb (%p) failed for chunk %u (ws=%s)",
+				rb->done_cb,rb->chunk_id,wstatus_str(ws));
+
+	rb->chunk_lent = false;
+	rb->chunk_ptr = 0;
+	rb->chunk_used = 0;
+	rb->chunk_pos = 0;
+}
+
 /*
    reqbuf_read
 
@@ -311,101 +598,126 @@ end_of_request:
    is found inside the buffer. When a request is found it is taken from the buffer and
    all the data is shifted, buffer_used is updated.
 
-   The reqbuf type here is important because the type of reqbuf determines the way
-   this function detects the requests in the buffer.
+   Zero copy buffers (reqbuf_create_zc) take the requests straight from the lent chunk
+   while the buffer is empty, the chunk is given back when it has no more requests. A
+   chunk that ends with an incomplete request has that part copied to the buffer, the
+   next chunks are copied after it until the buffer is empty again.
 */
 wstatus
 reqbuf_read(reqbuf_t rb,request_t *req)
+{
+	dbgprint(MOD_REQBUF,__func__,"called with rb=%p, req=%p",rb,req);
+
+	return _reqbuf_read(rb,req,false);
+}
+
+/*
+   reqbuf_read_ready
+
+   Like reqbuf_read but calls the read (or peek) callback at most once until
+   it returns WSTATUS_AGAIN, for sources that are known to have data without
+   waiting (a channel reported ready by wloop). The caller calls it until
+   WSTATUS_AGAIN, the requests that data completed were all returned then
+   and the caller should wait for the source to be ready again.
+*/
+wstatus
+reqbuf_read_ready(reqbuf_t rb,request_t *req)
+{
+	dbgprint(MOD_REQBUF,__func__,"called with rb=%p, req=%p",rb,req);
+
+	return _reqbuf_read(rb,req,true);
+}
+
+/*
+   _reqbuf_read
+
+   Helper function of reqbuf_read and reqbuf_read_ready, with once it
+   returns WSTATUS_AGAIN instead of calling the callbacks a second time
+   since the last WSTATUS_AGAIN.
+*/
+static wstatus
+_reqbuf_read(reqbuf_t rb,request_t *req,bool once)
 {
 	wstatus ws;
 	request_t new_req;
-	void *req_ptr;
 	unsigned int req_size;
-	bool complete_flag;
-	unsigned int chunk_used, i, j;
-
-	dbgprint(MOD_REQBUF,__func__,"called with rb=%p, req=%p",rb,req);
+	unsigned int chunk_used;
 
 	for(;;)
 	{
 		if( rb->buffer_used )
 	   	{
 			/* process data inside buffer.. */
-			req_ptr = rb->buffer_ptr;
-			ws = _reqbuf_req_is_complete(req_ptr,rb->buffer_used,rb->type,&complete_flag);
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_REQBUF,__func__,"unable to use _reqbuf_req_is_complete on rb=%p",rb);
+			ws = _reqbuf_take(rb,rb->buffer_ptr,rb->buffer_used,&new_req,&req_size);
+			if( ws != WSTATUS_SUCCESS )
 				goto return_fail;
-			}
-			dbgprint(MOD_REQBUF,__func__,"request complete flag is %d",complete_flag);
 
-			if( complete_flag != true ) {
-				/* try to get more data and come back later */
-				goto get_more_data;
-			}
+			if( req_size ) {
+				_reqbuf_shift(rb,req_size);
+				if( !new_req )
+					continue;
 
-			ws = _reqbuf_find_req_size(req_ptr,rb->buffer_used,rb->type,&req_size);
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_REQBUF,__func__,"unable to find request size on rb=%p",rb);
-				goto return_fail;
+				*req = new_req;
+				DBGRET_SUCCESS(MOD_REQBUF);
 			}
-			dbgprint(MOD_REQBUF,__func__,"detected request size as %u bytes long",req_size);
 
-			if( rb->type == REQBUF_TYPE_TEXT )
-				goto req_type_text;
-			else if( rb->type == REQBUF_TYPE_BINARY )
-				goto req_type_bin;
+			/* try to get more data and come back later */
+		} else if( rb->chunk_lent )
+		{
+			/* process data inside the lent chunk */
+			ws = _reqbuf_take(rb,(char*)rb->chunk_ptr + rb->chunk_pos,rb->chunk_used - rb->chunk_pos,
+					&new_req,&req_size);
+			if( ws != WSTATUS_SUCCESS )
+				goto return_fail;
 
-			dbgprint(MOD_REQBUF,__func__,"invalid or unsupported request buffer type (%d)",rb->type);
-			goto return_fail;
+			if( req_size ) {
+				rb->chunk_pos += req_size;
+				if( rb->chunk_pos == rb->chunk_used )
+					_reqbuf_chunk_done(rb);
+				if( !new_req )
+					continue;
 
-req_type_text:
-			ws = req_from_string(req_ptr,&new_req);
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_REQBUF,__func__,"unable to create text request "
-						"(_req_from_string failed, ws=%s)",wstatus_str(ws));
-				goto return_fail;
+				*req = new_req;
+				DBGRET_SUCCESS(MOD_REQBUF);
 			}
-			dbgprint(MOD_REQBUF,__func__,"created text request successfully (ptr=%p)",new_req);
-			*req = new_req;
-			dbgprint(MOD_REQBUF,__func__,"updated req argument value to %p",*req);
 
-			goto shift_chunk;
+			/* the chunk ends with an incomplete request, it waits in the buffer */
+			ws = _reqbuf_append(rb,(char*)rb->chunk_ptr + rb->chunk_pos,rb->chunk_used - rb->chunk_pos);
+			_reqbuf_chunk_done(rb);
+			if( ws != WSTATUS_SUCCESS )
+				goto return_fail;
+		}
 
-req_type_bin:
+		if( once ) {
+			if( rb->ready_read ) {
+				dbgprint(MOD_REQBUF,__func__,"no complete request without reading again");
+				rb->ready_read = false;
+				return WSTATUS_AGAIN;
+			}
+			rb->ready_read = true;
+		}
 
-			/* if the request is in binary form, it means it is actually the data structure,
-			   simply allocate and copy the memory. */
-			new_req = (request_t)malloc(req_size);
-			if( !new_req ) {
-				dbgprint(MOD_REQBUF,__func__,"malloc failed (size=%u)",req_size);
+		if( rb->peek_cb )
+		{
+			ws = rb->peek_cb(rb->param,&rb->chunk_ptr,&rb->chunk_used,&rb->chunk_id);
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_REQBUF,__func__,"peek_cb (%p) failed (ws=%s)",rb->peek_cb,wstatus_str(ws));
 				goto return_fail;
 			}
-			dbgprint(MOD_REQBUF,__func__,"allocated request data structure successfully (ptr=%p)",new_req);
-			memcpy(new_req,req_ptr,req_size);
-			dbgprint(MOD_REQBUF,__func__,"copied request data into new request data structure OK");
-
-			*req = new_req;
-			dbgprint(MOD_REQBUF,__func__,"updated req argument value to %p",*req);
-
-shift_chunk:
-			/* now we need to shift the data, if the req_size == buffer_used means the
-			   buffer contained only one request and nothing more, we can skip the shifting
-			   in that case. */
-
-			if( req_size == rb->buffer_used )
-				goto skip_shift;
-			
-			/* shift all the remaining bytes to the beginning of the buffer */
-			for( i = req_size, j = 0 ; i < rb->buffer_used ; i++, j++ )
-				((char*)rb->buffer_ptr)[j] = ((char*)rb->buffer_ptr)[i];
-
-skip_shift:
-			rb->buffer_used -= req_size;
-			DBGRET_SUCCESS(MOD_REQBUF);
+			dbgprint(MOD_REQBUF,__func__,"peeked chunk %u with %u bytes",rb->chunk_id,rb->chunk_used);
+			rb->chunk_pos = 0;
+			rb->chunk_lent = true;
+
+			if( rb->buffer_used || !rb->chunk_used ) {
+				/* the chunk completes the request waiting in the buffer */
+				ws = _reqbuf_append(rb,rb->chunk_ptr,rb->chunk_used);
+				_reqbuf_chunk_done(rb);
+				if( ws != WSTATUS_SUCCESS )
+					goto return_fail;
+			}
+			continue;
 		}
 
-get_more_data:
 		if( rb->buffer_used == rb->buffer_size )
 	   	{
 			dbgprint(MOD_REQBUF,__func__,"increasing buffer size from %u to %u",
@@ -417,6 +729,7 @@ get_more_data:
 				dbgprint(MOD_REQBUF,__func__,"realloc failed (size=%u)",rb->buffer_size + REQBUF_INC_SIZE);
 				goto return_fail;
 			}
+			rb->buffer_size += REQBUF_INC_SIZE;
 		}
 		dbgprint(MOD_REQBUF,__func__,"buffer is %u bytes long, with %u bytes free",rb->buffer_size,
 				rb->buffer_size - rb->buffer_used);
@@ -425,7 +738,7 @@ get_more_data:
 		ws = rb->read_cb(rb->param,(char*)rb->buffer_ptr + rb->buffer_used,
 				rb->buffer_size - rb->buffer_used, &chunk_used);
 		if( ws != WSTATUS_SUCCESS ) {
-			dbgprint(MOD_REQBUF,__func__,"read_cb (%p) failed (ws=%s)",rb->read_cb,ws);
+			dbgprint(MOD_REQBUF,__func__,"read_cb (%p) failed (ws=%s)",rb->read_cb,wstatus_str(ws));
 			goto return_fail;
 		}
 		dbgprint(MOD_REQBUF,__func__,"read more %u bytes successfully",chunk_used);
@@ -436,14 +749,58 @@ get_more_data:
 		rb->buffer_used += chunk_used;
 		dbgprint(MOD_REQBUF,__func__,"new buffer usage value is %u, buffer has %u free bytes now",
 				rb->buffer_used, rb->buffer_size - rb->buffer_used);
-		continue;
 	}
 
-	DBGRET_SUCCESS(MOD_REQBUF);
 return_fail:
 	DBGRET_FAILURE(MOD_REQBUF);
 }
 
+/*
+   reqbuf_admission
+
+   Sets the admission callback of the request buffer. The callback is called
+   with the header of each request found in the buffer before the request is
+   parsed, if it returns false the request is dropped and reqbuf_read goes on
+   to the next one. Pass admit_cb=0 to admit every request.
+*/
+wstatus
+reqbuf_admission(reqbuf_t rb,REQBUFADMITCB admit_cb,void *param)
+{
+	dbgprint(MOD_REQBUF,__func__,"called with rb=%p, admit_cb=%p, param=%p",rb,admit_cb,param);
+
+	if( !rb ) {
+		dbgprint(MOD_REQBUF,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	rb->admit_cb = admit_cb;
+	rb->admit_param = param;
+	DBGRET_SUCCESS(MOD_REQBUF);
+}
+
+/*
+   reqbuf_capture
+
+   Attaches a capture log to the request buffer, the text of every request
+   read from the buffer is appended to it with channel_id. Binary requests
+   aren't captured since they hold pointers that are meaningless outside of
+   this process. Pass cap=0 to detach.
+*/
+wstatus
+reqbuf_capture(reqbuf_t rb,wcapture_t cap,uint16_t channel_id)
+{
+	dbgprint(MOD_REQBUF,__func__,"called with rb=%p, cap=%p, channel_id=%u",rb,cap,channel_id);
+
+	if( !rb ) {
+		dbgprint(MOD_REQBUF,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	rb->capture = cap;
+	rb->capture_id = channel_id;
+	DBGRET_SUCCESS(MOD_REQBUF);
+}
+
 wstatus
 reqbuf_status(reqbuf_t rb,reqbuf_status_t *rb_status)
 {
@@ -477,6 +834,9 @@ reqbuf_destroy(reqbuf_t rb)
 		DBGRET_FAILURE(MOD_REQBUF);
 	}
 
+	if( rb->chunk_lent )
+		_reqbuf_chunk_done(rb);
+
 	if( rb->buffer_ptr ) {
 		dbgprint(MOD_REQBUF,__func__,"freeing allocated buffer ptr=%p",rb->buffer_ptr);
 		free(rb->buffer_ptr);
@@ -62,6 +62,16 @@
 		- fills the request_t pointer in case of success, returns
 		failure otherwise.
 
+   reqbuf_read_ready(req)	reads a single request without waiting
+    arguments:
+		- same as reqbuf_read.
+	returns:
+		- like reqbuf_read, but the callback is called at most once
+		until WSTATUS_AGAIN is returned, which means that every request
+		the data read completed was returned. For sources known to be
+		ready (a channel reported ready by wloop), called until
+		WSTATUS_AGAIN.
+
    reqbuf_status()		returns the status of the reqbuffer
     arguments:
 		- reqbuf_t opaque data structure pointer which was returned
@@ -109,6 +119,15 @@
    5) when the reqbuf is not needed anymore, use reqbuf_destroy
       to free any data structure associated to it. If the buffer
 	  contains data, they will be discarded.
+
+   reqbuf_create_zc creates a zero copy request buffer, instead of a
+   read callback it has a peek callback that lends a chunk of data (a
+   datagram in a buffer of the wchannel, see wchannel_receive_zc) and a
+   done callback that gives it back. reqbuf_read parses the requests
+   straight from the chunk and gives it back after the last one, the
+   memory block is only used for a request split between chunks.
+   reqbuf_wchannel_peek_cb and reqbuf_wchannel_done_cb read from a
+   wchannel like reqbuf_wchannel_read_cb.
 */
 
 #ifndef _REQBUF_H
@@ -116,6 +135,7 @@
 
 #include "modmgr.h"
 #include "wstatus.h"
+#include "wcapture.h"
 
 #define REQBUF_INIT_SIZE 1024
 #define REQBUF_INC_SIZE 512
@@ -139,12 +159,19 @@ typedef enum _reqbuf_type_list
 } reqbuf_type_list;
 
 typedef wstatus (*REQBUFREADCB)(void *param,void *chunk_ptr,unsigned int chunk_size,unsigned int *chunk_used);
+typedef wstatus (*REQBUFPEEKCB)(void *param,void **chunk_ptr,unsigned int *chunk_used,unsigned int *chunk_id);
+typedef wstatus (*REQBUFDONECB)(void *param,unsigned int chunk_id);
+typedef bool (*REQBUFADMITCB)(void *param,const req_header_t *header);
 
 wstatus reqbuf_load(reqbuf_load_t *load);
 wstatus reqbuf_unload(void);
 wstatus reqbuf_create(REQBUFREADCB read_cb,void *param,reqbuf_type_list type,reqbuf_t *rb);
+wstatus reqbuf_create_zc(REQBUFPEEKCB peek_cb,REQBUFDONECB done_cb,void *param,reqbuf_type_list type,reqbuf_t *rb);
 wstatus reqbuf_read(reqbuf_t rb,request_t *req);
+wstatus reqbuf_read_ready(reqbuf_t rb,request_t *req);
 wstatus reqbuf_status(reqbuf_t rb,reqbuf_status_t *rb_status);
+wstatus reqbuf_admission(reqbuf_t rb,REQBUFADMITCB admit_cb,void *param);
+wstatus reqbuf_capture(reqbuf_t rb,wcapture_t cap,uint16_t channel_id);
 wstatus reqbuf_destroy(reqbuf_t rb);
 
 #endif
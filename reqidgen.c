@@ -0,0 +1,374 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   reqidgen - request id generator
+
+   Build tool that reads the list of well-known request codes and nvpair names
+   (reqids.list) and generates:
+
+    reqids.h	enums with the ids (reqcode_id, reqname_id) and the lookup
+				function prototypes.
+	reqids.c	the perfect hash tables and lookup functions.
+
+   The hash is FNV-1a with a seed (used as offset basis), the generator looks
+   for the first seed that maps every string of a table to a different slot of
+   a power of two sized table, at runtime a lookup is one hash, one length
+   compare and one memcmp (to reject strings that aren't in the list).
+
+   Usage: reqidgen reqids.list reqids.h reqids.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#define REQIDGEN_MAXENTRIES 256
+#define REQIDGEN_MAXSTRSIZE 64
+#define REQIDGEN_MAXIDSIZE 48
+#define REQIDGEN_MAXSEED 10000000
+
+typedef struct _reqidgen_entry_t
+{
+	char ident[REQIDGEN_MAXIDSIZE];
+	char str[REQIDGEN_MAXSTRSIZE];
+	unsigned int size;
+} reqidgen_entry_t;
+
+typedef struct _reqidgen_table_t
+{
+	const char *kind;			/* "code" or "name" */
+	const char *prefix;			/* enum prefix, REQCODE or REQNAME */
+	const char *type;			/* enum type name */
+	reqidgen_entry_t entries[REQIDGEN_MAXENTRIES];
+	unsigned int count;
+	uint32_t seed;
+	unsigned int table_size;
+	int slot_idx[REQIDGEN_MAXENTRIES*4];
+} reqidgen_table_t;
+
+static reqidgen_table_t code_table = { "code", "REQCODE", "reqcode_id" };
+static reqidgen_table_t name_table = { "name", "REQNAME", "reqname_id" };
+
+/* must match _reqid_hash written to reqids.c */
+static uint32_t
+reqidgen_hash(uint32_t seed,const char *ptr,unsigned int size)
+{
+	uint32_t h = seed;
+	unsigned int i;
+
+	for( i = 0 ; i < size ; i++ ) {
+		h ^= (unsigned char)ptr[i];
+		h *= 16777619u;
+	}
+
+	/* the low bits of FNV only depend on the low bits of the input, the
+	   tables are indexed by the low bits so fold the high ones in */
+	h ^= h >> 16;
+
+	return h;
+}
+
+/*
+   reqidgen_valid_str
+
+   The strings must be valid request codes (V_CODECHAR) or nvpair names
+   (V_NAMECHAR), otherwise they would never match anything.
+*/
+static int
+reqidgen_valid_str(const reqidgen_table_t *table,const char *str)
+{
+	const char *p;
+
+	for( p = str ; *p ; p++ )
+	{
+		if( isalnum((unsigned char)*p) )
+			continue;
+		if( (table == &code_table) && ((*p == '.') || (*p == '_') || (*p == '-')) )
+			continue;
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+reqidgen_add(reqidgen_table_t *table,const char *ident,const char *str,unsigned int line)
+{
+	reqidgen_entry_t *entry;
+	unsigned int i;
+
+	if( table->count >= REQIDGEN_MAXENTRIES ) {
+		fprintf(stderr,"line %u: too many %s entries (max is %u)\n",line,table->kind,REQIDGEN_MAXENTRIES);
+		return 0;
+	}
+
+	if( (strlen(ident) >= REQIDGEN_MAXIDSIZE) || (strlen(str) >= REQIDGEN_MAXSTRSIZE) ) {
+		fprintf(stderr,"line %u: identifier or string is too long\n",line);
+		return 0;
+	}
+
+	for( i = 0 ; ident[i] ; i++ ) {
+		if( !isupper((unsigned char)ident[i]) && !isdigit((unsigned char)ident[i]) && (ident[i] != '_') ) {
+			fprintf(stderr,"line %u: invalid identifier %s (use A-Z, 0-9 and _)\n",line,ident);
+			return 0;
+		}
+	}
+
+	if( !reqidgen_valid_str(table,str) ) {
+		fprintf(stderr,"line %u: %s is not a valid %s\n",line,str,table->kind);
+		return 0;
+	}
+
+	for( i = 0 ; i < table->count ; i++ ) {
+		if( !strcmp(table->entries[i].ident,ident) || !strcmp(table->entries[i].str,str) ) {
+			fprintf(stderr,"line %u: %s %s (%s) is repeated\n",line,table->kind,ident,str);
+			return 0;
+		}
+	}
+
+	entry = &table->entries[table->count++];
+	strcpy(entry->ident,ident);
+	strcpy(entry->str,str);
+	entry->size = strlen(str);
+
+	return 1;
+}
+
+static int
+reqidgen_parse(const char *path)
+{
+	FILE *fp;
+	char line_buf[512];
+	char kind[16],ident[REQIDGEN_MAXIDSIZE*2],str[REQIDGEN_MAXSTRSIZE*2];
+	unsigned int line = 0;
+	char *p;
+	int n;
+
+	fp = fopen(path,"r");
+	if( !fp ) {
+		fprintf(stderr,"unable to open %s\n",path);
+		return 0;
+	}
+
+	while( fgets(line_buf,sizeof(line_buf),fp) )
+	{
+		line++;
+
+		if( (p = strchr(line_buf,'#')) )
+			*p = '\0';
+
+		n = sscanf(line_buf,"%15s %95s %127s",kind,ident,str);
+		if( n <= 0 )
+			continue;
+
+		if( n != 3 ) {
+			fprintf(stderr,"%s:%u: expected <kind> <identifier> <string>\n",path,line);
+			goto return_fail;
+		}
+
+		if( !strcmp(kind,"code") ) {
+			if( !reqidgen_add(&code_table,ident,str,line) )
+				goto return_fail;
+		} else if( !strcmp(kind,"name") ) {
+			if( !reqidgen_add(&name_table,ident,str,line) )
+				goto return_fail;
+		} else {
+			fprintf(stderr,"%s:%u: unknown kind %s (use code or name)\n",path,line,kind);
+			goto return_fail;
+		}
+	}
+
+	fclose(fp);
+	return 1;
+
+return_fail:
+	fclose(fp);
+	return 0;
+}
+
+/*
+   reqidgen_solve
+
+   Finds the table size and seed of a perfect hash for the table. The table
+   has at least twice the slots of the entries, which makes the seed search
+   short even with a few hundred entries.
+*/
+static int
+reqidgen_solve(reqidgen_table_t *table)
+{
+	uint32_t seed;
+	unsigned int i,slot;
+
+	table->table_size = 8;
+	while( table->table_size < table->count*2 )
+		table->table_size *= 2;
+
+	for( seed = 1 ; seed < REQIDGEN_MAXSEED ; seed++ )
+	{
+		for( i = 0 ; i < table->table_size ; i++ )
+			table->slot_idx[i] = -1;
+
+		for( i = 0 ; i < table->count ; i++ ) {
+			slot = reqidgen_hash(seed,table->entries[i].str,table->entries[i].size) & (table->table_size-1);
+			if( table->slot_idx[slot] != -1 )
+				break;
+			table->slot_idx[slot] = i;
+		}
+
+		if( i == table->count ) {
+			table->seed = seed;
+			return 1;
+		}
+	}
+
+	fprintf(stderr,"unable to find a perfect hash seed for %s table\n",table->kind);
+	return 0;
+}
+
+static void
+reqidgen_write_enum(FILE *fp,const reqidgen_table_t *table)
+{
+	unsigned int i;
+
+	fprintf(fp,"typedef enum _%s {\n",table->type);
+	fprintf(fp,"\t%s_UNKNOWN = 0,\n",table->prefix);
+	for( i = 0 ; i < table->count ; i++ )
+		fprintf(fp,"\t%s_%s = %u, /* %s */\n",table->prefix,table->entries[i].ident,i+1,table->entries[i].str);
+	fprintf(fp,"\t%s_COUNT = %u\n",table->prefix,table->count+1);
+	fprintf(fp,"} %s;\n\n",table->type);
+}
+
+static int
+reqidgen_write_header(const char *path)
+{
+	FILE *fp;
+
+	fp = fopen(path,"w");
+	if( !fp ) {
+		fprintf(stderr,"unable to create %s\n",path);
+		return 0;
+	}
+
+	fprintf(fp,"/* reqids.h - generated by reqidgen from reqids.list, don't edit. */\n\n");
+	fprintf(fp,"#ifndef _REQIDS_H\n#define _REQIDS_H\n\n");
+	reqidgen_write_enum(fp,&code_table);
+	reqidgen_write_enum(fp,&name_table);
+	fprintf(fp,"reqcode_id reqid_code_lookup(const char *code_ptr,unsigned int code_size);\n");
+	fprintf(fp,"reqname_id reqid_name_lookup(const char *name_ptr,unsigned int name_size);\n");
+	fprintf(fp,"const char *reqid_code_str(reqcode_id code_id);\n");
+	fprintf(fp,"const char *reqid_name_str(reqname_id name_id);\n\n");
+	fprintf(fp,"#endif\n\n");
+
+	fclose(fp);
+	return 1;
+}
+
+static void
+reqidgen_write_table(FILE *fp,const reqidgen_table_t *table,const char *lname)
+{
+	const reqidgen_entry_t *entry;
+	unsigned int i;
+
+	fprintf(fp,"#define REQID_%s_SEED %uu\n",table->prefix,table->seed);
+	fprintf(fp,"#define REQID_%s_MASK %uu\n\n",table->prefix,table->table_size-1);
+
+	fprintf(fp,"static const reqid_slot_t reqid_%s_slots[%u] = {\n",lname,table->table_size);
+	for( i = 0 ; i < table->table_size ; i++ ) {
+		if( table->slot_idx[i] == -1 )
+			continue;
+		entry = &table->entries[table->slot_idx[i]];
+		fprintf(fp,"\t[%u] = { \"%s\", %u, %s_%s },\n",i,entry->str,entry->size,table->prefix,entry->ident);
+	}
+	fprintf(fp,"};\n\n");
+
+	fprintf(fp,"static const char *reqid_%s_strs[%s_COUNT] = {\n\t0,\n",lname,table->prefix);
+	for( i = 0 ; i < table->count ; i++ )
+		fprintf(fp,"\t\"%s\",\n",table->entries[i].str);
+	fprintf(fp,"};\n\n");
+
+	fprintf(fp,"%s\nreqid_%s_lookup(const char *%s_ptr,unsigned int %s_size)\n{\n",table->type,lname,lname,lname);
+	fprintf(fp,"\tconst reqid_slot_t *slot;\n\n");
+	fprintf(fp,"\tif( !%s_ptr )\n\t\treturn %s_UNKNOWN;\n\n",lname,table->prefix);
+	fprintf(fp,"\tslot = &reqid_%s_slots[_reqid_hash(REQID_%s_SEED,%s_ptr,%s_size) & REQID_%s_MASK];\n",
+			lname,table->prefix,lname,lname,table->prefix);
+	fprintf(fp,"\tif( !slot->str || (slot->size != %s_size) || memcmp(slot->str,%s_ptr,%s_size) )\n",lname,lname,lname);
+	fprintf(fp,"\t\treturn %s_UNKNOWN;\n\n",table->prefix);
+	fprintf(fp,"\treturn (%s)slot->id;\n}\n\n",table->type);
+
+	fprintf(fp,"const char *\nreqid_%s_str(%s %s_id)\n{\n",lname,table->type,lname);
+	fprintf(fp,"\tif( (%s_id <= %s_UNKNOWN) || (%s_id >= %s_COUNT) )\n",lname,table->prefix,lname,table->prefix);
+	fprintf(fp,"\t\treturn 0;\n\n");
+	fprintf(fp,"\treturn reqid_%s_strs[%s_id];\n}\n\n",lname,lname);
+}
+
+static int
+reqidgen_write_source(const char *path)
+{
+	FILE *fp;
+
+	fp = fopen(path,"w");
+	if( !fp ) {
+		fprintf(stderr,"unable to create %s\n",path);
+		return 0;
+	}
+
+	fprintf(fp,"/* reqids.c - generated by reqidgen from reqids.list, don't edit. */\n\n");
+	fprintf(fp,"#include <string.h>\n#include <stdint.h>\n\n#include \"reqids.h\"\n\n");
+	fprintf(fp,"typedef struct _reqid_slot_t {\n\tconst char *str;\n\tunsigned int size;\n\tunsigned int id;\n} reqid_slot_t;\n\n");
+	fprintf(fp,"static uint32_t\n_reqid_hash(uint32_t seed,const char *ptr,unsigned int size)\n{\n");
+	fprintf(fp,"\tuint32_t h = seed;\n\tunsigned int i;\n\n");
+	fprintf(fp,"\tfor( i = 0 ; i < size ; i++ ) {\n\t\th ^= (unsigned char)ptr[i];\n\t\th *= 16777619u;\n\t}\n\n\th ^= h >> 16;\n\n");
+	fprintf(fp,"\treturn h;\n}\n\n");
+
+	reqidgen_write_table(fp,&code_table,"code");
+	reqidgen_write_table(fp,&name_table,"name");
+
+	fclose(fp);
+	return 1;
+}
+
+int main(int argc,char *argv[])
+{
+	if( argc != 4 ) {
+		fprintf(stderr,"usage: %s reqids.list reqids.h reqids.c\n",argv[0]);
+		return 1;
+	}
+
+	if( !reqidgen_parse(argv[1]) )
+		return 1;
+
+	if( !reqidgen_solve(&code_table) || !reqidgen_solve(&name_table) )
+		return 1;
+
+	if( !reqidgen_write_header(argv[2]) || !reqidgen_write_source(argv[3]) ) {
+		remove(argv[2]);
+		remove(argv[3]);
+		return 1;
+	}
+
+	printf("reqidgen: %u codes (seed %u, %u slots), %u names (seed %u, %u slots)\n",
+			code_table.count,code_table.seed,code_table.table_size,
+			name_table.count,name_table.seed,name_table.table_size);
+
+	return 0;
+}
+
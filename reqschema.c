@@ -0,0 +1,583 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "wstatus.h"
+#include "debug.h"
+#include "jmlist.h"
+#include "wlock.h"
+#include "nvpair.h"
+#include "req.h"
+#include "reqschema.h"
+
+typedef struct _reqschema_fdesc_t
+{
+	char name[REQSCHEMA_NAMESIZE];
+	uint16_t name_size;
+	reqname_id name_id;
+	reqschema_type_list type;
+	bool required;
+} reqschema_fdesc_t;
+
+struct _reqschema_t
+{
+	char module[REQMODSIZE];
+	char code[REQCODESIZE];
+	unsigned int field_count;
+	reqschema_fdesc_t fields[1];
+};
+
+/* this module variables */
+static jmlist schema_list = 0; /* reqschema_t */
+static wlock_t schema_lock;
+
+/*
+   reqschema_load
+
+   Initializes the schema registry, called by modmgr_load.
+*/
+wstatus
+reqschema_load(void)
+{
+	struct _jmlist_params params = { .flags = JMLIST_LINKED };
+	jmlist_status jmls;
+	wstatus ws;
+
+	dbgprint(MOD_REQSCHEMA,__func__,"called");
+
+	if( schema_list ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"module was already loaded");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	ws = wlock_create(&schema_lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"failed to create lock (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	jmls = jmlist_create(&schema_list,&params);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"failed to create jmlist (jmls=%d)",jmls);
+		schema_list = 0;
+		wlock_free(&schema_lock);
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	DBGRET_SUCCESS(MOD_REQSCHEMA);
+}
+
+/*
+   _reqschema_jml_free
+
+   Helper callback to free a schema, associated to a jmlist entry.
+*/
+void _reqschema_jml_free(void *ptr,void *param)
+{
+	if( ptr )
+		free(ptr);
+}
+
+/*
+   reqschema_unload
+
+   Frees every registered schema, called by modmgr_unload.
+*/
+wstatus
+reqschema_unload(void)
+{
+	dbgprint(MOD_REQSCHEMA,__func__,"called");
+
+	if( !schema_list ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	jmlist_parse(schema_list,_reqschema_jml_free,0);
+	jmlist_free(schema_list);
+	schema_list = 0;
+	wlock_free(&schema_lock);
+
+	DBGRET_SUCCESS(MOD_REQSCHEMA);
+}
+
+/*
+   _reqschema_find
+
+   Helper function to find the schema of a module and code, the caller must hold
+   the schema lock.
+*/
+wstatus
+_reqschema_find(const char *module,const char *code,reqschema_t *schema)
+{
+	jmlist_status jmls;
+	jmlist_seek_handle shandle;
+	jmlist_index entry_count;
+	void *aux_ptr;
+	reqschema_t aux_schema;
+
+	jmls = jmlist_entry_count(schema_list,&entry_count);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"failed to get schema list count (jmls=%d)",jmls);
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	jmls = jmlist_seek_start(schema_list,&shandle);
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"failed to start seeking schema list (jmls=%d)",jmls);
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	while( entry_count-- )
+	{
+		jmls = jmlist_seek_next(schema_list,&shandle,&aux_ptr);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_REQSCHEMA,__func__,"failed to seek schema list (jmls=%d)",jmls);
+			break;
+		}
+
+		aux_schema = (reqschema_t)aux_ptr;
+		if( strcmp(aux_schema->code,code) || strcmp(aux_schema->module,module) )
+			continue;
+
+		jmlist_seek_end(schema_list,&shandle);
+		*schema = aux_schema;
+		DBGRET_SUCCESS(MOD_REQSCHEMA);
+	}
+
+	jmlist_seek_end(schema_list,&shandle);
+	DBGRET_FAILURE(MOD_REQSCHEMA);
+}
+
+/*
+   reqschema_register
+
+   Registers the schema of the requests with destination module and request
+   code. The fields array is copied, it can be discarded by the caller. A
+   module+code pair can only have one schema, unregister it first to replace it.
+   The index of each field in the array is the index used to read the value
+   from the record.
+*/
+wstatus
+reqschema_register(const char *module,const char *code,const reqschema_field_t *fields,unsigned int field_count)
+{
+	reqschema_t new_schema = 0;
+	reqschema_t aux_schema;
+	jmlist_status jmls;
+	unsigned int i,j;
+
+	dbgprint(MOD_REQSCHEMA,__func__,"called with module=%s, code=%s, fields=%p, field_count=%u",
+			z_ptr(module),z_ptr(code),fields,field_count);
+
+	if( !schema_list ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"module was not loaded yet");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	if( !module || !strlen(module) || (strlen(module) >= REQMODSIZE) ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"invalid module argument");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	if( !code || !strlen(code) || (strlen(code) >= REQCODESIZE) ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"invalid code argument");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	if( !fields || !field_count || (field_count > REQSCHEMA_MAXFIELDS) ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"invalid fields argument (fields=0 or field_count not in 1..%u)",
+				REQSCHEMA_MAXFIELDS);
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	new_schema = (reqschema_t)malloc(sizeof(struct _reqschema_t) + (field_count-1)*sizeof(reqschema_fdesc_t));
+	if( !new_schema ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+	memset(new_schema,0,sizeof(struct _reqschema_t));
+
+	strcpy(new_schema->module,module);
+	strcpy(new_schema->code,code);
+	new_schema->field_count = field_count;
+
+	for( i = 0 ; i < field_count ; i++ )
+	{
+		if( !fields[i].name || !strlen(fields[i].name) || (strlen(fields[i].name) >= REQSCHEMA_NAMESIZE) ) {
+			dbgprint(MOD_REQSCHEMA,__func__,"invalid name of field idx=%u",i);
+			goto return_fail;
+		}
+
+		for( j = 0 ; j < i ; j++ ) {
+			if( !strcmp(new_schema->fields[j].name,fields[i].name) ) {
+				dbgprint(MOD_REQSCHEMA,__func__,"field %s is repeated",fields[i].name);
+				goto return_fail;
+			}
+		}
+
+		strcpy(new_schema->fields[i].name,fields[i].name);
+		new_schema->fields[i].name_size = strlen(fields[i].name);
+		new_schema->fields[i].name_id = reqid_name_lookup(fields[i].name,new_schema->fields[i].name_size);
+		new_schema->fields[i].type = fields[i].type;
+		new_schema->fields[i].required = fields[i].required;
+	}
+
+	wlock_acquire(&schema_lock);
+
+	if( _reqschema_find(module,code,&aux_schema) == WSTATUS_SUCCESS ) {
+		wlock_release(&schema_lock);
+		dbgprint(MOD_REQSCHEMA,__func__,"schema for %s/%s is already registered",module,code);
+		goto return_fail;
+	}
+
+	jmls = jmlist_insert(schema_list,new_schema);
+	wlock_release(&schema_lock);
+
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"failed to insert schema into list (jmls=%d)",jmls);
+		goto return_fail;
+	}
+
+	dbgprint(MOD_REQSCHEMA,__func__,"registered schema for %s/%s with %u fields",module,code,field_count);
+	DBGRET_SUCCESS(MOD_REQSCHEMA);
+
+return_fail:
+	free(new_schema);
+	DBGRET_FAILURE(MOD_REQSCHEMA);
+}
+
+/*
+   reqschema_unregister
+
+   Removes the schema of a module and code.
+*/
+wstatus
+reqschema_unregister(const char *module,const char *code)
+{
+	reqschema_t schema;
+	jmlist_status jmls;
+
+	dbgprint(MOD_REQSCHEMA,__func__,"called with module=%s, code=%s",z_ptr(module),z_ptr(code));
+
+	if( !schema_list || !module || !code ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"invalid arguments or module not loaded");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	wlock_acquire(&schema_lock);
+
+	if( _reqschema_find(module,code,&schema) != WSTATUS_SUCCESS ) {
+		wlock_release(&schema_lock);
+		dbgprint(MOD_REQSCHEMA,__func__,"schema for %s/%s was not found",module,code);
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	jmls = jmlist_remove_by_ptr(schema_list,schema);
+	wlock_release(&schema_lock);
+
+	if( jmls != JMLIST_ERROR_SUCCESS ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"failed to remove schema from list (jmls=%d)",jmls);
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	free(schema);
+	DBGRET_SUCCESS(MOD_REQSCHEMA);
+}
+
+/*
+   reqschema_lookup
+
+   Returns the schema of a module and code. The schema is valid until it's
+   unregistered.
+*/
+wstatus
+reqschema_lookup(const char *module,const char *code,reqschema_t *schema)
+{
+	wstatus ws;
+
+	if( !schema_list || !module || !code || !schema ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"invalid arguments or module not loaded");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	wlock_acquire(&schema_lock);
+	ws = _reqschema_find(module,code,schema);
+	wlock_release(&schema_lock);
+
+	return ws;
+}
+
+/*
+   _reqschema_parse_value
+
+   Helper function to convert the value of a nvpair to the type of the field.
+*/
+wstatus
+_reqschema_parse_value(const reqschema_fdesc_t *field,const nvpair_t nvp,reqrecord_value_t *value,
+		char *error_ptr,unsigned int error_size)
+{
+	char buf[64];
+	char *end_ptr;
+
+	value->size = nvp->value_size;
+
+	switch(field->type)
+	{
+		case REQSCHEMA_TYPE_STRING:
+		case REQSCHEMA_TYPE_BYTES:
+			value->data.ptr = (const char*)nvp->value_ptr;
+			break;
+
+		case REQSCHEMA_TYPE_INT:
+		case REQSCHEMA_TYPE_DOUBLE:
+			if( !nvp->value_size || (nvp->value_size >= sizeof(buf)) ) {
+				snprintf(error_ptr,error_size,"field %s has invalid %s value",field->name,
+						reqschema_type_str(field->type));
+				DBGRET_FAILURE(MOD_REQSCHEMA);
+			}
+			memcpy(buf,nvp->value_ptr,nvp->value_size);
+			buf[nvp->value_size] = '\0';
+
+			errno = 0;
+			if( field->type == REQSCHEMA_TYPE_INT )
+				value->data.i = strtol(buf,&end_ptr,10);
+			else
+				value->data.d = strtod(buf,&end_ptr);
+
+			if( (*end_ptr != '\0') || errno ) {
+				snprintf(error_ptr,error_size,"field %s has invalid %s value",field->name,
+						reqschema_type_str(field->type));
+				DBGRET_FAILURE(MOD_REQSCHEMA);
+			}
+			break;
+
+		default:
+			snprintf(error_ptr,error_size,"field %s has unknown type",field->name);
+			DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	value->present = true;
+	DBGRET_SUCCESS(MOD_REQSCHEMA);
+}
+
+/*
+   reqschema_validate
+
+   Validates a binary request against a schema and builds the record with the
+   typed values. nvpairs not described in the schema are ignored. If the request
+   doesn't comply WSTATUS_INVALID_ARGUMENT is returned and error_ptr is filled
+   with the reason (if error_ptr isn't null). The record is a single allocation,
+   free it with reqrecord_free (or let req_free do it if attached to the request).
+*/
+wstatus
+reqschema_validate(const struct _reqschema_t *schema,const request_t req,reqrecord_t *record,char *error_ptr,unsigned int error_size)
+{
+	reqrecord_t new_record = 0;
+	jmlist_status jmls;
+	jmlist_seek_handle shandle;
+	jmlist_index nv_count = 0;
+	void *aux_ptr;
+	nvpair_t nvp;
+	unsigned int i;
+	size_t record_size;
+	char aux_error[REQSCHEMA_ERRORSIZE];
+
+	dbgprint(MOD_REQSCHEMA,__func__,"called with schema=%p, req=%p, record=%p",schema,req,record);
+
+	if( !error_ptr ) {
+		error_ptr = aux_error;
+		error_size = sizeof(aux_error);
+	}
+
+	if( !schema || !req || !record ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"invalid arguments (schema=0, req=0 or record=0)");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	if( req->stype != REQUEST_STYPE_BIN ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"only binary requests can be validated, use req_to_bin");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	record_size = sizeof(struct _reqrecord_t) + (schema->field_count-1)*sizeof(reqrecord_value_t);
+	new_record = (reqrecord_t)malloc(record_size);
+	if( !new_record ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"malloc failed (size=%u)",record_size);
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+	memset(new_record,0,record_size);
+	new_record->field_count = schema->field_count;
+
+	if( req->data.bin.nvl )
+	{
+		jmls = jmlist_entry_count(req->data.bin.nvl,&nv_count);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_REQSCHEMA,__func__,"failed to get nvl count (jmls=%d)",jmls);
+			goto return_fail;
+		}
+	}
+
+	if( nv_count )
+	{
+		jmls = jmlist_seek_start(req->data.bin.nvl,&shandle);
+		if( jmls != JMLIST_ERROR_SUCCESS ) {
+			dbgprint(MOD_REQSCHEMA,__func__,"failed to start seeking nvl (jmls=%d)",jmls);
+			goto return_fail;
+		}
+
+		while( nv_count-- )
+		{
+			jmls = jmlist_seek_next(req->data.bin.nvl,&shandle,&aux_ptr);
+			if( jmls != JMLIST_ERROR_SUCCESS ) {
+				dbgprint(MOD_REQSCHEMA,__func__,"failed to seek nvl (jmls=%d)",jmls);
+				jmlist_seek_end(req->data.bin.nvl,&shandle);
+				goto return_fail;
+			}
+			nvp = (nvpair_t)aux_ptr;
+
+			/* well-known names were tagged by the parser, compare the ids */
+
+			for( i = 0 ; i < schema->field_count ; i++ ) {
+				if( schema->fields[i].name_id != REQNAME_UNKNOWN ) {
+					if( schema->fields[i].name_id == nvp->name_id )
+						break;
+				} else if( (schema->fields[i].name_size == nvp->name_size) &&
+						!memcmp(schema->fields[i].name,nvp->name_ptr,nvp->name_size) )
+					break;
+			}
+
+			if( i == schema->field_count )
+				continue;
+
+			if( new_record->values[i].present ) {
+				snprintf(error_ptr,error_size,"field %s is repeated",schema->fields[i].name);
+				jmlist_seek_end(req->data.bin.nvl,&shandle);
+				goto return_invalid;
+			}
+
+			if( _reqschema_parse_value(&schema->fields[i],nvp,&new_record->values[i],
+						error_ptr,error_size) != WSTATUS_SUCCESS ) {
+				jmlist_seek_end(req->data.bin.nvl,&shandle);
+				goto return_invalid;
+			}
+		}
+
+		jmlist_seek_end(req->data.bin.nvl,&shandle);
+	}
+
+	for( i = 0 ; i < schema->field_count ; i++ ) {
+		if( schema->fields[i].required && !new_record->values[i].present ) {
+			snprintf(error_ptr,error_size,"required field %s is missing",schema->fields[i].name);
+			goto return_invalid;
+		}
+	}
+
+	*record = new_record;
+	dbgprint(MOD_REQSCHEMA,__func__,"updated record value to %p",*record);
+
+	DBGRET_SUCCESS(MOD_REQSCHEMA);
+
+return_invalid:
+	dbgprint(MOD_REQSCHEMA,__func__,"request doesn't comply with schema %s/%s: %s",
+			schema->module,schema->code,error_ptr);
+	free(new_record);
+	return WSTATUS_INVALID_ARGUMENT;
+
+return_fail:
+	free(new_record);
+	DBGRET_FAILURE(MOD_REQSCHEMA);
+}
+
+/*
+   reqschema_attach
+
+   Used by modmgr at ingress, validates the binary request against the schema
+   registered for its destination and code and attaches the record to the
+   request (see req_record). Requests without schema are accepted as they are.
+   Returns WSTATUS_INVALID_ARGUMENT with the reason in error_ptr when the request
+   must be rejected.
+*/
+wstatus
+reqschema_attach(request_t req,char *error_ptr,unsigned int error_size)
+{
+	reqschema_t schema;
+	reqrecord_t record = 0;
+	char module[REQMODSIZE+1];
+	char code[REQCODESIZE+1];
+	wstatus ws;
+
+	dbgprint(MOD_REQSCHEMA,__func__,"called with req=%p",req);
+
+	if( !req || (req->stype != REQUEST_STYPE_BIN) ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"invalid req argument (req=0 or not binary)");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	if( !schema_list || req->record ) {
+		/* no schemas or already validated */
+		DBGRET_SUCCESS(MOD_REQSCHEMA);
+	}
+
+	memcpy(module,req->data.bin.dst,REQMODSIZE);
+	module[REQMODSIZE] = '\0';
+	memcpy(code,req->data.bin.code,REQCODESIZE);
+	code[REQCODESIZE] = '\0';
+
+	/* validation runs with the lock, the schema can't be unregistered meanwhile */
+
+	wlock_acquire(&schema_lock);
+
+	if( _reqschema_find(module,code,&schema) != WSTATUS_SUCCESS ) {
+		wlock_release(&schema_lock);
+		dbgprint(MOD_REQSCHEMA,__func__,"no schema for this request");
+		DBGRET_SUCCESS(MOD_REQSCHEMA);
+	}
+
+	ws = reqschema_validate(schema,req,&record,error_ptr,error_size);
+	wlock_release(&schema_lock);
+
+	if( ws != WSTATUS_SUCCESS )
+		return ws;
+
+	req->record = record;
+	DBGRET_SUCCESS(MOD_REQSCHEMA);
+}
+
+/*
+   reqrecord_free
+
+   Frees a record returned by reqschema_validate.
+*/
+wstatus
+reqrecord_free(reqrecord_t record)
+{
+	if( !record ) {
+		dbgprint(MOD_REQSCHEMA,__func__,"invalid record argument (record=0)");
+		DBGRET_FAILURE(MOD_REQSCHEMA);
+	}
+
+	free(record);
+	DBGRET_SUCCESS(MOD_REQSCHEMA);
+}
+
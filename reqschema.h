@@ -0,0 +1,126 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Request Schema - Implementation
+
+   Module handlers used to call req_get_nv for each field of a request and
+   then convert the value with atof/strtol on every access. With schemas,
+   modules register the fields expected for each request code they accept
+   (name, type and if the field is required). The request is validated once
+   when it enters modmgr, the values are converted to their types and saved
+   in a record (reqrecord_t) which is attached to the request, handlers read
+   the fields by index without any parsing.
+
+   Requests that don't comply with the schema of their destination and code
+   are rejected by modmgr at ingress with a single error reply to the source,
+   they never reach the handler.
+
+   Example:
+
+	enum { AP_FIELD_CH, AP_FIELD_PWR, AP_FIELD_ID };
+	static const reqschema_field_t ap_set_fields[] = {
+		{ "ch", REQSCHEMA_TYPE_INT, true },
+		{ "pwr", REQSCHEMA_TYPE_DOUBLE, false },
+		{ "id", REQSCHEMA_TYPE_STRING, true }
+	};
+
+	reqschema_register("apmgr","apSet",ap_set_fields,3);
+
+	...and in the module request callback:
+
+	reqrecord_t rec = req_record(req);
+	if( rec && reqrecord_has(rec,AP_FIELD_PWR) )
+		pwr = reqrecord_double(rec,AP_FIELD_PWR);
+
+   String and bytes values aren't copied, the record points to the value of
+   the nvpair in the request, so they're valid while the request is. Strings
+   are not null terminated, use reqrecord_size.
+*/
+
+#ifndef _REQSCHEMA_H
+#define _REQSCHEMA_H
+
+#include <stdbool.h>
+#include "wstatus.h"
+#include "req.h"
+
+#define REQSCHEMA_NAMESIZE 32
+#define REQSCHEMA_MAXFIELDS 32
+#define REQSCHEMA_ERRORSIZE 128
+
+typedef enum _reqschema_type_list
+{
+	REQSCHEMA_TYPE_INT,
+	REQSCHEMA_TYPE_DOUBLE,
+	REQSCHEMA_TYPE_STRING,
+	REQSCHEMA_TYPE_BYTES
+} reqschema_type_list;
+
+#define reqschema_type_str(x) ( x == REQSCHEMA_TYPE_INT ? "int" : \
+		x == REQSCHEMA_TYPE_DOUBLE ? "double" : \
+		x == REQSCHEMA_TYPE_STRING ? "string" : "bytes" )
+
+/* field description passed by the modules */
+typedef struct _reqschema_field_t
+{
+	const char *name;
+	reqschema_type_list type;
+	bool required;
+} reqschema_field_t;
+
+typedef struct _reqschema_t *reqschema_t;
+
+/* typed value of a field in a validated request */
+typedef struct _reqrecord_value_t
+{
+	bool present;
+	uint16_t size;
+	union _reqrecord_data {
+		long i;
+		double d;
+		const char *ptr;
+	} data;
+} reqrecord_value_t;
+
+typedef struct _reqrecord_t
+{
+	unsigned int field_count;
+	reqrecord_value_t values[1];
+} *reqrecord_t;
+
+/* zero cost accessors, idx is the index of the field in the schema */
+#define req_record(req) ((reqrecord_t)(req)->record)
+#define reqrecord_has(rec,idx) ((rec)->values[idx].present)
+#define reqrecord_int(rec,idx) ((rec)->values[idx].data.i)
+#define reqrecord_double(rec,idx) ((rec)->values[idx].data.d)
+#define reqrecord_ptr(rec,idx) ((rec)->values[idx].data.ptr)
+#define reqrecord_size(rec,idx) ((rec)->values[idx].size)
+
+wstatus reqschema_load(void);
+wstatus reqschema_unload(void);
+wstatus reqschema_register(const char *module,const char *code,const reqschema_field_t *fields,unsigned int field_count);
+wstatus reqschema_unregister(const char *module,const char *code);
+wstatus reqschema_lookup(const char *module,const char *code,reqschema_t *schema);
+wstatus reqschema_validate(const struct _reqschema_t *schema,const request_t req,reqrecord_t *record,char *error_ptr,unsigned int error_size);
+wstatus reqschema_attach(request_t req,char *error_ptr,unsigned int error_size);
+wstatus reqrecord_free(reqrecord_t record);
+
+#endif
+
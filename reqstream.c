@@ -0,0 +1,967 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "watomic.h"
+#include "nvpair.h"
+#include "req.h"
+#include "modmgr.h"
+#include "reqstream.h"
+
+/* reorder window slot, holds a chunk that arrived before its turn */
+typedef struct _reqstream_slot_t
+{
+	bool used;
+	uint32_t seq;
+	nvpair_t nvp;
+} reqstream_slot_t;
+
+struct _reqstream_t
+{
+	reqstream_role_list role;
+	uint32_t sid;
+	char src[REQMODSIZE];
+	char dst[REQMODSIZE];
+	REQSTREAMSENDCB send_cb;
+	REQSTREAMCHUNKCB chunk_cb;
+	void *param;
+	wlock_t lock;
+	unsigned int window;
+	unsigned int credit;		/* sender: chunks that may still be sent */
+	uint32_t next_seq;			/* sender: next to send, receiver: next to deliver */
+	unsigned int consumed;		/* receiver: chunks consumed since last credit */
+	unsigned int buffered;		/* receiver: chunks in the reorder window */
+	uint32_t end_seq;
+	bool end_seen;
+	bool closed;
+	uint64_t bytes;
+	reqstream_slot_t *slots;
+};
+
+static watomic_t next_sid = 0;
+
+/*
+   _reqstream_as_bin
+
+   Helper function that returns the binary form of a request. Text requests
+   are converted (the caller must free the returned request, converted flag
+   is set), binary requests are returned as they are.
+*/
+wstatus
+_reqstream_as_bin(const request_t req,request_t *req_bin,bool *converted)
+{
+	wstatus ws;
+
+	if( req->stype == REQUEST_STYPE_BIN ) {
+		*req_bin = req;
+		*converted = false;
+		DBGRET_SUCCESS(MOD_REQSTREAM);
+	}
+
+	ws = req_to_bin(req,req_bin);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"failed to convert request to bin (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	*converted = true;
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+}
+
+/*
+   _reqstream_nv_uint
+
+   Helper function to read an unsigned integer value from a request nvpair.
+*/
+wstatus
+_reqstream_nv_uint(const request_t req,reqname_id name_id,uint32_t *value)
+{
+	const char *name = reqid_name_str(name_id);
+	nvpair_t nvp = 0;
+	char buf[16];
+	char *end_ptr;
+	unsigned long aux;
+	wstatus ws;
+
+	ws = req_get_nv_id(req,name_id,&nvp);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"nvpair \"%s\" not found in request (req=%p)",name,req);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( !nvp->value_size || (nvp->value_size >= sizeof(buf)) ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid size of nvpair \"%s\" value (%u)",name,nvp->value_size);
+		_nvp_free(nvp);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	memcpy(buf,nvp->value_ptr,nvp->value_size);
+	buf[nvp->value_size] = '\0';
+	_nvp_free(nvp);
+
+	aux = strtoul(buf,&end_ptr,10);
+	if( *end_ptr != '\0' ) {
+		dbgprint(MOD_REQSTREAM,__func__,"value of nvpair \"%s\" is not a number (%s)",name,buf);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	*value = (uint32_t)aux;
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+}
+
+/*
+   _reqstream_req_build
+
+   Helper function that allocates a new binary request of this stream with the
+   request code and the sid nvpair. An additional numeric nvpair is added if
+   nv_name_id isn't REQNAME_UNKNOWN.
+*/
+wstatus
+_reqstream_req_build(reqstream_t rs,reqcode_id code_id,reqname_id nv_name_id,uint32_t nv_value,request_t *req)
+{
+	const char *nv_name = reqid_name_str(nv_name_id);
+	request_t new_req;
+	char buf[16];
+	wstatus ws;
+
+	new_req = (request_t)malloc(sizeof(struct _request_t));
+	if( !new_req ) {
+		dbgprint(MOD_REQSTREAM,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+	memset(new_req,0,sizeof(struct _request_t));
+
+	new_req->stype = REQUEST_STYPE_BIN;
+	new_req->data.bin.type = REQUEST_TYPE_REQUEST;
+	new_req->data.bin.id = 0;
+	memcpy(new_req->data.bin.src,rs->src,sizeof(new_req->data.bin.src));
+	memcpy(new_req->data.bin.dst,rs->dst,sizeof(new_req->data.bin.dst));
+	strncpy(new_req->data.bin.code,reqid_code_str(code_id),sizeof(new_req->data.bin.code)-1);
+	new_req->data.bin.code_id = code_id;
+
+	snprintf(buf,sizeof(buf),"%u",rs->sid);
+	ws = req_add_nvp_z(reqid_name_str(REQNAME_SID),buf,new_req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"failed to add sid nvpair (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	if( nv_name )
+	{
+		snprintf(buf,sizeof(buf),"%u",nv_value);
+		ws = req_add_nvp_z(nv_name,buf,new_req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQSTREAM,__func__,"failed to add %s nvpair (ws=%s)",nv_name,wstatus_str(ws));
+			goto return_fail;
+		}
+	}
+
+	*req = new_req;
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+
+return_fail:
+	req_free(new_req);
+	DBGRET_FAILURE(MOD_REQSTREAM);
+}
+
+/*
+   _reqstream_send
+
+   Helper function that sends a request of the stream using the send callback
+   and frees it, the transport takes its own reference if it needs one.
+*/
+wstatus
+_reqstream_send(reqstream_t rs,request_t req)
+{
+	wstatus ws;
+
+	ws = rs->send_cb(rs->param,req);
+	req_free(req);
+
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) send callback failed (ws=%s)",rs,wstatus_str(ws));
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+}
+
+/*
+   _reqstream_alloc
+
+   Helper function to allocate a stream data structure.
+*/
+wstatus
+_reqstream_alloc(reqstream_role_list role,unsigned int window,reqstream_t *rs)
+{
+	reqstream_t new_rs;
+	wstatus ws;
+
+	new_rs = (reqstream_t)malloc(sizeof(struct _reqstream_t));
+	if( !new_rs ) {
+		dbgprint(MOD_REQSTREAM,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+	memset(new_rs,0,sizeof(struct _reqstream_t));
+
+	new_rs->role = role;
+	new_rs->window = window;
+
+	if( role == REQSTREAM_ROLE_RECEIVER )
+	{
+		new_rs->slots = (reqstream_slot_t*)malloc(window*sizeof(reqstream_slot_t));
+		if( !new_rs->slots ) {
+			dbgprint(MOD_REQSTREAM,__func__,"malloc failed for %u slots",window);
+			free(new_rs);
+			DBGRET_FAILURE(MOD_REQSTREAM);
+		}
+		memset(new_rs->slots,0,window*sizeof(reqstream_slot_t));
+	}
+
+	ws = wlock_create(&new_rs->lock);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"failed to create lock (ws=%s)",wstatus_str(ws));
+		if( new_rs->slots )
+			free(new_rs->slots);
+		free(new_rs);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	*rs = new_rs;
+	dbgprint(MOD_REQSTREAM,__func__,"allocated new stream (rs=%p, role=%d, window=%u)",new_rs,role,window);
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+}
+
+/*
+   reqstream_open
+
+   Opens a new stream from module src to module dst, the stream.open request is
+   sent with the send callback. No chunk can be written before the receiver gives
+   credit, which arrives in a stream.credit request (see reqstream_input).
+*/
+wstatus
+reqstream_open(REQSTREAMSENDCB send_cb,void *param,const char *src,const char *dst,reqstream_t *rs)
+{
+	reqstream_t new_rs = 0;
+	request_t req;
+	wstatus ws;
+
+	dbgprint(MOD_REQSTREAM,__func__,"called with send_cb=%p, param=%p, src=%s, dst=%s, rs=%p",
+			send_cb,param,z_ptr(src),z_ptr(dst),rs);
+
+	if( !send_cb ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid send_cb argument (send_cb=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( !src || !strlen(src) || (strlen(src) >= REQMODSIZE) ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid src argument");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( !dst || !strlen(dst) || (strlen(dst) >= REQMODSIZE) ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid dst argument");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( !rs ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid rs argument (rs=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	ws = _reqstream_alloc(REQSTREAM_ROLE_SENDER,0,&new_rs);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"failed to allocate stream (ws=%s)",wstatus_str(ws));
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	new_rs->sid = (uint32_t)watomic_inc(&next_sid);
+	strcpy(new_rs->src,src);
+	strcpy(new_rs->dst,dst);
+	new_rs->send_cb = send_cb;
+	new_rs->param = param;
+
+	ws = _reqstream_req_build(new_rs,REQCODE_STREAM_OPEN,REQNAME_UNKNOWN,0,&req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"failed to build open request (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	ws = _reqstream_send(new_rs,req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"failed to send open request (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	*rs = new_rs;
+	dbgprint(MOD_REQSTREAM,__func__,"opened stream sid=%u (rs=%p)",new_rs->sid,*rs);
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+
+return_fail:
+	reqstream_destroy(new_rs);
+	DBGRET_FAILURE(MOD_REQSTREAM);
+}
+
+/*
+   reqstream_write
+
+   Sends data_size bytes of the payload split in chunks of REQSTREAM_CHUNK_SIZE.
+   Only the chunks allowed by the current credit are sent, the function never
+   blocks nor buffers data. data_used is updated with the bytes sent, when it's
+   less than data_size the caller must write the remaining bytes after more
+   credit arrives.
+*/
+wstatus
+reqstream_write(reqstream_t rs,const void *data_ptr,unsigned int data_size,unsigned int *data_used)
+{
+	unsigned int used = 0;
+	unsigned int chunk_size;
+	uint32_t seq;
+	request_t req;
+	nvblob_t blob;
+	wstatus ws;
+
+	dbgprint(MOD_REQSTREAM,__func__,"called with rs=%p, data_ptr=%p, data_size=%u, data_used=%p",
+			rs,data_ptr,data_size,data_used);
+
+	if( !rs || (rs->role != REQSTREAM_ROLE_SENDER) ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid rs argument (rs=0 or not a sender stream)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( !data_ptr || !data_size ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid data_ptr argument (data_ptr=0 or data_size=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	while( used < data_size )
+	{
+		/* reserve one credit and one sequence number */
+
+		wlock_acquire(&rs->lock);
+		if( rs->closed ) {
+			wlock_release(&rs->lock);
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) stream is closed",rs);
+			goto return_fail;
+		}
+
+		if( !rs->credit ) {
+			wlock_release(&rs->lock);
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) no credit left, %u of %u bytes were sent",
+					rs,used,data_size);
+			break;
+		}
+
+		rs->credit--;
+		seq = rs->next_seq++;
+		wlock_release(&rs->lock);
+
+		chunk_size = data_size - used;
+		if( chunk_size > REQSTREAM_CHUNK_SIZE )
+			chunk_size = REQSTREAM_CHUNK_SIZE;
+
+		ws = _reqstream_req_build(rs,REQCODE_STREAM_CHUNK,REQNAME_SEQ,seq,&req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) failed to build chunk request",rs);
+			goto return_fail;
+		}
+
+		/* the chunk bytes are copied once into the blob referenced by the request */
+
+		ws = _nvp_blob_alloc(chunk_size,&blob);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) failed to allocate chunk blob",rs);
+			req_free(req);
+			goto return_fail;
+		}
+		memcpy(blob->data,(const char*)data_ptr + used,chunk_size);
+
+		ws = req_add_nvp_blob(REQSTREAM_NV_DATA,strlen(REQSTREAM_NV_DATA),blob,req);
+		_nvp_blob_unref(blob);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) failed to add chunk data to request",rs);
+			req_free(req);
+			goto return_fail;
+		}
+
+		ws = _reqstream_send(rs,req);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) failed to send chunk seq=%u",rs,seq);
+			goto return_fail;
+		}
+
+		used += chunk_size;
+		rs->bytes += chunk_size;
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) sent chunk seq=%u (%u bytes)",rs,seq,chunk_size);
+	}
+
+	if( data_used )
+		*data_used = used;
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+
+return_fail:
+	if( data_used )
+		*data_used = used;
+
+	DBGRET_FAILURE(MOD_REQSTREAM);
+}
+
+/*
+   reqstream_close
+
+   Sender side, finishes the stream. The receiver delivers the end event after
+   all the chunks were consumed.
+*/
+wstatus
+reqstream_close(reqstream_t rs)
+{
+	request_t req;
+	uint32_t chunks;
+	wstatus ws;
+
+	dbgprint(MOD_REQSTREAM,__func__,"called with rs=%p",rs);
+
+	if( !rs || (rs->role != REQSTREAM_ROLE_SENDER) ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid rs argument (rs=0 or not a sender stream)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	wlock_acquire(&rs->lock);
+	if( rs->closed ) {
+		wlock_release(&rs->lock);
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) stream is already closed",rs);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+	rs->closed = true;
+	chunks = rs->next_seq;
+	wlock_release(&rs->lock);
+
+	ws = _reqstream_req_build(rs,REQCODE_STREAM_CLOSE,REQNAME_CHUNKS,chunks,&req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) failed to build close request",rs);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	ws = _reqstream_send(rs,req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) failed to send close request",rs);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) closed stream sid=%u after %u chunks",rs,rs->sid,chunks);
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+}
+
+/*
+   reqstream_abort
+
+   Aborts the stream from any side, the other side is notified with a
+   stream.abort request. The reason is optional.
+*/
+wstatus
+reqstream_abort(reqstream_t rs,const char *reason)
+{
+	request_t req;
+	wstatus ws;
+
+	dbgprint(MOD_REQSTREAM,__func__,"called with rs=%p, reason=%s",rs,z_ptr(reason));
+
+	if( !rs ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid rs argument (rs=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	wlock_acquire(&rs->lock);
+	rs->closed = true;
+	wlock_release(&rs->lock);
+
+	ws = _reqstream_req_build(rs,REQCODE_STREAM_ABORT,REQNAME_UNKNOWN,0,&req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) failed to build abort request",rs);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( reason && strlen(reason) )
+		req_add_nvp_z(REQERROR_DESCNAME,reason,req);
+
+	ws = _reqstream_send(rs,req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) failed to send abort request",rs);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+}
+
+/*
+   reqstream_accept
+
+   Receiver side, creates the stream from a stream.open request and gives the
+   initial credit (window chunks) to the sender. The chunk callback is called
+   for every chunk in order and for the end/abort events, always from the
+   thread calling reqstream_input.
+*/
+wstatus
+reqstream_accept(const request_t open_req,REQSTREAMSENDCB send_cb,REQSTREAMCHUNKCB chunk_cb,void *param,unsigned int window,reqstream_t *rs)
+{
+	reqstream_t new_rs = 0;
+	request_t req_bin = 0;
+	request_t req;
+	bool converted = false;
+	uint32_t sid;
+	wstatus ws;
+
+	dbgprint(MOD_REQSTREAM,__func__,"called with open_req=%p, send_cb=%p, chunk_cb=%p, param=%p, window=%u, rs=%p",
+			open_req,send_cb,chunk_cb,param,window,rs);
+
+	if( !open_req ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid open_req argument (open_req=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( !send_cb || !chunk_cb ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid callback argument (send_cb=0 or chunk_cb=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( !rs ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid rs argument (rs=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( !window )
+		window = REQSTREAM_DEFAULT_WINDOW;
+
+	if( window > REQSTREAM_MAX_WINDOW ) {
+		dbgprint(MOD_REQSTREAM,__func__,"window is overlimit (max is %u, requested %u)",REQSTREAM_MAX_WINDOW,window);
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	ws = _reqstream_as_bin(open_req,&req_bin,&converted);
+	if( ws != WSTATUS_SUCCESS ) {
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( req_bin->data.bin.code_id != REQCODE_STREAM_OPEN ) {
+		dbgprint(MOD_REQSTREAM,__func__,"request is not a %s request",REQSTREAM_CODE_OPEN);
+		goto return_fail;
+	}
+
+	ws = _reqstream_nv_uint(req_bin,REQNAME_SID,&sid);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"open request has no valid sid");
+		goto return_fail;
+	}
+
+	ws = _reqstream_alloc(REQSTREAM_ROLE_RECEIVER,window,&new_rs);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"failed to allocate stream (ws=%s)",wstatus_str(ws));
+		goto return_fail;
+	}
+
+	/* replies go back to the sender module */
+
+	new_rs->sid = sid;
+	memcpy(new_rs->src,req_bin->data.bin.dst,sizeof(new_rs->src));
+	memcpy(new_rs->dst,req_bin->data.bin.src,sizeof(new_rs->dst));
+	new_rs->send_cb = send_cb;
+	new_rs->chunk_cb = chunk_cb;
+	new_rs->param = param;
+
+	ws = _reqstream_req_build(new_rs,REQCODE_STREAM_CREDIT,REQNAME_CREDIT,window,&req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"failed to build credit request");
+		goto return_fail;
+	}
+
+	ws = _reqstream_send(new_rs,req);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"failed to send initial credit");
+		goto return_fail;
+	}
+
+	if( converted )
+		req_free(req_bin);
+
+	*rs = new_rs;
+	dbgprint(MOD_REQSTREAM,__func__,"accepted stream sid=%u from %s (rs=%p)",sid,new_rs->dst,*rs);
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+
+return_fail:
+	if( new_rs )
+		reqstream_destroy(new_rs);
+
+	if( converted )
+		req_free(req_bin);
+
+	DBGRET_FAILURE(MOD_REQSTREAM);
+}
+
+/*
+   _reqstream_deliver
+
+   Receiver side helper, delivers the chunks of the reorder window that are
+   in order, gives back the credit of the consumed chunks and delivers the
+   end event when all the chunks were consumed. The lock is held by the caller,
+   it's released during the callbacks.
+*/
+wstatus
+_reqstream_deliver(reqstream_t rs)
+{
+	reqstream_slot_t *slot;
+	nvpair_t nvp;
+	request_t req;
+	unsigned int credit;
+	wstatus ws;
+
+	for(;;)
+	{
+		slot = &rs->slots[rs->next_seq % rs->window];
+		if( !slot->used || (slot->seq != rs->next_seq) )
+			break;
+
+		nvp = slot->nvp;
+		slot->used = false;
+		slot->nvp = 0;
+		rs->buffered--;
+		rs->next_seq++;
+		rs->consumed++;
+		rs->bytes += nvp->value_size;
+
+		wlock_release(&rs->lock);
+		ws = rs->chunk_cb(rs->param,rs,REQSTREAM_EVENT_CHUNK,nvp->value_ptr,nvp->value_size);
+		_nvp_free(nvp);
+		wlock_acquire(&rs->lock);
+
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) consumer failed, aborting stream",rs);
+			wlock_release(&rs->lock);
+			reqstream_abort(rs,"consumer failed");
+			wlock_acquire(&rs->lock);
+			DBGRET_FAILURE(MOD_REQSTREAM);
+		}
+	}
+
+	/* return credit in batches of half window */
+
+	if( !rs->end_seen && (rs->consumed >= (rs->window+1)/2) )
+	{
+		credit = rs->consumed;
+		rs->consumed = 0;
+
+		wlock_release(&rs->lock);
+		ws = _reqstream_req_build(rs,REQCODE_STREAM_CREDIT,REQNAME_CREDIT,credit,&req);
+		if( ws == WSTATUS_SUCCESS )
+			ws = _reqstream_send(rs,req);
+		wlock_acquire(&rs->lock);
+
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) failed to send credit",rs);
+			DBGRET_FAILURE(MOD_REQSTREAM);
+		}
+	}
+
+	if( rs->end_seen && !rs->closed && (rs->next_seq == rs->end_seq) )
+	{
+		rs->closed = true;
+		wlock_release(&rs->lock);
+		rs->chunk_cb(rs->param,rs,REQSTREAM_EVENT_END,0,0);
+		wlock_acquire(&rs->lock);
+	}
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+}
+
+/*
+   reqstream_input
+
+   Processes a stream.* request received by the module for this stream. Sender
+   streams accept credit and abort requests, receiver streams accept chunk,
+   close and abort requests.
+*/
+wstatus
+reqstream_input(reqstream_t rs,const request_t req)
+{
+	request_t req_bin = 0;
+	bool converted = false;
+	const char *code;
+	uint32_t sid,value;
+	nvpair_t nvp = 0;
+	reqstream_slot_t *slot;
+	wstatus ws;
+
+	dbgprint(MOD_REQSTREAM,__func__,"called with rs=%p, req=%p",rs,req);
+
+	if( !rs ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid rs argument (rs=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( !req ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid req argument (req=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	ws = _reqstream_as_bin(req,&req_bin,&converted);
+	if( ws != WSTATUS_SUCCESS ) {
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+	code = req_bin->data.bin.code;
+
+	ws = _reqstream_nv_uint(req_bin,REQNAME_SID,&sid);
+	if( (ws != WSTATUS_SUCCESS) || (sid != rs->sid) ) {
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) request doesn't belong to stream sid=%u",rs,rs->sid);
+		goto return_fail;
+	}
+
+	switch(req_bin->data.bin.code_id)
+	{
+		case REQCODE_STREAM_ABORT:
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) stream sid=%u was aborted by the other side",rs,sid);
+			wlock_acquire(&rs->lock);
+			rs->closed = true;
+			wlock_release(&rs->lock);
+			if( rs->chunk_cb )
+				rs->chunk_cb(rs->param,rs,REQSTREAM_EVENT_ABORT,0,0);
+			goto return_success;
+
+		case REQCODE_STREAM_CREDIT:
+			if( rs->role != REQSTREAM_ROLE_SENDER )
+				goto unexpected_code;
+
+			ws = _reqstream_nv_uint(req_bin,REQNAME_CREDIT,&value);
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) credit request without credit nvpair",rs);
+				goto return_fail;
+			}
+
+			wlock_acquire(&rs->lock);
+			rs->credit += value;
+			wlock_release(&rs->lock);
+			dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) received %u credits",rs,value);
+			goto return_success;
+
+		case REQCODE_STREAM_CLOSE:
+			if( rs->role != REQSTREAM_ROLE_RECEIVER )
+				goto unexpected_code;
+
+			ws = _reqstream_nv_uint(req_bin,REQNAME_CHUNKS,&value);
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) close request without chunks nvpair",rs);
+				goto return_fail;
+			}
+
+			wlock_acquire(&rs->lock);
+			rs->end_seen = true;
+			rs->end_seq = value;
+			ws = _reqstream_deliver(rs);
+			wlock_release(&rs->lock);
+			if( ws != WSTATUS_SUCCESS )
+				goto return_fail;
+			goto return_success;
+
+		case REQCODE_STREAM_CHUNK:
+			if( rs->role != REQSTREAM_ROLE_RECEIVER )
+				goto unexpected_code;
+			break;
+
+		default:
+			goto unexpected_code;
+	}
+
+	/* chunk of a receiver stream */
+
+	ws = _reqstream_nv_uint(req_bin,REQNAME_SEQ,&value);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) chunk request without seq nvpair",rs);
+		goto return_fail;
+	}
+
+	/* the chunk nvpair shares the value with the request, no bytes are copied */
+
+	ws = req_get_nv_id(req_bin,REQNAME_DATA,&nvp);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) chunk request without data nvpair",rs);
+		goto return_fail;
+	}
+
+	wlock_acquire(&rs->lock);
+
+	if( rs->closed || (value < rs->next_seq) ) {
+		wlock_release(&rs->lock);
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) dropping old or duplicated chunk seq=%u",rs,value);
+		_nvp_free(nvp);
+		goto return_success;
+	}
+
+	if( value >= rs->next_seq + rs->window ) {
+		wlock_release(&rs->lock);
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) chunk seq=%u is beyond the credit given, aborting",rs,value);
+		_nvp_free(nvp);
+		reqstream_abort(rs,"credit exceeded");
+		goto return_fail;
+	}
+
+	slot = &rs->slots[value % rs->window];
+	if( slot->used ) {
+		wlock_release(&rs->lock);
+		dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) duplicated chunk seq=%u",rs,value);
+		_nvp_free(nvp);
+		goto return_success;
+	}
+
+	slot->used = true;
+	slot->seq = value;
+	slot->nvp = nvp;
+	rs->buffered++;
+
+	ws = _reqstream_deliver(rs);
+	wlock_release(&rs->lock);
+	if( ws != WSTATUS_SUCCESS )
+		goto return_fail;
+
+return_success:
+	if( converted )
+		req_free(req_bin);
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+
+unexpected_code:
+	dbgprint(MOD_REQSTREAM,__func__,"(rs=%p) unexpected request code %s for %s stream",rs,code,
+			rs->role == REQSTREAM_ROLE_SENDER ? "sender" : "receiver");
+
+return_fail:
+	if( converted )
+		req_free(req_bin);
+
+	DBGRET_FAILURE(MOD_REQSTREAM);
+}
+
+/*
+   reqstream_get_sid
+
+   Returns the stream id of a stream.* request, used by modules to find the
+   stream a request belongs to.
+*/
+wstatus
+reqstream_get_sid(const request_t req,uint32_t *sid)
+{
+	dbgprint(MOD_REQSTREAM,__func__,"called with req=%p, sid=%p",req,sid);
+
+	if( !req || !sid ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid argument (req=0 or sid=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	return _reqstream_nv_uint(req,REQNAME_SID,sid);
+}
+
+/*
+   reqstream_status
+
+   Fills the status data structure with the stream state.
+*/
+wstatus
+reqstream_status(reqstream_t rs,reqstream_status_t *status)
+{
+	if( !rs || !status ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid argument (rs=0 or status=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	wlock_acquire(&rs->lock);
+	status->role = rs->role;
+	status->sid = rs->sid;
+	status->window = rs->window;
+	status->credit = rs->credit;
+	status->next_seq = rs->next_seq;
+	status->chunks_buffered = rs->buffered;
+	status->bytes = rs->bytes;
+	status->closed = rs->closed;
+	wlock_release(&rs->lock);
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+}
+
+/*
+   reqstream_destroy
+
+   Frees the stream data structure, chunks still in the reorder window are
+   discarded. No request is sent, use reqstream_close or reqstream_abort first.
+*/
+wstatus
+reqstream_destroy(reqstream_t rs)
+{
+	unsigned int i;
+
+	dbgprint(MOD_REQSTREAM,__func__,"called with rs=%p",rs);
+
+	if( !rs ) {
+		dbgprint(MOD_REQSTREAM,__func__,"invalid rs argument (rs=0)");
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	if( rs->slots )
+	{
+		for( i = 0 ; i < rs->window ; i++ ) {
+			if( rs->slots[i].used )
+				_nvp_free(rs->slots[i].nvp);
+		}
+		free(rs->slots);
+	}
+
+	wlock_free(&rs->lock);
+	free(rs);
+
+	DBGRET_SUCCESS(MOD_REQSTREAM);
+}
+
+/*
+   reqstream_modmgr_send_cb
+
+   Default send callback, forwards the stream requests through modmgr to the
+   destination module (DCR or SSR). The param isn't used.
+*/
+wstatus
+reqstream_modmgr_send_cb(void *param,request_t req)
+{
+	const struct _modreg_t *mod = 0;
+	wstatus ws;
+
+	ws = modmgr_lookup(array2z(req->data.bin.dst,sizeof(req->data.bin.dst)),&mod);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_REQSTREAM,__func__,"destination module %s not found",
+				array2z(req->data.bin.dst,sizeof(req->data.bin.dst)));
+		DBGRET_FAILURE(MOD_REQSTREAM);
+	}
+
+	return _request_send(req,mod);
+}
+
@@ -0,0 +1,140 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Request Stream - Implementation
+
+   Requests are limited by the uint16_t nvpair sizes and must be fully
+   buffered in a reqbuf before being dispatched, this makes the transfer
+   of big payloads (configuration files, captures, ...) painful. The
+   request stream splits a payload into ordered chunks, each one carried
+   by a normal request, so streams go through modmgr like any other
+   request (DCR or SSR) and no change to the transport is required.
+
+   Request codes used by streams (all of them carry the stream id, sid):
+
+   stream.open		sender -> receiver, opens a new stream.
+   stream.credit	receiver -> sender, credit=N allows N more chunks.
+   stream.chunk		sender -> receiver, seq=N data=<chunk bytes>.
+   stream.close		sender -> receiver, chunks=N (total chunks sent).
+   stream.abort		any direction, errorMsg=<reason>.
+
+   Flow control is credit based, the sender never has more chunks in
+   flight than the credit given by the receiver (the receiver window).
+   The receiver delivers the chunks in order to the consumer callback
+   as they arrive and returns the credit after the chunks are consumed.
+   Chunks arriving out of order (SSR over UDP) are kept in a reorder
+   window with the size of the credit, so the memory used by a stream
+   is bounded by window * REQSTREAM_CHUNK_SIZE, whatever the size of
+   the payload.
+
+   The transport is abstracted like in reqbuf, a send callback and an
+   opaque param are passed when the stream is created. The default one,
+   reqstream_modmgr_send_cb, forwards the requests through modmgr.
+
+   Usage, sender side:
+	1) reqstream_open(send_cb,param,"mysrc","mydst",&rs)
+	2) reqstream_write(rs,ptr,size,&used) sends as many chunks as the
+	   credit allows and returns the bytes consumed, when there's no
+	   credit left it returns with used < size, the caller should write
+	   the rest after more credit arrives.
+	3) stream.credit requests received by the module are passed to
+	   reqstream_input(rs,req).
+	4) reqstream_close(rs) and reqstream_destroy(rs).
+
+   Usage, receiver side:
+	1) when a stream.open request arrives, reqstream_accept creates the
+	   stream and sends the initial credit.
+	2) every stream.* request with the same sid (reqstream_get_sid) is
+	   passed to reqstream_input, which calls the chunk callback for each
+	   chunk in order, and for the end or abort of the stream.
+	3) reqstream_destroy(rs) after the end/abort event.
+*/
+
+#ifndef _REQSTREAM_H
+#define _REQSTREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "wstatus.h"
+#include "req.h"
+
+/* the codes and names are also in reqids.list (REQCODE_STREAM_*, REQNAME_*),
+   reqstream matches them by id */
+#define REQSTREAM_CODE_OPEN "stream.open"
+#define REQSTREAM_CODE_CREDIT "stream.credit"
+#define REQSTREAM_CODE_CHUNK "stream.chunk"
+#define REQSTREAM_CODE_CLOSE "stream.close"
+#define REQSTREAM_CODE_ABORT "stream.abort"
+
+#define REQSTREAM_NV_SID "sid"
+#define REQSTREAM_NV_SEQ "seq"
+#define REQSTREAM_NV_DATA "data"
+#define REQSTREAM_NV_CREDIT "credit"
+#define REQSTREAM_NV_CHUNKS "chunks"
+
+/* chunk size must fit, encoded (#HEX), in an uint16_t value size */
+#define REQSTREAM_CHUNK_SIZE 8192
+#define REQSTREAM_DEFAULT_WINDOW 8
+#define REQSTREAM_MAX_WINDOW 256
+
+typedef struct _reqstream_t *reqstream_t;
+
+typedef enum _reqstream_role_list
+{
+	REQSTREAM_ROLE_SENDER,
+	REQSTREAM_ROLE_RECEIVER
+} reqstream_role_list;
+
+typedef enum _reqstream_event_list
+{
+	REQSTREAM_EVENT_CHUNK,
+	REQSTREAM_EVENT_END,
+	REQSTREAM_EVENT_ABORT
+} reqstream_event_list;
+
+typedef struct _reqstream_status_t
+{
+	reqstream_role_list role;
+	uint32_t sid;
+	unsigned int window;
+	unsigned int credit;
+	uint32_t next_seq;
+	unsigned int chunks_buffered;
+	uint64_t bytes;
+	bool closed;
+} reqstream_status_t;
+
+typedef wstatus (*REQSTREAMSENDCB)(void *param,request_t req);
+typedef wstatus (*REQSTREAMCHUNKCB)(void *param,reqstream_t rs,reqstream_event_list event,const void *chunk_ptr,unsigned int chunk_size);
+
+wstatus reqstream_open(REQSTREAMSENDCB send_cb,void *param,const char *src,const char *dst,reqstream_t *rs);
+wstatus reqstream_write(reqstream_t rs,const void *data_ptr,unsigned int data_size,unsigned int *data_used);
+wstatus reqstream_close(reqstream_t rs);
+wstatus reqstream_abort(reqstream_t rs,const char *reason);
+wstatus reqstream_accept(const request_t open_req,REQSTREAMSENDCB send_cb,REQSTREAMCHUNKCB chunk_cb,void *param,unsigned int window,reqstream_t *rs);
+wstatus reqstream_input(reqstream_t rs,const request_t req);
+wstatus reqstream_get_sid(const request_t req,uint32_t *sid);
+wstatus reqstream_status(reqstream_t rs,reqstream_status_t *status);
+wstatus reqstream_destroy(reqstream_t rs);
+
+wstatus reqstream_modmgr_send_cb(void *param,request_t req);
+
+#endif
+
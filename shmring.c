@@ -0,0 +1,653 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+/* syscall, futex and memfd_create are GNU extensions */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "watomic.h"
+#include "shmring.h"
+
+#if defined POSH_OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#define SHMRING_API 1
+#endif
+
+#define SHMRING_MAGIC 0x57534852			/* "WSHR" */
+#define SHMRING_WRAP 0xFFFFFFFFu			/* record length of the wrap marker */
+#define SHMRING_RECORD_HEADER 8				/* length and padding, keeps the frames aligned */
+#define SHMRING_SPIN_MIN 16
+#define SHMRING_SPIN_MAX 16384
+#define SHMRING_SLEEP_US 100000				/* futex waits are bounded, see shmring_shutdown */
+
+#define SHMRING_ALIGN8(x) (((x) + 7) & ~7u)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define _shmring_pause() __asm__ __volatile__("pause")
+#else
+#define _shmring_pause() watomic_barrier()
+#endif
+
+/*
+   Control words of a ring, head and tail are offsets that only grow (they
+   wrap at 2^32, the ring size is a power of two). Each one is written by a
+   single side and has its own cache line.
+*/
+typedef struct _shmring_ctl_t
+{
+	volatile uint32_t head;				/* written by the producer */
+	char pad0[60];
+	volatile uint32_t tail;				/* written by the consumer */
+	char pad1[60];
+	volatile uint32_t consumer_sleeping;
+	volatile uint32_t producer_sleeping;
+	char pad2[56];
+} shmring_ctl_t;
+
+/* beginning of the shared memory, the data of both rings follows it */
+typedef struct _shmring_shm_t
+{
+	uint32_t magic;
+	uint32_t size;
+	volatile uint32_t closed;
+	char pad[52];
+	shmring_ctl_t ctl[2];				/* 0 = modmgr to module, 1 = module to modmgr */
+} shmring_shm_t;
+
+struct _shmring_t
+{
+	int fd;
+	bool owner;							/* created by this side */
+	char path[SHMRING_PATHSIZE];
+	shmring_shm_t *shm;
+	size_t map_size;
+	uint32_t size;
+	uint32_t mask;
+	/* producer side */
+	shmring_ctl_t *tx_ctl;
+	char *tx_data;
+	uint32_t tx_head;
+	uint32_t tx_tail;					/* last tail read, there's at least this space */
+	bool reserved;
+	unsigned int reserved_size;
+	/* consumer side */
+	shmring_ctl_t *rx_ctl;
+	char *rx_data;
+	uint32_t rx_tail;
+	uint32_t rx_head;					/* last head read */
+	uint32_t rx_next;					/* tail after the release of the peeked frame */
+	bool peeked;
+	unsigned int spin_limit;
+	/* statistics, each updated by a single thread */
+	unsigned long sent;
+	unsigned long received;
+	unsigned long full;
+	unsigned long sleeps;
+	unsigned long wakeups;
+};
+
+#if SHMRING_API == 1
+/*
+   _shmring_futex_wait
+
+   Helper function that sleeps while *addr is value, at most SHMRING_SLEEP_US.
+   The futex is shared, the other side is another process.
+*/
+static void
+_shmring_futex_wait(volatile uint32_t *addr,uint32_t value)
+{
+	struct timespec ts;
+
+	ts.tv_sec = SHMRING_SLEEP_US / 1000000;
+	ts.tv_nsec = (SHMRING_SLEEP_US % 1000000) * 1000L;
+	syscall(SYS_futex,addr,FUTEX_WAIT,value,&ts,0,0);
+}
+
+/*
+   _shmring_futex_wake
+
+   Helper function that wakes the threads sleeping on addr.
+*/
+static void
+_shmring_futex_wake(volatile uint32_t *addr)
+{
+	syscall(SYS_futex,addr,FUTEX_WAKE,INT_MAX,0,0,0);
+}
+#else
+static void _shmring_futex_wait(volatile uint32_t *addr,uint32_t value) { }
+static void _shmring_futex_wake(volatile uint32_t *addr) { }
+#endif
+
+/*
+   _shmring_map
+
+   Helper function that maps the memory of the rings and sets the pointers of
+   this side, the sizes were checked by the caller.
+*/
+static wstatus
+_shmring_map(shmring_t ring,size_t map_size)
+{
+#if SHMRING_API == 1
+	void *map_ptr;
+	unsigned int tx,rx;
+
+	map_ptr = mmap(0,map_size,PROT_READ|PROT_WRITE,MAP_SHARED,ring->fd,0);
+	if( map_ptr == MAP_FAILED ) {
+		dbgprint(MOD_SHMRING,__func__,"mmap failed (errno=%d)",errno);
+		return WSTATUS_FAILURE;
+	}
+
+	ring->shm = (shmring_shm_t*)map_ptr;
+	ring->map_size = map_size;
+
+	/* modmgr writes the first ring, the module the second */
+	tx = ring->owner ? 0 : 1;
+	rx = 1 - tx;
+	ring->tx_ctl = &ring->shm->ctl[tx];
+	ring->rx_ctl = &ring->shm->ctl[rx];
+	ring->tx_data = (char*)map_ptr + sizeof(shmring_shm_t) + (size_t)tx * ring->size;
+	ring->rx_data = (char*)map_ptr + sizeof(shmring_shm_t) + (size_t)rx * ring->size;
+
+	/* the other side might have used the rings already */
+	ring->tx_head = ring->tx_ctl->head;
+	ring->tx_tail = watomic_load_acquire(&ring->tx_ctl->tail);
+	ring->rx_tail = ring->rx_ctl->tail;
+	ring->rx_head = ring->rx_tail;
+	return WSTATUS_SUCCESS;
+#else
+	return WSTATUS_UNSUPPORTED;
+#endif
+}
+
+/*
+   shmring_create
+
+   Creates the rings in a new memfd, each one with size bytes (rounded up to
+   a power of two, 0 = SHMRING_DEFAULT_SIZE). The caller is the modmgr side.
+*/
+wstatus
+shmring_create(unsigned int size,shmring_t *ring)
+{
+#if SHMRING_API == 1
+	shmring_t new_ring = 0;
+	uint32_t ring_size = SHMRING_MIN_SIZE;
+	size_t map_size;
+
+	dbgprint(MOD_SHMRING,__func__,"called with size=%u, ring=%p",size,ring);
+
+	if( !ring || (size > SHMRING_MAX_SIZE) ) {
+		dbgprint(MOD_SHMRING,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( !size )
+		size = SHMRING_DEFAULT_SIZE;
+	while( ring_size < size )
+		ring_size <<= 1;
+	map_size = sizeof(shmring_shm_t) + 2 * (size_t)ring_size;
+
+	new_ring = (shmring_t)malloc(sizeof(struct _shmring_t));
+	if( !new_ring ) {
+		dbgprint(MOD_SHMRING,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_SHMRING);
+	}
+	memset(new_ring,0,sizeof(struct _shmring_t));
+	new_ring->owner = true;
+	new_ring->size = ring_size;
+	new_ring->mask = ring_size - 1;
+	new_ring->spin_limit = SHMRING_SPIN_MIN;
+
+	new_ring->fd = (int)syscall(SYS_memfd_create,"wicom-shmring",0);
+	if( new_ring->fd < 0 ) {
+		dbgprint(MOD_SHMRING,__func__,"memfd_create failed (errno=%d)",errno);
+		free(new_ring);
+		DBGRET_FAILURE(MOD_SHMRING);
+	}
+
+	if( ftruncate(new_ring->fd,map_size) ) {
+		dbgprint(MOD_SHMRING,__func__,"ftruncate failed (errno=%d)",errno);
+		goto return_fail;
+	}
+
+	if( _shmring_map(new_ring,map_size) != WSTATUS_SUCCESS )
+		goto return_fail;
+
+	/* a new memfd is zeroed, only the header is written */
+	new_ring->shm->size = ring_size;
+	new_ring->shm->magic = SHMRING_MAGIC;
+
+	snprintf(new_ring->path,sizeof(new_ring->path),"/proc/%d/fd/%d",(int)getpid(),new_ring->fd);
+
+	*ring = new_ring;
+	dbgprint(MOD_SHMRING,__func__,"created rings of %u bytes at %s",ring_size,new_ring->path);
+	DBGRET_SUCCESS(MOD_SHMRING);
+
+return_fail:
+	close(new_ring->fd);
+	free(new_ring);
+	DBGRET_FAILURE(MOD_SHMRING);
+#else
+	dbgprint(MOD_SHMRING,__func__,"shared memory rings are only supported in Linux");
+	return WSTATUS_UNSUPPORTED;
+#endif
+}
+
+/*
+   shmring_open
+
+   Maps the rings created by modmgr, path is the one returned by its
+   shmring_path. The caller is the module side.
+*/
+wstatus
+shmring_open(const char *path,shmring_t *ring)
+{
+#if SHMRING_API == 1
+	shmring_t new_ring = 0;
+	shmring_shm_t header;
+	struct stat st;
+
+	dbgprint(MOD_SHMRING,__func__,"called with path=%s, ring=%p",z_ptr(path),ring);
+
+	if( !path || !ring || (strlen(path) >= SHMRING_PATHSIZE) ) {
+		dbgprint(MOD_SHMRING,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_ring = (shmring_t)malloc(sizeof(struct _shmring_t));
+	if( !new_ring ) {
+		dbgprint(MOD_SHMRING,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_SHMRING);
+	}
+	memset(new_ring,0,sizeof(struct _shmring_t));
+	new_ring->spin_limit = SHMRING_SPIN_MIN;
+	strcpy(new_ring->path,path);
+
+	new_ring->fd = open(path,O_RDWR);
+	if( new_ring->fd < 0 ) {
+		dbgprint(MOD_SHMRING,__func__,"failed to open %s (errno=%d)",path,errno);
+		free(new_ring);
+		DBGRET_FAILURE(MOD_SHMRING);
+	}
+
+	/* check the header before trusting its size */
+	if( (fstat(new_ring->fd,&st) != 0) || (st.st_size < (off_t)sizeof(header)) ||
+		(pread(new_ring->fd,&header,sizeof(header),0) != (ssize_t)sizeof(header)) ||
+		(header.magic != SHMRING_MAGIC) || (header.size < SHMRING_MIN_SIZE) ||
+		(header.size > SHMRING_MAX_SIZE) || (header.size & (header.size - 1)) ||
+		((size_t)st.st_size < sizeof(shmring_shm_t) + 2 * (size_t)header.size) ) {
+		dbgprint(MOD_SHMRING,__func__,"%s isn't a shmring",path);
+		goto return_fail;
+	}
+
+	new_ring->size = header.size;
+	new_ring->mask = header.size - 1;
+
+	if( _shmring_map(new_ring,sizeof(shmring_shm_t) + 2 * (size_t)header.size) != WSTATUS_SUCCESS )
+		goto return_fail;
+
+	*ring = new_ring;
+	DBGRET_SUCCESS(MOD_SHMRING);
+
+return_fail:
+	close(new_ring->fd);
+	free(new_ring);
+	DBGRET_FAILURE(MOD_SHMRING);
+#else
+	dbgprint(MOD_SHMRING,__func__,"shared memory rings are only supported in Linux");
+	return WSTATUS_UNSUPPORTED;
+#endif
+}
+
+/*
+   shmring_path
+
+   Returns the path the module uses to open the rings (see shmring_open).
+*/
+const char *
+shmring_path(shmring_t ring)
+{
+	return ring ? ring->path : 0;
+}
+
+/*
+   shmring_reserve
+
+   Reserves space for a frame of size bytes in the ring of this side, ptr is
+   set to it (8 bytes aligned). Without space it fails at once, unless wait
+   is true: then it waits for the other side to release frames. The frame is
+   published by shmring_commit, there's a single reserve at a time.
+*/
+wstatus
+shmring_reserve(shmring_t ring,unsigned int size,bool wait,void **ptr)
+{
+	uint32_t need,pos,contiguous,total,tail;
+	unsigned int spins = 0;
+
+	if( !ring || !ptr || ring->reserved || (size > ring->size / 2 - SHMRING_RECORD_HEADER) ) {
+		dbgprint(MOD_SHMRING,__func__,"invalid arguments (ring=%p, size=%u)",ring,size);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	need = SHMRING_RECORD_HEADER + SHMRING_ALIGN8(size);
+	pos = ring->tx_head & ring->mask;
+	contiguous = ring->size - pos;
+	total = (contiguous < need) ? contiguous + need : need;
+
+	while( ring->size - (ring->tx_head - ring->tx_tail) < total )
+	{
+		ring->tx_tail = watomic_load_acquire(&ring->tx_ctl->tail);
+		if( ring->size - (ring->tx_head - ring->tx_tail) >= total )
+			break;
+
+		if( ring->shm->closed ) {
+			dbgprint(MOD_SHMRING,__func__,"rings were shut down");
+			return WSTATUS_FAILURE;
+		}
+
+		if( !wait ) {
+			ring->full++;
+			return WSTATUS_FAILURE;
+		}
+
+		if( spins++ < ring->spin_limit ) {
+			_shmring_pause();
+			continue;
+		}
+
+		/* tell the consumer before testing again, it wakes us after its release */
+		tail = ring->tx_tail;
+		ring->tx_ctl->producer_sleeping = 1;
+		watomic_barrier();
+		if( ring->tx_ctl->tail == tail ) {
+			ring->sleeps++;
+			_shmring_futex_wait(&ring->tx_ctl->tail,tail);
+		}
+		ring->tx_ctl->producer_sleeping = 0;
+	}
+
+	/* the rest of the ring is skipped, the frame must be contiguous */
+	if( contiguous < need ) {
+		*(volatile uint32_t*)(ring->tx_data + pos) = SHMRING_WRAP;
+		ring->tx_head += contiguous;
+		pos = 0;
+	}
+
+	ring->reserved = true;
+	ring->reserved_size = size;
+	*ptr = ring->tx_data + pos + SHMRING_RECORD_HEADER;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   shmring_commit
+
+   Publishes the frame reserved by shmring_reserve, size may be smaller than
+   the reserved one. The consumer is woken if it's sleeping.
+*/
+wstatus
+shmring_commit(shmring_t ring,unsigned int size)
+{
+	uint32_t pos;
+
+	if( !ring || !ring->reserved || (size > ring->reserved_size) ) {
+		dbgprint(MOD_SHMRING,__func__,"invalid arguments (ring=%p, size=%u)",ring,size);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	pos = ring->tx_head & ring->mask;
+	*(volatile uint32_t*)(ring->tx_data + pos) = size;
+	ring->tx_head += SHMRING_RECORD_HEADER + SHMRING_ALIGN8(size);
+	ring->reserved = false;
+	ring->sent++;
+
+	watomic_store_release(&ring->tx_ctl->head,ring->tx_head);
+
+	/* the head must be visible before the flag is read (see shmring_peek), the
+	   flag is cleared so the next commits don't repeat the wakeup */
+	watomic_barrier();
+	if( ring->tx_ctl->consumer_sleeping ) {
+		ring->tx_ctl->consumer_sleeping = 0;
+		ring->wakeups++;
+		_shmring_futex_wake(&ring->tx_ctl->head);
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   shmring_send
+
+   Copies a frame to the ring of this side, see shmring_reserve.
+*/
+wstatus
+shmring_send(shmring_t ring,const void *ptr,unsigned int size,bool wait)
+{
+	void *frame_ptr;
+	wstatus ws;
+
+	ws = shmring_reserve(ring,size,wait,&frame_ptr);
+	if( ws != WSTATUS_SUCCESS )
+		return ws;
+
+	memcpy(frame_ptr,ptr,size);
+	return shmring_commit(ring,size);
+}
+
+/*
+   shmring_peek
+
+   Waits for the next frame of the other side, ptr and size are set to it.
+   The frame stays in the ring until shmring_release. Fails when the rings
+   were shut down and there are no more frames.
+*/
+wstatus
+shmring_peek(shmring_t ring,const void **ptr,unsigned int *size)
+{
+	uint32_t pos,length,head;
+	unsigned int spins;
+
+	if( !ring || !ptr || !size || ring->peeked ) {
+		dbgprint(MOD_SHMRING,__func__,"invalid arguments (ring=%p)",ring);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	for(;;)
+	{
+		if( ring->rx_tail == ring->rx_head )
+		{
+			/* spin first, frames usually come in bursts */
+			for( spins = 0 ; spins < ring->spin_limit ; spins++ ) {
+				ring->rx_head = watomic_load_acquire(&ring->rx_ctl->head);
+				if( ring->rx_head != ring->rx_tail )
+					break;
+				_shmring_pause();
+			}
+
+			if( ring->rx_head != ring->rx_tail ) {
+				if( ring->spin_limit < SHMRING_SPIN_MAX )
+					ring->spin_limit <<= 1;
+			} else {
+				if( ring->spin_limit > SHMRING_SPIN_MIN )
+					ring->spin_limit >>= 1;
+
+				if( ring->shm->closed ) {
+					dbgprint(MOD_SHMRING,__func__,"rings were shut down");
+					return WSTATUS_FAILURE;
+				}
+
+				/* tell the producer before testing again, it wakes us after its commit */
+				ring->rx_ctl->consumer_sleeping = 1;
+				watomic_barrier();
+				head = ring->rx_ctl->head;
+				if( head == ring->rx_tail ) {
+					ring->sleeps++;
+					_shmring_futex_wait(&ring->rx_ctl->head,head);
+				}
+				ring->rx_ctl->consumer_sleeping = 0;
+				ring->rx_head = watomic_load_acquire(&ring->rx_ctl->head);
+				continue;
+			}
+		}
+
+		pos = ring->rx_tail & ring->mask;
+		length = *(volatile uint32_t*)(ring->rx_data + pos);
+
+		if( length == SHMRING_WRAP ) {
+			ring->rx_tail += ring->size - pos;
+			continue;
+		}
+
+		if( (length > ring->size / 2) || (pos + SHMRING_RECORD_HEADER + length > ring->size) ) {
+			dbgprint(MOD_SHMRING,__func__,"corrupted frame length (%u) at %u",length,pos);
+			return WSTATUS_FAILURE;
+		}
+
+		ring->peeked = true;
+		ring->rx_next = ring->rx_tail + SHMRING_RECORD_HEADER + SHMRING_ALIGN8(length);
+		*ptr = ring->rx_data + pos + SHMRING_RECORD_HEADER;
+		*size = length;
+		return WSTATUS_SUCCESS;
+	}
+}
+
+/*
+   shmring_release
+
+   Frees the space of the frame returned by shmring_peek. The producer is
+   woken if it's waiting for space.
+*/
+wstatus
+shmring_release(shmring_t ring)
+{
+	if( !ring || !ring->peeked ) {
+		dbgprint(MOD_SHMRING,__func__,"invalid arguments (ring=%p)",ring);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	ring->rx_tail = ring->rx_next;
+	ring->peeked = false;
+	ring->received++;
+
+	watomic_store_release(&ring->rx_ctl->tail,ring->rx_tail);
+
+	watomic_barrier();
+	if( ring->rx_ctl->producer_sleeping ) {
+		ring->rx_ctl->producer_sleeping = 0;
+		ring->wakeups++;
+		_shmring_futex_wake(&ring->rx_ctl->tail);
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   shmring_shutdown
+
+   Closes the rings for both sides and wakes their threads. A side that was
+   testing the closed flag as it was set wakes at most SHMRING_SLEEP_US
+   later.
+*/
+wstatus
+shmring_shutdown(shmring_t ring)
+{
+	unsigned int i;
+
+	dbgprint(MOD_SHMRING,__func__,"called with ring=%p",ring);
+
+	if( !ring ) {
+		dbgprint(MOD_SHMRING,__func__,"invalid ring argument (ring=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	ring->shm->closed = 1;
+	watomic_barrier();
+
+	for( i = 0 ; i < 2 ; i++ ) {
+		_shmring_futex_wake(&ring->shm->ctl[i].head);
+		_shmring_futex_wake(&ring->shm->ctl[i].tail);
+	}
+
+	DBGRET_SUCCESS(MOD_SHMRING);
+}
+
+/*
+   shmring_status
+
+   Fills status with the state and counters of this side of the rings.
+*/
+wstatus
+shmring_status(shmring_t ring,shmring_status_t *status)
+{
+	if( !ring || !status ) {
+		dbgprint(MOD_SHMRING,__func__,"invalid arguments (ring=%p, status=%p)",ring,status);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	memset(status,0,sizeof(shmring_status_t));
+	status->size = ring->size;
+	status->tx_used = ring->tx_ctl->head - ring->tx_ctl->tail;
+	status->rx_used = ring->rx_ctl->head - ring->rx_ctl->tail;
+	status->sent = ring->sent;
+	status->received = ring->received;
+	status->full = ring->full;
+	status->sleeps = ring->sleeps;
+	status->wakeups = ring->wakeups;
+	status->spin_limit = ring->spin_limit;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   shmring_destroy
+
+   Unmaps the rings of this side, the memfd is freed by the kernel when both
+   sides closed it.
+*/
+wstatus
+shmring_destroy(shmring_t ring)
+{
+	dbgprint(MOD_SHMRING,__func__,"called with ring=%p",ring);
+
+	if( !ring ) {
+		dbgprint(MOD_SHMRING,__func__,"invalid ring argument (ring=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+#if SHMRING_API == 1
+	munmap((void*)ring->shm,ring->map_size);
+	close(ring->fd);
+#endif
+	free(ring);
+	DBGRET_SUCCESS(MOD_SHMRING);
+}
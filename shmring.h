@@ -0,0 +1,91 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Shared memory transport between modmgr and a SSR module of the same host.
+   Sending every request in a UDP datagram costs two syscalls, two copies
+   and the text conversion, a shmring is a pair of single producer single
+   consumer rings in a memfd mapped by both processes, one for each
+   direction, carrying binary frames (see req_to_frame) without syscalls
+   while both sides are busy.
+
+   modmgr creates the rings (shmring_create), the module maps them with the
+   path returned by shmring_path ("/proc/<pid>/fd/<fd>" of the memfd). Each
+   side only writes to its own ring:
+
+   - the producer reserves space for a frame (shmring_reserve), writes it in
+     place and publishes it (shmring_commit), shmring_send copies a buffer.
+   - the consumer gets the next frame (shmring_peek), reads it in place and
+     frees its space (shmring_release).
+
+   A consumer without frames spins for a while before sleeping on a futex,
+   the spin is adapted to the traffic: it grows while frames arrive during
+   the spin and shrinks while they don't, an idle side costs no CPU. The
+   producer only makes the wakeup syscall when the consumer is sleeping. A
+   producer may wait for space the same way, modmgr never does (a full ring
+   is a busy module, see _request_send_shm).
+
+   shmring_shutdown wakes both sides, the frames already in the rings can
+   still be read and then shmring_peek fails.
+
+   Only Linux is supported (memfd and futex).
+*/
+
+#ifndef _SHMRING_H
+#define _SHMRING_H
+
+#include <stdbool.h>
+#include "posh.h"
+#include "wstatus.h"
+
+#define SHMRING_DEFAULT_SIZE (1 << 20)		/* bytes of each ring */
+#define SHMRING_MIN_SIZE 4096
+#define SHMRING_MAX_SIZE (1 << 28)
+#define SHMRING_PATHSIZE 64
+
+typedef struct _shmring_status_t
+{
+	unsigned int size;
+	unsigned int tx_used;				/* bytes waiting in the ring of this side */
+	unsigned int rx_used;				/* bytes waiting in the ring of the other side */
+	unsigned long sent;
+	unsigned long received;
+	unsigned long full;					/* reserves that failed without space */
+	unsigned long sleeps;				/* futex waits */
+	unsigned long wakeups;				/* futex wakes */
+	unsigned int spin_limit;
+} shmring_status_t;
+
+typedef struct _shmring_t *shmring_t;
+
+wstatus shmring_create(unsigned int size,shmring_t *ring);
+wstatus shmring_open(const char *path,shmring_t *ring);
+const char *shmring_path(shmring_t ring);
+wstatus shmring_reserve(shmring_t ring,unsigned int size,bool wait,void **ptr);
+wstatus shmring_commit(shmring_t ring,unsigned int size);
+wstatus shmring_send(shmring_t ring,const void *ptr,unsigned int size,bool wait);
+wstatus shmring_peek(shmring_t ring,const void **ptr,unsigned int *size);
+wstatus shmring_release(shmring_t ring);
+wstatus shmring_shutdown(shmring_t ring);
+wstatus shmring_status(shmring_t ring,shmring_status_t *status);
+wstatus shmring_destroy(shmring_t ring);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Atomic integer operations, used mostly for reference counters of
+   objects shared between threads (nvpair value buffers, sealed
+   requests, etc). These don't need a wlock_t around them.
+
+   Like wlock and wthread this is just a thin layer over the native
+   primitives of the OS/compiler. All operations return the new value
+   except watomic_cas/watomic_casptr which return true if the swap
+   was done.
+
+   watomic_load_acquire and watomic_store_release read and write a
+   variable (any integer) with the ordering needed to publish data to
+   another thread or process (lock free rings, see shmring.h), without
+   the full barrier of the other operations.
+*/
+
+#ifndef _WATOMIC_H
+#define _WATOMIC_H
+
+#include "posh.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#define ATOMIC_API 1 /* gcc __sync builtins */
+#endif
+
+#if (defined POSH_OS_WIN32 || defined POSH_OS_WIN64)
+#include <windows.h>
+#define ATOMIC_API 2 /* Interlocked functions */
+#endif
+
+#ifndef ATOMIC_API
+#error No atomic operations supported by wicom found in your OS.
+#endif
+
+typedef volatile long watomic_t;
+
+#if ATOMIC_API == 1
+#define watomic_inc(p) __sync_add_and_fetch((p),1)
+#define watomic_dec(p) __sync_sub_and_fetch((p),1)
+#define watomic_add(p,v) __sync_add_and_fetch((p),(v))
+#define watomic_get(p) __sync_add_and_fetch((p),0)
+#define watomic_cas(p,o,n) __sync_bool_compare_and_swap((p),(o),(n))
+#define watomic_casptr(p,o,n) __sync_bool_compare_and_swap((p),(o),(n))
+#define watomic_barrier() __sync_synchronize()
+#define watomic_load_acquire(p) __atomic_load_n((p),__ATOMIC_ACQUIRE)
+#define watomic_store_release(p,v) __atomic_store_n((p),(v),__ATOMIC_RELEASE)
+#elif ATOMIC_API == 2
+#define watomic_inc(p) InterlockedIncrement((p))
+#define watomic_dec(p) InterlockedDecrement((p))
+#define watomic_add(p,v) (InterlockedExchangeAdd((p),(v)) + (v))
+#define watomic_get(p) InterlockedExchangeAdd((p),0)
+#define watomic_cas(p,o,n) (InterlockedCompareExchange((p),(n),(o)) == (o))
+#define watomic_casptr(p,o,n) (InterlockedCompareExchangePointer((PVOID*)(p),(PVOID)(n),(PVOID)(o)) == (PVOID)(o))
+#define watomic_barrier() MemoryBarrier()
+#define watomic_load_acquire(p) (*(p))	/* volatile accesses are acquire/release in MSVC */
+#define watomic_store_release(p,v) (*(p) = (v))
+#endif
+
+#endif
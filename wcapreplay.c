@@ -0,0 +1,357 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   wcapreplay - traffic capture replay tool
+
+   Feeds the ingress requests of a capture log (see wcapture.h) back into a
+   wicom instance through an UDP channel and reports the throughput and the
+   latency of the replies. The requests can be sent at the recorded pace, N
+   times faster or as fast as possible:
+
+   wcapreplay [-s speed] [-p local_port] [-c channel_id] [-w wait_ms] capture host port
+
+   -s speed       1 replays at the recorded pace (default), 4 replays 4x
+                  faster, 0 sends as fast as possible.
+   -p local_port  UDP port where the replies are received (default 48791).
+   -c channel_id  only replays the records of this channel.
+   -w wait_ms     time to wait for the replies after the last request.
+
+   Replies are matched to the requests by the request id (the leading number
+   of the request text), so latency is only measured for the requests that
+   have a reply. The result is printed as a JSON line:
+
+   {"sent":10000,"bytes":812345,"duration_s":2.013,"req_per_s":4967.7,
+    "bytes_per_s":403549.1,"replies":9998,"latency_us":{"p50":61.2,"p90":88.0,
+    "p99":140.3,"p999":301.9,"max":512.0},"lag_us":{"p50":1.1,"p99":12.4,"max":80.2}}
+
+   lag_us is how late each request was sent compared with its schedule, if it
+   grows the target pace can't be sustained by this host.
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wstatus.h"
+#include "debug.h"
+#include "jmlist.h"
+#include "watomic.h"
+#include "wthread.h"
+#include "wchannel.h"
+#include "wcapture.h"
+
+#define REPLAY_DEFAULT_PORT "48791"
+#define REPLAY_DEFAULT_WAIT_MS 1000
+#define REPLAY_MAXIDS 65536
+#define REPLAY_MAXMSG 65536
+#define REPLAY_ANY_CHANNEL (-1)
+
+/* replay state shared between the sender and the receiver thread */
+
+static wchannel_t replay_wch = 0;
+static uint64_t replay_sent_ns[REPLAY_MAXIDS];	/* send time by request id, 0 if none */
+static double *replay_latency = 0;				/* reply latencies (us) */
+static unsigned long replay_latency_count = 0;
+static unsigned long replay_latency_max = 0;
+static watomic_t replay_stop = 0;
+
+static int
+replay_cmp_double(const void *a,const void *b)
+{
+	double da = *(const double*)a;
+	double db = *(const double*)b;
+	return (da > db) - (da < db);
+}
+
+static double
+replay_percentile(const double *sorted,unsigned long count,double p)
+{
+	unsigned long i;
+
+	if( !count )
+		return 0.0;
+
+	i = (unsigned long)(p * (double)(count - 1) + 0.5);
+	return sorted[i];
+}
+
+/*
+   replay_request_id
+
+   Returns the request id of a request text (leading decimal number) or -1.
+*/
+static long
+replay_request_id(const char *msg_ptr,unsigned int msg_size)
+{
+	unsigned int i;
+	long id = 0;
+
+	for( i = 0 ; (i < msg_size) && (msg_ptr[i] >= '0') && (msg_ptr[i] <= '9') ; i++ ) {
+		id = id * 10 + (msg_ptr[i] - '0');
+		if( id >= REPLAY_MAXIDS )
+			return -1;
+	}
+
+	return i ? id : -1;
+}
+
+static void
+replay_sleep_until(uint64_t target_ns)
+{
+	struct timespec ts;
+	uint64_t now = wcapture_now_ns();
+
+	if( target_ns <= now )
+		return;
+
+	ts.tv_sec = (time_t)((target_ns - now) / 1000000000ULL);
+	ts.tv_nsec = (long)((target_ns - now) % 1000000000ULL);
+	nanosleep(&ts,0);
+}
+
+/*
+   replay_receiver
+
+   Thread routine that receives the replies and records their latency. The
+   sender wakes it up with a datagram to itself when replay_stop is set.
+*/
+static void
+replay_receiver(void *param)
+{
+	static char msg[REPLAY_MAXMSG];
+	unsigned int msg_used;
+	uint64_t now;
+	long id;
+	wstatus ws;
+
+	param = param;
+
+	for(;;)
+	{
+		ws = wchannel_receive(replay_wch,msg,sizeof(msg),&msg_used);
+		if( watomic_get(&replay_stop) )
+			break;
+
+		if( ws != WSTATUS_SUCCESS )
+			continue;
+
+		now = wcapture_now_ns();
+		id = replay_request_id(msg,msg_used);
+		if( (id < 0) || !replay_sent_ns[id] )
+			continue;
+
+		if( replay_latency_count < replay_latency_max )
+			replay_latency[replay_latency_count++] = (double)(now - replay_sent_ns[id]) / 1000.0;
+		replay_sent_ns[id] = 0;
+	}
+}
+
+static void
+replay_usage(const char *name)
+{
+	fprintf(stderr,"usage: %s [-s speed] [-p local_port] [-c channel_id] [-w wait_ms] capture host port\n",name);
+}
+
+int main(int argc,char *argv[])
+{
+	struct _jmlist_init_params init = { .flags = 0, .fverbose = 0, .fdump = stdout, .fdebug = 0 };
+	wchannel_load_t load;
+	wchannel_opt_t wch_opt = {
+		.type = WCHANNEL_TYPE_SOCKUDP,
+		.host_src = "0.0.0.0",
+		.port_src = REPLAY_DEFAULT_PORT,
+		.debug_opts = WCHANNEL_NO_DEBUG
+	};
+	wcapture_reader_t reader = 0;
+	const wcapture_record_t *rec;
+	wthread_t receiver;
+	char dest[256];
+	char self[64];
+	double speed = 1.0;
+	long channel_id = REPLAY_ANY_CHANNEL;
+	unsigned int wait_ms = REPLAY_DEFAULT_WAIT_MS;
+	uint64_t first_ts = 0, start_ns = 0, end_ns, target_ns, now;
+	unsigned long sent = 0, lag_count = 0, total = 0;
+	unsigned long long bytes = 0;
+	double *lag = 0;
+	double duration;
+	long id;
+	int arg;
+	int ret = EXIT_FAILURE;
+
+	for( arg = 1 ; arg < argc ; arg++ )
+	{
+		if( !strcmp(argv[arg],"-s") && (arg+1 < argc) ) {
+			speed = atof(argv[++arg]);
+			if( speed < 0.0 ) {
+				fprintf(stderr,"speed can't be negative\n");
+				return EXIT_FAILURE;
+			}
+		} else if( !strcmp(argv[arg],"-p") && (arg+1 < argc) ) {
+			wch_opt.port_src = argv[++arg];
+		} else if( !strcmp(argv[arg],"-c") && (arg+1 < argc) ) {
+			channel_id = atol(argv[++arg]);
+		} else if( !strcmp(argv[arg],"-w") && (arg+1 < argc) ) {
+			wait_ms = (unsigned int)atoi(argv[++arg]);
+		} else if( argv[arg][0] == '-' ) {
+			replay_usage(argv[0]);
+			return EXIT_FAILURE;
+		} else
+			break;
+	}
+
+	if( argc - arg != 3 ) {
+		replay_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(dest,sizeof(dest),"%s %s",argv[arg+1],argv[arg+2]);
+	snprintf(self,sizeof(self),"127.0.0.1 %s",wch_opt.port_src);
+
+	debug_set_mask(DEBUG_MASK_NONE);
+	jmlist_initialize(&init);
+
+	if( wcapture_reader_open(argv[arg],&reader) != WSTATUS_SUCCESS ) {
+		fprintf(stderr,"unable to open capture log %s\n",argv[arg]);
+		goto return_jmlist;
+	}
+
+	/* count the records to replay so the sample arrays are allocated once */
+	while( (wcapture_reader_next(reader,&rec) == WSTATUS_SUCCESS) && rec ) {
+		if( (rec->direction == WCAPTURE_DIR_IN) &&
+				((channel_id == REPLAY_ANY_CHANNEL) || (rec->channel_id == channel_id)) )
+			total++;
+	}
+	wcapture_reader_close(reader);
+	reader = 0;
+
+	if( !total ) {
+		fprintf(stderr,"no ingress records to replay in %s\n",argv[arg]);
+		goto return_jmlist;
+	}
+
+	replay_latency = (double*)malloc(total * sizeof(double));
+	lag = (double*)malloc(total * sizeof(double));
+	if( !replay_latency || !lag ) {
+		fprintf(stderr,"malloc failed\n");
+		goto return_free;
+	}
+	replay_latency_max = total;
+
+	if( wchannel_load(load) != WSTATUS_SUCCESS ) {
+		fprintf(stderr,"unable to load wchannel\n");
+		goto return_free;
+	}
+
+	if( wchannel_create(&wch_opt,&replay_wch) != WSTATUS_SUCCESS ) {
+		fprintf(stderr,"unable to create udp channel on port %s\n",wch_opt.port_src);
+		goto return_unload;
+	}
+
+	if( wthread_create(replay_receiver,0,&receiver) != WSTATUS_SUCCESS ) {
+		fprintf(stderr,"unable to create receiver thread\n");
+		goto return_destroy;
+	}
+
+	if( wcapture_reader_open(argv[arg],&reader) != WSTATUS_SUCCESS ) {
+		fprintf(stderr,"unable to open capture log %s\n",argv[arg]);
+		goto return_thread;
+	}
+
+	while( (wcapture_reader_next(reader,&rec) == WSTATUS_SUCCESS) && rec )
+	{
+		if( (rec->direction != WCAPTURE_DIR_IN) ||
+				((channel_id != REPLAY_ANY_CHANNEL) && (rec->channel_id != channel_id)) )
+			continue;
+
+		if( !sent ) {
+			first_ts = rec->timestamp_ns;
+			start_ns = wcapture_now_ns();
+		}
+
+		/* pace: the record is due (timestamp - first timestamp) / speed after the start */
+		if( speed > 0.0 ) {
+			target_ns = start_ns + (uint64_t)((double)(rec->timestamp_ns - first_ts) / speed);
+			replay_sleep_until(target_ns);
+			now = wcapture_now_ns();
+			lag[lag_count++] = (double)(now - target_ns) / 1000.0;
+		} else
+			now = wcapture_now_ns();
+
+		id = replay_request_id(rec->data,rec->size);
+		if( id >= 0 )
+			replay_sent_ns[id] = now;
+
+		if( wchannel_send(replay_wch,dest,(void*)rec->data,rec->size,0) != WSTATUS_SUCCESS )
+			continue;
+
+		sent++;
+		bytes += rec->size;
+	}
+	end_ns = wcapture_now_ns();
+
+	/* give the replies some time, then wake up the receiver to stop it */
+	replay_sleep_until(end_ns + (uint64_t)wait_ms * 1000000ULL);
+	watomic_inc(&replay_stop);
+	wchannel_send(replay_wch,self,"",1,0);
+	wthread_wait(receiver);
+
+	duration = (double)(end_ns - start_ns) / 1e9;
+	qsort(replay_latency,replay_latency_count,sizeof(double),replay_cmp_double);
+	qsort(lag,lag_count,sizeof(double),replay_cmp_double);
+
+	printf("{\"sent\":%lu,\"bytes\":%llu,\"duration_s\":%.3f,\"req_per_s\":%.1f,\"bytes_per_s\":%.1f,\"replies\":%lu,",
+			sent,bytes,duration,duration > 0.0 ? (double)sent / duration : 0.0,
+			duration > 0.0 ? (double)bytes / duration : 0.0,replay_latency_count);
+	printf("\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},",
+			replay_percentile(replay_latency,replay_latency_count,0.50),
+			replay_percentile(replay_latency,replay_latency_count,0.90),
+			replay_percentile(replay_latency,replay_latency_count,0.99),
+			replay_percentile(replay_latency,replay_latency_count,0.999),
+			replay_latency_count ? replay_latency[replay_latency_count-1] : 0.0);
+	if( lag_count )
+		printf("\"lag_us\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+				replay_percentile(lag,lag_count,0.50),replay_percentile(lag,lag_count,0.99),lag[lag_count-1]);
+	else
+		printf("\"lag_us\":null}\n");
+
+	ret = EXIT_SUCCESS;
+	wcapture_reader_close(reader);
+	goto return_destroy;
+
+return_thread:
+	watomic_inc(&replay_stop);
+	wchannel_send(replay_wch,self,"",1,0);
+	wthread_wait(receiver);
+return_destroy:
+	wchannel_destroy(replay_wch);
+return_unload:
+	wchannel_unload();
+return_free:
+	free(replay_latency);
+	free(lag);
+return_jmlist:
+	jmlist_uninitialize();
+	return ret;
+}
+
@@ -0,0 +1,419 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "watomic.h"
+#include "wcapture.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#define WCAPTURE_MMAP 1
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#endif
+
+struct _wcapture_t
+{
+	int fd;
+	uint64_t size;
+	char *base;					/* mapped log */
+	wcapture_header_t *header;
+};
+
+struct _wcapture_reader_t
+{
+	int fd;
+	uint64_t size;
+	uint64_t offset;			/* next record */
+	uint64_t end;				/* end of the used area */
+	char *base;
+	wcapture_header_t *header;
+};
+
+/*
+   wcapture_now_ns
+
+   Returns the monotonic clock in nanoseconds, used for the record timestamps
+   and by the replay tool to pace the requests.
+*/
+uint64_t
+wcapture_now_ns(void)
+{
+#ifdef WCAPTURE_MMAP
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+/*
+   wcapture_open
+
+   Creates (or truncates) the capture log in path with the given size and maps
+   it into memory. The whole log is allocated now so that the writers never
+   have to grow it.
+*/
+wstatus
+wcapture_open(const char *path,uint64_t size,wcapture_t *cap)
+{
+#ifdef WCAPTURE_MMAP
+	wcapture_t new_cap = 0;
+	int fd = -1;
+	void *base;
+
+	dbgprint(MOD_WCAPTURE,__func__,"called with path=%s, size=%llu, cap=%p",path ? path : "(null)",(unsigned long long)size,cap);
+
+	if( !path || !cap ) {
+		dbgprint(MOD_WCAPTURE,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( size < WCAPTURE_MINSIZE ) {
+		dbgprint(MOD_WCAPTURE,__func__,"capture size must be at least %u bytes",WCAPTURE_MINSIZE);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	fd = open(path,O_RDWR|O_CREAT|O_TRUNC,0644);
+	if( fd < 0 ) {
+		dbgprint(MOD_WCAPTURE,__func__,"failed to open capture file %s (%s)",path,strerror(errno));
+		goto return_fail;
+	}
+
+	if( ftruncate(fd,(off_t)size) != 0 ) {
+		dbgprint(MOD_WCAPTURE,__func__,"failed to set capture file size (%s)",strerror(errno));
+		goto return_fail;
+	}
+
+	base = mmap(0,(size_t)size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	if( base == MAP_FAILED ) {
+		dbgprint(MOD_WCAPTURE,__func__,"failed to map capture file (%s)",strerror(errno));
+		goto return_fail;
+	}
+
+	new_cap = (wcapture_t)malloc(sizeof(struct _wcapture_t));
+	if( !new_cap ) {
+		dbgprint(MOD_WCAPTURE,__func__,"malloc failed");
+		munmap(base,(size_t)size);
+		goto return_fail;
+	}
+
+	new_cap->fd = fd;
+	new_cap->size = size;
+	new_cap->base = (char*)base;
+	new_cap->header = (wcapture_header_t*)base;
+
+	memset(new_cap->header,0,sizeof(wcapture_header_t));
+	memcpy(new_cap->header->magic,WCAPTURE_MAGIC,4);
+	new_cap->header->version = WCAPTURE_VERSION;
+	new_cap->header->size = size;
+	new_cap->header->start_ns = wcapture_now_ns();
+	new_cap->header->offset = sizeof(wcapture_header_t);
+
+	dbgprint(MOD_WCAPTURE,__func__,"capture log %s created (cap=%p)",path,new_cap);
+	*cap = new_cap;
+	DBGRET_SUCCESS(MOD_WCAPTURE);
+
+return_fail:
+	if( fd >= 0 )
+		close(fd);
+	DBGRET_FAILURE(MOD_WCAPTURE);
+#else
+	dbgprint(MOD_WCAPTURE,__func__,"capture logs aren't supported in this OS");
+	return WSTATUS_UNSUPPORTED;
+#endif
+}
+
+/*
+   wcapture_write
+
+   Appends a message to the capture log. The space is reserved with an atomic
+   add on the log offset so concurrent writers (receiver thread, modules
+   sending replies) never take a lock, then the record header and the bytes
+   are copied and the record is marked as committed.
+
+   If the log is full the message is dropped and the dropped counter is
+   incremented, the offset keeps growing past the end so the following
+   writers fail fast too. This function is called in the message path, it
+   only logs when a message is dropped.
+*/
+wstatus
+wcapture_write(wcapture_t cap,wcapture_dir_list direction,uint16_t channel_id,const void *msg_ptr,unsigned int msg_size)
+{
+	wcapture_record_t *rec;
+	uint64_t rec_size;
+	uint64_t end;
+
+	if( !cap || (!msg_ptr && msg_size) )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	rec_size = wcapture_record_size(msg_size);
+	end = (uint64_t)watomic_add(&cap->header->offset,(long)rec_size);
+	if( end > cap->size ) {
+		if( watomic_inc(&cap->header->dropped) == 1 )
+			dbgprint(MOD_WCAPTURE,__func__,"capture log is full, dropping messages (cap=%p)",cap);
+		return WSTATUS_FAILURE;
+	}
+
+	rec = (wcapture_record_t*)(cap->base + (end - rec_size));
+	rec->timestamp_ns = wcapture_now_ns();
+	rec->size = msg_size;
+	rec->channel_id = channel_id;
+	rec->direction = (uint8_t)direction;
+	if( msg_size )
+		memcpy(rec->data,msg_ptr,msg_size);
+
+	/* bytes must be visible before the record is seen as committed */
+	watomic_barrier();
+	rec->committed = 1;
+	watomic_inc(&cap->header->records);
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wcapture_status
+
+   Returns the size, bytes used, records written and messages dropped of a
+   capture log.
+*/
+wstatus
+wcapture_status(wcapture_t cap,wcapture_status_t *status)
+{
+	uint64_t used;
+
+	if( !cap || !status )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	used = (uint64_t)watomic_get(&cap->header->offset);
+	status->size = cap->size;
+	status->used = used > cap->size ? cap->size : used;
+	status->records = (uint64_t)watomic_get(&cap->header->records);
+	status->dropped = (uint64_t)watomic_get(&cap->header->dropped);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wcapture_close
+
+   Unmaps the capture log and truncates the file to the used size. Nothing
+   may be writing to the log when this is called (detach it from the channels
+   and request buffers first).
+*/
+wstatus
+wcapture_close(wcapture_t cap)
+{
+#ifdef WCAPTURE_MMAP
+	wcapture_status_t st;
+
+	dbgprint(MOD_WCAPTURE,__func__,"called with cap=%p",cap);
+
+	if( !cap ) {
+		dbgprint(MOD_WCAPTURE,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wcapture_status(cap,&st);
+	dbgprint(MOD_WCAPTURE,__func__,"closing capture log (records=%llu, used=%llu, dropped=%llu)",
+			(unsigned long long)st.records,(unsigned long long)st.used,(unsigned long long)st.dropped);
+
+	/* record the real end so the reader doesn't walk into the unused area */
+	cap->header->offset = (watomic_t)st.used;
+	msync(cap->base,(size_t)cap->size,MS_SYNC);
+	munmap(cap->base,(size_t)cap->size);
+
+	if( ftruncate(cap->fd,(off_t)st.used) != 0 )
+		dbgprint(MOD_WCAPTURE,__func__,"failed to truncate capture file (%s)",strerror(errno));
+
+	close(cap->fd);
+	free(cap);
+	DBGRET_SUCCESS(MOD_WCAPTURE);
+#else
+	return WSTATUS_UNSUPPORTED;
+#endif
+}
+
+/*
+   wcapture_reader_open
+
+   Maps an existing capture log for reading. The log may still be in use by a
+   writer, in that case only the records committed so far are read.
+*/
+wstatus
+wcapture_reader_open(const char *path,wcapture_reader_t *reader)
+{
+#ifdef WCAPTURE_MMAP
+	wcapture_reader_t new_reader = 0;
+	struct stat st;
+	int fd = -1;
+	void *base;
+	uint64_t end;
+
+	dbgprint(MOD_WCAPTURE,__func__,"called with path=%s, reader=%p",path ? path : "(null)",reader);
+
+	if( !path || !reader ) {
+		dbgprint(MOD_WCAPTURE,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	fd = open(path,O_RDONLY);
+	if( fd < 0 ) {
+		dbgprint(MOD_WCAPTURE,__func__,"failed to open capture file %s (%s)",path,strerror(errno));
+		goto return_fail;
+	}
+
+	if( fstat(fd,&st) != 0 || (uint64_t)st.st_size < sizeof(wcapture_header_t) ) {
+		dbgprint(MOD_WCAPTURE,__func__,"capture file %s is too small",path);
+		goto return_fail;
+	}
+
+	base = mmap(0,(size_t)st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	if( base == MAP_FAILED ) {
+		dbgprint(MOD_WCAPTURE,__func__,"failed to map capture file (%s)",strerror(errno));
+		goto return_fail;
+	}
+
+	if( memcmp(((wcapture_header_t*)base)->magic,WCAPTURE_MAGIC,4) ||
+			((wcapture_header_t*)base)->version != WCAPTURE_VERSION ) {
+		dbgprint(MOD_WCAPTURE,__func__,"%s isn't a capture log or has an unsupported version",path);
+		munmap(base,(size_t)st.st_size);
+		goto return_fail;
+	}
+
+	new_reader = (wcapture_reader_t)malloc(sizeof(struct _wcapture_reader_t));
+	if( !new_reader ) {
+		dbgprint(MOD_WCAPTURE,__func__,"malloc failed");
+		munmap(base,(size_t)st.st_size);
+		goto return_fail;
+	}
+
+	end = (uint64_t)((wcapture_header_t*)base)->offset;
+	if( end > (uint64_t)st.st_size )
+		end = (uint64_t)st.st_size;
+
+	new_reader->fd = fd;
+	new_reader->size = (uint64_t)st.st_size;
+	new_reader->base = (char*)base;
+	new_reader->header = (wcapture_header_t*)base;
+	new_reader->offset = sizeof(wcapture_header_t);
+	new_reader->end = end;
+
+	*reader = new_reader;
+	DBGRET_SUCCESS(MOD_WCAPTURE);
+
+return_fail:
+	if( fd >= 0 )
+		close(fd);
+	DBGRET_FAILURE(MOD_WCAPTURE);
+#else
+	return WSTATUS_UNSUPPORTED;
+#endif
+}
+
+/*
+   wcapture_reader_header
+
+   Returns the header of the capture log (start time, records, dropped).
+*/
+wstatus
+wcapture_reader_header(wcapture_reader_t reader,const wcapture_header_t **header)
+{
+	if( !reader || !header )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	*header = reader->header;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wcapture_reader_next
+
+   Returns the next committed record of the log, the record points into the
+   mapped log and is valid until the reader is closed. When there are no
+   more records *record is set to 0. Records that weren't completely written
+   are skipped.
+*/
+wstatus
+wcapture_reader_next(wcapture_reader_t reader,const wcapture_record_t **record)
+{
+	const wcapture_record_t *rec;
+	uint64_t rec_size;
+
+	if( !reader || !record )
+		return WSTATUS_INVALID_ARGUMENT;
+
+	while( reader->offset + WCAPTURE_RECORD_HDRSIZE <= reader->end ) {
+		rec = (const wcapture_record_t*)(reader->base + reader->offset);
+		rec_size = wcapture_record_size(rec->size);
+		if( reader->offset + rec_size > reader->end ) {
+			dbgprint(MOD_WCAPTURE,__func__,"truncated record at offset %llu",(unsigned long long)reader->offset);
+			break;
+		}
+
+		reader->offset += rec_size;
+		if( rec->committed ) {
+			*record = rec;
+			return WSTATUS_SUCCESS;
+		}
+	}
+
+	reader->offset = reader->end;
+	*record = 0;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wcapture_reader_close
+
+   Unmaps the capture log and frees the reader.
+*/
+wstatus
+wcapture_reader_close(wcapture_reader_t reader)
+{
+#ifdef WCAPTURE_MMAP
+	dbgprint(MOD_WCAPTURE,__func__,"called with reader=%p",reader);
+
+	if( !reader ) {
+		dbgprint(MOD_WCAPTURE,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	munmap(reader->base,(size_t)reader->size);
+	close(reader->fd);
+	free(reader);
+	DBGRET_SUCCESS(MOD_WCAPTURE);
+#else
+	return WSTATUS_UNSUPPORTED;
+#endif
+}
+
@@ -0,0 +1,116 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Records the requests that go through wchannels and request buffers into a
+   memory mapped log, the log can be replayed later with wcapreplay to
+   reproduce the real request mix in a test box.
+
+   The log file is created with a fixed size and mapped once, each message is
+   appended with its monotonic timestamp, direction (ingress/egress), the
+   channel id given by the owner of the channel and the raw bytes. Writing a
+   message costs one atomic add (to reserve space) and one memcpy, there's no
+   lock and no system call, so it can stay on in production. When the log is
+   full the messages are dropped and counted.
+
+   Usage:
+
+	wcapture_t cap;
+	wcapture_open("/var/tmp/wicom.cap",256*1024*1024,&cap);
+	wchannel_capture(wch,cap,1);	... every send/receive of wch is logged
+	reqbuf_capture(rb,cap,2);		... every request read from rb is logged
+	...
+	wchannel_capture(wch,0,0);
+	wcapture_close(cap);
+
+   The log is read with wcapture_reader_open / wcapture_reader_next.
+
+   File layout: wcapture_header_t followed by the records, each record is a
+   wcapture_record_t followed by the bytes and padded to 8 bytes. Records
+   that weren't completely written when the log was closed (committed=0) are
+   skipped by the reader. The file is truncated to the used size on close.
+*/
+
+#ifndef _WCAPTURE_H
+#define _WCAPTURE_H
+
+#include <stdint.h>
+#include "wstatus.h"
+#include "watomic.h"
+
+#define WCAPTURE_MAGIC "WCAP"
+#define WCAPTURE_VERSION 1
+#define WCAPTURE_ALIGN 8
+#define WCAPTURE_MINSIZE 4096
+
+typedef enum _wcapture_dir_list {
+	WCAPTURE_DIR_IN = 1,	/* ingress: received */
+	WCAPTURE_DIR_OUT = 2	/* egress: sent */
+} wcapture_dir_list;
+
+typedef struct _wcapture_header_t {
+	char magic[4];
+	uint32_t version;
+	uint64_t size;			/* size of the log (header included) */
+	uint64_t start_ns;		/* monotonic time when the log was created */
+	watomic_t offset;		/* next free byte */
+	watomic_t records;		/* records committed */
+	watomic_t dropped;		/* messages dropped because the log was full */
+	char reserved[16];
+} wcapture_header_t;
+
+typedef struct _wcapture_record_t {
+	uint64_t timestamp_ns;	/* monotonic clock */
+	uint32_t size;			/* bytes of data */
+	uint16_t channel_id;
+	uint8_t direction;		/* wcapture_dir_list */
+	uint8_t committed;
+	char data[1];
+} wcapture_record_t;
+
+#define WCAPTURE_RECORD_HDRSIZE (sizeof(wcapture_record_t)-WCAPTURE_ALIGN)
+#define wcapture_record_size(size) \
+	((WCAPTURE_RECORD_HDRSIZE + (size) + WCAPTURE_ALIGN - 1) & ~(uint64_t)(WCAPTURE_ALIGN - 1))
+
+typedef struct _wcapture_t *wcapture_t;
+typedef struct _wcapture_reader_t *wcapture_reader_t;
+
+typedef struct _wcapture_status_t {
+	uint64_t size;
+	uint64_t used;
+	uint64_t records;
+	uint64_t dropped;
+} wcapture_status_t;
+
+wstatus wcapture_open(const char *path,uint64_t size,wcapture_t *cap);
+wstatus wcapture_write(wcapture_t cap,wcapture_dir_list direction,uint16_t channel_id,const void *msg_ptr,unsigned int msg_size);
+wstatus wcapture_status(wcapture_t cap,wcapture_status_t *status);
+wstatus wcapture_close(wcapture_t cap);
+
+wstatus wcapture_reader_open(const char *path,wcapture_reader_t *reader);
+wstatus wcapture_reader_header(wcapture_reader_t reader,const wcapture_header_t **header);
+wstatus wcapture_reader_next(wcapture_reader_t reader,const wcapture_record_t **record);
+wstatus wcapture_reader_close(wcapture_reader_t reader);
+
+uint64_t wcapture_now_ns(void);
+
+#endif
+
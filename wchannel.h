@@ -42,6 +42,93 @@
    possible also to configure the channel so that each message
    received or sent is dumped to the stdout.
 
+   The message buffer is a capture ring of the last ring_size messages
+   (WCHANNEL_MESSAGE_BUFFER uses buffer_size if ring_size is 0), cheap
+   enough to be always enabled: recording a message copies its first
+   ring_snaplen bytes into a slot of a slab allocated with the channel, no
+   allocation and no lock, senders and the receiver record at once.
+   wchannel_ring_dump copies the messages out while the channel is in use,
+   the oldest first, so the last messages can be inspected after an
+   incident without stopping the traffic.
+
+   UDP channels created with reuse_port can share their port, the kernel
+   spreads the senders between them (each sender always to the same one).
+   wchannel_shutdown wakes a thread blocked in wchannel_receive, it returns
+   failure from then on, so a receiver thread can be stopped before the
+   channel is destroyed.
+
+   UDP channels have two engines, chosen with the engine option. The
+   classic engine makes one syscall per message. The URING engine (Linux,
+   see wuring.h) keeps a multishot receive armed on the socket, the kernel
+   fills a ring of registered buffers (uring_buffers of uring_buffer_size
+   bytes) and the receiver picks the datagrams from the completion ring,
+   without a syscall while they keep arriving. A channel that can't use
+   io_uring (old kernel, io_uring disabled) falls back to the classic
+   engine, wchannel_engine tells which one is in use.
+
+   wchannel_receive copies the message into the caller buffer with either
+   engine. wchannel_receive_zc lends the buffer holding the message
+   instead (a registered buffer with the URING engine, a buffer of the
+   channel with the classic one), it must be given back with
+   wchannel_receive_done before the next wchannel_receive_zc of the classic
+   engine. The URING engine lends up to uring_buffers at a time, a receiver
+   holding all of them doesn't receive anything more.
+
+   wchannel_send_batch sends several messages at once, with a single
+   io_uring submission (URING) or sendmmsg (classic). The messages are
+   sent in order and the batch stops at the first failure.
+
+   UDP channels created with gso hand the kernel one buffer for a run of
+   consecutive messages of a batch with the same destination and size (the
+   last one may be shorter), up to WCHANNEL_GSO_MAX messages and
+   WCHANNEL_GSO_BYTES, the kernel (or the NIC) cuts it into the datagrams
+   (UDP_SEGMENT). The receiver sees the usual datagrams. A run refused by
+   the kernel (a segment larger than the path MTU) is sent one message at a
+   time. With gro, the kernel may hand a receive several datagrams of the
+   same sender at once (UDP_GRO), wchannel_receive and wchannel_receive_zc
+   still return them one at a time, from a buffer of the channel:
+   wchannel_pending tells if a receive returns a datagram of it without
+   reading the socket (wchannel_fd doesn't poll readable for them). gro is
+   used only by the classic engine. wchannel_offload tells which of them
+   the kernel accepted.
+
+   PIPE channels are an unnamed pipe owned by the channel, threads of the
+   process send to it (dest isn't used) and one thread receives from it.
+   The pipe is a stream, a receive returns what is available, not one
+   message. wchannel_shutdown closes the write end, the receiver gets end
+   of file.
+
+   UDP channels send to multicast groups like to any address. With the
+   mcast option the channel applies mcast_ttl (hops of its multicast
+   datagrams, 0 is 1), mcast_loop (this host gets a copy if it joined the
+   group, needed to test on loopback) and mcast_if (interface of the sends,
+   0 lets the routing table choose). wchannel_mcast_join makes the channel
+   receive the datagrams sent to a group on its port, several channels of
+   the same host can receive the group with reuse_port, each one gets a
+   copy. wchannel_mcast_leave leaves the group.
+
+   UDP channels created with reliable deliver the messages of each peer
+   once and in order, those lost are sent again (wrel.h: sequence numbers,
+   selective ACKs, a window per peer with timeouts from the measured round
+   trip). The peers don't wait for each other, a lost message holds only
+   the messages of its sender. A service thread of the channel reads the
+   socket and sends the messages again. wchannel_send never blocks on a
+   peer: it returns WSTATUS_AGAIN while the window of the destination is
+   full (wchannel_send_batch stops there with WSTATUS_AGAIN), the caller
+   keeps the message and tries again once wchannel_reliable_wait says a
+   window opened, meanwhile it can send to the other peers of the channel.
+   Both ends need the option, a plain channel receives the header. Messages
+   sent to a multicast group aren't acknowledged, they're sent plain. The
+   channel uses the classic engine without offloads and has a single
+   receiver, the message of wchannel_receive_zc is kept until the next
+   receive. reliable_loss drops a percent of the datagrams sent (messages
+   and ACKs) to test the recovery on loopback. wchannel_reliable_status
+   returns the counters of each peer.
+
+   wchannel_fd returns a descriptor that polls readable when the channel
+   has something to receive, so a single thread can wait for many channels
+   at once (wloop.h) and receive only from the ready ones.
+
    Example of usage:
 
    wchannel_t wch;
@@ -64,8 +151,11 @@
 #ifndef _WCHANNEL_H
 #define _WCHANNEL_H
 
+#include <stdbool.h>
 #include "posh.h"
 #include "wstatus.h"
+#include "wcapture.h"
+#include "wrel.h"
 
 typedef enum _wchannel_type_list
 {
@@ -82,6 +172,26 @@ typedef enum _wchannel_debug_opts
 	WCHANNEL_MESSAGE_BUFFER
 } wchannel_debug_opts;
 
+typedef enum _wchannel_engine_list
+{
+	WCHANNEL_ENGINE_CLASSIC,
+	WCHANNEL_ENGINE_URING
+} wchannel_engine_list;
+
+#define WCHANNEL_URING_BUFFERS 16			/* default registered buffers, a power of two */
+#define WCHANNEL_URING_BUFFER_SIZE 65536	/* default size of each, the largest datagram */
+#define WCHANNEL_ZC_SIZE 65536				/* buffer lent by the classic engine */
+#define WCHANNEL_BATCH_MAX 64				/* messages sent by a single syscall */
+#define WCHANNEL_RING_SNAPLEN 128			/* default bytes kept of each message by the ring */
+#define WCHANNEL_RING_MAX (1U << 20)		/* largest capture ring, in messages */
+#define WCHANNEL_GSO_MAX 64					/* messages sent in one buffer (UDP_MAX_SEGMENTS) */
+#define WCHANNEL_GSO_BYTES 65507			/* largest buffer, the largest UDP payload */
+#define WCHANNEL_GRO_SIZE 65536				/* receive buffer of a channel with gro */
+
+/* segmentation offloads in use, see wchannel_offload */
+#define WCHANNEL_OFFLOAD_GSO 0x1
+#define WCHANNEL_OFFLOAD_GRO 0x2
+
 typedef struct _wchannel_load_t
 {
 	void *junk;
@@ -100,14 +210,72 @@ typedef struct _wchannel_opt_t
 	wchannel_debug_opts debug_opts;
 	WCHANNELDUMPCB dump_cb;
 	unsigned int buffer_size;
+	bool reuse_port;			/* SO_REUSEPORT, several sockets bound to the same port */
+	wchannel_engine_list engine;
+	unsigned int uring_buffers;		/* 0 = WCHANNEL_URING_BUFFERS */
+	unsigned int uring_buffer_size;	/* 0 = WCHANNEL_URING_BUFFER_SIZE */
+	unsigned int ring_size;			/* capture ring messages (power of two), 0 = none */
+	unsigned int ring_snaplen;		/* 0 = WCHANNEL_RING_SNAPLEN */
+	bool gso;					/* UDP_SEGMENT for the runs of a batch */
+	bool gro;					/* UDP_GRO, classic engine only */
+	bool mcast;					/* apply the multicast options below */
+	unsigned int mcast_ttl;		/* 0 = 1 */
+	bool mcast_loop;			/* IP_MULTICAST_LOOP */
+	char *mcast_if;				/* interface name, 0 = routing table */
+	bool reliable;				/* reliable datagrams (wrel.h), classic engine only */
+	unsigned int reliable_loss;	/* percent of datagrams dropped on purpose, to test */
 } wchannel_opt_t;
 
+/* message of wchannel_send_batch, dest has the format of wchannel_send */
+typedef struct _wchannel_msg_t
+{
+	char *dest;
+	void *ptr;
+	unsigned int size;
+} wchannel_msg_t;
+
+/* message of the capture ring, see wchannel_ring_dump */
+typedef struct _wchannel_ring_msg_t
+{
+	uint64_t seq;				/* messages recorded before this one */
+	uint64_t time_ns;			/* CLOCK_REALTIME */
+	wcapture_dir_list dir;
+	unsigned int size;			/* size of the message */
+	unsigned int snap_size;		/* bytes kept, up to ring_snaplen */
+	const void *ptr;
+} wchannel_ring_msg_t;
+
+typedef void (*WCHANNELRINGCB)(void *param,const wchannel_ring_msg_t *msg);
+
+typedef struct _wchannel_ring_status_t
+{
+	unsigned int entries;
+	unsigned int snaplen;
+	uint64_t recorded;
+	unsigned long dropped;		/* writers lapped by the whole ring */
+} wchannel_ring_status_t;
+
 typedef struct _wchannel_t *wchannel_t;
 
 wstatus wchannel_create(wchannel_opt_t *chan_opt,wchannel_t *channel);
 wstatus wchannel_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used);
 wstatus wchannel_receive(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used);
+wstatus wchannel_receive_zc(wchannel_t channel,void **msg_ptr,unsigned int *msg_used,unsigned int *msg_id);
+wstatus wchannel_receive_done(wchannel_t channel,unsigned int msg_id);
+wstatus wchannel_send_batch(wchannel_t channel,wchannel_msg_t *msg_list,unsigned int msg_count,unsigned int *msg_sent);
+wchannel_engine_list wchannel_engine(wchannel_t channel);
+int wchannel_fd(wchannel_t channel);
+bool wchannel_pending(wchannel_t channel);
+unsigned int wchannel_offload(wchannel_t channel);
+wstatus wchannel_mcast_join(wchannel_t channel,const char *group,const char *ifname);
+wstatus wchannel_mcast_leave(wchannel_t channel,const char *group,const char *ifname);
+wstatus wchannel_reliable_status(wchannel_t channel,wrel_status_t *list,unsigned int list_size,unsigned int *count);
+wstatus wchannel_reliable_wait(wchannel_t channel,unsigned long *gen,unsigned int timeout_us);
 wstatus wchannel_destroy(wchannel_t channel);
+wstatus wchannel_shutdown(wchannel_t channel);
+wstatus wchannel_capture(wchannel_t channel,wcapture_t cap,uint16_t channel_id);
+wstatus wchannel_ring_dump(wchannel_t channel,WCHANNELRINGCB ring_cb,void *param);
+wstatus wchannel_ring_status(wchannel_t channel,wchannel_ring_status_t *status);
 wstatus wchannel_load(wchannel_load_t load);
 wstatus wchannel_unload(void);
 
@@ -18,15 +18,26 @@
 	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
 */
 
+/* sendmmsg is a GNU extension */
+#define _GNU_SOURCE
+
 #include "posh.h"
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/eventfd.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <net/if.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <poll.h>
 #include <arpa/inet.h>
 
 #include "wstatus.h"
@@ -34,28 +45,91 @@
 #include "wlock.h"
 #include "jmlist.h"
 #include "debug.h"
-
-typedef struct _msgentry_t {
-	void *ptr;
+#include "wcapture.h"
+#include "wuring.h"
+#include "watomic.h"
+#include "wthread.h"
+#include "wcond.h"
+#include "wrel.h"
+
+#define WCHANNEL_HOSTSIZE 256
+#define WCHANNEL_URING_ENTRIES 8			/* the receive ring has the receive and the wake read */
+#define WCHANNEL_URING_RECV 1				/* user_data of the multishot receive */
+#define WCHANNEL_URING_WAKE 2				/* user_data of the read of the wake eventfd */
+#define WCHANNEL_URING_CANCEL 3				/* user_data of the cancellation of the receive */
+
+#define WCHANNEL_RING_BUSY UINT64_MAX		/* stamp of a slot being written */
+
+/* slot of the capture ring, its snapshot is in the slab of the ring */
+typedef struct _wchannel_slot_t {
+	volatile uint64_t stamp;				/* seq + 1 of the message, 0 if never written */
+	uint64_t time_ns;
+	wcapture_dir_list dir;
 	unsigned int size;
-} msgentry_t;
-
-typedef struct _msgbuf_t {
-	msgentry_t **list_ptr;
-   	unsigned int size;
-} *msgbuf_t;
+	unsigned int snap_size;
+} wchannel_slot_t;
+
+typedef struct _wchannel_ring_t {
+	wchannel_slot_t *slot_list;
+	char *slab;								/* entries snapshots of snaplen bytes */
+	unsigned int entries;					/* a power of two */
+	unsigned int snaplen;
+	volatile uint64_t head;					/* messages recorded, seq of the next one */
+	volatile unsigned long dropped;
+} *wchannel_ring_t;
 
 struct _wchannel_t {
 	wchannel_opt_t chan_opt;
-	int sock;
-	struct _msgbuf_t message_buffer;
+	int sock;								/* read end of a PIPE channel */
+	int pipe_wr;							/* write end of a PIPE channel, -1 once shut down */
+	int family;								/* address family of sock */
+	wchannel_ring_t ring;					/* capture ring, 0 if disabled */
+	wcapture_t capture;
+	uint16_t capture_id;
+	wchannel_engine_list engine;			/* engine in use, see _wchannel_uring_setup */
+	void *zc_buffer;						/* lent by wchannel_receive_zc (classic) */
+	/* URING engine receive, used only by the receiver thread */
+	wuring_t rx_ring;
+	bool rx_armed;							/* the multishot receive is armed */
+	bool rx_received;						/* a datagram was received by rx_ring */
+	unsigned int rx_lent;					/* registered buffers lent to the caller */
+	int wake_fd;							/* eventfd written by wchannel_shutdown */
+	bool wake_armed;
+	uint64_t wake_value;
+	volatile bool closing;
+	/* URING engine batched send, PIPE writes */
+	wlock_t tx_lock;
+	wuring_t tx_ring;
+	bool tx_failed;							/* sends fell back to sendmmsg */
+	/* segmentation offloads, see _wchannel_udp_offload */
+	bool gso;								/* UDP_SEGMENT accepted by the kernel */
+	bool gro;								/* UDP_GRO accepted by the kernel */
+	char *gro_buffer;						/* last receive, WCHANNEL_GRO_SIZE bytes */
+	unsigned int gro_used;
+	unsigned int gro_pos;					/* next datagram in gro_buffer */
+	unsigned int gro_segment;				/* size of the datagrams of gro_buffer */
+	/* reliable datagrams, see _wchannel_rel_setup */
+	wrel_t rel;
+	wthread_t rel_thread;					/* service thread, the only reader of sock */
+	int rel_fd;								/* eventfd readable while rel has messages */
+	wlock_t rel_lock;
+	wcond_t rel_cond;						/* signaled when a window opens */
+	unsigned long rel_gen;					/* windows opened, under rel_lock */
 };
 
-wstatus _msgbuf_free(msgbuf_t msg_buf);
 wstatus _wchannel_udp_free(wchannel_t channel);
 wstatus _wchannel_udp_create(wchannel_opt_t *chan_opt,wchannel_t *channel);
 wstatus _wchannel_udp_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used);
 wstatus _wchannel_udp_recv(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used);
+static void _wchannel_uring_close(wchannel_t channel);
+static wstatus _wchannel_udp_resolve(wchannel_t channel,char *dest,struct sockaddr_storage *addr,socklen_t *addr_len);
+static void _wchannel_rel_close(wchannel_t channel);
+static wstatus _wchannel_pipe_free(wchannel_t channel);
+static wstatus _wchannel_pipe_create(wchannel_opt_t *chan_opt,wchannel_t *channel);
+static wstatus _wchannel_pipe_send(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used);
+static wstatus _wchannel_pipe_recv(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used);
+static void _wchannel_ring_free(wchannel_ring_t ring);
+static void _wchannel_ring_put(wchannel_ring_t ring,wcapture_dir_list dir,void *msg_ptr,unsigned int msg_size);
 
 bool unloading = false;
 bool loaded = false;
@@ -87,18 +161,23 @@ _wchannel_free_entry(wchannel_t channel)
 				goto return_fail;
 			}
 			break;
-		case WCHANNEL_TYPE_SOCKTCP:
 		case WCHANNEL_TYPE_PIPE:
+			ws = _wchannel_pipe_free(channel);
+			if( ws != WSTATUS_SUCCESS ) {
+				dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to free this channel",channel);
+				goto return_fail;
+			}
+			break;
+		case WCHANNEL_TYPE_SOCKTCP:
 		case WCHANNEL_TYPE_FIFO:
 		default:
 			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) invalid or unsupported channel type");
 			goto return_fail;
 	}
 
-	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) freeing channel structure",channel);
+	/* the pointer isn't used after free, not even by dbgprint */
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) freeing channel structure, returning with success.",channel);
 	free(channel);
-
-	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) returning with success.",channel);
 	return WSTATUS_SUCCESS;
 
 return_fail:
@@ -118,16 +197,19 @@ _wchannel_udp_free(wchannel_t channel)
 {
 	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p",channel);
 
-	if( channel->chan_opt.debug_opts == WCHANNEL_MESSAGE_BUFFER )
-	{
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) message buffer will be freed (p=%p)",
-				channel,channel->message_buffer);
+	_wchannel_ring_free(channel->ring);
 
-		_msgbuf_free(&channel->message_buffer);
-		
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) message buffer freed (p=%p)",
-				channel,channel->message_buffer);
-	}
+	_wchannel_rel_close(channel);
+	_wchannel_uring_close(channel);
+	if( channel->wake_fd >= 0 )
+		close(channel->wake_fd);
+	if( channel->tx_ring )
+		wuring_destroy(channel->tx_ring);
+	wlock_free(&channel->tx_lock);
+	if( channel->zc_buffer )
+		free(channel->zc_buffer);
+	if( channel->gro_buffer )
+		free(channel->gro_buffer);
 
 	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) closing socket descriptor",channel);
 	
@@ -138,618 +220,1976 @@ _wchannel_udp_free(wchannel_t channel)
 
 	DBGRET_SUCCESS(MOD_WCHANNEL);
 }
+
 /*
-   _wchannel_udp_create
+   _wchannel_uring_arm
 
-   Handler function to create an UDP socket with options specified
-   by chan_opt. The created socket should be saved in channel parameter.
+   Helper function that queues the wake read and the multishot receive of
+   the URING engine if they aren't armed, they're submitted by the next
+   wait of the ring.
 */
-wstatus
-_wchannel_udp_create(wchannel_opt_t *chan_opt,wchannel_t *channel)
+static wstatus
+_wchannel_uring_arm(wchannel_t channel)
 {
-	int sock,ecode;
-	struct addrinfo hints,*result,*rp;
-	wchannel_t new_channel;
-	struct sockaddr_in *psin;
-
-	dbgprint(MOD_WCHANNEL,__func__,"called with chan_opt=%p and channel=%p",chan_opt,channel);
+	wstatus ws;
 
-	/* validate arguments */
-	if( !chan_opt ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing channel options structure (chan_opt=0)");
-		goto return_fail_early;
-	}
-	
-	if( !channel ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing channel argument (channel=0)");
-		goto return_fail_early;
+	if( !channel->wake_armed ) {
+		ws = wuring_prep_read(channel->rx_ring,channel->wake_fd,&channel->wake_value,
+				sizeof(channel->wake_value),WCHANNEL_URING_WAKE);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to arm the wake read",channel);
+			return ws;
+		}
+		channel->wake_armed = true;
 	}
 
-	if( chan_opt->type != WCHANNEL_TYPE_SOCKUDP ) {
-		dbgprint(MOD_WCHANNEL,__func__,"unexpected call to this function (sock type is != udp)");
-		goto return_fail_early;
+	if( !channel->rx_armed ) {
+		ws = wuring_prep_recv_multishot(channel->rx_ring,channel->sock,WCHANNEL_URING_RECV);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to arm the receive",channel);
+			return ws;
+		}
+		channel->rx_armed = true;
 	}
 
-	/* create socket */
-
-	memset(&hints,0,sizeof(hints));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_DGRAM;
-	hints.ai_protocol = 0;
-
-	ecode = getaddrinfo(chan_opt->host_src, chan_opt->port_src, &hints, &result);
-	if( ecode != 0 )
-	{
-		dbgprint(MOD_WCHANNEL,__func__,"unable to get address info for binding host (%s)",
-				gai_strerror(ecode));
-		goto return_fail_early;
-	}
+	return WSTATUS_SUCCESS;
+}
 
-	for (rp = result; rp != NULL; rp = rp->ai_next)
-	{
-		sock = 0;
+/*
+   _wchannel_uring_setup
+
+   Helper function that sets up the URING engine of a new UDP channel: the
+   receive ring with its registered buffers and the eventfd that wakes the
+   receiver on shutdown. The multishot receive is armed and submitted right
+   away, so the ring descriptor (wchannel_fd) becomes readable as soon as a
+   datagram is received. When anything fails the channel is left with the
+   classic engine.
+*/
+static void
+_wchannel_uring_setup(wchannel_t channel)
+{
+	unsigned int count,size;
+	wstatus ws;
 
-		sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-		if( sock < 0 )
-			continue;
+	count = channel->chan_opt.uring_buffers ? channel->chan_opt.uring_buffers : WCHANNEL_URING_BUFFERS;
+	size = channel->chan_opt.uring_buffer_size ? channel->chan_opt.uring_buffer_size : WCHANNEL_URING_BUFFER_SIZE;
 
-		dbgprint(MOD_WCHANNEL,__func__,"socket created successfully (sock=%d)",sock);
+	ws = wuring_create(WCHANNEL_URING_ENTRIES,&channel->rx_ring);
+	if( ws != WSTATUS_SUCCESS ) {
+		channel->rx_ring = 0;
+		goto fallback;
+	}
 
-		psin = (struct sockaddr_in*)rp->ai_addr;
-		dbgprint(MOD_WCHANNEL,__func__,"binding of the socket to host=%s and port=%d",
-				inet_ntoa(psin->sin_addr),htons(psin->sin_port));
-		ecode = bind(sock,rp->ai_addr,rp->ai_addrlen);
-		if( ecode < 0 ) {
-			/* this might happen if for example the port is already taken by other pid */
-			dbgprint(MOD_WCHANNEL,__func__,"bind of socket failed (host=%s, port=%d) trying next addr",
-					inet_ntoa(psin->sin_addr),htons(psin->sin_port));
-			close(sock);
-			continue;
-		}
+	ws = wuring_pbuf_register(channel->rx_ring,0,count,size);
+	if( ws != WSTATUS_SUCCESS )
+		goto fallback;
 
-		dbgprint(MOD_WCHANNEL,__func__,"bind to host=%s and port=%d was successful",
-			inet_ntoa(psin->sin_addr),htons(psin->sin_port));
-		/* socket created successfuly */
-		freeaddrinfo(result);
-		goto bind_ok;
+	channel->wake_fd = eventfd(0,EFD_CLOEXEC);
+	if( channel->wake_fd < 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) eventfd failed (%s)",channel,strerror(errno));
+		goto fallback;
 	}
 
-	if( sock )
-		close(sock);
+	/* armed now so the ring polls readable once datagrams arrive (wloop) */
+	ws = _wchannel_uring_arm(channel);
+	if( ws != WSTATUS_SUCCESS )
+		goto fallback;
+	ws = wuring_submit(channel->rx_ring,0);
+	if( ws != WSTATUS_SUCCESS )
+		goto fallback;
+
+	channel->engine = WCHANNEL_ENGINE_URING;
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) using the io_uring engine with %u buffers of %u bytes",
+			channel,count,size);
+	return;
+
+fallback:
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) io_uring is not available, using the classic engine",channel);
+	_wchannel_uring_close(channel);
+	if( channel->wake_fd >= 0 ) {
+		close(channel->wake_fd);
+		channel->wake_fd = -1;
+	}
+	channel->engine = WCHANNEL_ENGINE_CLASSIC;
+}
 
-	freeaddrinfo(result);
-	dbgprint(MOD_WCHANNEL,__func__,"unable to find a valid bind address (host_src=%s, port_src=%s)",
-			(chan_opt->host_src ? chan_opt->host_src : "NULL"),
-		   (chan_opt->port_src ? chan_opt->port_src : "NULL") );
-	goto return_fail_early;
+/*
+   _wchannel_uring_cancel
 
-bind_ok:
+   Helper function that cancels the armed multishot receive and waits for
+   its last completion, the socket is held by the receive until then (a
+   channel created right after on the same port would fail to bind while
+   the kernel tears the ring down).
+*/
+static void
+_wchannel_uring_cancel(wchannel_t channel)
+{
+	wuring_cqe_t cqe;
+	bool cancelled = false;
 
-	/* allocate new channel_t structure to store in internal channel list */
-	dbgprint(MOD_WCHANNEL,__func__,"allocating memory for new channel_t struct");
-	new_channel = (wchannel_t) malloc(sizeof(struct _wchannel_t));
-	dbgprint(MOD_WCHANNEL,__func__,"memory allocated for new channel_t (p=%p)",new_channel);
-	memset(new_channel,0,sizeof(struct _wchannel_t));
-	dbgprint(MOD_WCHANNEL,__func__,"memory of new channel_t cleared");
+	if( !channel->rx_ring || !channel->rx_armed )
+		return;
 
-	dbgprint(MOD_WCHANNEL,__func__,"copying channel options into new channel_t (p=%p)",new_channel);
-	memcpy(&new_channel->chan_opt,chan_opt,sizeof(wchannel_opt_t));
-	dbgprint(MOD_WCHANNEL,__func__,"copying socket handle into new channel_t (p=%p)",new_channel);
-	new_channel->sock = sock;
+	if( (wuring_prep_cancel(channel->rx_ring,WCHANNEL_URING_RECV,WCHANNEL_URING_CANCEL) != WSTATUS_SUCCESS) ||
+			(wuring_submit(channel->rx_ring,0) != WSTATUS_SUCCESS) )
+		return;
 
-	dbgprint(MOD_WCHANNEL,__func__,"updating channel argument");
-	*channel = new_channel;
-	dbgprint(MOD_WCHANNEL,__func__,"new channel (%p) value is %p",*channel);
+	while( !cancelled || channel->rx_armed )
+	{
+		if( wuring_wait(channel->rx_ring,&cqe) != WSTATUS_SUCCESS )
+			break;
 
-	dbgprint(MOD_WCHANNEL,__func__,"returning with success.");
-	return WSTATUS_SUCCESS;
+		if( cqe.user_data == WCHANNEL_URING_CANCEL ) {
+			cancelled = true;
+			/* not found (already done) or not cancellable, don't wait for it */
+			if( cqe.res < 0 )
+				channel->rx_armed = false;
+		}
+		else if( (cqe.user_data == WCHANNEL_URING_RECV) && !cqe.more )
+			channel->rx_armed = false;
+	}
+}
 
-	dbgprint(MOD_WCHANNEL,__func__,"closing socket %d",sock);
-	close(sock);
+/*
+   _wchannel_uring_close
 
-return_fail_early:
-	dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
-	return WSTATUS_FAILURE;
+   Helper function that destroys the receive ring of the URING engine, the
+   armed receive is cancelled and the registered buffers are freed. The
+   wake eventfd stays open, wchannel_shutdown may still write to it.
+*/
+static void
+_wchannel_uring_close(wchannel_t channel)
+{
+	if( channel->rx_ring ) {
+		_wchannel_uring_cancel(channel);
+		wuring_destroy(channel->rx_ring);
+		channel->rx_ring = 0;
+	}
+	channel->rx_armed = false;
+	channel->wake_armed = false;
+	channel->rx_lent = 0;
 }
 
 /*
-   _wchannel_udp_send
+   _wchannel_uring_recv
 
-   Helper function to send a message using an UDP socket and destination
-   specified in dest string. Format of the destiny string is "<host> <port>"
-   there is a space separating host and port.
+   Helper function that returns the next datagram received by the URING
+   engine, lending the registered buffer that holds it (msg_id, given back
+   with _wchannel_uring_done). The multishot receive is armed again when the
+   kernel stops it (it ran out of buffers or failed).
 
-   Should return success if the message is sent successfully, failure otherwise.
+   Kernels with io_uring but without the multishot receive fail it with
+   EINVAL, the channel falls back to the classic engine then and this
+   function returns WSTATUS_UNIMPLEMENTED, the caller must use the classic
+   receive.
 */
-wstatus
-_wchannel_udp_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+static wstatus
+_wchannel_uring_recv(wchannel_t channel,void **msg_ptr,unsigned int *msg_used,unsigned int *msg_id)
 {
-	char *phost,*pport;
-	char *dest_dup;
-	struct addrinfo hints,*result,*rp;
-	int sret,ecode;
-
-	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, dest=%s, msg_ptr=%p, msg_size=%u, msg_used=%p",
-			channel,dest,msg_ptr,msg_size,msg_used);
-
-	
-	/* parse dest string */
+	wuring_cqe_t cqe;
+	wuring_status_t ring_status;
+	wstatus ws;
 
-	if( !dest && (channel->chan_opt.host_dst && channel->chan_opt.port_dst) )
-	{
-		phost = channel->chan_opt.host_dst;
-		pport = channel->chan_opt.port_dst;
-	} else if( dest )
+	for(;;)
 	{
-		dest_dup = strdup(dest);
-		char *pchar = dest_dup;
-		while( (*pchar != ' ') && (*pchar != '\0') )
-			pchar++;
-		
-		if( *pchar == '\0' )
-		{
-			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) dest string format is invalid, missing port information");
-			goto return_fail;
-		} else
-		{
-			phost = dest_dup;
-			pport = pchar + 1;
-			*pchar = '\0';
+		if( channel->closing ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) channel was shut down",channel);
+			DBGRET_FAILURE(MOD_WCHANNEL);
 		}
-	} else
-	{
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) couldn't find any destination information",channel);
-		goto return_fail;
-	}
-	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) detected host=%s and port=%s in dest string",
-			channel,phost,pport);
 
-	/* create addr structure for this destination */
-	memset(&hints,0,sizeof(hints));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_DGRAM;
-	hints.ai_protocol = 0;
+		ws = _wchannel_uring_arm(channel);
+		if( ws != WSTATUS_SUCCESS ) {
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
 
-	ecode = getaddrinfo(phost,pport, &hints, &result);
-	if( ecode != 0 )
-	{
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) unable to get address info for destination host (%s)",
-				channel,gai_strerror(ecode));
-		goto return_fail;
-	}
+		ws = wuring_wait(channel->rx_ring,&cqe);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to wait for a completion",channel);
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
 
-	for (rp = result; rp != NULL; rp = rp->ai_next)
-	{
-		sret = sendto(channel->sock,msg_ptr,msg_size,0,(struct sockaddr*)rp->ai_addr,rp->ai_addrlen);
-		if( sret < 0 )
+		if( cqe.user_data == WCHANNEL_URING_WAKE ) {
+			channel->closing = true;
 			continue;
+		}
 
-		/* socket created successfuly */
-		freeaddrinfo(result);
-		goto msg_sent;
-	}
+		if( !cqe.more )
+			channel->rx_armed = false;
 
-	/* failed to sent */
-	freeaddrinfo(result);
-	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to send message to host %s:%s (%s)",
-			channel,phost,pport,strerror(errno));
-	goto return_fail;
+		if( cqe.res < 0 )
+		{
+			if( cqe.res == -ENOBUFS ) {
+				/* the receive is armed again once a buffer was given back, if the
+				   caller holds all of them nothing can be received */
+				wuring_status(channel->rx_ring,&ring_status);
+				if( channel->rx_lent < ring_status.buffers )
+					continue;
+				dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) every registered buffer is lent (%u)",
+						channel,channel->rx_lent);
+				DBGRET_FAILURE(MOD_WCHANNEL);
+			}
 
-msg_sent:
-	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) message sent successfully (bytes_sent=%d)",channel,sret);
+			if( (cqe.res == -EINVAL) && !channel->rx_received ) {
+				dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) multishot receive is not supported, "
+						"using the classic engine",channel);
+				_wchannel_uring_close(channel);
+				channel->engine = WCHANNEL_ENGINE_CLASSIC;
+				return WSTATUS_UNIMPLEMENTED;
+			}
 
-	if( msg_used ) {
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) updating msg_used argument",channel);
-		*msg_used = (unsigned int)sret;
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) new msg_used value is %u",channel,*msg_used);
-	}
-	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) msg_used is 0 so won't update it",channel);
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) receive failed (%s)",channel,strerror(-cqe.res));
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
 
-	DBGRET_SUCCESS(MOD_WCHANNEL);
+		if( !cqe.has_buffer )
+			continue;
 
-return_fail:
-	
-	DBGRET_FAILURE(MOD_WCHANNEL);
+		if( !cqe.res ) {
+			/* empty datagram, nothing to parse */
+			wuring_pbuf_return(channel->rx_ring,cqe.buf_id);
+			continue;
+		}
+
+		channel->rx_received = true;
+		channel->rx_lent++;
+		*msg_ptr = wuring_pbuf_ptr(channel->rx_ring,cqe.buf_id);
+		*msg_used = (unsigned int)cqe.res;
+		*msg_id = cqe.buf_id;
+		return WSTATUS_SUCCESS;
+	}
 }
 
 /*
-   _wchannel_udp_recv
+   _wchannel_uring_done
 
-   Helper function to be used with sockets to receive data. This function is synchronous
-   meaning that it will hang waiting for data if there's no data available.
+   Helper function that gives a buffer lent by _wchannel_uring_recv back to
+   the receive ring.
 */
-wstatus
-_wchannel_udp_recv(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+static wstatus
+_wchannel_uring_done(wchannel_t channel,unsigned int msg_id)
 {
-	ssize_t recv_bytes;
-
-	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, msgptr=%p, msgsize=%u, msgused=%p",
-			channel,msg_ptr,msg_size,msg_used);
-
-	recv_bytes = recv(channel->sock,msg_ptr,msg_size,0);
-	if( recv_bytes < 0 ) {
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to receive data from socket (%s)",strerror(errno));
-		goto return_fail;
-	} else if ( recv_bytes == 0 ) {
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) peer closed half-side of connection",channel);
-		goto return_fail;
-	}
+	wstatus ws;
 
-	if( msg_used ) {
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) updating msg_used argument to %u",channel,recv_bytes);
-		*msg_used = (unsigned int)recv_bytes;
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) msg_used was updated to %u",channel,*msg_used);
-	} else {
-		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) msg_used is null so its not going to be used",channel);
+	ws = wuring_pbuf_return(channel->rx_ring,msg_id);
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to give back buffer %u",channel,msg_id);
+		return ws;
 	}
 
-	DBGRET_SUCCESS(MOD_WCHANNEL);
-
-return_fail:
-	DBGRET_FAILURE(MOD_WCHANNEL);
+	channel->rx_lent--;
+	return WSTATUS_SUCCESS;
 }
 
 /*
-   _msgbuf_clear
+   _wchannel_udp_offload
 
-   Helper function to clear the message buffer..the right way.
+   Helper function that enables the segmentation offloads asked by the
+   options of a new UDP channel, an offload the kernel doesn't support is
+   left off (see wchannel_offload). Fails only if the gro buffer can't be
+   allocated.
 */
-wstatus
-_msgbuf_clear(msgbuf_t msg_buf)
+static wstatus
+_wchannel_udp_offload(wchannel_t channel)
 {
-	dbgprint(MOD_WCHANNEL,__func__,"called with msgbuf_ptr=%p, msgbuf_size=%u",msg_buf->list_ptr,msg_buf->size);
+	int value;
 
-	for( unsigned int i = 0 ; i < msg_buf->size ; i++ )
-		msg_buf->list_ptr[i] = NULL;
+	if( channel->chan_opt.gso )
+	{
+		/* a segment size of 0 for the socket, each send gives its own */
+		value = 0;
+		if( setsockopt(channel->sock,SOL_UDP,UDP_SEGMENT,&value,sizeof(value)) == 0 )
+			channel->gso = true;
+		else
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) UDP_SEGMENT is not supported, batches are sent per message (%s)",
+					channel,strerror(errno));
+	}
 
-	dbgprint(MOD_WCHANNEL,__func__,"returning with success.");
-	return WSTATUS_SUCCESS;
+	if( channel->chan_opt.gro && (channel->engine == WCHANNEL_ENGINE_CLASSIC) )
+	{
+		value = 1;
+		if( setsockopt(channel->sock,SOL_UDP,UDP_GRO,&value,sizeof(value)) < 0 ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) UDP_GRO is not supported, receiving per datagram (%s)",
+					channel,strerror(errno));
+			return WSTATUS_SUCCESS;
+		}
+
+		channel->gro_buffer = (char*)malloc(WCHANNEL_GRO_SIZE);
+		if( !channel->gro_buffer ) {
+			dbgprint(MOD_WCHANNEL,__func__,"malloc failed (size=%u)",WCHANNEL_GRO_SIZE);
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
+		channel->gro = true;
+	}
+
+	return WSTATUS_SUCCESS;
 }
 
 /*
-   _msgbuf_entry_alloc
+   _wchannel_gro_recv
 
-   Helper function to allocate a new msg buffer entry.
+   Helper function that returns the next datagram of the last receive of a
+   channel with gro, reading the socket when there's none left. The datagram
+   stays in gro_buffer until the next call. Without a UDP_GRO control
+   message the receive is a single datagram.
 */
-wstatus
-_msgbuf_entry_alloc(msgentry_t **new_entry)
+static wstatus
+_wchannel_gro_recv(wchannel_t channel,void **msg_ptr,unsigned int *msg_used)
 {
-	dbgprint(MOD_WCHANNEL,__func__,"called with new_entry=%p",new_entry);
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr hdr;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	unsigned int size;
+	ssize_t recv_bytes;
 
-	msgentry_t *entry;
+	if( channel->gro_pos >= channel->gro_used )
+	{
+		iov.iov_base = channel->gro_buffer;
+		iov.iov_len = WCHANNEL_GRO_SIZE;
+		memset(&hdr,0,sizeof(hdr));
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = control.buf;
+		hdr.msg_controllen = sizeof(control.buf);
+
+		recv_bytes = recvmsg(channel->sock,&hdr,0);
+		if( recv_bytes < 0 ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to receive data from socket (%s)",channel,strerror(errno));
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		} else if( recv_bytes == 0 ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) peer closed half-side of connection",channel);
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
 
-	entry = (msgentry_t*) malloc(sizeof(msgentry_t));
-	if( !entry ) {
-		dbgprint(MOD_WCHANNEL,__func__,"malloc failed");
-		goto return_fail;
-	}
-	dbgprint(MOD_WCHANNEL,__func__,"memory allocated successfully (p=%p)",entry);
+		channel->gro_used = (unsigned int)recv_bytes;
+		channel->gro_pos = 0;
+		channel->gro_segment = channel->gro_used;
 
-	dbgprint(MOD_WCHANNEL,__func__,"clearing new entry structure");
-	memset(entry,0,sizeof(msgentry_t));
+		for( cmsg = CMSG_FIRSTHDR(&hdr) ; cmsg ; cmsg = CMSG_NXTHDR(&hdr,cmsg) )
+		{
+			if( (cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO) ) {
+				memcpy(&size,CMSG_DATA(cmsg),sizeof(int));
+				if( size )
+					channel->gro_segment = size;
+			}
+		}
+	}
 
-	dbgprint(MOD_WCHANNEL,__func__,"updating new_entry to %p",entry);
-	*new_entry = entry;
+	size = channel->gro_used - channel->gro_pos;
+	if( size > channel->gro_segment )
+		size = channel->gro_segment;
 
-	DBGRET_SUCCESS(MOD_WCHANNEL);
-return_fail:
-	DBGRET_FAILURE(MOD_WCHANNEL);
+	*msg_ptr = channel->gro_buffer + channel->gro_pos;
+	*msg_used = size;
+	channel->gro_pos += size;
+	return WSTATUS_SUCCESS;
 }
 
 /*
-   _msgbuf_insert
+   _wchannel_mcast_ifindex
 
-   Helper function to insert a new message buffer entry. Message buffers have a static size
-   so whenever a new entry is inserted, the last one pops out (discarded).
-   The new_entry string pointer will 
+   Helper function that returns the index of the interface of the multicast
+   sends and joins of a channel: ifname, else the mcast_if option, 0 (the
+   routing table chooses) if neither is set. Returns -1 if the interface
+   doesn't exist.
 */
-wstatus
-_msgbuf_insert(msgbuf_t msg_buf,void *msg_ptr,unsigned int msg_size)
+static int
+_wchannel_mcast_ifindex(wchannel_t channel,const char *ifname)
 {
-	msgentry_t *ptail_entry;
-	wstatus ws;
-	msgentry_t *new_entry;
-	unsigned int i;
-
-	dbgprint(MOD_WCHANNEL,__func__,"called with msg_buf=%p, msg_ptr=%p, msg_size=%u",
-			msg_buf,msg_ptr,msg_size);
-
-	/* validate arguments */
-
-	if( !msg_buf ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing msg_buf argument (msg_buf=0)");
-		goto return_fail;
-	}
-
-	if( !msg_ptr ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing msg_ptr argument (msg_ptr=0)");
-		goto return_fail;
-	}
+	unsigned int index;
 
-	if( !msg_size ) {
-		dbgprint(MOD_WCHANNEL,__func__,"message size is null");
-		goto return_fail;
-	}
+	if( !ifname )
+		ifname = channel->chan_opt.mcast_if;
+	if( !ifname || !ifname[0] )
+		return 0;
 
-	ws = _msgbuf_entry_alloc(&new_entry);
-	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) failed to allocate new message entry",msg_buf);
-		goto return_fail;
+	index = if_nametoindex(ifname);
+	if( !index ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) unknown interface %s (%s)",channel,ifname,strerror(errno));
+		return -1;
 	}
-	dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) allocated new message entry successfully (entry=%p)",msg_buf,new_entry);
+	return (int)index;
+}
 
-	dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) filling new message entry fields (entry=%p, ptr=%p, size=%u)",
-			msg_buf,new_entry,msg_ptr,msg_size);
-	new_entry->ptr = msg_ptr;
-	new_entry->size = msg_size;
-	dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) new entry information is ptr=%p and size=%u",
-		msg_buf,new_entry->ptr,new_entry->size);
+/*
+   _wchannel_mcast_setup
 
-	dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) accessing tail entry (%d)",msg_buf,msg_buf->size);
-	ptail_entry = msg_buf->list_ptr[msg_buf->size - 1];
-	if( ptail_entry ) {
-		/* we've a tail entry, should free it from memory */
-		dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) freeing tail entry (entry=%p, ptr=%p, size=%u)",
-				msg_buf,ptail_entry,ptail_entry->ptr,ptail_entry->size);
+   Helper function that applies the multicast options of a new UDP channel
+   to its sends: the hops (mcast_ttl, 0 is 1, the local network), the copy
+   to the groups joined on this host (mcast_loop) and the interface.
+*/
+static wstatus
+_wchannel_mcast_setup(wchannel_t channel)
+{
+	struct ip_mreqn mreqn;
+	int ttl,loop,ifindex;
 
-		free(ptail_entry->ptr);
-		free(ptail_entry);
+	ttl = channel->chan_opt.mcast_ttl ? (int)channel->chan_opt.mcast_ttl : 1;
+	loop = channel->chan_opt.mcast_loop ? 1 : 0;
 
-		dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) tail entry was freed successfully");
+	ifindex = _wchannel_mcast_ifindex(channel,0);
+	if( ifindex < 0 ) {
+		DBGRET_FAILURE(MOD_WCHANNEL);
 	}
-	
-	/* shift all entries one position */
-	dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) shifiting message buffer",msg_buf);
-	for( i = 0 ; i < (msg_buf->size-1) ; i++ )
+
+	if( channel->family == AF_INET6 )
 	{
-		msg_buf->list_ptr[i+1]->ptr = msg_buf->list_ptr[i]->ptr;
-		msg_buf->list_ptr[i+1]->size = msg_buf->list_ptr[i]->size;
+		if( (setsockopt(channel->sock,IPPROTO_IPV6,IPV6_MULTICAST_HOPS,&ttl,sizeof(ttl)) < 0) ||
+				(setsockopt(channel->sock,IPPROTO_IPV6,IPV6_MULTICAST_LOOP,&loop,sizeof(loop)) < 0) ||
+				(ifindex && (setsockopt(channel->sock,IPPROTO_IPV6,IPV6_MULTICAST_IF,&ifindex,sizeof(ifindex)) < 0)) ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) unable to set the multicast options (%s)",channel,strerror(errno));
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
+		DBGRET_SUCCESS(MOD_WCHANNEL);
 	}
-	dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) shifting completed successfully",msg_buf);
 
-	dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) updating head entry to new ptr=%p",msg_buf,new_entry);
-	msg_buf->list_ptr[0] = new_entry;
+	memset(&mreqn,0,sizeof(mreqn));
+	mreqn.imr_ifindex = ifindex;
 
-	dbgprint(MOD_WCHANNEL,__func__,"returning with success.");
-	return WSTATUS_SUCCESS;
+	if( (setsockopt(channel->sock,IPPROTO_IP,IP_MULTICAST_TTL,&ttl,sizeof(ttl)) < 0) ||
+			(setsockopt(channel->sock,IPPROTO_IP,IP_MULTICAST_LOOP,&loop,sizeof(loop)) < 0) ||
+			(ifindex && (setsockopt(channel->sock,IPPROTO_IP,IP_MULTICAST_IF,&mreqn,sizeof(mreqn)) < 0)) ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) unable to set the multicast options (%s)",channel,strerror(errno));
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
 
-return_fail:
-	dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
-	return WSTATUS_FAILURE;
+	DBGRET_SUCCESS(MOD_WCHANNEL);
 }
 
 /*
-   _msgbuf_free
+   _wchannel_mcast_member
 
-   Helper function to free a message buffer. A message buffer as you know
-   is a vector of pointers to msgentry_t structures. These structures also
-   have pointers to allocated memory.
+   Helper function of wchannel_mcast_join and wchannel_mcast_leave, adds or
+   drops the membership of the channel socket in a group.
 */
-wstatus
-_msgbuf_free(msgbuf_t msg_buf)
+static wstatus
+_wchannel_mcast_member(wchannel_t channel,const char *group,const char *ifname,bool join)
 {
-	msgentry_t *entry;
+	struct addrinfo hints,*result;
+	struct ip_mreqn mreqn;
+	struct ipv6_mreq mreq6;
+	int ecode,ifindex,ret;
 
-	dbgprint(MOD_WCHANNEL,__func__,"called with msgbuf=%p",msg_buf);
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, group=%s, ifname=%s, join=%d",
+			channel,group ? group : "NULL",ifname ? ifname : "NULL",join);
 
-	if( !msg_buf ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing msgbuf argument (msgbuf=0)");
-		goto return_fail;
+	if( !channel || !group ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
 	}
 
-	for( unsigned int i = 0 ; i < msg_buf->size ; i++ )
-	{
-		dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) accessing message buffer entry %u",msg_buf,i);
-		if( msg_buf->list_ptr[i] ) {
-			entry = msg_buf->list_ptr[i];
-			if( entry->ptr ) {
-				dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) freeing entry (%u,%p) ptr=%p",msg_buf,i,entry,entry->ptr); 
-				free(entry->ptr);
-			}
-			dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) freeing entry (%u,%p)",msg_buf,i,entry);
-			free(entry);
-			msg_buf->list_ptr[i] = 0;
-		}
+	if( channel->chan_opt.type != WCHANNEL_TYPE_SOCKUDP ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) multicast needs an UDP channel",channel);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	ifindex = _wchannel_mcast_ifindex(channel,ifname);
+	if( ifindex < 0 ) {
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = channel->family;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST;
+
+	ecode = getaddrinfo(group,0,&hints,&result);
+	if( ecode != 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) invalid group address %s (%s)",channel,group,gai_strerror(ecode));
+		return WSTATUS_INVALID_ARGUMENT;
 	}
 
-	dbgprint(MOD_WCHANNEL,__func__,"(msgbuf=%p) all entries were freed, now freeing msgbuf structure",msg_buf);
-	free(msg_buf);
+	if( channel->family == AF_INET6 ) {
+		memset(&mreq6,0,sizeof(mreq6));
+		mreq6.ipv6mr_multiaddr = ((struct sockaddr_in6*)result->ai_addr)->sin6_addr;
+		mreq6.ipv6mr_interface = (unsigned int)ifindex;
+		ret = setsockopt(channel->sock,IPPROTO_IPV6,join ? IPV6_ADD_MEMBERSHIP : IPV6_DROP_MEMBERSHIP,&mreq6,sizeof(mreq6));
+	} else {
+		memset(&mreqn,0,sizeof(mreqn));
+		mreqn.imr_multiaddr = ((struct sockaddr_in*)result->ai_addr)->sin_addr;
+		mreqn.imr_ifindex = ifindex;
+		ret = setsockopt(channel->sock,IPPROTO_IP,join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP,&mreqn,sizeof(mreqn));
+	}
+	freeaddrinfo(result);
+
+	if( ret < 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) unable to %s group %s (%s)",
+				channel,join ? "join" : "leave",group,strerror(errno));
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
 
 	DBGRET_SUCCESS(MOD_WCHANNEL);
-return_fail:
-	DBGRET_FAILURE(MOD_WCHANNEL);
 }
 
 /*
-   wchannel_create
+   _wchannel_rel_xmit
 
-   Channel options are passed in wchannel_opt_t structure, the channel
-   if successful created is returned in channel pointer. This value is
-   only valid if the function returns success.
+   Callback of wrel that sends a datagram of the reliable layer, a failure
+   is handled as a loss (the message is sent again).
+*/
+static void
+_wchannel_rel_xmit(void *param,const void *addr,unsigned int addr_len,const void *ptr,unsigned int size)
+{
+	wchannel_t channel = (wchannel_t)param;
 
-   There are various types of channels, please refer to the dev guide
-   for more information and examples about these.
+	if( sendto(channel->sock,ptr,size,0,(const struct sockaddr*)addr,(socklen_t)addr_len) < 0 )
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to send datagram (%s)",channel,strerror(errno));
+}
 
-   To the client, channel is an opaque pointer to a structure, the
-   definition of the structure is only available in wchannel_X.c this
-   way the client code doesn't have access to the wchannel structure.
+/*
+   _wchannel_rel_event
+
+   Callback of wrel, called with its lock held: rel_fd follows the messages
+   ready to receive, the senders waiting for a window are woken and the
+   service thread is woken to recompute its timeout.
 */
-wstatus
-wchannel_create(wchannel_opt_t *chan_opt,wchannel_t *channel)
+static void
+_wchannel_rel_event(void *param,wrel_event_list event)
 {
-	wstatus ws;
-	wchannel_t new_channel;
-
-	dbgprint(MOD_WCHANNEL,__func__,"called with chan_opt=%p and channel=%p",chan_opt,channel);
+	wchannel_t channel = (wchannel_t)param;
+	uint64_t value = 1;
 
-	if( !loaded ) {
-		dbgprint(MOD_WCHANNEL,__func__,"module was not loaded yet");
-		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
-		return WSTATUS_FAILURE;
+	switch( event )
+	{
+		case WREL_EVENT_READY:
+			if( write(channel->rel_fd,&value,sizeof(value)) < 0 )
+				dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to write to rel eventfd (%s)",channel,strerror(errno));
+			break;
+		case WREL_EVENT_EMPTY:
+			/* non blocking, resets the counter */
+			if( read(channel->rel_fd,&value,sizeof(value)) < 0 )
+				value = 0;
+			break;
+		case WREL_EVENT_WINDOW:
+			wlock_acquire(&channel->rel_lock);
+			channel->rel_gen++;
+			wcond_broadcast(&channel->rel_cond);
+			wlock_release(&channel->rel_lock);
+			break;
+		case WREL_EVENT_TIMER:
+			if( write(channel->wake_fd,&value,sizeof(value)) < 0 )
+				dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to write to wake eventfd (%s)",channel,strerror(errno));
+			break;
 	}
+}
 
-	if( unloading ) {
-		dbgprint(MOD_WCHANNEL,__func__,"cannot call this function when module is unloading");
-		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
-		return WSTATUS_FAILURE;
-	}
+/*
+   _wchannel_rel_thread
 
-	/* validate arguments */
-	if( !chan_opt ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing channel options structure (chan_opt=0)");
-		goto return_fail_early;
-	}
-	
-	if( !channel ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing channel argument (channel=0)");
-		goto return_fail_early;
+   Service thread of a reliable channel: reads the socket (the datagrams go
+   to wrel_input) and sends again the messages whose timeout expired, until
+   the channel is shut down. wake_fd wakes it when a new deadline is
+   earlier than the one it waits for.
+*/
+static void
+_wchannel_rel_thread(void *param)
+{
+	wchannel_t channel = (wchannel_t)param;
+	struct sockaddr_storage addr;
+	struct pollfd pfd_list[2];
+	socklen_t addr_len;
+	ssize_t recv_bytes;
+	uint64_t value;
+	char *buffer;
+	int timeout;
+
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) service thread started",channel);
+
+	buffer = (char*)malloc(WCHANNEL_ZC_SIZE);
+	if( !buffer ) {
+		dbgprint(MOD_WCHANNEL,__func__,"malloc failed (size=%u)",WCHANNEL_ZC_SIZE);
+		return;
 	}
 
-	switch(chan_opt->type)
+	while( !channel->closing )
 	{
-		case WCHANNEL_TYPE_SOCKUDP:
-			dbgprint(MOD_WCHANNEL,__func__,"calling _wchannel_udp_create function");
-			ws = _wchannel_udp_create(chan_opt,&new_channel);
-			dbgprint(MOD_WCHANNEL,__func__,"function has returned ws=%u",ws);
+		timeout = wrel_poll(channel->rel);
+
+		pfd_list[0].fd = channel->sock;
+		pfd_list[0].events = POLLIN;
+		pfd_list[1].fd = channel->wake_fd;
+		pfd_list[1].events = POLLIN;
+		if( poll(pfd_list,2,timeout) < 0 ) {
+			if( errno == EINTR )
+				continue;
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) poll failed (%s)",channel,strerror(errno));
+			break;
+		}
 
-			if( ws != WSTATUS_SUCCESS )
-				goto return_fail_early;
+		if( channel->closing )
+			break;
 
-			dbgprint(MOD_WCHANNEL,__func__,"UDP channel created (channel=%p)",new_channel);
+		if( pfd_list[1].revents & POLLIN ) {
+			if( read(channel->wake_fd,&value,sizeof(value)) < 0 )
+				value = 0;
+		}
 
-			break;
-		case WCHANNEL_TYPE_SOCKTCP:
-		case WCHANNEL_TYPE_PIPE:
-		case WCHANNEL_TYPE_FIFO:
-		default:
-			dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported channel type specified (%d)",
-					chan_opt->type);
-			goto return_fail_early;
+		if( !(pfd_list[0].revents & (POLLIN | POLLERR)) )
+			continue;
+
+		for(;;)
+		{
+			addr_len = sizeof(addr);
+			recv_bytes = recvfrom(channel->sock,buffer,WCHANNEL_ZC_SIZE,MSG_DONTWAIT,(struct sockaddr*)&addr,&addr_len);
+			if( recv_bytes < 0 ) {
+				/* ICMP errors of a peer that went away are reported here, its messages time out */
+				if( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ECONNREFUSED) && (errno != EINTR) )
+					dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to receive data from socket (%s)",
+							channel,strerror(errno));
+				if( (errno == ECONNREFUSED) || (errno == EINTR) )
+					continue;
+				break;
+			}
+			if( recv_bytes == 0 )
+				continue;	/* an empty datagram isn't a message */
+
+			wrel_input(channel->rel,&addr,addr_len,buffer,(unsigned int)recv_bytes);
+		}
 	}
 
-	/* setup debugging */
+	free(buffer);
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) service thread stopped",channel);
+}
 
-	switch(chan_opt->debug_opts)
-	{
-		case WCHANNEL_DUMP_CALLBACK:
-			if( !chan_opt->dump_cb ) {
-				dbgprint(MOD_WCHANNEL,__func__,
-						"(new_channel=%p) need to fill dump callback function address (proc=0)",
-						new_channel);
-				goto return_fail_channel;
-			}
+/*
+   _wchannel_rel_setup
 
-			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) using dump callback for channel debugging (proc=%p)",
-					new_channel,chan_opt->dump_cb);
-			break;
-		case WCHANNEL_MESSAGE_BUFFER:
-			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) using message buffer for channel debugging (size=%u)",
-					new_channel,chan_opt->buffer_size);
-			new_channel->message_buffer.list_ptr = (msgentry_t**) malloc(sizeof(msgentry_t*)*chan_opt->buffer_size);
-			if( !new_channel->message_buffer.list_ptr ) {
-				dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) failed to create message buffer (size=%u)",
-						new_channel,chan_opt->buffer_size);
-				goto return_fail_channel;
-			}
-			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) allocated message buffer successfully (p=%p)",
-					new_channel,new_channel->message_buffer.list_ptr);
+   Helper function that puts the reliable layer (wrel.h) on a new UDP
+   channel: the layer itself, the eventfds and the service thread reading
+   the socket. The channel uses the classic engine without offloads, the
+   service thread is the only reader of its socket.
+*/
+static wstatus
+_wchannel_rel_setup(wchannel_t channel)
+{
+	wrel_opt_t rel_opt;
+
+	memset(&rel_opt,0,sizeof(rel_opt));
+	rel_opt.loss = channel->chan_opt.reliable_loss;
+	rel_opt.xmit_cb = _wchannel_rel_xmit;
+	rel_opt.event_cb = _wchannel_rel_event;
+	rel_opt.param = channel;
+
+	channel->rel_fd = eventfd(0,EFD_CLOEXEC | EFD_NONBLOCK);
+	if( channel->rel_fd < 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) eventfd failed (%s)",channel,strerror(errno));
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
 
-			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) clearing message buffer",new_channel);
-			_msgbuf_clear(&new_channel->message_buffer);
-			break;
-		case WCHANNEL_NO_DEBUG:
-			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) debugging disabled in this channel",new_channel);
-			break;
-		default:
-			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) invalid or unsupported channel debugging options (opt=%d)",
-					new_channel,chan_opt->debug_opts);
-			goto return_fail_channel;
+	channel->wake_fd = eventfd(0,EFD_CLOEXEC | EFD_NONBLOCK);
+	if( channel->wake_fd < 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) eventfd failed (%s)",channel,strerror(errno));
+		goto return_fail_rel_fd;
 	}
 
-	dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) updating channel pointer to %p",new_channel,new_channel);
-	*channel = new_channel;
-	dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) updated channel pointer to %p successfully",new_channel,*channel);
+	if( wlock_create(&channel->rel_lock) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to create the reliable lock",channel);
+		goto return_fail_rel_fd;
+	}
 
-	dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) returning with success.",new_channel);
-	return WSTATUS_SUCCESS;
+	if( wcond_create(&channel->rel_cond) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to create the window condition",channel);
+		goto return_fail_lock;
+	}
 
-return_fail_channel:
-	/* free allocated channel */
-	close(new_channel->sock);
-	free(new_channel);
+	if( wrel_create(&rel_opt,&channel->rel) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to create the reliable layer",channel);
+		goto return_fail_cond;
+	}
 
-return_fail_early:
-	dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
-	return WSTATUS_FAILURE;
+	if( wthread_create(_wchannel_rel_thread,channel,&channel->rel_thread) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to create the service thread",channel);
+		wrel_destroy(channel->rel);
+		channel->rel = 0;
+		goto return_fail_cond;
+	}
+
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) reliable datagrams enabled (loss=%u%%)",
+			channel,channel->chan_opt.reliable_loss);
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+
+return_fail_cond:
+	wcond_free(&channel->rel_cond);
+return_fail_lock:
+	wlock_free(&channel->rel_lock);
+return_fail_rel_fd:
+	close(channel->rel_fd);
+	DBGRET_FAILURE(MOD_WCHANNEL);
 }
 
 /*
-   wchannel_send
+   _wchannel_rel_close
 
-   Sends the buffer_size bytes through the channel. The destination
-   string format depends on the channel type:
-SOCKET:
-	dest = [<host>[ <port>]]
-	if <port> is not used, port specified in chan_opt will be used.
-	if <host> and port are not used, the host and port specified in chan_opt will be used.
-PIPE:
-	...
-FIFO:
-	...
+   Helper function that stops the service thread of a reliable channel and
+   frees its reliable layer, the messages not acknowledged are dropped.
+*/
+static void
+_wchannel_rel_close(wchannel_t channel)
+{
+	uint64_t one = 1;
 
-	If buffer_used != 0, an integer will be written on success indicating
-	the number of bytes sent. This doesn't tell anything about bytes reception tho.
+	if( !channel->rel )
+		return;
 
-Implementation:
-	1) check for arguments
-	2) lookup channel in internal channel list
-	3) validate dest, build sockaddr from dest string
-	4) send buffer
+	channel->closing = true;
+	if( write(channel->wake_fd,&one,sizeof(one)) < 0 )
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to write to wake eventfd (%s)",channel,strerror(errno));
+	wthread_wait(channel->rel_thread);
 
-Return Values:
-	WSTATUS_FAILURE message failed to sent, it can be considered that no message was sent.
-	WSTATUS_SEMIFAIL message was sent, but wchannel was unable to store it on message history
-	(check the debugging output for more information on why and where).
-	WSTATUS_SUCCESS when message was sent and was stored on message history (if active) successfully.
+	wrel_destroy(channel->rel);
+	channel->rel = 0;
+	wcond_free(&channel->rel_cond);
+	wlock_free(&channel->rel_lock);
+	close(channel->rel_fd);
+}
+
+/*
+   _wchannel_rel_send
+
+   Helper function that sends a message of a reliable channel. Returns
+   WSTATUS_AGAIN without sending when the window of the peer is full, the
+   sender never waits here: the channel is shared by the senders of all the
+   peers. Multicast destinations have no single peer to acknowledge, their
+   messages are sent plain.
 */
-wstatus
-wchannel_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+static wstatus
+_wchannel_rel_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
 {
-	unsigned int bytes_sent = 0;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	bool mcast;
 	wstatus ws;
 
-	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, msg_ptr=%p, msg_size=%u, msg_used=%p",
-			channel,msg_ptr,msg_size,msg_used);
-
-	if( !loaded ) {
-		dbgprint(MOD_WCHANNEL,__func__,"module was not loaded yet");
-		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
-		return WSTATUS_FAILURE;
+	if( channel->closing ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) channel was shut down",channel);
+		DBGRET_FAILURE(MOD_WCHANNEL);
 	}
 
-	if( unloading ) {
-		dbgprint(MOD_WCHANNEL,__func__,"cannot call this function when module is unloading");
-		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
-		return WSTATUS_FAILURE;
-	}
+	ws = _wchannel_udp_resolve(channel,dest,&addr,&addr_len);
+	if( ws != WSTATUS_SUCCESS )
+		return ws;
 
-	if( !channel ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing channel argument (channel=0)");
-		goto return_fail;
-	}
+	if( addr.ss_family == AF_INET6 )
+		mcast = IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6*)&addr)->sin6_addr);
+	else
+		mcast = IN_MULTICAST(ntohl(((struct sockaddr_in*)&addr)->sin_addr.s_addr));
 
-	if( !dest || !strlen(dest)) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing argument dest (dest=0 or empty dest)");
-		goto return_fail;
+	if( mcast ) {
+		if( sendto(channel->sock,msg_ptr,msg_size,0,(struct sockaddr*)&addr,addr_len) < 0 ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to send message (%s)",channel,strerror(errno));
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
+		goto msg_sent;
 	}
 
-	if( !msg_ptr || !msg_size ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing message to send or message size is zero");
-		goto return_fail;
+	ws = wrel_send(channel->rel,&addr,addr_len,msg_ptr,msg_size);
+	if( ws == WSTATUS_AGAIN ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) window of %s is full",channel,dest);
+		return WSTATUS_AGAIN;
+	}
+	if( ws != WSTATUS_SUCCESS ) {
+		DBGRET_FAILURE(MOD_WCHANNEL);
 	}
 
-	/* now ready to send */
-
+msg_sent:
+	if( msg_used )
+		*msg_used = msg_size;
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+}
+
+/*
+   _wchannel_rel_recv
+
+   Helper function that returns the next message of a reliable channel,
+   waiting for one. The message is lent by wrel, it's valid until the next
+   receive.
+*/
+static wstatus
+_wchannel_rel_recv(wchannel_t channel,void **msg_ptr,unsigned int *msg_used)
+{
+	struct pollfd pfd;
+
+	for(;;)
+	{
+		if( channel->closing ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) channel was shut down",channel);
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
+
+		if( wrel_deliver(channel->rel,msg_ptr,msg_used) == WSTATUS_SUCCESS )
+			return WSTATUS_SUCCESS;
+
+		pfd.fd = channel->rel_fd;
+		pfd.events = POLLIN;
+		if( (poll(&pfd,1,-1) < 0) && (errno != EINTR) ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) poll failed (%s)",channel,strerror(errno));
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
+	}
+}
+
+/*
+   _wchannel_udp_create
+
+   Handler function to create an UDP socket with options specified
+   by chan_opt. The created socket should be saved in channel parameter.
+*/
+wstatus
+_wchannel_udp_create(wchannel_opt_t *chan_opt,wchannel_t *channel)
+{
+	int sock,ecode,family;
+	struct addrinfo hints,*result,*rp;
+	wchannel_t new_channel;
+	struct sockaddr_in *psin;
+
+	dbgprint(MOD_WCHANNEL,__func__,"called with chan_opt=%p and channel=%p",chan_opt,channel);
+
+	/* validate arguments */
+	if( !chan_opt ) {
+		dbgprint(MOD_WCHANNEL,__func__,"missing channel options structure (chan_opt=0)");
+		goto return_fail_early;
+	}
+	
+	if( !channel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"missing channel argument (channel=0)");
+		goto return_fail_early;
+	}
+
+	if( chan_opt->type != WCHANNEL_TYPE_SOCKUDP ) {
+		dbgprint(MOD_WCHANNEL,__func__,"unexpected call to this function (sock type is != udp)");
+		goto return_fail_early;
+	}
+
+	/* create socket */
+
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = 0;
+
+	ecode = getaddrinfo(chan_opt->host_src, chan_opt->port_src, &hints, &result);
+	if( ecode != 0 )
+	{
+		dbgprint(MOD_WCHANNEL,__func__,"unable to get address info for binding host (%s)",
+				gai_strerror(ecode));
+		goto return_fail_early;
+	}
+
+	for (rp = result; rp != NULL; rp = rp->ai_next)
+	{
+		sock = 0;
+
+		sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if( sock < 0 )
+			continue;
+
+		dbgprint(MOD_WCHANNEL,__func__,"socket created successfully (sock=%d)",sock);
+
+		if( chan_opt->reuse_port )
+		{
+#ifdef SO_REUSEPORT
+			ecode = 1;
+			if( setsockopt(sock,SOL_SOCKET,SO_REUSEPORT,&ecode,sizeof(ecode)) < 0 ) {
+				dbgprint(MOD_WCHANNEL,__func__,"unable to set SO_REUSEPORT (%s)",strerror(errno));
+				close(sock);
+				continue;
+			}
+#else
+			dbgprint(MOD_WCHANNEL,__func__,"SO_REUSEPORT is not supported by this system");
+			close(sock);
+			continue;
+#endif
+		}
+
+		psin = (struct sockaddr_in*)rp->ai_addr;
+		dbgprint(MOD_WCHANNEL,__func__,"binding of the socket to host=%s and port=%d",
+				inet_ntoa(psin->sin_addr),htons(psin->sin_port));
+		ecode = bind(sock,rp->ai_addr,rp->ai_addrlen);
+		if( ecode < 0 ) {
+			/* this might happen if for example the port is already taken by other pid */
+			dbgprint(MOD_WCHANNEL,__func__,"bind of socket failed (host=%s, port=%d) trying next addr",
+					inet_ntoa(psin->sin_addr),htons(psin->sin_port));
+			close(sock);
+			continue;
+		}
+
+		dbgprint(MOD_WCHANNEL,__func__,"bind to host=%s and port=%d was successful",
+			inet_ntoa(psin->sin_addr),htons(psin->sin_port));
+		/* socket created successfuly */
+		family = rp->ai_family;
+		freeaddrinfo(result);
+		goto bind_ok;
+	}
+
+	if( sock )
+		close(sock);
+
+	freeaddrinfo(result);
+	dbgprint(MOD_WCHANNEL,__func__,"unable to find a valid bind address (host_src=%s, port_src=%s)",
+			(chan_opt->host_src ? chan_opt->host_src : "NULL"),
+		   (chan_opt->port_src ? chan_opt->port_src : "NULL") );
+	goto return_fail_early;
+
+bind_ok:
+
+	/* allocate new channel_t structure to store in internal channel list */
+	dbgprint(MOD_WCHANNEL,__func__,"allocating memory for new channel_t struct");
+	new_channel = (wchannel_t) malloc(sizeof(struct _wchannel_t));
+	dbgprint(MOD_WCHANNEL,__func__,"memory allocated for new channel_t (p=%p)",new_channel);
+	memset(new_channel,0,sizeof(struct _wchannel_t));
+	dbgprint(MOD_WCHANNEL,__func__,"memory of new channel_t cleared");
+
+	dbgprint(MOD_WCHANNEL,__func__,"copying channel options into new channel_t (p=%p)",new_channel);
+	memcpy(&new_channel->chan_opt,chan_opt,sizeof(wchannel_opt_t));
+	dbgprint(MOD_WCHANNEL,__func__,"copying socket handle into new channel_t (p=%p)",new_channel);
+	new_channel->sock = sock;
+	new_channel->family = family;
+	new_channel->pipe_wr = -1;
+	new_channel->wake_fd = -1;
+	new_channel->engine = WCHANNEL_ENGINE_CLASSIC;
+
+	/* the service thread of a reliable channel reads the socket one datagram at a time */
+	if( chan_opt->reliable ) {
+		new_channel->chan_opt.engine = WCHANNEL_ENGINE_CLASSIC;
+		new_channel->chan_opt.gso = false;
+		new_channel->chan_opt.gro = false;
+	}
+
+	if( wlock_create(&new_channel->tx_lock) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WCHANNEL,__func__,"failed to create the send lock");
+		free(new_channel);
+		goto return_fail_socket;
+	}
+
+	if( new_channel->chan_opt.engine == WCHANNEL_ENGINE_URING )
+		_wchannel_uring_setup(new_channel);
+
+	if( chan_opt->mcast && (_wchannel_mcast_setup(new_channel) != WSTATUS_SUCCESS) ) {
+		_wchannel_uring_close(new_channel);
+		if( new_channel->wake_fd >= 0 )
+			close(new_channel->wake_fd);
+		wlock_free(&new_channel->tx_lock);
+		free(new_channel);
+		goto return_fail_socket;
+	}
+
+	if( _wchannel_udp_offload(new_channel) != WSTATUS_SUCCESS ) {
+		_wchannel_uring_close(new_channel);
+		if( new_channel->wake_fd >= 0 )
+			close(new_channel->wake_fd);
+		wlock_free(&new_channel->tx_lock);
+		free(new_channel);
+		goto return_fail_socket;
+	}
+
+	if( chan_opt->reliable && (_wchannel_rel_setup(new_channel) != WSTATUS_SUCCESS) ) {
+		if( new_channel->wake_fd >= 0 )
+			close(new_channel->wake_fd);
+		wlock_free(&new_channel->tx_lock);
+		free(new_channel);
+		goto return_fail_socket;
+	}
+
+	dbgprint(MOD_WCHANNEL,__func__,"updating channel argument");
+	*channel = new_channel;
+	dbgprint(MOD_WCHANNEL,__func__,"new channel (%p) value is %p",*channel);
+
+	dbgprint(MOD_WCHANNEL,__func__,"returning with success.");
+	return WSTATUS_SUCCESS;
+
+return_fail_socket:
+	dbgprint(MOD_WCHANNEL,__func__,"closing socket %d",sock);
+	close(sock);
+
+return_fail_early:
+	dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
+	return WSTATUS_FAILURE;
+}
+
+/*
+   _wchannel_udp_send
+
+   Helper function to send a message using an UDP socket and destination
+   specified in dest string. Format of the destiny string is "<host> <port>"
+   there is a space separating host and port.
+
+   Should return success if the message is sent successfully, failure otherwise.
+*/
+wstatus
+_wchannel_udp_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+{
+	char *phost,*pport;
+	char *dest_dup = 0;
+	struct addrinfo hints,*result,*rp;
+	int sret,ecode;
+
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, dest=%s, msg_ptr=%p, msg_size=%u, msg_used=%p",
+			channel,dest,msg_ptr,msg_size,msg_used);
+
+	if( channel->rel )
+		return _wchannel_rel_send(channel,dest,msg_ptr,msg_size,msg_used);
+	
+	/* parse dest string */
+
+	if( !dest && (channel->chan_opt.host_dst && channel->chan_opt.port_dst) )
+	{
+		phost = channel->chan_opt.host_dst;
+		pport = channel->chan_opt.port_dst;
+	} else if( dest )
+	{
+		dest_dup = strdup(dest);
+		char *pchar = dest_dup;
+		while( (*pchar != ' ') && (*pchar != '\0') )
+			pchar++;
+		
+		if( *pchar == '\0' )
+		{
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) dest string format is invalid, missing port information");
+			goto return_fail;
+		} else
+		{
+			phost = dest_dup;
+			pport = pchar + 1;
+			*pchar = '\0';
+		}
+	} else
+	{
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) couldn't find any destination information",channel);
+		goto return_fail;
+	}
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) detected host=%s and port=%s in dest string",
+			channel,phost,pport);
+
+	/* create addr structure for this destination */
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = 0;
+
+	ecode = getaddrinfo(phost,pport, &hints, &result);
+	if( ecode != 0 )
+	{
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) unable to get address info for destination host (%s)",
+				channel,gai_strerror(ecode));
+		goto return_fail;
+	}
+
+	for (rp = result; rp != NULL; rp = rp->ai_next)
+	{
+		sret = sendto(channel->sock,msg_ptr,msg_size,0,(struct sockaddr*)rp->ai_addr,rp->ai_addrlen);
+		if( sret < 0 )
+			continue;
+
+		/* socket created successfuly */
+		freeaddrinfo(result);
+		goto msg_sent;
+	}
+
+	/* failed to sent */
+	freeaddrinfo(result);
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to send message to host %s:%s (%s)",
+			channel,phost,pport,strerror(errno));
+	goto return_fail;
+
+msg_sent:
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) message sent successfully (bytes_sent=%d)",channel,sret);
+
+	if( msg_used ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) updating msg_used argument",channel);
+		*msg_used = (unsigned int)sret;
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) new msg_used value is %u",channel,*msg_used);
+	}
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) msg_used is 0 so won't update it",channel);
+
+	free(dest_dup);
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+
+return_fail:
+	free(dest_dup);
+	DBGRET_FAILURE(MOD_WCHANNEL);
+}
+
+/*
+   _wchannel_udp_recv
+
+   Helper function to be used with sockets to receive data. This function is synchronous
+   meaning that it will hang waiting for data if there's no data available.
+*/
+wstatus
+_wchannel_udp_recv(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+{
+	ssize_t recv_bytes;
+	void *zc_ptr;
+	unsigned int zc_used,zc_id;
+	wstatus ws;
+
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, msgptr=%p, msgsize=%u, msgused=%p",
+			channel,msg_ptr,msg_size,msg_used);
+
+	if( channel->rel )
+	{
+		ws = _wchannel_rel_recv(channel,&zc_ptr,&zc_used);
+		if( ws != WSTATUS_SUCCESS )
+			goto return_fail;
+		recv_bytes = zc_used < msg_size ? zc_used : msg_size;
+		memcpy(msg_ptr,zc_ptr,recv_bytes);
+		goto received;
+	}
+
+	if( channel->engine == WCHANNEL_ENGINE_URING )
+	{
+		ws = _wchannel_uring_recv(channel,&zc_ptr,&zc_used,&zc_id);
+		if( ws == WSTATUS_SUCCESS ) {
+			/* like recv, the part of the datagram that doesn't fit is discarded */
+			recv_bytes = zc_used < msg_size ? zc_used : msg_size;
+			memcpy(msg_ptr,zc_ptr,recv_bytes);
+			_wchannel_uring_done(channel,zc_id);
+			goto received;
+		}
+
+		if( ws != WSTATUS_UNIMPLEMENTED )
+			goto return_fail;
+		/* the channel fell back to the classic engine */
+	}
+
+	if( channel->gro )
+	{
+		ws = _wchannel_gro_recv(channel,&zc_ptr,&zc_used);
+		if( ws != WSTATUS_SUCCESS )
+			goto return_fail;
+		recv_bytes = zc_used < msg_size ? zc_used : msg_size;
+		memcpy(msg_ptr,zc_ptr,recv_bytes);
+		goto received;
+	}
+
+	recv_bytes = recv(channel->sock,msg_ptr,msg_size,0);
+	if( recv_bytes < 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to receive data from socket (%s)",strerror(errno));
+		goto return_fail;
+	} else if ( recv_bytes == 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) peer closed half-side of connection",channel);
+		goto return_fail;
+	}
+
+received:
+	if( msg_used ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) updating msg_used argument to %u",channel,recv_bytes);
+		*msg_used = (unsigned int)recv_bytes;
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) msg_used was updated to %u",channel,*msg_used);
+	} else {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) msg_used is null so its not going to be used",channel);
+	}
+
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+
+return_fail:
+	DBGRET_FAILURE(MOD_WCHANNEL);
+}
+
+/*
+   _wchannel_pipe_create
+
+   Handler function to create a PIPE channel, an unnamed pipe with both ends
+   owned by the channel: wchannel_send writes to it and wchannel_receive
+   reads from it. It's the way for threads of the same process to reach a
+   thread that waits for a channel.
+*/
+static wstatus
+_wchannel_pipe_create(wchannel_opt_t *chan_opt,wchannel_t *channel)
+{
+	int fds[2];
+	wchannel_t new_channel;
+
+	dbgprint(MOD_WCHANNEL,__func__,"called with chan_opt=%p and channel=%p",chan_opt,channel);
+
+	if( pipe2(fds,O_CLOEXEC) < 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"pipe2 failed (%s)",strerror(errno));
+		goto return_fail_early;
+	}
+
+	new_channel = (wchannel_t) malloc(sizeof(struct _wchannel_t));
+	if( !new_channel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"malloc failed (size=%u)",(unsigned int)sizeof(struct _wchannel_t));
+		goto return_fail_pipe;
+	}
+	memset(new_channel,0,sizeof(struct _wchannel_t));
+	memcpy(&new_channel->chan_opt,chan_opt,sizeof(wchannel_opt_t));
+	new_channel->sock = fds[0];
+	new_channel->pipe_wr = fds[1];
+	new_channel->family = AF_UNSPEC;
+	new_channel->wake_fd = -1;
+	new_channel->engine = WCHANNEL_ENGINE_CLASSIC;
+
+	if( wlock_create(&new_channel->tx_lock) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WCHANNEL,__func__,"failed to create the send lock");
+		free(new_channel);
+		goto return_fail_pipe;
+	}
+
+	dbgprint(MOD_WCHANNEL,__func__,"created pipe (read fd=%d, write fd=%d)",fds[0],fds[1]);
+	*channel = new_channel;
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+
+return_fail_pipe:
+	close(fds[0]);
+	close(fds[1]);
+
+return_fail_early:
+	DBGRET_FAILURE(MOD_WCHANNEL);
+}
+
+/*
+   _wchannel_pipe_free
+
+   Helper function to free a PIPE channel data structure, both ends of the
+   pipe are closed.
+*/
+static wstatus
+_wchannel_pipe_free(wchannel_t channel)
+{
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p",channel);
+
+	_wchannel_ring_free(channel->ring);
+
+	if( channel->pipe_wr >= 0 )
+		close(channel->pipe_wr);
+	close(channel->sock);
+	wlock_free(&channel->tx_lock);
+	if( channel->zc_buffer )
+		free(channel->zc_buffer);
+
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+}
+
+/*
+   _wchannel_pipe_send
+
+   Helper function that writes the whole message to the pipe. Messages up to
+   PIPE_BUF bytes are written at once, larger ones are written in parts, the
+   send lock keeps the parts of two senders from being mixed.
+*/
+static wstatus
+_wchannel_pipe_send(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+{
+	unsigned int written = 0;
+	ssize_t ret;
+
+	wlock_acquire(&channel->tx_lock);
+
+	if( channel->pipe_wr < 0 ) {
+		wlock_release(&channel->tx_lock);
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) channel was shut down",channel);
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	while( written < msg_size )
+	{
+		ret = write(channel->pipe_wr,(char*)msg_ptr + written,msg_size - written);
+		if( ret < 0 ) {
+			if( errno == EINTR )
+				continue;
+			wlock_release(&channel->tx_lock);
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) write failed after %u bytes (%s)",
+					channel,written,strerror(errno));
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
+		written += (unsigned int)ret;
+	}
+
+	wlock_release(&channel->tx_lock);
+
+	*msg_used = written;
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+}
+
+/*
+   _wchannel_pipe_recv
+
+   Helper function that reads what is available in the pipe, up to msg_size
+   bytes, waiting if it's empty. A pipe is a stream, the message boundaries
+   of the sender aren't kept. End of file (the channel was shut down) is a
+   failure.
+*/
+static wstatus
+_wchannel_pipe_recv(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+{
+	ssize_t ret;
+
+	do {
+		ret = read(channel->sock,msg_ptr,msg_size);
+	} while( (ret < 0) && (errno == EINTR) );
+
+	if( ret < 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) read failed (%s)",channel,strerror(errno));
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	if( !ret ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) pipe was closed",channel);
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	*msg_used = (unsigned int)ret;
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+}
+
+/*
+   _wchannel_udp_resolve
+
+   Helper function that resolves a destination string of wchannel_send into
+   the address of the first host found of the channel address family.
+*/
+static wstatus
+_wchannel_udp_resolve(wchannel_t channel,char *dest,struct sockaddr_storage *addr,socklen_t *addr_len)
+{
+	char host[WCHANNEL_HOSTSIZE];
+	char *phost,*pport,*pchar;
+	struct addrinfo hints,*result;
+	int ecode;
+
+	if( !dest ) {
+		if( !channel->chan_opt.host_dst || !channel->chan_opt.port_dst ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) couldn't find any destination information",channel);
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
+		phost = channel->chan_opt.host_dst;
+		pport = channel->chan_opt.port_dst;
+	} else {
+		pchar = strchr(dest,' ');
+		if( !pchar || ((size_t)(pchar - dest) >= sizeof(host)) ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) dest string format is invalid (%s)",channel,dest);
+			DBGRET_FAILURE(MOD_WCHANNEL);
+		}
+		memcpy(host,dest,pchar - dest);
+		host[pchar - dest] = '\0';
+		phost = host;
+		pport = pchar + 1;
+	}
+
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = channel->family;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	ecode = getaddrinfo(phost,pport,&hints,&result);
+	if( ecode != 0 ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) unable to get address info for destination host %s:%s (%s)",
+				channel,phost,pport,gai_strerror(ecode));
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	memcpy(addr,result->ai_addr,result->ai_addrlen);
+	*addr_len = result->ai_addrlen;
+	freeaddrinfo(result);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   _wchannel_udp_sendmmsg
+
+   Helper function that sends count messages with sendmmsg, returns how many
+   were sent before the first failure.
+*/
+static unsigned int
+_wchannel_udp_sendmmsg(wchannel_t channel,struct mmsghdr *hdr_list,unsigned int count)
+{
+	unsigned int done = 0;
+	int ret;
+
+	while( done < count )
+	{
+		ret = sendmmsg(channel->sock,hdr_list + done,count - done,0);
+		if( ret < 0 ) {
+			if( errno == EINTR )
+				continue;
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) sendmmsg failed after %u messages (%s)",
+					channel,done,strerror(errno));
+			break;
+		}
+		done += (unsigned int)ret;
+	}
+
+	return done;
+}
+
+/*
+   _wchannel_uring_sendmsg
+
+   Helper function that sends count messages with a single io_uring
+   submission, the sends are linked so they stop at the first failure.
+   Returns how many were sent. The send ring is created by the first batch
+   and shared by the senders of the channel (tx_lock), sends fall back to
+   sendmmsg if it can't be created.
+*/
+static unsigned int
+_wchannel_uring_sendmsg(wchannel_t channel,struct mmsghdr *hdr_list,unsigned int count)
+{
+	bool sent_list[WCHANNEL_BATCH_MAX];
+	wuring_cqe_t cqe;
+	unsigned int i,done;
+	wstatus ws;
+
+	wlock_acquire(&channel->tx_lock);
+
+	if( !channel->tx_ring && !channel->tx_failed ) {
+		ws = wuring_create(WCHANNEL_BATCH_MAX,&channel->tx_ring);
+		if( ws != WSTATUS_SUCCESS ) {
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) io_uring is not available, sending with sendmmsg",channel);
+			channel->tx_ring = 0;
+			channel->tx_failed = true;
+		}
+	}
+
+	if( !channel->tx_ring ) {
+		wlock_release(&channel->tx_lock);
+		return _wchannel_udp_sendmmsg(channel,hdr_list,count);
+	}
+
+	for( i = 0 ; i < count ; i++ ) {
+		sent_list[i] = false;
+		wuring_prep_sendmsg(channel->tx_ring,channel->sock,&hdr_list[i].msg_hdr,i + 1 < count,i);
+	}
+
+	ws = wuring_submit(channel->tx_ring,count);
+	if( ws != WSTATUS_SUCCESS ) {
+		/* the state of the ring is unknown, it isn't used again */
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) submission failed, sending with sendmmsg from now on",channel);
+		wuring_destroy(channel->tx_ring);
+		channel->tx_ring = 0;
+		channel->tx_failed = true;
+		wlock_release(&channel->tx_lock);
+		return 0;
+	}
+
+	for( i = 0 ; i < count ; i++ ) {
+		if( wuring_wait(channel->tx_ring,&cqe) != WSTATUS_SUCCESS )
+			break;
+		if( (cqe.user_data < count) && (cqe.res >= 0) )
+			sent_list[cqe.user_data] = true;
+		else if( cqe.user_data < count )
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) send %u of the batch failed (%s)",
+					channel,(unsigned int)cqe.user_data,strerror(-cqe.res));
+	}
+
+	wlock_release(&channel->tx_lock);
+
+	for( done = 0 ; (done < count) && sent_list[done] ; done++ );
+	return done;
+}
+
+/*
+   _wchannel_dest_equal
+
+   Helper function that tests if two destination strings are the same, the
+   address of consecutive messages of a batch is resolved only once.
+*/
+static bool
+_wchannel_dest_equal(const char *a,const char *b)
+{
+	if( a == b )
+		return true;
+
+	return a && b && !strcmp(a,b);
+}
+
+/*
+   _wchannel_gso_split
+
+   Helper function that sends the messages of a run refused by the kernel
+   as UDP_SEGMENT one at a time, returns how many were sent.
+*/
+static unsigned int
+_wchannel_gso_split(wchannel_t channel,struct msghdr *run)
+{
+	struct mmsghdr hdr_list[WCHANNEL_GSO_MAX];
+	unsigned int i;
+
+	dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) run of %u messages refused, sending them one at a time",
+			channel,(unsigned int)run->msg_iovlen);
+
+	memset(hdr_list,0,run->msg_iovlen * sizeof(struct mmsghdr));
+	for( i = 0 ; i < run->msg_iovlen ; i++ ) {
+		hdr_list[i].msg_hdr.msg_name = run->msg_name;
+		hdr_list[i].msg_hdr.msg_namelen = run->msg_namelen;
+		hdr_list[i].msg_hdr.msg_iov = &run->msg_iov[i];
+		hdr_list[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return _wchannel_udp_sendmmsg(channel,hdr_list,run->msg_iovlen);
+}
+
+/*
+   _wchannel_gso_join
+
+   Helper function that tests if message msg_index of a batch can join the
+   run of UDP_SEGMENT being built in hdr: same destination and size than the
+   first message of the run, after no shorter one, within WCHANNEL_GSO_MAX
+   and WCHANNEL_GSO_BYTES.
+*/
+static bool
+_wchannel_gso_join(wchannel_msg_t *msg_list,unsigned int msg_index,struct msghdr *hdr,unsigned int run_bytes)
+{
+	wchannel_msg_t *msg = &msg_list[msg_index];
+	unsigned int segment = (unsigned int)hdr->msg_iov[0].iov_len;
+
+	if( !segment || !msg->size || (msg->size > segment) )
+		return false;
+
+	if( (hdr->msg_iovlen >= WCHANNEL_GSO_MAX) || (run_bytes + msg->size > WCHANNEL_GSO_BYTES) )
+		return false;
+
+	/* only the last message of a run may be shorter */
+	if( hdr->msg_iov[hdr->msg_iovlen - 1].iov_len != segment )
+		return false;
+
+	return _wchannel_dest_equal(msg->dest,msg_list[msg_index - 1].dest);
+}
+
+/*
+   _wchannel_udp_send_batch
+
+   Helper function that sends the messages of msg_list in groups of
+   WCHANNEL_BATCH_MAX, with the engine of the channel. With gso the runs of
+   messages to the same destination take a single header, a buffer the
+   kernel cuts at the size of its first message (UDP_SEGMENT). A reliable
+   channel sends them one at a time. msg_sent is updated with the number of
+   messages sent before the first failure.
+*/
+static wstatus
+_wchannel_udp_send_batch(wchannel_t channel,wchannel_msg_t *msg_list,unsigned int msg_count,unsigned int *msg_sent)
+{
+	/* control messages of the runs, size_t keeps the cmsghdr aligned */
+	size_t control[WCHANNEL_BATCH_MAX * CMSG_SPACE(sizeof(uint16_t)) / sizeof(size_t)];
+	struct sockaddr_storage addr_list[WCHANNEL_BATCH_MAX];
+	struct mmsghdr hdr_list[WCHANNEL_BATCH_MAX];
+	struct iovec iov_list[WCHANNEL_BATCH_MAX];
+	unsigned int run_bytes[WCHANNEL_BATCH_MAX];
+	struct cmsghdr *cmsg;
+	struct msghdr *hdr;
+	wchannel_msg_t *msg;
+	unsigned int count,hdr_count,h,i,done,sent = 0;
+	uint16_t segment;
+	bool resolve_failed = false;
+	wstatus ws;
+
+	/* each message of a reliable channel takes its place in the window of its peer */
+	if( channel->rel )
+	{
+		ws = WSTATUS_SUCCESS;
+		while( (sent < msg_count) &&
+				((ws = _wchannel_rel_send(channel,msg_list[sent].dest,msg_list[sent].ptr,msg_list[sent].size,0)) == WSTATUS_SUCCESS) )
+			sent++;
+		*msg_sent = sent;
+		return ws;
+	}
+
+	while( (sent < msg_count) && !resolve_failed )
+	{
+		hdr_count = 0;
+		for( count = 0 ; (count < WCHANNEL_BATCH_MAX) && (sent + count < msg_count) ; count++ )
+		{
+			msg = &msg_list[sent + count];
+			iov_list[count].iov_base = msg->ptr;
+			iov_list[count].iov_len = msg->size;
+
+			/* the iovecs of a run are consecutive, the message joins the last header */
+			if( count && channel->gso &&
+					_wchannel_gso_join(msg_list,sent + count,&hdr_list[hdr_count - 1].msg_hdr,run_bytes[hdr_count - 1]) ) {
+				hdr_list[hdr_count - 1].msg_hdr.msg_iovlen++;
+				run_bytes[hdr_count - 1] += msg->size;
+				continue;
+			}
+
+			hdr = &hdr_list[hdr_count].msg_hdr;
+			memset(&hdr_list[hdr_count],0,sizeof(struct mmsghdr));
+
+			if( count && _wchannel_dest_equal(msg->dest,msg_list[sent + count - 1].dest) ) {
+				memcpy(&addr_list[hdr_count],&addr_list[hdr_count - 1],hdr_list[hdr_count - 1].msg_hdr.msg_namelen);
+				hdr->msg_namelen = hdr_list[hdr_count - 1].msg_hdr.msg_namelen;
+			} else {
+				ws = _wchannel_udp_resolve(channel,msg->dest,&addr_list[hdr_count],&hdr->msg_namelen);
+				if( ws != WSTATUS_SUCCESS ) {
+					resolve_failed = true;
+					break;
+				}
+			}
+
+			hdr->msg_name = &addr_list[hdr_count];
+			hdr->msg_iov = &iov_list[count];
+			hdr->msg_iovlen = 1;
+			run_bytes[hdr_count] = msg->size;
+			hdr_count++;
+		}
+
+		if( !count )
+			break;
+
+		/* a run of several messages gives the kernel its segment size */
+		for( h = 0 ; h < hdr_count ; h++ )
+		{
+			hdr = &hdr_list[h].msg_hdr;
+			if( hdr->msg_iovlen < 2 )
+				continue;
+
+			segment = (uint16_t)hdr->msg_iov[0].iov_len;
+			hdr->msg_control = (char*)control + h * CMSG_SPACE(sizeof(uint16_t));
+			hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+			cmsg = CMSG_FIRSTHDR(hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			memcpy(CMSG_DATA(cmsg),&segment,sizeof(uint16_t));
+		}
+
+		for( h = 0 ; h < hdr_count ; )
+		{
+			if( channel->chan_opt.engine == WCHANNEL_ENGINE_URING )
+				done = _wchannel_uring_sendmsg(channel,hdr_list + h,hdr_count - h);
+			else
+				done = _wchannel_udp_sendmmsg(channel,hdr_list + h,hdr_count - h);
+
+			for( i = 0 ; i < done ; i++ )
+				sent += hdr_list[h + i].msg_hdr.msg_iovlen;
+			h += done;
+			if( h == hdr_count )
+				break;
+
+			/* the kernel may refuse a run (segment larger than the MTU of the route) */
+			hdr = &hdr_list[h].msg_hdr;
+			if( hdr->msg_iovlen < 2 )
+				break;
+
+			done = _wchannel_gso_split(channel,hdr);
+			sent += done;
+			if( done < hdr->msg_iovlen )
+				break;
+			h++;
+		}
+
+		if( h < hdr_count )
+			break;
+	}
+
+	*msg_sent = sent;
+	if( sent < msg_count ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) sent %u of %u messages",channel,sent,msg_count);
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   _wchannel_ring_create
+
+   Helper function that creates the capture ring of a new channel, ring_size
+   entries (buffer_size with WCHANNEL_MESSAGE_BUFFER) rounded up to a power
+   of two, each with ring_snaplen bytes of the slab. *ring is 0 if the
+   channel has no ring.
+*/
+static wstatus
+_wchannel_ring_create(wchannel_opt_t *chan_opt,wchannel_ring_t *ring)
+{
+	wchannel_ring_t new_ring;
+	unsigned int entries,snaplen;
+
+	*ring = 0;
+
+	entries = chan_opt->ring_size;
+	if( !entries && (chan_opt->debug_opts == WCHANNEL_MESSAGE_BUFFER) )
+		entries = chan_opt->buffer_size;
+	if( !entries )
+		return WSTATUS_SUCCESS;
+
+	if( entries > WCHANNEL_RING_MAX )
+		entries = WCHANNEL_RING_MAX;
+	while( entries & (entries - 1) )
+		entries += entries & -entries;
+
+	snaplen = chan_opt->ring_snaplen ? chan_opt->ring_snaplen : WCHANNEL_RING_SNAPLEN;
+
+	new_ring = (wchannel_ring_t)malloc(sizeof(struct _wchannel_ring_t));
+	if( !new_ring ) {
+		dbgprint(MOD_WCHANNEL,__func__,"malloc failed (size=%u)",(unsigned int)sizeof(struct _wchannel_ring_t));
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+	memset(new_ring,0,sizeof(struct _wchannel_ring_t));
+	new_ring->entries = entries;
+	new_ring->snaplen = snaplen;
+
+	new_ring->slot_list = (wchannel_slot_t*)calloc(entries,sizeof(wchannel_slot_t));
+	new_ring->slab = (char*)malloc((size_t)entries * snaplen);
+	if( !new_ring->slot_list || !new_ring->slab ) {
+		dbgprint(MOD_WCHANNEL,__func__,"failed to allocate ring of %u entries of %u bytes",entries,snaplen);
+		_wchannel_ring_free(new_ring);
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	dbgprint(MOD_WCHANNEL,__func__,"created capture ring of %u entries of %u bytes",entries,snaplen);
+	*ring = new_ring;
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+}
+
+/*
+   _wchannel_ring_free
+
+   Helper function that frees a capture ring.
+*/
+static void
+_wchannel_ring_free(wchannel_ring_t ring)
+{
+	if( !ring )
+		return;
+
+	if( ring->slot_list )
+		free(ring->slot_list);
+	if( ring->slab )
+		free(ring->slab);
+	free(ring);
+}
+
+/*
+   _wchannel_ring_put
+
+   Helper function that records a message in the capture ring, the oldest
+   one is overwritten. Any number of threads may record at once: each takes
+   the next sequence number and claims its slot, a slot still claimed by a
+   writer that was lapped by the whole ring is not waited for, the message
+   is dropped instead. Only the first snaplen bytes are kept.
+*/
+static void
+_wchannel_ring_put(wchannel_ring_t ring,wcapture_dir_list dir,void *msg_ptr,unsigned int msg_size)
+{
+	wchannel_slot_t *slot;
+	struct timespec ts;
+	uint64_t seq,stamp;
+
+	seq = watomic_add(&ring->head,1) - 1;
+	slot = &ring->slot_list[seq & (ring->entries - 1)];
+
+	stamp = watomic_load_acquire(&slot->stamp);
+	if( (stamp == WCHANNEL_RING_BUSY) || !watomic_cas(&slot->stamp,stamp,WCHANNEL_RING_BUSY) ) {
+		watomic_inc(&ring->dropped);
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+	slot->time_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+	slot->dir = dir;
+	slot->size = msg_size;
+	slot->snap_size = msg_size < ring->snaplen ? msg_size : ring->snaplen;
+	memcpy(ring->slab + (size_t)(seq & (ring->entries - 1)) * ring->snaplen,msg_ptr,slot->snap_size);
+
+	/* published, the readers take it from now on */
+	watomic_store_release(&slot->stamp,seq + 1);
+}
+
+/*
+   wchannel_create
+
+   Channel options are passed in wchannel_opt_t structure, the channel
+   if successful created is returned in channel pointer. This value is
+   only valid if the function returns success.
+
+   There are various types of channels, please refer to the dev guide
+   for more information and examples about these.
+
+   To the client, channel is an opaque pointer to a structure, the
+   definition of the structure is only available in wchannel_X.c this
+   way the client code doesn't have access to the wchannel structure.
+*/
+wstatus
+wchannel_create(wchannel_opt_t *chan_opt,wchannel_t *channel)
+{
+	wstatus ws;
+	wchannel_t new_channel;
+
+	dbgprint(MOD_WCHANNEL,__func__,"called with chan_opt=%p and channel=%p",chan_opt,channel);
+
+	if( !loaded ) {
+		dbgprint(MOD_WCHANNEL,__func__,"module was not loaded yet");
+		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	if( unloading ) {
+		dbgprint(MOD_WCHANNEL,__func__,"cannot call this function when module is unloading");
+		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	/* validate arguments */
+	if( !chan_opt ) {
+		dbgprint(MOD_WCHANNEL,__func__,"missing channel options structure (chan_opt=0)");
+		goto return_fail_early;
+	}
+	
+	if( !channel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"missing channel argument (channel=0)");
+		goto return_fail_early;
+	}
+
+	switch(chan_opt->type)
+	{
+		case WCHANNEL_TYPE_SOCKUDP:
+			dbgprint(MOD_WCHANNEL,__func__,"calling _wchannel_udp_create function");
+			ws = _wchannel_udp_create(chan_opt,&new_channel);
+			dbgprint(MOD_WCHANNEL,__func__,"function has returned ws=%u",ws);
+
+			if( ws != WSTATUS_SUCCESS )
+				goto return_fail_early;
+
+			dbgprint(MOD_WCHANNEL,__func__,"UDP channel created (channel=%p)",new_channel);
+
+			break;
+		case WCHANNEL_TYPE_PIPE:
+			ws = _wchannel_pipe_create(chan_opt,&new_channel);
+			if( ws != WSTATUS_SUCCESS )
+				goto return_fail_early;
+
+			dbgprint(MOD_WCHANNEL,__func__,"PIPE channel created (channel=%p)",new_channel);
+			break;
+		case WCHANNEL_TYPE_SOCKTCP:
+		case WCHANNEL_TYPE_FIFO:
+		default:
+			dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported channel type specified (%d)",
+					chan_opt->type);
+			goto return_fail_early;
+	}
+
+	/* the capture ring, see wchannel_ring_dump */
+	ws = _wchannel_ring_create(chan_opt,&new_channel->ring);
+	if( ws != WSTATUS_SUCCESS )
+		goto return_fail_channel;
+
+	/* setup debugging */
+
+	switch(chan_opt->debug_opts)
+	{
+		case WCHANNEL_DUMP_CALLBACK:
+			if( !chan_opt->dump_cb ) {
+				dbgprint(MOD_WCHANNEL,__func__,
+						"(new_channel=%p) need to fill dump callback function address (proc=0)",
+						new_channel);
+				goto return_fail_channel;
+			}
+
+			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) using dump callback for channel debugging (proc=%p)",
+					new_channel,chan_opt->dump_cb);
+			break;
+		case WCHANNEL_MESSAGE_BUFFER:
+			/* the message buffer is the capture ring */
+			if( !new_channel->ring ) {
+				dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) message buffer needs buffer_size or ring_size",
+						new_channel);
+				goto return_fail_channel;
+			}
+			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) using message buffer for channel debugging (size=%u)",
+					new_channel,new_channel->ring->entries);
+			break;
+		case WCHANNEL_NO_DEBUG:
+			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) debugging disabled in this channel",new_channel);
+			break;
+		default:
+			dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) invalid or unsupported channel debugging options (opt=%d)",
+					new_channel,chan_opt->debug_opts);
+			goto return_fail_channel;
+	}
+
+	dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) updating channel pointer to %p",new_channel,new_channel);
+	*channel = new_channel;
+	dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) updated channel pointer to %p successfully",new_channel,*channel);
+
+	dbgprint(MOD_WCHANNEL,__func__,"(new_channel=%p) returning with success.",new_channel);
+	return WSTATUS_SUCCESS;
+
+return_fail_channel:
+	/* free allocated channel */
+	_wchannel_ring_free(new_channel->ring);
+	_wchannel_rel_close(new_channel);
+	_wchannel_uring_close(new_channel);
+	if( new_channel->wake_fd >= 0 )
+		close(new_channel->wake_fd);
+	wlock_free(&new_channel->tx_lock);
+	if( new_channel->pipe_wr >= 0 )
+		close(new_channel->pipe_wr);
+	close(new_channel->sock);
+	free(new_channel);
+
+return_fail_early:
+	dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
+	return WSTATUS_FAILURE;
+}
+
+/*
+   wchannel_send
+
+   Sends the buffer_size bytes through the channel. The destination
+   string format depends on the channel type:
+SOCKET:
+	dest = [<host>[ <port>]]
+	if <port> is not used, port specified in chan_opt will be used.
+	if <host> and port are not used, the host and port specified in chan_opt will be used.
+PIPE:
+	dest is not used, the message is written to the pipe of the channel.
+FIFO:
+	...
+
+	If buffer_used != 0, an integer will be written on success indicating
+	the number of bytes sent. This doesn't tell anything about bytes reception tho.
+
+Implementation:
+	1) check for arguments
+	2) lookup channel in internal channel list
+	3) validate dest, build sockaddr from dest string
+	4) send buffer
+
+Return Values:
+	WSTATUS_FAILURE message failed to sent, it can be considered that no message was sent.
+	WSTATUS_SEMIFAIL message was sent, but wchannel was unable to store it on message history
+	(check the debugging output for more information on why and where).
+	WSTATUS_SUCCESS when message was sent and was stored on message history (if active) successfully.
+*/
+wstatus
+wchannel_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+{
+	unsigned int bytes_sent = 0;
+	wstatus ws;
+
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, msg_ptr=%p, msg_size=%u, msg_used=%p",
+			channel,msg_ptr,msg_size,msg_used);
+
+	if( !loaded ) {
+		dbgprint(MOD_WCHANNEL,__func__,"module was not loaded yet");
+		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	if( unloading ) {
+		dbgprint(MOD_WCHANNEL,__func__,"cannot call this function when module is unloading");
+		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	if( !channel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"missing channel argument (channel=0)");
+		goto return_fail;
+	}
+
+	/* pipes have a single peer */
+	if( (channel->chan_opt.type != WCHANNEL_TYPE_PIPE) && (!dest || !strlen(dest)) ) {
+		dbgprint(MOD_WCHANNEL,__func__,"missing argument dest (dest=0 or empty dest)");
+		goto return_fail;
+	}
+
+	if( !msg_ptr || !msg_size ) {
+		dbgprint(MOD_WCHANNEL,__func__,"missing message to send or message size is zero");
+		goto return_fail;
+	}
+
+	/* now ready to send */
+
 	switch(channel->chan_opt.type)
 	{
 		case WCHANNEL_TYPE_SOCKUDP:
@@ -757,8 +2197,10 @@ wchannel_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,
 			ws = _wchannel_udp_send(channel,dest,msg_ptr,msg_size,&bytes_sent);
 			dbgprint(MOD_WCHANNEL,__func__,"helper function returned ws=%d",ws);
 			break;
-		case WCHANNEL_TYPE_SOCKTCP:
 		case WCHANNEL_TYPE_PIPE:
+			ws = _wchannel_pipe_send(channel,msg_ptr,msg_size,&bytes_sent);
+			break;
+		case WCHANNEL_TYPE_SOCKTCP:
 		case WCHANNEL_TYPE_FIFO:
 		default:
 			dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported channel type %d "
@@ -766,7 +2208,11 @@ wchannel_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,
 			goto return_fail;
 	}
 
-	/* check helper return value */
+	/* check helper return value, a reliable channel may ask to try again later */
+	if( ws == WSTATUS_AGAIN ) {
+		dbgprint(MOD_WCHANNEL,__func__,"window of the destination is full, returning with again");
+		return WSTATUS_AGAIN;
+	}
 	if( ws != WSTATUS_SUCCESS ) {
 		dbgprint(MOD_WCHANNEL,__func__,"failed to send message");
 		goto return_fail;
@@ -779,23 +2225,76 @@ wchannel_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,
 		dbgprint(MOD_WCHANNEL,__func__,"new msg_used value is %u",*msg_used);
 	}
 
+	/* record the message in the capture log and in the capture ring */
+	if( channel->capture )
+		wcapture_write(channel->capture,WCAPTURE_DIR_OUT,channel->capture_id,msg_ptr,bytes_sent);
+	if( channel->ring )
+		_wchannel_ring_put(channel->ring,WCAPTURE_DIR_OUT,msg_ptr,bytes_sent);
+
 	/* handle the message history */
 	switch(channel->chan_opt.debug_opts)
 	{
 		case WCHANNEL_MESSAGE_BUFFER:
-		
-			/* insert message in message history of the channel */
-			dbgprint(MOD_WCHANNEL,__func__,"calling helper function msgbuf_insert with msgbuf=%p msgptr=%p msgsize=%u",
-					&channel->message_buffer,msg_ptr,msg_size);
-
-			ws = _msgbuf_insert(&channel->message_buffer,msg_ptr,msg_size);
+			/* recorded in the capture ring */
+			break;
 
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_WCHANNEL,__func__,"msgbuf_insert failed (ws=%d)",ws);
+		case WCHANNEL_DUMP_CALLBACK:
+			
+			/* call the user defined callback function */
+			if( !channel->chan_opt.dump_cb ) {
+				dbgprint(MOD_WCHANNEL,__func__,"debug opts = dump_cb but dump_cb=0");
 				goto return_semifail;
 			}
 
-			dbgprint(MOD_WCHANNEL,__func__,"added message to message history successfully");
+			dbgprint(MOD_WCHANNEL,__func__,"calling dump_cb=%p with dest=%s, msg_ptr=%p, msg_size=%u and msg_used=%u",
+					channel->chan_opt.dump_cb,dest,msg_ptr,msg_size,bytes_sent);
+
+			channel->chan_opt.dump_cb(dest,msg_ptr,msg_size,bytes_sent);
+
+			dbgprint(MOD_WCHANNEL,__func__,"dump_cb returned successfully");
+			break;
+
+		case WCHANNEL_NO_DEBUG:
+			dbgprint(MOD_WCHANNEL,__func__,"channel has debug off");
+			break;
+		default:
+			dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported debug option %d"
+					" (check your channel pointer!)",channel->chan_opt.debug_opts);
+			goto return_semifail;
+	}
+
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+
+return_semifail:
+	dbgprint(MOD_WCHANNEL,__func__,"returning semifail.");
+	return WSTATUS_SEMIFAIL;
+
+return_fail:
+	DBGRET_FAILURE(MOD_WCHANNEL);
+}
+
+/*
+   _wchannel_trace_in
+
+   Helper function that records a received message in the capture log, in
+   the capture ring and in the debugging of the channel. Returns
+   WSTATUS_SEMIFAIL if the message couldn't be recorded. The ring keeps a
+   copy, so lent messages (wchannel_receive_zc) are recorded like the others.
+*/
+static wstatus
+_wchannel_trace_in(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int msg_used)
+{
+	/* record the message in the capture log and in the capture ring */
+	if( channel->capture )
+		wcapture_write(channel->capture,WCAPTURE_DIR_IN,channel->capture_id,msg_ptr,msg_used);
+	if( channel->ring )
+		_wchannel_ring_put(channel->ring,WCAPTURE_DIR_IN,msg_ptr,msg_used);
+
+	/* handle the message history */
+	switch(channel->chan_opt.debug_opts)
+	{
+		case WCHANNEL_MESSAGE_BUFFER:
+			/* recorded in the capture ring */
 			break;
 
 		case WCHANNEL_DUMP_CALLBACK:
@@ -803,150 +2302,442 @@ wchannel_send(wchannel_t channel,char *dest,void *msg_ptr,unsigned int msg_size,
 			/* call the user defined callback function */
 			if( !channel->chan_opt.dump_cb ) {
 				dbgprint(MOD_WCHANNEL,__func__,"debug opts = dump_cb but dump_cb=0");
-				goto return_semifail;
+				return WSTATUS_SEMIFAIL;
 			}
 
-			dbgprint(MOD_WCHANNEL,__func__,"calling dump_cb=%p with dest=%s, msg_ptr=%p, msg_size=%u and msg_used=%u",
-					channel->chan_opt.dump_cb,dest,msg_ptr,msg_size,bytes_sent);
+			dbgprint(MOD_WCHANNEL,__func__,"calling dump_cb=%p with dest=NULL, msg_ptr=%p, msg_size=%u and msg_used=%u",
+					channel->chan_opt.dump_cb,msg_ptr,msg_size,msg_used);
+
+			channel->chan_opt.dump_cb(0,msg_ptr,msg_size,msg_used);
+
+			dbgprint(MOD_WCHANNEL,__func__,"dump_cb returned successfully");
+			break;
+
+		case WCHANNEL_NO_DEBUG:
+			dbgprint(MOD_WCHANNEL,__func__,"channel has debug off");
+			break;
+		default:
+			dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported debug option %d"
+					" (check your channel pointer!)",channel->chan_opt.debug_opts);
+			return WSTATUS_SEMIFAIL;
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+wstatus
+wchannel_receive(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+{
+	wstatus ws;
+	unsigned int bytes_sent;
+
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, msg_ptr=%p, msg_size=%u, msg_used=%p",
+			channel,msg_ptr,msg_size,msg_used);
+
+	if( !loaded ) {
+		dbgprint(MOD_WCHANNEL,__func__,"module was not loaded yet");
+		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	if( unloading ) {
+		dbgprint(MOD_WCHANNEL,__func__,"cannot call this function when module is unloading");
+		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	if( !channel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"missing channel argument (channel=0)");
+		goto return_fail;
+	}
+
+	if( !msg_ptr || !msg_size ) {
+		dbgprint(MOD_WCHANNEL,__func__,"missing message to send or message size is zero");
+		goto return_fail;
+	}
+
+	/* now ready to send */
+
+	switch(channel->chan_opt.type)
+	{
+		case WCHANNEL_TYPE_SOCKUDP:
+			dbgprint(MOD_WCHANNEL,__func__,"calling helper function wchannel_udp_recv");
+			ws = _wchannel_udp_recv(channel,msg_ptr,msg_size,&bytes_sent);
+			dbgprint(MOD_WCHANNEL,__func__,"helper function returned ws=%d",ws);
+			break;
+		case WCHANNEL_TYPE_PIPE:
+			ws = _wchannel_pipe_recv(channel,msg_ptr,msg_size,&bytes_sent);
+			break;
+		case WCHANNEL_TYPE_SOCKTCP:
+		case WCHANNEL_TYPE_FIFO:
+		default:
+			dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported channel type %d "
+					"(check your channel pointer!)",channel->chan_opt.type);
+			goto return_fail;
+	}
+
+	/* check helper return value */
+	if( ws != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WCHANNEL,__func__,"failed to receive message");
+		goto return_fail;
+	}
+
+	/* update msg_used if its not null */
+	if( msg_used ) {
+		dbgprint(MOD_WCHANNEL,__func__,"updating msg_used argument with %u",bytes_sent);
+		*msg_used = bytes_sent;
+		dbgprint(MOD_WCHANNEL,__func__,"new msg_used value is %u",*msg_used);
+	}
+
+	ws = _wchannel_trace_in(channel,msg_ptr,msg_size,bytes_sent);
+	if( ws != WSTATUS_SUCCESS )
+		goto return_semifail;
+
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+
+return_semifail:
+	dbgprint(MOD_WCHANNEL,__func__,"returning semifail.");
+	return WSTATUS_SEMIFAIL;
+
+return_fail:
+	DBGRET_FAILURE(MOD_WCHANNEL);
+}
+
+/*
+   wchannel_receive_zc
+
+   Receives a message like wchannel_receive but instead of copying it, lends
+   the buffer holding it: msg_ptr and msg_used are updated with the message
+   and msg_id identifies the buffer, it must be given back with
+   wchannel_receive_done (see wchannel.h). The classic engine receives in a
+   buffer of the channel, there's a single one (the gro buffer with gro).
+*/
+wstatus
+wchannel_receive_zc(wchannel_t channel,void **msg_ptr,unsigned int *msg_used,unsigned int *msg_id)
+{
+	void *zc_ptr;
+	unsigned int zc_used,zc_id = 0;
+	wstatus ws;
+
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, msg_ptr=%p, msg_used=%p, msg_id=%p",
+			channel,msg_ptr,msg_used,msg_id);
+
+	if( !loaded || unloading ) {
+		dbgprint(MOD_WCHANNEL,__func__,"module is not loaded or is unloading");
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	if( !channel || !msg_ptr || !msg_used || !msg_id ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( (channel->chan_opt.type != WCHANNEL_TYPE_SOCKUDP) && (channel->chan_opt.type != WCHANNEL_TYPE_PIPE) ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported channel type %d",channel->chan_opt.type);
+		goto return_fail;
+	}
 
-			channel->chan_opt.dump_cb(dest,msg_ptr,msg_size,bytes_sent);
+	if( channel->rel )
+	{
+		/* lent by wrel, it's kept until the next receive */
+		ws = _wchannel_rel_recv(channel,&zc_ptr,&zc_used);
+		if( ws != WSTATUS_SUCCESS )
+			goto return_fail;
+		goto received;
+	}
 
-			dbgprint(MOD_WCHANNEL,__func__,"dump_cb returned successfully");
-			break;
+	if( channel->engine == WCHANNEL_ENGINE_URING )
+	{
+		ws = _wchannel_uring_recv(channel,&zc_ptr,&zc_used,&zc_id);
+		if( ws == WSTATUS_SUCCESS )
+			goto received;
+		if( ws != WSTATUS_UNIMPLEMENTED )
+			goto return_fail;
+		/* the channel fell back to the classic engine */
+	}
 
-		case WCHANNEL_NO_DEBUG:
-			dbgprint(MOD_WCHANNEL,__func__,"channel has debug off");
-			break;
-		default:
-			dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported debug option %d"
-					" (check your channel pointer!)",channel->chan_opt.debug_opts);
-			goto return_semifail;
+	if( channel->gro )
+	{
+		/* lent from gro_buffer, it's kept until the next receive */
+		ws = _wchannel_gro_recv(channel,&zc_ptr,&zc_used);
+		if( ws != WSTATUS_SUCCESS )
+			goto return_fail;
+		goto received;
 	}
 
-	DBGRET_SUCCESS(MOD_WCHANNEL);
+	if( !channel->zc_buffer ) {
+		channel->zc_buffer = malloc(WCHANNEL_ZC_SIZE);
+		if( !channel->zc_buffer ) {
+			dbgprint(MOD_WCHANNEL,__func__,"malloc failed (size=%u)",WCHANNEL_ZC_SIZE);
+			goto return_fail;
+		}
+	}
 
-return_semifail:
-	dbgprint(MOD_WCHANNEL,__func__,"returning semifail.");
-	return WSTATUS_SEMIFAIL;
+	if( channel->chan_opt.type == WCHANNEL_TYPE_PIPE )
+		ws = _wchannel_pipe_recv(channel,channel->zc_buffer,WCHANNEL_ZC_SIZE,&zc_used);
+	else
+		ws = _wchannel_udp_recv(channel,channel->zc_buffer,WCHANNEL_ZC_SIZE,&zc_used);
+	if( ws != WSTATUS_SUCCESS )
+		goto return_fail;
+	zc_ptr = channel->zc_buffer;
+
+received:
+	*msg_ptr = zc_ptr;
+	*msg_used = zc_used;
+	*msg_id = zc_id;
+
+	/* a trace failure doesn't lose the message, the caller must give it back */
+	_wchannel_trace_in(channel,zc_ptr,zc_used,zc_used);
+	DBGRET_SUCCESS(MOD_WCHANNEL);
 
 return_fail:
+	dbgprint(MOD_WCHANNEL,__func__,"failed to receive message");
 	DBGRET_FAILURE(MOD_WCHANNEL);
 }
 
+/*
+   wchannel_receive_done
+
+   Gives back the buffer lent by wchannel_receive_zc, msg_ptr must not be
+   used after this.
+*/
+wstatus
+wchannel_receive_done(wchannel_t channel,unsigned int msg_id)
+{
+	if( !channel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid channel argument (channel=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( channel->engine == WCHANNEL_ENGINE_URING )
+		return _wchannel_uring_done(channel,msg_id);
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wchannel_send_batch
+
+   Sends msg_count messages of msg_list, each to its own destination (the
+   dest string of wchannel_send). The URING engine submits them to the
+   kernel with a single syscall, the classic engine uses sendmmsg. The
+   messages are sent in order and the batch stops at the first failure,
+   msg_sent (if not 0) is updated with the number of messages sent.
+   Messages sent in a batch are recorded in the capture ring like the others.
+*/
 wstatus
-wchannel_receive(wchannel_t channel,void *msg_ptr,unsigned int msg_size,unsigned int *msg_used)
+wchannel_send_batch(wchannel_t channel,wchannel_msg_t *msg_list,unsigned int msg_count,unsigned int *msg_sent)
 {
+	unsigned int i,sent = 0;
 	wstatus ws;
-	unsigned int bytes_sent;
 
-	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, msg_ptr=%p, msg_size=%u, msg_used=%p",
-			channel,msg_ptr,msg_size,msg_used);
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, msg_list=%p, msg_count=%u, msg_sent=%p",
+			channel,msg_list,msg_count,msg_sent);
 
-	if( !loaded ) {
-		dbgprint(MOD_WCHANNEL,__func__,"module was not loaded yet");
-		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
-		return WSTATUS_FAILURE;
+	if( !loaded || unloading ) {
+		dbgprint(MOD_WCHANNEL,__func__,"module is not loaded or is unloading");
+		DBGRET_FAILURE(MOD_WCHANNEL);
 	}
 
-	if( unloading ) {
-		dbgprint(MOD_WCHANNEL,__func__,"cannot call this function when module is unloading");
-		dbgprint(MOD_WCHANNEL,__func__,"returning with failure.");
-		return WSTATUS_FAILURE;
+	if( !channel || !msg_list || !msg_count ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
 	}
 
-	if( !channel ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing channel argument (channel=0)");
-		goto return_fail;
+	for( i = 0 ; i < msg_count ; i++ ) {
+		if( !msg_list[i].ptr || !msg_list[i].size ) {
+			dbgprint(MOD_WCHANNEL,__func__,"message %u is empty",i);
+			return WSTATUS_INVALID_ARGUMENT;
+		}
 	}
 
-	if( !msg_ptr || !msg_size ) {
-		dbgprint(MOD_WCHANNEL,__func__,"missing message to send or message size is zero");
-		goto return_fail;
+	if( channel->chan_opt.type != WCHANNEL_TYPE_SOCKUDP ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported channel type %d",channel->chan_opt.type);
+		DBGRET_FAILURE(MOD_WCHANNEL);
 	}
 
-	/* now ready to send */
+	ws = _wchannel_udp_send_batch(channel,msg_list,msg_count,&sent);
 
-	switch(channel->chan_opt.type)
+	for( i = 0 ; i < sent ; i++ )
 	{
-		case WCHANNEL_TYPE_SOCKUDP:
-			dbgprint(MOD_WCHANNEL,__func__,"calling helper function wchannel_udp_recv");
-			ws = _wchannel_udp_recv(channel,msg_ptr,msg_size,&bytes_sent);
-			dbgprint(MOD_WCHANNEL,__func__,"helper function returned ws=%d",ws);
-			break;
-		case WCHANNEL_TYPE_SOCKTCP:
-		case WCHANNEL_TYPE_PIPE:
-		case WCHANNEL_TYPE_FIFO:
-		default:
-			dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported channel type %d "
-					"(check your channel pointer!)",channel->chan_opt.type);
-			goto return_fail;
+		if( channel->capture )
+			wcapture_write(channel->capture,WCAPTURE_DIR_OUT,channel->capture_id,msg_list[i].ptr,msg_list[i].size);
+		if( channel->ring )
+			_wchannel_ring_put(channel->ring,WCAPTURE_DIR_OUT,msg_list[i].ptr,msg_list[i].size);
+
+		if( (channel->chan_opt.debug_opts == WCHANNEL_DUMP_CALLBACK) && channel->chan_opt.dump_cb )
+			channel->chan_opt.dump_cb(msg_list[i].dest,msg_list[i].ptr,msg_list[i].size,msg_list[i].size);
 	}
 
-	/* check helper return value */
+	if( msg_sent )
+		*msg_sent = sent;
+
+	if( ws == WSTATUS_AGAIN )
+		return WSTATUS_AGAIN;
 	if( ws != WSTATUS_SUCCESS ) {
-		dbgprint(MOD_WCHANNEL,__func__,"failed to receive message");
-		goto return_fail;
+		DBGRET_FAILURE(MOD_WCHANNEL);
 	}
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+}
 
-	/* update msg_used if its not null */
-	if( msg_used ) {
-		dbgprint(MOD_WCHANNEL,__func__,"updating msg_used argument with %u",bytes_sent);
-		*msg_used = bytes_sent;
-		dbgprint(MOD_WCHANNEL,__func__,"new msg_used value is %u",*msg_used);
+/*
+   wchannel_engine
+
+   Returns the engine used by the channel to receive, a channel created
+   with the URING engine may have fallen back to the classic one.
+*/
+wchannel_engine_list
+wchannel_engine(wchannel_t channel)
+{
+	if( !channel )
+		return WCHANNEL_ENGINE_CLASSIC;
+
+	return channel->engine;
+}
+
+/*
+   wchannel_fd
+
+   Returns the descriptor that polls readable when the channel has something
+   to receive (see wloop.h): the socket or the read end of the pipe, or the
+   descriptor of the receive ring with the URING engine. Returns -1 if the
+   channel is invalid. The descriptor must only be polled, never read.
+*/
+int
+wchannel_fd(wchannel_t channel)
+{
+	int fd;
+
+	if( !channel )
+		return -1;
+
+	if( channel->rel )
+		return channel->rel_fd;
+
+	if( channel->engine == WCHANNEL_ENGINE_URING ) {
+		fd = wuring_fd(channel->rx_ring);
+		if( fd >= 0 )
+			return fd;
 	}
 
-	/* handle the message history */
-	switch(channel->chan_opt.debug_opts)
-	{
-		case WCHANNEL_MESSAGE_BUFFER:
-		
-			/* insert message in message history of the channel */
-			dbgprint(MOD_WCHANNEL,__func__,"calling helper function msgbuf_insert with msgbuf=%p msgptr=%p msgsize=%u",
-					&channel->message_buffer,msg_ptr,msg_size);
+	return channel->sock;
+}
 
-			ws = _msgbuf_insert(&channel->message_buffer,msg_ptr,msg_size);
+/*
+   wchannel_pending
 
-			if( ws != WSTATUS_SUCCESS ) {
-				dbgprint(MOD_WCHANNEL,__func__,"msgbuf_insert failed (ws=%d)",ws);
-				goto return_semifail;
-			}
+   Returns true if the next receive returns a datagram already received by
+   the channel (gro), without reading the socket: wchannel_fd doesn't poll
+   readable for it.
+*/
+bool
+wchannel_pending(wchannel_t channel)
+{
+	if( !channel )
+		return false;
 
-			dbgprint(MOD_WCHANNEL,__func__,"added message to message history successfully");
-			break;
+	return channel->gro && (channel->gro_pos < channel->gro_used);
+}
 
-		case WCHANNEL_DUMP_CALLBACK:
-			
-			/* call the user defined callback function */
-			if( !channel->chan_opt.dump_cb ) {
-				dbgprint(MOD_WCHANNEL,__func__,"debug opts = dump_cb but dump_cb=0");
-				goto return_semifail;
-			}
+/*
+   wchannel_offload
 
-			dbgprint(MOD_WCHANNEL,__func__,"calling dump_cb=%p with dest=NULL, msg_ptr=%p, msg_size=%u and msg_used=%u",
-					channel->chan_opt.dump_cb,msg_ptr,msg_size,bytes_sent);
+   Returns the segmentation offloads in use by the channel (WCHANNEL_OFFLOAD_*),
+   those asked by its options and accepted by the kernel.
+*/
+unsigned int
+wchannel_offload(wchannel_t channel)
+{
+	unsigned int offload = 0;
 
-			channel->chan_opt.dump_cb(0,msg_ptr,msg_size,bytes_sent);
+	if( !channel )
+		return 0;
 
-			dbgprint(MOD_WCHANNEL,__func__,"dump_cb returned successfully");
-			break;
+	if( channel->gso )
+		offload |= WCHANNEL_OFFLOAD_GSO;
+	if( channel->gro )
+		offload |= WCHANNEL_OFFLOAD_GRO;
+	return offload;
+}
 
-		case WCHANNEL_NO_DEBUG:
-			dbgprint(MOD_WCHANNEL,__func__,"channel has debug off");
-			break;
-		default:
-			dbgprint(MOD_WCHANNEL,__func__,"invalid or unsupported debug option %d"
-					" (check your channel pointer!)",channel->chan_opt.debug_opts);
-			goto return_semifail;
+/*
+   wchannel_reliable_status
+
+   Fills list with the state of the reliable layer for up to list_size peers
+   of the channel (see wrel_status), count is set to the number returned.
+   Fails if the channel wasn't created with reliable.
+*/
+wstatus
+wchannel_reliable_status(wchannel_t channel,wrel_status_t *list,unsigned int list_size,unsigned int *count)
+{
+	if( !channel || !list || !count ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
 	}
 
-	DBGRET_SUCCESS(MOD_WCHANNEL);
+	if( !channel->rel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) channel is not reliable",channel);
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
 
-return_semifail:
-	dbgprint(MOD_WCHANNEL,__func__,"returning semifail.");
-	return WSTATUS_SEMIFAIL;
+	return wrel_status(channel->rel,list,list_size,count);
+}
 
-return_fail:
-	DBGRET_FAILURE(MOD_WCHANNEL);
+/*
+   wchannel_reliable_wait
+
+   Waits up to timeout_us for a window of a reliable channel to open, the
+   senders that got WSTATUS_AGAIN may try again. gen is the count of the
+   windows opened seen by the caller and is updated: if a window opened
+   since, it returns right away. Read it with a timeout of 0 before trying
+   the sends so a window opened meanwhile isn't missed.
+*/
+wstatus
+wchannel_reliable_wait(wchannel_t channel,unsigned long *gen,unsigned int timeout_us)
+{
+	if( !channel || !gen ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( !channel->rel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) channel is not reliable",channel);
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	wlock_acquire(&channel->rel_lock);
+	if( timeout_us && (*gen == channel->rel_gen) && !channel->closing )
+		wcond_timedwait(&channel->rel_cond,&channel->rel_lock,timeout_us);
+	*gen = channel->rel_gen;
+	wlock_release(&channel->rel_lock);
+
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wchannel_mcast_join
+
+   The channel receives the datagrams sent to the multicast group (numeric
+   address of the family of the channel) on its port. ifname is the
+   interface of the group, 0 uses the mcast_if option or lets the routing
+   table choose.
+*/
+wstatus
+wchannel_mcast_join(wchannel_t channel,const char *group,const char *ifname)
+{
+	return _wchannel_mcast_member(channel,group,ifname,true);
+}
+
+/*
+   wchannel_mcast_leave
+
+   The channel leaves a group joined with wchannel_mcast_join, closing the
+   channel leaves all of them.
+*/
+wstatus
+wchannel_mcast_leave(wchannel_t channel,const char *group,const char *ifname)
+{
+	return _wchannel_mcast_member(channel,group,ifname,false);
 }
 
 /*
@@ -992,6 +2783,194 @@ return_fail:
 	return WSTATUS_FAILURE;
 }
 
+/*
+   wchannel_shutdown
+
+   Shuts down the socket of the channel, a thread blocked in wchannel_receive
+   returns failure (and so does every receive from then on). The channel must
+   still be destroyed with wchannel_destroy. A receiver of the URING engine
+   is woken through its eventfd. The write end of a PIPE channel is closed,
+   its sends fail from then on.
+*/
+wstatus
+wchannel_shutdown(wchannel_t channel)
+{
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p",channel);
+
+	if( !channel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid channel argument (channel=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	switch(channel->chan_opt.type)
+	{
+		case WCHANNEL_TYPE_SOCKUDP:
+			/* the URING engine receiver waits for the ring, not for the socket,
+			   it's woken by the eventfd read armed in the ring */
+			channel->closing = true;
+			if( channel->wake_fd >= 0 ) {
+				uint64_t one = 1;
+				if( write(channel->wake_fd,&one,sizeof(one)) < 0 )
+					dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to write to wake eventfd (%s)",
+							channel,strerror(errno));
+			}
+
+			/* the receiver of a reliable channel waits for rel_fd, the senders for a window */
+			if( channel->rel ) {
+				uint64_t one = 1;
+				if( write(channel->rel_fd,&one,sizeof(one)) < 0 )
+					dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) failed to write to rel eventfd (%s)",
+							channel,strerror(errno));
+				wlock_acquire(&channel->rel_lock);
+				wcond_broadcast(&channel->rel_cond);
+				wlock_release(&channel->rel_lock);
+			}
+
+			/* unconnected sockets report ENOTCONN but the receivers are woken anyway */
+			if( (shutdown(channel->sock,SHUT_RDWR) < 0) && (errno != ENOTCONN) ) {
+				dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) shutdown failed (%s)",channel,strerror(errno));
+				DBGRET_FAILURE(MOD_WCHANNEL);
+			}
+			break;
+
+		case WCHANNEL_TYPE_PIPE:
+			/* closing the write end, the reader gets end of file */
+			channel->closing = true;
+			wlock_acquire(&channel->tx_lock);
+			if( channel->pipe_wr >= 0 ) {
+				close(channel->pipe_wr);
+				channel->pipe_wr = -1;
+			}
+			wlock_release(&channel->tx_lock);
+			break;
+
+		default:
+			dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) channel type %d not supported",
+					channel,channel->chan_opt.type);
+			return WSTATUS_UNIMPLEMENTED;
+	}
+
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+}
+
+/*
+   wchannel_ring_dump
+
+   Calls ring_cb for each message in the capture ring of the channel, from
+   the oldest to the newest, while the channel is being used. Each message
+   is copied out of the ring and checked after the copy, messages that are
+   overwritten meanwhile are skipped. The msg pointer is only valid during
+   the call. Fails if the channel has no ring.
+*/
+wstatus
+wchannel_ring_dump(wchannel_t channel,WCHANNELRINGCB ring_cb,void *param)
+{
+	wchannel_ring_t ring;
+	wchannel_slot_t *slot;
+	wchannel_ring_msg_t msg;
+	uint64_t head,seq,stamp;
+	char *snap;
+
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, ring_cb=%p, param=%p",channel,ring_cb,param);
+
+	if( !channel || !ring_cb ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	ring = channel->ring;
+	if( !ring ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) channel has no capture ring",channel);
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	snap = (char*)malloc(ring->snaplen);
+	if( !snap ) {
+		dbgprint(MOD_WCHANNEL,__func__,"malloc failed (size=%u)",ring->snaplen);
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	head = watomic_load_acquire(&ring->head);
+	seq = head > ring->entries ? head - ring->entries : 0;
+
+	for( ; seq < head ; seq++ )
+	{
+		slot = &ring->slot_list[seq & (ring->entries - 1)];
+
+		stamp = watomic_load_acquire(&slot->stamp);
+		if( stamp != seq + 1 )
+			continue;
+
+		msg.seq = seq;
+		msg.time_ns = slot->time_ns;
+		msg.dir = slot->dir;
+		msg.size = slot->size;
+		msg.snap_size = slot->snap_size;
+		if( msg.snap_size > ring->snaplen )
+			continue;
+		memcpy(snap,ring->slab + (size_t)(seq & (ring->entries - 1)) * ring->snaplen,msg.snap_size);
+		msg.ptr = snap;
+
+		/* the copy is only good if no writer claimed the slot meanwhile */
+		watomic_barrier();
+		if( slot->stamp != stamp )
+			continue;
+
+		ring_cb(param,&msg);
+	}
+
+	free(snap);
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+}
+
+/*
+   wchannel_ring_status
+
+   Fills status with the configuration and the counters of the capture ring
+   of the channel, fails if it has none.
+*/
+wstatus
+wchannel_ring_status(wchannel_t channel,wchannel_ring_status_t *status)
+{
+	if( !channel || !status ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid arguments (channel=%p, status=%p)",channel,status);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( !channel->ring ) {
+		dbgprint(MOD_WCHANNEL,__func__,"(channel=%p) channel has no capture ring",channel);
+		DBGRET_FAILURE(MOD_WCHANNEL);
+	}
+
+	status->entries = channel->ring->entries;
+	status->snaplen = channel->ring->snaplen;
+	status->recorded = watomic_load_acquire(&channel->ring->head);
+	status->dropped = watomic_get(&channel->ring->dropped);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wchannel_capture
+
+   Attaches a capture log to the channel, every message sent or received
+   successfully is appended to it with channel_id. Pass cap=0 to detach.
+   This must not be called while other threads are using the channel.
+*/
+wstatus
+wchannel_capture(wchannel_t channel,wcapture_t cap,uint16_t channel_id)
+{
+	dbgprint(MOD_WCHANNEL,__func__,"called with channel=%p, cap=%p, channel_id=%u",channel,cap,channel_id);
+
+	if( !channel ) {
+		dbgprint(MOD_WCHANNEL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	channel->capture = cap;
+	channel->capture_id = channel_id;
+	DBGRET_SUCCESS(MOD_WCHANNEL);
+}
+
 /*
    wchannel_load
 
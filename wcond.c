@@ -0,0 +1,213 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "wcond.h"
+
+#if (defined POSH_OS_LINUX || defined POSH_OS_OSX)
+#include <time.h>
+#endif
+
+wstatus
+wcond_create(wcond_t *cond)
+{
+	dbgprint(MOD_WLOCK,__func__,"called with cond=%p",(void*)cond);
+
+	if( cond == 0 ) {
+		dbgprint(MOD_WLOCK,__func__,"Invalid wcond_t pointer specified (cond=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+#if LOCK_API == 1
+	int status;
+	status = pthread_cond_init(cond,NULL);
+	if( status ) {
+		dbgprint(MOD_WLOCK,__func__,"Unable to initialize condition variable (0x%X)",status);
+		dbgprint(MOD_WLOCK,__func__,"Returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	dbgprint(MOD_WLOCK,__func__,"Returning with success.");
+	return WSTATUS_SUCCESS;
+#else
+	dbgprint(MOD_WLOCK,__func__,"This function is unimplemented.");
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+wstatus
+wcond_free(wcond_t *cond)
+{
+	dbgprint(MOD_WLOCK,__func__,"called with cond=%p",(void*)cond);
+
+	if( cond == 0 ) {
+		dbgprint(MOD_WLOCK,__func__,"Invalid wcond_t pointer specified (cond=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+#if LOCK_API == 1
+	int status;
+	status = pthread_cond_destroy(cond);
+	if( status ) {
+		/* EBUSY: some thread is still waiting on it */
+		dbgprint(MOD_WLOCK,__func__,"Unable to destroy condition variable (0x%X)",status);
+		dbgprint(MOD_WLOCK,__func__,"Returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	dbgprint(MOD_WLOCK,__func__,"Returning with success.");
+	return WSTATUS_SUCCESS;
+#else
+	dbgprint(MOD_WLOCK,__func__,"This function is unimplemented.");
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wcond_wait
+
+   Waits until the condition is signaled, lock must be acquired by the caller.
+   Spurious wakeups may happen, the caller must test its condition in a loop.
+*/
+wstatus
+wcond_wait(wcond_t *cond,wlock_t *lock)
+{
+	dbgprint(MOD_WLOCK,__func__,"called with cond=%p, lock=%p",(void*)cond,(void*)lock);
+
+	if( !cond || !lock ) {
+		dbgprint(MOD_WLOCK,__func__,"Invalid arguments (cond=0 or lock=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+#if LOCK_API == 1
+	int status;
+	status = pthread_cond_wait(cond,lock);
+	if( status ) {
+		dbgprint(MOD_WLOCK,__func__,"Unable to wait on condition variable (0x%X)",status);
+		dbgprint(MOD_WLOCK,__func__,"Returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	dbgprint(MOD_WLOCK,__func__,"Returning with success.");
+	return WSTATUS_SUCCESS;
+#else
+	dbgprint(MOD_WLOCK,__func__,"This function is unimplemented.");
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wcond_timedwait
+
+   Like wcond_wait but gives up after timeout_us microseconds, it returns
+   success either way (the caller tests its condition and its deadline in a
+   loop, like with the spurious wakeups).
+*/
+wstatus
+wcond_timedwait(wcond_t *cond,wlock_t *lock,unsigned int timeout_us)
+{
+	dbgprint(MOD_WLOCK,__func__,"called with cond=%p, lock=%p, timeout_us=%u",(void*)cond,(void*)lock,timeout_us);
+
+	if( !cond || !lock ) {
+		dbgprint(MOD_WLOCK,__func__,"Invalid arguments (cond=0 or lock=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+#if LOCK_API == 1
+	struct timespec ts;
+	int status;
+
+	/* pthread condition variables wait on the realtime clock by default */
+	clock_gettime(CLOCK_REALTIME,&ts);
+	ts.tv_sec += timeout_us / 1000000;
+	ts.tv_nsec += (long)(timeout_us % 1000000) * 1000;
+	if( ts.tv_nsec >= 1000000000L ) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	status = pthread_cond_timedwait(cond,lock,&ts);
+	if( status && (status != ETIMEDOUT) ) {
+		dbgprint(MOD_WLOCK,__func__,"Unable to wait on condition variable (0x%X)",status);
+		dbgprint(MOD_WLOCK,__func__,"Returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	dbgprint(MOD_WLOCK,__func__,"Returning with success.");
+	return WSTATUS_SUCCESS;
+#else
+	dbgprint(MOD_WLOCK,__func__,"This function is unimplemented.");
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+wstatus
+wcond_signal(wcond_t *cond)
+{
+	dbgprint(MOD_WLOCK,__func__,"called with cond=%p",(void*)cond);
+
+	if( cond == 0 ) {
+		dbgprint(MOD_WLOCK,__func__,"Invalid wcond_t pointer specified (cond=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+#if LOCK_API == 1
+	if( pthread_cond_signal(cond) ) {
+		dbgprint(MOD_WLOCK,__func__,"Returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	dbgprint(MOD_WLOCK,__func__,"Returning with success.");
+	return WSTATUS_SUCCESS;
+#else
+	dbgprint(MOD_WLOCK,__func__,"This function is unimplemented.");
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+wstatus
+wcond_broadcast(wcond_t *cond)
+{
+	dbgprint(MOD_WLOCK,__func__,"called with cond=%p",(void*)cond);
+
+	if( cond == 0 ) {
+		dbgprint(MOD_WLOCK,__func__,"Invalid wcond_t pointer specified (cond=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+#if LOCK_API == 1
+	if( pthread_cond_broadcast(cond) ) {
+		dbgprint(MOD_WLOCK,__func__,"Returning with failure.");
+		return WSTATUS_FAILURE;
+	}
+
+	dbgprint(MOD_WLOCK,__func__,"Returning with success.");
+	return WSTATUS_SUCCESS;
+#else
+	dbgprint(MOD_WLOCK,__func__,"This function is unimplemented.");
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
@@ -0,0 +1,55 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Condition variable, used together with a wlock_t by threads that have to
+   wait until some state changes (a queue gets an entry, a flag is set...)
+   without spinning. The client can:
+   - create and free condition variables
+   - wait on a condition (the lock must be acquired, it's released while
+     waiting and acquired again before returning), with or without timeout
+   - signal one waiter or broadcast to all the waiters
+
+   Like wlock this is a thin layer over the native primitives of the OS.
+*/
+
+#ifndef _WCOND_H
+#define _WCOND_H
+
+#include "posh.h"
+#include "wstatus.h"
+#include "wlock.h"
+
+#if LOCK_API == 1
+typedef pthread_cond_t wcond_t;
+#elif LOCK_API == 2
+typedef HANDLE wcond_t;
+#endif
+
+wstatus wcond_create(wcond_t *cond);
+wstatus wcond_free(wcond_t *cond);
+wstatus wcond_wait(wcond_t *cond,wlock_t *lock);
+wstatus wcond_timedwait(wcond_t *cond,wlock_t *lock,unsigned int timeout_us);
+wstatus wcond_signal(wcond_t *cond);
+wstatus wcond_broadcast(wcond_t *cond);
+
+#endif
+
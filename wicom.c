@@ -36,6 +36,22 @@
 #include "nvpair.h"
 #include "req.h"
 #include "reqbuf.h"
+#include "reqstream.h"
+#include "reqschema.h"
+#include "wcapture.h"
+#include "admctl.h"
+#include "modsched.h"
+#include "modinbox.h"
+#include "wlock.h"
+#include "wcond.h"
+#include "modbus.h"
+#include "modstats.h"
+#include "modgroup.h"
+#include "modpeer.h"
+#include "shmring.h"
+#include "wloop.h"
+#include "wthread.h"
+#include "watomic.h"
 
 double vtest = 50.0;
 
@@ -397,14 +413,2109 @@ void req_validation_test(void)
 	}
 }
 
+/*
+   test_check
+
+   Prints the outcome of one behaviour check of a test function and returns 1
+   when it failed, the test functions add these up and main exits with failure
+   if any of them is non zero.
+*/
+int test_check(const char *test,const char *what,bool ok)
+{
+	printf("%-20s %-56s %s\n",test,what,ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+/* test_sleep: waits ms milliseconds, wicom has no portable sleep */
+void test_sleep(unsigned int ms)
+{
+	wlock_t lock;
+	wcond_t cond;
+
+	wlock_create(&lock);
+	wcond_create(&cond);
+	wlock_acquire(&lock);
+	wcond_timedwait(&cond,&lock,ms*1000);
+	wlock_release(&lock);
+	wcond_free(&cond);
+	wlock_free(&lock);
+}
+
+/* nvblob_test: req_dup shares the values that don't fit inline through the
+   refcounted blob, the copy keeps the value after the original is freed. */
+int nvblob_test(void)
+{
+	char *req_raw = "1 modFrom modTo reqCode name1=\"a value that does not fit inline\"";
+	request_t req_text,req,req_copy;
+	nvpair_t nvp,nvp_copy;
+	nvblob_t blob;
+	int failed = 0;
+
+	/* req_get_nv returns a copy of the nvpair, it holds its own reference */
+	if( req_from_string(req_raw,&req_text) != WSTATUS_SUCCESS )
+		return test_check("nvblob_test","parse request",false);
+	req_to_bin(req_text,&req);
+	req_free(req_text);
+
+	req_dup(req,&req_copy);
+	req_get_nv(req,"name1",5,&nvp);
+	req_get_nv(req_copy,"name1",5,&nvp_copy);
+	blob = nvp->value_blob;
+
+	failed += test_check("nvblob_test","dup shares the value blob",
+			blob && nvp_copy->value_blob == blob && watomic_get(&blob->refcount) == 4);
+	failed += test_check("nvblob_test","shared value can't be overwritten",
+			_nvp_fill(nvp->name_ptr,nvp->name_size,"x",nvp->value_size,nvp) != WSTATUS_SUCCESS);
+
+	_nvp_free(nvp);
+	req_free(req);
+	failed += test_check("nvblob_test","copy keeps the value after free",
+			watomic_get(&blob->refcount) == 2 && nvp_copy->value_size == 32 &&
+			!memcmp(nvp_copy->value_ptr,"a value that does not fit inline",32));
+
+	_nvp_free(nvp_copy);
+	req_free(req_copy);
+	return failed;
+}
+
+/* sealed_test: a sealed request is read-only, it's shared through references
+   and its text is built once for every reader. */
+int sealed_test(void)
+{
+	char *req_raw = "2 modFrom modTo reqCode name1=value1";
+	request_t req_text,req;
+	const char *text1 = 0,*text2 = 0;
+	int failed = 0;
+
+	if( req_from_string(req_raw,&req_text) != WSTATUS_SUCCESS )
+		return test_check("sealed_test","parse request",false);
+	req_to_bin(req_text,&req);
+	req_free(req_text);
+
+	failed += test_check("sealed_test","seal a binary request",req_seal(req) == WSTATUS_SUCCESS);
+	failed += test_check("sealed_test","sealed request can't be modified",
+			req_add_nvp_z("name2","value2",req) != WSTATUS_SUCCESS);
+	failed += test_check("sealed_test","second seal is refused",req_seal(req) != WSTATUS_SUCCESS);
+
+	req_ref(req);
+	failed += test_check("sealed_test","reference taken",watomic_get(&req->refcount) == 2);
+
+	req_sealed_text(req,&text1,0);
+	req_sealed_text(req,&text2,0);
+	failed += test_check("sealed_test","text is built once and cached",
+			text1 && text1 == text2 && strstr(text1,"name1=value1"));
+
+	req_unref(req);
+	failed += test_check("sealed_test","unref keeps the other reference",watomic_get(&req->refcount) == 1);
+	req_unref(req);
+
+	return failed;
+}
+
+/* nvinline_test: short names and values are stored inside the nvpair, long
+   ones go to the heap, a copy of an inline value owns its own bytes. */
+int nvinline_test(void)
+{
+	nvpair_t nvp_short = 0,nvp_long = 0,nvp_copy = 0;
+	char long_name[] = "a_name_longer_than_inline";
+	char long_value[] = "a value longer than the inline buffer";
+	int failed = 0;
+
+	_nvp_alloc(2,4,&nvp_short);
+	_nvp_fill("ch",2,"11.5",4,nvp_short);
+	failed += test_check("nvinline_test","short name and value are inline",
+			nvp_name_is_inline(nvp_short) && nvp_value_is_inline(nvp_short) && !nvp_short->value_blob &&
+			!memcmp(nvp_short->value_ptr,"11.5",4));
+
+	_nvp_alloc(sizeof(long_name)-1,sizeof(long_value)-1,&nvp_long);
+	_nvp_fill(long_name,sizeof(long_name)-1,long_value,sizeof(long_value)-1,nvp_long);
+	failed += test_check("nvinline_test","long name and value are not inline",
+			!nvp_name_is_inline(nvp_long) && !nvp_value_is_inline(nvp_long) && nvp_long->value_blob &&
+			!memcmp(nvp_long->name_ptr,long_name,sizeof(long_name)-1));
+
+	_nvp_dup(nvp_short,&nvp_copy);
+	failed += test_check("nvinline_test","copy of an inline value owns its bytes",
+			nvp_copy && nvp_value_is_inline(nvp_copy) && nvp_copy->value_ptr != nvp_short->value_ptr &&
+			!memcmp(nvp_copy->value_ptr,"11.5",4));
+
+	_nvp_free(nvp_copy);
+	_nvp_free(nvp_long);
+	_nvp_free(nvp_short);
+	return failed;
+}
+
+/* stream_test: the requests sent by each side of a stream are queued here and
+   then passed by hand to the other side, so they can be reordered. */
+#define STREAM_TEST_QUEUE 16
+#define STREAM_TEST_CHUNKS 3
+typedef struct _stream_test_t
+{
+	request_t queue[STREAM_TEST_QUEUE];
+	unsigned int count;
+	char data[STREAM_TEST_CHUNKS*REQSTREAM_CHUNK_SIZE];
+	unsigned int data_used;
+	bool ended;
+} stream_test_t;
+
+wstatus stream_test_send_cb(void *param,request_t req)
+{
+	stream_test_t *st = (stream_test_t*)param;
+
+	if( st->count == STREAM_TEST_QUEUE )
+		return WSTATUS_FAILURE;
+
+	return req_dup(req,&st->queue[st->count++]);
+}
+
+wstatus stream_test_chunk_cb(void *param,reqstream_t rs,reqstream_event_list event,const void *chunk_ptr,unsigned int chunk_size)
+{
+	stream_test_t *st = (stream_test_t*)param;
+
+	if( event == REQSTREAM_EVENT_END )
+		st->ended = true;
+
+	if( event != REQSTREAM_EVENT_CHUNK )
+		return WSTATUS_SUCCESS;
+
+	if( st->data_used + chunk_size > sizeof(st->data) )
+		return WSTATUS_FAILURE;
+
+	memcpy(st->data + st->data_used,chunk_ptr,chunk_size);
+	st->data_used += chunk_size;
+	return WSTATUS_SUCCESS;
+}
+
+void stream_test_flush(stream_test_t *st)
+{
+	while( st->count )
+		req_free(st->queue[--st->count]);
+}
+
+/* stream_test: chunks that arrive out of order wait in the reorder window
+   and are delivered in order once the gap is filled. */
+int stream_test(void)
+{
+	static stream_test_t tx_queue,rx_queue;
+	static char payload[STREAM_TEST_CHUNKS*REQSTREAM_CHUNK_SIZE];
+	reqstream_t tx = 0,rx = 0;
+	reqstream_status_t status;
+	unsigned int i,used = 0;
+	int failed = 0;
+
+	for( i = 0 ; i < sizeof(payload) ; i++ )
+		payload[i] = (char)(i*7);
+
+	if( reqstream_open(stream_test_send_cb,&tx_queue,"modFrom","modTo",&tx) != WSTATUS_SUCCESS )
+		return test_check("stream_test","open stream",false);
+
+	reqstream_accept(tx_queue.queue[0],stream_test_send_cb,stream_test_chunk_cb,&rx_queue,4,&rx);
+	stream_test_flush(&tx_queue);
+	for( i = 0 ; i < rx_queue.count ; i++ )
+		reqstream_input(tx,rx_queue.queue[i]);
+	stream_test_flush(&rx_queue);
+
+	reqstream_write(tx,payload,sizeof(payload),&used);
+	failed += test_check("stream_test","credit lets every chunk out",
+			used == sizeof(payload) && tx_queue.count == STREAM_TEST_CHUNKS);
+
+	/* deliver the chunks in reverse order */
+	reqstream_input(rx,tx_queue.queue[2]);
+	reqstream_input(rx,tx_queue.queue[1]);
+	reqstream_status(rx,&status);
+	failed += test_check("stream_test","chunks after a gap are held back",
+			rx_queue.data_used == 0 && status.chunks_buffered == 2);
+
+	reqstream_input(rx,tx_queue.queue[0]);
+	failed += test_check("stream_test","filling the gap delivers in order",
+			rx_queue.data_used == sizeof(payload) && !memcmp(rx_queue.data,payload,sizeof(payload)));
+	stream_test_flush(&tx_queue);
+
+	reqstream_close(tx);
+	for( i = 0 ; i < tx_queue.count ; i++ )
+		reqstream_input(rx,tx_queue.queue[i]);
+	failed += test_check("stream_test","close ends the stream",rx_queue.ended);
+
+	stream_test_flush(&tx_queue);
+	stream_test_flush(&rx_queue);
+	reqstream_destroy(rx);
+	reqstream_destroy(tx);
+	return failed;
+}
+
+/* schema_test: requests are checked against the schema of their destination
+   and code, the typed values are read from the record. */
+int schema_test(void)
+{
+	static const reqschema_field_t fields[] = {
+		{ "ch", REQSCHEMA_TYPE_INT, true },
+		{ "pwr", REQSCHEMA_TYPE_DOUBLE, false },
+		{ "id", REQSCHEMA_TYPE_STRING, true }
+	};
+	char *req_raw[] = {
+		"3 modFrom apmgr apSet ch=11 pwr=17.5 id=ap042",
+		"4 modFrom apmgr apSet pwr=17.5 id=ap042",
+		"5 modFrom apmgr apSet ch=eleven id=ap042"
+	};
+	request_t req_text,req[3] = { 0, 0, 0 };
+	char error[REQSCHEMA_ERRORSIZE];
+	reqrecord_t rec;
+	wstatus ws[3];
+	int i,failed = 0;
+
+	reqschema_load();
+	reqschema_register("apmgr","apSet",fields,3);
+
+	for( i = 0 ; i < 3 ; i++ ) {
+		req_from_string(req_raw[i],&req_text);
+		req_to_bin(req_text,&req[i]);
+		req_free(req_text);
+		error[0] = '\0';
+		ws[i] = reqschema_attach(req[i],error,sizeof(error));
+	}
+
+	rec = req_record(req[0]);
+	failed += test_check("schema_test","valid request gets a typed record",
+			ws[0] == WSTATUS_SUCCESS && rec && reqrecord_int(rec,0) == 11 &&
+			reqrecord_double(rec,1) == 17.5 && reqrecord_size(rec,2) == 5 &&
+			!memcmp(reqrecord_ptr(rec,2),"ap042",5));
+	failed += test_check("schema_test","missing required field is rejected",
+			ws[1] != WSTATUS_SUCCESS && !req_record(req[1]));
+	failed += test_check("schema_test","wrong field type is rejected",
+			ws[2] != WSTATUS_SUCCESS && !req_record(req[2]) && error[0]);
+
+	for( i = 0 ; i < 3 ; i++ )
+		req_free(req[i]);
+	reqschema_unregister("apmgr","apSet");
+	reqschema_unload();
+	return failed;
+}
+
+/* reqids_test: every well-known code and name maps back to its id, other
+   strings are unknown and parsed requests are tagged with the ids. */
+int reqids_test(void)
+{
+	char *req_raw = "6 modFrom modTo moduleLookup name=apmgr other=1";
+	request_t req_text,req;
+	nvpair_t nvp = 0;
+	const char *str;
+	bool all_codes = true,all_names = true;
+	int i,failed = 0;
+
+	for( i = REQCODE_UNKNOWN + 1 ; i < REQCODE_COUNT ; i++ ) {
+		str = reqid_code_str(i);
+		if( !str || reqid_code_lookup(str,strlen(str)) != i )
+			all_codes = false;
+	}
+	for( i = REQNAME_UNKNOWN + 1 ; i < REQNAME_COUNT ; i++ ) {
+		str = reqid_name_str(i);
+		if( !str || reqid_name_lookup(str,strlen(str)) != i )
+			all_names = false;
+	}
+	failed += test_check("reqids_test","every code maps back to its id",all_codes);
+	failed += test_check("reqids_test","every name maps back to its id",all_names);
+	failed += test_check("reqids_test","other strings are unknown",
+			reqid_code_lookup("module",6) == REQCODE_UNKNOWN &&
+			reqid_code_lookup("moduleLookupX",13) == REQCODE_UNKNOWN &&
+			reqid_name_lookup("nam",3) == REQNAME_UNKNOWN);
+
+	req_from_string(req_raw,&req_text);
+	req_to_bin(req_text,&req);
+	req_free(req_text);
+	failed += test_check("reqids_test","parsed request code is tagged",
+			req->data.bin.code_id == REQCODE_MODULE_LOOKUP);
+	failed += test_check("reqids_test","lookup by name id",
+			req_get_nv_id(req,REQNAME_NAME,&nvp) == WSTATUS_SUCCESS && nvp->value_size == 5);
+	if( nvp )
+		_nvp_free(nvp);
+	req_free(req);
+
+	return failed;
+}
+
+/* encoded_nv_test: encoded values followed by other nvpairs are valid and
+   survive the binary/text round trip, array2z terminates what it copies. */
+int encoded_nv_test(void)
+{
+	char *req_raw = "7 modFrom modTo reqCode name1=#6566672A686970 name2=value2";
+	request_t req_text,req_bin,req_text2;
+	req_validation_t validation = REQUEST_VALIDATION_UNDEF;
+	const char *str;
+	int failed = 0;
+
+	req_validate(req_raw,strlen(req_raw)+1,&validation);
+	failed += test_check("encoded_nv_test","encoded value before other nvpair is valid",
+			validation == REQUEST_IS_VALID);
+
+	req_from_string(req_raw,&req_text);
+	req_to_bin(req_text,&req_bin);
+	req_to_text(req_bin,&req_text2);
+	failed += test_check("encoded_nv_test","encoded value survives the text round trip",
+			req_text2 && strstr(req_text2->data.text.raw,"name1=#6566672A686970 ") &&
+			strstr(req_text2->data.text.raw,"name2=value2"));
+	req_free(req_text2);
+	req_free(req_bin);
+	req_free(req_text);
+
+	array2z("longer value",12);
+	str = array2z("abc",3);
+	failed += test_check("encoded_nv_test","array2z terminates the copy",!strcmp(str,"abc"));
+
+	return failed;
+}
+
+/* capture_test: messages written to a capture log are read back in order,
+   the ones that don't fit are dropped and counted. */
+#define CAPTURE_TEST_PATH "wicom_test.cap"
+int capture_test(void)
+{
+	wcapture_t cap;
+	wcapture_reader_t reader;
+	wcapture_status_t status;
+	const wcapture_record_t *rec1 = 0,*rec2 = 0;
+	char msg[256];
+	int i,failed = 0;
+
+	if( wcapture_open(CAPTURE_TEST_PATH,WCAPTURE_MINSIZE,&cap) != WSTATUS_SUCCESS )
+		return test_check("capture_test","open capture log",false);
+
+	wcapture_write(cap,WCAPTURE_DIR_IN,1,"8 modFrom modTo reqCode",23);
+	wcapture_write(cap,WCAPTURE_DIR_OUT,2,"8R modTo modFrom reqCode",24);
+
+	memset(msg,'x',sizeof(msg));
+	for( i = 0 ; i < 2*WCAPTURE_MINSIZE/(int)sizeof(msg) ; i++ )
+		wcapture_write(cap,WCAPTURE_DIR_IN,1,msg,sizeof(msg));
+
+	wcapture_status(cap,&status);
+	failed += test_check("capture_test","full log drops and counts messages",
+			status.dropped > 0 && status.used <= status.size && status.records + status.dropped == (uint64_t)i + 2);
+	wcapture_close(cap);
+
+	if( wcapture_reader_open(CAPTURE_TEST_PATH,&reader) != WSTATUS_SUCCESS ) {
+		remove(CAPTURE_TEST_PATH);
+		return failed + test_check("capture_test","open capture log for reading",false);
+	}
+
+	wcapture_reader_next(reader,&rec1);
+	wcapture_reader_next(reader,&rec2);
+	failed += test_check("capture_test","records are read back in order",
+			rec1 && rec2 && rec1->direction == WCAPTURE_DIR_IN && rec1->channel_id == 1 &&
+			rec1->size == 23 && !memcmp(rec1->data,"8 modFrom",9) &&
+			rec2->direction == WCAPTURE_DIR_OUT && rec2->channel_id == 2 && rec2->size == 24 &&
+			rec2->timestamp_ns >= rec1->timestamp_ns);
+
+	wcapture_reader_close(reader);
+	remove(CAPTURE_TEST_PATH);
+	return failed;
+}
+
+/* admctl_test_send: admits one request (or reply) from src, returns 1 if
+   admitted */
+int admctl_test_send(const char *src,bool reply,bool internal)
+{
+	char req_raw[160];
+	req_header_t header;
+	admctl_verdict_list verdict = ADMCTL_REJECT_RATE;
+
+	snprintf(req_raw,sizeof(req_raw),"9%s %s modTo reqCode",reply ? "R" : "",src);
+	if( req_peek_header(req_raw,strlen(req_raw)+1,&header) != WSTATUS_SUCCESS )
+		return 0;
+	admctl_admit(&header,internal,&verdict);
+	return verdict == ADMCTL_ADMIT;
+}
+
+/* admctl_test: a new source gets a share of the burst and a flooding source
+   is limited to its burst, new or spoofed source names don't get fresh
+   bursts, replies and the modmgr source name are charged like any other
+   request, a module that was already known keeps being admitted. */
+int admctl_test(void)
+{
+	admctl_opt_t opt = { .rate = 10, .burst = 16, .queue_high = 100000, .queue_low = 50000 };
+	admctl_status_t status;
+	char long_src[REQMODSIZE],spoof_src[32];
+	int i,admitted,failed = 0;
+
+	memset(long_src,'L',sizeof(long_src)-1);
+	long_src[sizeof(long_src)-1] = '\0';
+
+	admctl_load(&opt);
+
+	/* each new source takes a share of the newcomer tokens */
+	admitted = 0;
+	for( i = 0 ; i < 50 ; i++ )
+		admitted += admctl_test_send("goodmod",false,false);
+	failed += test_check("admctl_test","new source gets a share of the burst",
+			admitted == opt.burst / ADMCTL_NEWCOMER_SHARE);
+
+	admitted = 0;
+	for( i = 0 ; i < 100 ; i++ ) {
+		snprintf(spoof_src,sizeof(spoof_src),"spoof%d",i);
+		admitted += admctl_test_send(spoof_src,false,false);
+	}
+	for( i = 0 ; i < 50 ; i++ )
+		admitted += admctl_test_send(long_src,false,false);
+	failed += test_check("admctl_test","new source names don't get fresh bursts",
+			admitted <= opt.burst - opt.burst / ADMCTL_NEWCOMER_SHARE);
+
+	admctl_status(&status);
+	failed += test_check("admctl_test","sources are bounded",status.sources <= ADMCTL_MAXSOURCES);
+	admctl_unload();
+
+	/* replies and the name of modmgr don't skip the buckets, only the
+	   requests of the fast channel do */
+	admctl_load(&opt);
+	admitted = 0;
+	for( i = 0 ; i < 50 ; i++ )
+		admitted += admctl_test_send("replymod",true,false);
+	failed += test_check("admctl_test","replies are charged to their source",
+			admitted == opt.burst / ADMCTL_NEWCOMER_SHARE);
+	admitted = 0;
+	for( i = 0 ; i < 50 ; i++ )
+		admitted += admctl_test_send("modmgr",false,false);
+	failed += test_check("admctl_test","modmgr source name is limited",
+			admitted == opt.burst / ADMCTL_NEWCOMER_SHARE);
+	admitted = 0;
+	for( i = 0 ; i < 50 ; i++ )
+		admitted += admctl_test_send("modmgr",false,true);
+	failed += test_check("admctl_test","internal requests are admitted",admitted == 50);
+	for( i = 0 ; i < 50 ; i++ )
+		admctl_release();
+	admctl_unload();
+
+	/* a source is limited to its burst once its bucket refilled (rate 100
+	   per second, 16 tokens in 160 ms) */
+	opt.rate = 100;
+	admctl_load(&opt);
+	admctl_test_send("goodmod",false,false);
+	test_sleep(300);
+	admitted = 0;
+	for( i = 0 ; i < 50 ; i++ )
+		admitted += admctl_test_send("goodmod",false,false);
+	failed += test_check("admctl_test","source is limited to its burst",
+			admitted >= opt.burst && admitted <= opt.burst + 2);
+	admctl_unload();
+
+	/* known sources keep their own bucket when others flood */
+	opt.rate = 10;
+	admctl_load(&opt);
+	admctl_test_send("goodmod",false,false);
+	test_sleep(600);
+	for( i = 0 ; i < 300 ; i++ ) {
+		snprintf(spoof_src,sizeof(spoof_src),"spoof%d",i);
+		admctl_test_send(spoof_src,false,false);
+		admctl_test_send(long_src,false,false);
+	}
+	admitted = 0;
+	for( i = 0 ; i < 5 ; i++ )
+		admitted += admctl_test_send("goodmod",false,false);
+	failed += test_check("admctl_test","known source is admitted during a flood",admitted == 5);
+	admctl_unload();
+
+	/* queue watermark with hysteresis */
+	opt.rate = ADMCTL_RATE_UNLIMITED;
+	opt.queue_high = 4;
+	opt.queue_low = 2;
+	admctl_load(&opt);
+	admitted = 0;
+	for( i = 0 ; i < 6 ; i++ )
+		admitted += admctl_test_send("goodmod",false,false);
+	admctl_status(&status);
+	failed += test_check("admctl_test","queue over watermark is shed",admitted == 4 && status.shedding);
+	admctl_release();
+	admctl_release();
+	admitted = admctl_test_send("goodmod",false,false);
+	admctl_status(&status);
+	failed += test_check("admctl_test","shedding stops at the low watermark",admitted == 1 && !status.shedding);
+	admctl_unload();
+
+	return failed;
+}
+
+/* modsched_test: a source flooding its class, even under a long name or
+   under many spoofed names, can't starve the other sources of the class, and
+   control requests go first. */
+#define MODSCHED_TEST_FLOOD 100
+#define MODSCHED_TEST_SPOOF 100
+int modsched_test(void)
+{
+	modsched_opt_t opt = { .quantum = 0 };
+	modsched_t sched;
+	modsched_status_t status;
+	request_t req,victim = 0,control = 0;
+	char long_src[REQMODSIZE],spoof_src[32];
+	int i,total = 0,victim_pos = -1,control_pos = -1,failed = 0;
+
+	memset(long_src,'F',sizeof(long_src)-1);
+	long_src[sizeof(long_src)-1] = '\0';
+
+	if( modsched_create(&opt,&sched) != WSTATUS_SUCCESS )
+		return test_check("modsched_test","create scheduler",false);
+
+	for( i = 0 ; i < MODSCHED_TEST_FLOOD ; i++ ) {
+		req_from_string("10 flooder modTo reqCode",&req);
+		modsched_enqueue(sched,req,long_src,MODSCHED_CLASS_NORMAL,1);
+		total++;
+	}
+	for( i = 0 ; i < MODSCHED_TEST_SPOOF ; i++ ) {
+		snprintf(spoof_src,sizeof(spoof_src),"spoof%d",i);
+		req_from_string("11 spoof modTo reqCode",&req);
+		modsched_enqueue(sched,req,spoof_src,MODSCHED_CLASS_NORMAL,1);
+		total++;
+	}
+	req_from_string("12 victim modTo reqCode",&victim);
+	modsched_enqueue(sched,victim,"victim",MODSCHED_CLASS_NORMAL,1);
+	req_from_string("13 modmgr modTo registryModule",&control);
+	modsched_enqueue(sched,control,"modmgr",MODSCHED_CLASS_CONTROL,1);
+	total += 2;
+
+	for( i = 0 ; i < total ; i++ ) {
+		if( modsched_dequeue(sched,&req) != WSTATUS_SUCCESS )
+			break;
+		if( req == victim )
+			victim_pos = i;
+		if( req == control )
+			control_pos = i;
+		req_free(req);
+	}
+
+	modsched_status(sched,MODSCHED_CLASS_NORMAL,&status);
+	failed += test_check("modsched_test","every request is dispatched",
+			i == total && status.depth == 0 && status.dispatched == (unsigned long)total - 1);
+	failed += test_check("modsched_test","control class goes first",control_pos == 0);
+	failed += test_check("modsched_test","flooding source doesn't starve others",
+			victim_pos > 0 && victim_pos <= MODSCHED_TEST_SPOOF + MODSCHED_DEFAULT_QUANTUM + 2);
+
+	modsched_destroy(sched);
+	return failed;
+}
+
+/* batch_test: a DCR module with a batch callback gets the requests in a
+   single call, sealed, and the replies over reply_max are freed. */
+#define BATCH_TEST_EXTRA 2
+unsigned int batch_test_calls,batch_test_count,batch_test_max;
+bool batch_test_sealed;
+request_t batch_test_replies[BATCH_TEST_EXTRA+1];
+
+void batch_test_cb(const request_t *req_list,unsigned int req_count,request_t *reply_list,unsigned int reply_max,unsigned int *reply_count)
+{
+	unsigned int i;
+
+	batch_test_calls++;
+	batch_test_count += req_count;
+	batch_test_max = reply_max;
+	for( i = 0 ; i < req_count ; i++ )
+		if( !req_is_sealed(req_list[i]) )
+			batch_test_sealed = false;
+	*reply_count = 0;
+	if( !batch_test_replies[0] )
+		return;
+
+	/* a module returning more replies than allowed */
+	for( i = 0 ; i < reply_max + BATCH_TEST_EXTRA ; i++ )
+		reply_list[(*reply_count)++] = batch_test_replies[i];
+}
+
+int batch_test(void)
+{
+	struct _modreg_t mod;
+	request_t req_text,req_list[8];
+	int i,failed = 0;
+
+	memset(&mod,0,sizeof(mod));
+	strcpy(mod.basic.name,"batchmod");
+	mod.communication.type = MODREG_COMM_DCR;
+	mod.communication.data.dcr.reqbatch_cb = batch_test_cb;
+
+	for( i = 0 ; i < 8 ; i++ ) {
+		req_from_string("14 modFrom batchmod reqCode n=1",&req_text);
+		req_to_bin(req_text,&req_list[i]);
+		req_free(req_text);
+	}
+
+	batch_test_sealed = true;
+	failed += test_check("batch_test","batch is delivered in one call",
+			_request_deliver_batch(req_list,8,&mod) == WSTATUS_SUCCESS &&
+			batch_test_calls == 1 && batch_test_count == 8 && batch_test_sealed);
+	failed += test_check("batch_test","batch over MODREG_BATCH_MAX is refused",
+			_request_deliver_batch(req_list,MODREG_BATCH_MAX+1,&mod) != WSTATUS_SUCCESS && batch_test_calls == 1);
+
+	/* the replies are sealed and referenced by the test too, modmgr drops its
+	   reference of every one of them. They're expired so they aren't routed. */
+	for( i = 0 ; i < BATCH_TEST_EXTRA + 1 ; i++ ) {
+		req_from_string("15 batchmod modTo reqCode deadline=1",&req_text);
+		req_to_bin(req_text,&batch_test_replies[i]);
+		req_free(req_text);
+		req_seal(batch_test_replies[i]);
+		req_ref(batch_test_replies[i]);
+	}
+	_request_deliver_batch(req_list,1,&mod);
+	failed += test_check("batch_test","callback gets the reply capacity",batch_test_max == 1);
+	for( i = 0 ; i < BATCH_TEST_EXTRA + 1 ; i++ ) {
+		failed += test_check("batch_test","excess replies are freed",watomic_get(&batch_test_replies[i]->refcount) == 1);
+		req_unref(batch_test_replies[i]);
+	}
+	memset(batch_test_replies,0,sizeof(batch_test_replies));
+
+	mod.communication.data.dcr.reqbatch_cb = 0;
+	failed += test_check("batch_test","module without batch callback is refused",
+			_request_deliver_batch(req_list,8,&mod) != WSTATUS_SUCCESS);
+
+	for( i = 0 ; i < 8 ; i++ )
+		req_unref(req_list[i]);
+	return failed;
+}
+
+/* inbox_test: the deliver callback waits on inbox_test_gate, so the test can
+   fill the inbox while the inbox thread is busy with the first request. */
+wlock_t inbox_test_gate;
+unsigned int inbox_test_dropped;
+
+void inbox_test_deliver_cb(void *param,const request_t *req_list,unsigned int req_count)
+{
+	wlock_acquire(&inbox_test_gate);
+	wlock_release(&inbox_test_gate);
+}
+
+void inbox_test_drop_cb(void *param,const request_t req)
+{
+	inbox_test_dropped++;
+}
+
+/* inbox_test_fill: puts count requests in a new inbox of size 2 while the
+   module is busy, returns how many were refused and the inbox status */
+unsigned int inbox_test_fill(modinbox_overflow_list overflow,unsigned int count,modinbox_status_t *status)
+{
+	modinbox_opt_t opt = { .name = "inboxtest", .size = 2, .batch_max = 1, .overflow = overflow,
+		.block_ms = 5, .drop_cb = inbox_test_drop_cb };
+	modinbox_t inbox;
+	modinbox_result_list result;
+	request_t req;
+	unsigned int i,full = 0;
+
+	wlock_acquire(&inbox_test_gate);
+	if( modinbox_create(&opt,inbox_test_deliver_cb,0,&inbox) != WSTATUS_SUCCESS ) {
+		wlock_release(&inbox_test_gate);
+		return 0;
+	}
+
+	for( i = 0 ; i < count ; i++ ) {
+		req_from_string("15 modFrom inboxtest reqCode",&req);
+		if( (modinbox_put(inbox,req,&result) != WSTATUS_SUCCESS) || (result == MODINBOX_FULL) ) {
+			req_free(req);
+			full++;
+		}
+	}
+
+	modinbox_status(inbox,status);
+	wlock_release(&inbox_test_gate);
+	modinbox_stop(inbox);
+	modinbox_wait(inbox);
+	modinbox_destroy(inbox);
+	return full;
+}
+
+/* inbox_test_self_cb: the module replies to itself until its inbox is full,
+   the inbox thread must not wait block_ms for itself. */
+modinbox_t inbox_test_self;
+uint64_t inbox_test_self_ms;
+wlock_t inbox_test_self_lock;
+wcond_t inbox_test_self_cond;
+
+void inbox_test_self_cb(void *param,const request_t *req_list,unsigned int req_count)
+{
+	modinbox_result_list result = MODINBOX_QUEUED;
+	uint64_t start_ms = req_deadline_now_ms();
+	request_t req;
+
+	wlock_acquire(&inbox_test_self_lock);
+	if( inbox_test_self_ms ) {
+		wlock_release(&inbox_test_self_lock);
+		return;
+	}
+	wlock_release(&inbox_test_self_lock);
+
+	while( result != MODINBOX_FULL ) {
+		req_from_string("15 inboxtest inboxtest reqCode",&req);
+		if( (modinbox_put(inbox_test_self,req,&result) != WSTATUS_SUCCESS) || (result == MODINBOX_FULL) ) {
+			req_free(req);
+			break;
+		}
+	}
+
+	wlock_acquire(&inbox_test_self_lock);
+	inbox_test_self_ms = req_deadline_now_ms() - start_ms + 1;
+	wcond_broadcast(&inbox_test_self_cond);
+	wlock_release(&inbox_test_self_lock);
+}
+
+/* inbox_test: the overflow policies of a full inbox, BLOCK gives up after
+   block_ms instead of waiting forever and never waits for itself. */
+int inbox_test(void)
+{
+	modinbox_opt_t opt = { .name = "inboxtest", .size = 2, .batch_max = 1, .block_ms = 1000 };
+	modinbox_result_list result;
+	modinbox_status_t status;
+	request_t req;
+	unsigned int full;
+	int i,failed = 0;
+
+	wlock_create(&inbox_test_gate);
+
+	full = inbox_test_fill(MODINBOX_OVERFLOW_BUSY,6,&status);
+	failed += test_check("inbox_test","busy policy refuses when full",
+			full >= 3 && status.rejected == full && status.depth <= 2);
+
+	full = inbox_test_fill(MODINBOX_OVERFLOW_BLOCK,6,&status);
+	failed += test_check("inbox_test","block policy rejects after block_ms",
+			full >= 3 && status.rejected == full);
+
+	inbox_test_dropped = 0;
+	full = inbox_test_fill(MODINBOX_OVERFLOW_DROP_OLDEST,6,&status);
+	failed += test_check("inbox_test","drop oldest policy calls drop_cb",
+			full == 0 && inbox_test_dropped >= 3 && status.dropped == inbox_test_dropped && status.depth == 2);
+
+	opt.overflow = MODINBOX_OVERFLOW_BLOCK;
+	wlock_create(&inbox_test_self_lock);
+	wcond_create(&inbox_test_self_cond);
+	inbox_test_self_ms = 0;
+	if( modinbox_create(&opt,inbox_test_self_cb,0,&inbox_test_self) == WSTATUS_SUCCESS ) {
+		req_from_string("15 modFrom inboxtest reqCode",&req);
+		if( (modinbox_put(inbox_test_self,req,&result) != WSTATUS_SUCCESS) || (result == MODINBOX_FULL) )
+			req_free(req);
+		wlock_acquire(&inbox_test_self_lock);
+		for( i = 0 ; (i < 300) && !inbox_test_self_ms ; i++ )
+			wcond_timedwait(&inbox_test_self_cond,&inbox_test_self_lock,10000);
+		wlock_release(&inbox_test_self_lock);
+		modinbox_stop(inbox_test_self);
+		modinbox_wait(inbox_test_self);
+		modinbox_destroy(inbox_test_self);
+	}
+	failed += test_check("inbox_test","block policy doesn't wait for its own thread",
+			inbox_test_self_ms && (inbox_test_self_ms < opt.block_ms / 2));
+	wcond_free(&inbox_test_self_cond);
+	wlock_free(&inbox_test_self_lock);
+
+	wlock_free(&inbox_test_gate);
+	return failed;
+}
+
+/* bus_test: the deliver callback of the bus waits on bus_test_gate, events
+   published meanwhile stay in the queue of the subscriber. */
+wlock_t bus_test_gate,bus_test_lock;
+wcond_t bus_test_cond;
+unsigned int bus_test_entered,bus_test_delivered;
+char bus_test_last[8];
+
+void bus_test_deliver_cb(void *param,const char *subscriber,request_t event)
+{
+	nvpair_t nvp = 0;
+
+	wlock_acquire(&bus_test_lock);
+	bus_test_entered++;
+	wcond_broadcast(&bus_test_cond);
+	wlock_release(&bus_test_lock);
+
+	wlock_acquire(&bus_test_gate);
+	wlock_release(&bus_test_gate);
+
+	wlock_acquire(&bus_test_lock);
+	bus_test_delivered++;
+	if( (req_get_nv(event,"pwr",3,&nvp) == WSTATUS_SUCCESS) && (nvp->value_size < sizeof(bus_test_last)) ) {
+		memcpy(bus_test_last,nvp->value_ptr,nvp->value_size);
+		bus_test_last[nvp->value_size] = '\0';
+	}
+	if( nvp )
+		_nvp_free(nvp);
+	wcond_broadcast(&bus_test_cond);
+	wlock_release(&bus_test_lock);
+}
+
+void bus_test_publish(modbus_t bus,const char *topic,const char *key,int pwr)
+{
+	char req_raw[64];
+	request_t req_text,event;
+
+	snprintf(req_raw,sizeof(req_raw),"17 apmgr modbus event pwr=%d",pwr);
+	req_from_string(req_raw,&req_text);
+	req_to_bin(req_text,&event);
+	req_free(req_text);
+	modbus_publish(bus,topic,key,event);
+	req_unref(event);
+}
+
+/* bus_test_wait: waits up to one second for the counter to reach count */
+bool bus_test_wait(unsigned int *counter,unsigned int count)
+{
+	int i;
+	bool done;
+
+	wlock_acquire(&bus_test_lock);
+	for( i = 0 ; (i < 100) && (*counter < count) ; i++ )
+		wcond_timedwait(&bus_test_cond,&bus_test_lock,10000);
+	done = (*counter >= count);
+	wlock_release(&bus_test_lock);
+	return done;
+}
+
+/* bus_test: a slow subscriber gets the latest value of each key, the queue
+   stays bounded when the keys are all different. */
+int bus_test(void)
+{
+	modbus_opt_t opt = { .queue_size = 0 };
+	modbus_status_t status;
+	modbus_t bus;
+	char key[16];
+	int i,failed = 0;
+
+	wlock_create(&bus_test_gate);
+	wlock_create(&bus_test_lock);
+	wcond_create(&bus_test_cond);
+	bus_test_entered = 0;
+	bus_test_delivered = 0;
+
+	if( modbus_create(&opt,bus_test_deliver_cb,0,&bus) != WSTATUS_SUCCESS )
+		return test_check("bus_test","create bus",false);
+	modbus_subscribe(bus,"slowmod","ap.*",4);
+
+	/* keep the bus thread in the callback with the first event */
+	wlock_acquire(&bus_test_gate);
+	bus_test_publish(bus,"ap.1","first",0);
+	bus_test_wait(&bus_test_entered,1);
+
+	for( i = 1 ; i <= 10 ; i++ )
+		bus_test_publish(bus,"ap.1","pwr",i);
+	bus_test_publish(bus,"map.1","pwr",99);
+	modbus_status(bus,"slowmod",&status);
+	failed += test_check("bus_test","same key is conflated in place",status.depth == 1 && status.conflated == 9);
+	failed += test_check("bus_test","other topics aren't queued",status.queued == 2);
+
+	wlock_release(&bus_test_gate);
+	failed += test_check("bus_test","subscriber gets the latest value",
+			bus_test_wait(&bus_test_delivered,2) && !strcmp(bus_test_last,"10"));
+
+	wlock_acquire(&bus_test_gate);
+	bus_test_publish(bus,"ap.1","first",0);
+	bus_test_wait(&bus_test_entered,3);
+
+	for( i = 0 ; i < 10 ; i++ ) {
+		snprintf(key,sizeof(key),"key%d",i);
+		bus_test_publish(bus,"ap.2",key,100+i);
+	}
+	modbus_status(bus,"slowmod",&status);
+	failed += test_check("bus_test","queue of different keys is bounded",status.depth == 4 && status.dropped == 6);
+
+	wlock_release(&bus_test_gate);
+	failed += test_check("bus_test","queued events are delivered",
+			bus_test_wait(&bus_test_delivered,7) && !strcmp(bus_test_last,"109"));
+
+	modbus_stop(bus);
+	modbus_destroy(bus);
+	wcond_free(&bus_test_cond);
+	wlock_free(&bus_test_lock);
+	wlock_free(&bus_test_gate);
+	return failed;
+}
+
+/* stats_test_record: records count samples of handler_us for apmgr/apSet */
+void stats_test_record(unsigned int count,uint64_t handler_us,bool error)
+{
+	modstats_sample_t sample;
+	unsigned int i;
+
+	memset(&sample,0,sizeof(sample));
+	sample.ingress_ns = 1000000;
+	sample.start_ns = sample.ingress_ns + 50000;
+	sample.end_ns = sample.start_ns + handler_us*1000;
+	sample.bytes_in = 10;
+	sample.bytes_out = 20;
+	sample.error = error;
+
+	for( i = 0 ; i < count ; i++ )
+		modstats_record("apmgr","apSet",&sample);
+}
+
+void stats_test_thread(void *param)
+{
+	stats_test_record(50,100,false);
+}
+
+/* stats_test: samples recorded by several threads are summed by pair and
+   the percentiles are within the histogram precision. */
+int stats_test(void)
+{
+	modstats_status_t list[8];
+	modstats_status_t *st = 0;
+	wthread_t thread;
+	unsigned int i,count = 0;
+	int failed = 0;
+
+	modstats_load();
+
+	stats_test_record(94,100,false);
+	stats_test_record(5,100,true);
+	stats_test_record(1,10000,false);
+	wthread_create(stats_test_thread,0,&thread);
+	wthread_wait(thread);
+
+	modstats_snapshot(list,8,&count);
+	for( i = 0 ; i < count ; i++ )
+		if( !strcmp(list[i].dst,"apmgr") && !strcmp(list[i].code,"apSet") )
+			st = &list[i];
+
+	failed += test_check("stats_test","samples of every thread are summed",
+			st && st->count == 150 && st->errors == 5 && st->bytes_in == 1500 && st->bytes_out == 3000);
+	failed += test_check("stats_test","percentiles within the bucket precision",
+			st && st->handler.p50_us >= 100*7/8 && st->handler.p50_us <= 100*9/8 &&
+			st->handler.max_us >= 10000*7/8 && st->handler.max_us <= 10000*9/8 &&
+			st->queue.p50_us >= 50*7/8 && st->queue.p50_us <= 50*9/8);
+
+	modstats_reset();
+	st = 0;
+	modstats_snapshot(list,8,&count);
+	for( i = 0 ; i < count ; i++ )
+		if( !strcmp(list[i].dst,"apmgr") && !strcmp(list[i].code,"apSet") && list[i].count )
+			st = &list[i];
+	failed += test_check("stats_test","reset clears the counters",!st);
+
+	modstats_unload();
+	return failed;
+}
+
+/* group_test: requests are spread by outstanding count, a replica that keeps
+   failing is skipped and consistent hashing keeps the keys of the replicas
+   that stay. Members are just the addresses of replica_id. */
+int group_test(void)
+{
+	modgroup_opt_t opt;
+	modgroup_t group;
+	modgroup_status_t list[3];
+	int replica_id[3];
+	void *member,*key_member[16];
+	char key[16];
+	unsigned int i,count = 0,picked[3] = { 0, 0, 0 };
+	bool rep2_keys,skipped = true,kept = true;
+	int failed = 0;
+
+	memset(&opt,0,sizeof(opt));
+	opt.policy = MODGROUP_LEAST_OUTSTANDING;
+	opt.fail_max = 2;
+	modgroup_create(&opt,&group);
+	modgroup_add(group,&replica_id[0],"rep0");
+	modgroup_add(group,&replica_id[1],"rep1");
+	modgroup_add(group,&replica_id[2],"rep2");
+
+	for( i = 0 ; i < 30 ; i++ ) {
+		modgroup_pick(group,0,&member);
+		modgroup_sent(group,member,(int)i+1,"client",true);
+		picked[(int*)member - replica_id]++;
+	}
+	failed += test_check("group_test","least outstanding spreads the requests",
+			picked[0] == 10 && picked[1] == 10 && picked[2] == 10);
+
+	/* replies of rep0 make it the least loaded */
+	for( i = 0 ; i < 30 ; i += 3 )
+		modgroup_reply(group,(int)i+1,"client");
+	modgroup_pick(group,0,&member);
+	modgroup_status(group,list,3,&count);
+	failed += test_check("group_test","replies release the outstanding count",
+			member == &replica_id[0] && count == 3 && list[0].outstanding == 0 && list[1].outstanding == 10);
+
+	/* DCR replicas finish without reply */
+	modgroup_sent(group,&replica_id[0],100,"client",false);
+	modgroup_done(group,&replica_id[0]);
+	modgroup_status(group,list,3,&count);
+	failed += test_check("group_test","done releases the outstanding count",list[0].outstanding == 0);
+
+	/* rep0 fails twice and is skipped */
+	modgroup_sent(group,&replica_id[0],101,"client",true);
+	modgroup_failed(group,&replica_id[0],101,"client");
+	modgroup_sent(group,&replica_id[0],102,"client",true);
+	modgroup_failed(group,&replica_id[0],102,"client");
+	for( i = 0 ; i < 20 ; i++ ) {
+		modgroup_pick(group,0,&member);
+		if( member == &replica_id[0] )
+			skipped = false;
+	}
+	modgroup_status(group,list,3,&count);
+	failed += test_check("group_test","failing replica is down and skipped",skipped && !list[0].healthy);
+	modgroup_destroy(group);
+
+	/* consistent hashing */
+	opt.policy = MODGROUP_HASH;
+	strcpy(opt.hash_name,"apId");
+	modgroup_create(&opt,&group);
+	modgroup_add(group,&replica_id[0],"rep0");
+	modgroup_add(group,&replica_id[1],"rep1");
+	modgroup_add(group,&replica_id[2],"rep2");
+	for( i = 0 ; i < 16 ; i++ ) {
+		snprintf(key,sizeof(key),"ap%03u",i);
+		modgroup_pick(group,key,&key_member[i]);
+		modgroup_pick(group,key,&member);
+		if( member != key_member[i] )
+			kept = false;
+	}
+	failed += test_check("group_test","same key goes to the same replica",kept);
+
+	modgroup_remove(group,&replica_id[2]);
+	rep2_keys = false;
+	for( i = 0 ; i < 16 ; i++ ) {
+		snprintf(key,sizeof(key),"ap%03u",i);
+		modgroup_pick(group,key,&member);
+		if( (key_member[i] != &replica_id[2]) && (member != key_member[i]) )
+			kept = false;
+		if( key_member[i] == &replica_id[2] )
+			rep2_keys = true;
+	}
+	failed += test_check("group_test","removing a replica only moves its keys",kept && rep2_keys);
+	modgroup_destroy(group);
+
+	return failed;
+}
+
+/* modmgr checks: modmgr runs on the loopback and the requests are sent by
+   plain wchannels, the DCR module "sink" counts the requests delivered to it
+   and keeps the last one. */
+#define MODMGR_TEST_HOST "127.0.0.1"
+#define MODMGR_TEST_PORT "48960"
+#define MODMGR_TEST_DEST MODMGR_TEST_HOST " " MODMGR_TEST_PORT
+wlock_t sink_lock;
+wcond_t sink_cond;
+unsigned int sink_count;
+char sink_last_src[REQMODSIZE];
+char sink_last_code[REQCODESIZE];
+char sink_last_n[16];
+
+void sink_reqproc_cb(const request_t req)
+{
+	nvpair_t nvp = 0;
+
+	wlock_acquire(&sink_lock);
+	sink_count++;
+	strncpy(sink_last_src,req->data.bin.src,sizeof(sink_last_src)-1);
+	strncpy(sink_last_code,req->data.bin.code,sizeof(sink_last_code)-1);
+	sink_last_n[0] = '\0';
+	if( (req_get_nv(req,"n",1,&nvp) == WSTATUS_SUCCESS) && (nvp->value_size < sizeof(sink_last_n)) ) {
+		memcpy(sink_last_n,nvp->value_ptr,nvp->value_size);
+		sink_last_n[nvp->value_size] = '\0';
+	}
+	if( nvp )
+		_nvp_free(nvp);
+	wcond_broadcast(&sink_cond);
+	wlock_release(&sink_lock);
+}
+
+/* sink_wait: waits up to one second for count requests delivered to sink */
+bool sink_wait(unsigned int count)
+{
+	int i;
+	bool done;
+
+	wlock_acquire(&sink_lock);
+	for( i = 0 ; (i < 100) && (sink_count < count) ; i++ )
+		wcond_timedwait(&sink_cond,&sink_lock,10000);
+	done = (sink_count >= count);
+	wlock_release(&sink_lock);
+	return done;
+}
+
+/* modmgr_test_start: loads modmgr and registers the sink module */
+wstatus modmgr_test_start(modmgr_load_t *load)
+{
+	wchannel_load_t wch_load;
+	struct _modreg_t reg;
+
+	wlock_create(&sink_lock);
+	wcond_create(&sink_cond);
+	sink_count = 0;
+	memset(sink_last_src,0,sizeof(sink_last_src));
+	memset(sink_last_code,0,sizeof(sink_last_code));
+
+	wchannel_load(wch_load);
+	load->bind_hostname = MODMGR_TEST_HOST;
+	load->bind_port = MODMGR_TEST_PORT;
+	if( modmgr_load(*load) != WSTATUS_SUCCESS )
+		return WSTATUS_FAILURE;
+
+	memset(&reg,0,sizeof(reg));
+	strcpy(reg.basic.name,"sink");
+	reg.communication.type = MODREG_COMM_DCR;
+	reg.communication.data.dcr.reqproc_cb = sink_reqproc_cb;
+	if( modmgr_register(&reg) != WSTATUS_SUCCESS ) {
+		modmgr_unload();
+		return WSTATUS_FAILURE;
+	}
+
+	return WSTATUS_SUCCESS;
+}
+
+void modmgr_test_stop(void)
+{
+	modmgr_unload();
+	wchannel_unload();
+	wcond_free(&sink_cond);
+	wlock_free(&sink_lock);
+}
+
+/* modmgr_test_client: creates a wchannel bound to the loopback port */
+wchannel_t modmgr_test_client(char *port)
+{
+	wchannel_opt_t opt;
+	wchannel_t wch;
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = MODMGR_TEST_HOST;
+	opt.port_src = port;
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	if( wchannel_create(&opt,&wch) != WSTATUS_SUCCESS )
+		return 0;
+	return wch;
+}
+
+/* receivers_test: requests from several clients are spread over the remote
+   receivers and reach the DCR module parsed. */
+int receivers_test(void)
+{
+	modmgr_load_t load;
+	wchannel_t client[2];
+	char req_raw[64];
+	unsigned int i,used;
+	int failed = 0;
+
+	memset(&load,0,sizeof(load));
+	load.receivers = 2;
+	if( modmgr_test_start(&load) != WSTATUS_SUCCESS )
+		return test_check("receivers_test","load modmgr",false);
+
+	client[0] = modmgr_test_client("48961");
+	client[1] = modmgr_test_client("48962");
+	for( i = 1 ; client[0] && client[1] && (i <= 20) ; i++ ) {
+		snprintf(req_raw,sizeof(req_raw),"%u client sink ping n=%u",i,i);
+		wchannel_send(client[i % 2],MODMGR_TEST_DEST,req_raw,strlen(req_raw)+1,&used);
+	}
+
+	failed += test_check("receivers_test","requests of every client are delivered",sink_wait(20));
+	wlock_acquire(&sink_lock);
+	failed += test_check("receivers_test","remote requests are parsed",
+			!strcmp(sink_last_src,"client") && !strcmp(sink_last_code,"ping") && atoi(sink_last_n) > 0);
+	wlock_release(&sink_lock);
+
+	for( i = 0 ; i < 2 ; i++ )
+		if( client[i] )
+			wchannel_destroy(client[i]);
+	modmgr_test_stop();
+	return failed;
+}
+
+/* peers_test_summary_cb: the local modules announced by the test node */
+unsigned int peers_test_summary_cb(void *param,char *buf,unsigned int buf_size)
+{
+	return snprintf(buf,buf_size,"sink");
+}
+
+/* peers_test: modules announced by the peers are routed to the first peer
+   announcing them, the requests sent to a peer in the linger time share one
+   datagram. */
+int peers_test(void)
+{
+	modpeer_opt_t opt;
+	modpeer_t peers;
+	modpeer_status_t status[2];
+	wchannel_load_t wch_load;
+	wchannel_t peer_wch;
+	unsigned int i,peer = 99,peer_other = 99,count = 0,used;
+	char *req_raw[] = { "1 sink apmgr ping n=1", "2 sink apmgr ping n=2", "3 sink apmgr ping n=3" };
+	char buffer[1024],*ptr;
+	wstatus ws_unknown;
+	bool batched = false;
+	int failed = 0;
+
+	memset(&opt,0,sizeof(opt));
+	opt.node = "node1";
+	opt.host_src = MODMGR_TEST_HOST;
+	opt.summary_ms = 60000;
+	opt.linger_us = 50000;
+
+	wchannel_load(wch_load);
+	peer_wch = modmgr_test_client("48963");
+	if( !peer_wch || (modpeer_create(&opt,peers_test_summary_cb,0,&peers) != WSTATUS_SUCCESS) ) {
+		if( peer_wch )
+			wchannel_destroy(peer_wch);
+		wchannel_unload();
+		return test_check("peers_test","create peers",false);
+	}
+
+	modpeer_add(peers,"node2",MODMGR_TEST_HOST,"48963");
+	modpeer_add(peers,"node3",MODMGR_TEST_HOST,"48964");
+	modpeer_learn(peers,"node2","apmgr:mapmgr");
+	modpeer_learn(peers,"node3","apmgr:other");
+
+	modpeer_route(peers,"apmgr",&peer);
+	modpeer_route(peers,"other",&peer_other);
+	ws_unknown = modpeer_route(peers,"nobody",&i);
+	failed += test_check("peers_test","first peer announcing a module gets it",
+			peer == 0 && peer_other == 1 && ws_unknown != WSTATUS_SUCCESS);
+
+	/* the summary sent when the peer is added goes in the same batch */
+	for( i = 0 ; i < 3 ; i++ )
+		modpeer_send(peers,peer,req_raw[i],strlen(req_raw[i]));
+	for( i = 0 ; i < 100 ; i++ ) {
+		modpeer_status(peers,status,2,&count);
+		if( status[0].requests == 4 )
+			break;
+		test_sleep(10);
+	}
+	failed += test_check("peers_test","lingering requests share a datagram",
+			count == 2 && status[0].requests == 4 && status[0].datagrams == 1);
+
+	memset(buffer,0,sizeof(buffer));
+	if( (status[0].datagrams == 1) && (wchannel_receive(peer_wch,buffer,sizeof(buffer)-1,&used) == WSTATUS_SUCCESS) ) {
+		for( i = 0, ptr = buffer ; (ptr < buffer + used) && (i < 3) ; ptr += strlen(ptr) + 1 )
+			if( !strcmp(ptr,req_raw[i]) )
+				i++;
+		batched = (i == 3);
+	}
+	failed += test_check("peers_test","batch holds the requests in order",batched);
+
+	modpeer_stop(peers);
+	modpeer_destroy(peers);
+	wchannel_destroy(peer_wch);
+	wchannel_unload();
+	return failed;
+}
+
+/* shmring_test: frames sent by one side of a shared memory ring are read in
+   place by the other side, a full ring refuses frames instead of waiting. */
+int shmring_test(void)
+{
+	char *req_raw = "18 modFrom modTo reqCode name1=value1";
+	shmring_t ring_mgr,ring_mod;
+	shmring_status_t status;
+	request_t req_text,req_bin,req_frame = 0;
+	char frame[256];
+	const void *ptr;
+	unsigned int frame_used = 0,size,sent = 0,received = 0;
+	nvpair_t nvp = 0;
+	int failed = 0;
+
+	if( shmring_create(SHMRING_MIN_SIZE,&ring_mgr) != WSTATUS_SUCCESS )
+		return test_check("shmring_test","create ring",false);
+	if( shmring_open(shmring_path(ring_mgr),&ring_mod) != WSTATUS_SUCCESS ) {
+		shmring_destroy(ring_mgr);
+		return test_check("shmring_test","open ring",false);
+	}
+
+	req_from_string(req_raw,&req_text);
+	req_to_bin(req_text,&req_bin);
+	req_to_frame(req_bin,frame,sizeof(frame),&frame_used);
+	req_free(req_text);
+	req_free(req_bin);
+
+	shmring_send(ring_mgr,frame,frame_used,false);
+	if( shmring_peek(ring_mod,&ptr,&size) == WSTATUS_SUCCESS ) {
+		req_from_frame(ptr,size,&req_frame);
+		shmring_release(ring_mod);
+	}
+	failed += test_check("shmring_test","frame crosses the ring",
+			req_frame && !strcmp(req_frame->data.bin.code,"reqCode") &&
+			req_get_nv(req_frame,"name1",5,&nvp) == WSTATUS_SUCCESS && !memcmp(nvp->value_ptr,"value1",6));
+	if( nvp )
+		_nvp_free(nvp);
+	if( req_frame )
+		req_free(req_frame);
+
+	while( (sent < SHMRING_MIN_SIZE) && (shmring_send(ring_mod,frame,frame_used,false) == WSTATUS_SUCCESS) )
+		sent++;
+	shmring_status(ring_mod,&status);
+	failed += test_check("shmring_test","full ring refuses frames",
+			sent > 0 && sent < SHMRING_MIN_SIZE && status.full == 1);
+
+	while( (received < sent) && (shmring_peek(ring_mgr,&ptr,&size) == WSTATUS_SUCCESS) ) {
+		if( (size == frame_used) && !memcmp(ptr,frame,size) )
+			received++;
+		shmring_release(ring_mgr);
+	}
+	failed += test_check("shmring_test","every frame is read back",received == sent);
+
+	shmring_shutdown(ring_mgr);
+	failed += test_check("shmring_test","shutdown wakes an empty peek",
+			shmring_peek(ring_mgr,&ptr,&size) != WSTATUS_SUCCESS);
+
+	shmring_destroy(ring_mod);
+	shmring_destroy(ring_mgr);
+	return failed;
+}
+
+/* deadline_test_sub_cb: the module forwards a sub-request with a later
+   deadline than the request it's handling */
+uint64_t deadline_test_sub_ms;
+
+void deadline_test_sub_cb(const request_t req)
+{
+	char req_raw[96];
+	request_t req_text,sub;
+
+	snprintf(req_raw,sizeof(req_raw),"19 submod modTo reqCode deadline=%llu",
+			(unsigned long long)(req_deadline_now_ms() + 60000));
+	req_from_string(req_raw,&req_text);
+	req_to_bin(req_text,&sub);
+	req_free(req_text);
+	_request_process(sub);
+	deadline_test_sub_ms = sub->deadline_ms;
+	req_free(sub);
+}
+
+/* deadline_test: the deadline nvpair is parsed and kept, modmgr drops the
+   requests that expired before they reach the module. */
+int deadline_test(void)
+{
+	struct _modreg_t mod;
+	modmgr_load_t load;
+	modstats_status_t list[8];
+	wchannel_t client;
+	request_t req_text,req;
+	char req_raw[96];
+	uint64_t now_ms = req_deadline_now_ms();
+	unsigned int i,count = 0,used;
+	uint64_t expired = 0;
+	int failed = 0;
+
+	snprintf(req_raw,sizeof(req_raw),"19 modFrom modTo reqCode deadline=%llu",(unsigned long long)(now_ms + 10000));
+	req_from_string(req_raw,&req_text);
+	req_to_bin(req_text,&req);
+	req_free(req_text);
+	req_deadline_parse(req);
+	failed += test_check("deadline_test","deadline nvpair is parsed",
+			req->deadline_ms == now_ms + 10000 && !req_expired(req,now_ms) && req_expired(req,now_ms + 10001));
+	req_deadline_set(req,now_ms + 20000);
+	failed += test_check("deadline_test","request keeps its earlier deadline",req->deadline_ms == now_ms + 10000);
+	req_deadline_set(req,now_ms + 5);
+	req->deadline_ms = 0;
+	req_deadline_parse(req);
+	failed += test_check("deadline_test","an earlier deadline replaces the nvpair",req->deadline_ms == now_ms + 5);
+	req_free(req);
+
+	/* the parent already expired, so does the sub-request and it isn't routed */
+	memset(&mod,0,sizeof(mod));
+	strcpy(mod.basic.name,"submod");
+	mod.communication.type = MODREG_COMM_DCR;
+	mod.communication.data.dcr.reqproc_cb = deadline_test_sub_cb;
+	snprintf(req_raw,sizeof(req_raw),"19 modFrom submod reqCode deadline=%llu",(unsigned long long)(now_ms - 1000));
+	req_from_string(req_raw,&req_text);
+	req_to_bin(req_text,&req);
+	req_free(req_text);
+	req_deadline_parse(req);
+	req_seal(req);
+	_request_deliver(&req,1,&mod);
+	failed += test_check("deadline_test","sub-requests inherit the earlier deadline",deadline_test_sub_ms == now_ms - 1000);
+	req_free(req);
+
+	memset(&load,0,sizeof(load));
+	load.receivers = 1;
+	if( modmgr_test_start(&load) != WSTATUS_SUCCESS )
+		return failed + test_check("deadline_test","load modmgr",false);
+
+	client = modmgr_test_client("48961");
+	if( client ) {
+		snprintf(req_raw,sizeof(req_raw),"20 client sink ping n=1 deadline=%llu",(unsigned long long)(now_ms - 1000));
+		wchannel_send(client,MODMGR_TEST_DEST,req_raw,strlen(req_raw)+1,&used);
+		snprintf(req_raw,sizeof(req_raw),"21 client sink ping n=2 deadline=%llu",(unsigned long long)(now_ms + 60000));
+		wchannel_send(client,MODMGR_TEST_DEST,req_raw,strlen(req_raw)+1,&used);
+	}
+
+	sink_wait(1);
+	test_sleep(20);
+	wlock_acquire(&sink_lock);
+	failed += test_check("deadline_test","expired request doesn't reach the module",
+			sink_count == 1 && !strcmp(sink_last_n,"2"));
+	wlock_release(&sink_lock);
+
+	modmgr_stats(list,8,&count);
+	for( i = 0 ; i < count ; i++ )
+		if( !strcmp(list[i].dst,"sink") && !strcmp(list[i].code,"ping") )
+			expired = list[i].expired;
+	failed += test_check("deadline_test","expired request is counted",expired == 1);
+
+	if( client )
+		wchannel_destroy(client);
+	modmgr_test_stop();
+	return failed;
+}
+
+/* uring_test: a URING channel (or the classic engine it falls back to)
+   receives a batch in order, lent buffers hold the datagrams until they're
+   given back. */
+int uring_test(void)
+{
+	wchannel_load_t wch_load;
+	wchannel_opt_t opt;
+	wchannel_t tx,rx;
+	wchannel_msg_t msg_list[3];
+	char *msg[] = { "22 client sink ping n=1", "23 client sink ping n=2", "24 client sink ping n=3" };
+	void *msg_ptr[3];
+	unsigned int i,msg_sent = 0,msg_used,msg_id[3];
+	char buffer[64];
+	bool in_order = true,lent = true,rebound = true;
+	int failed = 0;
+
+	wchannel_load(wch_load);
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = MODMGR_TEST_HOST;
+	opt.port_src = "48965";
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.engine = WCHANNEL_ENGINE_URING;
+	opt.uring_buffers = 8;
+	if( wchannel_create(&opt,&rx) != WSTATUS_SUCCESS ) {
+		wchannel_unload();
+		return test_check("uring_test","create channel",false);
+	}
+	opt.port_src = "48966";
+	if( wchannel_create(&opt,&tx) != WSTATUS_SUCCESS ) {
+		wchannel_destroy(rx);
+		wchannel_unload();
+		return test_check("uring_test","create channel",false);
+	}
+	printf("%-20s %s engine in use\n","uring_test",wchannel_engine(rx) == WCHANNEL_ENGINE_URING ? "uring" : "classic");
+
+	for( i = 0 ; i < 3 ; i++ ) {
+		msg_list[i].dest = MODMGR_TEST_HOST " 48965";
+		msg_list[i].ptr = msg[i];
+		msg_list[i].size = strlen(msg[i])+1;
+	}
+	failed += test_check("uring_test","batch is sent",
+			wchannel_send_batch(tx,msg_list,3,&msg_sent) == WSTATUS_SUCCESS && msg_sent == 3);
+
+	for( i = 0 ; (i < 3) && (msg_sent == 3) ; i++ ) {
+		if( wchannel_receive(rx,buffer,sizeof(buffer),&msg_used) != WSTATUS_SUCCESS )
+			in_order = false;
+		else if( strcmp(buffer,msg[i]) )
+			in_order = false;
+	}
+	failed += test_check("uring_test","batch is received in order",msg_sent == 3 && in_order);
+
+	/* the URING engine lends several buffers at once, the classic one one at a time */
+	for( i = 0 ; (i < 3) && (msg_sent == 3) ; i++ ) {
+		wchannel_send(tx,MODMGR_TEST_HOST " 48965",msg[i],strlen(msg[i])+1,&msg_used);
+		if( wchannel_receive_zc(rx,&msg_ptr[i],&msg_used,&msg_id[i]) != WSTATUS_SUCCESS )
+			lent = false;
+		else if( (msg_used != strlen(msg[i])+1) || memcmp(msg_ptr[i],msg[i],msg_used) )
+			lent = false;
+		if( lent && (wchannel_engine(rx) != WCHANNEL_ENGINE_URING) )
+			wchannel_receive_done(rx,msg_id[i]);
+	}
+	if( lent && (wchannel_engine(rx) == WCHANNEL_ENGINE_URING) ) {
+		for( i = 0 ; i < 3 ; i++ )
+			if( memcmp(msg_ptr[i],msg[i],strlen(msg[i])+1) )
+				lent = false;
+		for( i = 0 ; i < 3 ; i++ )
+			wchannel_receive_done(rx,msg_id[i]);
+	}
+	failed += test_check("uring_test","lent buffers hold the datagrams",msg_sent == 3 && lent);
+
+	/* the armed receive lets go of the socket before the channel is gone,
+	   the port can be bound again right away */
+	wchannel_destroy(rx);
+	opt.port_src = "48965";
+	for( i = 0 ; (i < 100) && rebound ; i++ ) {
+		opt.engine = (i % 2) ? WCHANNEL_ENGINE_CLASSIC : WCHANNEL_ENGINE_URING;
+		rebound = (wchannel_create(&opt,&rx) == WSTATUS_SUCCESS);
+		if( rebound )
+			wchannel_destroy(rx);
+	}
+	failed += test_check("uring_test","port is free once destroyed",rebound);
+
+	wchannel_destroy(tx);
+	wchannel_unload();
+	return failed;
+}
+
+/* wloop_test: counters of the loop callbacks */
+typedef struct _wloop_test_t
+{
+	unsigned int received[2];
+	unsigned int ticks;
+	unsigned int wakes;
+	unsigned int tick_id;
+	uint64_t stop_ns;
+} wloop_test_t;
+
+void wloop_test_ready_cb(wloop_t loop,wchannel_t channel,void *param)
+{
+	unsigned int *received = (unsigned int*)param;
+	char buffer[64];
+	unsigned int used;
+
+	if( wchannel_receive(channel,buffer,sizeof(buffer),&used) == WSTATUS_SUCCESS )
+		(*received)++;
+}
+
+void wloop_test_tick_cb(wloop_t loop,unsigned int timer_id,void *param)
+{
+	wloop_test_t *wt = (wloop_test_t*)param;
+
+	if( ++wt->ticks == 3 )
+		wloop_timer_cancel(loop,timer_id);
+}
+
+void wloop_test_stop_cb(wloop_t loop,unsigned int timer_id,void *param)
+{
+	wloop_test_t *wt = (wloop_test_t*)param;
+
+	wt->stop_ns = modstats_now_ns();
+	wloop_stop(loop);
+}
+
+void wloop_test_wake_cb(wloop_t loop,void *param)
+{
+	((wloop_test_t*)param)->wakes++;
+}
+
+/* wloop_test: one thread serves two channels, a periodic timer cancelled by
+   its own callback, coalesced wakeups and a timer that stops the loop. */
+int wloop_test(void)
+{
+	wchannel_load_t wch_load;
+	wloop_test_t wt;
+	wloop_t loop;
+	wchannel_t tx,rx[2];
+	unsigned int i,timer_id,used;
+	uint64_t start_ns;
+	int failed = 0;
+
+	memset(&wt,0,sizeof(wt));
+	wchannel_load(wch_load);
+	tx = modmgr_test_client("48967");
+	rx[0] = modmgr_test_client("48968");
+	rx[1] = modmgr_test_client("48969");
+	if( !tx || !rx[0] || !rx[1] || (wloop_create(wloop_test_wake_cb,&wt,&loop) != WSTATUS_SUCCESS) ) {
+		failed += test_check("wloop_test","create loop",false);
+		goto return_wch;
+	}
+
+	wloop_add(loop,rx[0],wloop_test_ready_cb,&wt.received[0]);
+	wloop_add(loop,rx[1],wloop_test_ready_cb,&wt.received[1]);
+	wchannel_send(tx,MODMGR_TEST_HOST " 48968","25 a b c",9,&used);
+	wchannel_send(tx,MODMGR_TEST_HOST " 48968","26 a b c",9,&used);
+	wchannel_send(tx,MODMGR_TEST_HOST " 48969","27 a b c",9,&used);
+	/* the timers are due from when they're armed */
+	start_ns = modstats_now_ns();
+	wloop_timer(loop,5,true,wloop_test_tick_cb,&wt,&wt.tick_id);
+	wloop_timer(loop,50,false,wloop_test_stop_cb,&wt,&timer_id);
+	wloop_wake(loop);
+	wloop_wake(loop);
+
+	wloop_run(loop);
+
+	failed += test_check("wloop_test","each ready channel is received",wt.received[0] == 2 && wt.received[1] == 1);
+	failed += test_check("wloop_test","periodic timer cancelled by its callback",wt.ticks == 3);
+	failed += test_check("wloop_test","wakeups are coalesced",wt.wakes == 1);
+	failed += test_check("wloop_test","timer doesn't run early",wt.stop_ns >= start_ns + 50*1000000ULL);
+
+	wloop_remove(loop,rx[0]);
+	wloop_remove(loop,rx[1]);
+	wloop_destroy(loop);
+
+return_wch:
+	if( tx )
+		wchannel_destroy(tx);
+	for( i = 0 ; i < 2 ; i++ )
+		if( rx[i] )
+			wchannel_destroy(rx[i]);
+	wchannel_unload();
+	return failed;
+}
+
+/* ring_test: the capture ring keeps the snapshots of the last messages */
+#define RING_TEST_MAX 8
+typedef struct _ring_test_t
+{
+	wchannel_ring_msg_t msg[RING_TEST_MAX];
+	char data[RING_TEST_MAX][16];
+	unsigned int count;
+} ring_test_t;
+
+void ring_test_cb(void *param,const wchannel_ring_msg_t *msg)
+{
+	ring_test_t *rt = (ring_test_t*)param;
+
+	if( (rt->count == RING_TEST_MAX) || (msg->snap_size > sizeof(rt->data[0])) )
+		return;
+	rt->msg[rt->count] = *msg;
+	memcpy(rt->data[rt->count],msg->ptr,msg->snap_size);
+	rt->count++;
+}
+
+/* ring_test: a ring of 4 messages keeps the last 4 sent, oldest first, cut
+   to the snapshot length. */
+int ring_test(void)
+{
+	wchannel_load_t wch_load;
+	wchannel_opt_t opt;
+	wchannel_t tx,rx;
+	wchannel_ring_status_t status;
+	ring_test_t rt;
+	char msg[32];
+	unsigned int i,used;
+	bool last = true;
+	int failed = 0;
+
+	memset(&rt,0,sizeof(rt));
+	wchannel_load(wch_load);
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = MODMGR_TEST_HOST;
+	opt.port_src = "48970";
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.ring_size = 4;
+	opt.ring_snaplen = 8;
+	rx = modmgr_test_client("48971");
+	if( !rx || (wchannel_create(&opt,&tx) != WSTATUS_SUCCESS) ) {
+		if( rx )
+			wchannel_destroy(rx);
+		wchannel_unload();
+		return test_check("ring_test","create channel",false);
+	}
+
+	for( i = 0 ; i < 6 ; i++ ) {
+		snprintf(msg,sizeof(msg),"%u a b c n=%u",28+i,i);
+		wchannel_send(tx,MODMGR_TEST_HOST " 48971",msg,strlen(msg)+1,&used);
+	}
+
+	wchannel_ring_status(tx,&status);
+	wchannel_ring_dump(tx,ring_test_cb,&rt);
+	for( i = 0 ; (i < rt.count) && (rt.count == 4) ; i++ ) {
+		snprintf(msg,sizeof(msg),"%u a b c n=%u",30+i,i+2);
+		if( (rt.msg[i].seq != i+2) || (rt.msg[i].dir != WCAPTURE_DIR_OUT) || (rt.msg[i].size != strlen(msg)+1) ||
+				(rt.msg[i].snap_size != 8) || memcmp(rt.data[i],msg,8) )
+			last = false;
+	}
+	failed += test_check("ring_test","every message is recorded",status.recorded == 6 && status.entries == 4);
+	failed += test_check("ring_test","ring keeps the last messages, oldest first",rt.count == 4 && last);
+
+	wchannel_destroy(tx);
+	wchannel_destroy(rx);
+	wchannel_unload();
+	return failed;
+}
+
+/* gso_test: a batch sent with segmentation offload is received as the same
+   datagrams, in order, also when the kernel coalesces them (gro). */
+#define GSO_TEST_COUNT 12
+int gso_test(void)
+{
+	wchannel_load_t wch_load;
+	wchannel_opt_t opt;
+	wchannel_t tx,rx;
+	wchannel_msg_t msg_list[GSO_TEST_COUNT];
+	char msg[GSO_TEST_COUNT][48],buffer[64];
+	unsigned int i,msg_sent = 0,used;
+	bool in_order = true;
+	int failed = 0;
+
+	wchannel_load(wch_load);
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = MODMGR_TEST_HOST;
+	opt.port_src = "48972";
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.gro = true;
+	if( wchannel_create(&opt,&rx) != WSTATUS_SUCCESS ) {
+		wchannel_unload();
+		return test_check("gso_test","create channel",false);
+	}
+	opt.port_src = "48973";
+	opt.gro = false;
+	opt.gso = true;
+	if( wchannel_create(&opt,&tx) != WSTATUS_SUCCESS ) {
+		wchannel_destroy(rx);
+		wchannel_unload();
+		return test_check("gso_test","create channel",false);
+	}
+	printf("%-20s offloads gso=%d gro=%d\n","gso_test",
+			(wchannel_offload(tx) & WCHANNEL_OFFLOAD_GSO) != 0,(wchannel_offload(rx) & WCHANNEL_OFFLOAD_GRO) != 0);
+
+	/* a run of 8 messages of the same size, then messages of other sizes */
+	for( i = 0 ; i < GSO_TEST_COUNT ; i++ ) {
+		if( i < 8 )
+			snprintf(msg[i],sizeof(msg[i]),"%u client sink ping",40+i);
+		else
+			snprintf(msg[i],sizeof(msg[i]),"%u client sink ping n=%.*s",40+i,(int)i,"xxxxxxxxxxxx");
+		msg_list[i].dest = MODMGR_TEST_HOST " 48972";
+		msg_list[i].ptr = msg[i];
+		msg_list[i].size = strlen(msg[i])+1;
+	}
+	wchannel_send_batch(tx,msg_list,GSO_TEST_COUNT,&msg_sent);
+
+	for( i = 0 ; (i < GSO_TEST_COUNT) && (msg_sent == GSO_TEST_COUNT) ; i++ ) {
+		memset(buffer,0,sizeof(buffer));
+		if( (wchannel_receive(rx,buffer,sizeof(buffer),&used) != WSTATUS_SUCCESS) ||
+				(used != strlen(msg[i])+1) || strcmp(buffer,msg[i]) )
+			in_order = false;
+	}
+	failed += test_check("gso_test","batch is sent",msg_sent == GSO_TEST_COUNT);
+	failed += test_check("gso_test","datagrams keep their boundaries and order",
+			msg_sent == GSO_TEST_COUNT && in_order && !wchannel_pending(rx));
+
+	wchannel_destroy(tx);
+	wchannel_destroy(rx);
+	wchannel_unload();
+	return failed;
+}
+
+/* test_receive: receives one message of channel waiting up to
+   timeout_ms, the checks don't block when a datagram never arrives (no
+   route for a multicast group, a message given up). */
+typedef struct _test_msg_t
+{
+	char buffer[256];
+	unsigned int used;
+	bool received;
+} test_msg_t;
+
+void test_receive_cb(wloop_t loop,wchannel_t channel,void *param)
+{
+	test_msg_t *msg = (test_msg_t*)param;
+
+	memset(msg->buffer,0,sizeof(msg->buffer));
+	if( wchannel_receive(channel,msg->buffer,sizeof(msg->buffer)-1,&msg->used) == WSTATUS_SUCCESS )
+		msg->received = true;
+	/* a single message, the loop calls again at once while more are pending */
+	wloop_stop(loop);
+}
+
+bool test_receive(wchannel_t channel,test_msg_t *msg,int timeout_ms)
+{
+	wloop_t loop;
+	int i;
+
+	msg->received = false;
+	if( wloop_create(0,0,&loop) != WSTATUS_SUCCESS )
+		return false;
+	wloop_add(loop,channel,test_receive_cb,msg);
+	for( i = 0 ; (i < timeout_ms/10) && !msg->received ; i++ )
+		wloop_run_once(loop,10);
+	wloop_remove(loop,channel);
+	wloop_destroy(loop);
+	return msg->received;
+}
+
+/* mcast_test: a request sent to a multicast module reaches every member
+   joined on the loopback, modmgr collects the reply of each one. */
+#define MCAST_TEST_GROUP "239.255.42.2"
+#define MCAST_TEST_PORT "48974"
+int mcast_test(void)
+{
+	modmgr_load_t load;
+	struct _modreg_t reg;
+	wchannel_opt_t opt;
+	wchannel_t member[2] = { 0, 0 },requester = 0;
+	test_msg_t msg;
+	modcast_reply_t reply_list[4];
+	char *member_name[] = { "ap1", "ap2" };
+	char reply[64];
+	unsigned int i,used,count = 0,replies = 0;
+	bool complete = false,reached = true;
+	int id,failed = 0;
+
+	memset(&load,0,sizeof(load));
+	load.receivers = 1;
+	load.mcast_loop = true;
+	load.mcast_if = "lo";
+	if( modmgr_test_start(&load) != WSTATUS_SUCCESS )
+		return test_check("mcast_test","load modmgr",false);
+
+	memset(&reg,0,sizeof(reg));
+	strcpy(reg.basic.name,"requester");
+	reg.communication.type = MODREG_COMM_SSR;
+	strcpy(reg.communication.data.ssr.host,MODMGR_TEST_HOST);
+	strcpy(reg.communication.data.ssr.port,"48975");
+	modmgr_register(&reg);
+
+	memset(&reg,0,sizeof(reg));
+	strcpy(reg.basic.name,"apgroup");
+	reg.communication.type = MODREG_COMM_MCAST;
+	strcpy(reg.communication.data.mcast.host,MCAST_TEST_GROUP);
+	strcpy(reg.communication.data.mcast.port,MCAST_TEST_PORT);
+	reg.communication.data.mcast.reply_timeout_ms = 500;
+	modmgr_register(&reg);
+	modmgr_mcast_join("apgroup","ap1");
+	modmgr_mcast_join("apgroup","ap2");
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = "0.0.0.0";
+	opt.port_src = MCAST_TEST_PORT;
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.reuse_port = true;
+	for( i = 0 ; i < 2 ; i++ )
+		if( (wchannel_create(&opt,&member[i]) != WSTATUS_SUCCESS) ||
+				(wchannel_mcast_join(member[i],MCAST_TEST_GROUP,"lo") != WSTATUS_SUCCESS) )
+			reached = false;
+	requester = modmgr_test_client("48975");
+
+	if( reached && requester )
+		wchannel_send(requester,MODMGR_TEST_DEST,"60 requester apgroup ping x=1",30,&used);
+
+	for( i = 0 ; (i < 2) && reached && requester ; i++ ) {
+		if( !test_receive(member[i],&msg,1000) || (sscanf(msg.buffer,"%d",&id) != 1) || (id != 60) ) {
+			reached = false;
+			break;
+		}
+		snprintf(reply,sizeof(reply),"%dR %s requester pong y=2",id,member_name[i]);
+		wchannel_send(member[i],MODMGR_TEST_DEST,reply,strlen(reply)+1,&used);
+	}
+	failed += test_check("mcast_test","every member gets the request",reached && requester);
+
+	for( i = 0 ; (i < 2) && reached && requester ; i++ )
+		if( test_receive(requester,&msg,1000) && strstr(msg.buffer,"pong") )
+			replies++;
+	modmgr_mcast_collect("apgroup",60,"requester",reply_list,4,&count,&complete);
+	failed += test_check("mcast_test","replies of both members are collected",
+			replies == 2 && count == 2 && complete && reply_list[0].replied && reply_list[1].replied);
+
+	for( i = 0 ; i < 2 ; i++ )
+		if( member[i] ) {
+			wchannel_mcast_leave(member[i],MCAST_TEST_GROUP,"lo");
+			wchannel_destroy(member[i]);
+		}
+	if( requester )
+		wchannel_destroy(requester);
+	modmgr_test_stop();
+	return failed;
+}
+
+/* reliable_test: a sequence sent with 10% of the datagrams lost arrives
+   once and in order, a reader that falls behind keeps its messages, a peer
+   that doesn't answer fills its window without holding the others. */
+#define RELIABLE_TEST_COUNT 100
+int reliable_test(void)
+{
+	wchannel_load_t wch_load;
+	wchannel_opt_t opt;
+	wchannel_t sender = 0,receiver = 0;
+	wrel_status_t status[4];
+	test_msg_t msg;
+	char text[32];
+	unsigned int i,used,count,sent = 0,in_order = 0;
+	unsigned long gen = 0,retransmits = 0,failed_msgs = 0,received = 0;
+	bool full = false;
+	wstatus ws;
+	int failed = 0;
+
+	memset(&wch_load,0,sizeof(wch_load));
+	wchannel_load(wch_load);
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = "127.0.0.1";
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.reliable = true;
+	opt.reliable_loss = 10;
+	opt.port_src = "48976";
+	if( wchannel_create(&opt,&sender) != WSTATUS_SUCCESS )
+		sender = 0;
+	opt.port_src = "48977";
+	if( wchannel_create(&opt,&receiver) != WSTATUS_SUCCESS )
+		receiver = 0;
+	if( !sender || !receiver ) {
+		failed += test_check("reliable_test","create channels",false);
+		goto end;
+	}
+
+	/* the sender keeps the message while the window is full, the receiver
+	   takes what arrived meanwhile so the window opens */
+	for( i = 0 ; i < RELIABLE_TEST_COUNT ; i++ ) {
+		snprintf(text,sizeof(text),"%u",i);
+		while( (ws = wchannel_send(sender,"127.0.0.1 48977",text,strlen(text)+1,&used)) == WSTATUS_AGAIN ) {
+			while( test_receive(receiver,&msg,10) && (strtoul(msg.buffer,0,10) == in_order) )
+				in_order++;
+			wchannel_reliable_wait(sender,&gen,100000);
+		}
+		if( ws != WSTATUS_SUCCESS )
+			break;
+		sent++;
+	}
+	while( (in_order < sent) && test_receive(receiver,&msg,2000) && (strtoul(msg.buffer,0,10) == in_order) )
+		in_order++;
+	failed += test_check("reliable_test","lossy sequence received in order",
+			sent == RELIABLE_TEST_COUNT && in_order == RELIABLE_TEST_COUNT);
+	failed += test_check("reliable_test","nothing received twice",!test_receive(receiver,&msg,50));
+
+	wchannel_reliable_status(sender,status,4,&count);
+	for( i = 0 ; i < count ; i++ )
+		if( !strcmp(status[i].peer,"127.0.0.1 48977") ) {
+			retransmits = status[i].retransmits;
+			failed_msgs = status[i].failed;
+		}
+	wchannel_reliable_status(receiver,status,4,&count);
+	for( i = 0 ; i < count ; i++ )
+		if( !strcmp(status[i].peer,"127.0.0.1 48976") )
+			received = status[i].received;
+	failed += test_check("reliable_test","losses recovered by retransmits",
+			retransmits > 0 && failed_msgs == 0 && received == RELIABLE_TEST_COUNT);
+
+	/* a receiver that doesn't read for a while answers the PROBEs, it keeps
+	   the messages of a full window */
+	for( count = 0 ; count < WREL_WINDOW ; count++ ) {
+		snprintf(text,sizeof(text),"%u",RELIABLE_TEST_COUNT+count);
+		for( i = 0 ; (i < 20) && ((ws = wchannel_send(sender,"127.0.0.1 48977",text,strlen(text)+1,&used)) == WSTATUS_AGAIN) ; i++ )
+			wchannel_reliable_wait(sender,&gen,100000);
+		if( ws != WSTATUS_SUCCESS )
+			break;
+	}
+	/* once acknowledged the sender is stuck at the limit and probes */
+	test_sleep(50);
+	full = (wchannel_send(sender,"127.0.0.1 48977","x",2,&used) == WSTATUS_AGAIN);
+	test_sleep(200);
+	if( wchannel_send(sender,"127.0.0.1 48977","x",2,&used) != WSTATUS_AGAIN )
+		full = false;
+	for( i = 0 ; i < count ; i++ )
+		if( !test_receive(receiver,&msg,2000) || (strtoul(msg.buffer,0,10) != RELIABLE_TEST_COUNT+i) )
+			break;
+	failed += test_check("reliable_test","a slow reader isn't given up",full && count == WREL_WINDOW && i == count);
+	full = false;
+
+	/* nobody acknowledges on 48978, the window fills up */
+	for( i = 0 ; i <= WREL_WINDOW ; i++ )
+		if( wchannel_send(sender,"127.0.0.1 48978","x",2,&used) == WSTATUS_AGAIN ) {
+			full = true;
+			break;
+		}
+	failed += test_check("reliable_test","window of a silent peer fills up",full && i == WREL_WINDOW);
+	for( i = 0 ; (i < 20) && ((ws = wchannel_send(sender,"127.0.0.1 48977","live",5,&used)) == WSTATUS_AGAIN) ; i++ )
+		wchannel_reliable_wait(sender,&gen,100000);
+	failed += test_check("reliable_test","other peers aren't held",
+			ws == WSTATUS_SUCCESS && test_receive(receiver,&msg,2000) && !strcmp(msg.buffer,"live"));
+
+end:
+	if( sender )
+		wchannel_destroy(sender);
+	if( receiver )
+		wchannel_destroy(receiver);
+	wchannel_unload();
+	return failed;
+}
+
+/* deferred_test: the requests to an SSR module that doesn't read wait in
+   its deferred queue without holding another module, and arrive in order
+   once it reads. */
+#define DEFERRED_TEST_COUNT (WREL_WINDOW + 16)
+int deferred_test(void)
+{
+	modmgr_load_t load;
+	struct _modreg_t reg;
+	wchannel_opt_t opt;
+	wchannel_t slow = 0,fast = 0,client;
+	test_msg_t msg;
+	char req_raw[64];
+	unsigned int i,used,in_order = 0;
+	bool fast_sent = false;
+	int failed = 0;
+
+	memset(&load,0,sizeof(load));
+	load.receivers = 1;
+	load.reliable = true;
+	load.admission.burst = 1000;
+	if( modmgr_test_start(&load) != WSTATUS_SUCCESS )
+		return test_check("deferred_test","load modmgr",false);
+
+	memset(&opt,0,sizeof(opt));
+	opt.type = WCHANNEL_TYPE_SOCKUDP;
+	opt.host_src = MODMGR_TEST_HOST;
+	opt.debug_opts = WCHANNEL_NO_DEBUG;
+	opt.reliable = true;
+	opt.port_src = "48979";
+	if( wchannel_create(&opt,&slow) != WSTATUS_SUCCESS )
+		slow = 0;
+	opt.port_src = "48980";
+	if( wchannel_create(&opt,&fast) != WSTATUS_SUCCESS )
+		fast = 0;
+	client = modmgr_test_client("48981");
+
+	memset(&reg,0,sizeof(reg));
+	strcpy(reg.basic.name,"slowmod");
+	reg.communication.type = MODREG_COMM_SSR;
+	strcpy(reg.communication.data.ssr.host,MODMGR_TEST_HOST);
+	strcpy(reg.communication.data.ssr.port,"48979");
+	modmgr_register(&reg);
+	strcpy(reg.basic.name,"fastmod");
+	strcpy(reg.communication.data.ssr.port,"48980");
+	modmgr_register(&reg);
+
+	if( slow && fast && client ) {
+		for( i = 1 ; i <= DEFERRED_TEST_COUNT ; i++ ) {
+			snprintf(req_raw,sizeof(req_raw),"%u client slowmod ping n=%u",i,i);
+			wchannel_send(client,MODMGR_TEST_DEST,req_raw,strlen(req_raw)+1,&used);
+		}
+		wchannel_send(client,MODMGR_TEST_DEST,"999 client fastmod ping n=0",28,&used);
+		fast_sent = test_receive(fast,&msg,2000) && strstr(msg.buffer,"fastmod");
+	}
+	failed += test_check("deferred_test","a module with a full window doesn't hold the others",fast_sent);
+
+	for( i = 1 ; fast_sent && (i <= DEFERRED_TEST_COUNT) ; i++ ) {
+		snprintf(req_raw,sizeof(req_raw),"%u client slowmod ping n=%u",i,i);
+		if( !test_receive(slow,&msg,2000) || strcmp(msg.buffer,req_raw) )
+			break;
+		in_order++;
+	}
+	failed += test_check("deferred_test","deferred requests arrive in order",in_order == DEFERRED_TEST_COUNT);
+
+	if( client )
+		wchannel_destroy(client);
+	if( fast )
+		wchannel_destroy(fast);
+	if( slow )
+		wchannel_destroy(slow);
+	modmgr_test_stop();
+	return failed;
+}
+
 int main(int argc,char *argv[])
 {
 	wstatus s;
 	wview_load_t load;
 	char buffer[32];
+	int failed = 0;
+	struct _jmlist_init_params init = { .flags = 0, .fverbose = 0, .fdump = stdout, .fdebug = 0 };
 
+	debug_set_mask(DEBUG_MASK_NONE);
 	req_validation_test();
 
+	jmlist_initialize(&init);
+
+	failed += nvblob_test();
+	failed += sealed_test();
+	failed += nvinline_test();
+	failed += stream_test();
+	failed += schema_test();
+	failed += reqids_test();
+	failed += encoded_nv_test();
+	failed += capture_test();
+	failed += admctl_test();
+	failed += modsched_test();
+	failed += batch_test();
+	failed += inbox_test();
+	failed += bus_test();
+	failed += stats_test();
+	failed += group_test();
+	failed += receivers_test();
+	failed += peers_test();
+	failed += shmring_test();
+	failed += deadline_test();
+	failed += uring_test();
+	failed += wloop_test();
+	failed += ring_test();
+	failed += gso_test();
+	failed += mcast_test();
+	failed += reliable_test();
+	failed += deferred_test();
+
+	jmlist_uninitialize();
+	if( failed ) {
+		printf("%d check(s) failed\n",failed);
+		return EXIT_FAILURE;
+	}
+
 	//request_test();
 
 	//wchannel_test();
@@ -0,0 +1,91 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Event loop of wchannel: a single thread waits for many channels (UDP,
+   PIPE, whatever has a wchannel_fd), for timers and for wakeups from other
+   threads, and calls a callback for each of them. It replaces a blocked
+   thread per channel and the dummy messages that were sent to a channel
+   just to wake its thread.
+
+   Channels are added with a ready callback (wloop_add), called by the loop
+   thread whenever the channel has something to receive. The readiness is
+   level-triggered, the callback should receive once (the receive doesn't
+   wait then) and it's called again on the next iteration while there's
+   more, or right away while the channel has datagrams pending (gro, see
+   wchannel_pending). A channel must be removed (wloop_remove) before it's
+   destroyed.
+
+   Timers (wloop_timer) call their callback once after timeout_ms, or every
+   timeout_ms when periodic, until cancelled. Their resolution is the
+   millisecond, they never run early.
+
+   wloop_wake can be called by any thread, the loop thread calls the wake
+   callback of the loop once for any number of wakeups since the last call
+   (a thread that queued work for the loop thread wakes it up this way).
+   wloop_stop can also be called by any thread, wloop_run returns as soon
+   as the callback running (if any) returns.
+
+   Callbacks run in the loop thread without any lock held, they may add and
+   remove channels and timers (removing the channel or the timer being
+   called included) and stop the loop. Every other function may be called
+   by any thread.
+
+   Example of usage:
+
+   wloop_t loop;
+
+   ws = wloop_create(0,0,&loop);
+   ws = wloop_add(loop,wch,on_ready,ctx);
+   ws = wloop_timer(loop,1000,true,on_tick,ctx,&timer_id);
+   ws = wloop_run(loop);		(returns after wloop_stop)
+   wloop_remove(loop,wch);
+   wloop_destroy(loop);
+
+*/
+
+#ifndef _WLOOP_H
+#define _WLOOP_H
+
+#include <stdbool.h>
+#include "wstatus.h"
+#include "wchannel.h"
+
+#define WLOOP_EVENTS 32			/* events taken by one wait */
+
+typedef struct _wloop_t *wloop_t;
+
+typedef void (*WLOOPREADYCB)(wloop_t loop,wchannel_t channel,void *param);
+typedef void (*WLOOPTIMERCB)(wloop_t loop,unsigned int timer_id,void *param);
+typedef void (*WLOOPWAKECB)(wloop_t loop,void *param);
+
+wstatus wloop_create(WLOOPWAKECB wake_cb,void *param,wloop_t *loop);
+wstatus wloop_add(wloop_t loop,wchannel_t channel,WLOOPREADYCB ready_cb,void *param);
+wstatus wloop_remove(wloop_t loop,wchannel_t channel);
+wstatus wloop_timer(wloop_t loop,unsigned int timeout_ms,bool periodic,WLOOPTIMERCB timer_cb,void *param,unsigned int *timer_id);
+wstatus wloop_timer_cancel(wloop_t loop,unsigned int timer_id);
+wstatus wloop_wake(wloop_t loop);
+wstatus wloop_run(wloop_t loop);
+wstatus wloop_run_once(wloop_t loop,int timeout_ms);
+wstatus wloop_stop(wloop_t loop);
+wstatus wloop_destroy(wloop_t loop);
+
+#endif
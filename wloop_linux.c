@@ -0,0 +1,675 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+/* epoll and eventfd are Linux interfaces */
+#define _GNU_SOURCE
+
+#include "posh.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "watomic.h"
+#include "wchannel.h"
+#include "wloop.h"
+
+#define WLOOP_EVENT_KEY UINT64_MAX		/* epoll key of the eventfd */
+
+typedef struct _wloop_watch_t
+{
+	bool used;
+	uint32_t generation;		/* changes when the slot is reused */
+	wchannel_t channel;
+	int fd;
+	WLOOPREADYCB ready_cb;
+	void *param;
+} wloop_watch_t;
+
+typedef struct _wloop_timer_t
+{
+	unsigned int id;
+	uint64_t due_ns;
+	uint64_t period_ns;			/* 0 for a one-shot timer */
+	WLOOPTIMERCB timer_cb;
+	void *param;
+} wloop_timer_t;
+
+struct _wloop_t
+{
+	int epoll_fd;
+	int event_fd;				/* wakeups, stop and new timers */
+	wlock_t lock;				/* protects the watch and the timer lists */
+	WLOOPWAKECB wake_cb;
+	void *wake_param;
+	volatile long wake_pending;
+	volatile bool stopping;
+	wloop_watch_t *watch_list;
+	unsigned int watch_size;
+	wloop_timer_t *timer_list;
+	unsigned int timer_count;
+	unsigned int timer_size;
+	unsigned int timer_next_id;
+};
+
+/*
+   _wloop_now_ns
+
+   Helper function that returns the monotonic clock in nanoseconds.
+*/
+static uint64_t
+_wloop_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+   _wloop_signal
+
+   Helper function that makes the eventfd readable, the loop thread returns
+   from its wait.
+*/
+static wstatus
+_wloop_signal(wloop_t loop)
+{
+	uint64_t one = 1;
+
+	if( write(loop->event_fd,&one,sizeof(one)) < 0 ) {
+		dbgprint(MOD_WLOOP,__func__,"(loop=%p) failed to write to the eventfd (%s)",loop,strerror(errno));
+		return WSTATUS_FAILURE;
+	}
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wloop_create
+
+   Creates a new event loop, wake_cb (may be 0) is called by the loop thread
+   after wloop_wake with param.
+*/
+wstatus
+wloop_create(WLOOPWAKECB wake_cb,void *param,wloop_t *loop)
+{
+	wloop_t new_loop;
+	struct epoll_event ev;
+
+	dbgprint(MOD_WLOOP,__func__,"called with wake_cb=%p, param=%p, loop=%p",wake_cb,param,loop);
+
+	if( !loop ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid loop argument (loop=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_loop = (wloop_t)malloc(sizeof(struct _wloop_t));
+	if( !new_loop ) {
+		dbgprint(MOD_WLOOP,__func__,"malloc failed (size=%u)",(unsigned int)sizeof(struct _wloop_t));
+		goto return_fail;
+	}
+	memset(new_loop,0,sizeof(struct _wloop_t));
+	new_loop->wake_cb = wake_cb;
+	new_loop->wake_param = param;
+	new_loop->timer_next_id = 1;
+	new_loop->event_fd = -1;
+
+	new_loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if( new_loop->epoll_fd < 0 ) {
+		dbgprint(MOD_WLOOP,__func__,"epoll_create1 failed (%s)",strerror(errno));
+		goto return_fail_loop;
+	}
+
+	new_loop->event_fd = eventfd(0,EFD_CLOEXEC | EFD_NONBLOCK);
+	if( new_loop->event_fd < 0 ) {
+		dbgprint(MOD_WLOOP,__func__,"eventfd failed (%s)",strerror(errno));
+		goto return_fail_epoll;
+	}
+
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = WLOOP_EVENT_KEY;
+	if( epoll_ctl(new_loop->epoll_fd,EPOLL_CTL_ADD,new_loop->event_fd,&ev) < 0 ) {
+		dbgprint(MOD_WLOOP,__func__,"failed to add the eventfd (%s)",strerror(errno));
+		goto return_fail_eventfd;
+	}
+
+	if( wlock_create(&new_loop->lock) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WLOOP,__func__,"failed to create the loop lock");
+		goto return_fail_eventfd;
+	}
+
+	dbgprint(MOD_WLOOP,__func__,"created loop %p (epoll fd=%d, eventfd=%d)",
+			new_loop,new_loop->epoll_fd,new_loop->event_fd);
+	*loop = new_loop;
+	DBGRET_SUCCESS(MOD_WLOOP);
+
+return_fail_eventfd:
+	close(new_loop->event_fd);
+return_fail_epoll:
+	close(new_loop->epoll_fd);
+return_fail_loop:
+	free(new_loop);
+return_fail:
+	DBGRET_FAILURE(MOD_WLOOP);
+}
+
+/*
+   wloop_add
+
+   Adds a channel to the loop, ready_cb is called with param by the loop
+   thread whenever the channel has something to receive. A channel can be
+   added once to a loop.
+*/
+wstatus
+wloop_add(wloop_t loop,wchannel_t channel,WLOOPREADYCB ready_cb,void *param)
+{
+	wloop_watch_t *watch,*new_list;
+	struct epoll_event ev;
+	unsigned int i,slot,new_size;
+	int fd;
+
+	dbgprint(MOD_WLOOP,__func__,"called with loop=%p, channel=%p, ready_cb=%p, param=%p",
+			loop,channel,ready_cb,param);
+
+	if( !loop || !channel || !ready_cb ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	fd = wchannel_fd(channel);
+	if( fd < 0 ) {
+		dbgprint(MOD_WLOOP,__func__,"(loop=%p) channel %p has no descriptor",loop,channel);
+		return WSTATUS_UNSUPPORTED;
+	}
+
+	wlock_acquire(&loop->lock);
+
+	slot = loop->watch_size;
+	for( i = 0 ; i < loop->watch_size ; i++ )
+	{
+		if( !loop->watch_list[i].used ) {
+			if( slot == loop->watch_size )
+				slot = i;
+			continue;
+		}
+		if( loop->watch_list[i].channel == channel ) {
+			dbgprint(MOD_WLOOP,__func__,"(loop=%p) channel %p was added already",loop,channel);
+			goto return_fail_lock;
+		}
+	}
+
+	if( slot == loop->watch_size )
+	{
+		new_size = loop->watch_size ? loop->watch_size * 2 : 4;
+		new_list = (wloop_watch_t*)realloc(loop->watch_list,sizeof(wloop_watch_t)*new_size);
+		if( !new_list ) {
+			dbgprint(MOD_WLOOP,__func__,"(loop=%p) realloc failed (size=%u)",loop,new_size);
+			goto return_fail_lock;
+		}
+		memset(new_list + loop->watch_size,0,sizeof(wloop_watch_t)*(new_size - loop->watch_size));
+		loop->watch_list = new_list;
+		loop->watch_size = new_size;
+	}
+
+	watch = &loop->watch_list[slot];
+
+	/* level-triggered, the loop calls ready_cb while there's something */
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = ((uint64_t)(watch->generation + 1) << 32) | slot;
+	if( epoll_ctl(loop->epoll_fd,EPOLL_CTL_ADD,fd,&ev) < 0 ) {
+		dbgprint(MOD_WLOOP,__func__,"(loop=%p) failed to add fd=%d (%s)",loop,fd,strerror(errno));
+		goto return_fail_lock;
+	}
+
+	watch->used = true;
+	watch->generation++;
+	watch->channel = channel;
+	watch->fd = fd;
+	watch->ready_cb = ready_cb;
+	watch->param = param;
+
+	wlock_release(&loop->lock);
+	dbgprint(MOD_WLOOP,__func__,"(loop=%p) added channel %p (fd=%d) in slot %u",loop,channel,fd,slot);
+	DBGRET_SUCCESS(MOD_WLOOP);
+
+return_fail_lock:
+	wlock_release(&loop->lock);
+	DBGRET_FAILURE(MOD_WLOOP);
+}
+
+/*
+   wloop_remove
+
+   Removes a channel from the loop, its ready callback isn't called after
+   this returns (unless it's running, when called from another thread).
+*/
+wstatus
+wloop_remove(wloop_t loop,wchannel_t channel)
+{
+	wloop_watch_t *watch;
+	unsigned int i;
+
+	dbgprint(MOD_WLOOP,__func__,"called with loop=%p, channel=%p",loop,channel);
+
+	if( !loop || !channel ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&loop->lock);
+
+	for( i = 0 ; i < loop->watch_size ; i++ )
+	{
+		watch = &loop->watch_list[i];
+		if( !watch->used || (watch->channel != channel) )
+			continue;
+
+		if( epoll_ctl(loop->epoll_fd,EPOLL_CTL_DEL,watch->fd,0) < 0 )
+			dbgprint(MOD_WLOOP,__func__,"(loop=%p) failed to remove fd=%d (%s)",loop,watch->fd,strerror(errno));
+
+		/* events of this slot already taken by the loop are skipped */
+		watch->used = false;
+		watch->channel = 0;
+		wlock_release(&loop->lock);
+		DBGRET_SUCCESS(MOD_WLOOP);
+	}
+
+	wlock_release(&loop->lock);
+	dbgprint(MOD_WLOOP,__func__,"(loop=%p) channel %p isn't in the loop",loop,channel);
+	DBGRET_FAILURE(MOD_WLOOP);
+}
+
+/*
+   wloop_timer
+
+   Adds a timer, timer_cb is called with param by the loop thread after
+   timeout_ms (and every timeout_ms if periodic). timer_id (if not 0) is
+   updated with the id of the timer, for wloop_timer_cancel.
+*/
+wstatus
+wloop_timer(wloop_t loop,unsigned int timeout_ms,bool periodic,WLOOPTIMERCB timer_cb,void *param,unsigned int *timer_id)
+{
+	wloop_timer_t *timer,*new_list;
+	unsigned int new_size;
+
+	dbgprint(MOD_WLOOP,__func__,"called with loop=%p, timeout_ms=%u, periodic=%d, timer_cb=%p, param=%p",
+			loop,timeout_ms,periodic,timer_cb,param);
+
+	if( !loop || !timer_cb || (periodic && !timeout_ms) ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&loop->lock);
+
+	if( loop->timer_count == loop->timer_size )
+	{
+		new_size = loop->timer_size ? loop->timer_size * 2 : 4;
+		new_list = (wloop_timer_t*)realloc(loop->timer_list,sizeof(wloop_timer_t)*new_size);
+		if( !new_list ) {
+			wlock_release(&loop->lock);
+			dbgprint(MOD_WLOOP,__func__,"(loop=%p) realloc failed (size=%u)",loop,new_size);
+			DBGRET_FAILURE(MOD_WLOOP);
+		}
+		loop->timer_list = new_list;
+		loop->timer_size = new_size;
+	}
+
+	timer = &loop->timer_list[loop->timer_count++];
+	timer->id = loop->timer_next_id++;
+	if( !loop->timer_next_id )
+		loop->timer_next_id = 1;
+	timer->period_ns = periodic ? (uint64_t)timeout_ms * 1000000ULL : 0;
+	timer->due_ns = _wloop_now_ns() + (uint64_t)timeout_ms * 1000000ULL;
+	timer->timer_cb = timer_cb;
+	timer->param = param;
+
+	if( timer_id )
+		*timer_id = timer->id;
+
+	wlock_release(&loop->lock);
+
+	/* the loop may be waiting with a timeout computed before this timer */
+	_wloop_signal(loop);
+
+	DBGRET_SUCCESS(MOD_WLOOP);
+}
+
+/*
+   wloop_timer_cancel
+
+   Cancels a timer, its callback isn't called after this returns (unless
+   it's running, when called from another thread). Fails if the timer
+   doesn't exist (a one-shot timer that was called doesn't).
+*/
+wstatus
+wloop_timer_cancel(wloop_t loop,unsigned int timer_id)
+{
+	unsigned int i;
+
+	dbgprint(MOD_WLOOP,__func__,"called with loop=%p, timer_id=%u",loop,timer_id);
+
+	if( !loop || !timer_id ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&loop->lock);
+
+	for( i = 0 ; i < loop->timer_count ; i++ )
+	{
+		if( loop->timer_list[i].id != timer_id )
+			continue;
+
+		loop->timer_list[i] = loop->timer_list[--loop->timer_count];
+		wlock_release(&loop->lock);
+		DBGRET_SUCCESS(MOD_WLOOP);
+	}
+
+	wlock_release(&loop->lock);
+	dbgprint(MOD_WLOOP,__func__,"(loop=%p) timer %u doesn't exist",loop,timer_id);
+	DBGRET_FAILURE(MOD_WLOOP);
+}
+
+/*
+   wloop_wake
+
+   Wakes the loop thread, it calls the wake callback. Wakeups are merged,
+   only the first since the last call of the callback writes to the eventfd.
+*/
+wstatus
+wloop_wake(wloop_t loop)
+{
+	if( !loop ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid loop argument (loop=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( !watomic_cas(&loop->wake_pending,0,1) )
+		return WSTATUS_SUCCESS;
+
+	return _wloop_signal(loop);
+}
+
+/*
+   _wloop_timeout
+
+   Helper function that returns the timeout of the wait, the time left for
+   the next timer (rounded up to the millisecond, timers never run early)
+   if it's shorter than timeout_ms.
+*/
+static int
+_wloop_timeout(wloop_t loop,int timeout_ms)
+{
+	uint64_t now,next = UINT64_MAX,left;
+	unsigned int i;
+
+	wlock_acquire(&loop->lock);
+	for( i = 0 ; i < loop->timer_count ; i++ ) {
+		if( loop->timer_list[i].due_ns < next )
+			next = loop->timer_list[i].due_ns;
+	}
+	wlock_release(&loop->lock);
+
+	if( next == UINT64_MAX )
+		return timeout_ms;
+
+	now = _wloop_now_ns();
+	if( next <= now )
+		return 0;
+
+	left = (next - now + 999999ULL) / 1000000ULL;
+	if( left > INT32_MAX )
+		left = INT32_MAX;
+
+	if( (timeout_ms >= 0) && ((uint64_t)timeout_ms < left) )
+		return timeout_ms;
+	return (int)left;
+}
+
+/*
+   _wloop_timers
+
+   Helper function that calls the timers due. Periodic timers are moved to
+   their next period (skipping the periods that were missed), one-shot timers
+   are removed before their callback is called.
+*/
+static void
+_wloop_timers(wloop_t loop)
+{
+	wloop_timer_t due;
+	uint64_t now;
+	unsigned int i,first;
+
+	now = _wloop_now_ns();
+
+	while( !loop->stopping )
+	{
+		wlock_acquire(&loop->lock);
+
+		first = loop->timer_count;
+		for( i = 0 ; i < loop->timer_count ; i++ ) {
+			if( (loop->timer_list[i].due_ns <= now) &&
+					((first == loop->timer_count) || (loop->timer_list[i].due_ns < loop->timer_list[first].due_ns)) )
+				first = i;
+		}
+
+		if( first == loop->timer_count ) {
+			wlock_release(&loop->lock);
+			return;
+		}
+
+		due = loop->timer_list[first];
+		if( due.period_ns ) {
+			loop->timer_list[first].due_ns += due.period_ns;
+			if( loop->timer_list[first].due_ns <= now )
+				loop->timer_list[first].due_ns = now + due.period_ns;
+		} else {
+			loop->timer_list[first] = loop->timer_list[--loop->timer_count];
+		}
+
+		wlock_release(&loop->lock);
+
+		due.timer_cb(loop,due.id,due.param);
+	}
+}
+
+/*
+   _wloop_ready
+
+   Helper function that calls the ready callback of the channel of the epoll
+   key, if it's still in the loop: the slot may have been removed (and even
+   reused) by a callback called before in this iteration. The callback is
+   called again while the channel has datagrams pending (wchannel_pending),
+   the descriptor doesn't poll readable for them.
+*/
+static void
+_wloop_ready(wloop_t loop,uint64_t key)
+{
+	wloop_watch_t *watch;
+	unsigned int slot = (unsigned int)(key & 0xFFFFFFFF);
+	uint32_t generation = (uint32_t)(key >> 32);
+	WLOOPREADYCB ready_cb;
+	wchannel_t channel;
+	void *param;
+	bool again = false;
+
+	for(;;)
+	{
+		wlock_acquire(&loop->lock);
+
+		if( slot >= loop->watch_size ) {
+			wlock_release(&loop->lock);
+			return;
+		}
+
+		watch = &loop->watch_list[slot];
+		if( !watch->used || (watch->generation != generation) ) {
+			wlock_release(&loop->lock);
+			return;
+		}
+
+		ready_cb = watch->ready_cb;
+		channel = watch->channel;
+		param = watch->param;
+
+		wlock_release(&loop->lock);
+
+		if( again && !wchannel_pending(channel) )
+			return;
+
+		ready_cb(loop,channel,param);
+		if( loop->stopping )
+			return;
+		again = true;
+	}
+}
+
+/*
+   wloop_run_once
+
+   Waits up to timeout_ms (-1 waits until something happens, 0 doesn't
+   wait) for the channels, the timers and the wakeups of the loop and calls
+   the callbacks of those ready. Returns failure if the wait fails.
+*/
+wstatus
+wloop_run_once(wloop_t loop,int timeout_ms)
+{
+	struct epoll_event ev_list[WLOOP_EVENTS];
+	uint64_t value;
+	int i,count;
+
+	if( !loop ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid loop argument (loop=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	count = epoll_wait(loop->epoll_fd,ev_list,WLOOP_EVENTS,_wloop_timeout(loop,timeout_ms));
+	if( count < 0 ) {
+		if( errno == EINTR )
+			return WSTATUS_SUCCESS;
+		dbgprint(MOD_WLOOP,__func__,"(loop=%p) epoll_wait failed (%s)",loop,strerror(errno));
+		DBGRET_FAILURE(MOD_WLOOP);
+	}
+
+	for( i = 0 ; (i < count) && !loop->stopping ; i++ )
+	{
+		if( ev_list[i].data.u64 != WLOOP_EVENT_KEY ) {
+			_wloop_ready(loop,ev_list[i].data.u64);
+			continue;
+		}
+
+		/* nonblocking, it was readable */
+		if( read(loop->event_fd,&value,sizeof(value)) < 0 )
+			dbgprint(MOD_WLOOP,__func__,"(loop=%p) failed to read the eventfd (%s)",loop,strerror(errno));
+
+		if( watomic_cas(&loop->wake_pending,1,0) && loop->wake_cb )
+			loop->wake_cb(loop,loop->wake_param);
+	}
+
+	_wloop_timers(loop);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wloop_run
+
+   Runs the loop in the calling thread until wloop_stop is called.
+*/
+wstatus
+wloop_run(wloop_t loop)
+{
+	wstatus ws;
+
+	dbgprint(MOD_WLOOP,__func__,"called with loop=%p",loop);
+
+	if( !loop ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid loop argument (loop=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	while( !loop->stopping )
+	{
+		ws = wloop_run_once(loop,-1);
+		if( ws != WSTATUS_SUCCESS )
+			return ws;
+	}
+
+	dbgprint(MOD_WLOOP,__func__,"(loop=%p) loop was stopped",loop);
+	DBGRET_SUCCESS(MOD_WLOOP);
+}
+
+/*
+   wloop_stop
+
+   Stops the loop, wloop_run returns once the callback running (if any)
+   returns, and right away from then on.
+*/
+wstatus
+wloop_stop(wloop_t loop)
+{
+	dbgprint(MOD_WLOOP,__func__,"called with loop=%p",loop);
+
+	if( !loop ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid loop argument (loop=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	loop->stopping = true;
+	watomic_barrier();
+	return _wloop_signal(loop);
+}
+
+/*
+   wloop_destroy
+
+   Destroys the loop, it must not be running. The channels still in the loop
+   aren't destroyed (nor shut down).
+*/
+wstatus
+wloop_destroy(wloop_t loop)
+{
+	dbgprint(MOD_WLOOP,__func__,"called with loop=%p",loop);
+
+	if( !loop ) {
+		dbgprint(MOD_WLOOP,__func__,"invalid loop argument (loop=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	close(loop->event_fd);
+	close(loop->epoll_fd);
+	wlock_free(&loop->lock);
+	if( loop->watch_list )
+		free(loop->watch_list);
+	if( loop->timer_list )
+		free(loop->timer_list);
+	free(loop);
+
+	DBGRET_SUCCESS(MOD_WLOOP);
+}
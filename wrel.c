@@ -0,0 +1,1093 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <time.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "wlock.h"
+#include "wrel.h"
+
+#define WREL_MAGIC 0xFF
+#define WREL_VERSION 1
+#define WREL_TYPE_DATA 1
+#define WREL_TYPE_ACK 2
+#define WREL_TYPE_PROBE 3
+#define WREL_ACK_SIZE 24
+#define WREL_PROBE_SIZE 8
+#define WREL_BUCKETS 64
+#define WREL_KEYSIZE 24
+
+#define WREL_SEQ_LT(a,b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
+
+/* message in flight (tx) or kept until delivered (rx) */
+typedef struct _wrel_slot_t
+{
+	bool used;
+	bool acked;							/* tx: in sack, the buffer is freed */
+	bool fast;							/* tx: sent again for a hole in sack, until its timeout */
+	uint32_t seq;
+	void *ptr;							/* tx: header and message, rx: message */
+	unsigned int size;
+	unsigned int tries;
+	uint64_t sent_ns;
+	uint64_t due_ns;
+} wrel_slot_t;
+
+typedef struct _wrel_peer_t
+{
+	unsigned char key[WREL_KEYSIZE];	/* family, port and address */
+	unsigned int key_len;
+	struct sockaddr_storage addr;
+	unsigned int addr_len;
+	/* sender */
+	uint32_t tx_epoch;
+	uint32_t tx_next;					/* seq of the next message */
+	uint32_t tx_una;					/* first seq not acknowledged */
+	uint32_t tx_limit;					/* first seq the peer has no room for */
+	bool tx_blocked;					/* a send stopped at tx_limit */
+	uint64_t probe_ns;					/* next PROBE, 0 if none */
+	unsigned int probes;				/* sent without answer */
+	uint64_t srtt_us;
+	uint64_t rttvar_us;
+	uint64_t rto_us;
+	wrel_slot_t tx[WREL_WINDOW];
+	/* receiver */
+	bool rx_open;
+	uint32_t rx_epoch;
+	uint32_t rx_next;					/* first seq not received */
+	uint32_t rx_deliver;				/* first seq not delivered */
+	uint32_t rx_adv;					/* limit of the last ACK */
+	wrel_slot_t rx[WREL_WINDOW];
+	bool in_ready;
+	struct _wrel_peer_t *ready_next;
+	struct _wrel_peer_t *next;			/* bucket chain */
+	/* counters, see wrel_status_t */
+	unsigned long sent;
+	unsigned long retransmits;
+	unsigned long failed;
+	unsigned long received;
+	unsigned long duplicates;
+	unsigned long dropped;
+} wrel_peer_t;
+
+/* datagram without header, delivered as it arrived */
+typedef struct _wrel_plain_t
+{
+	struct _wrel_plain_t *next;
+	unsigned int size;
+	char data[];
+} wrel_plain_t;
+
+struct _wrel_t
+{
+	wrel_opt_t opt;
+	unsigned int window;
+	unsigned int retries;
+	unsigned int seed;					/* of the loss injection */
+	wlock_t lock;
+	wrel_peer_t *buckets[WREL_BUCKETS];
+	wrel_peer_t *ready_head;			/* peers with messages to deliver, in turn */
+	wrel_peer_t *ready_tail;
+	wrel_plain_t *plain_head;
+	wrel_plain_t *plain_tail;
+	unsigned int plain_count;
+	bool plain_turn;					/* next delivery is a plain datagram */
+	bool signaled;						/* WREL_EVENT_READY was sent */
+	void *held;							/* last message delivered */
+	uint64_t next_due_ns;				/* earliest deadline known by wrel_poll, 0 if none */
+};
+
+/*
+   _wrel_now_ns
+
+   Helper function that returns the monotonic clock in nanoseconds.
+*/
+static uint64_t
+_wrel_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+   _wrel_epoch
+
+   Helper function that returns a new epoch for a peer, the wall clock in
+   milliseconds and always after the previous one.
+*/
+static uint32_t
+_wrel_epoch(uint32_t previous)
+{
+	struct timespec ts;
+	uint32_t epoch;
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+	epoch = (uint32_t)((uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL);
+	if( previous && !WREL_SEQ_LT(previous,epoch) )
+		epoch = previous + 1;
+	return epoch;
+}
+
+static void
+_wrel_put32(unsigned char *ptr,uint32_t value)
+{
+	ptr[0] = (unsigned char)(value >> 24);
+	ptr[1] = (unsigned char)(value >> 16);
+	ptr[2] = (unsigned char)(value >> 8);
+	ptr[3] = (unsigned char)value;
+}
+
+static uint32_t
+_wrel_get32(const unsigned char *ptr)
+{
+	return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | (uint32_t)ptr[3];
+}
+
+/*
+   _wrel_header
+
+   Helper function that writes the first 8 bytes of a datagram.
+*/
+static void
+_wrel_header(unsigned char *ptr,unsigned int type,uint32_t epoch)
+{
+	ptr[0] = WREL_MAGIC;
+	ptr[1] = (unsigned char)((WREL_VERSION << 4) | type);
+	ptr[2] = 0;
+	ptr[3] = 0;
+	_wrel_put32(ptr + 4,epoch);
+}
+
+/*
+   _wrel_key
+
+   Helper function that builds the key of a peer from its address, the parts
+   of the sockaddr that identify it (the rest may have garbage).
+*/
+static void
+_wrel_key(const void *addr,unsigned int addr_len,unsigned char *key,unsigned int *key_len)
+{
+	const struct sockaddr *sa = (const struct sockaddr *)addr;
+	const struct sockaddr_in *sin;
+	const struct sockaddr_in6 *sin6;
+
+	memset(key,0,WREL_KEYSIZE);
+	key[0] = (unsigned char)sa->sa_family;
+
+	if( (sa->sa_family == AF_INET) && (addr_len >= sizeof(struct sockaddr_in)) ) {
+		sin = (const struct sockaddr_in *)addr;
+		memcpy(key + 1,&sin->sin_port,2);
+		memcpy(key + 3,&sin->sin_addr,4);
+		*key_len = 7;
+	} else if( (sa->sa_family == AF_INET6) && (addr_len >= sizeof(struct sockaddr_in6)) ) {
+		sin6 = (const struct sockaddr_in6 *)addr;
+		memcpy(key + 1,&sin6->sin6_port,2);
+		memcpy(key + 3,&sin6->sin6_addr,16);
+		memcpy(key + 19,&sin6->sin6_scope_id,4);
+		*key_len = 23;
+	} else {
+		*key_len = addr_len < WREL_KEYSIZE ? addr_len : WREL_KEYSIZE;
+		memcpy(key,addr,*key_len);
+	}
+}
+
+/*
+   _wrel_peer
+
+   Helper function that returns the peer of an address, a new one is
+   created when create is set. Returns 0 if there's none (or no memory).
+*/
+static wrel_peer_t *
+_wrel_peer(wrel_t rel,const void *addr,unsigned int addr_len,bool create)
+{
+	unsigned char key[WREL_KEYSIZE];
+	unsigned int key_len,i;
+	uint32_t hash = 2166136261u;
+	wrel_peer_t *peer;
+
+	_wrel_key(addr,addr_len,key,&key_len);
+	for( i = 0 ; i < key_len ; i++ )
+		hash = (hash ^ key[i]) * 16777619u;
+	hash %= WREL_BUCKETS;
+
+	for( peer = rel->buckets[hash] ; peer ; peer = peer->next )
+		if( (peer->key_len == key_len) && !memcmp(peer->key,key,key_len) )
+			return peer;
+
+	if( !create || (addr_len > sizeof(peer->addr)) )
+		return 0;
+
+	peer = (wrel_peer_t*)malloc(sizeof(wrel_peer_t));
+	if( !peer ) {
+		dbgprint(MOD_WREL,__func__,"malloc failed");
+		return 0;
+	}
+	memset(peer,0,sizeof(wrel_peer_t));
+	memcpy(peer->key,key,sizeof(key));
+	peer->key_len = key_len;
+	memcpy(&peer->addr,addr,addr_len);
+	peer->addr_len = addr_len;
+	peer->tx_epoch = _wrel_epoch(0);
+	peer->tx_limit = rel->window;
+	peer->rto_us = WREL_RTO_INITIAL_MS * 1000ULL;
+
+	peer->next = rel->buckets[hash];
+	rel->buckets[hash] = peer;
+	return peer;
+}
+
+/*
+   _wrel_xmit
+
+   Helper function that sends a datagram to a peer, unless loss injection
+   drops it.
+*/
+static void
+_wrel_xmit(wrel_t rel,wrel_peer_t *peer,const void *ptr,unsigned int size)
+{
+	if( rel->opt.loss && ((unsigned int)(rand_r(&rel->seed) % 100) < rel->opt.loss) ) {
+		peer->dropped++;
+		return;
+	}
+
+	rel->opt.xmit_cb(rel->opt.param,&peer->addr,peer->addr_len,ptr,size);
+}
+
+static void
+_wrel_event(wrel_t rel,wrel_event_list event)
+{
+	if( rel->opt.event_cb )
+		rel->opt.event_cb(rel->opt.param,event);
+}
+
+/*
+   _wrel_ack
+
+   Helper function that sends the ACK of the messages received from a peer,
+   with the room it has for more.
+*/
+static void
+_wrel_ack(wrel_t rel,wrel_peer_t *peer)
+{
+	unsigned char ack[WREL_ACK_SIZE];
+	uint64_t sack = 0;
+	wrel_slot_t *slot;
+	uint32_t seq;
+	unsigned int i;
+
+	for( i = 0 ; i < 64 ; i++ ) {
+		seq = peer->rx_next + 1 + i;
+		if( (seq - peer->rx_deliver) >= rel->window )
+			break;
+		slot = &peer->rx[seq % rel->window];
+		if( slot->used && (slot->seq == seq) )
+			sack |= 1ULL << i;
+	}
+
+	peer->rx_adv = peer->rx_deliver + rel->window;
+
+	_wrel_header(ack,WREL_TYPE_ACK,peer->rx_epoch);
+	_wrel_put32(ack + 8,peer->rx_next);
+	_wrel_put32(ack + 12,peer->rx_adv);
+	_wrel_put32(ack + 16,(uint32_t)(sack >> 32));
+	_wrel_put32(ack + 20,(uint32_t)sack);
+
+	_wrel_xmit(rel,peer,ack,sizeof(ack));
+}
+
+/*
+   _wrel_rtt
+
+   Helper function that updates the round trip time of a peer with a
+   measure and computes its timeout (RFC 6298).
+*/
+static void
+_wrel_rtt(wrel_peer_t *peer,uint64_t rtt_us)
+{
+	uint64_t diff;
+
+	if( !peer->srtt_us ) {
+		peer->srtt_us = rtt_us ? rtt_us : 1;
+		peer->rttvar_us = rtt_us / 2;
+	} else {
+		diff = peer->srtt_us > rtt_us ? peer->srtt_us - rtt_us : rtt_us - peer->srtt_us;
+		peer->rttvar_us = (3 * peer->rttvar_us + diff) / 4;
+		peer->srtt_us = (7 * peer->srtt_us + rtt_us) / 8;
+	}
+
+	peer->rto_us = peer->srtt_us + (4 * peer->rttvar_us > 1000 ? 4 * peer->rttvar_us : 1000);
+	if( peer->rto_us < WREL_RTO_MIN_MS * 1000ULL )
+		peer->rto_us = WREL_RTO_MIN_MS * 1000ULL;
+	if( peer->rto_us > WREL_RTO_MAX_MS * 1000ULL )
+		peer->rto_us = WREL_RTO_MAX_MS * 1000ULL;
+}
+
+/*
+   _wrel_tx_reset
+
+   Helper function that gives a peer up: the messages waiting for their ACK
+   are dropped and the next ones start a new epoch.
+*/
+static void
+_wrel_tx_reset(wrel_t rel,wrel_peer_t *peer)
+{
+	unsigned int i;
+
+	for( i = 0 ; i < rel->window ; i++ ) {
+		if( peer->tx[i].used && !peer->tx[i].acked )
+			peer->failed++;
+		free(peer->tx[i].ptr);
+		memset(&peer->tx[i],0,sizeof(wrel_slot_t));
+	}
+
+	dbgprint(MOD_WREL,__func__,"gave up peer %p after %u tries, %lu messages failed so far",
+			peer,rel->retries,peer->failed);
+
+	peer->tx_epoch = _wrel_epoch(peer->tx_epoch);
+	peer->tx_next = 0;
+	peer->tx_una = 0;
+	peer->tx_limit = rel->window;
+	peer->tx_blocked = false;
+	peer->probe_ns = 0;
+	peer->probes = 0;
+	peer->srtt_us = 0;
+	peer->rttvar_us = 0;
+	peer->rto_us = WREL_RTO_INITIAL_MS * 1000ULL;
+}
+
+/*
+   _wrel_rx_reset
+
+   Helper function that starts receiving a new epoch of a peer, the messages
+   of the old one that weren't delivered are dropped.
+*/
+static void
+_wrel_rx_reset(wrel_t rel,wrel_peer_t *peer,uint32_t epoch)
+{
+	unsigned int i;
+
+	for( i = 0 ; i < rel->window ; i++ ) {
+		free(peer->rx[i].ptr);
+		memset(&peer->rx[i],0,sizeof(wrel_slot_t));
+	}
+
+	peer->rx_open = true;
+	peer->rx_epoch = epoch;
+	peer->rx_next = 0;
+	peer->rx_deliver = 0;
+	peer->rx_adv = 0;
+}
+
+/*
+   _wrel_resend
+
+   Helper function that sends a message in flight again.
+*/
+static void
+_wrel_resend(wrel_t rel,wrel_peer_t *peer,wrel_slot_t *slot,uint64_t now_ns,uint64_t timeout_us)
+{
+	slot->tries++;
+	slot->sent_ns = now_ns;
+	slot->due_ns = now_ns + timeout_us * 1000ULL;
+	peer->retransmits++;
+	_wrel_xmit(rel,peer,slot->ptr,slot->size);
+}
+
+/*
+   _wrel_ready_add
+
+   Helper function that puts a peer at the end of the delivery turn and
+   tells the owner when there was nothing to deliver.
+*/
+static void
+_wrel_ready_add(wrel_t rel,wrel_peer_t *peer)
+{
+	if( peer )
+	{
+		peer->in_ready = true;
+		peer->ready_next = 0;
+		if( rel->ready_tail )
+			rel->ready_tail->ready_next = peer;
+		else
+			rel->ready_head = peer;
+		rel->ready_tail = peer;
+	}
+
+	if( !rel->signaled ) {
+		rel->signaled = true;
+		_wrel_event(rel,WREL_EVENT_READY);
+	}
+}
+
+/*
+   _wrel_input_data
+
+   Helper function that keeps a message received from a peer until it's
+   delivered, in order, and acknowledges it.
+*/
+static void
+_wrel_input_data(wrel_t rel,wrel_peer_t *peer,const unsigned char *ptr,unsigned int size)
+{
+	uint32_t epoch,seq;
+	wrel_slot_t *slot;
+
+	epoch = _wrel_get32(ptr + 4);
+	seq = _wrel_get32(ptr + 8);
+
+	if( !peer->rx_open || WREL_SEQ_LT(peer->rx_epoch,epoch) )
+		_wrel_rx_reset(rel,peer,epoch);
+	else if( epoch != peer->rx_epoch )
+		return;		/* of an epoch already over */
+
+	if( WREL_SEQ_LT(seq,peer->rx_next) ) {
+		peer->duplicates++;
+		_wrel_ack(rel,peer);
+		return;
+	}
+
+	/* no room, the sender didn't get the limit yet */
+	if( (seq - peer->rx_deliver) >= rel->window ) {
+		_wrel_ack(rel,peer);
+		return;
+	}
+
+	slot = &peer->rx[seq % rel->window];
+	if( slot->used ) {
+		peer->duplicates++;
+		_wrel_ack(rel,peer);
+		return;
+	}
+
+	size -= WREL_DATA_SIZE;
+	slot->ptr = malloc(size ? size : 1);
+	if( !slot->ptr ) {
+		/* not acknowledged, it's sent again */
+		dbgprint(MOD_WREL,__func__,"malloc failed (size=%u)",size);
+		return;
+	}
+	memcpy(slot->ptr,ptr + WREL_DATA_SIZE,size);
+	slot->size = size;
+	slot->seq = seq;
+	slot->used = true;
+	peer->received++;
+
+	while( peer->rx[peer->rx_next % rel->window].used &&
+			(peer->rx[peer->rx_next % rel->window].seq == peer->rx_next) )
+		peer->rx_next++;
+
+	if( (peer->rx_next != peer->rx_deliver) && !peer->in_ready )
+		_wrel_ready_add(rel,peer);
+
+	_wrel_ack(rel,peer);
+}
+
+/*
+   _wrel_input_ack
+
+   Helper function that frees the messages a peer acknowledged, measures the
+   round trip and sends again the ones sack shows as missing.
+*/
+static void
+_wrel_input_ack(wrel_t rel,wrel_peer_t *peer,const unsigned char *ptr)
+{
+	wrel_slot_t *slot,*last = 0;
+	uint32_t ack,limit,seq;
+	uint64_t sack,now_ns,sample_ns = 0;
+	bool changed = false;
+	unsigned int i;
+
+	if( _wrel_get32(ptr + 4) != peer->tx_epoch )
+		return;
+
+	/* the peer answers, a full window is a slow reader not a dead one */
+	peer->probes = 0;
+
+	ack = _wrel_get32(ptr + 8);
+	limit = _wrel_get32(ptr + 12);
+	sack = ((uint64_t)_wrel_get32(ptr + 16) << 32) | _wrel_get32(ptr + 20);
+	now_ns = _wrel_now_ns();
+
+	if( WREL_SEQ_LT(peer->tx_una,ack) && !WREL_SEQ_LT(peer->tx_next,ack) )
+	{
+		for( seq = peer->tx_una ; seq != ack ; seq++ ) {
+			slot = &peer->tx[seq % rel->window];
+			if( !slot->acked && (slot->tries == 1) && (slot->sent_ns > sample_ns) )
+				sample_ns = slot->sent_ns;
+			free(slot->ptr);
+			memset(slot,0,sizeof(wrel_slot_t));
+		}
+		peer->tx_una = ack;
+		changed = true;
+	}
+
+	for( i = 0 ; sack && (i < 64) ; i++ )
+	{
+		if( !(sack & (1ULL << i)) )
+			continue;
+		seq = ack + 1 + i;
+		if( WREL_SEQ_LT(seq,peer->tx_una) || !WREL_SEQ_LT(seq,peer->tx_next) )
+			continue;
+
+		slot = &peer->tx[seq % rel->window];
+		last = slot;
+		if( !slot->used || slot->acked )
+			continue;
+		if( (slot->tries == 1) && (slot->sent_ns > sample_ns) )
+			sample_ns = slot->sent_ns;
+		free(slot->ptr);
+		slot->ptr = 0;
+		slot->acked = true;
+		changed = true;
+	}
+
+	/* Karn: only messages acknowledged at their first send are measured, the
+	   last one sent (the others may have waited for a lost ACK) */
+	if( sample_ns )
+		_wrel_rtt(peer,(now_ns - sample_ns) / 1000);
+
+	if( WREL_SEQ_LT(peer->tx_limit,limit) ) {
+		peer->tx_limit = limit;
+		peer->probe_ns = 0;
+		peer->probes = 0;
+		changed = true;
+	}
+
+	/* the messages sent before one that arrived are missing */
+	if( last )
+	{
+		for( seq = peer->tx_una ; WREL_SEQ_LT(seq,last->seq) ; seq++ ) {
+			slot = &peer->tx[seq % rel->window];
+			if( slot->used && !slot->acked && !slot->fast && (slot->sent_ns < last->sent_ns) ) {
+				slot->fast = true;
+				_wrel_resend(rel,peer,slot,now_ns,peer->rto_us);
+			}
+		}
+	}
+
+	if( changed )
+		_wrel_event(rel,WREL_EVENT_WINDOW);
+}
+
+/*
+   wrel_create
+
+   Creates the reliable layer of a channel, opt.xmit_cb is required.
+*/
+wstatus
+wrel_create(const wrel_opt_t *opt,wrel_t *rel)
+{
+	wrel_t new_rel;
+
+	dbgprint(MOD_WREL,__func__,"called with opt=%p, rel=%p",opt,rel);
+
+	if( !opt || !opt->xmit_cb || !rel || (opt->window > WREL_WINDOW) || (opt->loss > 100) ) {
+		dbgprint(MOD_WREL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_rel = (wrel_t)malloc(sizeof(struct _wrel_t));
+	if( !new_rel ) {
+		dbgprint(MOD_WREL,__func__,"malloc failed");
+		DBGRET_FAILURE(MOD_WREL);
+	}
+	memset(new_rel,0,sizeof(struct _wrel_t));
+
+	new_rel->opt = *opt;
+	new_rel->window = opt->window ? opt->window : WREL_WINDOW;
+	new_rel->retries = opt->retries ? opt->retries : WREL_RETRIES;
+	new_rel->seed = (unsigned int)_wrel_now_ns();
+
+	if( wlock_create(&new_rel->lock) != WSTATUS_SUCCESS ) {
+		dbgprint(MOD_WREL,__func__,"failed to create lock");
+		free(new_rel);
+		DBGRET_FAILURE(MOD_WREL);
+	}
+
+	*rel = new_rel;
+	DBGRET_SUCCESS(MOD_WREL);
+}
+
+/*
+   wrel_destroy
+
+   Destroys the layer, the messages in flight and the ones not delivered are
+   dropped.
+*/
+wstatus
+wrel_destroy(wrel_t rel)
+{
+	wrel_peer_t *peer,*next_peer;
+	wrel_plain_t *plain,*next_plain;
+	unsigned int i,j;
+
+	dbgprint(MOD_WREL,__func__,"called with rel=%p",rel);
+
+	if( !rel ) {
+		dbgprint(MOD_WREL,__func__,"invalid rel argument (rel=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	for( i = 0 ; i < WREL_BUCKETS ; i++ ) {
+		for( peer = rel->buckets[i] ; peer ; peer = next_peer ) {
+			next_peer = peer->next;
+			for( j = 0 ; j < WREL_WINDOW ; j++ ) {
+				free(peer->tx[j].ptr);
+				free(peer->rx[j].ptr);
+			}
+			free(peer);
+		}
+	}
+
+	for( plain = rel->plain_head ; plain ; plain = next_plain ) {
+		next_plain = plain->next;
+		free(plain);
+	}
+
+	free(rel->held);
+	wlock_free(&rel->lock);
+	free(rel);
+	DBGRET_SUCCESS(MOD_WREL);
+}
+
+/*
+   wrel_send
+
+   Sends a message to the peer at addr. Returns WSTATUS_AGAIN when the
+   window of the peer is full (window messages waiting for their ACK, or
+   the limit of the receiver reached), WREL_EVENT_WINDOW tells when to try
+   again. The message is copied, it's kept until acknowledged.
+*/
+wstatus
+wrel_send(wrel_t rel,const void *addr,unsigned int addr_len,const void *ptr,unsigned int size)
+{
+	wrel_peer_t *peer;
+	wrel_slot_t *slot;
+	unsigned char *buf;
+	uint64_t now_ns;
+
+	if( !rel || !addr || !addr_len || (!ptr && size) || (size > WREL_MAX_MESSAGE) ) {
+		dbgprint(MOD_WREL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&rel->lock);
+
+	peer = _wrel_peer(rel,addr,addr_len,true);
+	if( !peer ) {
+		wlock_release(&rel->lock);
+		DBGRET_FAILURE(MOD_WREL);
+	}
+
+	now_ns = _wrel_now_ns();
+
+	if( (peer->tx_next - peer->tx_una) >= rel->window ) {
+		wlock_release(&rel->lock);
+		return WSTATUS_AGAIN;
+	}
+
+	if( !WREL_SEQ_LT(peer->tx_next,peer->tx_limit) )
+	{
+		/* with nothing in flight only a PROBE gets the limit again */
+		peer->tx_blocked = true;
+		if( !peer->probe_ns ) {
+			peer->probe_ns = now_ns + peer->rto_us * 1000ULL;
+			if( !rel->next_due_ns || (peer->probe_ns < rel->next_due_ns) ) {
+				rel->next_due_ns = peer->probe_ns;
+				_wrel_event(rel,WREL_EVENT_TIMER);
+			}
+		}
+		wlock_release(&rel->lock);
+		return WSTATUS_AGAIN;
+	}
+
+	buf = (unsigned char*)malloc(WREL_DATA_SIZE + size);
+	if( !buf ) {
+		wlock_release(&rel->lock);
+		dbgprint(MOD_WREL,__func__,"malloc failed (size=%u)",WREL_DATA_SIZE + size);
+		DBGRET_FAILURE(MOD_WREL);
+	}
+	_wrel_header(buf,WREL_TYPE_DATA,peer->tx_epoch);
+	_wrel_put32(buf + 8,peer->tx_next);
+	if( size )
+		memcpy(buf + WREL_DATA_SIZE,ptr,size);
+
+	slot = &peer->tx[peer->tx_next % rel->window];
+	slot->used = true;
+	slot->acked = false;
+	slot->fast = false;
+	slot->seq = peer->tx_next;
+	slot->ptr = buf;
+	slot->size = WREL_DATA_SIZE + size;
+	slot->tries = 1;
+	slot->sent_ns = now_ns;
+	slot->due_ns = now_ns + peer->rto_us * 1000ULL;
+
+	peer->tx_next++;
+	peer->tx_blocked = false;
+	peer->sent++;
+	_wrel_xmit(rel,peer,buf,slot->size);
+
+	if( !rel->next_due_ns || (slot->due_ns < rel->next_due_ns) ) {
+		rel->next_due_ns = slot->due_ns;
+		_wrel_event(rel,WREL_EVENT_TIMER);
+	}
+
+	wlock_release(&rel->lock);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wrel_input
+
+   Handles a datagram received from addr: a message is kept until delivered
+   and acknowledged, an ACK frees the messages in flight. Datagrams without
+   the header are queued as they are (up to WREL_PLAIN_MAX). Returns
+   WSTATUS_INVALID_ARGUMENT for a truncated header.
+*/
+wstatus
+wrel_input(wrel_t rel,const void *addr,unsigned int addr_len,const void *ptr,unsigned int size)
+{
+	const unsigned char *data = (const unsigned char *)ptr;
+	wrel_plain_t *plain;
+	wrel_peer_t *peer;
+	unsigned int type;
+
+	if( !rel || !addr || !addr_len || !ptr ) {
+		dbgprint(MOD_WREL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&rel->lock);
+
+	if( (size < WREL_PROBE_SIZE) || (data[0] != WREL_MAGIC) || ((data[1] >> 4) != WREL_VERSION) )
+	{
+		if( rel->plain_count >= WREL_PLAIN_MAX ) {
+			wlock_release(&rel->lock);
+			dbgprint(MOD_WREL,__func__,"too many datagrams without header, dropping one");
+			return WSTATUS_SUCCESS;
+		}
+
+		plain = (wrel_plain_t*)malloc(sizeof(wrel_plain_t) + size);
+		if( !plain ) {
+			wlock_release(&rel->lock);
+			dbgprint(MOD_WREL,__func__,"malloc failed (size=%u)",size);
+			DBGRET_FAILURE(MOD_WREL);
+		}
+		plain->next = 0;
+		plain->size = size;
+		memcpy(plain->data,ptr,size);
+		if( rel->plain_tail )
+			rel->plain_tail->next = plain;
+		else
+			rel->plain_head = plain;
+		rel->plain_tail = plain;
+		rel->plain_count++;
+
+		_wrel_ready_add(rel,0);
+		wlock_release(&rel->lock);
+		return WSTATUS_SUCCESS;
+	}
+
+	type = data[1] & 0x0F;
+	if( ((type == WREL_TYPE_DATA) && (size < WREL_DATA_SIZE)) || ((type == WREL_TYPE_ACK) && (size < WREL_ACK_SIZE)) ) {
+		wlock_release(&rel->lock);
+		dbgprint(MOD_WREL,__func__,"truncated datagram (type=%u, size=%u)",type,size);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	peer = _wrel_peer(rel,addr,addr_len,type == WREL_TYPE_DATA);
+	if( peer )
+	{
+		switch( type )
+		{
+			case WREL_TYPE_DATA:
+				_wrel_input_data(rel,peer,data,size);
+				break;
+			case WREL_TYPE_ACK:
+				_wrel_input_ack(rel,peer,data);
+				break;
+			case WREL_TYPE_PROBE:
+				if( peer->rx_open && (_wrel_get32(data + 4) == peer->rx_epoch) )
+					_wrel_ack(rel,peer);
+				break;
+			default:
+				dbgprint(MOD_WREL,__func__,"unknown datagram type %u",type);
+				break;
+		}
+	}
+
+	wlock_release(&rel->lock);
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wrel_deliver
+
+   Returns the next message received, the peers take turns (and the
+   datagrams without header). The message belongs to the module, it's valid
+   until the next wrel_deliver. Fails when there's none.
+*/
+wstatus
+wrel_deliver(wrel_t rel,void **ptr,unsigned int *size)
+{
+	wrel_plain_t *plain;
+	wrel_peer_t *peer;
+	wrel_slot_t *slot;
+	bool delivered = false;
+
+	if( !rel || !ptr || !size ) {
+		dbgprint(MOD_WREL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&rel->lock);
+
+	free(rel->held);
+	rel->held = 0;
+
+	/* peers whose epoch restarted may have nothing left */
+	while( rel->ready_head && (rel->ready_head->rx_deliver == rel->ready_head->rx_next) ) {
+		peer = rel->ready_head;
+		rel->ready_head = peer->ready_next;
+		if( !rel->ready_head )
+			rel->ready_tail = 0;
+		peer->in_ready = false;
+		peer->ready_next = 0;
+	}
+
+	if( rel->plain_head && (rel->plain_turn || !rel->ready_head) )
+	{
+		plain = rel->plain_head;
+		rel->plain_head = plain->next;
+		if( !rel->plain_head )
+			rel->plain_tail = 0;
+		rel->plain_count--;
+
+		rel->held = plain;
+		*ptr = plain->data;
+		*size = plain->size;
+		rel->plain_turn = false;
+		delivered = true;
+	}
+	else if( rel->ready_head )
+	{
+		peer = rel->ready_head;
+		rel->ready_head = peer->ready_next;
+		if( !rel->ready_head )
+			rel->ready_tail = 0;
+		peer->in_ready = false;
+		peer->ready_next = 0;
+
+		slot = &peer->rx[peer->rx_deliver % rel->window];
+		rel->held = slot->ptr;
+		*ptr = slot->ptr;
+		*size = slot->size;
+		memset(slot,0,sizeof(wrel_slot_t));
+		peer->rx_deliver++;
+		rel->plain_turn = true;
+		delivered = true;
+
+		if( peer->rx_deliver != peer->rx_next )
+			_wrel_ready_add(rel,peer);
+
+		/* announce the room when half the window was freed since the last ACK */
+		if( (peer->rx_deliver + rel->window - peer->rx_adv) >= (rel->window + 1) / 2 )
+			_wrel_ack(rel,peer);
+	}
+
+	if( !rel->ready_head && !rel->plain_head && rel->signaled ) {
+		rel->signaled = false;
+		_wrel_event(rel,WREL_EVENT_EMPTY);
+	}
+
+	wlock_release(&rel->lock);
+	return delivered ? WSTATUS_SUCCESS : WSTATUS_FAILURE;
+}
+
+/*
+   wrel_ready
+
+   Returns true if wrel_deliver has a message.
+*/
+bool
+wrel_ready(wrel_t rel)
+{
+	bool ready;
+
+	if( !rel )
+		return false;
+
+	wlock_acquire(&rel->lock);
+	ready = rel->signaled;
+	wlock_release(&rel->lock);
+
+	return ready;
+}
+
+/*
+   wrel_poll
+
+   Sends again the messages whose timeout expired (and the PROBEs due) and
+   gives up the peers that didn't answer. Returns the milliseconds until the
+   next deadline, -1 if there's none.
+*/
+int
+wrel_poll(wrel_t rel)
+{
+	unsigned char probe[WREL_PROBE_SIZE];
+	uint64_t now_ns,next_ns = 0,backoff_us;
+	wrel_peer_t *peer;
+	wrel_slot_t *slot;
+	unsigned int i;
+	uint32_t seq;
+	bool reset;
+
+	if( !rel )
+		return -1;
+
+	wlock_acquire(&rel->lock);
+
+	now_ns = _wrel_now_ns();
+
+	for( i = 0 ; i < WREL_BUCKETS ; i++ )
+	{
+		for( peer = rel->buckets[i] ; peer ; peer = peer->next )
+		{
+			reset = false;
+			for( seq = peer->tx_una ; seq != peer->tx_next ; seq++ )
+			{
+				slot = &peer->tx[seq % rel->window];
+				if( !slot->used || slot->acked )
+					continue;
+
+				if( slot->due_ns <= now_ns )
+				{
+					if( slot->tries >= rel->retries ) {
+						reset = true;
+						break;
+					}
+					backoff_us = peer->rto_us << slot->tries;
+					if( backoff_us > WREL_RTO_MAX_MS * 1000ULL )
+						backoff_us = WREL_RTO_MAX_MS * 1000ULL;
+					slot->fast = false;
+					_wrel_resend(rel,peer,slot,now_ns,backoff_us);
+				}
+
+				if( !next_ns || (slot->due_ns < next_ns) )
+					next_ns = slot->due_ns;
+			}
+
+			if( !reset && peer->tx_blocked && (peer->tx_una == peer->tx_next) && peer->probe_ns )
+			{
+				if( peer->probe_ns <= now_ns )
+				{
+					if( peer->probes >= rel->retries )
+						reset = true;
+					else {
+						_wrel_header(probe,WREL_TYPE_PROBE,peer->tx_epoch);
+						_wrel_xmit(rel,peer,probe,sizeof(probe));
+						peer->probes++;
+						peer->probe_ns = now_ns + peer->rto_us * 1000ULL;
+					}
+				}
+				if( !reset && (!next_ns || (peer->probe_ns < next_ns)) )
+					next_ns = peer->probe_ns;
+			}
+
+			if( reset ) {
+				_wrel_tx_reset(rel,peer);
+				_wrel_event(rel,WREL_EVENT_WINDOW);
+			}
+		}
+	}
+
+	rel->next_due_ns = next_ns;
+	wlock_release(&rel->lock);
+
+	if( !next_ns )
+		return -1;
+	return next_ns <= now_ns ? 0 : (int)((next_ns - now_ns + 999999ULL) / 1000000ULL);
+}
+
+/*
+   wrel_status
+
+   Fills list with the state of up to list_size peers, count is set to the
+   number of peers returned.
+*/
+wstatus
+wrel_status(wrel_t rel,wrel_status_t *list,unsigned int list_size,unsigned int *count)
+{
+	char host[48],port[8];
+	wrel_status_t *status;
+	wrel_peer_t *peer;
+	unsigned int i,n = 0;
+	uint32_t room;
+
+	if( !rel || !list || !count ) {
+		dbgprint(MOD_WREL,__func__,"invalid arguments");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	wlock_acquire(&rel->lock);
+
+	for( i = 0 ; i < WREL_BUCKETS ; i++ )
+	{
+		for( peer = rel->buckets[i] ; peer && (n < list_size) ; peer = peer->next )
+		{
+			status = &list[n++];
+			memset(status,0,sizeof(wrel_status_t));
+
+			if( getnameinfo((struct sockaddr*)&peer->addr,peer->addr_len,host,sizeof(host),port,sizeof(port),
+						NI_NUMERICHOST | NI_NUMERICSERV) == 0 )
+				snprintf(status->peer,sizeof(status->peer),"%s %s",host,port);
+
+			status->sent = peer->sent;
+			status->retransmits = peer->retransmits;
+			status->failed = peer->failed;
+			status->received = peer->received;
+			status->duplicates = peer->duplicates;
+			status->dropped = peer->dropped;
+			status->inflight = peer->tx_next - peer->tx_una;
+			room = rel->window - status->inflight;
+			if( WREL_SEQ_LT(peer->tx_limit,peer->tx_next + room) )
+				room = WREL_SEQ_LT(peer->tx_next,peer->tx_limit) ? peer->tx_limit - peer->tx_next : 0;
+			status->window = room;
+			status->srtt_us = peer->srtt_us;
+			status->rto_us = peer->rto_us;
+		}
+	}
+	*count = n;
+
+	wlock_release(&rel->lock);
+	DBGRET_SUCCESS(MOD_WREL);
+}
@@ -0,0 +1,152 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+/*
+   Module Description
+
+   Reliable datagrams, the layer used by UDP wchannels created with the
+   reliable option (see wchannel.h). Messages sent to a peer are delivered
+   to it once and in the order they were sent, lost datagrams are sent
+   again. Each peer (address and port) is independent: a loss towards one
+   of them never delays the messages of the others.
+
+   The module doesn't own a socket, the channel gives it the datagrams it
+   receives (wrel_input) and it sends through a callback (WRELXMITCB). Every
+   message is sent in a datagram with a header:
+
+     DATA:  0xFF, 0x11, 0, 0, epoch (32 bits), seq (32 bits), message
+     ACK:   0xFF, 0x12, 0, 0, epoch, ack, limit (32 bits), sack (64 bits)
+     PROBE: 0xFF, 0x13, 0, 0, epoch
+
+   in network byte order. A datagram that doesn't start with 0xFF and
+   version 1 isn't reliable, it's delivered as it arrived (a text request
+   starts with a digit), so a reliable channel still receives from plain
+   ones.
+
+   Sequence numbers: each message gets the next seq of its peer, starting
+   at 0 in an epoch. The epoch is the clock of the sender in milliseconds
+   when it started sending to the peer, a receiver that sees a newer epoch
+   knows the sender restarted and starts over (the messages of the old one
+   it didn't deliver are dropped).
+
+   Acknowledgements: every DATA is answered with an ACK, ack is the seq of
+   the first message not received yet and the bits of sack tell which of
+   the next 64 were received (bit 0 is ack + 1), so the sender only sends
+   again what is really missing.
+
+   Retransmission: up to window messages may wait for their ACK. Each one
+   is sent again when its timeout expires, the timeout follows the round
+   trip time measured on the messages acknowledged at the first try (RFC
+   6298) and doubles at each retry. A message sent before one the receiver
+   already got (a hole in sack) is sent again right away, once per timeout.
+   After retries sends without ACK the peer is given up: its messages are
+   dropped (counted as failed) and a new epoch starts.
+
+   Flow control: the receiver keeps up to window messages of a peer that
+   weren't delivered yet (arrived out of order or not taken by the
+   application). limit in the ACK is the first seq it has no room for, the
+   sender doesn't go past it (wrel_send returns WSTATUS_AGAIN). When the
+   application takes messages the receiver announces the new limit, a
+   sender stuck at the limit with nothing in flight sends a PROBE to get
+   it again. A peer that answers the PROBEs is kept however long it takes
+   to read, only retries PROBEs without ACK give it up.
+
+   Loss injection: loss percent of the datagrams sent (DATA, ACK and PROBE)
+   are dropped on purpose instead of being sent, to test the recovery on a
+   single host.
+
+   wrel_poll must be called when the time it returned passes, it sends
+   again what is due. The event callback tells the owner when there are
+   messages to deliver (WREL_EVENT_READY, WREL_EVENT_EMPTY when not anymore),
+   when a waiting sender may try again (WREL_EVENT_WINDOW) and when a
+   retransmission is due before the time wrel_poll returned
+   (WREL_EVENT_TIMER). Callbacks run with the lock of the module held and
+   must not call it.
+
+   Every function may be called by any thread.
+*/
+
+#ifndef _WREL_H
+#define _WREL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "posh.h"
+#include "wstatus.h"
+
+#define WREL_WINDOW 64				/* messages in flight and kept per peer, the bits of sack */
+#define WREL_RETRIES 8				/* sends of a message before the peer is given up */
+#define WREL_RTO_INITIAL_MS 100		/* timeout before the first round trip is measured */
+#define WREL_RTO_MIN_MS 5
+#define WREL_RTO_MAX_MS 2000
+#define WREL_PLAIN_MAX 1024			/* datagrams without header waiting to be delivered */
+#define WREL_DATA_SIZE 12			/* header of a DATA datagram */
+#define WREL_MAX_MESSAGE (65507 - WREL_DATA_SIZE)
+#define WREL_PEERSIZE 64
+
+typedef enum _wrel_event_list
+{
+	WREL_EVENT_READY,				/* wrel_deliver has a message */
+	WREL_EVENT_EMPTY,				/* it hasn't anymore */
+	WREL_EVENT_WINDOW,				/* a peer acknowledged or was given up */
+	WREL_EVENT_TIMER				/* call wrel_poll sooner */
+} wrel_event_list;
+
+typedef void (*WRELXMITCB)(void *param,const void *addr,unsigned int addr_len,const void *ptr,unsigned int size);
+typedef void (*WRELEVENTCB)(void *param,wrel_event_list event);
+
+typedef struct _wrel_opt_t
+{
+	unsigned int window;			/* 0 = WREL_WINDOW, at most WREL_WINDOW */
+	unsigned int retries;			/* 0 = WREL_RETRIES */
+	unsigned int loss;				/* percent of the datagrams dropped on purpose */
+	WRELXMITCB xmit_cb;
+	WRELEVENTCB event_cb;			/* optional */
+	void *param;
+} wrel_opt_t;
+
+typedef struct _wrel_status_t
+{
+	char peer[WREL_PEERSIZE];		/* "host port" */
+	unsigned long sent;				/* messages sent to the peer */
+	unsigned long retransmits;
+	unsigned long failed;			/* dropped when the peer was given up */
+	unsigned long received;			/* messages of the peer, duplicates excluded */
+	unsigned long duplicates;
+	unsigned long dropped;			/* datagrams to the peer dropped by loss injection */
+	unsigned int inflight;			/* waiting for the ACK */
+	unsigned int window;			/* more messages the peer accepts now */
+	uint64_t srtt_us;				/* 0 until the first measure */
+	uint64_t rto_us;
+} wrel_status_t;
+
+typedef struct _wrel_t *wrel_t;
+
+wstatus wrel_create(const wrel_opt_t *opt,wrel_t *rel);
+wstatus wrel_destroy(wrel_t rel);
+wstatus wrel_send(wrel_t rel,const void *addr,unsigned int addr_len,const void *ptr,unsigned int size);
+wstatus wrel_input(wrel_t rel,const void *addr,unsigned int addr_len,const void *ptr,unsigned int size);
+wstatus wrel_deliver(wrel_t rel,void **ptr,unsigned int *size);
+bool wrel_ready(wrel_t rel);
+int wrel_poll(wrel_t rel);
+wstatus wrel_status(wrel_t rel,wrel_status_t *list,unsigned int list_size,unsigned int *count);
+
+#endif
+
@@ -43,6 +43,8 @@ const char *wstatus_str(wstatus ws)
 			return "WSTATUS_INVALID_ARGUMENT";
 		case WSTATUS_MOD_UNINITIALIZED:
 			return "WSTATUS_MOD_UNINITIALIZED";
+		case WSTATUS_AGAIN:
+			return "WSTATUS_AGAIN";
 		default:
 			return "(UNKNOW WSTATUS)";
 	}
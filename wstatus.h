@@ -28,7 +28,8 @@ typedef enum _wstatus {
 	WSTATUS_UNIMPLEMENTED,
 	WSTATUS_UNSUPPORTED,
 	WSTATUS_INVALID_ARGUMENT,
-	WSTATUS_MOD_UNINITIALIZED
+	WSTATUS_MOD_UNINITIALIZED,
+	WSTATUS_AGAIN				/* nothing available without waiting, try again later */
 } wstatus;
 
 const char *wstatus_str(wstatus ws);
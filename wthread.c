@@ -119,6 +119,21 @@ wthread_wait(wthread_t thread)
 	return WSTATUS_FAILURE;
 }
 
+/*
+   wthread_is_self
+
+   Returns true if the calling thread is the one given.
+*/
+bool
+wthread_is_self(wthread_t thread)
+{
+#if THREAD_API == 1
+	return pthread_equal(thread,pthread_self()) ? true : false;
+#elif THREAD_API == 2
+	return GetThreadId(thread) == GetCurrentThreadId();
+#endif
+}
+
 /* 
    wthread_exit
 
@@ -21,6 +21,7 @@
 #ifndef _WTHREAD_H
 #define _WTHREAD_H
 
+#include <stdbool.h>
 #include "posh.h"
 
 #if (defined POSH_OS_OSX || defined POSH_OS_LINUX)
@@ -50,6 +51,7 @@ typedef void (*wthread_routine_t)(void *param);
 
 wstatus wthread_create(wthread_routine_t routine,void *param,wthread_t *thread);
 wstatus wthread_wait(wthread_t thread);
+bool wthread_is_self(wthread_t thread);
 
 #endif
 
@@ -0,0 +1,718 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+
+/* syscall and MAP_ANONYMOUS are GNU extensions */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "posh.h"
+#include "wstatus.h"
+#include "debug.h"
+#include "watomic.h"
+#include "wuring.h"
+
+#if defined POSH_OS_LINUX
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+/* the multishot receive is the newest feature used, older headers lack it */
+#if defined __NR_io_uring_setup && defined IORING_RECV_MULTISHOT
+#define WURING_API 1
+#endif
+#endif
+
+struct _wuring_t
+{
+	int fd;
+	unsigned int entries;
+	/* submission ring */
+	void *sq_map;
+	size_t sq_map_size;
+	volatile uint32_t *sq_head;			/* written by the kernel */
+	volatile uint32_t *sq_tail;
+	uint32_t *sq_array;
+	uint32_t sq_mask;
+	uint32_t sqe_tail;					/* entries prepared, published by wuring_submit */
+	void *sqes;
+	size_t sqes_size;
+	/* completion ring */
+	void *cq_map;
+	size_t cq_map_size;
+	volatile uint32_t *cq_head;
+	volatile uint32_t *cq_tail;			/* written by the kernel */
+	uint32_t cq_mask;
+	void *cqes;
+	/* provided buffer ring */
+	void *pbuf_ring;
+	size_t pbuf_ring_size;
+	char *pbuf_data;
+	unsigned int pbuf_count;
+	unsigned int pbuf_size;
+	uint16_t pbuf_group;
+	uint16_t pbuf_tail;
+	/* statistics */
+	unsigned long submits;
+	unsigned long waits;
+	unsigned long completions;
+};
+
+#if WURING_API == 1
+/*
+   _wuring_get_sqe
+
+   Helper function that returns the next free submission entry, cleared, or
+   0 if the submission ring is full (wuring_submit wasn't called).
+*/
+static struct io_uring_sqe *
+_wuring_get_sqe(wuring_t ring)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t index;
+
+	if( ring->sqe_tail - watomic_load_acquire(ring->sq_head) >= ring->entries )
+		return 0;
+
+	index = ring->sqe_tail & ring->sq_mask;
+	sqe = &((struct io_uring_sqe*)ring->sqes)[index];
+	memset(sqe,0,sizeof(struct io_uring_sqe));
+	ring->sq_array[index] = index;
+	ring->sqe_tail++;
+	return sqe;
+}
+
+/*
+   _wuring_enter
+
+   Helper function that publishes the prepared entries and calls io_uring_enter
+   until it doesn't fail with EINTR. The entries the kernel didn't consume yet
+   are submitted again (sq_tail - sq_head).
+*/
+static int
+_wuring_enter(wuring_t ring,unsigned int wait_nr)
+{
+	unsigned int to_submit;
+	int ret;
+
+	watomic_store_release(ring->sq_tail,ring->sqe_tail);
+
+	for(;;)
+	{
+		to_submit = ring->sqe_tail - watomic_load_acquire(ring->sq_head);
+		if( !to_submit && !wait_nr )
+			return 0;
+
+		ret = (int)syscall(__NR_io_uring_enter,ring->fd,to_submit,wait_nr,
+				wait_nr ? IORING_ENTER_GETEVENTS : 0,(void*)0,(size_t)0);
+		if( ret >= 0 ) {
+			if( to_submit )
+				ring->submits++;
+			if( wait_nr )
+				ring->waits++;
+			return ret;
+		}
+
+		if( errno != EINTR )
+			return -errno;
+	}
+}
+
+/*
+   _wuring_unmap
+
+   Helper function that closes the ring and unmaps every region of it.
+*/
+static void
+_wuring_unmap(wuring_t ring)
+{
+	/* closed first so no receive completes into unmapped buffers */
+	if( ring->fd >= 0 )
+		close(ring->fd);
+	if( ring->pbuf_data )
+		munmap(ring->pbuf_data,(size_t)ring->pbuf_count * ring->pbuf_size);
+	if( ring->pbuf_ring )
+		munmap(ring->pbuf_ring,ring->pbuf_ring_size);
+	if( ring->sqes )
+		munmap(ring->sqes,ring->sqes_size);
+	if( ring->cq_map && (ring->cq_map != ring->sq_map) )
+		munmap(ring->cq_map,ring->cq_map_size);
+	if( ring->sq_map )
+		munmap(ring->sq_map,ring->sq_map_size);
+}
+#endif
+
+/*
+   wuring_create
+
+   Creates a ring with room for entries submissions (a power of two, the
+   kernel rounds it up otherwise). Fails when the kernel doesn't support
+   io_uring or it's disabled (kernel.io_uring_disabled, seccomp filters).
+*/
+wstatus
+wuring_create(unsigned int entries,wuring_t *ring)
+{
+#if WURING_API == 1
+	struct io_uring_params params;
+	wuring_t new_ring = 0;
+	char *sq_ptr,*cq_ptr;
+
+	dbgprint(MOD_WURING,__func__,"called with entries=%u, ring=%p",entries,ring);
+
+	if( !ring || !entries || (entries > WURING_MAX_ENTRIES) ) {
+		dbgprint(MOD_WURING,__func__,"invalid arguments (entries=%u, ring=%p)",entries,ring);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	new_ring = (wuring_t)malloc(sizeof(struct _wuring_t));
+	if( !new_ring ) {
+		dbgprint(MOD_WURING,__func__,"malloc failed");
+		goto return_fail;
+	}
+	memset(new_ring,0,sizeof(struct _wuring_t));
+
+	memset(&params,0,sizeof(params));
+	new_ring->fd = (int)syscall(__NR_io_uring_setup,entries,&params);
+	if( new_ring->fd < 0 ) {
+		dbgprint(MOD_WURING,__func__,"io_uring_setup failed (%s)",strerror(errno));
+		goto return_fail;
+	}
+	new_ring->entries = params.sq_entries;
+
+	new_ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	new_ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if( params.features & IORING_FEAT_SINGLE_MMAP ) {
+		if( new_ring->cq_map_size > new_ring->sq_map_size )
+			new_ring->sq_map_size = new_ring->cq_map_size;
+		new_ring->cq_map_size = new_ring->sq_map_size;
+	}
+
+	new_ring->sq_map = mmap(0,new_ring->sq_map_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+			new_ring->fd,IORING_OFF_SQ_RING);
+	if( new_ring->sq_map == MAP_FAILED ) {
+		new_ring->sq_map = 0;
+		dbgprint(MOD_WURING,__func__,"failed to map the submission ring (%s)",strerror(errno));
+		goto return_fail;
+	}
+
+	if( params.features & IORING_FEAT_SINGLE_MMAP )
+		new_ring->cq_map = new_ring->sq_map;
+	else {
+		new_ring->cq_map = mmap(0,new_ring->cq_map_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+				new_ring->fd,IORING_OFF_CQ_RING);
+		if( new_ring->cq_map == MAP_FAILED ) {
+			new_ring->cq_map = 0;
+			dbgprint(MOD_WURING,__func__,"failed to map the completion ring (%s)",strerror(errno));
+			goto return_fail;
+		}
+	}
+
+	new_ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	new_ring->sqes = mmap(0,new_ring->sqes_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+			new_ring->fd,IORING_OFF_SQES);
+	if( new_ring->sqes == MAP_FAILED ) {
+		new_ring->sqes = 0;
+		dbgprint(MOD_WURING,__func__,"failed to map the submission entries (%s)",strerror(errno));
+		goto return_fail;
+	}
+
+	sq_ptr = (char*)new_ring->sq_map;
+	new_ring->sq_head = (volatile uint32_t*)(sq_ptr + params.sq_off.head);
+	new_ring->sq_tail = (volatile uint32_t*)(sq_ptr + params.sq_off.tail);
+	new_ring->sq_mask = *(uint32_t*)(sq_ptr + params.sq_off.ring_mask);
+	new_ring->sq_array = (uint32_t*)(sq_ptr + params.sq_off.array);
+	new_ring->sqe_tail = *new_ring->sq_tail;
+
+	cq_ptr = (char*)new_ring->cq_map;
+	new_ring->cq_head = (volatile uint32_t*)(cq_ptr + params.cq_off.head);
+	new_ring->cq_tail = (volatile uint32_t*)(cq_ptr + params.cq_off.tail);
+	new_ring->cq_mask = *(uint32_t*)(cq_ptr + params.cq_off.ring_mask);
+	new_ring->cqes = (void*)(cq_ptr + params.cq_off.cqes);
+
+	*ring = new_ring;
+	dbgprint(MOD_WURING,__func__,"created ring fd=%d with %u entries",new_ring->fd,new_ring->entries);
+	DBGRET_SUCCESS(MOD_WURING);
+
+return_fail:
+	if( new_ring ) {
+		_wuring_unmap(new_ring);
+		free(new_ring);
+	}
+	DBGRET_FAILURE(MOD_WURING);
+#else
+	dbgprint(MOD_WURING,__func__,"io_uring is not supported in this system");
+	entries = entries;
+	ring = ring;
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wuring_pbuf_register
+
+   Registers a provided buffer ring of count buffers (a power of two) of size
+   bytes with the id group, every buffer is given to the kernel. A ring has
+   at most one provided buffer ring. Fails on kernels older than 5.19.
+*/
+wstatus
+wuring_pbuf_register(wuring_t ring,uint16_t group,unsigned int count,unsigned int size)
+{
+#if WURING_API == 1
+	struct io_uring_buf_reg reg;
+	unsigned int i;
+
+	dbgprint(MOD_WURING,__func__,"called with ring=%p, group=%u, count=%u, size=%u",ring,group,count,size);
+
+	if( !ring || !count || (count > WURING_MAX_BUFFERS) || (count & (count - 1)) || !size ) {
+		dbgprint(MOD_WURING,__func__,"invalid arguments (count=%u, size=%u)",count,size);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	if( ring->pbuf_ring ) {
+		dbgprint(MOD_WURING,__func__,"ring fd=%d has provided buffers already",ring->fd);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	/* the ring of buffer descriptors must be page aligned */
+	ring->pbuf_ring_size = count * sizeof(struct io_uring_buf);
+	ring->pbuf_ring = mmap(0,ring->pbuf_ring_size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if( ring->pbuf_ring == MAP_FAILED ) {
+		ring->pbuf_ring = 0;
+		dbgprint(MOD_WURING,__func__,"failed to map the buffer ring (%s)",strerror(errno));
+		DBGRET_FAILURE(MOD_WURING);
+	}
+
+	ring->pbuf_data = mmap(0,(size_t)count * size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if( ring->pbuf_data == MAP_FAILED ) {
+		ring->pbuf_data = 0;
+		dbgprint(MOD_WURING,__func__,"failed to map %u buffers of %u bytes (%s)",count,size,strerror(errno));
+		goto return_fail;
+	}
+
+	memset(&reg,0,sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->pbuf_ring;
+	reg.ring_entries = count;
+	reg.bgid = group;
+	if( syscall(__NR_io_uring_register,ring->fd,IORING_REGISTER_PBUF_RING,&reg,1) < 0 ) {
+		dbgprint(MOD_WURING,__func__,"failed to register the buffer ring (%s)",strerror(errno));
+		goto return_fail;
+	}
+
+	ring->pbuf_count = count;
+	ring->pbuf_size = size;
+	ring->pbuf_group = group;
+	ring->pbuf_tail = 0;
+
+	for( i = 0 ; i < count ; i++ )
+		wuring_pbuf_return(ring,i);
+
+	DBGRET_SUCCESS(MOD_WURING);
+
+return_fail:
+	if( ring->pbuf_data )
+		munmap(ring->pbuf_data,(size_t)count * size);
+	munmap(ring->pbuf_ring,ring->pbuf_ring_size);
+	ring->pbuf_data = 0;
+	ring->pbuf_ring = 0;
+	DBGRET_FAILURE(MOD_WURING);
+#else
+	ring = ring;
+	group = group;
+	count = count;
+	size = size;
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wuring_pbuf_ptr
+
+   Returns the memory of the provided buffer buf_id, 0 if it doesn't exist.
+*/
+void *
+wuring_pbuf_ptr(wuring_t ring,unsigned int buf_id)
+{
+	if( !ring || !ring->pbuf_data || (buf_id >= ring->pbuf_count) )
+		return 0;
+
+	return ring->pbuf_data + (size_t)buf_id * ring->pbuf_size;
+}
+
+/*
+   wuring_pbuf_return
+
+   Gives the provided buffer buf_id back to the kernel, the buffer must not
+   be used after this.
+*/
+wstatus
+wuring_pbuf_return(wuring_t ring,unsigned int buf_id)
+{
+#if WURING_API == 1
+	struct io_uring_buf_ring *br;
+	struct io_uring_buf *buf;
+
+	if( !ring || !ring->pbuf_ring || (buf_id >= ring->pbuf_count) ) {
+		dbgprint(MOD_WURING,__func__,"invalid arguments (ring=%p, buf_id=%u)",ring,buf_id);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	br = (struct io_uring_buf_ring*)ring->pbuf_ring;
+	buf = &br->bufs[ring->pbuf_tail & (ring->pbuf_count - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(ring->pbuf_data + (size_t)buf_id * ring->pbuf_size);
+	buf->len = ring->pbuf_size;
+	buf->bid = (uint16_t)buf_id;
+	ring->pbuf_tail++;
+
+	/* the descriptor must be visible before the tail that publishes it */
+	watomic_store_release(&br->tail,ring->pbuf_tail);
+	return WSTATUS_SUCCESS;
+#else
+	ring = ring;
+	buf_id = buf_id;
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wuring_prep_recv_multishot
+
+   Queues a multishot receive on the socket fd, every datagram received
+   completes with one of the provided buffers until it fails or runs out of
+   buffers (the completion without more set).
+*/
+wstatus
+wuring_prep_recv_multishot(wuring_t ring,int fd,uint64_t user_data)
+{
+#if WURING_API == 1
+	struct io_uring_sqe *sqe;
+
+	if( !ring || !ring->pbuf_ring || (fd < 0) ) {
+		dbgprint(MOD_WURING,__func__,"invalid arguments (ring=%p, fd=%d)",ring,fd);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	sqe = _wuring_get_sqe(ring);
+	if( !sqe ) {
+		dbgprint(MOD_WURING,__func__,"submission ring fd=%d is full",ring->fd);
+		DBGRET_FAILURE(MOD_WURING);
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = ring->pbuf_group;
+	sqe->user_data = user_data;
+	return WSTATUS_SUCCESS;
+#else
+	ring = ring;
+	fd = fd;
+	user_data = user_data;
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wuring_prep_read
+
+   Queues a read of size bytes from fd into buf, used for an eventfd that
+   wakes the thread waiting for the ring. buf must stay valid until the
+   operation completes.
+*/
+wstatus
+wuring_prep_read(wuring_t ring,int fd,void *buf,unsigned int size,uint64_t user_data)
+{
+#if WURING_API == 1
+	struct io_uring_sqe *sqe;
+
+	if( !ring || !buf || !size || (fd < 0) ) {
+		dbgprint(MOD_WURING,__func__,"invalid arguments (ring=%p, fd=%d, buf=%p, size=%u)",ring,fd,buf,size);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	sqe = _wuring_get_sqe(ring);
+	if( !sqe ) {
+		dbgprint(MOD_WURING,__func__,"submission ring fd=%d is full",ring->fd);
+		DBGRET_FAILURE(MOD_WURING);
+	}
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = size;
+	sqe->off = (uint64_t)-1;			/* current position, eventfds aren't seekable */
+	sqe->user_data = user_data;
+	return WSTATUS_SUCCESS;
+#else
+	ring = ring;
+	fd = fd;
+	buf = buf;
+	size = size;
+	user_data = user_data;
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wuring_prep_sendmsg
+
+   Queues a sendmsg on the socket fd, msg and everything it points to must
+   stay valid until the operation completes. A linked send makes the next
+   operation start after it and fail with -ECANCELED if it fails, so a batch
+   of linked sends stops at the first failure like sendmmsg.
+*/
+wstatus
+wuring_prep_sendmsg(wuring_t ring,int fd,const struct msghdr *msg,bool link,uint64_t user_data)
+{
+#if WURING_API == 1
+	struct io_uring_sqe *sqe;
+
+	if( !ring || !msg || (fd < 0) ) {
+		dbgprint(MOD_WURING,__func__,"invalid arguments (ring=%p, fd=%d, msg=%p)",ring,fd,msg);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	sqe = _wuring_get_sqe(ring);
+	if( !sqe ) {
+		dbgprint(MOD_WURING,__func__,"submission ring fd=%d is full",ring->fd);
+		DBGRET_FAILURE(MOD_WURING);
+	}
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)msg;
+	sqe->len = 1;
+	if( link )
+		sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = user_data;
+	return WSTATUS_SUCCESS;
+#else
+	ring = ring;
+	fd = fd;
+	msg = msg;
+	link = link;
+	user_data = user_data;
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wuring_prep_cancel
+
+   Queues the cancellation of the operation queued with target as user_data
+   (a multishot receive completes then without more set). The kernel only
+   lets go of the descriptor of an operation once it completed, a ring
+   closed with the receive armed keeps the socket (and its port) until the
+   asynchronous teardown of the ring is done.
+*/
+wstatus
+wuring_prep_cancel(wuring_t ring,uint64_t target,uint64_t user_data)
+{
+#if WURING_API == 1
+	struct io_uring_sqe *sqe;
+
+	if( !ring ) {
+		dbgprint(MOD_WURING,__func__,"invalid ring argument (ring=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	sqe = _wuring_get_sqe(ring);
+	if( !sqe ) {
+		dbgprint(MOD_WURING,__func__,"submission ring fd=%d is full",ring->fd);
+		DBGRET_FAILURE(MOD_WURING);
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = user_data;
+	return WSTATUS_SUCCESS;
+#else
+	ring = ring;
+	target = target;
+	user_data = user_data;
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wuring_submit
+
+   Submits every queued operation with a single syscall and waits until at
+   least wait_nr completions are available (0 doesn't wait).
+*/
+wstatus
+wuring_submit(wuring_t ring,unsigned int wait_nr)
+{
+#if WURING_API == 1
+	int ret;
+
+	if( !ring ) {
+		dbgprint(MOD_WURING,__func__,"invalid ring argument (ring=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	ret = _wuring_enter(ring,wait_nr);
+	if( ret < 0 ) {
+		dbgprint(MOD_WURING,__func__,"io_uring_enter failed on ring fd=%d (%s)",ring->fd,strerror(-ret));
+		DBGRET_FAILURE(MOD_WURING);
+	}
+	return WSTATUS_SUCCESS;
+#else
+	ring = ring;
+	wait_nr = wait_nr;
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wuring_peek
+
+   Takes the next completion without waiting, returns false if there's none.
+*/
+bool
+wuring_peek(wuring_t ring,wuring_cqe_t *cqe)
+{
+#if WURING_API == 1
+	struct io_uring_cqe *entry;
+	uint32_t head;
+
+	if( !ring || !cqe )
+		return false;
+
+	head = *ring->cq_head;
+	if( head == watomic_load_acquire(ring->cq_tail) )
+		return false;
+
+	entry = &((struct io_uring_cqe*)ring->cqes)[head & ring->cq_mask];
+	cqe->user_data = entry->user_data;
+	cqe->res = entry->res;
+	cqe->more = (entry->flags & IORING_CQE_F_MORE) != 0;
+	cqe->has_buffer = (entry->flags & IORING_CQE_F_BUFFER) != 0;
+	cqe->buf_id = entry->flags >> IORING_CQE_BUFFER_SHIFT;
+
+	/* the entry was copied, the kernel may reuse it */
+	watomic_store_release(ring->cq_head,head + 1);
+	ring->completions++;
+	return true;
+#else
+	ring = ring;
+	cqe = cqe;
+	return false;
+#endif
+}
+
+/*
+   wuring_wait
+
+   Takes the next completion, submitting the queued operations and waiting
+   for it if there's none yet.
+*/
+wstatus
+wuring_wait(wuring_t ring,wuring_cqe_t *cqe)
+{
+#if WURING_API == 1
+	int ret;
+
+	if( !ring || !cqe ) {
+		dbgprint(MOD_WURING,__func__,"invalid arguments (ring=%p, cqe=%p)",ring,cqe);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	while( !wuring_peek(ring,cqe) )
+	{
+		ret = _wuring_enter(ring,1);
+		if( ret < 0 ) {
+			dbgprint(MOD_WURING,__func__,"io_uring_enter failed on ring fd=%d (%s)",ring->fd,strerror(-ret));
+			DBGRET_FAILURE(MOD_WURING);
+		}
+	}
+	return WSTATUS_SUCCESS;
+#else
+	ring = ring;
+	cqe = cqe;
+	return WSTATUS_UNIMPLEMENTED;
+#endif
+}
+
+/*
+   wuring_status
+
+   Fills status with the configuration and the counters of the ring.
+*/
+wstatus
+wuring_status(wuring_t ring,wuring_status_t *status)
+{
+	if( !ring || !status ) {
+		dbgprint(MOD_WURING,__func__,"invalid arguments (ring=%p, status=%p)",ring,status);
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+	memset(status,0,sizeof(wuring_status_t));
+	status->entries = ring->entries;
+	status->buffers = ring->pbuf_count;
+	status->buffer_size = ring->pbuf_size;
+	status->submits = ring->submits;
+	status->waits = ring->waits;
+	status->completions = ring->completions;
+	return WSTATUS_SUCCESS;
+}
+
+/*
+   wuring_fd
+
+   Returns the descriptor of the ring, -1 if there's none.
+*/
+int
+wuring_fd(wuring_t ring)
+{
+	if( !ring )
+		return -1;
+
+	return ring->fd;
+}
+
+/*
+   wuring_destroy
+
+   Closes the ring, the pending operations are cancelled by the kernel (in
+   the background, see wuring_prep_cancel) and the provided buffers are
+   freed.
+*/
+wstatus
+wuring_destroy(wuring_t ring)
+{
+	dbgprint(MOD_WURING,__func__,"called with ring=%p",ring);
+
+	if( !ring ) {
+		dbgprint(MOD_WURING,__func__,"invalid ring argument (ring=0)");
+		return WSTATUS_INVALID_ARGUMENT;
+	}
+
+#if WURING_API == 1
+	_wuring_unmap(ring);
+#endif
+	free(ring);
+	DBGRET_SUCCESS(MOD_WURING);
+}
@@ -0,0 +1,100 @@
+/*
+	This file is part of wicom.
+
+	wicom is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	wicom is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with wicom.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright (C) 2009 Jean-François Mousinho <jean.mousinho@ist.utl.pt>
+	Centro de Informatica do IST - Universidade Tecnica de Lisboa 
+*/
+/*
+   Module Description
+
+   Thin layer over the Linux io_uring interface, used by wchannel to receive
+   datagrams without a syscall per message (see the URING engine in
+   wchannel.h). Only the operations wchannel needs are wrapped and the
+   rings are set up with the raw syscalls, no library is required.
+
+   A wuring_t is a submission/completion ring pair owned by one thread (or
+   protected by the caller), it may have a provided buffer ring registered
+   (wuring_pbuf_register): count buffers of the same size that the kernel
+   picks from when a receive completes, the completion carries the buffer
+   id. The buffer belongs to the caller until it's given back with
+   wuring_pbuf_return, a multishot receive without buffers left completes
+   with -ENOBUFS and must be armed again.
+
+   Operations are queued with the wuring_prep_* functions and submitted in
+   a single syscall by wuring_submit, which may also wait for completions.
+   wuring_wait returns the next completion, waiting for it if needed. The
+   descriptor of the ring (wuring_fd) polls readable while there are
+   completions, so a ring can be waited for with other descriptors.
+
+   wuring_create fails on kernels without io_uring (or with it disabled),
+   the callers are expected to fall back to the classic syscalls. Kernels
+   older than 6.0 have io_uring but not the multishot receive, that's only
+   known when the first receive completes with -EINVAL.
+
+   Only Linux is supported, elsewhere every function fails.
+*/
+
+#ifndef _WURING_H
+#define _WURING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "posh.h"
+#include "wstatus.h"
+
+#define WURING_MAX_ENTRIES 4096
+#define WURING_MAX_BUFFERS 32768			/* buffer ids are 16 bits, count must be a power of two */
+
+typedef struct _wuring_cqe_t
+{
+	uint64_t user_data;
+	int res;							/* result of the operation, -errno on failure */
+	bool more;							/* a multishot operation is still armed */
+	bool has_buffer;					/* buf_id holds a provided buffer */
+	unsigned int buf_id;
+} wuring_cqe_t;
+
+typedef struct _wuring_status_t
+{
+	unsigned int entries;
+	unsigned int buffers;				/* provided buffers registered */
+	unsigned int buffer_size;
+	unsigned long submits;				/* io_uring_enter calls that submitted */
+	unsigned long waits;				/* io_uring_enter calls that waited */
+	unsigned long completions;
+} wuring_status_t;
+
+typedef struct _wuring_t *wuring_t;
+
+struct msghdr;
+
+wstatus wuring_create(unsigned int entries,wuring_t *ring);
+wstatus wuring_pbuf_register(wuring_t ring,uint16_t group,unsigned int count,unsigned int size);
+void *wuring_pbuf_ptr(wuring_t ring,unsigned int buf_id);
+wstatus wuring_pbuf_return(wuring_t ring,unsigned int buf_id);
+wstatus wuring_prep_recv_multishot(wuring_t ring,int fd,uint64_t user_data);
+wstatus wuring_prep_read(wuring_t ring,int fd,void *buf,unsigned int size,uint64_t user_data);
+wstatus wuring_prep_sendmsg(wuring_t ring,int fd,const struct msghdr *msg,bool link,uint64_t user_data);
+wstatus wuring_prep_cancel(wuring_t ring,uint64_t target,uint64_t user_data);
+wstatus wuring_submit(wuring_t ring,unsigned int wait_nr);
+wstatus wuring_wait(wuring_t ring,wuring_cqe_t *cqe);
+bool wuring_peek(wuring_t ring,wuring_cqe_t *cqe);
+wstatus wuring_status(wuring_t ring,wuring_status_t *status);
+int wuring_fd(wuring_t ring);
+wstatus wuring_destroy(wuring_t ring);
+
+#endif
+